@@ -0,0 +1,680 @@
+/**
+ * @file winfsp/coro.hpp
+ * WinFsp C++20 Coroutine Layer.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_CORO_HPP_INCLUDED
+#define WINFSP_CORO_HPP_INCLUDED
+
+#include <winfsp/winfsp.hpp>
+
+#if !defined(__cpp_impl_coroutine)
+#error this header requires a C++20 compiler with coroutine support
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <utility>
+
+namespace Fsp {
+
+/*
+ * Task
+ *
+ * A lazily started coroutine that produces a value of type T. A Task starts running when it
+ * is awaited and resumes its awaiter when it completes.
+ */
+template <typename T>
+class Task;
+
+namespace Detail {
+
+class TaskPromiseBase
+{
+public:
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> Handle) noexcept
+        {
+            TaskPromiseBase &Promise = Handle.promise();
+            if (Promise._Continuation)
+                return Promise._Continuation;
+            if (0 != Promise._Completion)
+                /* the completion routine may destroy the coroutine */
+                Promise._Completion(Promise._CompletionContext);
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return std::suspend_always();
+    }
+    FinalAwaiter final_suspend() noexcept
+    {
+        return FinalAwaiter();
+    }
+    void unhandled_exception() noexcept
+    {
+        _Exception = std::current_exception();
+    }
+    VOID SetContinuation(std::coroutine_handle<> Continuation)
+    {
+        _Continuation = Continuation;
+    }
+    VOID SetCompletion(VOID (*Completion)(PVOID), PVOID CompletionContext)
+    {
+        _Completion = Completion;
+        _CompletionContext = CompletionContext;
+    }
+
+protected:
+    VOID RethrowIfException()
+    {
+        if (_Exception)
+            std::rethrow_exception(_Exception);
+    }
+
+private:
+    std::coroutine_handle<> _Continuation;
+    VOID (*_Completion)(PVOID) = 0;
+    PVOID _CompletionContext = 0;
+    std::exception_ptr _Exception;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object() noexcept;
+    void return_value(T Value)
+    {
+        _Value = std::move(Value);
+    }
+    T Result()
+    {
+        RethrowIfException();
+        return std::move(_Value);
+    }
+
+private:
+    T _Value{};
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept
+    {
+    }
+    void Result()
+    {
+        RethrowIfException();
+    }
+};
+
+}
+
+template <typename T>
+class Task
+{
+public:
+    typedef Detail::TaskPromise<T> promise_type;
+
+public:
+    Task() : _Handle()
+    {
+    }
+    explicit Task(std::coroutine_handle<promise_type> Handle) : _Handle(Handle)
+    {
+    }
+    Task(Task &&Other) noexcept : _Handle(std::exchange(Other._Handle, nullptr))
+    {
+    }
+    Task &operator=(Task &&Other) noexcept
+    {
+        if (this != &Other)
+        {
+            if (_Handle)
+                _Handle.destroy();
+            _Handle = std::exchange(Other._Handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (_Handle)
+            _Handle.destroy();
+    }
+
+    /* awaitable */
+    bool await_ready() const noexcept
+    {
+        return !_Handle || _Handle.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> Continuation) noexcept
+    {
+        _Handle.promise().SetContinuation(Continuation);
+        return _Handle;
+    }
+    T await_resume()
+    {
+        return _Handle.promise().Result();
+    }
+
+    /* low-level control; used when a Task is not awaited by another coroutine */
+    BOOLEAN IsValid() const
+    {
+        return !!_Handle;
+    }
+    BOOLEAN IsDone() const
+    {
+        return _Handle.done();
+    }
+    VOID SetCompletion(VOID (*Completion)(PVOID), PVOID CompletionContext)
+    {
+        _Handle.promise().SetCompletion(Completion, CompletionContext);
+    }
+    VOID Start()
+    {
+        _Handle.resume();
+    }
+    T Result()
+    {
+        return _Handle.promise().Result();
+    }
+
+private:
+    std::coroutine_handle<promise_type> _Handle;
+
+private:
+    /* disallow copy and assignment */
+    Task(const Task &);
+    Task &operator=(const Task &);
+};
+
+namespace Detail {
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}
+
+/*
+ * Executor
+ *
+ * Resumes coroutines on a thread pool. Dispatcher threads spend their time blocked in the FSD
+ * waiting for requests and cannot be handed work, so coroutines that suspend in a
+ * CoroutineFileSystemBase operation are resumed on the executor's threads instead. By default
+ * the process thread pool is used; a private pool with a bounded number of threads may be
+ * requested at construction.
+ */
+class Executor
+{
+public:
+    class ScheduleAwaiter
+    {
+    public:
+        ScheduleAwaiter(Executor *Owner) : _Executor(Owner)
+        {
+        }
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> Handle) noexcept
+        {
+            /* if the work cannot be submitted continue on the current thread */
+            return !!_Executor->Post(Handle);
+        }
+        void await_resume() noexcept
+        {
+        }
+    private:
+        Executor *_Executor;
+    };
+    class DelayAwaiter
+    {
+    public:
+        DelayAwaiter(Executor *Owner, ULONG Milliseconds) :
+            _Executor(Owner), _Milliseconds(Milliseconds)
+        {
+        }
+        bool await_ready() noexcept
+        {
+            return 0 == _Milliseconds;
+        }
+        bool await_suspend(std::coroutine_handle<> Handle) noexcept
+        {
+            PTP_TIMER Timer = CreateThreadpoolTimer(TimerCallback,
+                Handle.address(), _Executor->Environment());
+            if (0 == Timer)
+                return false;
+            LARGE_INTEGER DueTime;
+            FILETIME FileTime;
+            DueTime.QuadPart = -(LONGLONG)_Milliseconds * 10000;
+            FileTime.dwLowDateTime = DueTime.LowPart;
+            FileTime.dwHighDateTime = DueTime.HighPart;
+            SetThreadpoolTimer(Timer, &FileTime, 0, 0);
+            return true;
+        }
+        void await_resume() noexcept
+        {
+        }
+    private:
+        static VOID CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE Instance,
+            PVOID Context, PTP_TIMER Timer)
+        {
+            CloseThreadpoolTimer(Timer);
+            std::coroutine_handle<>::from_address(Context).resume();
+        }
+        Executor *_Executor;
+        ULONG _Milliseconds;
+    };
+    class WaitAwaiter
+    {
+    public:
+        WaitAwaiter(Executor *Owner, HANDLE Handle) :
+            _Executor(Owner), _Handle(Handle)
+        {
+        }
+        bool await_ready() noexcept
+        {
+            return WAIT_OBJECT_0 == WaitForSingleObject(_Handle, 0);
+        }
+        bool await_suspend(std::coroutine_handle<> Handle) noexcept
+        {
+            PTP_WAIT Wait = CreateThreadpoolWait(WaitCallback,
+                Handle.address(), _Executor->Environment());
+            if (0 == Wait)
+            {
+                WaitForSingleObject(_Handle, INFINITE);
+                return false;
+            }
+            SetThreadpoolWait(Wait, _Handle, 0);
+            return true;
+        }
+        void await_resume() noexcept
+        {
+        }
+    private:
+        static VOID CALLBACK WaitCallback(PTP_CALLBACK_INSTANCE Instance,
+            PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult)
+        {
+            CloseThreadpoolWait(Wait);
+            std::coroutine_handle<>::from_address(Context).resume();
+        }
+        Executor *_Executor;
+        HANDLE _Handle;
+    };
+
+public:
+    Executor(ULONG ThreadCountMin = 0, ULONG ThreadCountMax = 0) :
+        _Pool(0)
+    {
+        InitializeThreadpoolEnvironment(&_Environment);
+        if (0 != ThreadCountMax)
+        {
+            _Pool = CreateThreadpool(0);
+            if (0 != _Pool)
+            {
+                SetThreadpoolThreadMaximum(_Pool, ThreadCountMax);
+                SetThreadpoolThreadMinimum(_Pool, ThreadCountMin);
+                SetThreadpoolCallbackPool(&_Environment, _Pool);
+            }
+        }
+    }
+    virtual ~Executor()
+    {
+        /* the pool is released once its outstanding timers and waits are gone */
+        if (0 != _Pool)
+            CloseThreadpool(_Pool);
+        DestroyThreadpoolEnvironment(&_Environment);
+    }
+
+    /* awaitables */
+    ScheduleAwaiter Schedule()
+    {
+        return ScheduleAwaiter(this);
+    }
+    DelayAwaiter Delay(ULONG Milliseconds)
+    {
+        return DelayAwaiter(this, Milliseconds);
+    }
+    WaitAwaiter Wait(HANDLE Handle)
+    {
+        return WaitAwaiter(this, Handle);
+    }
+
+    /* helpers */
+    BOOLEAN Post(std::coroutine_handle<> Handle)
+    {
+        return !!TrySubmitThreadpoolCallback(PostCallback, Handle.address(), &_Environment);
+    }
+    PTP_CALLBACK_ENVIRON Environment()
+    {
+        return &_Environment;
+    }
+
+private:
+    static VOID CALLBACK PostCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+    {
+        std::coroutine_handle<>::from_address(Context).resume();
+    }
+
+private:
+    TP_CALLBACK_ENVIRON _Environment;
+    PTP_POOL _Pool;
+
+private:
+    /* disallow copy and assignment */
+    Executor(const Executor &);
+    Executor &operator=(const Executor &);
+};
+
+/*
+ * CoroutineFileSystemBase
+ *
+ * A FileSystemBase whose Read, Write and ReadDirectory operations are coroutines. These are
+ * the operations that the dispatcher allows to complete asynchronously. An operation starts
+ * on the dispatcher thread; if it suspends (for example to await backend I/O) the dispatcher
+ * thread returns to the FSD and the response is sent when the coroutine completes.
+ *
+ * Note that the operation guard (see FileSystemHost::Mount Synchronized) only covers the
+ * part of an operation that runs before its first suspension.
+ */
+class CoroutineFileSystemBase : public FileSystemBase
+{
+public:
+    CoroutineFileSystemBase() : FileSystemBase()
+    {
+    }
+
+    /* coroutine operations */
+    virtual Task<NTSTATUS> ReadAsync(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PVOID Buffer,
+        UINT64 Offset,
+        ULONG Length,
+        PULONG PBytesTransferred)
+    {
+        co_return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    virtual Task<NTSTATUS> WriteAsync(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PVOID Buffer,
+        UINT64 Offset,
+        ULONG Length,
+        BOOLEAN WriteToEndOfFile,
+        BOOLEAN ConstrainedIo,
+        PULONG PBytesTransferred,
+        FileInfo *FileInfo)
+    {
+        co_return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    virtual Task<NTSTATUS> ReadDirectoryAsync(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PWSTR Pattern,
+        PWSTR Marker,
+        PVOID Buffer,
+        ULONG Length,
+        PULONG PBytesTransferred)
+    {
+        co_return SeekableReadDirectory(
+            FileNode,
+            FileDesc,
+            Pattern,
+            Marker,
+            Buffer,
+            Length,
+            PBytesTransferred);
+    }
+
+    /* operations */
+    NTSTATUS Read(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PVOID Buffer,
+        UINT64 Offset,
+        ULONG Length,
+        PULONG PBytesTransferred)
+    {
+        Operation *Op = new Operation(this);
+        Op->Coroutine = ReadAsync(
+            FileNode,
+            FileDesc,
+            Buffer,
+            Offset,
+            Length,
+            &Op->BytesTransferred);
+        return StartOperation(Op, PBytesTransferred, 0);
+    }
+    NTSTATUS Write(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PVOID Buffer,
+        UINT64 Offset,
+        ULONG Length,
+        BOOLEAN WriteToEndOfFile,
+        BOOLEAN ConstrainedIo,
+        PULONG PBytesTransferred,
+        FileInfo *FileInfo)
+    {
+        Operation *Op = new Operation(this);
+        Op->Coroutine = WriteAsync(
+            FileNode,
+            FileDesc,
+            Buffer,
+            Offset,
+            Length,
+            WriteToEndOfFile,
+            ConstrainedIo,
+            &Op->BytesTransferred,
+            &Op->FileInfo);
+        return StartOperation(Op, PBytesTransferred, FileInfo);
+    }
+    NTSTATUS ReadDirectory(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PWSTR Pattern,
+        PWSTR Marker,
+        PVOID Buffer,
+        ULONG Length,
+        PULONG PBytesTransferred)
+    {
+        /* Pattern and Marker live in the request buffer, which is reused once we return */
+        Operation *Op = new Operation(this);
+        if (0 != Pattern)
+            Op->Pattern = Pattern;
+        if (0 != Marker)
+            Op->Marker = Marker;
+        Op->Coroutine = ReadDirectoryAsync(
+            FileNode,
+            FileDesc,
+            0 != Pattern ? &Op->Pattern[0] : 0,
+            0 != Marker ? &Op->Marker[0] : 0,
+            Buffer,
+            Length,
+            &Op->BytesTransferred);
+        return StartOperation(Op, PBytesTransferred, 0);
+    }
+
+private:
+    struct OperationWaiter
+    {
+        HANDLE Event;
+        NTSTATUS Result;
+        std::exception_ptr Exception;
+        ULONG BytesTransferred;
+        FileSystemBase::FileInfo FileInfo;
+    };
+    struct Operation
+    {
+        Operation(CoroutineFileSystemBase *Self) :
+            Self(Self), BytesTransferred(0), FileInfo(), Waiter(0)
+        {
+        }
+        CoroutineFileSystemBase *Self;
+        AsyncResponse Response;
+        Fsp::Task<NTSTATUS> Coroutine;
+        ULONG BytesTransferred;
+        FileSystemBase::FileInfo FileInfo;
+        std::wstring Pattern, Marker;
+        OperationWaiter *Waiter;        /* set when the request cannot be pended */
+    };
+    NTSTATUS StartOperation(Operation *Op, PULONG PBytesTransferred, FileInfo *FileInfo)
+    {
+        /*
+         * If the coroutine completes before Start returns, OperationCompleted runs on this
+         * thread from within Start and leaves the operation for us to finish. Otherwise it
+         * runs on an executor thread once the coroutine completes and finishes the operation
+         * itself: it sends the response or, if the request could not be pended, hands the
+         * outcome to our Waiter. Either way the Op is destroyed by the side that finishes,
+         * and only after the coroutine has reached its final suspension point.
+         */
+        OperationWaiter Waiter = {};
+        Operation *StartingOperation = _StartingOperation;
+        BOOLEAN CompletedSynchronously;
+        try
+        {
+            Op->Response = PendResponse();
+            if (!Op->Response.IsValid())
+            {
+                /* cannot pend this request: wait for the coroutine to complete */
+                Waiter.Event = CreateEventW(0, TRUE, FALSE, 0);
+                if (0 == Waiter.Event)
+                {
+                    delete Op;
+                    return NtStatusFromWin32(GetLastError());
+                }
+                Op->Waiter = &Waiter;
+            }
+            Op->Coroutine.SetCompletion(OperationCompleted, Op);
+            _StartingOperation = Op;
+            Op->Coroutine.Start();
+        }
+        catch (...)
+        {
+            _StartingOperation = StartingOperation;
+            if (0 != Waiter.Event)
+                CloseHandle(Waiter.Event);
+            delete Op;
+            throw;
+        }
+        /* OperationCompleted clears _StartingOperation when it runs from within Start */
+        CompletedSynchronously = 0 == _StartingOperation;
+        _StartingOperation = StartingOperation;
+        if (CompletedSynchronously)
+            FinishOperation(Op, &Waiter);
+        else if (0 == Waiter.Event)
+            /* the Op may already be gone; do not touch it */
+            return STATUS_PENDING;
+        else
+            WaitForSingleObject(Waiter.Event, INFINITE);
+        if (0 != Waiter.Event)
+            CloseHandle(Waiter.Event);
+        if (Waiter.Exception)
+            std::rethrow_exception(Waiter.Exception);
+        *PBytesTransferred = Waiter.BytesTransferred;
+        if (0 != FileInfo)
+            *FileInfo = Waiter.FileInfo;
+        return Waiter.Result;
+    }
+    static VOID FinishOperation(Operation *Op, OperationWaiter *Waiter)
+    {
+        /* move the outcome of a completed coroutine into the Waiter and destroy the Op */
+        try
+        {
+            Waiter->Result = Op->Coroutine.Result();
+        }
+        catch (...)
+        {
+            Waiter->Exception = std::current_exception();
+        }
+        Waiter->BytesTransferred = Op->BytesTransferred;
+        Waiter->FileInfo = Op->FileInfo;
+        delete Op;
+    }
+    static VOID OperationCompleted(PVOID Context)
+    {
+        Operation *Op = (Operation *)Context;
+        OperationWaiter *Waiter = Op->Waiter;
+        NTSTATUS Result;
+        if (Op == _StartingOperation)
+        {
+            /* synchronous completion; StartOperation finishes once Start has returned */
+            _StartingOperation = 0;
+            return;
+        }
+        if (0 != Waiter)
+        {
+            /*
+             * Destroy the coroutine (we are called from its final suspension point) before
+             * we wake the dispatcher thread, which owns the Waiter. Signaling the Event is
+             * the last thing we do.
+             */
+            FinishOperation(Op, Waiter);
+            SetEvent(Waiter->Event);
+            return;
+        }
+        try
+        {
+            Result = Op->Coroutine.Result();
+        }
+        catch (...)
+        {
+            try
+            {
+                Result = Op->Self->ExceptionHandler();
+            }
+            catch (...)
+            {
+                Result = STATUS_UNEXPECTED_IO_ERROR;
+            }
+        }
+        Op->Response.Complete(Result, Op->BytesTransferred, &Op->FileInfo);
+        /* destroys the coroutine; we are called from its final suspension point */
+        delete Op;
+    }
+
+    /* the operation whose coroutine is being started on this thread, if any */
+    static inline thread_local Operation *_StartingOperation = 0;
+};
+
+}
+
+#endif
@@ -59,6 +59,10 @@ extern const __declspec(selectany) GUID FspFsvrtDeviceClassGuid =
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 't', METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
 #define FSP_FSCTL_STOP                  \
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'S', METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSP_FSCTL_TRANSACT_RING_SETUP   \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'r', METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSP_FSCTL_TRANSACT_RING         \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'R', METHOD_BUFFERED, FILE_ANY_ACCESS)
 
 #define FSP_FSCTL_VOLUME_PARAMS_PREFIX  "\\VolumeParams="
 
@@ -77,6 +81,10 @@ FSP_FSCTL_STATIC_ASSERT(FSP_FSCTL_VOLUME_NAME_SIZEMAX <= 260 * sizeof(WCHAR),
 #define FSP_FSCTL_TRANSACT_RSP_BUFFER_SIZEMAX   (FSP_FSCTL_TRANSACT_RSP_SIZEMAX - sizeof(FSP_FSCTL_TRANSACT_RSP))
 #define FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN (64 * 1024)
 #define FSP_FSCTL_TRANSACT_BUFFER_SIZEMIN       FSP_FSCTL_TRANSACT_REQ_SIZEMAX
+#define FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MIN   16
+#define FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MAX   256
+#define FSP_FSCTL_TRANSACT_RING_SLOT_SIZE       (FSP_FSCTL_TRANSACT_RSP_SIZEMAX + 64)
+#define FSP_FSCTL_TRANSACT_RING_RETRY_MAX       64
 
 #define FSP_FSCTL_TRANSACT_REQ_TOKEN_HANDLE(T)  ((HANDLE)((T) & 0xffffffff))
 #define FSP_FSCTL_TRANSACT_REQ_TOKEN_PID(T)     ((UINT32)(((T) >> 32) & 0xffffffff))
@@ -122,10 +130,19 @@ enum
     FspFsctlIrpCapacityMinimum = 100,
     FspFsctlIrpCapacityMaximum = 1000,
     FspFsctlIrpCapacityDefault = 1000,
+    FspFsctlMetaCacheCapacityMinimum = 100,
+    FspFsctlMetaCacheCapacityMaximum = 100000,
+    FspFsctlMetaCacheCapacityDefault = 100,
+    FspFsctlDirInfoCacheSizeMaxMinimum = 16384,
+    FspFsctlDirInfoCacheSizeMaxMaximum = 64 * 1024 * 1024,
+    FspFsctlDirInfoCacheSizeMaxDefault = 16384,
+    FspFsctlNegativeNameCacheCapacityMinimum = 100,
+    FspFsctlNegativeNameCacheCapacityMaximum = 100000,
+    FspFsctlNegativeNameCacheCapacityDefault = 1000,
 };
 typedef struct
 {
-    UINT16 Version;                     /* set to 0 */
+    UINT16 Version;                     /* set to 0 or sizeof(FSP_FSCTL_VOLUME_PARAMS) */
     /* volume information */
     UINT16 SectorSize;
     UINT16 SectorsPerAllocationUnit;
@@ -152,14 +169,69 @@ typedef struct
     UINT32 PostCleanupWhenModifiedOnly:1;   /* post Cleanup when a file was modified/deleted */
     UINT32 PassQueryDirectoryPattern:1;     /* pass Pattern during QueryDirectory operations */
     UINT32 AlwaysUseDoubleBuffering:1;
-    UINT32 KmReservedFlags:3;
+    UINT32 BatchCloseRequests:1;        /* coalesce Close requests into multi-context requests */
+    UINT32 DelayCloseRequests:1;        /* hold back Close requests to satisfy reopens */
+    UINT32 KmReservedFlags:1;
     /* user-mode flags */
     UINT32 UmFileContextIsUserContext2:1;   /* user mode: FileContext parameter is UserContext2 */
     UINT32 UmFileContextIsFullContext:1;    /* user mode: FileContext parameter is FullContext */
     UINT32 UmReservedFlags:14;
     WCHAR Prefix[FSP_FSCTL_VOLUME_PREFIX_SIZE / sizeof(WCHAR)]; /* UNC prefix (\Server\Share) */
     WCHAR FileSystemName[FSP_FSCTL_VOLUME_FSNAME_SIZE / sizeof(WCHAR)];
+    /* fields below are only used when Version is sizeof(FSP_FSCTL_VOLUME_PARAMS) */
+    /* meta cache capacities */
+    UINT32 SecurityCacheCapacity;       /* maximum number of cached security descriptors (100 - 100000) */
+    UINT32 DirInfoCacheCapacity;        /* maximum number of cached directory listings (100 - 100000) */
+    UINT32 StreamInfoCacheCapacity;     /* maximum number of cached stream listings (100 - 100000) */
+    UINT32 DirInfoCacheSizeMax;         /* maximum size of a cached directory listing (bytes; 16K - 64M) */
+    UINT32 NegativeNameCacheCapacity;   /* maximum number of cached nonexistent names (100 - 100000) */
 } FSP_FSCTL_VOLUME_PARAMS;
+/* size of the original (Version 0) FSP_FSCTL_VOLUME_PARAMS */
+#define FSP_FSCTL_VOLUME_PARAMS_V0_SIZE FIELD_OFFSET(FSP_FSCTL_VOLUME_PARAMS, SecurityCacheCapacity)
+FSP_FSCTL_STATIC_ASSERT(456 == FSP_FSCTL_VOLUME_PARAMS_V0_SIZE,
+    "FSP_FSCTL_VOLUME_PARAMS Version 0 layout must not change.");
+/*
+ * FSCTL_FILESYSTEM_GET_STATISTICS returns one record per processor. Each record is
+ * a FILESYSTEM_STATISTICS followed by a FAT_STATISTICS and an FSP_FSCTL_STATISTICS;
+ * its size is FILESYSTEM_STATISTICS::SizeOfCompleteStructure. Counters that are kept
+ * per volume rather than per processor are reported in the first record only, so
+ * totals are obtained by summing all records. All counters are UINT64.
+ */
+typedef struct
+{
+    UINT64 Allocates, Misses;
+} FSP_FSCTL_POOL_CACHE_STATISTICS;
+typedef struct
+{
+    UINT64 Hits, Misses, Inserts, Evictions;
+} FSP_FSCTL_CACHE_STATISTICS;
+typedef struct
+{
+    UINT64 Closes;                      /* Closes added to a batch */
+    UINT64 Requests;                    /* batched Close requests posted */
+} FSP_FSCTL_CLOSE_BATCH_STATISTICS;
+typedef struct
+{
+    UINT64 ItemCount;
+    UINT64 Hits, Misses, Evictions, Shares;
+} FSP_FSCTL_META_CACHE_STATISTICS;
+typedef struct
+{
+    UINT64 ItemCount;
+    UINT64 Hits, Misses, Inserts, Evictions, Invalidations;
+} FSP_FSCTL_NEGATIVE_NAME_CACHE_STATISTICS;
+typedef struct
+{
+    FSP_FSCTL_POOL_CACHE_STATISTICS PoolCache[3];   /* request, work item, response; driver wide */
+    FSP_FSCTL_CACHE_STATISTICS CloseCache;
+    FSP_FSCTL_CLOSE_BATCH_STATISTICS CloseBatch;
+    FSP_FSCTL_META_CACHE_STATISTICS SecurityCache;  /* per volume */
+    FSP_FSCTL_META_CACHE_STATISTICS DirInfoCache;   /* per volume */
+    FSP_FSCTL_META_CACHE_STATISTICS StreamInfoCache;/* per volume */
+    FSP_FSCTL_NEGATIVE_NAME_CACHE_STATISTICS NegativeNameCache;    /* per volume */
+} FSP_FSCTL_STATISTICS;
+FSP_FSCTL_STATIC_ASSERT(0 == sizeof(FSP_FSCTL_STATISTICS) % sizeof(UINT64),
+    "FSP_FSCTL_STATISTICS must consist of UINT64 counters only.");
 typedef struct
 {
     UINT64 TotalSize;
@@ -263,6 +335,7 @@ typedef struct
         {
             UINT64 UserContext;
             UINT64 UserContext2;
+            FSP_FSCTL_TRANSACT_BUF Contexts;    /* FSP_FSCTL_TRANSACT_FULL_CONTEXT[] of more closed files */
         } Close;
         struct
         {
@@ -501,6 +574,175 @@ static inline FSP_FSCTL_TRANSACT_RSP *FspFsctlTransactConsumeResponse(
     return NextResponse <= ResponseBufEnd ? (FSP_FSCTL_TRANSACT_RSP *)NextResponse : 0;
 }
 
+/*
+ * Transact ring
+ *
+ * A transact ring is a memory area that is shared between the user-mode file system
+ * and the FSD. It contains two bounded multi-producer/multi-consumer queues: a request
+ * queue (produced by the FSD, consumed by the file system) and a response queue (produced
+ * by the file system, consumed by the FSD). Each queue slot is large enough to hold a
+ * single request or response, which retains the usual FSP_FSCTL_TRANSACT_{REQ,RSP} framing.
+ *
+ * Every slot has a Sequence number that determines its state: a slot at Position is
+ * free for producers when its Sequence == Position and ready for consumers when its
+ * Sequence == Position + 1. Producers and consumers claim a slot by advancing the queue
+ * Tail or Head, fill or read it in place and then publish it by updating its Sequence.
+ *
+ * The ring is not trusted by the FSD: the FSD always uses the SlotCount it was given
+ * during setup and validates everything it reads from the ring.
+ */
+#pragma warning(push)
+#pragma warning(disable:4200)           /* zero-sized array in struct/union */
+enum
+{
+    FspFsctlTransactRingRequestQueue    = 0,
+    FspFsctlTransactRingResponseQueue   = 1,
+};
+typedef struct
+{
+    UINT64 RingAddress;                 /* FSP_FSCTL_TRANSACT_RING_SETUP only */
+    UINT32 SlotCount;                   /* FSP_FSCTL_TRANSACT_RING_SETUP only */
+    UINT32 Wait:1;                      /* FSP_FSCTL_TRANSACT_RING only */
+} FSP_FSCTL_TRANSACT_RING_PARAMS;
+typedef struct
+{
+    volatile LONG Sequence;
+    UINT32 Reserved;
+    FSP_FSCTL_DECLSPEC_ALIGN UINT8 Buffer[];
+} FSP_FSCTL_TRANSACT_RING_SLOT;
+typedef struct
+{
+    volatile LONG Head;
+    UINT8 HeadPadding[60];
+    volatile LONG Tail;
+    UINT8 TailPadding[60];
+} FSP_FSCTL_TRANSACT_RING_QUEUE;
+typedef struct
+{
+    UINT16 Version;
+    UINT16 Reserved;
+    UINT32 SlotCount;
+    UINT8 Padding[56];
+    FSP_FSCTL_TRANSACT_RING_QUEUE Queue[2];
+    FSP_FSCTL_DECLSPEC_ALIGN UINT8 Slots[];
+} FSP_FSCTL_TRANSACT_RING;
+#pragma warning(pop)
+FSP_FSCTL_STATIC_ASSERT(320 == sizeof(FSP_FSCTL_TRANSACT_RING),
+    "sizeof(FSP_FSCTL_TRANSACT_RING) must be exactly 320.");
+static inline SIZE_T FspFsctlTransactRingSize(UINT32 SlotCount)
+{
+    return sizeof(FSP_FSCTL_TRANSACT_RING) + 2 * (SIZE_T)SlotCount * FSP_FSCTL_TRANSACT_RING_SLOT_SIZE;
+}
+static inline BOOLEAN FspFsctlTransactRingValidSlotCount(UINT32 SlotCount)
+{
+    return FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MIN <= SlotCount &&
+        FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MAX >= SlotCount &&
+        0 == (SlotCount & (SlotCount - 1));
+}
+static inline VOID FspFsctlTransactRingInitialize(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount)
+{
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot;
+    Ring->Version = sizeof(FSP_FSCTL_TRANSACT_RING);
+    Ring->Reserved = 0;
+    Ring->SlotCount = SlotCount;
+    for (ULONG QueueIndex = 0; 2 > QueueIndex; QueueIndex++)
+    {
+        Ring->Queue[QueueIndex].Head = 0;
+        Ring->Queue[QueueIndex].Tail = 0;
+        for (UINT32 Position = 0; SlotCount > Position; Position++)
+        {
+            Slot = (FSP_FSCTL_TRANSACT_RING_SLOT *)(Ring->Slots +
+                ((SIZE_T)QueueIndex * SlotCount + Position) * FSP_FSCTL_TRANSACT_RING_SLOT_SIZE);
+            Slot->Sequence = (LONG)Position;
+            Slot->Reserved = 0;
+        }
+    }
+}
+static inline FSP_FSCTL_TRANSACT_RING_SLOT *FspFsctlTransactRingSlot(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex, LONG Position)
+{
+    return (FSP_FSCTL_TRANSACT_RING_SLOT *)(Ring->Slots +
+        ((SIZE_T)(QueueIndex & 1) * SlotCount + ((ULONG)Position & (SlotCount - 1))) *
+            FSP_FSCTL_TRANSACT_RING_SLOT_SIZE);
+}
+static inline BOOLEAN FspFsctlTransactRingCanProduce(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex)
+{
+    LONG Position = Ring->Queue[QueueIndex & 1].Tail;
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot = FspFsctlTransactRingSlot(Ring, SlotCount, QueueIndex, Position);
+    return Slot->Sequence == Position;
+}
+static inline BOOLEAN FspFsctlTransactRingCanConsume(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex)
+{
+    LONG Position = Ring->Queue[QueueIndex & 1].Head;
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot = FspFsctlTransactRingSlot(Ring, SlotCount, QueueIndex, Position);
+    return Slot->Sequence == (LONG)((ULONG)Position + 1);
+}
+static inline PVOID FspFsctlTransactRingProduceBegin(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex, PLONG PPosition)
+{
+    FSP_FSCTL_TRANSACT_RING_QUEUE *Queue = &Ring->Queue[QueueIndex & 1];
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot;
+    LONG Position, Difference;
+    for (ULONG Retry = 0; FSP_FSCTL_TRANSACT_RING_RETRY_MAX > Retry; Retry++)
+    {
+        Position = Queue->Tail;
+        Slot = FspFsctlTransactRingSlot(Ring, SlotCount, QueueIndex, Position);
+        Difference = (LONG)((ULONG)Slot->Sequence - (ULONG)Position);
+        if (0 == Difference)
+        {
+            if (Position == InterlockedCompareExchange(&Queue->Tail,
+                (LONG)((ULONG)Position + 1), Position))
+            {
+                *PPosition = Position;
+                return Slot->Buffer;
+            }
+        }
+        else if (0 > Difference)
+            break;                      /* queue is full */
+    }
+    return 0;
+}
+static inline VOID FspFsctlTransactRingProduceEnd(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex, LONG Position)
+{
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot = FspFsctlTransactRingSlot(Ring, SlotCount, QueueIndex, Position);
+    InterlockedExchange(&Slot->Sequence, (LONG)((ULONG)Position + 1));
+}
+static inline PVOID FspFsctlTransactRingConsumeBegin(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex, PLONG PPosition)
+{
+    FSP_FSCTL_TRANSACT_RING_QUEUE *Queue = &Ring->Queue[QueueIndex & 1];
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot;
+    LONG Position, Difference;
+    for (ULONG Retry = 0; FSP_FSCTL_TRANSACT_RING_RETRY_MAX > Retry; Retry++)
+    {
+        Position = Queue->Head;
+        Slot = FspFsctlTransactRingSlot(Ring, SlotCount, QueueIndex, Position);
+        Difference = (LONG)((ULONG)Slot->Sequence - ((ULONG)Position + 1));
+        if (0 == Difference)
+        {
+            if (Position == InterlockedCompareExchange(&Queue->Head,
+                (LONG)((ULONG)Position + 1), Position))
+            {
+                *PPosition = Position;
+                return Slot->Buffer;
+            }
+        }
+        else if (0 > Difference)
+            break;                      /* queue is empty */
+    }
+    return 0;
+}
+static inline VOID FspFsctlTransactRingConsumeEnd(
+    FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount, ULONG QueueIndex, LONG Position)
+{
+    FSP_FSCTL_TRANSACT_RING_SLOT *Slot = FspFsctlTransactRingSlot(Ring, SlotCount, QueueIndex, Position);
+    InterlockedExchange(&Slot->Sequence, (LONG)((ULONG)Position + SlotCount));
+}
+
 #if !defined(WINFSP_SYS_INTERNAL)
 FSP_API NTSTATUS FspFsctlCreateVolume(PWSTR DevicePath,
     const FSP_FSCTL_VOLUME_PARAMS *VolumeParams,
@@ -511,6 +753,11 @@ FSP_API NTSTATUS FspFsctlTransact(HANDLE VolumeHandle,
     PVOID RequestBuf, SIZE_T *PRequestBufSize,
     BOOLEAN Batch);
 FSP_API NTSTATUS FspFsctlStop(HANDLE VolumeHandle);
+FSP_API NTSTATUS FspFsctlTransactRingCreate(HANDLE VolumeHandle,
+    UINT32 SlotCount, FSP_FSCTL_TRANSACT_RING **PRing);
+FSP_API VOID FspFsctlTransactRingDelete(FSP_FSCTL_TRANSACT_RING *Ring);
+FSP_API NTSTATUS FspFsctlTransactRing(HANDLE VolumeHandle,
+    BOOLEAN Wait);
 FSP_API NTSTATUS FspFsctlGetVolumeList(PWSTR DevicePath,
     PWCHAR VolumeListBuf, PSIZE_T PVolumeListSize);
 FSP_API NTSTATUS FspFsctlPreflight(PWSTR DevicePath);
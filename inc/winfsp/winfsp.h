@@ -386,6 +386,18 @@ typedef struct _FSP_FILE_SYSTEM_INTERFACE
     /**
      * Close a file.
      *
+     * As an optimization a file system may specify the FSP_FSCTL_VOLUME_PARAMS ::
+     * BatchCloseRequests flag. In this case the FSD will coalesce Close requests for multiple
+     * files into a single request and this operation will be called once for each file. The
+     * FSD delivers such requests with a small delay, so a Close may be received after later
+     * requests for other files.
+     *
+     * A file system may also specify the FSP_FSCTL_VOLUME_PARAMS :: DelayCloseRequests flag.
+     * In this case the FSD may hold back the Close of a file for a few seconds and give the
+     * still open file context to a later open of the same file by the same user. Such an open
+     * is not seen by the file system, so Cleanup may be called more than once for a file
+     * context before its Close.
+     *
      * @param FileSystem
      *     The file system on which this request is posted.
      * @param FileContext
@@ -829,7 +841,30 @@ typedef struct _FSP_FILE_SYSTEM
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY OpGuardStrategy;
     SRWLOCK OpGuardLock;
     BOOLEAN UmFileContextIsUserContext2, UmFileContextIsFullContext;
+    UINT32 TransactRingSlotCount;
+    FSP_FSCTL_TRANSACT_RING *TransactRing;
+    BOOLEAN TransactBatch;
+    ULONG TransactBatchWorkerCount;
+    ULONG DispatcherThreadCountMin, DispatcherThreadCountMax;
+    ULONG DispatcherThreadIdleTimeout;
+    PVOID DispatcherPool;
+    PVOID AccessCheckCache;
+    PVOID DirectoryCache;
 } FSP_FILE_SYSTEM;
+typedef struct _FSP_FILE_SYSTEM_DISPATCHER_STATISTICS
+{
+    ULONG ThreadCount;                  /* current number of dispatcher threads */
+    ULONG BusyThreadCount;              /* threads currently executing requests */
+    ULONG ThreadCountMin, ThreadCountMax;
+    ULONG ThreadCountPeak;
+    UINT64 ThreadCreateCount;           /* threads created since the dispatcher was started */
+    UINT64 ThreadExitCount;             /* threads that exited because they were idle */
+    UINT64 RequestCount;
+    UINT64 BatchCount;                  /* request deliveries; RequestCount / BatchCount is the
+                                           average number of requests per delivery */
+    UINT64 BusyTime;                    /* 100ns units, summed over all threads */
+    UINT64 IdleTime;                    /* 100ns units, summed over all threads */
+} FSP_FILE_SYSTEM_DISPATCHER_STATISTICS;
 typedef struct _FSP_FILE_SYSTEM_OPERATION_CONTEXT
 {
     FSP_FSCTL_TRANSACT_REQ *Request;
@@ -928,6 +963,21 @@ FSP_API NTSTATUS FspFileSystemStartDispatcher(FSP_FILE_SYSTEM *FileSystem, ULONG
  *     The file system object.
  */
 FSP_API VOID FspFileSystemStopDispatcher(FSP_FILE_SYSTEM *FileSystem);
+/**
+ * Get file system dispatcher statistics.
+ *
+ * Thread utilization can be computed as BusyTime / (BusyTime + IdleTime).
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Statistics [out]
+ *     Pointer to a structure that will receive the dispatcher statistics.
+ * @return
+ *     STATUS_SUCCESS or error code. STATUS_INVALID_DEVICE_STATE if the dispatcher
+ *     is not running.
+ */
+FSP_API NTSTATUS FspFileSystemGetDispatcherStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_DISPATCHER_STATISTICS *Statistics);
 /**
  * Send a response to the FSD.
  *
@@ -1056,6 +1106,88 @@ VOID FspFileSystemSetDebugLog(FSP_FILE_SYSTEM *FileSystem,
 {
     FileSystem->DebugLog = DebugLog;
 }
+/**
+ * Use a transact ring to communicate with the FSD.
+ *
+ * When a transact ring is used the dispatcher receives requests and sends responses through
+ * memory that is shared with the FSD and only enters the kernel when it runs out of requests
+ * or when too many responses have accumulated. This reduces the number of kernel transitions
+ * under load. This call must be made prior to FspFileSystemStartDispatcher.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param SlotCount
+ *     The number of request and response slots in the ring. This must be a power of 2
+ *     between 16 and 256. A value of 0 disables the transact ring (default).
+ */
+FSP_API VOID FspFileSystemSetTransactRingF(FSP_FILE_SYSTEM *FileSystem,
+    UINT32 SlotCount);
+static inline
+VOID FspFileSystemSetTransactRing(FSP_FILE_SYSTEM *FileSystem,
+    UINT32 SlotCount)
+{
+    FileSystem->TransactRingSlotCount = SlotCount;
+}
+/**
+ * Receive requests from the FSD in batches.
+ *
+ * When batching is enabled each dispatcher thread receives as many requests as are available
+ * (up to FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN bytes worth) in a single kernel transition
+ * and executes them. Responses are sent as their requests complete; responses that complete
+ * while another response is being sent are coalesced into the next kernel transition. This
+ * call must be made prior to FspFileSystemStartDispatcher and is ignored if a transact ring
+ * is used.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param TransactBatch
+ *     TRUE to enable batching.
+ * @param WorkerCount
+ *     The maximum number of threads (including the dispatcher thread) that execute the
+ *     requests of a single batch. Additional threads are taken from the process thread pool.
+ *     A value of 0 or 1 executes the batch on the dispatcher thread.
+ */
+FSP_API VOID FspFileSystemSetTransactBatchF(FSP_FILE_SYSTEM *FileSystem,
+    BOOLEAN TransactBatch, ULONG WorkerCount);
+static inline
+VOID FspFileSystemSetTransactBatch(FSP_FILE_SYSTEM *FileSystem,
+    BOOLEAN TransactBatch, ULONG WorkerCount)
+{
+    FileSystem->TransactBatch = TransactBatch;
+    FileSystem->TransactBatchWorkerCount = WorkerCount;
+}
+/**
+ * Let the file system dispatcher adapt its number of threads to the load.
+ *
+ * By default the dispatcher runs a fixed number of threads. When a thread count range is set
+ * the dispatcher starts ThreadCountMin threads and adds a thread (up to ThreadCountMax) whenever
+ * all of its threads are busy executing requests, for example because they are blocked in a
+ * slow backend. A thread that has not received a request for IdleTimeout milliseconds exits,
+ * but the dispatcher never goes below ThreadCountMin threads. This call must be made prior to
+ * FspFileSystemStartDispatcher; when it is used the ThreadCount argument of
+ * FspFileSystemStartDispatcher is ignored.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param ThreadCountMin
+ *     The minimum number of dispatcher threads.
+ * @param ThreadCountMax
+ *     The maximum number of dispatcher threads. A value of 0 disables the adaptive thread
+ *     pool (default).
+ * @param IdleTimeout
+ *     The time (in milliseconds) after which an idle thread exits. A value of 0 selects
+ *     a default of 30 seconds.
+ */
+FSP_API VOID FspFileSystemSetDispatcherThreadCountF(FSP_FILE_SYSTEM *FileSystem,
+    ULONG ThreadCountMin, ULONG ThreadCountMax, ULONG IdleTimeout);
+static inline
+VOID FspFileSystemSetDispatcherThreadCount(FSP_FILE_SYSTEM *FileSystem,
+    ULONG ThreadCountMin, ULONG ThreadCountMax, ULONG IdleTimeout)
+{
+    FileSystem->DispatcherThreadCountMin = ThreadCountMin;
+    FileSystem->DispatcherThreadCountMax = ThreadCountMax;
+    FileSystem->DispatcherThreadIdleTimeout = IdleTimeout;
+}
 FSP_API BOOLEAN FspFileSystemIsOperationCaseSensitiveF(VOID);
 static inline
 BOOLEAN FspFileSystemIsOperationCaseSensitive(VOID)
@@ -1348,6 +1480,119 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
     PVOID Buffer, ULONG Length, PULONG PBytesTransferred);
 FSP_API VOID FspFileSystemDeleteDirectoryBuffer(PVOID *PDirBuffer);
 
+/*
+ * Directory streaming
+ *
+ * A streaming directory buffer is for file systems whose enumeration already returns
+ * entries in ReadDirectory order ("." and ".." first, then by file name). Unlike the
+ * directory buffer above, pages are served while the enumeration is still in progress.
+ * Memory use is bounded by WindowSize (0 selects a default). To achieve this the producer
+ * blocks in FspFileSystemFillDirectoryStream while the window is full of unread entries.
+ * For this reason the producer should normally run on a thread other than the one that
+ * calls FspFileSystemReadDirectoryStream.
+ *
+ * When FspFileSystemAcquireDirectoryStream returns TRUE the caller becomes the producer.
+ * It must call FspFileSystemFillDirectoryStream for each entry in order and then finish
+ * with FspFileSystemReleaseDirectoryStream, passing the enumeration result. A Reset
+ * cancels any running producer: its next fill call fails with STATUS_CANCELLED.
+ *
+ * FspFileSystemReadDirectoryStream resumes from the marker of the previous page in
+ * constant time. It returns STATUS_INVALID_PARAMETER if the marker precedes entries
+ * that have already left the window. In that case the enumeration must be restarted.
+ * It returns a partial page (without the end of directory marker) as soon as it has
+ * copied at least one entry and blocks only while no entry is available.
+ */
+FSP_API BOOLEAN FspFileSystemAcquireDirectoryStream(PVOID *PDirStream,
+    BOOLEAN Reset, ULONG WindowSize, PNTSTATUS PResult);
+FSP_API BOOLEAN FspFileSystemFillDirectoryStream(PVOID *PDirStream,
+    FSP_FSCTL_DIR_INFO *DirInfo, PNTSTATUS PResult);
+FSP_API VOID FspFileSystemReleaseDirectoryStream(PVOID *PDirStream, NTSTATUS Result);
+FSP_API NTSTATUS FspFileSystemReadDirectoryStream(PVOID *PDirStream,
+    PWSTR Marker,
+    PVOID Buffer, ULONG Length, PULONG PBytesTransferred);
+FSP_API VOID FspFileSystemDeleteDirectoryStream(PVOID *PDirStream);
+
+/*
+ * Directory caching
+ *
+ * The directory cache lets handles that enumerate the same directory share one listing.
+ * A file system that enables it (FspFileSystemSetDirectoryCache) calls
+ * FspFileSystemAcquireCachedDirectoryBuffer in ReadDirectory instead of
+ * FspFileSystemAcquireDirectoryBuffer and passes the name of the directory being read.
+ * When a fresh listing for this directory is cached the handle's directory buffer becomes
+ * a reference to it and the function returns FALSE; FspFileSystemReadDirectoryBuffer then
+ * pages through the shared listing. Otherwise the function returns TRUE and the caller fills
+ * the buffer as usual and finishes with FspFileSystemReleaseCachedDirectoryBuffer, passing
+ * the enumeration result; a successful listing is published to the cache. Handles that ask
+ * for a listing while it is being filled wait for it rather than enumerate the directory
+ * again. Shared listings are immutable and are freed when the last handle and the cache
+ * release them (FspFileSystemDeleteDirectoryBuffer).
+ *
+ * Cached listings expire after a timeout. They are also invalidated when a file is created,
+ * overwritten, renamed or deleted, or has its reparse point set or deleted (the containing
+ * directory, and for directories all listings under them). SetBasicInfo and SetFileSize
+ * invalidate only the listing of the containing directory. Writes do not invalidate: file
+ * sizes and times that a write changes may be stale in a listing for up to the timeout.
+ * File systems that are modified by other means must call FspFileSystemInvalidateDirectoryCache.
+ */
+typedef struct _FSP_FILE_SYSTEM_DIRECTORY_CACHE_STATISTICS
+{
+    ULONG Capacity;
+    ULONG Count;                        /* listings currently in the cache */
+    UINT64 HitCount, MissCount;
+    UINT64 InsertCount;
+    UINT64 InvalidateCount;             /* invalidation requests (not listings removed) */
+} FSP_FILE_SYSTEM_DIRECTORY_CACHE_STATISTICS;
+/**
+ * Enable the directory cache.
+ *
+ * This call must be made prior to FspFileSystemStartDispatcher.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Capacity
+ *     The number of directory listings in the cache. A value of 0 disables the cache (default).
+ * @param Timeout
+ *     The time (in milliseconds) that a listing remains valid. A value of 0 selects a default
+ *     of 1 second.
+ * @param CaseSensitive
+ *     Whether directory names are compared case-sensitively. This should usually be the
+ *     same as the VolumeParams CaseSensitiveSearch field.
+ * @return
+ *     STATUS_SUCCESS or error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetDirectoryCache(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Capacity, ULONG Timeout, BOOLEAN CaseSensitive);
+FSP_API BOOLEAN FspFileSystemAcquireCachedDirectoryBuffer(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR DirName, PVOID *PDirBuffer, BOOLEAN Reset, PNTSTATUS PResult);
+FSP_API VOID FspFileSystemReleaseCachedDirectoryBuffer(FSP_FILE_SYSTEM *FileSystem,
+    PVOID *PDirBuffer, NTSTATUS Result);
+/**
+ * Invalidate the directory cache.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param FileName
+ *     The name of a file or directory. The listing of the directory that contains it is
+ *     invalidated, as are the listings of FileName and of any directories under it. If this
+ *     parameter is NULL the whole cache is invalidated.
+ */
+FSP_API VOID FspFileSystemInvalidateDirectoryCache(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName);
+/**
+ * Get directory cache statistics.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Statistics [out]
+ *     Pointer to a structure that will receive the directory cache statistics.
+ * @return
+ *     STATUS_SUCCESS or error code. STATUS_INVALID_DEVICE_STATE if the directory
+ *     cache is not enabled.
+ */
+FSP_API NTSTATUS FspFileSystemGetDirectoryCacheStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_DIRECTORY_CACHE_STATISTICS *Statistics);
+
 /*
  * Security
  */
@@ -1417,6 +1662,65 @@ NTSTATUS FspAccessCheck(FSP_FILE_SYSTEM *FileSystem,
         DesiredAccess, PGrantedAccess,
         0);
 }
+typedef struct _FSP_FILE_SYSTEM_ACCESS_CHECK_CACHE_STATISTICS
+{
+    ULONG Capacity;
+    ULONG Count;                        /* entries currently in the cache */
+    UINT64 HitCount, MissCount;
+    UINT64 InsertCount;
+    UINT64 InvalidateCount;             /* invalidation requests (not entries removed) */
+} FSP_FILE_SYSTEM_ACCESS_CHECK_CACHE_STATISTICS;
+/**
+ * Cache the results of traverse checks.
+ *
+ * When a caller does not have the traverse privilege (SeChangeNotifyPrivilege) FspAccessCheckEx
+ * must check FILE_TRAVERSE access on every directory in the path of the file being opened, which
+ * requires a GetSecurityByName call for each of them. When the access check cache is enabled the
+ * access granted on each directory is remembered per access token, so that subsequent opens in
+ * the same directory tree only need to check the directories that are not already cached.
+ *
+ * Cache entries are invalidated when a directory is renamed, deleted or has its reparse point
+ * set or deleted, and the whole cache is invalidated when security is changed through the
+ * SetSecurity operation. File systems whose security can change by other means must call
+ * FspFileSystemInvalidateAccessCheckCache. This call must be made prior to
+ * FspFileSystemStartDispatcher.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Capacity
+ *     The number of entries in the cache. A value of 0 disables the cache (default).
+ * @param Timeout
+ *     The time (in milliseconds) that an entry remains valid. A value of 0 selects a default
+ *     of 1 second.
+ * @return
+ *     STATUS_SUCCESS or error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetAccessCheckCache(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Capacity, ULONG Timeout);
+/**
+ * Invalidate the access check cache.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param FileName
+ *     The name of a file or directory. All entries for this name and any names under it are
+ *     invalidated. If this parameter is NULL the whole cache is invalidated.
+ */
+FSP_API VOID FspFileSystemInvalidateAccessCheckCache(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName);
+/**
+ * Get access check cache statistics.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Statistics [out]
+ *     Pointer to a structure that will receive the access check cache statistics.
+ * @return
+ *     STATUS_SUCCESS or error code. STATUS_INVALID_DEVICE_STATE if the access check
+ *     cache is not enabled.
+ */
+FSP_API NTSTATUS FspFileSystemGetAccessCheckCacheStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_ACCESS_CHECK_CACHE_STATISTICS *Statistics);
 
 /*
  * POSIX Interop
@@ -1444,6 +1748,42 @@ NTSTATUS FspPosixMapPosixToWindowsPath(const char *PosixPath, PWSTR *PWindowsPat
 {
     return FspPosixMapPosixToWindowsPathEx(PosixPath, PWindowsPath, TRUE);
 }
+/**
+ * Map a Windows path to a POSIX path into a caller-provided buffer.
+ *
+ * @param WindowsPath
+ *     The Windows path to map.
+ * @param PosixPath
+ *     The buffer that will receive the (NUL-terminated) POSIX path.
+ * @param PSize [in,out]
+ *     On input the size of the PosixPath buffer in bytes. On output the number of bytes
+ *     written including the terminating NUL, or the required buffer size if the buffer
+ *     is too small.
+ * @param Translate
+ *     Whether to translate path separators and characters invalid for Windows filenames.
+ * @return
+ *     STATUS_SUCCESS or STATUS_BUFFER_TOO_SMALL.
+ */
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPathBuffer(PWSTR WindowsPath,
+    char *PosixPath, PULONG PSize, BOOLEAN Translate);
+/**
+ * Map a POSIX path to a Windows path into a caller-provided buffer.
+ *
+ * @param PosixPath
+ *     The POSIX path to map.
+ * @param WindowsPath
+ *     The buffer that will receive the (NUL-terminated) Windows path.
+ * @param PSize [in,out]
+ *     On input the size of the WindowsPath buffer in bytes. On output the number of bytes
+ *     written including the terminating NUL, or the required buffer size if the buffer
+ *     is too small.
+ * @param Translate
+ *     Whether to translate path separators and characters invalid for Windows filenames.
+ * @return
+ *     STATUS_SUCCESS or STATUS_BUFFER_TOO_SMALL.
+ */
+FSP_API NTSTATUS FspPosixMapPosixToWindowsPathBuffer(const char *PosixPath,
+    PWSTR WindowsPath, PULONG PSize, BOOLEAN Translate);
 FSP_API VOID FspPosixDeletePath(void *Path);
 FSP_API VOID FspPosixEncodeWindowsPath(PWSTR WindowsPath, ULONG Size);
 FSP_API VOID FspPosixDecodeWindowsPath(PWSTR WindowsPath, ULONG Size);
@@ -1663,12 +2003,65 @@ FSP_API VOID FspDebugLogSD(const char *Format, PSECURITY_DESCRIPTOR SecurityDesc
 FSP_API VOID FspDebugLogFT(const char *Format, PFILETIME FileTime);
 FSP_API VOID FspDebugLogRequest(FSP_FSCTL_TRANSACT_REQ *Request);
 FSP_API VOID FspDebugLogResponse(FSP_FSCTL_TRANSACT_RSP *Response);
+FSP_API NTSTATUS FspDebugTraceStart(HANDLE Handle);
+FSP_API VOID FspDebugTraceStop(VOID);
 FSP_API NTSTATUS FspCallNamedPipeSecurely(PWSTR PipeName,
     PVOID InBuffer, ULONG InBufferSize, PVOID OutBuffer, ULONG OutBufferSize,
     PULONG PBytesTransferred, ULONG Timeout,
     PSID Sid);
 FSP_API NTSTATUS FspVersion(PUINT32 PVersion);
 
+/*
+ * Debug trace
+ *
+ * While a trace is active FspDebugLogRequest and FspDebugLogResponse append fixed size
+ * binary records to a per-thread ring instead of formatting text; a background thread
+ * drains the rings to the trace file. A trace file is a FSP_DEBUG_TRACE_HEADER followed
+ * by FSP_DEBUG_TRACE_RECORD's; records of one thread appear in order, but records of
+ * different threads are only ordered by their Counter. Use "fsptool trace" to print it.
+ *
+ * FspDebugTraceStop must not be called while file system dispatchers are running.
+ */
+#define FSP_DEBUG_TRACE_MAGIC           "WFSPTRC"
+#define FSP_DEBUG_TRACE_VERSION         1
+enum
+{
+    FspDebugTraceRequest                = 1,
+    FspDebugTraceResponse,
+    FspDebugTraceDropped,               /* Arg0: records dropped by ThreadId since last report */
+};
+typedef struct
+{
+    CHAR Magic[8];                      /* FSP_DEBUG_TRACE_MAGIC */
+    UINT32 Version;
+    UINT32 RecordSize;                  /* sizeof(FSP_DEBUG_TRACE_RECORD) */
+    UINT64 Frequency;                   /* performance counter frequency */
+    UINT64 StartCounter;                /* performance counter when the trace started */
+    UINT64 StartTime;                   /* system time (FILETIME) when the trace started */
+    UINT32 ProcessId;
+    UINT32 Reserved;
+} FSP_DEBUG_TRACE_HEADER;
+typedef struct
+{
+    UINT8 Type;                         /* FspDebugTrace{Request,Response,Dropped} */
+    UINT8 Kind;                         /* FspFsctlTransact*Kind */
+    UINT16 Reserved;
+    UINT32 ThreadId;
+    UINT64 Counter;                     /* performance counter */
+    UINT64 Hint;
+    UINT64 UserContext;
+    UINT64 UserContext2;
+    UINT64 Arg0;                        /* Offset, AllocationSize, FileSize, etc. */
+    UINT32 Arg1;                        /* Length, CreateOptions, information class, etc. */
+    UINT32 Arg2;                        /* DesiredAccess, GrantedAccess, FileAttributes, etc. */
+    UINT32 Status;                      /* response only */
+    UINT32 Information;                 /* response only */
+} FSP_DEBUG_TRACE_RECORD;
+FSP_FSCTL_STATIC_ASSERT(48 == sizeof(FSP_DEBUG_TRACE_HEADER),
+    "sizeof(FSP_DEBUG_TRACE_HEADER) must be exactly 48.");
+FSP_FSCTL_STATIC_ASSERT(64 == sizeof(FSP_DEBUG_TRACE_RECORD),
+    "sizeof(FSP_DEBUG_TRACE_RECORD) must be exactly 64.");
+
 /*
  * Delay load
  */
@@ -38,6 +38,133 @@ inline NTSTATUS Initialize()
     return LoadResult;
 }
 
+/*
+ * AsyncResponse
+ *
+ * A completion token for an operation that is completed asynchronously. The Read, Write and
+ * ReadDirectory operations of FileSystemBase may obtain a token using PendResponse, start
+ * the operation in the background and return STATUS_PENDING. The token must later be completed
+ * exactly once (from any thread) using one of the Complete methods; the buffers passed to the
+ * operation remain valid until then. A successful Write must be completed with the updated
+ * FileInfo; without it the request fails with STATUS_INVALID_PARAMETER.
+ *
+ * Tokens are move-only, so that a request cannot be completed through two copies. Destroying
+ * a token does not complete it; this is only correct when the operation does not return
+ * STATUS_PENDING (e.g. because it failed to start the background work).
+ *
+ * Lifetime rules:
+ * - A token refers to the FSP_FILE_SYSTEM of the FileSystemHost. All tokens must be completed
+ * before it goes away, i.e. no later than FileSystemBase::Unmounted, which runs after the
+ * dispatcher has stopped and before FileSystemHost::Unmount (or the FileSystemHost destructor)
+ * deletes the FSP_FILE_SYSTEM. Completing a token afterwards uses a dangling pointer.
+ * - The Pattern and Marker of ReadDirectory (and the file names of all other operations) point
+ * into the request buffer of the dispatcher thread, which is reused as soon as the operation
+ * returns. An operation that returns STATUS_PENDING must copy them first.
+ */
+class AsyncResponse
+{
+public:
+    AsyncResponse() :
+        _FileSystemPtr(0), _Kind(FspFsctlTransactReservedKind), _Hint(0)
+    {
+    }
+    AsyncResponse(FSP_FILE_SYSTEM *FileSystem, FSP_FSCTL_TRANSACT_REQ *Request) :
+        _FileSystemPtr(0), _Kind(FspFsctlTransactReservedKind), _Hint(0)
+    {
+        if (0 == FileSystem || 0 == Request)
+            return;
+        switch (Request->Kind)
+        {
+        case FspFsctlTransactReadKind:
+        case FspFsctlTransactWriteKind:
+        case FspFsctlTransactQueryDirectoryKind:
+            _FileSystemPtr = FileSystem;
+            _Kind = Request->Kind;
+            _Hint = Request->Hint;
+            break;
+        default:
+            /* other operations cannot return STATUS_PENDING */
+            break;
+        }
+    }
+    AsyncResponse(AsyncResponse &&Other) :
+        _FileSystemPtr(Other._FileSystemPtr), _Kind(Other._Kind), _Hint(Other._Hint)
+    {
+        Other._FileSystemPtr = 0;
+    }
+    AsyncResponse &operator=(AsyncResponse &&Other)
+    {
+        /* the token assigned over must not be pending */
+        if (this != &Other)
+        {
+            _FileSystemPtr = Other._FileSystemPtr;
+            _Kind = Other._Kind;
+            _Hint = Other._Hint;
+            Other._FileSystemPtr = 0;
+        }
+        return *this;
+    }
+    AsyncResponse(const AsyncResponse &) = delete;
+    AsyncResponse &operator=(const AsyncResponse &) = delete;
+
+    BOOLEAN IsValid() const
+    {
+        return 0 != _FileSystemPtr;
+    }
+    UINT32 Kind() const
+    {
+        return _Kind;
+    }
+    UINT64 Hint() const
+    {
+        return _Hint;
+    }
+    VOID Complete(NTSTATUS Status, ULONG Information = 0,
+        const FSP_FSCTL_FILE_INFO *FileInfo = 0)
+    {
+        FSP_FILE_SYSTEM *FileSystemPtr = _FileSystemPtr;
+        FSP_FSCTL_TRANSACT_RSP Response;
+        if (0 == FileSystemPtr)
+            return;
+        _FileSystemPtr = 0;
+        RtlZeroMemory(&Response, sizeof Response);
+        Response.Size = sizeof Response;
+        Response.Kind = _Kind;
+        Response.Hint = _Hint;
+        if (NT_SUCCESS(Status) && FspFsctlTransactWriteKind == _Kind && 0 == FileInfo)
+            /* a successful Write must report the new file size, as FspFileSystemOpWrite does */
+            Status = STATUS_INVALID_PARAMETER;
+        Response.IoStatus.Status = Status;
+        if (NT_SUCCESS(Status))
+        {
+            Response.IoStatus.Information = Information;
+            if (FspFsctlTransactWriteKind == _Kind)
+                Response.Rsp.Write.FileInfo = *FileInfo;
+        }
+        FspFileSystemSendResponse(FileSystemPtr, &Response);
+    }
+    VOID CompleteRead(NTSTATUS Status, ULONG BytesTransferred)
+    {
+        Complete(Status, BytesTransferred);
+    }
+    VOID CompleteWrite(NTSTATUS Status, ULONG BytesTransferred,
+        const FSP_FSCTL_FILE_INFO *FileInfo)
+    {
+        Complete(Status, BytesTransferred, FileInfo);
+    }
+    VOID CompleteReadDirectory(NTSTATUS Status, ULONG BytesTransferred)
+    {
+        Complete(Status, BytesTransferred);
+    }
+
+private:
+    FSP_FILE_SYSTEM *_FileSystemPtr;
+    UINT32 _Kind;
+    UINT64 _Hint;
+};
+
+class FileSystemHost;
+
 class FileSystemBase
 {
 public:
@@ -57,7 +184,8 @@ public:
     };
 
 public:
-    FileSystemBase()
+    FileSystemBase() :
+        _FileSystemPtr(0)
     {
     }
     virtual ~FileSystemBase()
@@ -447,6 +575,17 @@ public:
         return FspFileSystemAddStreamInfo(StreamInfo, Buffer, Length, PBytesTransferred);
     }
 
+    /* asynchronous operations */
+    AsyncResponse PendResponse()
+    {
+        /*
+         * Call from within Read, Write or ReadDirectory. If the returned token IsValid
+         * the operation may return STATUS_PENDING and complete the token later.
+         */
+        FSP_FILE_SYSTEM_OPERATION_CONTEXT *OperationContext = FspFileSystemGetOperationContext();
+        return AsyncResponse(_FileSystemPtr, 0 != OperationContext ? OperationContext->Request : 0);
+    }
+
 private:
     static NTSTATUS GetReparsePointByName(FSP_FILE_SYSTEM *FileSystem,
         PVOID Context,
@@ -465,6 +604,10 @@ private:
         )
     }
 
+private:
+    FSP_FILE_SYSTEM *_FileSystemPtr;
+    friend class FileSystemHost;
+
 private:
     /* disallow copy and assignment */
     FileSystemBase(const FileSystemBase &);
@@ -479,6 +622,7 @@ public:
         _VolumeParams(), _FileSystemPtr(0), _FileSystem(&FileSystem)
     {
         Initialize();
+        _VolumeParams.Version = sizeof(FSP_FSCTL_VOLUME_PARAMS);
         _VolumeParams.UmFileContextIsFullContext = 1;
     }
     virtual ~FileSystemHost()
@@ -608,6 +752,22 @@ public:
     {
         _VolumeParams.PassQueryDirectoryPattern = !!PassQueryDirectoryPattern;
     }
+    BOOLEAN BatchCloseRequests()
+    {
+        return _VolumeParams.BatchCloseRequests;
+    }
+    VOID SetBatchCloseRequests(BOOLEAN BatchCloseRequests)
+    {
+        _VolumeParams.BatchCloseRequests = !!BatchCloseRequests;
+    }
+    BOOLEAN DelayCloseRequests()
+    {
+        return _VolumeParams.DelayCloseRequests;
+    }
+    VOID SetDelayCloseRequests(BOOLEAN DelayCloseRequests)
+    {
+        _VolumeParams.DelayCloseRequests = !!DelayCloseRequests;
+    }
     PWSTR Prefix()
     {
         return _VolumeParams.Prefix;
@@ -662,6 +822,7 @@ public:
         if (!NT_SUCCESS(Result))
             return Result;
         _FileSystemPtr->UserContext = _FileSystem;
+        _FileSystem->_FileSystemPtr = _FileSystemPtr;
         FspFileSystemSetOperationGuardStrategy(_FileSystemPtr, Synchronized ?
             FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE :
             FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE);
@@ -693,6 +854,7 @@ public:
         }
         if (!NT_SUCCESS(Result))
         {
+            _FileSystem->_FileSystemPtr = 0;
             FspFileSystemDelete(_FileSystemPtr);
             _FileSystemPtr = 0;
         }
@@ -710,6 +872,7 @@ public:
             _FileSystem->ExceptionHandler();
         }
         _FileSystemPtr->UserContext = 0;
+        _FileSystem->_FileSystemPtr = 0;
         FspFileSystemDelete(_FileSystemPtr);
         _FileSystemPtr = 0;
     }
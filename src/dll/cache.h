@@ -0,0 +1,83 @@
+/**
+ * @file dll/cache.h
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_DLL_CACHE_H_INCLUDED
+#define WINFSP_DLL_CACHE_H_INCLUDED
+
+/*
+ * Name keyed caches
+ *
+ * The access check and directory caches are direct-mapped tables: an entry lives in the
+ * slot FspCacheSlot(Hash, Capacity) and an insert simply replaces whatever is there. The
+ * FUSE attribute nodes use the same hash for their buckets.
+ */
+#define FspFnv1aOffsetBasis             2166136261
+
+static inline UINT32 FspFnv1a(UINT32 Hash, UINT32 C)
+{
+    return (Hash ^ C) * 16777619;
+}
+
+static inline UINT32 FspCacheHashFileName(PWSTR FileName, ULONG FileNameLength)
+{
+    /*
+     * FNV-1a over the file name with ASCII case folded. Names that differ only in the
+     * case of non-ASCII characters hash differently and simply miss in the cache.
+     */
+    UINT32 Hash = FspFnv1aOffsetBasis;
+    WCHAR C;
+
+    for (ULONG I = 0; FileNameLength > I; I++)
+    {
+        C = FileName[I];
+        if (L'a' <= C && C <= L'z')
+            C -= L'a' - L'A';
+        Hash = FspFnv1a(Hash, C);
+    }
+
+    return Hash;
+}
+
+static inline BOOLEAN FspCacheFileNameEqual(
+    PWSTR FileName1, ULONG FileNameLength1,
+    PWSTR FileName2, ULONG FileNameLength2,
+    BOOLEAN CaseSensitive)
+{
+    if (FileNameLength1 != FileNameLength2)
+        return FALSE;
+    if (CaseSensitive)
+        return 0 == invariant_wcsncmp(FileName1, FileName2, FileNameLength1);
+    return CSTR_EQUAL == CompareStringOrdinal(
+        FileName1, FileNameLength1, FileName2, FileNameLength2, TRUE);
+}
+
+static inline ULONG FspCacheCapacity(ULONG Capacity, ULONG CapacityMin, ULONG CapacityMax)
+{
+    /* round up to a power of 2 in [CapacityMin, CapacityMax] */
+    ULONG CacheCapacity;
+
+    if (CapacityMax < Capacity)
+        Capacity = CapacityMax;
+    for (CacheCapacity = CapacityMin; Capacity > CacheCapacity;)
+        CacheCapacity <<= 1;
+
+    return CacheCapacity;
+}
+
+#define FspCacheSlot(Hash, Capacity)    ((Hash) & ((Capacity) - 1))
+
+#endif
@@ -20,6 +20,10 @@
 #include <stdarg.h>
 
 static HANDLE FspDebugLogHandle = INVALID_HANDLE_VALUE;
+static volatile BOOLEAN FspDebugTraceActive;
+
+static VOID FspDebugTraceAppendRequest(FSP_FSCTL_TRANSACT_REQ *Request);
+static VOID FspDebugTraceAppendResponse(FSP_FSCTL_TRANSACT_RSP *Response);
 
 FSP_API VOID FspDebugLogSetHandle(HANDLE Handle)
 {
@@ -286,6 +290,12 @@ FSP_API VOID FspDebugLogRequest(FSP_FSCTL_TRANSACT_REQ *Request)
     char InfoBuf[256];
     char *Sddl = 0;
 
+    if (FspDebugTraceActive)
+    {
+        FspDebugTraceAppendRequest(Request);
+        return;
+    }
+
     switch (Request->Kind)
     {
     case FspFsctlTransactReservedKind:
@@ -351,8 +361,9 @@ FSP_API VOID FspDebugLogRequest(FSP_FSCTL_TRANSACT_REQ *Request)
                 UserContextBuf));
         break;
     case FspFsctlTransactCloseKind:
-        FspDebugLog("%S[TID=%04lx]: %p: >>Close %s%S%s%s\n",
+        FspDebugLog("%S[TID=%04lx]: %p: >>Close%s %s%S%s%s\n",
             FspDiagIdent(), GetCurrentThreadId(), (PVOID)Request->Hint,
+            Request->Req.Close.Contexts.Size ? " [Batch]" : "",
             Request->FileName.Size ? "\"" : "",
             Request->FileName.Size ? (PWSTR)Request->Buffer : L"",
             Request->FileName.Size ? "\", " : "",
@@ -643,6 +654,12 @@ FSP_API VOID FspDebugLogResponse(FSP_FSCTL_TRANSACT_RSP *Response)
     if (STATUS_PENDING == Response->IoStatus.Status)
         return;
 
+    if (FspDebugTraceActive)
+    {
+        FspDebugTraceAppendResponse(Response);
+        return;
+    }
+
     char UserContextBuf[40];
     char InfoBuf[256];
     char *Sddl = 0;
@@ -842,3 +859,492 @@ FSP_API VOID FspDebugLogResponse(FSP_FSCTL_TRANSACT_RSP *Response)
         break;
     }
 }
+
+/*
+ * Binary trace
+ *
+ * Formatting a text line and writing it synchronously costs microseconds per request and
+ * serializes dispatcher threads on the log handle. A binary trace instead copies a few
+ * fields of each request and response into a fixed size record of a per-thread ring.
+ * A ring has a single producer (its thread) and a single consumer (the drainer thread),
+ * so appending a record needs no lock and no interlocked operation: the producer fills
+ * the record at Head and then publishes it by advancing Head; the drainer copies records
+ * up to Head and then releases them by advancing Tail. Volatile accesses have acquire and
+ * release semantics with the Microsoft compiler on x86 and x64 (/volatile:ms), which is
+ * all the ordering this requires. When a ring is full the record is dropped and counted;
+ * the drainer reports drops with a FspDebugTraceDropped record.
+ *
+ * Rings are allocated on first use and registered on a list under FspDebugTraceLock; this
+ * is the only time a producer takes the lock. A ring outlives a trace so that the thread's
+ * TLS slot never dangles; it is freed when its thread exits (by the drainer if a trace
+ * is active, so that its last records are not lost).
+ */
+#define FSP_DEBUG_TRACE_RING_SIZE       1024    /* records; must be a power of 2 */
+#define FSP_DEBUG_TRACE_BUFFER_SIZE     1024    /* records */
+#define FSP_DEBUG_TRACE_DRAIN_INTERVAL  100     /* millis */
+
+typedef struct _FSP_DEBUG_TRACE_RING FSP_DEBUG_TRACE_RING;
+struct _FSP_DEBUG_TRACE_RING
+{
+    FSP_DEBUG_TRACE_RING *Next;         /* protected by FspDebugTraceLock */
+    UINT32 ThreadId;
+    BOOLEAN Abandoned;                  /* protected by FspDebugTraceLock */
+    ULONG DroppedReported;              /* drainer only */
+    /* producer and drainer indices are kept on different cache lines */
+    __declspec(align(64)) volatile ULONG Head;
+    volatile ULONG Dropped;
+    __declspec(align(64)) volatile ULONG Tail;
+    __declspec(align(64)) FSP_DEBUG_TRACE_RECORD Records[FSP_DEBUG_TRACE_RING_SIZE];
+};
+
+static DWORD FspDebugTraceTlsIndex = TLS_OUT_OF_INDEXES;
+static SRWLOCK FspDebugTraceLock = SRWLOCK_INIT;
+static FSP_DEBUG_TRACE_RING *FspDebugTraceRings;
+static HANDLE FspDebugTraceHandle, FspDebugTraceThread, FspDebugTraceStopEvent;
+static FSP_DEBUG_TRACE_RECORD *FspDebugTraceBuffer;
+
+static FSP_DEBUG_TRACE_RING *FspDebugTraceRingCreate(VOID)
+{
+    FSP_DEBUG_TRACE_RING *Ring;
+
+    Ring = MemAlloc(sizeof *Ring);
+    if (0 == Ring)
+        return 0;
+
+    memset(Ring, 0, FIELD_OFFSET(FSP_DEBUG_TRACE_RING, Records));
+    Ring->ThreadId = GetCurrentThreadId();
+
+    if (!TlsSetValue(FspDebugTraceTlsIndex, Ring))
+    {
+        MemFree(Ring);
+        return 0;
+    }
+
+    AcquireSRWLockExclusive(&FspDebugTraceLock);
+    Ring->Next = FspDebugTraceRings;
+    FspDebugTraceRings = Ring;
+    ReleaseSRWLockExclusive(&FspDebugTraceLock);
+
+    return Ring;
+}
+
+static inline FSP_DEBUG_TRACE_RECORD *FspDebugTraceAppendBegin(
+    FSP_DEBUG_TRACE_RING **PRing, UINT8 Type, UINT32 Kind, UINT64 Hint)
+{
+    FSP_DEBUG_TRACE_RING *Ring;
+    FSP_DEBUG_TRACE_RECORD *Record;
+    LARGE_INTEGER Counter;
+    ULONG Head;
+
+    Ring = TlsGetValue(FspDebugTraceTlsIndex);
+    if (0 == Ring)
+    {
+        Ring = FspDebugTraceRingCreate();
+        if (0 == Ring)
+            return 0;
+    }
+
+    Head = Ring->Head;
+    if (FSP_DEBUG_TRACE_RING_SIZE <= Head - Ring->Tail)
+    {
+        Ring->Dropped = Ring->Dropped + 1;
+        return 0;
+    }
+
+    QueryPerformanceCounter(&Counter);
+
+    Record = &Ring->Records[Head & (FSP_DEBUG_TRACE_RING_SIZE - 1)];
+    memset(Record, 0, sizeof *Record);
+    Record->Type = Type;
+    Record->Kind = (UINT8)Kind;
+    Record->ThreadId = Ring->ThreadId;
+    Record->Counter = Counter.QuadPart;
+    Record->Hint = Hint;
+
+    *PRing = Ring;
+    return Record;
+}
+
+static inline VOID FspDebugTraceAppendEnd(FSP_DEBUG_TRACE_RING *Ring)
+{
+    /* volatile store: release; the record is visible to the drainer before Head */
+    Ring->Head = Ring->Head + 1;
+}
+
+static VOID FspDebugTraceAppendRequest(FSP_FSCTL_TRANSACT_REQ *Request)
+{
+    FSP_DEBUG_TRACE_RING *Ring;
+    FSP_DEBUG_TRACE_RECORD *Record;
+
+    Record = FspDebugTraceAppendBegin(&Ring, FspDebugTraceRequest, Request->Kind, Request->Hint);
+    if (0 == Record)
+        return;
+
+    switch (Request->Kind)
+    {
+    case FspFsctlTransactCreateKind:
+        Record->Arg0 = Request->Req.Create.AllocationSize;
+        Record->Arg1 = Request->Req.Create.CreateOptions;
+        Record->Arg2 = Request->Req.Create.DesiredAccess;
+        break;
+    case FspFsctlTransactOverwriteKind:
+        Record->Arg0 = Request->Req.Overwrite.AllocationSize;
+        Record->Arg1 = Request->Req.Overwrite.Supersede;
+        Record->Arg2 = Request->Req.Overwrite.FileAttributes;
+        break;
+    case FspFsctlTransactCleanupKind:
+        Record->Arg1 =
+            (Request->Req.Cleanup.Delete << 0) |
+            (Request->Req.Cleanup.SetAllocationSize << 1) |
+            (Request->Req.Cleanup.SetArchiveBit << 2) |
+            (Request->Req.Cleanup.SetLastAccessTime << 3) |
+            (Request->Req.Cleanup.SetLastWriteTime << 4) |
+            (Request->Req.Cleanup.SetChangeTime << 5);
+        break;
+    case FspFsctlTransactCloseKind:
+        /* number of files closed by the request */
+        Record->Arg1 = 1 + Request->Req.Close.Contexts.Size / sizeof(FSP_FSCTL_TRANSACT_FULL_CONTEXT);
+        break;
+    case FspFsctlTransactReadKind:
+        Record->Arg0 = Request->Req.Read.Offset;
+        Record->Arg1 = Request->Req.Read.Length;
+        Record->Arg2 = Request->Req.Read.Key;
+        break;
+    case FspFsctlTransactWriteKind:
+        Record->Arg0 = Request->Req.Write.Offset;
+        Record->Arg1 = Request->Req.Write.Length;
+        Record->Arg2 = Request->Req.Write.ConstrainedIo;
+        break;
+    case FspFsctlTransactSetInformationKind:
+        Record->Arg1 = Request->Req.SetInformation.FileInformationClass;
+        switch (Request->Req.SetInformation.FileInformationClass)
+        {
+        case 19/*FileAllocationInformation*/:
+            Record->Arg0 = Request->Req.SetInformation.Info.Allocation.AllocationSize;
+            break;
+        case 4/*FileBasicInformation*/:
+            Record->Arg2 = Request->Req.SetInformation.Info.Basic.FileAttributes;
+            break;
+        case 13/*FileDispositionInformation*/:
+            Record->Arg2 = Request->Req.SetInformation.Info.Disposition.Delete;
+            break;
+        case 20/*FileEndOfFileInformation*/:
+            Record->Arg0 = Request->Req.SetInformation.Info.EndOfFile.FileSize;
+            break;
+        }
+        break;
+    case FspFsctlTransactSetVolumeInformationKind:
+        Record->Arg1 = Request->Req.SetVolumeInformation.FsInformationClass;
+        break;
+    case FspFsctlTransactQueryDirectoryKind:
+        Record->Arg1 = Request->Req.QueryDirectory.Length;
+        break;
+    case FspFsctlTransactFileSystemControlKind:
+        Record->Arg1 = Request->Req.FileSystemControl.FsControlCode;
+        break;
+    case FspFsctlTransactSetSecurityKind:
+        Record->Arg1 = Request->Req.SetSecurity.SecurityInformation;
+        break;
+    }
+
+    switch (Request->Kind)
+    {
+    case FspFsctlTransactOverwriteKind:
+    case FspFsctlTransactCleanupKind:
+    case FspFsctlTransactCloseKind:
+    case FspFsctlTransactReadKind:
+    case FspFsctlTransactWriteKind:
+    case FspFsctlTransactQueryInformationKind:
+    case FspFsctlTransactSetInformationKind:
+    case FspFsctlTransactFlushBuffersKind:
+    case FspFsctlTransactQueryDirectoryKind:
+    case FspFsctlTransactFileSystemControlKind:
+    case FspFsctlTransactQuerySecurityKind:
+    case FspFsctlTransactSetSecurityKind:
+    case FspFsctlTransactQueryStreamInformationKind:
+        /* these requests all start with the file's UserContext and UserContext2 */
+        Record->UserContext = Request->Req.QueryInformation.UserContext;
+        Record->UserContext2 = Request->Req.QueryInformation.UserContext2;
+        break;
+    }
+
+    FspDebugTraceAppendEnd(Ring);
+}
+
+static VOID FspDebugTraceAppendResponse(FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    FSP_DEBUG_TRACE_RING *Ring;
+    FSP_DEBUG_TRACE_RECORD *Record;
+
+    Record = FspDebugTraceAppendBegin(&Ring, FspDebugTraceResponse, Response->Kind, Response->Hint);
+    if (0 == Record)
+        return;
+
+    Record->Status = Response->IoStatus.Status;
+    Record->Information = Response->IoStatus.Information;
+
+    if (STATUS_SUCCESS == Response->IoStatus.Status)
+        switch (Response->Kind)
+        {
+        case FspFsctlTransactCreateKind:
+            Record->UserContext = Response->Rsp.Create.Opened.UserContext;
+            Record->UserContext2 = Response->Rsp.Create.Opened.UserContext2;
+            Record->Arg0 = Response->Rsp.Create.Opened.FileInfo.FileSize;
+            Record->Arg1 = Response->Rsp.Create.Opened.GrantedAccess;
+            Record->Arg2 = Response->Rsp.Create.Opened.FileInfo.FileAttributes;
+            break;
+        case FspFsctlTransactOverwriteKind:
+        case FspFsctlTransactWriteKind:
+        case FspFsctlTransactQueryInformationKind:
+        case FspFsctlTransactSetInformationKind:
+        case FspFsctlTransactFlushBuffersKind:
+            /* these responses all start with the file's FileInfo */
+            Record->Arg0 = Response->Rsp.QueryInformation.FileInfo.FileSize;
+            Record->Arg2 = Response->Rsp.QueryInformation.FileInfo.FileAttributes;
+            break;
+        }
+
+    FspDebugTraceAppendEnd(Ring);
+}
+
+static VOID FspDebugTraceDrain(VOID)
+{
+    FSP_DEBUG_TRACE_RING *Ring, **PRing;
+    FSP_DEBUG_TRACE_RECORD *Record;
+    LARGE_INTEGER Counter;
+    ULONG Count = 0, Head, Tail, Dropped, Index, Chunk;
+    DWORD BytesTransferred;
+
+    /*
+     * The lock is held exclusive while writing; it only delays threads that are about
+     * to register a new ring, which happens once per thread.
+     */
+    AcquireSRWLockExclusive(&FspDebugTraceLock);
+
+    for (PRing = &FspDebugTraceRings; 0 != (Ring = *PRing);)
+    {
+        Dropped = Ring->Dropped;
+        if (Ring->DroppedReported != Dropped)
+        {
+            if (FSP_DEBUG_TRACE_BUFFER_SIZE == Count)
+            {
+                WriteFile(FspDebugTraceHandle,
+                    FspDebugTraceBuffer, Count * sizeof(FSP_DEBUG_TRACE_RECORD),
+                    &BytesTransferred, 0);
+                Count = 0;
+            }
+
+            QueryPerformanceCounter(&Counter);
+
+            Record = &FspDebugTraceBuffer[Count++];
+            memset(Record, 0, sizeof *Record);
+            Record->Type = FspDebugTraceDropped;
+            Record->ThreadId = Ring->ThreadId;
+            Record->Counter = Counter.QuadPart;
+            Record->Arg0 = Dropped - Ring->DroppedReported;
+            Ring->DroppedReported = Dropped;
+        }
+
+        /* volatile load: acquire; records up to Head are visible */
+        Head = Ring->Head;
+        for (Tail = Ring->Tail; Head != Tail; Tail += Chunk)
+        {
+            if (FSP_DEBUG_TRACE_BUFFER_SIZE == Count)
+            {
+                WriteFile(FspDebugTraceHandle,
+                    FspDebugTraceBuffer, Count * sizeof(FSP_DEBUG_TRACE_RECORD),
+                    &BytesTransferred, 0);
+                Count = 0;
+            }
+
+            Index = Tail & (FSP_DEBUG_TRACE_RING_SIZE - 1);
+            Chunk = Head - Tail;
+            if (Chunk > FSP_DEBUG_TRACE_RING_SIZE - Index)
+                Chunk = FSP_DEBUG_TRACE_RING_SIZE - Index;
+            if (Chunk > FSP_DEBUG_TRACE_BUFFER_SIZE - Count)
+                Chunk = FSP_DEBUG_TRACE_BUFFER_SIZE - Count;
+
+            memcpy(FspDebugTraceBuffer + Count, Ring->Records + Index,
+                Chunk * sizeof(FSP_DEBUG_TRACE_RECORD));
+            Count += Chunk;
+
+            /* volatile store: release; the producer may reuse the copied records */
+            Ring->Tail = Tail + Chunk;
+        }
+
+        if (Ring->Abandoned)
+        {
+            *PRing = Ring->Next;
+            MemFree(Ring);
+        }
+        else
+            PRing = &Ring->Next;
+    }
+
+    if (0 != Count)
+        WriteFile(FspDebugTraceHandle,
+            FspDebugTraceBuffer, Count * sizeof(FSP_DEBUG_TRACE_RECORD),
+            &BytesTransferred, 0);
+
+    ReleaseSRWLockExclusive(&FspDebugTraceLock);
+}
+
+static DWORD WINAPI FspDebugTraceDrainer(PVOID Context)
+{
+    BOOLEAN Stop;
+
+    do
+    {
+        Stop = WAIT_OBJECT_0 ==
+            WaitForSingleObject(FspDebugTraceStopEvent, FSP_DEBUG_TRACE_DRAIN_INTERVAL);
+        FspDebugTraceDrain();
+    } while (!Stop);
+
+    return 0;
+}
+
+FSP_API NTSTATUS FspDebugTraceStart(HANDLE Handle)
+{
+    FSP_DEBUG_TRACE_HEADER Header;
+    FSP_DEBUG_TRACE_RING *Ring;
+    LARGE_INTEGER Frequency, Counter;
+    FILETIME StartTime;
+    DWORD BytesTransferred;
+    NTSTATUS Result;
+
+    if (0 != FspDebugTraceThread)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    if (TLS_OUT_OF_INDEXES == FspDebugTraceTlsIndex)
+    {
+        /* the TLS index is kept for the lifetime of the process; see FspDebugTraceFinalizeThread */
+        FspDebugTraceTlsIndex = TlsAlloc();
+        if (TLS_OUT_OF_INDEXES == FspDebugTraceTlsIndex)
+            return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    FspDebugTraceBuffer = MemAlloc(FSP_DEBUG_TRACE_BUFFER_SIZE * sizeof(FSP_DEBUG_TRACE_RECORD));
+    if (0 == FspDebugTraceBuffer)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    FspDebugTraceStopEvent = CreateEventW(0, TRUE, FALSE, 0);
+    if (0 == FspDebugTraceStopEvent)
+    {
+        Result = FspNtStatusFromWin32(GetLastError());
+        goto exit;
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Counter);
+    GetSystemTimeAsFileTime(&StartTime);
+
+    memset(&Header, 0, sizeof Header);
+    memcpy(Header.Magic, FSP_DEBUG_TRACE_MAGIC, sizeof FSP_DEBUG_TRACE_MAGIC);
+    Header.Version = FSP_DEBUG_TRACE_VERSION;
+    Header.RecordSize = sizeof(FSP_DEBUG_TRACE_RECORD);
+    Header.Frequency = Frequency.QuadPart;
+    Header.StartCounter = Counter.QuadPart;
+    Header.StartTime = ((PLARGE_INTEGER)&StartTime)->QuadPart;
+    Header.ProcessId = GetCurrentProcessId();
+    if (!WriteFile(Handle, &Header, sizeof Header, &BytesTransferred, 0))
+    {
+        Result = FspNtStatusFromWin32(GetLastError());
+        goto exit;
+    }
+
+    /* discard records left over from a previous trace */
+    AcquireSRWLockExclusive(&FspDebugTraceLock);
+    for (Ring = FspDebugTraceRings; 0 != Ring; Ring = Ring->Next)
+    {
+        Ring->Tail = Ring->Head;
+        Ring->DroppedReported = Ring->Dropped;
+    }
+    ReleaseSRWLockExclusive(&FspDebugTraceLock);
+
+    FspDebugTraceHandle = Handle;
+    FspDebugTraceThread = CreateThread(0, 0, FspDebugTraceDrainer, 0, 0, 0);
+    if (0 == FspDebugTraceThread)
+    {
+        Result = FspNtStatusFromWin32(GetLastError());
+        goto exit;
+    }
+
+    FspDebugTraceActive = TRUE;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (!NT_SUCCESS(Result))
+    {
+        if (0 != FspDebugTraceStopEvent)
+            CloseHandle(FspDebugTraceStopEvent);
+        FspDebugTraceStopEvent = 0;
+
+        MemFree(FspDebugTraceBuffer);
+        FspDebugTraceBuffer = 0;
+
+        FspDebugTraceHandle = 0;
+    }
+
+    return Result;
+}
+
+FSP_API VOID FspDebugTraceStop(VOID)
+{
+    if (0 == FspDebugTraceThread)
+        return;
+
+    /* under the lock so that exiting threads agree with the drainer on who frees rings */
+    AcquireSRWLockExclusive(&FspDebugTraceLock);
+    FspDebugTraceActive = FALSE;
+    ReleaseSRWLockExclusive(&FspDebugTraceLock);
+
+    /* the drainer does a final drain before it exits */
+    SetEvent(FspDebugTraceStopEvent);
+    WaitForSingleObject(FspDebugTraceThread, INFINITE);
+
+    CloseHandle(FspDebugTraceThread);
+    FspDebugTraceThread = 0;
+
+    CloseHandle(FspDebugTraceStopEvent);
+    FspDebugTraceStopEvent = 0;
+
+    MemFree(FspDebugTraceBuffer);
+    FspDebugTraceBuffer = 0;
+
+    FspDebugTraceHandle = 0;
+}
+
+VOID FspDebugTraceFinalizeThread(VOID)
+{
+    FSP_DEBUG_TRACE_RING *Ring, **PRing;
+
+    if (TLS_OUT_OF_INDEXES == FspDebugTraceTlsIndex)
+        return;
+
+    Ring = TlsGetValue(FspDebugTraceTlsIndex);
+    if (0 == Ring)
+        return;
+
+    TlsSetValue(FspDebugTraceTlsIndex, 0);
+
+    AcquireSRWLockExclusive(&FspDebugTraceLock);
+    if (FspDebugTraceActive)
+    {
+        /* the drainer frees the ring after it has drained its last records */
+        Ring->Abandoned = TRUE;
+        Ring = 0;
+    }
+    else
+    {
+        for (PRing = &FspDebugTraceRings; Ring != *PRing; PRing = &(*PRing)->Next)
+            ;
+        *PRing = Ring->Next;
+    }
+    ReleaseSRWLockExclusive(&FspDebugTraceLock);
+
+    MemFree(Ring);
+}
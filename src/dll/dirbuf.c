@@ -30,6 +30,11 @@ typedef struct
     SRWLOCK Lock;
     ULONG Capacity, LoMark, HiMark;
     PUINT8 Buffer;
+    volatile ULONG ReadHint;            /* index of last entry returned by ReadDirectory */
+    volatile LONG RefCount;             /* handles (and the directory cache) using the buffer */
+    BOOLEAN Shared;                     /* buffer belongs to the directory cache; immutable */
+    UINT32 CacheHash;
+    NTSTATUS CacheResult;               /* STATUS_PENDING while the buffer is being filled */
 } FSP_FILE_SYSTEM_DIRECTORY_BUFFER;
 
 static int FspFileSystemDirectoryBufferFileNameCmp(PWSTR a, int alen, PWSTR b, int blen)
@@ -211,13 +216,197 @@ static VOID FspFileSystemQSortDirectoryBuffer(PUINT8 Buffer, PULONG Index, int l
 #undef compexch
 #undef exch
 
+/*
+ * Multikey radix sort
+ *
+ * Based on Bentley and Sedgewick's "Fast Algorithms for Sorting and Searching Strings".
+ *
+ * Sorts a side array of precomputed keys rather than the index itself. Every key holds
+ * the entry's offset and name length and the 4 characters of the name at the current
+ * depth packed into a 64-bit integer (zero-padded past the end of the name; names never
+ * contain L'\0'), so that ordering by key is the same as ordering by the file name
+ * comparison above. Keys are partitioned three-way on this integer; the equal partition
+ * is then sorted on the next 4 characters, so a name is only reloaded from the buffer
+ * once per 4 characters of common prefix. Small partitions fall back to insertion sort
+ * that only compares the name remainders when the packed characters tie.
+ */
+
+#define FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY_CHARS 4
+#define FSP_FILE_SYSTEM_DIRECTORY_BUFFER_SMALL_SORT 16
+
+typedef struct
+{
+    UINT64 Prefix;
+    ULONG Offset;
+    ULONG Length;
+} FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY;
+
+static __forceinline
+PWSTR FspFileSystemDirectoryBufferKeyName(PUINT8 Buffer, FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Key)
+{
+    return ((FSP_FSCTL_DIR_INFO *)(Buffer + Key->Offset))->FileNameBuf;
+}
+
+static __forceinline
+UINT64 FspFileSystemDirectoryBufferKeyPrefix(PWSTR FileName, ULONG Length, ULONG Depth)
+{
+    UINT64 Prefix = 0;
+
+    for (ULONG I = Depth; Depth + FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY_CHARS > I; I++)
+        Prefix = (Prefix << 16) | (I < Length ? FileName[I] : 0);
+
+    return Prefix;
+}
+
+static __forceinline
+int FspFileSystemDirectoryBufferKeyCmp(PUINT8 Buffer,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *KeyA, FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *KeyB,
+    ULONG Depth)
+{
+    ULONG Length;
+    int res;
+
+    if (KeyA->Prefix != KeyB->Prefix)
+        return KeyA->Prefix < KeyB->Prefix ? -1 : +1;
+
+    /* prefixes tie; compare the remainder of the names (never reached for "." and "..") */
+    Depth += FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY_CHARS;
+    Length = KeyA->Length < KeyB->Length ? KeyA->Length : KeyB->Length;
+    if (Depth < Length)
+    {
+        res = invariant_wcsncmp(
+            FspFileSystemDirectoryBufferKeyName(Buffer, KeyA) + Depth,
+            FspFileSystemDirectoryBufferKeyName(Buffer, KeyB) + Depth,
+            Length - Depth);
+        if (0 != res)
+            return res;
+    }
+
+    return (int)KeyA->Length - (int)KeyB->Length;
+}
+
+#define exch(a, b)                      { FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY t = a; a = b; b = t; }
+
+static VOID FspFileSystemRadixSortDirectoryBuffer(PUINT8 Buffer,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys, ULONG Count, ULONG Depth)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Part[3];
+    ULONG PartCount[3], PartDepth[3], Largest;
+    UINT64 a, b, c, v;
+    ULONG lt, gt, i, j;
+
+    /*
+     * Recurse into the two smaller partitions and loop on the largest one;
+     * this bounds the recursion depth to log2(Count).
+     */
+    for (;;)
+    {
+        if (FSP_FILE_SYSTEM_DIRECTORY_BUFFER_SMALL_SORT > Count)
+        {
+            for (i = 1; Count > i; i++)
+                for (j = i; 0 < j &&
+                    0 < FspFileSystemDirectoryBufferKeyCmp(Buffer, &Keys[j - 1], &Keys[j], Depth); j--)
+                    exch(Keys[j - 1], Keys[j]);
+            return;
+        }
+
+        /* median-of-three pivot */
+        a = Keys[0].Prefix; b = Keys[Count / 2].Prefix; c = Keys[Count - 1].Prefix;
+        v = a < b ?
+            (b < c ? b : (a < c ? c : a)) :
+            (a < c ? a : (b < c ? c : b));
+
+        /* three-way partition: [0, lt) < v, [lt, gt) == v, [gt, Count) > v */
+        for (lt = 0, gt = Count, i = 0; gt > i;)
+        {
+            if (Keys[i].Prefix < v)
+            {
+                exch(Keys[lt], Keys[i]);
+                lt++, i++;
+            }
+            else if (Keys[i].Prefix > v)
+            {
+                gt--;
+                exch(Keys[i], Keys[gt]);
+            }
+            else
+                i++;
+        }
+
+        Part[0] = Keys; PartCount[0] = lt; PartDepth[0] = Depth;
+        Part[1] = Keys + lt; PartCount[1] = gt - lt; PartDepth[1] = Depth + FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY_CHARS;
+        Part[2] = Keys + gt; PartCount[2] = Count - gt; PartDepth[2] = Depth;
+
+        /*
+         * If the pivot name ends within the current characters, all names in the
+         * equal partition are the same. Otherwise load their next characters.
+         */
+        if (0 == (v & 0xffff))
+            PartCount[1] = 0;
+        else
+            for (i = 0; PartCount[1] > i; i++)
+                Part[1][i].Prefix = FspFileSystemDirectoryBufferKeyPrefix(
+                    FspFileSystemDirectoryBufferKeyName(Buffer, &Part[1][i]), Part[1][i].Length,
+                    PartDepth[1]);
+
+        Largest = PartCount[0] >= PartCount[1] ?
+            (PartCount[0] >= PartCount[2] ? 0 : 2) :
+            (PartCount[1] >= PartCount[2] ? 1 : 2);
+        for (i = 0; 3 > i; i++)
+            if (Largest != i && 1 < PartCount[i])
+                FspFileSystemRadixSortDirectoryBuffer(Buffer, Part[i], PartCount[i], PartDepth[i]);
+
+        Keys = Part[Largest];
+        Count = PartCount[Largest];
+        Depth = PartDepth[Largest];
+    }
+}
+
+#undef exch
+
 static inline VOID FspFileSystemSortDirectoryBuffer(FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer)
 {
     PUINT8 Buffer = DirBuffer->Buffer;
     PULONG Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
     ULONG Count = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    ULONG Length;
+
+    if (2 > Count)
+        return;
+
+    Keys = MemAlloc(Count * sizeof *Keys);
+    if (0 == Keys)
+    {
+        /* not enough memory for the keys; sort the index in place */
+        FspFileSystemQSortDirectoryBuffer(Buffer, Index, 0, Count - 1);
+        return;
+    }
+
+    for (ULONG I = 0; Count > I; I++)
+    {
+        DirInfo = (PVOID)(Buffer + Index[I]);
+        Length = (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR);
 
-    FspFileSystemQSortDirectoryBuffer(Buffer, Index, 0, Count - 1);
+        Keys[I].Offset = Index[I];
+        Keys[I].Length = Length;
+
+        /* order "." and ".." first */
+        if (1 == Length && L'.' == DirInfo->FileNameBuf[0])
+            Keys[I].Prefix = 0x0001000000000000ULL;
+        else if (2 == Length && L'.' == DirInfo->FileNameBuf[0] && L'.' == DirInfo->FileNameBuf[1])
+            Keys[I].Prefix = 0x0001000100000000ULL;
+        else
+            Keys[I].Prefix = FspFileSystemDirectoryBufferKeyPrefix(DirInfo->FileNameBuf, Length, 0);
+    }
+
+    FspFileSystemRadixSortDirectoryBuffer(Buffer, Keys, Count, 0);
+
+    for (ULONG I = 0; Count > I; I++)
+        Index[I] = Keys[I].Offset;
+
+    MemFree(Keys);
 }
 
 FSP_API BOOLEAN FspFileSystemAcquireDirectoryBuffer(PVOID *PDirBuffer,
@@ -236,6 +425,7 @@ FSP_API BOOLEAN FspFileSystemAcquireDirectoryBuffer(PVOID *PDirBuffer,
             RETURN(STATUS_INSUFFICIENT_RESOURCES, FALSE);
         memset(NewDirBuffer, 0, sizeof *NewDirBuffer);
         InitializeSRWLock(&NewDirBuffer->Lock);
+        NewDirBuffer->RefCount = 1;
         AcquireSRWLockExclusive(&NewDirBuffer->Lock);
 
         AcquireSRWLockExclusive(&CreateLock);
@@ -254,10 +444,18 @@ FSP_API BOOLEAN FspFileSystemAcquireDirectoryBuffer(PVOID *PDirBuffer,
 
     if (Reset)
     {
+        if (DirBuffer->Shared)
+        {
+            /* never refill a listing shared through the directory cache; detach from it */
+            FspFileSystemDeleteDirectoryBuffer(PDirBuffer);
+            return FspFileSystemAcquireDirectoryBuffer(PDirBuffer, Reset, PResult);
+        }
+
         AcquireSRWLockExclusive(&DirBuffer->Lock);
 
         DirBuffer->LoMark = 0;
         DirBuffer->HiMark = DirBuffer->Capacity;
+        DirBuffer->ReadHint = 0;
 
         RETURN(STATUS_SUCCESS, TRUE);
     }
@@ -349,16 +547,27 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
 
         PULONG Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
         ULONG Count = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
-        ULONG IndexNum;
+        ULONG IndexNum, MarkerLen;
         FSP_FSCTL_DIR_INFO *DirInfo;
 
         if (0 == Marker)
             IndexNum = 0;
         else
         {
-            FspFileSystemSearchDirectoryBuffer(DirBuffer,
-                Marker, lstrlenW(Marker),
-                &IndexNum);
+            /*
+             * A sequential enumeration passes the last name we returned as the marker.
+             * Check the entry we remember before falling back to the binary search.
+             * (The hint is only a hint: concurrent readers may race on it.)
+             */
+            MarkerLen = lstrlenW(Marker);
+            IndexNum = DirBuffer->ReadHint;
+            DirInfo = IndexNum < Count ? (PVOID)(DirBuffer->Buffer + Index[IndexNum]) : 0;
+            if (0 == DirInfo || 0 != FspFileSystemDirectoryBufferFileNameCmp(
+                DirInfo->FileNameBuf, (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR),
+                Marker, MarkerLen))
+                FspFileSystemSearchDirectoryBuffer(DirBuffer,
+                    Marker, MarkerLen,
+                    &IndexNum);
             IndexNum++;
         }
 
@@ -367,10 +576,14 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
             DirInfo = (PVOID)(DirBuffer->Buffer + Index[IndexNum]);
             if (!FspFileSystemAddDirInfo(DirInfo, Buffer, Length, PBytesTransferred))
             {
+                if (0 < IndexNum)
+                    DirBuffer->ReadHint = IndexNum - 1;
                 ReleaseSRWLockShared(&DirBuffer->Lock);
                 return;
             }
         }
+        if (0 < IndexNum)
+            DirBuffer->ReadHint = IndexNum - 1;
 
         ReleaseSRWLockShared(&DirBuffer->Lock);
     }
@@ -385,12 +598,689 @@ FSP_API VOID FspFileSystemDeleteDirectoryBuffer(PVOID *PDirBuffer)
 
     if (0 != DirBuffer)
     {
-        MemFree(DirBuffer->Buffer);
-        MemFree(DirBuffer);
+        if (0 == InterlockedDecrement(&DirBuffer->RefCount))
+        {
+            MemFree(DirBuffer->Buffer);
+            MemFree(DirBuffer);
+        }
         *PDirBuffer = 0;
     }
 }
 
+/*
+ * Directory cache
+ *
+ * A direct-mapped table of shared directory buffers keyed by directory name, modeled after
+ * the access check cache. A cache entry holds a reference to its buffer and so does every
+ * handle that reads it; the buffer is freed when the last reference is dropped. An entry
+ * with an ExpirationTime of 0 is pending: its buffer is being filled by the handle that
+ * missed and is locked exclusive until FspFileSystemReleaseCachedDirectoryBuffer, so that
+ * other handles wait for the listing by simply acquiring the buffer lock shared.
+ */
+
+enum
+{
+    FspDirectoryCacheCapacityMin = 16,
+    FspDirectoryCacheCapacityMax = 4096,
+    FspDirectoryCacheTimeoutDefault = 1000,
+};
+
+typedef struct
+{
+    UINT32 Hash;
+    UINT64 ExpirationTime;              /* GetTickCount64; 0 if the entry is pending */
+    ULONG DirNameLength;                /* in WCHAR's; 0 if the entry is unused */
+    PWSTR DirName;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer;
+} FSP_DIRECTORY_CACHE_ENTRY;
+
+typedef struct
+{
+    SRWLOCK Lock;
+    ULONG Capacity;                     /* power of 2 */
+    ULONG Timeout;
+    ULONG Count;
+    BOOLEAN CaseSensitive;
+    volatile LONG64 HitCount, MissCount, InsertCount, InvalidateCount;
+    FSP_DIRECTORY_CACHE_ENTRY Entries[];
+} FSP_DIRECTORY_CACHE;
+
+static inline ULONG FspDirectoryCacheDirNameLength(PWSTR DirName)
+{
+    /* ignore a trailing backslash, except for the root */
+    ULONG DirNameLength = lstrlenW(DirName);
+    if (1 < DirNameLength && L'\\' == DirName[DirNameLength - 1])
+        DirNameLength--;
+    return DirNameLength;
+}
+
+static inline VOID FspDirectoryCacheRemoveEntry(FSP_DIRECTORY_CACHE *Cache,
+    FSP_DIRECTORY_CACHE_ENTRY *Entry)
+{
+    PVOID DirBuffer = Entry->DirBuffer;
+
+    /* a pending buffer stays with the handle that fills it and is not published */
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer);
+    MemFree(Entry->DirName);
+    Entry->DirBuffer = 0;
+    Entry->DirName = 0;
+    Entry->DirNameLength = 0;
+    Cache->Count--;
+}
+
+static VOID FspDirectoryCacheInvalidate(FSP_DIRECTORY_CACHE *Cache,
+    PWSTR FileName, BOOLEAN ParentOnly)
+{
+    FSP_DIRECTORY_CACHE_ENTRY *Entry;
+    ULONG FileNameLength, ParentLength;
+    BOOLEAN All;
+
+    InterlockedIncrement64(&Cache->InvalidateCount);
+
+    All = 0 == FileName || (L'\\' == FileName[0] && L'\0' == FileName[1]);
+    if (!All)
+    {
+        /* a stream is listed with its file; use the file name */
+        for (FileNameLength = 0;
+            L'\0' != FileName[FileNameLength] && L':' != FileName[FileNameLength];
+            FileNameLength++)
+            ;
+        while (1 < FileNameLength && L'\\' == FileName[FileNameLength - 1])
+            FileNameLength--;
+        for (ParentLength = FileNameLength; 0 < ParentLength; ParentLength--)
+            if (L'\\' == FileName[ParentLength - 1])
+                break;
+        if (1 < ParentLength)
+            ParentLength--;
+        else
+            ParentLength = 1;           /* the root */
+    }
+    else
+        FileNameLength = ParentLength = 0;
+
+    AcquireSRWLockExclusive(&Cache->Lock);
+    if (0 != Cache->Count)
+        for (ULONG I = 0; Cache->Capacity > I; I++)
+        {
+            Entry = &Cache->Entries[I];
+            if (0 == Entry->DirNameLength)
+                continue;
+
+            /*
+             * Invalidate the listing of the parent directory and unless ParentOnly the
+             * listings of FileName itself and of any directory under it (case-insensitive).
+             */
+            if (All ||
+                (
+                    ParentLength == Entry->DirNameLength &&
+                    CSTR_EQUAL == CompareStringOrdinal(
+                        Entry->DirName, ParentLength, FileName, ParentLength, TRUE)
+                ) ||
+                (
+                    !ParentOnly &&
+                    FileNameLength <= Entry->DirNameLength &&
+                    (FileNameLength == Entry->DirNameLength ||
+                        L'\\' == Entry->DirName[FileNameLength]) &&
+                    CSTR_EQUAL == CompareStringOrdinal(
+                        Entry->DirName, FileNameLength, FileName, FileNameLength, TRUE)
+                ))
+                FspDirectoryCacheRemoveEntry(Cache, Entry);
+        }
+    ReleaseSRWLockExclusive(&Cache->Lock);
+}
+
+FSP_API NTSTATUS FspFileSystemSetDirectoryCache(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Capacity, ULONG Timeout, BOOLEAN CaseSensitive)
+{
+    FSP_DIRECTORY_CACHE *Cache = 0;
+    ULONG CacheCapacity;
+
+    if (0 != FileSystem->DispatcherThread)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    if (0 != Capacity)
+    {
+        CacheCapacity = FspCacheCapacity(Capacity,
+            FspDirectoryCacheCapacityMin, FspDirectoryCacheCapacityMax);
+
+        Cache = MemAlloc(sizeof *Cache + CacheCapacity * sizeof Cache->Entries[0]);
+        if (0 == Cache)
+            return STATUS_INSUFFICIENT_RESOURCES;
+        memset(Cache, 0, sizeof *Cache + CacheCapacity * sizeof Cache->Entries[0]);
+
+        InitializeSRWLock(&Cache->Lock);
+        Cache->Capacity = CacheCapacity;
+        Cache->Timeout = 0 != Timeout ? Timeout : FspDirectoryCacheTimeoutDefault;
+        Cache->CaseSensitive = CaseSensitive;
+    }
+
+    FspFileSystemDeleteDirectoryCache(FileSystem);
+    FileSystem->DirectoryCache = Cache;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API BOOLEAN FspFileSystemAcquireCachedDirectoryBuffer(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR DirName, PVOID *PDirBuffer, BOOLEAN Reset, PNTSTATUS PResult)
+{
+    FSP_DIRECTORY_CACHE *Cache = FileSystem->DirectoryCache;
+    FSP_DIRECTORY_CACHE_ENTRY *Entry;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer;
+    PWSTR DirNameCopy;
+    ULONG DirNameLength;
+    UINT32 Hash;
+    NTSTATUS Result;
+
+    if (0 == Cache || 0 == DirName)
+        return FspFileSystemAcquireDirectoryBuffer(PDirBuffer, Reset, PResult);
+
+    /* keep paging through the handle's listing unless the enumeration restarts */
+    if (!Reset && 0 != *PDirBuffer)
+        RETURN(STATUS_SUCCESS, FALSE);
+
+    FspFileSystemDeleteDirectoryBuffer(PDirBuffer);
+
+    DirNameLength = FspDirectoryCacheDirNameLength(DirName);
+    Hash = FspCacheHashFileName(DirName, DirNameLength);
+    Entry = &Cache->Entries[FspCacheSlot(Hash, Cache->Capacity)];
+
+    for (;;)
+    {
+        AcquireSRWLockShared(&Cache->Lock);
+        DirBuffer = 0;
+        if (0 != Entry->DirNameLength &&
+            Hash == Entry->Hash &&
+            (0 == Entry->ExpirationTime || GetTickCount64() < Entry->ExpirationTime) &&
+            FspCacheFileNameEqual(
+                Entry->DirName, Entry->DirNameLength, DirName, DirNameLength,
+                Cache->CaseSensitive))
+        {
+            DirBuffer = Entry->DirBuffer;
+            InterlockedIncrement(&DirBuffer->RefCount);
+        }
+        ReleaseSRWLockShared(&Cache->Lock);
+
+        if (0 == DirBuffer)
+            break;
+
+        /* if the listing is pending this waits until it has been filled */
+        AcquireSRWLockShared(&DirBuffer->Lock);
+        Result = DirBuffer->CacheResult;
+        ReleaseSRWLockShared(&DirBuffer->Lock);
+
+        *PDirBuffer = DirBuffer;
+        if (NT_SUCCESS(Result))
+        {
+            InterlockedIncrement64(&Cache->HitCount);
+            RETURN(STATUS_SUCCESS, FALSE);
+        }
+
+        /* the handle that was filling the listing failed and removed it; try again */
+        FspFileSystemDeleteDirectoryBuffer(PDirBuffer);
+    }
+
+    InterlockedIncrement64(&Cache->MissCount);
+
+    DirNameCopy = MemAlloc(DirNameLength * sizeof(WCHAR));
+    DirBuffer = MemAlloc(sizeof *DirBuffer);
+    if (0 == DirNameCopy || 0 == DirBuffer)
+    {
+        MemFree(DirBuffer);
+        MemFree(DirNameCopy);
+        return FspFileSystemAcquireDirectoryBuffer(PDirBuffer, Reset, PResult);
+    }
+    memcpy(DirNameCopy, DirName, DirNameLength * sizeof(WCHAR));
+    memset(DirBuffer, 0, sizeof *DirBuffer);
+    InitializeSRWLock(&DirBuffer->Lock);
+    DirBuffer->RefCount = 2;            /* this handle and the cache */
+    DirBuffer->Shared = TRUE;
+    DirBuffer->CacheHash = Hash;
+    DirBuffer->CacheResult = STATUS_PENDING;
+    AcquireSRWLockExclusive(&DirBuffer->Lock);
+
+    /*
+     * If another handle published a pending entry for the same directory in the meantime
+     * we replace it; both handles fill and only the last one to start remains cached.
+     */
+    AcquireSRWLockExclusive(&Cache->Lock);
+    if (0 != Entry->DirNameLength)
+        FspDirectoryCacheRemoveEntry(Cache, Entry);
+    Entry->Hash = Hash;
+    Entry->ExpirationTime = 0;
+    Entry->DirNameLength = DirNameLength;
+    Entry->DirName = DirNameCopy;
+    Entry->DirBuffer = DirBuffer;
+    Cache->Count++;
+    ReleaseSRWLockExclusive(&Cache->Lock);
+
+    *PDirBuffer = DirBuffer;
+    RETURN(STATUS_SUCCESS, TRUE);
+}
+
+FSP_API VOID FspFileSystemReleaseCachedDirectoryBuffer(FSP_FILE_SYSTEM *FileSystem,
+    PVOID *PDirBuffer, NTSTATUS Result)
+{
+    /* assume that FspFileSystemAcquireCachedDirectoryBuffer has returned TRUE */
+
+    FSP_DIRECTORY_CACHE *Cache = FileSystem->DirectoryCache;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer = *PDirBuffer;
+    FSP_DIRECTORY_CACHE_ENTRY *Entry;
+
+    if (!DirBuffer->Shared)
+    {
+        FspFileSystemReleaseDirectoryBuffer(PDirBuffer);
+        return;
+    }
+
+    if (NT_SUCCESS(Result))
+        FspFileSystemSortDirectoryBuffer(DirBuffer);
+
+    Entry = &Cache->Entries[FspCacheSlot(DirBuffer->CacheHash, Cache->Capacity)];
+    AcquireSRWLockExclusive(&Cache->Lock);
+    if (Entry->DirBuffer == DirBuffer)
+    {
+        /* not invalidated or replaced while it was being filled */
+        if (NT_SUCCESS(Result))
+        {
+            Entry->ExpirationTime = GetTickCount64() + Cache->Timeout;
+            InterlockedIncrement64(&Cache->InsertCount);
+        }
+        else
+            FspDirectoryCacheRemoveEntry(Cache, Entry);
+    }
+    ReleaseSRWLockExclusive(&Cache->Lock);
+
+    DirBuffer->CacheResult = NT_SUCCESS(Result) ? STATUS_SUCCESS : Result;
+    ReleaseSRWLockExclusive(&DirBuffer->Lock);
+}
+
+FSP_API VOID FspFileSystemInvalidateDirectoryCache(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName)
+{
+    if (0 != FileSystem->DirectoryCache)
+        FspDirectoryCacheInvalidate(FileSystem->DirectoryCache, FileName, FALSE);
+}
+
+VOID FspFileSystemInvalidateDirectoryCacheParent(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName)
+{
+    /* a change that is only visible in the listing that contains FileName */
+    if (0 != FileSystem->DirectoryCache)
+        FspDirectoryCacheInvalidate(FileSystem->DirectoryCache, FileName, TRUE);
+}
+
+FSP_API NTSTATUS FspFileSystemGetDirectoryCacheStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_DIRECTORY_CACHE_STATISTICS *Statistics)
+{
+    FSP_DIRECTORY_CACHE *Cache = FileSystem->DirectoryCache;
+
+    if (0 == Cache)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    AcquireSRWLockShared(&Cache->Lock);
+    Statistics->Capacity = Cache->Capacity;
+    Statistics->Count = Cache->Count;
+    ReleaseSRWLockShared(&Cache->Lock);
+    Statistics->HitCount = Cache->HitCount;
+    Statistics->MissCount = Cache->MissCount;
+    Statistics->InsertCount = Cache->InsertCount;
+    Statistics->InvalidateCount = Cache->InvalidateCount;
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspFileSystemDeleteDirectoryCache(FSP_FILE_SYSTEM *FileSystem)
+{
+    FSP_DIRECTORY_CACHE *Cache = FileSystem->DirectoryCache;
+
+    if (0 == Cache)
+        return;
+
+    for (ULONG I = 0; Cache->Capacity > I; I++)
+        if (0 != Cache->Entries[I].DirNameLength)
+            FspDirectoryCacheRemoveEntry(Cache, &Cache->Entries[I]);
+    MemFree(Cache);
+
+    FileSystem->DirectoryCache = 0;
+}
+
+/*
+ * Streaming directory buffer
+ *
+ * For file systems whose enumeration already produces entries in ReadDirectory order.
+ * A producer (usually a separate thread) appends entries while ReadDirectory serves pages
+ * from the same buffer, so the first page does not wait for the whole enumeration. Memory
+ * is bounded by a sliding window: entries that have been read are evicted (except for the
+ * last one, which anchors the next marker) and the producer blocks while the window is full
+ * of unread entries. Resuming from the marker of the previous page is O(1).
+ */
+
+#define FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK ((ULONG)-1)
+#define FSP_FILE_SYSTEM_DIRECTORY_STREAM_WINDOW_DEFAULT (256 * 1024)
+
+typedef struct
+{
+    SRWLOCK Lock;
+    CONDITION_VARIABLE Cond;
+    ULONG WindowSize, Capacity;
+    ULONG LoMark;                       /* end of entries */
+    ULONG ReadMark;                     /* first unread entry */
+    ULONG LastReadMark, LastFillMark;   /* last read/filled entry or NOMARK */
+    PUINT8 Buffer;
+    BOOLEAN Producing, Cancel, Done, Evicted;
+    NTSTATUS Result;
+} FSP_FILE_SYSTEM_DIRECTORY_STREAM;
+
+static inline int FspFileSystemDirectoryStreamCmp(FSP_FSCTL_DIR_INFO *DirInfo,
+    PWSTR FileName, int FileNameLen)
+{
+    return FspFileSystemDirectoryBufferFileNameCmp(
+        DirInfo->FileNameBuf, (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR),
+        FileName, FileNameLen);
+}
+
+static VOID FspFileSystemCancelDirectoryStreamProducer(FSP_FILE_SYSTEM_DIRECTORY_STREAM *DirStream)
+{
+    /* assume that the DirStream lock is held exclusive */
+
+    while (DirStream->Producing)
+    {
+        DirStream->Cancel = TRUE;
+        WakeAllConditionVariable(&DirStream->Cond);
+        SleepConditionVariableSRW(&DirStream->Cond, &DirStream->Lock, INFINITE, 0);
+    }
+}
+
+FSP_API BOOLEAN FspFileSystemAcquireDirectoryStream(PVOID *PDirStream,
+    BOOLEAN Reset, ULONG WindowSize, PNTSTATUS PResult)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_STREAM *DirStream = *PDirStream;
+    MemoryBarrier();
+
+    if (0 == DirStream)
+    {
+        static SRWLOCK CreateLock = SRWLOCK_INIT;
+        FSP_FILE_SYSTEM_DIRECTORY_STREAM *NewDirStream;
+
+        NewDirStream = MemAlloc(sizeof *NewDirStream);
+        if (0 == NewDirStream)
+            RETURN(STATUS_INSUFFICIENT_RESOURCES, FALSE);
+        memset(NewDirStream, 0, sizeof *NewDirStream);
+        InitializeSRWLock(&NewDirStream->Lock);
+        InitializeConditionVariable(&NewDirStream->Cond);
+        NewDirStream->WindowSize = 0 != WindowSize ?
+            WindowSize : FSP_FILE_SYSTEM_DIRECTORY_STREAM_WINDOW_DEFAULT;
+        NewDirStream->LastReadMark = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK;
+        NewDirStream->LastFillMark = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK;
+        NewDirStream->Producing = TRUE;
+
+        AcquireSRWLockExclusive(&CreateLock);
+        DirStream = *PDirStream;
+        MemoryBarrier();
+        if (0 == DirStream)
+            *PDirStream = DirStream = NewDirStream;
+        ReleaseSRWLockExclusive(&CreateLock);
+
+        if (DirStream == NewDirStream)
+            RETURN(STATUS_SUCCESS, TRUE);
+
+        MemFree(NewDirStream);
+    }
+
+    if (Reset)
+    {
+        AcquireSRWLockExclusive(&DirStream->Lock);
+
+        FspFileSystemCancelDirectoryStreamProducer(DirStream);
+
+        DirStream->LoMark = 0;
+        DirStream->ReadMark = 0;
+        DirStream->LastReadMark = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK;
+        DirStream->LastFillMark = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK;
+        DirStream->Cancel = FALSE;
+        DirStream->Done = FALSE;
+        DirStream->Evicted = FALSE;
+        DirStream->Result = STATUS_SUCCESS;
+        DirStream->Producing = TRUE;
+
+        WakeAllConditionVariable(&DirStream->Cond);
+        ReleaseSRWLockExclusive(&DirStream->Lock);
+
+        RETURN(STATUS_SUCCESS, TRUE);
+    }
+
+    RETURN(STATUS_SUCCESS, FALSE);
+}
+
+FSP_API BOOLEAN FspFileSystemFillDirectoryStream(PVOID *PDirStream,
+    FSP_FSCTL_DIR_INFO *DirInfo, PNTSTATUS PResult)
+{
+    /* assume that FspFileSystemAcquireDirectoryStream has returned TRUE */
+
+    FSP_FILE_SYSTEM_DIRECTORY_STREAM *DirStream = *PDirStream;
+    ULONG LoMark, Keep, Capacity, Required;
+    PUINT8 Buffer;
+    NTSTATUS Result;
+
+    if (0 == DirInfo)
+        RETURN(STATUS_INVALID_PARAMETER, FALSE);
+
+    AcquireSRWLockExclusive(&DirStream->Lock);
+
+    if (FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK != DirStream->LastFillMark &&
+        0 <= FspFileSystemDirectoryStreamCmp(
+            (FSP_FSCTL_DIR_INFO *)(DirStream->Buffer + DirStream->LastFillMark),
+            DirInfo->FileNameBuf, (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR)))
+    {
+        /* entries must arrive in strictly ascending order */
+        Result = STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    for (;;)
+    {
+        if (DirStream->Cancel)
+        {
+            Result = STATUS_CANCELLED;
+            goto exit;
+        }
+
+        LoMark = DirStream->LoMark;
+        if (FspFileSystemAddDirInfo(DirInfo, DirStream->Buffer, DirStream->Capacity, &LoMark))
+        {
+            DirStream->LastFillMark = DirStream->LoMark;
+            DirStream->LoMark = LoMark;
+            WakeAllConditionVariable(&DirStream->Cond);
+            Result = STATUS_SUCCESS;
+            goto exit;
+        }
+
+        /* evict entries that have been read, but keep the last one as the marker anchor */
+        Keep = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK != DirStream->LastReadMark ?
+            DirStream->LastReadMark : 0;
+        if (0 < Keep)
+        {
+            memmove(DirStream->Buffer, DirStream->Buffer + Keep, DirStream->LoMark - Keep);
+            DirStream->LoMark -= Keep;
+            DirStream->ReadMark -= Keep;
+            DirStream->LastReadMark = 0;
+            DirStream->LastFillMark -= Keep;
+            DirStream->Evicted = TRUE;
+            continue;
+        }
+
+        /* grow up to the window size; beyond it only if there is nothing unread to wait for */
+        if (DirStream->Capacity < DirStream->WindowSize || DirStream->ReadMark == DirStream->LoMark)
+        {
+            Required = DirStream->LoMark + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size);
+            Capacity = 0 != DirStream->Capacity ? DirStream->Capacity * 2 : 512;
+            if (Capacity > DirStream->WindowSize)
+                Capacity = DirStream->WindowSize;
+            if (Capacity < Required)
+                Capacity = Required;
+
+            Buffer = 0 != DirStream->Buffer ?
+                MemRealloc(DirStream->Buffer, Capacity) : MemAlloc(Capacity);
+            if (0 == Buffer)
+            {
+                Result = STATUS_INSUFFICIENT_RESOURCES;
+                goto exit;
+            }
+
+            DirStream->Buffer = Buffer;
+            DirStream->Capacity = Capacity;
+            continue;
+        }
+
+        /* the window is full of unread entries; wait for ReadDirectory to consume some */
+        SleepConditionVariableSRW(&DirStream->Cond, &DirStream->Lock, INFINITE, 0);
+    }
+
+exit:
+    ReleaseSRWLockExclusive(&DirStream->Lock);
+
+    RETURN(Result, NT_SUCCESS(Result));
+}
+
+FSP_API VOID FspFileSystemReleaseDirectoryStream(PVOID *PDirStream, NTSTATUS Result)
+{
+    /* assume that FspFileSystemAcquireDirectoryStream has returned TRUE */
+
+    FSP_FILE_SYSTEM_DIRECTORY_STREAM *DirStream = *PDirStream;
+
+    AcquireSRWLockExclusive(&DirStream->Lock);
+
+    DirStream->Producing = FALSE;
+    DirStream->Done = TRUE;
+    DirStream->Result = Result;
+
+    WakeAllConditionVariable(&DirStream->Cond);
+    ReleaseSRWLockExclusive(&DirStream->Lock);
+}
+
+FSP_API NTSTATUS FspFileSystemReadDirectoryStream(PVOID *PDirStream,
+    PWSTR Marker,
+    PVOID Buffer, ULONG Length, PULONG PBytesTransferred)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_STREAM *DirStream = *PDirStream;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    ULONG BytesTransferred = *PBytesTransferred;
+    int MarkerLen = 0;
+    NTSTATUS Result;
+    MemoryBarrier();
+
+    if (0 == DirStream)
+    {
+        FspFileSystemAddDirInfo(0, Buffer, Length, PBytesTransferred);
+        return STATUS_SUCCESS;
+    }
+
+    AcquireSRWLockExclusive(&DirStream->Lock);
+
+    if (0 != Marker)
+    {
+        MarkerLen = lstrlenW(Marker);
+
+        if (FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK != DirStream->LastReadMark &&
+            0 == FspFileSystemDirectoryStreamCmp(
+                (FSP_FSCTL_DIR_INFO *)(DirStream->Buffer + DirStream->LastReadMark),
+                Marker, MarkerLen))
+            /* continuation of the previous page */
+            Marker = 0;
+        else
+        {
+            /* rescan the window; entries up to the marker must not have been evicted */
+            if (DirStream->Evicted && 0 < DirStream->LoMark &&
+                0 < FspFileSystemDirectoryStreamCmp(
+                    (FSP_FSCTL_DIR_INFO *)DirStream->Buffer, Marker, MarkerLen))
+            {
+                Result = STATUS_INVALID_PARAMETER;
+                goto exit;
+            }
+
+            DirStream->ReadMark = 0;
+            DirStream->LastReadMark = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK;
+        }
+    }
+    else
+    {
+        if (DirStream->Evicted)
+        {
+            Result = STATUS_INVALID_PARAMETER;
+            goto exit;
+        }
+
+        DirStream->ReadMark = 0;
+        DirStream->LastReadMark = FSP_FILE_SYSTEM_DIRECTORY_STREAM_NOMARK;
+    }
+
+    for (;;)
+    {
+        while (DirStream->ReadMark < DirStream->LoMark)
+        {
+            DirInfo = (PVOID)(DirStream->Buffer + DirStream->ReadMark);
+
+            if (0 == Marker ||
+                0 < FspFileSystemDirectoryStreamCmp(DirInfo, Marker, MarkerLen))
+            {
+                /* entries are in order, so everything from here on follows the marker */
+                Marker = 0;
+
+                if (!FspFileSystemAddDirInfo(DirInfo, Buffer, Length, PBytesTransferred))
+                {
+                    Result = STATUS_SUCCESS;
+                    goto exit;
+                }
+            }
+
+            DirStream->LastReadMark = DirStream->ReadMark;
+            DirStream->ReadMark += FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size);
+        }
+
+        if (DirStream->Done)
+        {
+            Result = DirStream->Result;
+            if (NT_SUCCESS(Result))
+                FspFileSystemAddDirInfo(0, Buffer, Length, PBytesTransferred);
+            goto exit;
+        }
+
+        /* return a partial page rather than wait for the producer to fill it */
+        if (BytesTransferred != *PBytesTransferred)
+        {
+            Result = STATUS_SUCCESS;
+            goto exit;
+        }
+
+        /* nothing to return yet; let the producer reclaim what we have read and wait */
+        WakeAllConditionVariable(&DirStream->Cond);
+        SleepConditionVariableSRW(&DirStream->Cond, &DirStream->Lock, INFINITE, 0);
+    }
+
+exit:
+    WakeAllConditionVariable(&DirStream->Cond);
+    ReleaseSRWLockExclusive(&DirStream->Lock);
+
+    return Result;
+}
+
+FSP_API VOID FspFileSystemDeleteDirectoryStream(PVOID *PDirStream)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_STREAM *DirStream = *PDirStream;
+    MemoryBarrier();
+
+    if (0 != DirStream)
+    {
+        AcquireSRWLockExclusive(&DirStream->Lock);
+        FspFileSystemCancelDirectoryStreamProducer(DirStream);
+        ReleaseSRWLockExclusive(&DirStream->Lock);
+
+        MemFree(DirStream->Buffer);
+        MemFree(DirStream);
+        *PDirStream = 0;
+    }
+}
+
 VOID FspFileSystemPeekInDirectoryBuffer(PVOID *PDirBuffer,
     PUINT8 *PBuffer, PULONG *PIndex, PULONG PCount)
 {
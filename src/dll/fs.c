@@ -20,8 +20,34 @@
 enum
 {
     FspFileSystemDispatcherThreadCountMin = 2,
+    FspFileSystemDispatcherThreadIdleTimeoutDefault = 30000,
 };
 
+typedef struct
+{
+    SRWLOCK Lock;
+    ULONG ThreadCountMin, ThreadCountMax;
+    ULONG ThreadCount, ThreadCountPeak;
+    BOOLEAN Stopped;
+    volatile LONG BusyThreadCount;
+    volatile LONG64 ThreadCreateCount, ThreadExitCount, RequestCount, BatchCount;
+    volatile LONG64 BusyTime, IdleTime;
+    LONG64 IdleTimeout;                 /* QueryPerformanceCounter ticks */
+    LARGE_INTEGER Frequency;
+    ULONG SlotCount;
+    HANDLE Threads[];                   /* all threads other than FileSystem->DispatcherThread */
+} FSP_FILE_SYSTEM_DISPATCHER_POOL;
+
+typedef struct
+{
+    FSP_FILE_SYSTEM *FileSystem;
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool;
+    BOOLEAN CanRetire, Retired;
+    LONG64 Timestamp;
+} FSP_FILE_SYSTEM_DISPATCHER_WORKER;
+
+static DWORD WINAPI FspFileSystemDispatcherWorkerThread(PVOID FileSystem0);
+
 static FSP_FILE_SYSTEM_INTERFACE FspFileSystemNullInterface;
 
 static INIT_ONCE FspFileSystemInitOnce = INIT_ONCE_STATIC_INIT;
@@ -184,6 +210,9 @@ FSP_API VOID FspFileSystemDelete(FSP_FILE_SYSTEM *FileSystem)
 {
     FspFileSystemRemoveMountPoint(FileSystem);
     CloseHandle(FileSystem->VolumeHandle);
+    FspFsctlTransactRingDelete(FileSystem->TransactRing);
+    FspFileSystemDeleteAccessCheckCache(FileSystem);
+    FspFileSystemDeleteDirectoryCache(FileSystem);
     MemFree(FileSystem);
 }
 
@@ -440,39 +469,490 @@ FSP_API VOID FspFileSystemRemoveMountPoint(FSP_FILE_SYSTEM *FileSystem)
     FileSystem->MountHandle = 0;
 }
 
-static DWORD WINAPI FspFileSystemDispatcherThread(PVOID FileSystem0)
+static VOID FspFileSystemDispatchRequest(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
 {
-    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    SIZE_T ResponseSize;
+
+    if (FileSystem->DebugLog)
+    {
+        if (FspFsctlTransactKindCount <= Request->Kind ||
+            (FileSystem->DebugLog & (1 << Request->Kind)))
+            FspDebugLogRequest(Request);
+    }
+
+    Response->Size = sizeof *Response;
+    Response->Kind = Request->Kind;
+    Response->Hint = Request->Hint;
+    if (FspFsctlTransactKindCount > Request->Kind && 0 != FileSystem->Operations[Request->Kind])
+    {
+        Response->IoStatus.Status =
+            FspFileSystemEnterOperation(FileSystem, Request, Response);
+        if (NT_SUCCESS(Response->IoStatus.Status))
+        {
+            Response->IoStatus.Status =
+                FileSystem->Operations[Request->Kind](FileSystem, Request, Response);
+            FspFileSystemLeaveOperation(FileSystem, Request, Response);
+        }
+    }
+    else
+        Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+
+    if (FileSystem->DebugLog)
+    {
+        if (FspFsctlTransactKindCount <= Response->Kind ||
+            (FileSystem->DebugLog & (1 << Response->Kind)))
+            FspDebugLogResponse(Response);
+    }
+
+    ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Response->Size);
+    if (FSP_FSCTL_TRANSACT_RSP_SIZEMAX < ResponseSize/* should NOT happen */)
+    {
+        memset(Response, 0, sizeof *Response);
+        Response->Size = sizeof *Response;
+        Response->Kind = Request->Kind;
+        Response->Hint = Request->Hint;
+        Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+    }
+    else if (STATUS_PENDING == Response->IoStatus.Status)
+        memset(Response, 0, sizeof *Response);
+    else
+    {
+        memset((PUINT8)Response + Response->Size, 0, ResponseSize - Response->Size);
+        Response->Size = (UINT16)ResponseSize;
+    }
+}
+
+static inline LONG64 FspFileSystemDispatcherTimestamp(VOID)
+{
+    LARGE_INTEGER Counter;
+    QueryPerformanceCounter(&Counter);
+    return Counter.QuadPart;
+}
+
+static BOOLEAN FspFileSystemDispatcherSpawn(FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool,
+    FSP_FILE_SYSTEM *FileSystem)
+{
+    HANDLE Thread;
+
+    for (ULONG I = 0; Pool->SlotCount > I; I++)
+    {
+        if (0 != Pool->Threads[I])
+        {
+            /* reap threads that have retired */
+            if (WAIT_OBJECT_0 != WaitForSingleObject(Pool->Threads[I], 0))
+                continue;
+            CloseHandle(Pool->Threads[I]);
+            Pool->Threads[I] = 0;
+        }
+
+        Thread = CreateThread(0, 0, FspFileSystemDispatcherWorkerThread, FileSystem, 0, 0);
+        if (0 == Thread)
+            return FALSE;
+
+        Pool->Threads[I] = Thread;
+        Pool->ThreadCount++;
+        if (Pool->ThreadCountPeak < Pool->ThreadCount)
+            Pool->ThreadCountPeak = Pool->ThreadCount;
+        InterlockedIncrement64(&Pool->ThreadCreateCount);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static VOID FspFileSystemDispatcherEnter(FSP_FILE_SYSTEM_DISPATCHER_WORKER *Worker)
+{
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool = Worker->Pool;
+    LONG64 Timestamp = FspFileSystemDispatcherTimestamp();
+    LONG BusyThreadCount;
+
+    InterlockedAdd64(&Pool->IdleTime, Timestamp - Worker->Timestamp);
+    Worker->Timestamp = Timestamp;
+
+    /*
+     * If every dispatcher thread is now busy, further requests will queue up in the FSD
+     * until one of the threads returns. Add a thread if we are allowed to.
+     */
+    BusyThreadCount = InterlockedIncrement(&Pool->BusyThreadCount);
+    if ((ULONG)BusyThreadCount >= *(volatile ULONG *)&Pool->ThreadCount &&
+        Pool->ThreadCountMax > *(volatile ULONG *)&Pool->ThreadCount)
+    {
+        AcquireSRWLockExclusive(&Pool->Lock);
+        if (!Pool->Stopped &&
+            (ULONG)Pool->BusyThreadCount >= Pool->ThreadCount &&
+            Pool->ThreadCountMax > Pool->ThreadCount)
+            FspFileSystemDispatcherSpawn(Pool, Worker->FileSystem);
+        ReleaseSRWLockExclusive(&Pool->Lock);
+    }
+}
+
+static VOID FspFileSystemDispatcherLeave(FSP_FILE_SYSTEM_DISPATCHER_WORKER *Worker,
+    ULONG RequestCount)
+{
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool = Worker->Pool;
+    LONG64 Timestamp = FspFileSystemDispatcherTimestamp();
+
+    InterlockedDecrement(&Pool->BusyThreadCount);
+    InterlockedAdd64(&Pool->RequestCount, RequestCount);
+    InterlockedIncrement64(&Pool->BatchCount);
+    InterlockedAdd64(&Pool->BusyTime, Timestamp - Worker->Timestamp);
+    Worker->Timestamp = Timestamp;
+}
+
+static BOOLEAN FspFileSystemDispatcherIdle(FSP_FILE_SYSTEM_DISPATCHER_WORKER *Worker)
+{
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool = Worker->Pool;
+
+    /* called when a transact has returned without any requests; no responses are pending */
+    if (!Worker->CanRetire ||
+        Pool->ThreadCountMin >= *(volatile ULONG *)&Pool->ThreadCount ||
+        Pool->IdleTimeout > FspFileSystemDispatcherTimestamp() - Worker->Timestamp)
+        return FALSE;
+
+    AcquireSRWLockExclusive(&Pool->Lock);
+    if (!Pool->Stopped && Pool->ThreadCountMin < Pool->ThreadCount)
+    {
+        Pool->ThreadCount--;
+        InterlockedIncrement64(&Pool->ThreadExitCount);
+        Worker->Retired = TRUE;
+    }
+    ReleaseSRWLockExclusive(&Pool->Lock);
+
+    return Worker->Retired;
+}
+
+static NTSTATUS FspFileSystemDispatcherRing(FSP_FILE_SYSTEM_DISPATCHER_WORKER *Worker,
+    FSP_FILE_SYSTEM_OPERATION_CONTEXT *OperationContext)
+{
+    FSP_FILE_SYSTEM *FileSystem = Worker->FileSystem;
     NTSTATUS Result;
-    SIZE_T RequestSize, ResponseSize;
-    FSP_FSCTL_TRANSACT_REQ *Request = 0;
-    FSP_FSCTL_TRANSACT_RSP *Response = 0;
-    FSP_FILE_SYSTEM_OPERATION_CONTEXT OperationContext;
-    HANDLE DispatcherThread = 0;
+    FSP_FSCTL_TRANSACT_RING *Ring = FileSystem->TransactRing;
+    UINT32 SlotCount = FileSystem->TransactRingSlotCount;
+    FSP_FSCTL_TRANSACT_RING_QUEUE *ResponseQueue = &Ring->Queue[FspFsctlTransactRingResponseQueue];
+    FSP_FSCTL_TRANSACT_REQ *Request, *RequestBuf = OperationContext->Request;
+    FSP_FSCTL_TRANSACT_RSP *Response = OperationContext->Response;
+    PVOID SlotBuffer;
+    LONG Position;
 
-    Request = MemAlloc(FSP_FSCTL_TRANSACT_BUFFER_SIZEMIN);
-    Response = MemAlloc(FSP_FSCTL_TRANSACT_RSP_SIZEMAX);
-    if (0 == Request || 0 == Response)
+    for (;;)
+    {
+        Request = FspFsctlTransactRingConsumeBegin(Ring, SlotCount,
+            FspFsctlTransactRingRequestQueue, &Position);
+        if (0 == Request)
+        {
+            /* no requests in the ring: deliver our responses and wait for more requests */
+            Result = FspFsctlTransactRing(FileSystem->VolumeHandle, TRUE);
+            if (!NT_SUCCESS(Result))
+                return Result;
+            if (!FspFsctlTransactRingCanConsume(Ring, SlotCount,
+                    FspFsctlTransactRingRequestQueue) &&
+                FspFileSystemDispatcherIdle(Worker))
+                return STATUS_SUCCESS;
+            continue;
+        }
+
+        /* requests are processed in place; the slot is released when the operation returns */
+        memset(Response, 0, sizeof *Response);
+        if (FspFsctlTransactReservedKind != Request->Kind)
+        {
+            OperationContext->Request = Request;
+            FspFileSystemDispatcherEnter(Worker);
+            FspFileSystemDispatchRequest(FileSystem, Request, Response);
+            FspFileSystemDispatcherLeave(Worker, 1);
+            OperationContext->Request = RequestBuf;
+        }
+        FspFsctlTransactRingConsumeEnd(Ring, SlotCount,
+            FspFsctlTransactRingRequestQueue, Position);
+
+        if (0 == Response->Size)
+            continue;
+
+        SlotBuffer = FspFsctlTransactRingProduceBegin(Ring, SlotCount,
+            FspFsctlTransactRingResponseQueue, &Position);
+        if (0 == SlotBuffer)
+        {
+            /* response queue is full: send the response the old-fashioned way */
+            Result = FspFsctlTransact(FileSystem->VolumeHandle,
+                Response, Response->Size, 0, 0, FALSE);
+            if (!NT_SUCCESS(Result))
+                return Result;
+            continue;
+        }
+        memcpy(SlotBuffer, Response, Response->Size);
+        FspFsctlTransactRingProduceEnd(Ring, SlotCount,
+            FspFsctlTransactRingResponseQueue, Position);
+
+        /* do not let too many responses linger in the ring while we keep processing requests */
+        if (SlotCount / 4 <= (ULONG)ResponseQueue->Tail - (ULONG)ResponseQueue->Head)
+        {
+            Result = FspFsctlTransactRing(FileSystem->VolumeHandle, FALSE);
+            if (!NT_SUCCESS(Result))
+                return Result;
+        }
+    }
+}
+
+typedef struct
+{
+    FSP_FILE_SYSTEM *FileSystem;
+    FSP_FSCTL_TRANSACT_REQ **Requests;
+    ULONG RequestCount;
+    volatile LONG RequestIndex;
+    volatile LONG WorkerIndex;
+    FSP_FSCTL_TRANSACT_RSP **WorkerResponses;
+    SRWLOCK ResponseLock;
+    CONDITION_VARIABLE ResponseSpace;
+    PUINT8 ResponseBuf, ResponseBufPos, ResponseSendBuf;
+    BOOLEAN ResponseSending;
+    NTSTATUS Result;
+} FSP_FILE_SYSTEM_DISPATCHER_BATCH;
+
+static VOID FspFileSystemDispatcherBatchRespond(FSP_FILE_SYSTEM_DISPATCHER_BATCH *Batch,
+    FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    FSP_FILE_SYSTEM *FileSystem = Batch->FileSystem;
+    PUINT8 SendBuf;
+    SIZE_T SendSize;
+    NTSTATUS Result;
+
+    /*
+     * Responses are sent as soon as their requests complete. The worker that finds no send
+     * in progress becomes the sender: it swaps the response buffer with the (idle) send
+     * buffer under the lock and calls the FSD after releasing it. Responses that complete
+     * while the FSD call is in progress accumulate in the other buffer and are sent by the
+     * same worker when the call returns.
+     */
+
+    AcquireSRWLockExclusive(&Batch->ResponseLock);
+
+    /* a non-empty response buffer always has a sender, which will make space */
+    while (Batch->ResponseBufPos + Response->Size >
+        Batch->ResponseBuf + FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN)
+        SleepConditionVariableSRW(&Batch->ResponseSpace, &Batch->ResponseLock, INFINITE, 0);
+
+    memcpy(Batch->ResponseBufPos, Response, Response->Size);
+    Batch->ResponseBufPos += Response->Size;
+
+    if (!Batch->ResponseSending)
+    {
+        Batch->ResponseSending = TRUE;
+        do
+        {
+            SendBuf = Batch->ResponseBuf;
+            SendSize = Batch->ResponseBufPos - Batch->ResponseBuf;
+            Batch->ResponseBuf = Batch->ResponseBufPos = Batch->ResponseSendBuf;
+            Batch->ResponseSendBuf = SendBuf;
+            WakeAllConditionVariable(&Batch->ResponseSpace);
+            ReleaseSRWLockExclusive(&Batch->ResponseLock);
+
+            Result = FspFsctlTransact(FileSystem->VolumeHandle, SendBuf, SendSize, 0, 0, FALSE);
+
+            AcquireSRWLockExclusive(&Batch->ResponseLock);
+            if (!NT_SUCCESS(Result) && NT_SUCCESS(Batch->Result))
+                Batch->Result = Result;
+        } while (Batch->ResponseBufPos != Batch->ResponseBuf);
+        Batch->ResponseSending = FALSE;
+    }
+
+    ReleaseSRWLockExclusive(&Batch->ResponseLock);
+}
+
+static VOID FspFileSystemDispatcherBatchExecute(FSP_FILE_SYSTEM_DISPATCHER_BATCH *Batch,
+    FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    FSP_FILE_SYSTEM *FileSystem = Batch->FileSystem;
+    FSP_FSCTL_TRANSACT_REQ *Request;
+    FSP_FILE_SYSTEM_OPERATION_CONTEXT OperationContext, *PrevOperationContext;
+    LONG Index;
+
+    PrevOperationContext = TlsGetValue(FspFileSystemTlsKey);
+    TlsSetValue(FspFileSystemTlsKey, &OperationContext);
+
+    for (;;)
+    {
+        Index = InterlockedIncrement(&Batch->RequestIndex) - 1;
+        if ((LONG)Batch->RequestCount <= Index)
+            break;
+
+        Request = Batch->Requests[Index];
+        OperationContext.Request = Request;
+        OperationContext.Response = Response;
+
+        memset(Response, 0, sizeof *Response);
+        FspFileSystemDispatchRequest(FileSystem, Request, Response);
+        if (0 == Response->Size)
+            continue;
+
+        FspFileSystemDispatcherBatchRespond(Batch, Response);
+    }
+
+    TlsSetValue(FspFileSystemTlsKey, PrevOperationContext);
+}
+
+static VOID CALLBACK FspFileSystemDispatcherBatchWork(
+    PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+    FSP_FILE_SYSTEM_DISPATCHER_BATCH *Batch = Context;
+    LONG WorkerIndex = InterlockedIncrement(&Batch->WorkerIndex);
+
+    /* worker 0 is the dispatcher thread itself */
+    FspFileSystemDispatcherBatchExecute(Batch, Batch->WorkerResponses[WorkerIndex]);
+}
+
+static NTSTATUS FspFileSystemDispatcherBatch(FSP_FILE_SYSTEM_DISPATCHER_WORKER *Worker)
+{
+    FSP_FILE_SYSTEM *FileSystem = Worker->FileSystem;
+    NTSTATUS Result;
+    FSP_FILE_SYSTEM_DISPATCHER_BATCH Batch;
+    ULONG WorkerCount = FileSystem->TransactBatchWorkerCount;
+    ULONG RequestCountMax = FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN / sizeof(FSP_FSCTL_TRANSACT_REQ);
+    PUINT8 RequestBuf = 0, RequestBufEnd;
+    SIZE_T RequestSize;
+    FSP_FSCTL_TRANSACT_REQ *Request, *NextRequest;
+    PTP_WORK Work = 0;
+
+    if (0 == WorkerCount)
+        WorkerCount = 1;
+
+    memset(&Batch, 0, sizeof Batch);
+    Batch.FileSystem = FileSystem;
+    InitializeSRWLock(&Batch.ResponseLock);
+    InitializeConditionVariable(&Batch.ResponseSpace);
+
+    RequestBuf = MemAlloc(FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN);
+    Batch.ResponseBuf = MemAlloc(FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN);
+    Batch.ResponseSendBuf = MemAlloc(FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN);
+    Batch.Requests = MemAlloc(RequestCountMax * sizeof(FSP_FSCTL_TRANSACT_REQ *));
+    Batch.WorkerResponses = MemAlloc(WorkerCount * sizeof(FSP_FSCTL_TRANSACT_RSP *));
+    if (0 == RequestBuf || 0 == Batch.ResponseBuf || 0 == Batch.ResponseSendBuf ||
+        0 == Batch.Requests || 0 == Batch.WorkerResponses)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
         goto exit;
     }
+    memset(Batch.WorkerResponses, 0, WorkerCount * sizeof(FSP_FSCTL_TRANSACT_RSP *));
+    for (ULONG I = 0; WorkerCount > I; I++)
+    {
+        Batch.WorkerResponses[I] = MemAlloc(FSP_FSCTL_TRANSACT_RSP_SIZEMAX);
+        if (0 == Batch.WorkerResponses[I])
+        {
+            Result = STATUS_INSUFFICIENT_RESOURCES;
+            goto exit;
+        }
+    }
 
-    if (1 < FileSystem->DispatcherThreadCount)
+    if (1 < WorkerCount)
     {
-        FileSystem->DispatcherThreadCount--;
-        DispatcherThread = CreateThread(0, 0, FspFileSystemDispatcherThread, FileSystem, 0, 0);
-        if (0 == DispatcherThread)
+        Work = CreateThreadpoolWork(FspFileSystemDispatcherBatchWork, &Batch, 0);
+        if (0 == Work)
         {
             Result = FspNtStatusFromWin32(GetLastError());
             goto exit;
         }
     }
 
+    Batch.ResponseBufPos = Batch.ResponseBuf;
+    for (;;)
+    {
+        /* all responses of the previous batch have already been sent */
+        RequestSize = FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN;
+        Result = FspFsctlTransact(FileSystem->VolumeHandle,
+            0, 0, RequestBuf, &RequestSize, TRUE);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+
+        if (0 == RequestSize)
+        {
+            if (FspFileSystemDispatcherIdle(Worker))
+                goto exit;
+            continue;
+        }
+
+        Batch.RequestCount = 0;
+        Batch.RequestIndex = 0;
+        Batch.WorkerIndex = 0;
+        RequestBufEnd = RequestBuf + RequestSize;
+        for (Request = (PVOID)RequestBuf;
+            RequestCountMax > Batch.RequestCount &&
+                0 != (NextRequest = FspFsctlTransactConsumeRequest(Request, RequestBufEnd));
+            Request = NextRequest)
+            Batch.Requests[Batch.RequestCount++] = Request;
+
+        FspFileSystemDispatcherEnter(Worker);
+
+        /* fan out to worker threads if there is more than one request in the batch */
+        if (0 != Work)
+            for (ULONG I = 1; WorkerCount > I && Batch.RequestCount > I; I++)
+                SubmitThreadpoolWork(Work);
+
+        FspFileSystemDispatcherBatchExecute(&Batch, Batch.WorkerResponses[0]);
+
+        if (0 != Work)
+            WaitForThreadpoolWorkCallbacks(Work, FALSE);
+
+        FspFileSystemDispatcherLeave(Worker, Batch.RequestCount);
+
+        if (!NT_SUCCESS(Batch.Result))
+        {
+            Result = Batch.Result;
+            goto exit;
+        }
+    }
+
+exit:
+    if (0 != Work)
+    {
+        WaitForThreadpoolWorkCallbacks(Work, TRUE);
+        CloseThreadpoolWork(Work);
+    }
+
+    if (0 != Batch.WorkerResponses)
+        for (ULONG I = 0; WorkerCount > I; I++)
+            MemFree(Batch.WorkerResponses[I]);
+    MemFree(Batch.WorkerResponses);
+    MemFree(Batch.Requests);
+    MemFree(Batch.ResponseSendBuf);
+    MemFree(Batch.ResponseBuf);
+    MemFree(RequestBuf);
+
+    return Result;
+}
+
+static NTSTATUS FspFileSystemDispatcherLoop(FSP_FILE_SYSTEM_DISPATCHER_WORKER *Worker)
+{
+    FSP_FILE_SYSTEM *FileSystem = Worker->FileSystem;
+    NTSTATUS Result;
+    SIZE_T RequestSize;
+    FSP_FSCTL_TRANSACT_REQ *Request = 0;
+    FSP_FSCTL_TRANSACT_RSP *Response = 0;
+    FSP_FILE_SYSTEM_OPERATION_CONTEXT OperationContext;
+
+    Request = MemAlloc(FSP_FSCTL_TRANSACT_BUFFER_SIZEMIN);
+    Response = MemAlloc(FSP_FSCTL_TRANSACT_RSP_SIZEMAX);
+    if (0 == Request || 0 == Response)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
     OperationContext.Request = Request;
     OperationContext.Response = Response;
     TlsSetValue(FspFileSystemTlsKey, &OperationContext);
 
+    Worker->Timestamp = FspFileSystemDispatcherTimestamp();
+
+    if (0 != FileSystem->TransactRing)
+    {
+        Result = FspFileSystemDispatcherRing(Worker, &OperationContext);
+        goto exit;
+    }
+    else if (FileSystem->TransactBatch)
+    {
+        Result = FspFileSystemDispatcherBatch(Worker);
+        goto exit;
+    }
+
     memset(Response, 0, sizeof *Response);
     for (;;)
     {
@@ -484,55 +964,15 @@ static DWORD WINAPI FspFileSystemDispatcherThread(PVOID FileSystem0)
 
         memset(Response, 0, sizeof *Response);
         if (0 == RequestSize)
-            continue;
-
-        if (FileSystem->DebugLog)
-        {
-            if (FspFsctlTransactKindCount <= Request->Kind ||
-                (FileSystem->DebugLog & (1 << Request->Kind)))
-                FspDebugLogRequest(Request);
-        }
-
-        Response->Size = sizeof *Response;
-        Response->Kind = Request->Kind;
-        Response->Hint = Request->Hint;
-        if (FspFsctlTransactKindCount > Request->Kind && 0 != FileSystem->Operations[Request->Kind])
         {
-            Response->IoStatus.Status =
-                FspFileSystemEnterOperation(FileSystem, Request, Response);
-            if (NT_SUCCESS(Response->IoStatus.Status))
-            {
-                Response->IoStatus.Status =
-                    FileSystem->Operations[Request->Kind](FileSystem, Request, Response);
-                FspFileSystemLeaveOperation(FileSystem, Request, Response);
-            }
-        }
-        else
-            Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
-
-        if (FileSystem->DebugLog)
-        {
-            if (FspFsctlTransactKindCount <= Response->Kind ||
-                (FileSystem->DebugLog & (1 << Response->Kind)))
-                FspDebugLogResponse(Response);
+            if (FspFileSystemDispatcherIdle(Worker))
+                goto exit;
+            continue;
         }
 
-        ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Response->Size);
-        if (FSP_FSCTL_TRANSACT_RSP_SIZEMAX < ResponseSize/* should NOT happen */)
-        {
-            memset(Response, 0, sizeof *Response);
-            Response->Size = sizeof *Response;
-            Response->Kind = Request->Kind;
-            Response->Hint = Request->Hint;
-            Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
-        }
-        else if (STATUS_PENDING == Response->IoStatus.Status)
-            memset(Response, 0, sizeof *Response);
-        else
-        {
-            memset((PUINT8)Response + Response->Size, 0, ResponseSize - Response->Size);
-            Response->Size = (UINT16)ResponseSize;
-        }
+        FspFileSystemDispatcherEnter(Worker);
+        FspFileSystemDispatchRequest(FileSystem, Request, Response);
+        FspFileSystemDispatcherLeave(Worker, 1);
     }
 
 exit:
@@ -540,43 +980,151 @@ exit:
     MemFree(Response);
     MemFree(Request);
 
-    FspFileSystemSetDispatcherResult(FileSystem, Result);
+    if (!Worker->Retired)
+    {
+        FspFileSystemSetDispatcherResult(FileSystem, Result);
 
-    FspFsctlStop(FileSystem->VolumeHandle);
+        FspFsctlStop(FileSystem->VolumeHandle);
+    }
+
+    return Result;
+}
+
+static DWORD WINAPI FspFileSystemDispatcherWorkerThread(PVOID FileSystem0)
+{
+    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    FSP_FILE_SYSTEM_DISPATCHER_WORKER Worker;
+
+    memset(&Worker, 0, sizeof Worker);
+    Worker.FileSystem = FileSystem;
+    Worker.Pool = FileSystem->DispatcherPool;
+    Worker.CanRetire = TRUE;
+
+    return FspFileSystemDispatcherLoop(&Worker);
+}
 
-    if (0 != DispatcherThread)
+static DWORD WINAPI FspFileSystemDispatcherThread(PVOID FileSystem0)
+{
+    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool = FileSystem->DispatcherPool;
+    FSP_FILE_SYSTEM_DISPATCHER_WORKER Worker;
+    NTSTATUS Result;
+
+    memset(&Worker, 0, sizeof Worker);
+    Worker.FileSystem = FileSystem;
+    Worker.Pool = Pool;
+    Worker.CanRetire = FALSE;
+
+    /*
+     * Failure to create the initial threads is fatal. Any worker thread (but not this one)
+     * may retire later when idle; retirement never takes the pool below ThreadCountMin.
+     */
+    Result = STATUS_SUCCESS;
+    AcquireSRWLockExclusive(&Pool->Lock);
+    while (Pool->ThreadCountMin > Pool->ThreadCount)
+        if (!FspFileSystemDispatcherSpawn(Pool, FileSystem))
+        {
+            Result = FspNtStatusFromWin32(GetLastError());
+            break;
+        }
+    ReleaseSRWLockExclusive(&Pool->Lock);
+
+    if (NT_SUCCESS(Result))
+        Result = FspFileSystemDispatcherLoop(&Worker);
+    else
     {
-        WaitForSingleObject(DispatcherThread, INFINITE);
-        CloseHandle(DispatcherThread);
+        FspFileSystemSetDispatcherResult(FileSystem, Result);
+
+        FspFsctlStop(FileSystem->VolumeHandle);
     }
 
+    AcquireSRWLockExclusive(&Pool->Lock);
+    Pool->Stopped = TRUE;
+    ReleaseSRWLockExclusive(&Pool->Lock);
+
+    for (ULONG I = 0; Pool->SlotCount > I; I++)
+        if (0 != Pool->Threads[I])
+        {
+            WaitForSingleObject(Pool->Threads[I], INFINITE);
+            CloseHandle(Pool->Threads[I]);
+            Pool->Threads[I] = 0;
+        }
+
     return Result;
 }
 
 FSP_API NTSTATUS FspFileSystemStartDispatcher(FSP_FILE_SYSTEM *FileSystem, ULONG ThreadCount)
 {
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool;
+    ULONG ThreadCountMin, ThreadCountMax, IdleTimeout;
+
     if (0 != FileSystem->DispatcherThread)
         return STATUS_INVALID_PARAMETER;
 
-    if (0 == ThreadCount)
+    if (0 != FileSystem->DispatcherThreadCountMax)
     {
-        DWORD_PTR ProcessMask, SystemMask;
+        ThreadCountMin = FileSystem->DispatcherThreadCountMin;
+        ThreadCountMax = FileSystem->DispatcherThreadCountMax;
+        if (ThreadCountMin < FspFileSystemDispatcherThreadCountMin)
+            ThreadCountMin = FspFileSystemDispatcherThreadCountMin;
+        if (ThreadCountMax < ThreadCountMin)
+            ThreadCountMax = ThreadCountMin;
+        ThreadCount = ThreadCountMin;
+    }
+    else
+    {
+        if (0 == ThreadCount)
+        {
+            DWORD_PTR ProcessMask, SystemMask;
 
-        if (!GetProcessAffinityMask(GetCurrentProcess(), &ProcessMask, &SystemMask))
-            return FspNtStatusFromWin32(GetLastError());
+            if (!GetProcessAffinityMask(GetCurrentProcess(), &ProcessMask, &SystemMask))
+                return FspNtStatusFromWin32(GetLastError());
 
-        for (ThreadCount = 0; 0 != ProcessMask; ProcessMask >>= 1)
-            ThreadCount += ProcessMask & 1;
+            for (ThreadCount = 0; 0 != ProcessMask; ProcessMask >>= 1)
+                ThreadCount += ProcessMask & 1;
+        }
+
+        if (ThreadCount < FspFileSystemDispatcherThreadCountMin)
+            ThreadCount = FspFileSystemDispatcherThreadCountMin;
+
+        ThreadCountMin = ThreadCountMax = ThreadCount;
     }
 
-    if (ThreadCount < FspFileSystemDispatcherThreadCountMin)
-        ThreadCount = FspFileSystemDispatcherThreadCountMin;
+    IdleTimeout = 0 != FileSystem->DispatcherThreadIdleTimeout ?
+        FileSystem->DispatcherThreadIdleTimeout : FspFileSystemDispatcherThreadIdleTimeoutDefault;
 
+    if (0 != FileSystem->TransactRingSlotCount && 0 == FileSystem->TransactRing)
+    {
+        NTSTATUS Result = FspFsctlTransactRingCreate(FileSystem->VolumeHandle,
+            FileSystem->TransactRingSlotCount, &FileSystem->TransactRing);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
+
+    Pool = MemAlloc(sizeof *Pool + (ThreadCountMax - 1) * sizeof(HANDLE));
+    if (0 == Pool)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    memset(Pool, 0, sizeof *Pool + (ThreadCountMax - 1) * sizeof(HANDLE));
+    InitializeSRWLock(&Pool->Lock);
+    Pool->ThreadCountMin = ThreadCountMin;
+    Pool->ThreadCountMax = ThreadCountMax;
+    Pool->ThreadCount = Pool->ThreadCountPeak = 1;
+    Pool->ThreadCreateCount = 1;
+    QueryPerformanceFrequency(&Pool->Frequency);
+    Pool->IdleTimeout = (LONG64)IdleTimeout * Pool->Frequency.QuadPart / 1000;
+    Pool->SlotCount = ThreadCountMax - 1;
+
+    FileSystem->DispatcherPool = Pool;
     FileSystem->DispatcherThreadCount = ThreadCount;
     FileSystem->DispatcherThread = CreateThread(0, 0,
         FspFileSystemDispatcherThread, FileSystem, 0, 0);
     if (0 == FileSystem->DispatcherThread)
-        return FspNtStatusFromWin32(GetLastError());
+    {
+        NTSTATUS Result = FspNtStatusFromWin32(GetLastError());
+        FileSystem->DispatcherPool = 0;
+        MemFree(Pool);
+        return Result;
+    }
 
     return STATUS_SUCCESS;
 }
@@ -591,6 +1139,39 @@ FSP_API VOID FspFileSystemStopDispatcher(FSP_FILE_SYSTEM *FileSystem)
     WaitForSingleObject(FileSystem->DispatcherThread, INFINITE);
     CloseHandle(FileSystem->DispatcherThread);
     FileSystem->DispatcherThread = 0;
+
+    MemFree(FileSystem->DispatcherPool);
+    FileSystem->DispatcherPool = 0;
+}
+
+FSP_API NTSTATUS FspFileSystemGetDispatcherStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_DISPATCHER_STATISTICS *Statistics)
+{
+    FSP_FILE_SYSTEM_DISPATCHER_POOL *Pool = FileSystem->DispatcherPool;
+    UINT64 Frequency;
+
+    if (0 == Pool)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    Frequency = Pool->Frequency.QuadPart;
+
+    AcquireSRWLockShared(&Pool->Lock);
+    Statistics->ThreadCount = Pool->ThreadCount;
+    Statistics->ThreadCountMin = Pool->ThreadCountMin;
+    Statistics->ThreadCountMax = Pool->ThreadCountMax;
+    Statistics->ThreadCountPeak = Pool->ThreadCountPeak;
+    ReleaseSRWLockShared(&Pool->Lock);
+    Statistics->BusyThreadCount = Pool->BusyThreadCount;
+    Statistics->ThreadCreateCount = Pool->ThreadCreateCount;
+    Statistics->ThreadExitCount = Pool->ThreadExitCount;
+    Statistics->RequestCount = Pool->RequestCount;
+    Statistics->BatchCount = Pool->BatchCount;
+    Statistics->BusyTime = (UINT64)Pool->BusyTime / Frequency * 10000000 +
+        (UINT64)Pool->BusyTime % Frequency * 10000000 / Frequency;
+    Statistics->IdleTime = (UINT64)Pool->IdleTime / Frequency * 10000000 +
+        (UINT64)Pool->IdleTime % Frequency * 10000000 / Frequency;
+
+    return STATUS_SUCCESS;
 }
 
 FSP_API VOID FspFileSystemSendResponse(FSP_FILE_SYSTEM *FileSystem,
@@ -679,6 +1260,24 @@ FSP_API VOID FspFileSystemSetDebugLogF(FSP_FILE_SYSTEM *FileSystem,
     FspFileSystemSetDebugLog(FileSystem, DebugLog);
 }
 
+FSP_API VOID FspFileSystemSetTransactRingF(FSP_FILE_SYSTEM *FileSystem,
+    UINT32 SlotCount)
+{
+    FspFileSystemSetTransactRing(FileSystem, SlotCount);
+}
+
+FSP_API VOID FspFileSystemSetTransactBatchF(FSP_FILE_SYSTEM *FileSystem,
+    BOOLEAN TransactBatch, ULONG WorkerCount)
+{
+    FspFileSystemSetTransactBatch(FileSystem, TransactBatch, WorkerCount);
+}
+
+FSP_API VOID FspFileSystemSetDispatcherThreadCountF(FSP_FILE_SYSTEM *FileSystem,
+    ULONG ThreadCountMin, ULONG ThreadCountMax, ULONG IdleTimeout)
+{
+    FspFileSystemSetDispatcherThreadCount(FileSystem, ThreadCountMin, ThreadCountMax, IdleTimeout);
+}
+
 FSP_API BOOLEAN FspFileSystemIsOperationCaseSensitiveF(VOID)
 {
     return FspFileSystemIsOperationCaseSensitive();
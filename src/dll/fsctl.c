@@ -30,6 +30,7 @@ FSP_API NTSTATUS FspFsctlCreateVolume(PWSTR DevicePath,
     PHANDLE PVolumeHandle)
 {
     NTSTATUS Result;
+    FSP_FSCTL_VOLUME_PARAMS VolumeParamsBuf;
     PWSTR DeviceRoot;
     SIZE_T DeviceRootSize, DevicePathSize;
     WCHAR DevicePathBuf[MAX_PATH + sizeof *VolumeParams], *DevicePathPtr, *DevicePathEnd;
@@ -40,6 +41,20 @@ FSP_API NTSTATUS FspFsctlCreateVolume(PWSTR DevicePath,
         VolumeNameBuf[0] = L'\0';
     *PVolumeHandle = INVALID_HANDLE_VALUE;
 
+    /*
+     * File systems built against an older header pass a Version 0 structure, which ends
+     * at FileSystemName. Do not read past it; the fields that follow get their defaults.
+     */
+    memset(&VolumeParamsBuf, 0, sizeof VolumeParamsBuf);
+    if (0 == VolumeParams->Version)
+        memcpy(&VolumeParamsBuf, VolumeParams, FSP_FSCTL_VOLUME_PARAMS_V0_SIZE);
+    else if (sizeof(FSP_FSCTL_VOLUME_PARAMS) == VolumeParams->Version)
+        memcpy(&VolumeParamsBuf, VolumeParams, sizeof VolumeParamsBuf);
+    else
+        return STATUS_INVALID_PARAMETER;
+    VolumeParamsBuf.Version = sizeof(FSP_FSCTL_VOLUME_PARAMS);
+    VolumeParams = &VolumeParamsBuf;
+
     /* check lengths; everything (including encoded volume params) must fit within DevicePathBuf */
     DeviceRoot = L'\\' == DevicePath[0] ? GLOBALROOT : GLOBALROOT "\\Device\\";
     DeviceRootSize = lstrlenW(DeviceRoot) * sizeof(WCHAR);
@@ -140,6 +155,67 @@ FSP_API NTSTATUS FspFsctlStop(HANDLE VolumeHandle)
     return STATUS_SUCCESS;
 }
 
+FSP_API NTSTATUS FspFsctlTransactRingCreate(HANDLE VolumeHandle,
+    UINT32 SlotCount, FSP_FSCTL_TRANSACT_RING **PRing)
+{
+    NTSTATUS Result;
+    FSP_FSCTL_TRANSACT_RING *Ring;
+    FSP_FSCTL_TRANSACT_RING_PARAMS Params;
+    DWORD Bytes;
+
+    *PRing = 0;
+
+    if (!FspFsctlTransactRingValidSlotCount(SlotCount))
+        return STATUS_INVALID_PARAMETER;
+
+    Ring = VirtualAlloc(0, FspFsctlTransactRingSize(SlotCount), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (0 == Ring)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    FspFsctlTransactRingInitialize(Ring, SlotCount);
+
+    memset(&Params, 0, sizeof Params);
+    Params.RingAddress = (UINT64)(UINT_PTR)Ring;
+    Params.SlotCount = SlotCount;
+
+    if (!DeviceIoControl(VolumeHandle, FSP_FSCTL_TRANSACT_RING_SETUP,
+        &Params, sizeof Params, 0, 0,
+        &Bytes, 0))
+    {
+        Result = FspNtStatusFromWin32(GetLastError());
+        VirtualFree(Ring, 0, MEM_RELEASE);
+        return Result;
+    }
+
+    *PRing = Ring;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API VOID FspFsctlTransactRingDelete(FSP_FSCTL_TRANSACT_RING *Ring)
+{
+    /* the volume handle that the ring was registered with must have been closed already */
+    if (0 != Ring)
+        VirtualFree(Ring, 0, MEM_RELEASE);
+}
+
+FSP_API NTSTATUS FspFsctlTransactRing(HANDLE VolumeHandle,
+    BOOLEAN Wait)
+{
+    FSP_FSCTL_TRANSACT_RING_PARAMS Params;
+    DWORD Bytes;
+
+    memset(&Params, 0, sizeof Params);
+    Params.Wait = !!Wait;
+
+    if (!DeviceIoControl(VolumeHandle, FSP_FSCTL_TRANSACT_RING,
+        &Params, sizeof Params, 0, 0,
+        &Bytes, 0))
+        return FspNtStatusFromWin32(GetLastError());
+
+    return STATUS_SUCCESS;
+}
+
 FSP_API NTSTATUS FspFsctlGetVolumeList(PWSTR DevicePath,
     PWCHAR VolumeListBuf, PSIZE_T PVolumeListSize)
 {
@@ -843,6 +843,12 @@ FSP_API NTSTATUS FspFileSystemOpCreate(FSP_FILE_SYSTEM *FileSystem,
     else if (STATUS_OBJECT_NAME_COLLISION == Result)
         Result = FspFileSystemOpCreate_CollisionCheck(FileSystem, Request, Response);
 
+    if (STATUS_SUCCESS == Result &&
+        (FILE_CREATED == Response->IoStatus.Information ||
+        FILE_OVERWRITTEN == Response->IoStatus.Information ||
+        FILE_SUPERSEDED == Response->IoStatus.Information))
+        FspFileSystemInvalidateDirectoryCache(FileSystem, (PWSTR)Request->Buffer);
+
     return Result;
 }
 
@@ -888,16 +894,35 @@ FSP_API NTSTATUS FspFileSystemOpCleanup(FSP_FILE_SYSTEM *FileSystem,
             (0 != Request->Req.Cleanup.SetLastWriteTime ? FspCleanupSetLastWriteTime : 0) |
             (0 != Request->Req.Cleanup.SetChangeTime ? FspCleanupSetChangeTime : 0));
 
+    if (0 != Request->Req.Cleanup.Delete)
+    {
+        FspFileSystemInvalidateAccessCheckCache(FileSystem,
+            0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0);
+        FspFileSystemInvalidateDirectoryCache(FileSystem,
+            0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0);
+    }
+
     return STATUS_SUCCESS;
 }
 
 FSP_API NTSTATUS FspFileSystemOpClose(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
 {
+    FSP_FSCTL_TRANSACT_FULL_CONTEXT *Context, *ContextEnd;
+
     if (0 != FileSystem->Interface->Close)
+    {
         FileSystem->Interface->Close(FileSystem,
             (PVOID)ValOfFileContext(Request->Req.Close));
 
+        /* a coalesced Close carries the contexts of more closed files (BatchCloseRequests) */
+        Context = (PVOID)(Request->Buffer + Request->Req.Close.Contexts.Offset);
+        ContextEnd = (PVOID)((PUINT8)Context + Request->Req.Close.Contexts.Size);
+        for (; ContextEnd > Context; Context++)
+            FileSystem->Interface->Close(FileSystem,
+                (PVOID)ValOfFileContext(*Context));
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -1017,6 +1042,10 @@ FSP_API NTSTATUS FspFileSystemOpSetInformation(FSP_FILE_SYSTEM *FileSystem,
                 Request->Req.SetInformation.Info.Basic.LastWriteTime,
                 Request->Req.SetInformation.Info.Basic.ChangeTime,
                 &FileInfo);
+        /* without a file name (older FSD) invalidate the whole cache */
+        if (NT_SUCCESS(Result))
+            FspFileSystemInvalidateDirectoryCacheParent(FileSystem,
+                0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0);
         break;
     case 19/*FileAllocationInformation*/:
         if (0 != FileSystem->Interface->SetFileSize)
@@ -1024,6 +1053,9 @@ FSP_API NTSTATUS FspFileSystemOpSetInformation(FSP_FILE_SYSTEM *FileSystem,
                 (PVOID)ValOfFileContext(Request->Req.SetInformation),
                 Request->Req.SetInformation.Info.Allocation.AllocationSize, TRUE,
                 &FileInfo);
+        if (NT_SUCCESS(Result))
+            FspFileSystemInvalidateDirectoryCacheParent(FileSystem,
+                0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0);
         break;
     case 20/*FileEndOfFileInformation*/:
         if (0 != FileSystem->Interface->SetFileSize)
@@ -1031,6 +1063,9 @@ FSP_API NTSTATUS FspFileSystemOpSetInformation(FSP_FILE_SYSTEM *FileSystem,
                 (PVOID)ValOfFileContext(Request->Req.SetInformation),
                 Request->Req.SetInformation.Info.EndOfFile.FileSize, FALSE,
                 &FileInfo);
+        if (NT_SUCCESS(Result))
+            FspFileSystemInvalidateDirectoryCacheParent(FileSystem,
+                0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0);
         break;
     case 13/*FileDispositionInformation*/:
         if (0 != FileSystem->Interface->GetFileInfo)
@@ -1067,6 +1102,17 @@ FSP_API NTSTATUS FspFileSystemOpSetInformation(FSP_FILE_SYSTEM *FileSystem,
                 (PWSTR)Request->Buffer,
                 (PWSTR)(Request->Buffer + Request->Req.SetInformation.Info.Rename.NewFileName.Offset),
                 0 != Request->Req.SetInformation.Info.Rename.AccessToken);
+            if (NT_SUCCESS(Result))
+            {
+                FspFileSystemInvalidateAccessCheckCache(FileSystem,
+                    (PWSTR)Request->Buffer);
+                FspFileSystemInvalidateAccessCheckCache(FileSystem,
+                    (PWSTR)(Request->Buffer + Request->Req.SetInformation.Info.Rename.NewFileName.Offset));
+                FspFileSystemInvalidateDirectoryCache(FileSystem,
+                    (PWSTR)Request->Buffer);
+                FspFileSystemInvalidateDirectoryCache(FileSystem,
+                    (PWSTR)(Request->Buffer + Request->Req.SetInformation.Info.Rename.NewFileName.Offset));
+            }
         }
         break;
     }
@@ -1188,6 +1234,13 @@ FSP_API NTSTATUS FspFileSystemOpFileSystemControl(FSP_FILE_SYSTEM *FileSystem,
                 (PWSTR)Request->Buffer,
                 ReparseData,
                 Request->Req.FileSystemControl.Buffer.Size);
+            if (NT_SUCCESS(Result))
+            {
+                FspFileSystemInvalidateAccessCheckCache(FileSystem,
+                    (PWSTR)Request->Buffer);
+                FspFileSystemInvalidateDirectoryCache(FileSystem,
+                    (PWSTR)Request->Buffer);
+            }
         }
         break;
     case FSCTL_DELETE_REPARSE_POINT:
@@ -1201,6 +1254,13 @@ FSP_API NTSTATUS FspFileSystemOpFileSystemControl(FSP_FILE_SYSTEM *FileSystem,
                 (PWSTR)Request->Buffer,
                 ReparseData,
                 Request->Req.FileSystemControl.Buffer.Size);
+            if (NT_SUCCESS(Result))
+            {
+                FspFileSystemInvalidateAccessCheckCache(FileSystem,
+                    (PWSTR)Request->Buffer);
+                FspFileSystemInvalidateDirectoryCache(FileSystem,
+                    (PWSTR)Request->Buffer);
+            }
         }
         break;
     }
@@ -1233,13 +1293,21 @@ FSP_API NTSTATUS FspFileSystemOpQuerySecurity(FSP_FILE_SYSTEM *FileSystem,
 FSP_API NTSTATUS FspFileSystemOpSetSecurity(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
 {
+    NTSTATUS Result;
+
     if (0 == FileSystem->Interface->SetSecurity)
         return STATUS_INVALID_DEVICE_REQUEST;
 
-    return FileSystem->Interface->SetSecurity(FileSystem,
+    Result = FileSystem->Interface->SetSecurity(FileSystem,
         (PVOID)ValOfFileContext(Request->Req.SetSecurity),
         Request->Req.SetSecurity.SecurityInformation,
         (PSECURITY_DESCRIPTOR)Request->Buffer);
+
+    /* the request does not carry a file name; invalidate the whole cache */
+    if (NT_SUCCESS(Result))
+        FspFileSystemInvalidateAccessCheckCache(FileSystem, 0);
+
+    return Result;
 }
 
 FSP_API NTSTATUS FspFileSystemOpQueryStreamInformation(FSP_FILE_SYSTEM *FileSystem,
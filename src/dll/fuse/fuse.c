@@ -39,6 +39,9 @@ struct fsp_fuse_core_opt_data
         set_attr_timeout, attr_timeout,
         rellinks;
     int set_FileInfoTimeout;
+    unsigned ThreadCountMin, ThreadCountMax, ThreadIdleTimeout;
+    unsigned DirPrefetchThreadCount;
+    unsigned DirCacheCapacity, DirCacheTimeout;
     FSP_FSCTL_VOLUME_PARAMS VolumeParams;
     UINT16 VolumeLabelLength;
     WCHAR VolumeLabel[sizeof ((FSP_FSCTL_VOLUME_INFO *)0)->VolumeLabel / sizeof(WCHAR)];
@@ -96,6 +99,17 @@ static struct fuse_opt fsp_fuse_core_opts[] =
     FSP_FUSE_CORE_OPT("VolumeSerialNumber=%lx", VolumeParams.VolumeSerialNumber, 0),
     FSP_FUSE_CORE_OPT("FileInfoTimeout=", set_FileInfoTimeout, 1),
     FSP_FUSE_CORE_OPT("FileInfoTimeout=%d", VolumeParams.FileInfoTimeout, 0),
+    FSP_FUSE_CORE_OPT("SecurityCacheCapacity=%u", VolumeParams.SecurityCacheCapacity, 0),
+    FSP_FUSE_CORE_OPT("DirInfoCacheCapacity=%u", VolumeParams.DirInfoCacheCapacity, 0),
+    FSP_FUSE_CORE_OPT("StreamInfoCacheCapacity=%u", VolumeParams.StreamInfoCacheCapacity, 0),
+    FSP_FUSE_CORE_OPT("DirInfoCacheSizeMax=%u", VolumeParams.DirInfoCacheSizeMax, 0),
+    FSP_FUSE_CORE_OPT("NegativeNameCacheCapacity=%u", VolumeParams.NegativeNameCacheCapacity, 0),
+    FSP_FUSE_CORE_OPT("ThreadCountMin=%u", ThreadCountMin, 0),
+    FSP_FUSE_CORE_OPT("ThreadCountMax=%u", ThreadCountMax, 0),
+    FSP_FUSE_CORE_OPT("ThreadIdleTimeout=%u", ThreadIdleTimeout, 0),
+    FSP_FUSE_CORE_OPT("DirPrefetchThreadCount=%u", DirPrefetchThreadCount, 0),
+    FSP_FUSE_CORE_OPT("DirCacheCapacity=%u", DirCacheCapacity, 0),
+    FSP_FUSE_CORE_OPT("DirCacheTimeout=%u", DirCacheTimeout, 0),
     FUSE_OPT_KEY("UNC=", 'U'),
     FUSE_OPT_KEY("--UNC=", 'U'),
     FUSE_OPT_KEY("VolumePrefix=", 'U'),
@@ -394,6 +408,18 @@ static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
     FspFileSystemSetOperationGuardStrategy(f->FileSystem, f->OpGuardStrategy);
     FspFileSystemSetDebugLog(f->FileSystem, f->DebugLog);
 
+    if (0 != f->DirCacheCapacity)
+    {
+        Result = FspFileSystemSetDirectoryCache(f->FileSystem,
+            f->DirCacheCapacity, f->DirCacheTimeout, !!f->VolumeParams.CaseSensitiveSearch);
+        if (!NT_SUCCESS(Result))
+        {
+            FspServiceLog(EVENTLOG_ERROR_TYPE,
+                L"Cannot enable " FSP_FUSE_LIBRARY_NAME " directory cache.");
+            goto fail;
+        }
+    }
+
     if (0 != f->MountPoint)
     {
         Result = FspFileSystemSetMountPoint(f->FileSystem,
@@ -406,6 +432,10 @@ static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         }
     }
 
+    if (0 != f->ThreadCountMax)
+        FspFileSystemSetDispatcherThreadCount(f->FileSystem,
+            f->ThreadCountMin, f->ThreadCountMax, f->ThreadIdleTimeout);
+
     Result = FspFileSystemStartDispatcher(f->FileSystem, 0);
     if (!NT_SUCCESS(Result))
     {
@@ -428,6 +458,11 @@ static NTSTATUS fsp_fuse_svcstop(FSP_SERVICE *Service)
 
     FspFileSystemStopDispatcher(f->FileSystem);
 
+    if (f->DebugLog)
+        FspDebugLog("%S[TID=%04lx]: path arena: high water %ld bytes (arena %ld bytes), %ld overflows\n",
+            FspDiagIdent(), GetCurrentThreadId(),
+            f->ArenaHighWater, (LONG)FSP_FUSE_ARENA_SIZE, f->ArenaOverflowCount);
+
     fsp_fuse_cleanup(f);
 
     return STATUS_SUCCESS;
@@ -461,7 +496,7 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
     default:
         return 1;
     case 'h':
-        /* Note: The limit on FspServiceLog messages is 1024 bytes. This is getting close. */
+        /* Note: The limit on FspServiceLog messages is 1024 bytes. Split the help if needed. */
         FspServiceLog(EVENTLOG_ERROR_TYPE, L""
             FSP_FUSE_LIBRARY_NAME " options:\n"
             "    -o umask=MASK              set file permissions (octal)\n"
@@ -473,7 +508,8 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
             "        --VolumePrefix=UNC     set UNC prefix (\\Server\\Share)\n"
             "    -o FileSystemName=NAME     set file system name\n"
             "    -o DebugLog=FILE           debug log file (requires -d)\n"
-            "\n"
+            );
+        FspServiceLog(EVENTLOG_ERROR_TYPE, L""
             FSP_FUSE_LIBRARY_NAME " advanced options:\n"
             "    -o FileInfoTimeout=N       metadata timeout (millis, -1 for data caching)\n"
             "    -o SectorSize=N            (512-4096, deflt: 4096)\n"
@@ -481,6 +517,17 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
             "    -o MaxComponentLength=N    (deflt: 255)\n"
             "    -o VolumeCreationTime=T    (FILETIME hex format)\n"
             "    -o VolumeSerialNumber=N    (32-bit wide)\n"
+            "    -o SecurityCacheCapacity=N (100-100000, deflt: 100)\n"
+            "    -o DirInfoCacheCapacity=N  (100-100000, deflt: 100)\n"
+            "    -o StreamInfoCacheCapacity=N   (100-100000, deflt: 100)\n"
+            "    -o DirInfoCacheSizeMax=N   (bytes; 16K-64M, deflt: 16K)\n"
+            "    -o NegativeNameCacheCapacity=N (100-100000, deflt: 1000)\n"
+            "    -o ThreadCountMin=N        min dispatcher threads (deflt: 2)\n"
+            "    -o ThreadCountMax=N        max dispatcher threads (deflt: fixed count)\n"
+            "    -o ThreadIdleTimeout=N     idle thread exit timeout (millis, deflt: 30000)\n"
+            "    -o DirPrefetchThreadCount=N    readdir getattr threads (1-64, deflt: 8)\n"
+            "    -o DirCacheCapacity=N      shared readdir listings (16-4096, deflt: 0=off)\n"
+            "    -o DirCacheTimeout=N       shared readdir timeout (millis, deflt: 1000)\n"
             );
         opt_data->help = 1;
         return 1;
@@ -562,6 +609,7 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     opt_data.env = env;
     opt_data.DebugLogHandle = GetStdHandle(STD_ERROR_HANDLE);
     opt_data.VolumeParams.FileInfoTimeout = 1000;   /* default FileInfoTimeout for FUSE file systems */
+    opt_data.DirPrefetchThreadCount = FSP_FUSE_DIRINFO_PREFETCH_THREAD_COUNT_DEFAULT;
 
     if (-1 == fsp_fuse_opt_parse(env, args, &opt_data, fsp_fuse_core_opts, fsp_fuse_core_opt_proc))
         return 0;
@@ -601,7 +649,8 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     }
 
     if (!opt_data.set_FileInfoTimeout && opt_data.set_attr_timeout)
-        opt_data.VolumeParams.FileInfoTimeout = opt_data.set_attr_timeout * 1000;
+        opt_data.VolumeParams.FileInfoTimeout = opt_data.attr_timeout * 1000;
+    opt_data.VolumeParams.Version = sizeof(FSP_FSCTL_VOLUME_PARAMS);
     opt_data.VolumeParams.CaseSensitiveSearch = TRUE;
     opt_data.VolumeParams.PersistentAcls = TRUE;
     opt_data.VolumeParams.ReparsePoints = TRUE;
@@ -628,6 +677,17 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     memcpy(&f->VolumeParams, &opt_data.VolumeParams, sizeof opt_data.VolumeParams);
     f->VolumeLabelLength = opt_data.VolumeLabelLength;
     memcpy(&f->VolumeLabel, &opt_data.VolumeLabel, opt_data.VolumeLabelLength);
+    f->ThreadCountMin = opt_data.ThreadCountMin;
+    f->ThreadCountMax = opt_data.ThreadCountMax;
+    f->ThreadIdleTimeout = opt_data.ThreadIdleTimeout;
+    f->DirPrefetchThreadCount = opt_data.DirPrefetchThreadCount;
+    f->DirCacheCapacity = opt_data.DirCacheCapacity;
+    f->DirCacheTimeout = opt_data.DirCacheTimeout;
+    if (FSP_FUSE_DIRINFO_PREFETCH_THREAD_COUNT_MAX < f->DirPrefetchThreadCount)
+        f->DirPrefetchThreadCount = FSP_FUSE_DIRINFO_PREFETCH_THREAD_COUNT_MAX;
+    /* the write attribute cache is opt-in: only with an explicit attr_timeout */
+    f->AttrTimeout = opt_data.set_attr_timeout && 0 < opt_data.attr_timeout ?
+        opt_data.attr_timeout * 1000 : 0;
 
     Size = (lstrlenW(ch->MountPoint) + 1) * sizeof(WCHAR);
     f->MountPoint = fsp_fuse_obj_alloc(env, Size);
@@ -733,11 +793,13 @@ FSP_FUSE_API struct fuse_context *fsp_fuse_get_context(struct fsp_fuse_env *env)
         struct fsp_fuse_context_header *contexthdr;
 
         contexthdr = fsp_fuse_obj_alloc(env,
-            sizeof(struct fsp_fuse_context_header) + sizeof(struct fuse_context));
+            sizeof(struct fsp_fuse_context_header) + FSP_FUSE_CONTEXT_SIZE + FSP_FUSE_ARENA_SIZE);
         if (0 == contexthdr)
             return 0;
 
         context = FSP_FUSE_CONTEXT_FROM_HDR(contexthdr);
+        contexthdr->Arena = contexthdr->ContextBuf + FSP_FUSE_CONTEXT_SIZE;
+        contexthdr->ArenaSize = FSP_FUSE_ARENA_SIZE;
 
         TlsSetValue(fsp_fuse_tlskey, context);
     }
@@ -0,0 +1,156 @@
+/**
+ * @file dll/fuse/fuse_arena.c
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <dll/fuse/library.h>
+
+/*
+ * Per-thread path arena
+ *
+ * Every dispatcher thread owns a fixed size arena that is allocated together with its
+ * fuse_context. Transient buffers needed while servicing a request (POSIX paths, directory
+ * entry scratch paths) are carved from it and released all at once by fsp_fuse_op_leave.
+ * Requests that do not fit are satisfied from the heap and the blocks are freed at reset.
+ *
+ * Paths that are only needed for the duration of a call (e.g. the traverse and reparse
+ * point checks of a Create) are returned to the arena with fsp_fuse_arena_rewind, so that
+ * a deep path does not use up the arena one prefix at a time.
+ *
+ * ArenaSize is a multiple of FSP_FSCTL_DEFAULT_ALIGNMENT and ArenaUsed is always aligned.
+ */
+void *fsp_fuse_arena_alloc(struct fsp_fuse_context_header *contexthdr, ULONG Size)
+{
+    struct fsp_fuse_arena_block *Block;
+    PUINT8 Pointer;
+
+    Size = FSP_FSCTL_DEFAULT_ALIGN_UP(Size);
+
+    if (contexthdr->ArenaSize - contexthdr->ArenaUsed >= Size)
+    {
+        Pointer = contexthdr->Arena + contexthdr->ArenaUsed;
+        contexthdr->ArenaUsed += Size;
+        return Pointer;
+    }
+
+    Block = MemAlloc(sizeof *Block + Size);
+    if (0 == Block)
+        return 0;
+
+    Block->Next = contexthdr->ArenaOverflow;
+    contexthdr->ArenaOverflow = Block;
+    contexthdr->ArenaOverflowSize += Size;
+
+    return Block->Buffer;
+}
+
+VOID fsp_fuse_arena_rewind(struct fsp_fuse_context_header *contexthdr, ULONG Mark)
+{
+    /* overflow blocks stay allocated until reset; only the bump pointer moves back */
+    if (contexthdr->ArenaPeak < contexthdr->ArenaUsed)
+        contexthdr->ArenaPeak = contexthdr->ArenaUsed;
+    if (Mark < contexthdr->ArenaUsed)
+        contexthdr->ArenaUsed = Mark;
+}
+
+VOID fsp_fuse_arena_reset(struct fuse *f, struct fsp_fuse_context_header *contexthdr)
+{
+    struct fsp_fuse_arena_block *Block, *NextBlock;
+    LONG Used, HighWater;
+
+    Used = (LONG)(
+        (contexthdr->ArenaPeak > contexthdr->ArenaUsed ? contexthdr->ArenaPeak : contexthdr->ArenaUsed) +
+        contexthdr->ArenaOverflowSize);
+    for (HighWater = f->ArenaHighWater; HighWater < Used; HighWater = f->ArenaHighWater)
+        if (HighWater == InterlockedCompareExchange(&f->ArenaHighWater, Used, HighWater))
+            break;
+
+    if (0 != contexthdr->ArenaOverflow)
+    {
+        InterlockedIncrement(&f->ArenaOverflowCount);
+        for (Block = contexthdr->ArenaOverflow; 0 != Block; Block = NextBlock)
+        {
+            NextBlock = Block->Next;
+            MemFree(Block);
+        }
+    }
+
+    contexthdr->ArenaUsed = 0;
+    contexthdr->ArenaPeak = 0;
+    contexthdr->ArenaOverflowSize = 0;
+    contexthdr->ArenaOverflow = 0;
+}
+
+NTSTATUS fsp_fuse_arena_posix_path(struct fsp_fuse_context_header *contexthdr,
+    PWSTR FileName, char **PPosixPath)
+{
+    char *PosixPath;
+    ULONG Size;
+    NTSTATUS Result;
+
+    *PPosixPath = 0;
+
+    /* translate directly into the free part of the arena and commit only what was used */
+    PosixPath = (char *)(contexthdr->Arena + contexthdr->ArenaUsed);
+    Size = contexthdr->ArenaSize - contexthdr->ArenaUsed;
+    Result = FspPosixMapWindowsToPosixPathBuffer(FileName, PosixPath, &Size, TRUE);
+    if (NT_SUCCESS(Result))
+        fsp_fuse_arena_alloc(contexthdr, Size); /* fits; cannot fail */
+    else if (STATUS_BUFFER_TOO_SMALL == Result)
+    {
+        PosixPath = fsp_fuse_arena_alloc(contexthdr, Size);
+        if (0 == PosixPath)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        Result = FspPosixMapWindowsToPosixPathBuffer(FileName, PosixPath, &Size, TRUE);
+    }
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    *PPosixPath = PosixPath;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsp_fuse_arena_windows_path(struct fsp_fuse_context_header *contexthdr,
+    const char *PosixPath, PWSTR *PWindowsPath)
+{
+    PWSTR WindowsPath;
+    ULONG Size;
+    NTSTATUS Result;
+
+    *PWindowsPath = 0;
+
+    /* the arena is aligned, so its free part can hold WCHAR's */
+    WindowsPath = (PWSTR)(contexthdr->Arena + contexthdr->ArenaUsed);
+    Size = contexthdr->ArenaSize - contexthdr->ArenaUsed;
+    Result = FspPosixMapPosixToWindowsPathBuffer(PosixPath, WindowsPath, &Size, TRUE);
+    if (NT_SUCCESS(Result))
+        fsp_fuse_arena_alloc(contexthdr, Size); /* fits; cannot fail */
+    else if (STATUS_BUFFER_TOO_SMALL == Result)
+    {
+        WindowsPath = fsp_fuse_arena_alloc(contexthdr, Size);
+        if (0 == WindowsPath)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        Result = FspPosixMapPosixToWindowsPathBuffer(PosixPath, WindowsPath, &Size, TRUE);
+    }
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    *PWindowsPath = WindowsPath;
+
+    return STATUS_SUCCESS;
+}
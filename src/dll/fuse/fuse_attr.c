@@ -0,0 +1,203 @@
+/**
+ * @file dll/fuse/fuse_attr.c
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <dll/fuse/library.h>
+
+/*
+ * Attribute nodes
+ *
+ * When attr_timeout is set, Write caches the attributes of the open file (see fuse_intf.c).
+ * All opens of a path share an attribute node that lives as long as the path is open.
+ * Any operation that changes the attributes of a path bumps the generation of its node,
+ * which invalidates the cache of every open of that path and of no other path.
+ *
+ * Nodes are keyed by path. A rename rekeys the node of the renamed path and the nodes of
+ * every path below it, so that opens made before and after the rename share a node. The
+ * node of a replaced target is unlinked ("orphaned"): its opens refer to a file that is
+ * gone and must neither hit their cache nor take over the new key.
+ */
+static inline ULONG fsp_fuse_attr_hash(const char *PosixPath)
+{
+    ULONG Hash = FspFnv1aOffsetBasis;
+
+    for (; '\0' != *PosixPath; PosixPath++)
+        Hash = FspFnv1a(Hash, (UINT8)*PosixPath);
+
+    return Hash;
+}
+
+static inline struct fsp_fuse_attr_node *fsp_fuse_attr_lookup(struct fuse *f,
+    const char *PosixPath, ULONG Hash)
+{
+    struct fsp_fuse_attr_node *AttrNode;
+
+    for (AttrNode = f->AttrNodeBuckets[Hash % FSP_FUSE_ATTR_NODE_BUCKET_COUNT];
+        0 != AttrNode; AttrNode = AttrNode->Next)
+        if (Hash == AttrNode->Hash && 0 == lstrcmpA(PosixPath, AttrNode->PosixPath))
+            return AttrNode;
+
+    return 0;
+}
+
+static inline VOID fsp_fuse_attr_link(struct fuse *f, struct fsp_fuse_attr_node *AttrNode)
+{
+    AttrNode->Hash = fsp_fuse_attr_hash(AttrNode->PosixPath);
+    AttrNode->Next = f->AttrNodeBuckets[AttrNode->Hash % FSP_FUSE_ATTR_NODE_BUCKET_COUNT];
+    f->AttrNodeBuckets[AttrNode->Hash % FSP_FUSE_ATTR_NODE_BUCKET_COUNT] = AttrNode;
+}
+
+static inline VOID fsp_fuse_attr_unlink(struct fuse *f, struct fsp_fuse_attr_node *AttrNode)
+{
+    struct fsp_fuse_attr_node **P;
+
+    for (P = &f->AttrNodeBuckets[AttrNode->Hash % FSP_FUSE_ATTR_NODE_BUCKET_COUNT];
+        AttrNode != *P; P = &(*P)->Next)
+        ;
+    *P = AttrNode->Next;
+}
+
+static inline VOID fsp_fuse_attr_set_path(struct fsp_fuse_attr_node *AttrNode, char *PosixPath)
+{
+    if (AttrNode->PosixPathBuf != AttrNode->PosixPath)
+        MemFree(AttrNode->PosixPath);
+    AttrNode->PosixPath = PosixPath;
+}
+
+struct fsp_fuse_attr_node *fsp_fuse_attr_reference(struct fuse *f, const char *PosixPath)
+{
+    ULONG Hash = fsp_fuse_attr_hash(PosixPath);
+    struct fsp_fuse_attr_node *AttrNode;
+
+    AcquireSRWLockExclusive(&f->AttrNodeLock);
+
+    AttrNode = fsp_fuse_attr_lookup(f, PosixPath, Hash);
+    if (0 == AttrNode)
+    {
+        AttrNode = MemAlloc(sizeof *AttrNode + lstrlenA(PosixPath) + 1);
+        if (0 != AttrNode)
+        {
+            AttrNode->RefCount = 0;
+            AttrNode->Generation = 0;
+            AttrNode->PosixPath = AttrNode->PosixPathBuf;
+            lstrcpyA(AttrNode->PosixPath, PosixPath);
+            fsp_fuse_attr_link(f, AttrNode);
+        }
+    }
+    if (0 != AttrNode)
+        AttrNode->RefCount++;
+
+    ReleaseSRWLockExclusive(&f->AttrNodeLock);
+
+    return AttrNode;
+}
+
+VOID fsp_fuse_attr_dereference(struct fuse *f, struct fsp_fuse_attr_node *AttrNode)
+{
+    AcquireSRWLockExclusive(&f->AttrNodeLock);
+
+    if (0 == --AttrNode->RefCount)
+    {
+        if (0 != AttrNode->PosixPath)
+            fsp_fuse_attr_unlink(f, AttrNode);
+        fsp_fuse_attr_set_path(AttrNode, 0);
+    }
+    else
+        AttrNode = 0;
+
+    ReleaseSRWLockExclusive(&f->AttrNodeLock);
+
+    MemFree(AttrNode);
+}
+
+VOID fsp_fuse_attr_invalidate(struct fuse *f, const char *PosixPath)
+{
+    ULONG Hash = fsp_fuse_attr_hash(PosixPath);
+    struct fsp_fuse_attr_node *AttrNode;
+
+    AcquireSRWLockShared(&f->AttrNodeLock);
+
+    AttrNode = fsp_fuse_attr_lookup(f, PosixPath, Hash);
+    if (0 != AttrNode)
+        InterlockedIncrement(&AttrNode->Generation);
+
+    ReleaseSRWLockShared(&f->AttrNodeLock);
+}
+
+VOID fsp_fuse_attr_rename(struct fuse *f, struct fsp_fuse_attr_node *RenameNode,
+    const char *NewPosixPath)
+{
+    struct fsp_fuse_attr_node *AttrNode, *NextNode, *RenameList = 0;
+    const char *PosixPath;
+    ULONG Length, NewLength, Size;
+    char *Path;
+
+    AcquireSRWLockExclusive(&f->AttrNodeLock);
+
+    /* the old key is only freed once it has been used for matching below */
+    PosixPath = RenameNode->PosixPath;
+    if (0 == PosixPath)
+    {
+        InterlockedIncrement(&RenameNode->Generation);
+        goto exit;
+    }
+    Length = lstrlenA(PosixPath);
+    NewLength = lstrlenA(NewPosixPath);
+
+    /* the replaced target (if open) is gone */
+    AttrNode = fsp_fuse_attr_lookup(f, NewPosixPath, fsp_fuse_attr_hash(NewPosixPath));
+    if (0 != AttrNode && RenameNode != AttrNode)
+    {
+        fsp_fuse_attr_unlink(f, AttrNode);
+        fsp_fuse_attr_set_path(AttrNode, 0);
+        InterlockedIncrement(&AttrNode->Generation);
+    }
+
+    /* unlink the renamed path and everything below it; renames are rare, so scan it all */
+    for (ULONG Index = 0; FSP_FUSE_ATTR_NODE_BUCKET_COUNT > Index; Index++)
+        for (AttrNode = f->AttrNodeBuckets[Index]; 0 != AttrNode; AttrNode = NextNode)
+        {
+            NextNode = AttrNode->Next;
+            if (0 == invariant_strncmp(AttrNode->PosixPath, PosixPath, Length) &&
+                ('\0' == AttrNode->PosixPath[Length] || '/' == AttrNode->PosixPath[Length]))
+            {
+                fsp_fuse_attr_unlink(f, AttrNode);
+                AttrNode->Next = RenameList;
+                RenameList = AttrNode;
+            }
+        }
+
+    /* rekey and relink them; a node that cannot be rekeyed stays orphaned */
+    for (AttrNode = RenameList; 0 != AttrNode; AttrNode = NextNode)
+    {
+        NextNode = AttrNode->Next;
+        InterlockedIncrement(&AttrNode->Generation);
+
+        Size = NewLength + lstrlenA(AttrNode->PosixPath + Length) + 1;
+        Path = MemAlloc(Size);
+        if (0 != Path)
+        {
+            memcpy(Path, NewPosixPath, NewLength);
+            lstrcpyA(Path + NewLength, AttrNode->PosixPath + Length);
+        }
+        fsp_fuse_attr_set_path(AttrNode, Path);
+        if (0 != Path)
+            fsp_fuse_attr_link(f, AttrNode);
+    }
+
+exit:
+    ReleaseSRWLockExclusive(&f->AttrNodeLock);
+}
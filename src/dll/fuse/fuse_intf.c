@@ -118,6 +118,11 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
     UINT64 AccessToken = 0;
     NTSTATUS Result;
 
+    context = fsp_fuse_get_context(f->env);
+    if (0 == context)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+
     if (FspFsctlTransactCreateKind == Request->Kind)
     {
         if (Request->Req.Create.OpenTargetDirectory)
@@ -135,7 +140,7 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
 
     if (0 != FileName)
     {
-        Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+        Result = fsp_fuse_arena_posix_path(contexthdr, FileName, &PosixPath);
         if (FspFsctlTransactCreateKind == Request->Kind && Request->Req.Create.OpenTargetDirectory)
             FspPathCombine((PWSTR)Request->Buffer, Suffix);
         if (!NT_SUCCESS(Result))
@@ -154,13 +159,6 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
         Pid = FSP_FSCTL_TRANSACT_REQ_TOKEN_PID(AccessToken);
     }
 
-    context = fsp_fuse_get_context(f->env);
-    if (0 == context)
-    {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
-    }
-
     fsp_fuse_op_enter_lock(FileSystem, Request, Response);
 
     context->fuse = f;
@@ -169,14 +167,13 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
     context->gid = Gid;
     context->pid = 0 != f->env->winpid_to_pid ? f->env->winpid_to_pid(Pid) : Pid;
 
-    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     contexthdr->PosixPath = PosixPath;
 
     Result = STATUS_SUCCESS;
 
 exit:
-    if (!NT_SUCCESS(Result) && 0 != PosixPath)
-        FspPosixDeletePath(PosixPath);
+    if (!NT_SUCCESS(Result))
+        fsp_fuse_arena_reset(f, contexthdr);
 
     return Result;
 }
@@ -198,9 +195,8 @@ NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
     context->pid = -1;
 
     contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
-    if (0 != contexthdr->PosixPath)
-        FspPosixDeletePath(contexthdr->PosixPath);
-    memset(contexthdr, 0, sizeof *contexthdr);
+    contexthdr->PosixPath = 0;
+    fsp_fuse_arena_reset(f, contexthdr);
 
     return STATUS_SUCCESS;
 }
@@ -675,10 +671,20 @@ static NTSTATUS fsp_fuse_intf_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
     PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
 {
     struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context;
+    struct fsp_fuse_context_header *contexthdr;
     char *PosixPath = 0;
+    ULONG ArenaMark;
     NTSTATUS Result;
 
-    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+    /* called for the target and every traverse check of a Create; keep it off the heap */
+    context = fsp_fuse_get_context(f->env);
+    if (0 == context)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    ArenaMark = contexthdr->ArenaUsed;
+
+    Result = fsp_fuse_arena_posix_path(contexthdr, FileName, &PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
@@ -695,12 +701,52 @@ static NTSTATUS fsp_fuse_intf_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
         Result = STATUS_SUCCESS;
 
 exit:
-    if (0 != PosixPath)
-        FspPosixDeletePath(PosixPath);
+    fsp_fuse_arena_rewind(contexthdr, ArenaMark);
 
     return Result;
 }
 
+/*
+ * Per-open attribute cache
+ *
+ * Write needs the current file size for append and constrained I/O. When attr_timeout is
+ * set, rather than issue a getattr before every write, the file descriptor caches the
+ * attributes returned by the last getattr/write for up to attr_timeout. The cache of an
+ * open is invalidated when the generation of its attribute node changes (see fuse_attr.c).
+ * Without attr_timeout there are no attribute nodes and every write issues a getattr.
+ *
+ * The cache is only accessed from Write, which the FSD serializes per file.
+ */
+static inline VOID fsp_fuse_intf_InvalidateAttr(struct fsp_fuse_file_desc *filedesc)
+{
+    /* by node rather than by path: filedesc->PosixPath is not updated on rename */
+    if (0 != filedesc->AttrNode)
+        InterlockedIncrement(&filedesc->AttrNode->Generation);
+}
+
+static inline BOOLEAN fsp_fuse_intf_GetCachedAttr(
+    struct fsp_fuse_file_desc *filedesc, LONG Generation, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    if (0 == filedesc->AttrExpiration ||
+        Generation != filedesc->AttrGeneration ||
+        GetTickCount64() >= filedesc->AttrExpiration)
+        return FALSE;
+
+    memcpy(FileInfo, &filedesc->AttrFileInfo, sizeof *FileInfo);
+    return TRUE;
+}
+
+static inline VOID fsp_fuse_intf_SetCachedAttr(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, LONG Generation, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    if (0 == f->AttrTimeout)
+        return;
+
+    filedesc->AttrGeneration = Generation;
+    filedesc->AttrExpiration = GetTickCount64() + f->AttrTimeout;
+    memcpy(&filedesc->AttrFileInfo, FileInfo, sizeof *FileInfo);
+}
+
 static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     PWSTR FileName, UINT32 CreateOptions, UINT32 GrantedAccess,
     UINT32 FileAttributes, PSECURITY_DESCRIPTOR SecurityDescriptor, UINT64 AllocationSize,
@@ -717,12 +763,19 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     int err;
     NTSTATUS Result;
 
-    filedesc = MemAlloc(sizeof *filedesc);
+    /* the POSIX path lives in the arena; copy it into the file descriptor */
+    filedesc = MemAlloc(sizeof *filedesc + lstrlenA(contexthdr->PosixPath) + 1);
     if (0 == filedesc)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
         goto exit;
     }
+    filedesc->AttrNode = 0 != f->AttrTimeout ? fsp_fuse_attr_reference(f, contexthdr->PosixPath) : 0;
+    if (0 != f->AttrTimeout && 0 == filedesc->AttrNode)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
 
     Uid = context->uid;
     Gid = context->gid;
@@ -789,6 +842,7 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
         else
             Result = STATUS_INVALID_DEVICE_REQUEST;
     }
+    fsp_fuse_attr_invalidate(f, contexthdr->PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
@@ -822,13 +876,14 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     *PFileNode = filedesc;
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
 
-    filedesc->PosixPath = contexthdr->PosixPath;
+    filedesc->PosixPath = filedesc->PosixPathBuf;
+    lstrcpyA(filedesc->PosixPath, contexthdr->PosixPath);
     filedesc->IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     filedesc->IsReparsePoint = FALSE;
     filedesc->OpenFlags = fi.flags;
     filedesc->FileHandle = fi.fh;
     filedesc->DirBuffer = 0;
-    contexthdr->PosixPath = 0;
+    filedesc->AttrExpiration = 0;
 
     Result = STATUS_SUCCESS;
 
@@ -840,15 +895,17 @@ exit:
             if (CreateOptions & FILE_DIRECTORY_FILE)
             {
                 if (0 != f->ops.releasedir)
-                    f->ops.releasedir(filedesc->PosixPath, &fi);
+                    f->ops.releasedir(contexthdr->PosixPath, &fi);
             }
             else
             {
                 if (0 != f->ops.release)
-                    f->ops.release(filedesc->PosixPath, &fi);
+                    f->ops.release(contexthdr->PosixPath, &fi);
             }
         }
 
+        if (0 != filedesc && 0 != filedesc->AttrNode)
+            fsp_fuse_attr_dereference(f, filedesc->AttrNode);
         MemFree(filedesc);
     }
 
@@ -874,12 +931,19 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     if (!NT_SUCCESS(Result))
         goto exit;
 
-    filedesc = MemAlloc(sizeof *filedesc);
+    /* the POSIX path lives in the arena; copy it into the file descriptor */
+    filedesc = MemAlloc(sizeof *filedesc + lstrlenA(contexthdr->PosixPath) + 1);
     if (0 == filedesc)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
         goto exit;
     }
+    filedesc->AttrNode = 0 != f->AttrTimeout ? fsp_fuse_attr_reference(f, contexthdr->PosixPath) : 0;
+    if (0 != f->AttrTimeout && 0 == filedesc->AttrNode)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
 
     memset(&fi, 0, sizeof fi);
     switch (GrantedAccess & (FILE_READ_DATA | FILE_WRITE_DATA))
@@ -939,19 +1003,24 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     *PFileNode = filedesc;
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
 
-    filedesc->PosixPath = contexthdr->PosixPath;
+    filedesc->PosixPath = filedesc->PosixPathBuf;
+    lstrcpyA(filedesc->PosixPath, contexthdr->PosixPath);
     filedesc->IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     filedesc->IsReparsePoint = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
     filedesc->OpenFlags = fi.flags;
     filedesc->FileHandle = fi.fh;
     filedesc->DirBuffer = 0;
-    contexthdr->PosixPath = 0;
+    filedesc->AttrExpiration = 0;
 
     Result = STATUS_SUCCESS;
 
 exit:
     if (!NT_SUCCESS(Result))
+    {
+        if (0 != filedesc && 0 != filedesc->AttrNode)
+            fsp_fuse_attr_dereference(f, filedesc->AttrNode);
         MemFree(filedesc);
+    }
 
     return Result;
 }
@@ -986,6 +1055,7 @@ static NTSTATUS fsp_fuse_intf_Overwrite(FSP_FILE_SYSTEM *FileSystem,
     }
     else
         Result = STATUS_INVALID_DEVICE_REQUEST;
+    fsp_fuse_intf_InvalidateAttr(filedesc);
     if (!NT_SUCCESS(Result))
         return Result;
 
@@ -1017,6 +1087,7 @@ static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
      */
 
     if (Flags & FspCleanupDelete)
+    {
         if (filedesc->IsDirectory && !filedesc->IsReparsePoint)
         {
             if (0 != f->ops.rmdir)
@@ -1027,6 +1098,8 @@ static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
             if (0 != f->ops.unlink)
                 f->ops.unlink(filedesc->PosixPath);
         }
+        fsp_fuse_intf_InvalidateAttr(filedesc);
+    }
 }
 
 static VOID fsp_fuse_intf_Close(FSP_FILE_SYSTEM *FileSystem,
@@ -1058,7 +1131,8 @@ static VOID fsp_fuse_intf_Close(FSP_FILE_SYSTEM *FileSystem,
     }
 
     FspFileSystemDeleteDirectoryBuffer(&filedesc->DirBuffer);
-    MemFree(filedesc->PosixPath);
+    if (0 != filedesc->AttrNode)
+        fsp_fuse_attr_dereference(f, filedesc->AttrNode);
     MemFree(filedesc);
 }
 
@@ -1107,6 +1181,7 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
     struct fuse_file_info fi;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
     UINT64 EndOffset, AllocationUnit;
+    LONG Generation;
     int bytes;
     NTSTATUS Result;
 
@@ -1120,10 +1195,16 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath, &fi,
-        &Uid, &Gid, &Mode, &FileInfoBuf);
-    if (!NT_SUCCESS(Result))
-        return Result;
+    Generation = 0 != filedesc->AttrNode ? filedesc->AttrNode->Generation : 0;
+    if (!fsp_fuse_intf_GetCachedAttr(filedesc, Generation, &FileInfoBuf))
+    {
+        Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath, &fi,
+            &Uid, &Gid, &Mode, &FileInfoBuf);
+        if (!NT_SUCCESS(Result))
+            return Result;
+
+        fsp_fuse_intf_SetCachedAttr(f, filedesc, Generation, &FileInfoBuf);
+    }
 
     if (ConstrainedIo)
     {
@@ -1142,15 +1223,39 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
 
     bytes = f->ops.write(filedesc->PosixPath, Buffer, (size_t)(EndOffset - Offset), Offset, &fi);
     if (0 > bytes)
+    {
+        filedesc->AttrExpiration = 0;
         return fsp_fuse_ntstatus_from_errno(f->env, bytes);
+    }
 
     *PBytesTransferred = bytes;
 
     AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
         (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
-    FileInfoBuf.FileSize = Offset + bytes;
-    FileInfoBuf.AllocationSize =
-        (FileInfoBuf.FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+    if (FileInfoBuf.FileSize < Offset + bytes)
+    {
+        FileInfoBuf.FileSize = Offset + bytes;
+        FileInfoBuf.AllocationSize =
+            (FileInfoBuf.FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+    }
+
+    /*
+     * Other opens of this path must drop their cached attributes. Our own cache remains
+     * valid only if nobody else changed the path's attributes since we sampled Generation.
+     */
+    if (0 == filedesc->AttrNode)
+        ;
+    else if (Generation == InterlockedCompareExchange(&filedesc->AttrNode->Generation,
+        Generation + 1, Generation))
+    {
+        filedesc->AttrGeneration = Generation + 1;
+        memcpy(&filedesc->AttrFileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+    }
+    else
+    {
+        InterlockedIncrement(&filedesc->AttrNode->Generation);
+        filedesc->AttrExpiration = 0;
+    }
 
 success:
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
@@ -1296,6 +1401,7 @@ static NTSTATUS fsp_fuse_intf_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
         err = f->ops.utime(filedesc->PosixPath, &timbuf);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
     }
+    fsp_fuse_intf_InvalidateAttr(filedesc);
     if (!NT_SUCCESS(Result))
         return Result;
 
@@ -1349,6 +1455,7 @@ static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
             err = f->ops.truncate(filedesc->PosixPath, NewSize);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
+        fsp_fuse_intf_InvalidateAttr(filedesc);
         if (!NT_SUCCESS(Result))
             return Result;
 
@@ -1457,6 +1564,10 @@ static NTSTATUS fsp_fuse_intf_Rename(FSP_FILE_SYSTEM *FileSystem,
     }
 
     err = f->ops.rename(filedesc->PosixPath, contexthdr->PosixPath);
+    if (0 == err && 0 != filedesc->AttrNode)
+        fsp_fuse_attr_rename(f, filedesc->AttrNode, contexthdr->PosixPath);
+    else
+        fsp_fuse_intf_InvalidateAttr(filedesc);
     return fsp_fuse_ntstatus_from_errno(f->env, err);
 }
 
@@ -1519,6 +1630,9 @@ static NTSTATUS fsp_fuse_intf_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
     if (!NT_SUCCESS(Result))
         goto exit;
 
+    if (NewMode != Mode || NewUid != Uid || NewGid != Gid)
+        fsp_fuse_intf_InvalidateAttr(filedesc);
+
     if (NewMode != Mode)
     {
         err = f->ops.chmod(filedesc->PosixPath, NewMode);
@@ -1609,38 +1723,49 @@ static int fsp_fuse_intf_AddDirInfoOld(fuse_dirh_t dh, const char *name,
     return fsp_fuse_intf_AddDirInfo(dh, name, 0, 0) ? -ENOMEM : 0;
 }
 
-static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
-    struct fsp_fuse_file_desc *filedesc)
+/*
+ * Without readdirplus every directory entry needs its own getattr. These are independent of
+ * each other, so when the file system is multithreaded they are fanned out to the thread pool.
+ * Each participant claims entries by incrementing Next and fills DirInfo->FileInfo in place.
+ */
+struct fsp_fuse_dirinfo_fill
 {
-    char *PosixPath = 0, *PosixName, *PosixPathEnd, SavedPathChar;
-    ULONG SizeA, SizeW;
+    FSP_FILE_SYSTEM *FileSystem;
+    struct fuse_context *context;
+    const char *DirPosixPath;
     PUINT8 Buffer;
-    PULONG Index, IndexEnd;
+    PULONG Index;
     ULONG Count;
+    volatile LONG Next;
+    volatile LONG Result;
+};
+
+static NTSTATUS fsp_fuse_intf_FixDirInfoEntries(struct fsp_fuse_dirinfo_fill *Fill,
+    struct fsp_fuse_context_header *contexthdr)
+{
+    char *PosixPath = 0, *PosixName, *PosixPathEnd, SavedPathChar;
+    ULONG SizeA, SizeW, I;
     FSP_FSCTL_DIR_INFO *DirInfo;
     UINT32 Uid, Gid, Mode;
     NTSTATUS Result;
 
-    SizeA = lstrlenA(filedesc->PosixPath);
-    PosixPath = MemAlloc(SizeA + 1 + 255 + 1);
+    /* scratch path is released with the arena */
+    SizeA = lstrlenA(Fill->DirPosixPath);
+    PosixPath = fsp_fuse_arena_alloc(contexthdr, SizeA + 1 + 255 * 3 + 1);
     if (0 == PosixPath)
-    {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
-    }
+        return STATUS_INSUFFICIENT_RESOURCES;
 
-    memcpy(PosixPath, filedesc->PosixPath, SizeA);
+    memcpy(PosixPath, Fill->DirPosixPath, SizeA);
     if (1 < SizeA)
         /* if not root */
         PosixPath[SizeA++] = '/';
     PosixPath[SizeA] = '\0';
     PosixName = PosixPath + SizeA;
 
-    FspFileSystemPeekInDirectoryBuffer(&filedesc->DirBuffer, &Buffer, &Index, &Count);
-
-    for (IndexEnd = Index + Count; IndexEnd > Index; Index++)
+    while (STATUS_SUCCESS == Fill->Result &&
+        Fill->Count > (I = (ULONG)InterlockedIncrement(&Fill->Next) - 1))
     {
-        DirInfo = (FSP_FSCTL_DIR_INFO *)(Buffer + *Index);
+        DirInfo = (FSP_FSCTL_DIR_INFO *)(Fill->Buffer + Fill->Index[I]);
         SizeW = (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR);
 
         if (DirInfo->Padding[0])
@@ -1671,20 +1796,17 @@ static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
             else
             {
                 PosixPathEnd = 0;
-                SizeA = WideCharToMultiByte(CP_UTF8, 0, DirInfo->FileNameBuf, SizeW, PosixName, 255, 0, 0);
+                SizeA = WideCharToMultiByte(CP_UTF8, 0, DirInfo->FileNameBuf, SizeW, PosixName, 255 * 3, 0, 0);
                 if (0 == SizeA)
-                {
                     /* this should never happen because we just converted using MultiByteToWideChar */
-                    Result = STATUS_OBJECT_NAME_INVALID;
-                    goto exit;
-                }
+                    return STATUS_OBJECT_NAME_INVALID;
                 PosixName[SizeA] = '\0';
             }
 
-            Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, PosixPath, 0,
+            Result = fsp_fuse_intf_GetFileInfoEx(Fill->FileSystem, PosixPath, 0,
                 &Uid, &Gid, &Mode, &DirInfo->FileInfo);
             if (!NT_SUCCESS(Result))
-                goto exit;
+                return Result;
 
             if (0 != PosixPathEnd)
                 *PosixPathEnd = SavedPathChar;
@@ -1693,12 +1815,81 @@ static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
         FspPosixDecodeWindowsPath(DirInfo->FileNameBuf, SizeW);
     }
 
-    Result = STATUS_SUCCESS;
+    return STATUS_SUCCESS;
+}
 
-exit:
-    MemFree(PosixPath);
+static VOID CALLBACK fsp_fuse_intf_FixDirInfoWork(
+    PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+    struct fsp_fuse_dirinfo_fill *Fill = Context;
+    struct fuse *f = Fill->FileSystem->UserContext;
+    struct fuse_context *context, SavedContext;
+    struct fsp_fuse_context_header *contexthdr;
+    NTSTATUS Result;
 
-    return Result;
+    context = fsp_fuse_get_context(f->env);
+    if (0 == context)
+        return; /* the remaining participants will pick up the slack */
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+
+    /* getattr sees the same fuse_context as the thread that issued the ReadDirectory */
+    memcpy(&SavedContext, context, sizeof SavedContext);
+    memcpy(context, Fill->context, sizeof *context);
+
+    Result = fsp_fuse_intf_FixDirInfoEntries(Fill, contexthdr);
+    if (!NT_SUCCESS(Result))
+        InterlockedCompareExchange(&Fill->Result, Result, STATUS_SUCCESS);
+
+    memcpy(context, &SavedContext, sizeof *context);
+    fsp_fuse_arena_reset(f, contexthdr);
+}
+
+static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fsp_fuse_dirinfo_fill Fill;
+    ULONG WorkerCount = 1;
+    PTP_WORK Work = 0;
+    NTSTATUS Result;
+
+    memset(&Fill, 0, sizeof Fill);
+    Fill.FileSystem = FileSystem;
+    Fill.context = context;
+    Fill.DirPosixPath = filedesc->PosixPath;
+    Fill.Result = STATUS_SUCCESS;
+    FspFileSystemPeekInDirectoryBuffer(&filedesc->DirBuffer, &Fill.Buffer, &Fill.Index, &Fill.Count);
+
+    /* with the coarse guard strategy the file system expects to be called from one thread only */
+    if (FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE == f->OpGuardStrategy)
+    {
+        WorkerCount = (Fill.Count + FSP_FUSE_DIRINFO_PREFETCH_ENTRIES_PER_THREAD - 1) /
+            FSP_FUSE_DIRINFO_PREFETCH_ENTRIES_PER_THREAD;
+        if (WorkerCount > f->DirPrefetchThreadCount)
+            WorkerCount = f->DirPrefetchThreadCount;
+    }
+
+    if (1 < WorkerCount)
+    {
+        /* if the work item cannot be created, fill the entries on this thread */
+        Work = CreateThreadpoolWork(fsp_fuse_intf_FixDirInfoWork, &Fill, 0);
+        if (0 != Work)
+            for (ULONG I = 1; WorkerCount > I; I++)
+                SubmitThreadpoolWork(Work);
+    }
+
+    Result = fsp_fuse_intf_FixDirInfoEntries(&Fill, FSP_FUSE_HDR_FROM_CONTEXT(context));
+    if (!NT_SUCCESS(Result))
+        InterlockedCompareExchange(&Fill.Result, Result, STATUS_SUCCESS);
+
+    if (0 != Work)
+    {
+        WaitForThreadpoolWorkCallbacks(Work, FALSE);
+        CloseThreadpoolWork(Work);
+    }
+
+    return Fill.Result;
 }
 
 static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
@@ -1707,12 +1898,25 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
 {
     struct fuse *f = FileSystem->UserContext;
     struct fsp_fuse_file_desc *filedesc = FileNode;
+    struct fuse_context *context;
     struct fuse_dirhandle dh;
     struct fuse_file_info fi;
+    PWSTR DirName = 0;
     int err;
     NTSTATUS Result;
 
-    if (FspFileSystemAcquireDirectoryBuffer(&filedesc->DirBuffer, 0 == Marker, &Result))
+    /* the directory cache is keyed by Windows name; only needed when (re)starting a listing */
+    if (0 != FileSystem->DirectoryCache && (0 == Marker || 0 == filedesc->DirBuffer))
+    {
+        /* released with the arena */
+        context = fsp_fuse_get_context(f->env);
+        if (0 != context)
+            fsp_fuse_arena_windows_path(FSP_FUSE_HDR_FROM_CONTEXT(context),
+                filedesc->PosixPath, &DirName);
+    }
+
+    if (FspFileSystemAcquireCachedDirectoryBuffer(FileSystem, DirName,
+        &filedesc->DirBuffer, 0 == Marker, &Result))
     {
         memset(&dh, 0, sizeof dh);
         dh.filedesc = filedesc;
@@ -1744,7 +1948,7 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
                 Result = fsp_fuse_intf_FixDirInfo(FileSystem, filedesc);
         }
 
-        FspFileSystemReleaseDirectoryBuffer(&filedesc->DirBuffer);
+        FspFileSystemReleaseCachedDirectoryBuffer(FileSystem, &filedesc->DirBuffer, Result);
     }
 
     if (!NT_SUCCESS(Result))
@@ -1770,18 +1974,27 @@ static NTSTATUS fsp_fuse_intf_GetReparsePointByName(
     PWSTR FileName, BOOLEAN IsDirectory, PVOID Buffer, PSIZE_T PSize)
 {
     struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context;
+    struct fsp_fuse_context_header *contexthdr;
     char *PosixPath = 0;
+    ULONG ArenaMark;
     NTSTATUS Result;
 
-    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+    /* called once per path component while looking for reparse points */
+    context = fsp_fuse_get_context(f->env);
+    if (0 == context)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    ArenaMark = contexthdr->ArenaUsed;
+
+    Result = fsp_fuse_arena_posix_path(contexthdr, FileName, &PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
     Result = fsp_fuse_intf_GetReparsePointEx(FileSystem, PosixPath, 0, Buffer, PSize);
 
 exit:
-    if (0 != PosixPath)
-        FspPosixDeletePath(PosixPath);
+    fsp_fuse_arena_rewind(contexthdr, ArenaMark);
 
     return Result;
 }
@@ -1974,6 +2187,7 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
     }
 
     err = f->ops.rename(PosixHiddenPath, filedesc->PosixPath);
+    fsp_fuse_intf_InvalidateAttr(filedesc);
     if (0 != err)
     {
         /* on failure unlink "hidden" symlink */
@@ -31,6 +31,16 @@
 
 #define FSP_FUSE_HAS_SYMLINKS(f)        (0 != (f)->ops.readlink)
 
+#define FSP_FUSE_CONTEXT_SIZE           \
+    FSP_FSCTL_ALIGN_UP(sizeof(struct fuse_context), MEMORY_ALLOCATION_ALIGNMENT)
+#define FSP_FUSE_ARENA_SIZE             (16 * 1024)
+
+#define FSP_FUSE_ATTR_NODE_BUCKET_COUNT 64
+
+#define FSP_FUSE_DIRINFO_PREFETCH_THREAD_COUNT_DEFAULT 8
+#define FSP_FUSE_DIRINFO_PREFETCH_THREAD_COUNT_MAX 64
+#define FSP_FUSE_DIRINFO_PREFETCH_ENTRIES_PER_THREAD 32
+
 struct fuse
 {
     struct fsp_fuse_env *env;
@@ -47,15 +57,46 @@ struct fuse
     FSP_FSCTL_VOLUME_PARAMS VolumeParams;
     UINT16 VolumeLabelLength;
     WCHAR VolumeLabel[sizeof ((FSP_FSCTL_VOLUME_INFO *)0)->VolumeLabel / sizeof(WCHAR)];
+    unsigned ThreadCountMin, ThreadCountMax, ThreadIdleTimeout;
+    UINT32 AttrTimeout;
+    unsigned DirPrefetchThreadCount;
+    unsigned DirCacheCapacity, DirCacheTimeout;
     PWSTR MountPoint;
     FSP_FILE_SYSTEM *FileSystem;
     FSP_SERVICE *Service; /* weak */
     volatile int exited;
+    /* path arena metrics */
+    volatile LONG ArenaHighWater, ArenaOverflowCount;
+    /* attribute nodes of the open paths; see fuse_intf.c */
+    SRWLOCK AttrNodeLock;
+    struct fsp_fuse_attr_node *AttrNodeBuckets[FSP_FUSE_ATTR_NODE_BUCKET_COUNT];
+};
+
+struct fsp_fuse_attr_node
+{
+    struct fsp_fuse_attr_node *Next;
+    ULONG Hash;
+    LONG RefCount;
+    /* bumped on every change to the attributes of this path */
+    volatile LONG Generation;
+    /* current key; PosixPathBuf until a rename, 0 once orphaned; see fuse_attr.c */
+    char *PosixPath;
+    char PosixPathBuf[];
+};
+
+struct fsp_fuse_arena_block
+{
+    struct fsp_fuse_arena_block *Next;
+    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 Buffer[];
 };
 
 struct fsp_fuse_context_header
 {
     char *PosixPath;
+    /* per-thread bump arena; follows the fuse_context and is reset by fsp_fuse_op_leave */
+    PUINT8 Arena;
+    ULONG ArenaSize, ArenaUsed, ArenaPeak, ArenaOverflowSize;
+    struct fsp_fuse_arena_block *ArenaOverflow;
     __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 ContextBuf[];
 };
 
@@ -66,6 +107,12 @@ struct fsp_fuse_file_desc
     int OpenFlags;
     UINT64 FileHandle;
     PVOID DirBuffer;
+    /* cached getattr result; valid until AttrExpiration or until AttrNode->Generation changes */
+    struct fsp_fuse_attr_node *AttrNode;
+    LONG AttrGeneration;
+    UINT64 AttrExpiration;
+    FSP_FSCTL_FILE_INFO AttrFileInfo;
+    char PosixPathBuf[];
 };
 
 struct fuse_dirhandle
@@ -86,6 +133,20 @@ NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
 
 extern FSP_FILE_SYSTEM_INTERFACE fsp_fuse_intf;
 
+void *fsp_fuse_arena_alloc(struct fsp_fuse_context_header *contexthdr, ULONG Size);
+VOID fsp_fuse_arena_rewind(struct fsp_fuse_context_header *contexthdr, ULONG Mark);
+VOID fsp_fuse_arena_reset(struct fuse *f, struct fsp_fuse_context_header *contexthdr);
+NTSTATUS fsp_fuse_arena_posix_path(struct fsp_fuse_context_header *contexthdr,
+    PWSTR FileName, char **PPosixPath);
+NTSTATUS fsp_fuse_arena_windows_path(struct fsp_fuse_context_header *contexthdr,
+    const char *PosixPath, PWSTR *PWindowsPath);
+
+struct fsp_fuse_attr_node *fsp_fuse_attr_reference(struct fuse *f, const char *PosixPath);
+VOID fsp_fuse_attr_dereference(struct fuse *f, struct fsp_fuse_attr_node *AttrNode);
+VOID fsp_fuse_attr_invalidate(struct fuse *f, const char *PosixPath);
+VOID fsp_fuse_attr_rename(struct fuse *f, struct fsp_fuse_attr_node *RenameNode,
+    const char *NewPosixPath);
+
 NTSTATUS fsp_fuse_get_token_uidgid(
     HANDLE Token,
     TOKEN_INFORMATION_CLASS UserOrOwnerClass, /* TokenUser|TokenOwner */
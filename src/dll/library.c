@@ -48,6 +48,7 @@ BOOL WINAPI DllMain(HINSTANCE Instance, DWORD Reason, PVOID Reserved)
 
     case DLL_THREAD_DETACH:
         fsp_fuse_finalize_thread();
+        FspDebugTraceFinalizeThread();
         break;
     }
 
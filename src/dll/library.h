@@ -22,6 +22,7 @@
 #include <winfsp/winfsp.h>
 #include <shared/minimal.h>
 #include <strsafe.h>
+#include <dll/cache.h>
 
 #define LIBRARY_NAME                    "WinFsp"
 
@@ -41,6 +42,7 @@ VOID FspEventLogFinalize(BOOLEAN Dynamic);
 VOID FspServiceFinalize(BOOLEAN Dynamic);
 VOID fsp_fuse_finalize(BOOLEAN Dynamic);
 VOID fsp_fuse_finalize_thread(VOID);
+VOID FspDebugTraceFinalizeThread(VOID);
 
 NTSTATUS FspFsctlRegister(VOID);
 NTSTATUS FspFsctlUnregister(VOID);
@@ -54,6 +56,11 @@ PWSTR FspDiagIdent(VOID);
 VOID FspFileSystemPeekInDirectoryBuffer(PVOID *PDirBuffer,
     PUINT8 *PBuffer, PULONG *PIndex, PULONG PCount);
 
+VOID FspFileSystemDeleteAccessCheckCache(FSP_FILE_SYSTEM *FileSystem);
+VOID FspFileSystemDeleteDirectoryCache(FSP_FILE_SYSTEM *FileSystem);
+VOID FspFileSystemInvalidateDirectoryCacheParent(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName);
+
 BOOL WINAPI FspServiceConsoleCtrlHandler(DWORD CtrlType);
 
 static inline ULONG FspPathSuffixIndex(PWSTR FileName)
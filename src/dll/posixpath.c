@@ -0,0 +1,469 @@
+/**
+ * @file dll/posixpath.c
+ * POSIX Interop: path mapping.
+ *
+ * This file provides the Windows/POSIX path mapping routines. See dll/posix.c for
+ * the SID and permission mapping routines.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <dll/library.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FspPosixPathSse2                1
+#else
+#define FspPosixPathSse2                0
+#endif
+
+/*
+ * Services for Macintosh and Cygwin compatible filename transformation:
+ * Transform characters invalid for Windows filenames to the Unicode
+ * private use area in the U+F0XX range.
+ *
+ * The invalid maps are produced by the following Python script:
+ *     reserved = ['<', '>', ':', '"', '\\', '|', '?', '*']
+ *     l = [str(int(0 < i < 32 or chr(i) in reserved)) for i in xrange(0, 128)]
+ *     print "0x%08x" % int("".join(l[0:32]), 2)
+ *     print "0x%08x" % int("".join(l[32:64]), 2)
+ *     print "0x%08x" % int("".join(l[64:96]), 2)
+ *     print "0x%08x" % int("".join(l[96:128]), 2)
+ */
+static UINT32 FspPosixInvalidPathChars[4] =
+{
+    0x7fffffff,
+    0x2020002b,
+    0x00000008,
+    0x00000008,
+};
+
+/*
+ * Single pass UTF-16 <-> UTF-8 path transcoding.
+ *
+ * The following routines fuse UTF-16/UTF-8 conversion with the separator translation
+ * and private use area encoding/decoding above. Runs of ASCII characters are converted
+ * 16 characters at a time using SSE2 (where available); other characters are converted
+ * one at a time. Unpaired surrogates and invalid UTF-8 sequences are replaced with
+ * U+FFFD, which matches WideCharToMultiByte and MultiByteToWideChar.
+ *
+ * The conversion routines do not check the size of their output buffer; the caller
+ * must guarantee that it is large enough (3 bytes per UTF-16 code unit for UTF-8
+ * output; 1 UTF-16 code unit per byte for UTF-16 output) or compute the exact size
+ * using the corresponding size routine first.
+ */
+static inline BOOLEAN FspPosixIsInvalidPathChar(UINT32 c)
+{
+    return 128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f)));
+}
+
+#if FspPosixPathSse2
+static inline BOOLEAN FspPosixPathIsAscii16(const WCHAR *p)
+{
+    __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 8));
+    __m128i m = _mm_set1_epi16((short)0xff80);
+    return 0xffff == _mm_movemask_epi8(
+        _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(v0, v1), m), _mm_setzero_si128()));
+}
+#endif
+
+static ULONG FspPosixWindowsToPosixPathSize(const WCHAR *WindowsPath, ULONG Length,
+    BOOLEAN Translate)
+{
+    const WCHAR *p = WindowsPath, *endp = p + Length;
+    ULONG Size = 0;
+    WCHAR c;
+
+    while (endp > p)
+    {
+#if FspPosixPathSse2
+        if (16 <= endp - p && FspPosixPathIsAscii16(p))
+        {
+            p += 16, Size += 16;
+            continue;
+        }
+#endif
+        c = *p++;
+        if (0x80 > c)
+            Size += 1;
+        else if (0x800 > c)
+            Size += 2;
+        else if (0xd800 <= c && c <= 0xdbff && endp > p && 0xdc00 <= *p && *p <= 0xdfff)
+            p++, Size += 4;
+        else if (Translate && 0xf000 <= c && c <= 0xf07f && FspPosixIsInvalidPathChar(c & 0x7f))
+            Size += 1;
+        else
+            Size += 3;
+    }
+
+    return Size;
+}
+
+static ULONG FspPosixWindowsToPosixPathCopy(const WCHAR *WindowsPath, ULONG Length,
+    char *PosixPath, BOOLEAN Translate)
+{
+    const WCHAR *p = WindowsPath, *endp = p + Length;
+    unsigned char *q = (unsigned char *)PosixPath;
+    UINT32 c, c2;
+
+    while (endp > p)
+    {
+#if FspPosixPathSse2
+        if (16 <= endp - p && FspPosixPathIsAscii16(p))
+        {
+            __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+            __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 8));
+            __m128i v = _mm_packus_epi16(v0, v1);
+            if (Translate)
+            {
+                /* '\\' -> '/' */
+                __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+                v = _mm_xor_si128(v, _mm_and_si128(m, _mm_set1_epi8('\\' ^ '/')));
+            }
+            _mm_storeu_si128((__m128i *)q, v);
+            p += 16, q += 16;
+            continue;
+        }
+#endif
+        c = *p++;
+        if (0x80 > c)
+            *q++ = (unsigned char)(Translate && '\\' == c ? '/' : c);
+        else if (0x800 > c)
+        {
+            *q++ = (unsigned char)(0xc0 | (c >> 6));
+            *q++ = (unsigned char)(0x80 | (c & 0x3f));
+        }
+        else if (0xd800 <= c && c <= 0xdfff)
+        {
+            if (c <= 0xdbff && endp > p && 0xdc00 <= (c2 = *p) && c2 <= 0xdfff)
+            {
+                p++;
+                c = 0x10000 + (((c - 0xd800) << 10) | (c2 - 0xdc00));
+                *q++ = (unsigned char)(0xf0 | (c >> 18));
+                *q++ = (unsigned char)(0x80 | ((c >> 12) & 0x3f));
+                *q++ = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+                *q++ = (unsigned char)(0x80 | (c & 0x3f));
+            }
+            else
+            {
+                /* unpaired surrogate: U+FFFD */
+                *q++ = 0xef, *q++ = 0xbf, *q++ = 0xbd;
+            }
+        }
+        /* encode characters in the Unicode private use area: U+F0XX -> XX */
+        else if (Translate && 0xf000 <= c && c <= 0xf07f && FspPosixIsInvalidPathChar(c & 0x7f))
+            *q++ = (unsigned char)(c & 0x7f);
+        else
+        {
+            *q++ = (unsigned char)(0xe0 | (c >> 12));
+            *q++ = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+            *q++ = (unsigned char)(0x80 | (c & 0x3f));
+        }
+    }
+
+    return (ULONG)((char *)q - PosixPath);
+}
+
+static inline ULONG FspPosixDecodeUtf8(const unsigned char *p, const unsigned char *endp,
+    PUINT32 PChar)
+{
+    /*
+     * Decode a single UTF-8 sequence and return its length. Invalid sequences decode to
+     * U+FFFD; their length is that of the maximal subpart of a valid sequence (at least 1).
+     */
+    UINT32 c = p[0], lo = 0x80, hi = 0xbf;
+    ULONG Length, I;
+
+    if (0xc2 <= c && c <= 0xdf)
+        Length = 2, c &= 0x1f;
+    else if (0xe0 <= c && c <= 0xef)
+    {
+        Length = 3, c &= 0x0f;
+        if (0x0 == c)
+            lo = 0xa0;      /* no overlongs */
+        else if (0xd == c)
+            hi = 0x9f;      /* no surrogates */
+    }
+    else if (0xf0 <= c && c <= 0xf4)
+    {
+        Length = 4, c &= 0x07;
+        if (0x0 == c)
+            lo = 0x90;      /* no overlongs */
+        else if (0x4 == c)
+            hi = 0x8f;      /* no code points above U+10FFFF */
+    }
+    else
+    {
+        *PChar = 0xfffd;
+        return 1;
+    }
+
+    for (I = 1; Length > I; I++)
+    {
+        if (endp <= p + I || lo > p[I] || p[I] > hi)
+        {
+            *PChar = 0xfffd;
+            return I;
+        }
+        c = (c << 6) | (p[I] & 0x3f);
+        lo = 0x80, hi = 0xbf;
+    }
+
+    *PChar = c;
+    return Length;
+}
+
+#if FspPosixPathSse2
+static inline BOOLEAN FspPosixPathIsAscii16A(const char *p)
+{
+    return 0 == _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+}
+#endif
+
+static ULONG FspPosixPosixToWindowsPathSize(const char *PosixPath, ULONG Length)
+{
+    const unsigned char *p = (const unsigned char *)PosixPath, *endp = p + Length;
+    ULONG Size = 0;
+    UINT32 c;
+
+    while (endp > p)
+    {
+#if FspPosixPathSse2
+        if (16 <= endp - p && FspPosixPathIsAscii16A((const char *)p))
+        {
+            p += 16, Size += 16;
+            continue;
+        }
+#endif
+        if (0x80 > *p)
+        {
+            p++, Size++;
+            continue;
+        }
+        p += FspPosixDecodeUtf8(p, endp, &c);
+        Size += 0x10000 <= c ? 2 : 1;
+    }
+
+    return Size;
+}
+
+static ULONG FspPosixPosixToWindowsPathCopy(const char *PosixPath, ULONG Length,
+    PWSTR WindowsPath, BOOLEAN Translate)
+{
+    const unsigned char *p = (const unsigned char *)PosixPath, *endp = p + Length;
+    WCHAR *q = WindowsPath;
+    UINT32 c;
+
+    while (endp > p)
+    {
+#if FspPosixPathSse2
+        if (16 <= endp - p && FspPosixPathIsAscii16A((const char *)p))
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            __m128i z = _mm_setzero_si128();
+            __m128i lo, hi;
+            if (Translate)
+            {
+                /* characters invalid for Windows -> U+F0XX (see FspPosixInvalidPathChars) */
+                __m128i m = _mm_cmplt_epi8(v, _mm_set1_epi8(32));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+                m = _mm_andnot_si128(_mm_cmpeq_epi8(v, z), m);
+                /* '/' -> '\\' */
+                v = _mm_xor_si128(v,
+                    _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), _mm_set1_epi8('/' ^ '\\')));
+                lo = _mm_or_si128(_mm_unpacklo_epi8(v, z),
+                    _mm_and_si128(_mm_unpacklo_epi8(m, m), _mm_set1_epi16((short)0xf000)));
+                hi = _mm_or_si128(_mm_unpackhi_epi8(v, z),
+                    _mm_and_si128(_mm_unpackhi_epi8(m, m), _mm_set1_epi16((short)0xf000)));
+            }
+            else
+            {
+                lo = _mm_unpacklo_epi8(v, z);
+                hi = _mm_unpackhi_epi8(v, z);
+            }
+            _mm_storeu_si128((__m128i *)q, lo);
+            _mm_storeu_si128((__m128i *)(q + 8), hi);
+            p += 16, q += 16;
+            continue;
+        }
+#endif
+        c = *p;
+        if (0x80 > c)
+        {
+            p++;
+            if (Translate)
+            {
+                if ('/' == c)
+                    c = L'\\';
+                else if (FspPosixIsInvalidPathChar(c))
+                    c |= 0xf000;
+            }
+            *q++ = (WCHAR)c;
+            continue;
+        }
+        p += FspPosixDecodeUtf8(p, endp, &c);
+        if (0x10000 <= c)
+        {
+            c -= 0x10000;
+            *q++ = (WCHAR)(0xd800 | (c >> 10));
+            *q++ = (WCHAR)(0xdc00 | (c & 0x3ff));
+        }
+        else
+            *q++ = (WCHAR)c;
+    }
+
+    return (ULONG)(q - WindowsPath);
+}
+
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPathEx(PWSTR WindowsPath, char **PPosixPath,
+    BOOLEAN Translate)
+{
+    ULONG Length, Size;
+    char *PosixPath;
+
+    *PPosixPath = 0;
+
+    Length = lstrlenW(WindowsPath);
+    if ((MAXULONG - 1) / 3 < Length)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* allocate for the worst case (3 bytes per UTF-16 code unit) to convert in a single pass */
+    PosixPath = MemAlloc(Length * 3 + 1);
+    if (0 == PosixPath)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Size = FspPosixWindowsToPosixPathCopy(WindowsPath, Length, PosixPath, Translate);
+    PosixPath[Size] = '\0';
+
+    *PPosixPath = PosixPath;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR *PWindowsPath,
+    BOOLEAN Translate)
+{
+    ULONG Length, Size;
+    PWSTR WindowsPath;
+
+    *PWindowsPath = 0;
+
+    Length = lstrlenA(PosixPath);
+    if (MAXULONG / sizeof(WCHAR) - 1 < Length)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* allocate for the worst case (1 UTF-16 code unit per byte) to convert in a single pass */
+    WindowsPath = MemAlloc((Length + 1) * sizeof(WCHAR));
+    if (0 == WindowsPath)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Size = FspPosixPosixToWindowsPathCopy(PosixPath, Length, WindowsPath, Translate);
+    WindowsPath[Size] = L'\0';
+
+    *PWindowsPath = WindowsPath;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPathBuffer(PWSTR WindowsPath,
+    char *PosixPath, PULONG PSize, BOOLEAN Translate)
+{
+    ULONG Length, Size;
+
+    Length = lstrlenW(WindowsPath);
+
+    /* skip sizing when the buffer can hold the worst case */
+    if ((MAXULONG - 1) / 3 < Length || *PSize < Length * 3 + 1)
+    {
+        Size = FspPosixWindowsToPosixPathSize(WindowsPath, Length, Translate) + 1;
+        if (*PSize < Size)
+        {
+            *PSize = Size;
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+    }
+
+    Size = FspPosixWindowsToPosixPathCopy(WindowsPath, Length, PosixPath, Translate);
+    PosixPath[Size] = '\0';
+
+    *PSize = Size + 1;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspPosixMapPosixToWindowsPathBuffer(const char *PosixPath,
+    PWSTR WindowsPath, PULONG PSize, BOOLEAN Translate)
+{
+    ULONG Length, Size;
+
+    Length = lstrlenA(PosixPath);
+
+    /* skip sizing when the buffer can hold the worst case */
+    if (MAXULONG / sizeof(WCHAR) - 1 < Length || *PSize < (Length + 1) * sizeof(WCHAR))
+    {
+        Size = (FspPosixPosixToWindowsPathSize(PosixPath, Length) + 1) * sizeof(WCHAR);
+        if (*PSize < Size)
+        {
+            *PSize = Size;
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+    }
+
+    Size = FspPosixPosixToWindowsPathCopy(PosixPath, Length, WindowsPath, Translate);
+    WindowsPath[Size] = L'\0';
+
+    *PSize = (Size + 1) * sizeof(WCHAR);
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API VOID FspPosixDeletePath(void *Path)
+{
+    MemFree(Path);
+}
+
+FSP_API VOID FspPosixEncodeWindowsPath(PWSTR WindowsPath, ULONG Size)
+{
+    for (PWSTR p = WindowsPath, endp = p + Size; endp > p; p++)
+    {
+        WCHAR c = *p;
+
+        if (L'\\' == c)
+            *p = L'/';
+        /* encode characters in the Unicode private use area: U+F0XX -> XX */
+        else if (0xf000 <= c && c <= 0xf0ff)
+            *p &= ~0xf000;
+    }
+}
+
+FSP_API VOID FspPosixDecodeWindowsPath(PWSTR WindowsPath, ULONG Size)
+{
+    for (PWSTR p = WindowsPath, endp = p + Size; endp > p; p++)
+    {
+        WCHAR c = *p;
+
+        if (L'/' == c)
+            *p = L'\\';
+        else if (128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
+            *p |= 0xf000;
+    }
+}
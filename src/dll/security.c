@@ -48,6 +48,271 @@ static NTSTATUS FspGetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
     }
 }
 
+enum
+{
+    FspAccessCheckCacheCapacityMin = 16,
+    FspAccessCheckCacheCapacityMax = 65536,
+    FspAccessCheckCacheTimeoutDefault = 1000,
+};
+
+typedef struct
+{
+    UINT32 Hash;
+    BOOLEAN CaseSensitive;
+    LUID TokenId, ModifiedId;
+    UINT32 DesiredAccess, GrantedAccess;
+    UINT64 ExpirationTime;              /* GetTickCount64 */
+    ULONG FileNameLength;               /* in WCHAR's; 0 if the entry is unused */
+    PWSTR FileName;
+} FSP_ACCESS_CHECK_CACHE_ENTRY;
+
+typedef struct
+{
+    SRWLOCK Lock;
+    ULONG Capacity;                     /* power of 2 */
+    ULONG Timeout;
+    ULONG Count;
+    UINT64 Generation;
+    volatile LONG64 HitCount, MissCount, InsertCount, InvalidateCount;
+    FSP_ACCESS_CHECK_CACHE_ENTRY Entries[];
+} FSP_ACCESS_CHECK_CACHE;
+
+static inline UINT32 FspAccessCheckCacheHash(PWSTR FileName, ULONG FileNameLength,
+    PTOKEN_STATISTICS AccessTokenStatistics)
+{
+    UINT32 Hash = FspCacheHashFileName(FileName, FileNameLength);
+
+    Hash ^= (UINT32)AccessTokenStatistics->TokenId.LowPart * 0x9e3779b1;
+    Hash ^= Hash >> 16;
+
+    return Hash;
+}
+
+static inline VOID FspAccessCheckCacheRemoveEntry(FSP_ACCESS_CHECK_CACHE *Cache,
+    FSP_ACCESS_CHECK_CACHE_ENTRY *Entry)
+{
+    MemFree(Entry->FileName);
+    Entry->FileName = 0;
+    Entry->FileNameLength = 0;
+    Cache->Count--;
+}
+
+static BOOLEAN FspAccessCheckCacheLookup(FSP_ACCESS_CHECK_CACHE *Cache,
+    PWSTR FileName, ULONG FileNameLength, BOOLEAN CaseSensitive,
+    PTOKEN_STATISTICS AccessTokenStatistics, UINT32 DesiredAccess,
+    PUINT32 PGrantedAccess, PUINT64 PExpirationTime)
+{
+    UINT32 Hash = FspAccessCheckCacheHash(FileName, FileNameLength, AccessTokenStatistics);
+    FSP_ACCESS_CHECK_CACHE_ENTRY *Entry = &Cache->Entries[FspCacheSlot(Hash, Cache->Capacity)];
+    BOOLEAN Result = FALSE;
+
+    AcquireSRWLockShared(&Cache->Lock);
+    if (0 != Entry->FileNameLength &&
+        Hash == Entry->Hash &&
+        DesiredAccess == Entry->DesiredAccess &&
+        AccessTokenStatistics->TokenId.LowPart == Entry->TokenId.LowPart &&
+        AccessTokenStatistics->TokenId.HighPart == Entry->TokenId.HighPart &&
+        AccessTokenStatistics->ModifiedId.LowPart == Entry->ModifiedId.LowPart &&
+        AccessTokenStatistics->ModifiedId.HighPart == Entry->ModifiedId.HighPart &&
+        GetTickCount64() < Entry->ExpirationTime &&
+        FspCacheFileNameEqual(
+            Entry->FileName, Entry->FileNameLength, FileName, FileNameLength,
+            CaseSensitive || Entry->CaseSensitive))
+    {
+        *PGrantedAccess = Entry->GrantedAccess;
+        *PExpirationTime = Entry->ExpirationTime;
+        Result = TRUE;
+    }
+    ReleaseSRWLockShared(&Cache->Lock);
+
+    InterlockedIncrement64(Result ? &Cache->HitCount : &Cache->MissCount);
+
+    return Result;
+}
+
+static VOID FspAccessCheckCacheInsert(FSP_ACCESS_CHECK_CACHE *Cache, UINT64 Generation,
+    PWSTR FileName, ULONG FileNameLength, BOOLEAN CaseSensitive,
+    PTOKEN_STATISTICS AccessTokenStatistics, UINT32 DesiredAccess,
+    UINT32 GrantedAccess, UINT64 ExpirationTime)
+{
+    UINT32 Hash = FspAccessCheckCacheHash(FileName, FileNameLength, AccessTokenStatistics);
+    FSP_ACCESS_CHECK_CACHE_ENTRY *Entry = &Cache->Entries[FspCacheSlot(Hash, Cache->Capacity)];
+    PWSTR FileNameCopy;
+
+    FileNameCopy = MemAlloc(FileNameLength * sizeof(WCHAR));
+    if (0 == FileNameCopy)
+        return;
+    memcpy(FileNameCopy, FileName, FileNameLength * sizeof(WCHAR));
+
+    AcquireSRWLockExclusive(&Cache->Lock);
+    if (Generation != Cache->Generation)
+    {
+        /* the cache was invalidated while we were checking access; do not insert stale data */
+        ReleaseSRWLockExclusive(&Cache->Lock);
+        MemFree(FileNameCopy);
+        return;
+    }
+    if (0 != Entry->FileNameLength)
+        FspAccessCheckCacheRemoveEntry(Cache, Entry);
+    Entry->Hash = Hash;
+    Entry->CaseSensitive = CaseSensitive;
+    Entry->TokenId = AccessTokenStatistics->TokenId;
+    Entry->ModifiedId = AccessTokenStatistics->ModifiedId;
+    Entry->DesiredAccess = DesiredAccess;
+    Entry->GrantedAccess = GrantedAccess;
+    Entry->ExpirationTime = ExpirationTime;
+    Entry->FileNameLength = FileNameLength;
+    Entry->FileName = FileNameCopy;
+    Cache->Count++;
+    ReleaseSRWLockExclusive(&Cache->Lock);
+
+    InterlockedIncrement64(&Cache->InsertCount);
+}
+
+static PWSTR FspAccessCheckCacheTraverse(FSP_ACCESS_CHECK_CACHE *Cache,
+    PWSTR FileName, BOOLEAN CaseSensitive, PTOKEN_STATISTICS AccessTokenStatistics,
+    PUINT64 PExpirationTime)
+{
+    /*
+     * Find the deepest directory in the path of FileName for which traverse access is cached
+     * and return a pointer past it. A cached entry implies that all the directories above it
+     * were also traversable when it was inserted, because entries are only inserted while
+     * walking the path from the root and invalidating a directory invalidates all the entries
+     * under it.
+     */
+    PWSTR End, Remain;
+    UINT32 GrantedAccess;
+
+    for (End = FileName; L'\0' != *End && L':' != *End; End++)
+        ;
+
+    for (Remain = End - 1; FileName <= Remain; Remain--)
+    {
+        if (L'\\' != *Remain || (Remain > FileName && L'\\' == Remain[-1]))
+            continue;
+
+        if (FspAccessCheckCacheLookup(Cache,
+            Remain > FileName ? FileName : L"\\",
+            Remain > FileName ? (ULONG)(Remain - FileName) : 1,
+            CaseSensitive, AccessTokenStatistics, FILE_TRAVERSE, &GrantedAccess, PExpirationTime))
+        {
+            do
+            {
+                Remain++;
+            } while (L'\\' == *Remain);
+            return Remain;
+        }
+    }
+
+    return FileName;
+}
+
+static VOID FspAccessCheckCacheInvalidate(FSP_ACCESS_CHECK_CACHE *Cache,
+    PWSTR FileName)
+{
+    FSP_ACCESS_CHECK_CACHE_ENTRY *Entry;
+    ULONG FileNameLength;
+    BOOLEAN Root;
+
+    InterlockedIncrement64(&Cache->InvalidateCount);
+
+    Root = 0 == FileName || (L'\\' == FileName[0] && L'\0' == FileName[1]);
+    FileNameLength = !Root ? lstrlenW(FileName) : 0;
+
+    AcquireSRWLockExclusive(&Cache->Lock);
+    Cache->Generation++;
+    if (0 != Cache->Count)
+        for (ULONG I = 0; Cache->Capacity > I; I++)
+        {
+            Entry = &Cache->Entries[I];
+            if (0 == Entry->FileNameLength)
+                continue;
+
+            /* invalidate the entry if it is FileName or is under FileName (case-insensitive) */
+            if (Root ||
+                (
+                    FileNameLength <= Entry->FileNameLength &&
+                    (FileNameLength == Entry->FileNameLength ||
+                        L'\\' == Entry->FileName[FileNameLength]) &&
+                    CSTR_EQUAL == CompareStringOrdinal(
+                        Entry->FileName, FileNameLength, FileName, FileNameLength, TRUE)
+                ))
+                FspAccessCheckCacheRemoveEntry(Cache, Entry);
+        }
+    ReleaseSRWLockExclusive(&Cache->Lock);
+}
+
+FSP_API NTSTATUS FspFileSystemSetAccessCheckCache(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Capacity, ULONG Timeout)
+{
+    FSP_ACCESS_CHECK_CACHE *Cache = 0;
+    ULONG CacheCapacity;
+
+    if (0 != FileSystem->DispatcherThread)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    if (0 != Capacity)
+    {
+        CacheCapacity = FspCacheCapacity(Capacity,
+            FspAccessCheckCacheCapacityMin, FspAccessCheckCacheCapacityMax);
+
+        Cache = MemAlloc(sizeof *Cache + CacheCapacity * sizeof Cache->Entries[0]);
+        if (0 == Cache)
+            return STATUS_INSUFFICIENT_RESOURCES;
+        memset(Cache, 0, sizeof *Cache + CacheCapacity * sizeof Cache->Entries[0]);
+
+        InitializeSRWLock(&Cache->Lock);
+        Cache->Capacity = CacheCapacity;
+        Cache->Timeout = 0 != Timeout ? Timeout : FspAccessCheckCacheTimeoutDefault;
+    }
+
+    FspFileSystemDeleteAccessCheckCache(FileSystem);
+    FileSystem->AccessCheckCache = Cache;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API VOID FspFileSystemInvalidateAccessCheckCache(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName)
+{
+    if (0 != FileSystem->AccessCheckCache)
+        FspAccessCheckCacheInvalidate(FileSystem->AccessCheckCache, FileName);
+}
+
+FSP_API NTSTATUS FspFileSystemGetAccessCheckCacheStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_ACCESS_CHECK_CACHE_STATISTICS *Statistics)
+{
+    FSP_ACCESS_CHECK_CACHE *Cache = FileSystem->AccessCheckCache;
+
+    if (0 == Cache)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    AcquireSRWLockShared(&Cache->Lock);
+    Statistics->Capacity = Cache->Capacity;
+    Statistics->Count = Cache->Count;
+    ReleaseSRWLockShared(&Cache->Lock);
+    Statistics->HitCount = Cache->HitCount;
+    Statistics->MissCount = Cache->MissCount;
+    Statistics->InsertCount = Cache->InsertCount;
+    Statistics->InvalidateCount = Cache->InvalidateCount;
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspFileSystemDeleteAccessCheckCache(FSP_FILE_SYSTEM *FileSystem)
+{
+    FSP_ACCESS_CHECK_CACHE *Cache = FileSystem->AccessCheckCache;
+
+    if (0 == Cache)
+        return;
+
+    for (ULONG I = 0; Cache->Capacity > I; I++)
+        MemFree(Cache->Entries[I].FileName);
+    MemFree(Cache);
+
+    FileSystem->AccessCheckCache = 0;
+}
+
 FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request,
     BOOLEAN CheckParentOrMain, BOOLEAN AllowTraverseCheck,
@@ -96,6 +361,11 @@ FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
     UINT32 TraverseAccess, ParentAccess, DesiredAccess2;
     UINT16 NamedStreamSave;
     BOOL AccessStatus;
+    FSP_ACCESS_CHECK_CACHE *Cache = 0;
+    TOKEN_STATISTICS AccessTokenStatistics;
+    DWORD AccessTokenStatisticsLength;
+    UINT64 CacheGeneration = 0, CacheExpirationTime = 0;
+    ULONG PrefixLength;
 
     if (CheckParentDirectory)
         FspPathSuffix((PWSTR)Request->Buffer, &FileName, &Suffix, Root);
@@ -120,6 +390,25 @@ FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
         !(L'\\' == FileName[0] && L'\0' == FileName[1])/* no need to traverse check for root */)
     {
         Remain = FileName;
+
+        if (0 != FileSystem->AccessCheckCache &&
+            GetTokenInformation(
+                FSP_FSCTL_TRANSACT_REQ_TOKEN_HANDLE(Request->Req.Create.AccessToken),
+                TokenStatistics, &AccessTokenStatistics, sizeof AccessTokenStatistics,
+                &AccessTokenStatisticsLength))
+        {
+            Cache = FileSystem->AccessCheckCache;
+
+            AcquireSRWLockShared(&Cache->Lock);
+            CacheGeneration = Cache->Generation;
+            ReleaseSRWLockShared(&Cache->Lock);
+
+            CacheExpirationTime = GetTickCount64() + Cache->Timeout;
+            Remain = FspAccessCheckCacheTraverse(Cache,
+                FileName, Request->Req.Create.CaseSensitive, &AccessTokenStatistics,
+                &CacheExpirationTime);
+        }
+
         for (;;)
         {
             while (L'\\' != *Remain)
@@ -131,6 +420,7 @@ FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
 
             *Remain = L'\0';
             Prefix = Remain > FileName ? FileName : TraverseCheckRoot;
+            PrefixLength = Remain > FileName ? (ULONG)(Remain - FileName) : 1;
 
             FileAttributes = 0;
             Result = FspGetSecurityByName(FileSystem, Prefix, &FileAttributes,
@@ -184,6 +474,13 @@ FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
                 if (!NT_SUCCESS(Result))
                     goto exit;
             }
+            else
+                TraverseAccess = FILE_TRAVERSE;
+
+            if (0 != Cache)
+                FspAccessCheckCacheInsert(Cache, CacheGeneration,
+                    Prefix, PrefixLength, Request->Req.Create.CaseSensitive, &AccessTokenStatistics,
+                    FILE_TRAVERSE, TraverseAccess, CacheExpirationTime);
         }
     traverse_check_done:
         ;
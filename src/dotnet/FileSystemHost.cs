@@ -36,6 +36,7 @@ namespace Fsp
         /// <param name="FileSystem">The file system to host.</param>
         public FileSystemHost(FileSystemBase FileSystem)
         {
+            _VolumeParams.Version = (UInt16)Marshal.SizeOf(_VolumeParams);
             _VolumeParams.Flags = VolumeParams.UmFileContextIsFullContext;
             _FileSystem = FileSystem;
         }
@@ -189,6 +190,16 @@ namespace Fsp
             get { return 0 != (_VolumeParams.Flags & VolumeParams.PassQueryDirectoryPattern); }
             set { _VolumeParams.Flags |= (value ? VolumeParams.PassQueryDirectoryPattern : 0); }
         }
+        public Boolean BatchCloseRequests
+        {
+            get { return 0 != (_VolumeParams.Flags & VolumeParams.BatchCloseRequests); }
+            set { _VolumeParams.Flags |= (value ? VolumeParams.BatchCloseRequests : 0); }
+        }
+        public Boolean DelayCloseRequests
+        {
+            get { return 0 != (_VolumeParams.Flags & VolumeParams.DelayCloseRequests); }
+            set { _VolumeParams.Flags |= (value ? VolumeParams.DelayCloseRequests : 0); }
+        }
         /// <summary>
         /// Gets or sets the prefix for a network file system.
         /// </summary>
@@ -42,6 +42,8 @@ namespace Fsp.Interop
         internal const UInt32 PostCleanupWhenModifiedOnly = 0x00000400;
         internal const UInt32 PassQueryDirectoryPattern = 0x00000800;
         internal const UInt32 AlwaysUseDoubleBuffering = 0x00001000;
+        internal const UInt32 BatchCloseRequests = 0x00002000;
+        internal const UInt32 DelayCloseRequests = 0x00004000;
         internal const UInt32 UmFileContextIsUserContext2 = 0x00010000;
         internal const UInt32 UmFileContextIsFullContext = 0x00020000;
         internal const int PrefixSize = 192;
@@ -60,6 +62,11 @@ namespace Fsp.Interop
         internal UInt32 Flags;
         internal unsafe fixed UInt16 Prefix[PrefixSize];
         internal unsafe fixed UInt16 FileSystemName[FileSystemNameSize];
+        internal UInt32 SecurityCacheCapacity;
+        internal UInt32 DirInfoCacheCapacity;
+        internal UInt32 StreamInfoCacheCapacity;
+        internal UInt32 DirInfoCacheSizeMax;
+        internal UInt32 NegativeNameCacheCapacity;
 
         internal unsafe String GetPrefix()
         {
@@ -91,7 +91,8 @@ static void usage(void)
         //"    list                            list running file system processes\n"
         //"    kill                            kill file system process\n"
         "    id [NAME|SID|UID]               print user id\n"
-        "    perm [PATH|SDDL|UID:GID:MODE]   print permissions\n",
+        "    perm [PATH|SDDL|UID:GID:MODE]   print permissions\n"
+        "    trace FILE                      print binary debug trace\n",
         PROGNAME);
 }
 
@@ -567,6 +568,193 @@ static int perm(int argc, wchar_t **argv)
     return FspWin32FromNtStatus(Result);
 }
 
+#define trace_uint64_pair(v)            (UINT32)((v) >> 32), (UINT32)(v)
+
+static UINT64 trace_divmod(UINT64 Dividend, UINT64 Divisor, PUINT64 PRemainder)
+{
+    /* restoring division; 64-bit division needs CRT helpers on x86 and we do not link the CRT */
+    UINT64 Quotient = 0, Remainder = 0;
+
+    for (int I = 0; 64 > I; I++)
+    {
+        Remainder = (Remainder << 1) | (Dividend >> 63);
+        Dividend <<= 1;
+        Quotient <<= 1;
+        if (Remainder >= Divisor)
+        {
+            Remainder -= Divisor;
+            Quotient |= 1;
+        }
+    }
+
+    *PRemainder = Remainder;
+    return Quotient;
+}
+
+static const char *trace_kind_name(UINT8 Kind)
+{
+    static const char *KindNames[] =
+    {
+        "RESERVED",
+        "Create",
+        "Overwrite",
+        "Cleanup",
+        "Close",
+        "Read",
+        "Write",
+        "QueryInformation",
+        "SetInformation",
+        "QueryEa",
+        "SetEa",
+        "FlushBuffers",
+        "QueryVolumeInformation",
+        "SetVolumeInformation",
+        "QueryDirectory",
+        "FileSystemControl",
+        "DeviceControl",
+        "Shutdown",
+        "LockControl",
+        "QuerySecurity",
+        "SetSecurity",
+        "QueryStreamInformation",
+    };
+
+    return sizeof KindNames / sizeof KindNames[0] > Kind ? KindNames[Kind] : "INVALID";
+}
+
+static void trace_print(FSP_DEBUG_TRACE_HEADER *Header, FSP_DEBUG_TRACE_RECORD *Record)
+{
+    char TimeBuf[32];
+    UINT64 Ticks, Seconds, Remainder;
+    ULONG Micros;
+
+    /* fixed width relative time, so that "sort" puts the records of all threads in order */
+    Ticks = Record->Counter > Header->StartCounter ? Record->Counter - Header->StartCounter : 0;
+    Seconds = trace_divmod(Ticks, Header->Frequency, &Remainder);
+    Micros = 0;
+    for (int I = 0; 6 > I; I++)
+    {
+        Remainder = (Remainder << 3) + (Remainder << 1);
+        Micros = Micros * 10 + (ULONG)trace_divmod(Remainder, Header->Frequency, &Remainder);
+    }
+    wsprintfA(TimeBuf, "+%06lu.%06lu", (ULONG)Seconds, Micros);
+
+    switch (Record->Type)
+    {
+    case FspDebugTraceRequest:
+        info("%s [TID=%04lx]: %p: >>%s UserContext=%p:%p, Arg0=%lx:%08lx, Arg1=%lx, Arg2=%lx",
+            TimeBuf, Record->ThreadId, (PVOID)Record->Hint, trace_kind_name(Record->Kind),
+            (PVOID)Record->UserContext, (PVOID)Record->UserContext2,
+            trace_uint64_pair(Record->Arg0), Record->Arg1, Record->Arg2);
+        break;
+    case FspDebugTraceResponse:
+        info("%s [TID=%04lx]: %p: <<%s IoStatus=%lx[%ld] "
+            "UserContext=%p:%p, Arg0=%lx:%08lx, Arg1=%lx, Arg2=%lx",
+            TimeBuf, Record->ThreadId, (PVOID)Record->Hint, trace_kind_name(Record->Kind),
+            Record->Status, Record->Information,
+            (PVOID)Record->UserContext, (PVOID)Record->UserContext2,
+            trace_uint64_pair(Record->Arg0), Record->Arg1, Record->Arg2);
+        break;
+    case FspDebugTraceDropped:
+        info("%s [TID=%04lx]: %lu records dropped",
+            TimeBuf, Record->ThreadId, (ULONG)Record->Arg0);
+        break;
+    default:
+        info("%s [TID=%04lx]: invalid record type %u",
+            TimeBuf, Record->ThreadId, Record->Type);
+        break;
+    }
+}
+
+static NTSTATUS trace_file(PWSTR FileName)
+{
+    HANDLE Handle = INVALID_HANDLE_VALUE;
+    FSP_DEBUG_TRACE_HEADER Header;
+    FSP_DEBUG_TRACE_RECORD *Records = 0;
+    ULONG RecordCount = 1024;
+    SYSTEMTIME SystemTime;
+    DWORD BytesTransferred;
+    NTSTATUS Result;
+
+    Handle = CreateFileW(FileName,
+        GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
+    if (INVALID_HANDLE_VALUE == Handle)
+    {
+        Result = FspNtStatusFromWin32(GetLastError());
+        goto exit;
+    }
+
+    if (!ReadFile(Handle, &Header, sizeof Header, &BytesTransferred, 0))
+    {
+        Result = FspNtStatusFromWin32(GetLastError());
+        goto exit;
+    }
+
+    if (sizeof Header != BytesTransferred ||
+        0 != invariant_strncmp(Header.Magic, FSP_DEBUG_TRACE_MAGIC, sizeof Header.Magic) ||
+        FSP_DEBUG_TRACE_VERSION != Header.Version ||
+        sizeof(FSP_DEBUG_TRACE_RECORD) != Header.RecordSize ||
+        0 == Header.Frequency)
+    {
+        warn("%S: not a trace file", FileName);
+        Result = STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    if (FileTimeToSystemTime((PFILETIME)&Header.StartTime, &SystemTime))
+        info("trace of process %lu started at %04hu-%02hu-%02huT%02hu:%02hu:%02hu.%03huZ",
+            Header.ProcessId,
+            SystemTime.wYear, SystemTime.wMonth, SystemTime.wDay,
+            SystemTime.wHour, SystemTime.wMinute, SystemTime.wSecond,
+            SystemTime.wMilliseconds);
+
+    Records = MemAlloc(RecordCount * sizeof(FSP_DEBUG_TRACE_RECORD));
+    if (0 == Records)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    for (;;)
+    {
+        if (!ReadFile(Handle,
+            Records, RecordCount * sizeof(FSP_DEBUG_TRACE_RECORD), &BytesTransferred, 0))
+        {
+            Result = FspNtStatusFromWin32(GetLastError());
+            goto exit;
+        }
+
+        if (0 == BytesTransferred)
+            break;
+
+        /* a trailing partial record (from a trace that was not stopped) is ignored */
+        for (ULONG I = 0; BytesTransferred / sizeof(FSP_DEBUG_TRACE_RECORD) > I; I++)
+            trace_print(&Header, &Records[I]);
+    }
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    MemFree(Records);
+
+    if (INVALID_HANDLE_VALUE != Handle)
+        CloseHandle(Handle);
+
+    return Result;
+}
+
+static int trace(int argc, wchar_t **argv)
+{
+    if (2 != argc)
+        usage();
+
+    NTSTATUS Result;
+
+    Result = trace_file(argv[1]);
+
+    return FspWin32FromNtStatus(Result);
+}
+
 int wmain(int argc, wchar_t **argv)
 {
     argc--;
@@ -583,6 +771,9 @@ int wmain(int argc, wchar_t **argv)
     else
     if (0 == invariant_wcscmp(L"perm", argv[0]))
         return perm(argc, argv);
+    else
+    if (0 == invariant_wcscmp(L"trace", argv[0]))
+        return trace(argc, argv);
     else
         usage();
 
@@ -292,7 +292,9 @@ VOID FspPropagateTopFlags(PIRP Irp, PIRP TopLevelIrp)
     {
         DEBUGBREAK_EX(iorecu);
 
-        FspIrpSetTopFlags(Irp, FspFileNodeAcquireFull);
+        /* FspFastIoRead/FspFastIoWrite hold Main only, as do the cached IRP paths */
+        FspIrpSetTopFlags(Irp, (PIRP)FSRTL_FAST_IO_TOP_LEVEL_IRP == TopLevelIrp ?
+            FspFileNodeAcquireMain : FspFileNodeAcquireFull);
     }
     else if (IO_TYPE_IRP == TopLevelIrp->Type)
     {
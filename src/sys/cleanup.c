@@ -231,6 +231,9 @@ static VOID FspFsvolCleanupRequestFini(FSP_FSCTL_TRANSACT_REQ *Request, PVOID Co
     FspFileNodeReleaseOwner(FileNode, Pgio, Request);
 
     FspFileNodeCleanupComplete(FileNode, FileObject);
+    if (Request->Req.Cleanup.Delete)
+        /* a held open of a deleted file can never be reused */
+        FspFsvolCloseCacheEvictFileNode(FileNode);
     if (!FileNode->IsDirectory)
         FspFileNodeOplockCheck(FileNode, Irp);
     SetFlag(FileObject->Flags, FO_CLEANUP_COMPLETE);
@@ -23,6 +23,25 @@ static NTSTATUS FspFsvrtClose(
     PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 static NTSTATUS FspFsvolClose(
     PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+static VOID FspFsvolCloseBatchAdd(PDEVICE_OBJECT FsvolDeviceObject,
+    UINT64 UserContext, UINT64 UserContext2);
+static WORKER_THREAD_ROUTINE FspFsvolCloseBatchRoutine;
+VOID FspFsvolCloseBatchFlush(PDEVICE_OBJECT FsvolDeviceObject);
+VOID FspFsvolCloseBatchInit(PDEVICE_OBJECT FsvolDeviceObject);
+VOID FspFsvolCloseBatchFini(PDEVICE_OBJECT FsvolDeviceObject);
+static BOOLEAN FspFsvolCloseCacheInsert(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FILE_NODE *FileNode, FSP_FILE_DESC *FileDesc);
+static VOID FspFsvolCloseCacheRemove(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    PVOID Entry, PLIST_ENTRY EvictList);
+static VOID FspFsvolCloseCacheEvictList(PDEVICE_OBJECT FsvolDeviceObject, PLIST_ENTRY EvictList);
+VOID FspFsvolCloseCacheInit(PDEVICE_OBJECT FsvolDeviceObject);
+FSP_FILE_NODE *FspFsvolCloseCacheTake(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FILE_DESC *FileDesc, ACCESS_MASK DesiredAccess, PUINT64 PUserContext2);
+VOID FspFsvolCloseCacheDiscard(FSP_FILE_NODE *FileNode, UINT64 UserContext2);
+VOID FspFsvolCloseCacheEvictFileNode(FSP_FILE_NODE *FileNode);
+VOID FspFsvolCloseCacheEvictSubtree(PDEVICE_OBJECT FsvolDeviceObject, PUNICODE_STRING FileName);
+VOID FspFsvolCloseCacheEvictExpired(PDEVICE_OBJECT FsvolDeviceObject, UINT64 InterruptTime);
+VOID FspFsvolCloseCacheEvictAll(PDEVICE_OBJECT FsvolDeviceObject);
 FSP_IOCMPL_DISPATCH FspFsvolCloseComplete;
 FSP_DRIVER_DISPATCH FspClose;
 
@@ -30,10 +49,52 @@ FSP_DRIVER_DISPATCH FspClose;
 #pragma alloc_text(PAGE, FspFsctlClose)
 #pragma alloc_text(PAGE, FspFsvrtClose)
 #pragma alloc_text(PAGE, FspFsvolClose)
+#pragma alloc_text(PAGE, FspFsvolCloseBatchAdd)
+#pragma alloc_text(PAGE, FspFsvolCloseBatchFlush)
+#pragma alloc_text(PAGE, FspFsvolCloseBatchInit)
+#pragma alloc_text(PAGE, FspFsvolCloseBatchFini)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheInsert)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheRemove)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheEvictList)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheInit)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheTake)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheDiscard)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheEvictFileNode)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheEvictSubtree)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheEvictExpired)
+#pragma alloc_text(PAGE, FspFsvolCloseCacheEvictAll)
 #pragma alloc_text(PAGE, FspFsvolCloseComplete)
 #pragma alloc_text(PAGE, FspClose)
 #endif
 
+/*
+ * Delayed-close cache
+ *
+ * If the file system has asked for it, the Close of a plain open of a main file is held back
+ * for a short time: the FileNode stays open and the user-mode file system keeps the open
+ * UserContext/UserContext2. A Create of the same file by the same token that asks for no more
+ * access than was granted then reuses the held open without a round trip to user mode (see
+ * FspFsvolCreateFromCloseCache). Opens that ask for DELETE are never satisfied this way,
+ * because the parent directory may grant it. There is at most one held open per FileNode.
+ *
+ * A held open is evicted (i.e. its Close is finally posted) when it expires, when the cache
+ * is full or memory is low, when its file is renamed or deleted or has its security changed
+ * and when the volume is stopped. Like any Close in the context of a rename, the Close of an
+ * open that is evicted for a rename is delivered synchronously: the rename does not proceed
+ * until the file system has processed it. The CloseCacheList and FileNode::CloseCacheEntry
+ * are locked under the ContextTableResource. All entries share the same timeout, so the list is ordered
+ * by expiration time.
+ */
+typedef struct
+{
+    LIST_ENTRY ListEntry;
+    FSP_FILE_NODE *FileNode;
+    UINT64 UserContext2;
+    UINT64 ExpirationTime;
+    UINT32 GrantedAccess;
+    LUID TokenId, TokenModifiedId;
+} FSP_CLOSE_CACHE_ENTRY;
+
 static NTSTATUS FspFsctlClose(
     PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
 {
@@ -61,6 +122,7 @@ static NTSTATUS FspFsvolClose(
     if (!FspFileNodeIsValid(IrpSp->FileObject->FsContext))
         return STATUS_SUCCESS;
 
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     FSP_FILE_NODE *FileNode = FileObject->FsContext;
     FSP_FILE_DESC *FileDesc = FileObject->FsContext2;
@@ -68,6 +130,34 @@ static NTSTATUS FspFsvolClose(
 
     ASSERT(FileNode == FileDesc->FileNode);
 
+    /* if the file system has asked for it, hold this open back for a later reopen */
+    if (FsvolDeviceExtension->VolumeParams.DelayCloseRequests &&
+        FspFsvolCloseCacheInsert(FsvolDeviceObject, FileNode, FileDesc))
+    {
+        /* the cache entry now owns the FileNode open and reference */
+        FspFileDescDelete(FileDesc);
+
+        Irp->IoStatus.Information = 0;
+        return STATUS_SUCCESS;
+    }
+
+    /*
+     * If the file system has asked for it, coalesce this Close with other pending ones.
+     * Closes in the context of a rename remain synchronous; see below.
+     */
+    if (FsvolDeviceExtension->VolumeParams.BatchCloseRequests &&
+        !FspFsvolDeviceFileRenameIsAcquiredExclusive(FsvolDeviceObject))
+    {
+        FspFsvolCloseBatchAdd(FsvolDeviceObject, FileNode->UserContext, FileDesc->UserContext2);
+
+        FspFileNodeClose(FileNode, 0, FALSE);
+        FspFileDescDelete(FileDesc); /* this will also close the MainFileObject if any */
+        FspFileNodeDereference(FileNode);
+
+        Irp->IoStatus.Information = 0;
+        return STATUS_SUCCESS;
+    }
+
     /* create the user-mode file system request; MustSucceed because IRP_MJ_CLOSE cannot fail */
     FspIopCreateRequestMustSucceed(0, 0, 0, &Request);
     Request->Kind = FspFsctlTransactCloseKind;
@@ -106,6 +196,529 @@ static NTSTATUS FspFsvolClose(
     return STATUS_SUCCESS;
 }
 
+static VOID FspFsvolCloseBatchAdd(PDEVICE_OBJECT FsvolDeviceObject,
+    UINT64 UserContext, UINT64 UserContext2)
+{
+    PAGED_CODE();
+
+    /*
+     * A batch is a regular Close request for its first file; the contexts of subsequent
+     * files are appended to Req.Close.Contexts. A batch is posted when it is full or when
+     * the delayed flush runs, whichever comes first. The delayed flush holds a reference
+     * on the volume device, so a pending batch cannot outlive it.
+     */
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FSCTL_TRANSACT_REQ *Request, *NewRequest = 0, *FullRequest = 0;
+    FSP_FSCTL_TRANSACT_FULL_CONTEXT *Context;
+    BOOLEAN QueueFlush = FALSE;
+    LARGE_INTEGER Delay;
+
+retry:
+    ExAcquireFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+
+    Request = FsvolDeviceExtension->CloseBatchRequest;
+    if (0 == Request)
+    {
+        if (0 == NewRequest)
+        {
+            ExReleaseFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+
+            /* allocate outside the mutex; MustSucceed because IRP_MJ_CLOSE cannot fail */
+            FspIopCreateRequestMustSucceed(0, 0,
+                (FspFsvolDeviceCloseBatchCountMax - 1) * sizeof(FSP_FSCTL_TRANSACT_FULL_CONTEXT),
+                &NewRequest);
+            NewRequest->Kind = FspFsctlTransactCloseKind;
+            NewRequest->Size = sizeof *NewRequest;
+            goto retry;
+        }
+
+        Request = FsvolDeviceExtension->CloseBatchRequest = NewRequest;
+        NewRequest = 0;
+
+        Request->Req.Close.UserContext = UserContext;
+        Request->Req.Close.UserContext2 = UserContext2;
+    }
+    else
+    {
+        Context = (PVOID)(Request->Buffer + Request->Req.Close.Contexts.Size);
+        Context->UserContext = UserContext;
+        Context->UserContext2 = UserContext2;
+        Request->Req.Close.Contexts.Size += sizeof *Context;
+        Request->Size += sizeof *Context;
+    }
+
+    if ((FspFsvolDeviceCloseBatchCountMax - 1) * sizeof(FSP_FSCTL_TRANSACT_FULL_CONTEXT) ==
+        Request->Req.Close.Contexts.Size)
+    {
+        FullRequest = Request;
+        FsvolDeviceExtension->CloseBatchRequest = 0;
+    }
+    else if (!FsvolDeviceExtension->CloseBatchFlushPending)
+        QueueFlush = FsvolDeviceExtension->CloseBatchFlushPending = TRUE;
+
+    ExReleaseFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+
+    FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseBatch.Closes);
+
+    /* another thread started a batch while we were allocating ours */
+    if (0 != NewRequest)
+        FspIopDeleteRequest(NewRequest);
+
+    if (0 != FullRequest)
+    {
+        FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseBatch.Requests);
+        FspIopPostWorkRequestBestEffort(FsvolDeviceObject, FullRequest);
+    }
+
+    if (QueueFlush)
+    {
+        if (FspDeviceReference(FsvolDeviceObject))
+        {
+            Delay.QuadPart = FspFsvolDeviceCloseBatchDelay/*ms*/ * -10000;
+            FspQueueDelayedWorkItem(&FsvolDeviceExtension->CloseBatchDelayedWorkItem, Delay);
+        }
+        else
+        {
+            /* the volume is going away; post what we have now */
+            ExAcquireFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+            FsvolDeviceExtension->CloseBatchFlushPending = FALSE;
+            ExReleaseFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+
+            FspFsvolCloseBatchFlush(FsvolDeviceObject);
+        }
+    }
+}
+
+static VOID FspFsvolCloseBatchRoutine(PVOID Context)
+{
+    // !PAGED_CODE();
+
+    PDEVICE_OBJECT FsvolDeviceObject = Context;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    ExAcquireFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+    Request = FsvolDeviceExtension->CloseBatchRequest;
+    FsvolDeviceExtension->CloseBatchRequest = 0;
+    FsvolDeviceExtension->CloseBatchFlushPending = FALSE;
+    ExReleaseFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+
+    if (0 != Request)
+    {
+        FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseBatch.Requests);
+        FspIopPostWorkRequestBestEffort(FsvolDeviceObject, Request);
+    }
+
+    FspDeviceDereference(FsvolDeviceObject);
+}
+
+VOID FspFsvolCloseBatchFlush(PDEVICE_OBJECT FsvolDeviceObject)
+{
+    /*
+     * Post the pending batch now. In the context of a rename wait until the file system
+     * has processed it, so that the Closes reach the file system before the rename does.
+     */
+
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    if (!FsvolDeviceExtension->VolumeParams.BatchCloseRequests)
+        return;
+
+    ExAcquireFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+    Request = FsvolDeviceExtension->CloseBatchRequest;
+    FsvolDeviceExtension->CloseBatchRequest = 0;
+    ExReleaseFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+
+    if (0 != Request)
+    {
+        FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseBatch.Requests);
+        if (FspFsvolDeviceFileRenameIsAcquiredExclusive(FsvolDeviceObject))
+            FspIopPostWorkRequestBestEffortAndWait(FsvolDeviceObject, Request);
+        else
+            FspIopPostWorkRequestBestEffort(FsvolDeviceObject, Request);
+    }
+}
+
+VOID FspFsvolCloseBatchInit(PDEVICE_OBJECT FsvolDeviceObject)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+
+    ExInitializeFastMutex(&FsvolDeviceExtension->CloseBatchMutex);
+    FspInitializeDelayedWorkItem(&FsvolDeviceExtension->CloseBatchDelayedWorkItem,
+        FspFsvolCloseBatchRoutine, FsvolDeviceObject);
+}
+
+VOID FspFsvolCloseBatchFini(PDEVICE_OBJECT FsvolDeviceObject)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+
+    /* no flush can be pending: it holds a reference on the volume device */
+    ASSERT(!FsvolDeviceExtension->CloseBatchFlushPending);
+
+    if (0 != FsvolDeviceExtension->CloseBatchRequest)
+        FspIopDeleteRequest(FsvolDeviceExtension->CloseBatchRequest);
+}
+
+static BOOLEAN FspFsvolCloseCacheInsert(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FILE_NODE *FileNode, FSP_FILE_DESC *FileDesc)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_CLOSE_CACHE_ENTRY *Entry;
+    LIST_ENTRY EvictList;
+    UINT32 Timeout;
+    BOOLEAN Inserted = FALSE;
+
+    /* closes in the context of a rename must reach the file system; see FspFsvolClose */
+    if (!FileDesc->CloseCacheable ||
+        FileDesc->DeleteOnClose ||
+        0 != FileNode->MainFileNode ||
+        FspFsvolDeviceFileRenameIsAcquiredExclusive(FsvolDeviceObject) ||
+        FspLowMemoryCondition())
+        return FALSE;
+
+    Entry = FspAlloc(sizeof *Entry);
+    if (0 == Entry)
+        return FALSE;
+
+    /* a held open is only useful while the FileNode's FileInfo is */
+    Timeout = FsvolDeviceExtension->VolumeParams.FileInfoTimeout;
+    if (FspFsvolDeviceCloseCacheTimeout < Timeout)
+        Timeout = FspFsvolDeviceCloseCacheTimeout;
+
+    Entry->FileNode = FileNode;
+    Entry->UserContext2 = FileDesc->UserContext2;
+    Entry->ExpirationTime = FspExpirationTimeFromMillis(Timeout);
+    Entry->GrantedAccess = FileDesc->GrantedAccess;
+    Entry->TokenId = FileDesc->TokenId;
+    Entry->TokenModifiedId = FileDesc->TokenModifiedId;
+
+    InitializeListHead(&EvictList);
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+
+    /*
+     * A FileNode that is being deleted or is no longer in the ContextTable cannot be found
+     * by a reopen. Once the Ioq is stopped nothing may be added, because FspVolumeDelete
+     * has already emptied the cache.
+     */
+    if (!FileNode->DeletePending &&
+        0 < FileNode->OpenCount &&
+        0 == FileNode->CloseCacheEntry &&
+        !FspIoqStopped(FsvolDeviceExtension->Ioq))
+    {
+        if (FspFsvolDeviceCloseCacheCountMax <= FsvolDeviceExtension->CloseCacheCount)
+            FspFsvolCloseCacheRemove(FsvolDeviceExtension,
+                CONTAINING_RECORD(FsvolDeviceExtension->CloseCacheList.Flink,
+                    FSP_CLOSE_CACHE_ENTRY, ListEntry),
+                &EvictList);
+
+        FileNode->CloseCacheEntry = Entry;
+        InsertTailList(&FsvolDeviceExtension->CloseCacheList, &Entry->ListEntry);
+        FsvolDeviceExtension->CloseCacheCount++;
+        Inserted = TRUE;
+    }
+
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    if (!Inserted)
+    {
+        FspFree(Entry);
+        return FALSE;
+    }
+
+    FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseCache.Inserts);
+
+    FspFsvolCloseCacheEvictList(FsvolDeviceObject, &EvictList);
+
+    return TRUE;
+}
+
+static VOID FspFsvolCloseCacheRemove(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    PVOID Entry0, PLIST_ENTRY EvictList)
+{
+    /*
+     * Must be called with the ContextTable locked exclusive. The Entry is moved to the
+     * EvictList if one is given; otherwise the caller takes over the Entry.
+     */
+
+    PAGED_CODE();
+
+    FSP_CLOSE_CACHE_ENTRY *Entry = Entry0;
+
+    ASSERT(Entry == Entry->FileNode->CloseCacheEntry);
+
+    RemoveEntryList(&Entry->ListEntry);
+    FsvolDeviceExtension->CloseCacheCount--;
+    Entry->FileNode->CloseCacheEntry = 0;
+
+    if (0 != EvictList)
+        InsertTailList(EvictList, &Entry->ListEntry);
+}
+
+static VOID FspFsvolCloseCacheEvictList(PDEVICE_OBJECT FsvolDeviceObject, PLIST_ENTRY EvictList)
+{
+    PAGED_CODE();
+
+    FSP_CLOSE_CACHE_ENTRY *Entry;
+
+    while (!IsListEmpty(EvictList))
+    {
+        Entry = CONTAINING_RECORD(RemoveHeadList(EvictList), FSP_CLOSE_CACHE_ENTRY, ListEntry);
+
+        FspFsvolCloseCacheDiscard(Entry->FileNode, Entry->UserContext2);
+        FspFree(Entry);
+
+        FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseCache.Evictions);
+    }
+}
+
+VOID FspFsvolCloseCacheInit(PDEVICE_OBJECT FsvolDeviceObject)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+
+    InitializeListHead(&FsvolDeviceExtension->CloseCacheList);
+    FsvolDeviceExtension->CloseCacheCount = 0;
+}
+
+FSP_FILE_NODE *FspFsvolCloseCacheTake(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FILE_DESC *FileDesc, ACCESS_MASK DesiredAccess, PUINT64 PUserContext2)
+{
+    /*
+     * Look for a held open of the file named by FileDesc->FileNode that was opened by the
+     * same token (including its privileges and groups; see TOKEN_STATISTICS::ModifiedId)
+     * and was granted at least DesiredAccess. On success the held open is removed from the
+     * cache and the caller owns its FileNode open and reference and its UserContext2.
+     */
+
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    PUNICODE_STRING FileName = &FileDesc->FileNode->FileName;
+    ULONG FileNameHash;
+    FSP_FILE_NODE *FileNode;
+    FSP_CLOSE_CACHE_ENTRY *Entry = 0;
+
+    FileNameHash = FspFsvolDeviceHashContextByName(FsvolDeviceObject, FileName);
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+
+    FileNode = FspFsvolDeviceLookupContextByName(FsvolDeviceObject, FileName, FileNameHash);
+    if (0 != FileNode && 0 != FileNode->CloseCacheEntry)
+    {
+        Entry = FileNode->CloseCacheEntry;
+        if (RtlEqualLuid(&Entry->TokenId, &FileDesc->TokenId) &&
+            RtlEqualLuid(&Entry->TokenModifiedId, &FileDesc->TokenModifiedId) &&
+            DesiredAccess == (DesiredAccess & Entry->GrantedAccess) &&
+            !FileNode->DeletePending &&
+            FspExpirationTimeValid(Entry->ExpirationTime))
+            FspFsvolCloseCacheRemove(FsvolDeviceExtension, Entry, 0);
+        else
+            Entry = 0;
+    }
+
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    if (0 == Entry)
+    {
+        FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseCache.Misses);
+        return 0;
+    }
+
+    *PUserContext2 = Entry->UserContext2;
+    FspFree(Entry);
+
+    return FileNode;
+}
+
+VOID FspFsvolCloseCacheDiscard(FSP_FILE_NODE *FileNode, UINT64 UserContext2)
+{
+    /*
+     * Post the delayed Close of a held open and give up its FileNode open and reference.
+     * This is the tail of FspFsvolClose for an open that no longer has a FileDesc.
+     */
+
+    PAGED_CODE();
+
+    PDEVICE_OBJECT FsvolDeviceObject = FileNode->FsvolDeviceObject;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    if (FsvolDeviceExtension->VolumeParams.BatchCloseRequests &&
+        !FspFsvolDeviceFileRenameIsAcquiredExclusive(FsvolDeviceObject))
+    {
+        FspFsvolCloseBatchAdd(FsvolDeviceObject, FileNode->UserContext, UserContext2);
+
+        FspFileNodeClose(FileNode, 0, FALSE);
+        FspFileNodeDereference(FileNode);
+        return;
+    }
+
+    /* MustSucceed because a held open must always be closed */
+    FspIopCreateRequestMustSucceed(0, 0, 0, &Request);
+    Request->Kind = FspFsctlTransactCloseKind;
+    Request->Req.Close.UserContext = FileNode->UserContext;
+    Request->Req.Close.UserContext2 = UserContext2;
+
+    FspFileNodeClose(FileNode, 0, FALSE);
+    FspFileNodeDereference(FileNode);
+
+    /* if we are closing files in the context of a rename make it synchronous; see FspFsvolClose */
+    if (FspFsvolDeviceFileRenameIsAcquiredExclusive(FsvolDeviceObject))
+        FspIopPostWorkRequestBestEffortAndWait(FsvolDeviceObject, Request);
+    else
+        FspIopPostWorkRequestBestEffort(FsvolDeviceObject, Request);
+}
+
+VOID FspFsvolCloseCacheEvictFileNode(FSP_FILE_NODE *FileNode)
+{
+    PAGED_CODE();
+
+    PDEVICE_OBJECT FsvolDeviceObject = FileNode->FsvolDeviceObject;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    LIST_ENTRY EvictList;
+
+    if (!FsvolDeviceExtension->VolumeParams.DelayCloseRequests)
+        return;
+
+    InitializeListHead(&EvictList);
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+    if (0 != FileNode->CloseCacheEntry)
+        FspFsvolCloseCacheRemove(FsvolDeviceExtension, FileNode->CloseCacheEntry, &EvictList);
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    FspFsvolCloseCacheEvictList(FsvolDeviceObject, &EvictList);
+}
+
+VOID FspFsvolCloseCacheEvictSubtree(PDEVICE_OBJECT FsvolDeviceObject, PUNICODE_STRING FileName)
+{
+    /*
+     * Evict the held opens of FileName and of any names below it. The FileName's of
+     * cached FileNode's can only be compared while the FileRenameResource is held.
+     */
+
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    BOOLEAN CaseInsensitive = 0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch;
+    FSP_CLOSE_CACHE_ENTRY *Entry;
+    PUNICODE_STRING EntryFileName;
+    PLIST_ENTRY ListEntry, NextEntry;
+    LIST_ENTRY EvictList;
+    WCHAR Separator;
+
+    if (!FsvolDeviceExtension->VolumeParams.DelayCloseRequests)
+        return;
+
+    InitializeListHead(&EvictList);
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+
+    for (ListEntry = FsvolDeviceExtension->CloseCacheList.Flink;
+        &FsvolDeviceExtension->CloseCacheList != ListEntry;
+        ListEntry = NextEntry)
+    {
+        NextEntry = ListEntry->Flink;
+        Entry = CONTAINING_RECORD(ListEntry, FSP_CLOSE_CACHE_ENTRY, ListEntry);
+        EntryFileName = &Entry->FileNode->FileName;
+
+        if (!FspFileNameIsPrefix(FileName, EntryFileName, CaseInsensitive, 0))
+            continue;
+
+        if (sizeof(WCHAR) < FileName->Length &&
+            FileName->Length < EntryFileName->Length)
+        {
+            Separator = EntryFileName->Buffer[FileName->Length / sizeof(WCHAR)];
+            if (L'\\' != Separator && L':' != Separator)
+                continue;
+        }
+
+        FspFsvolCloseCacheRemove(FsvolDeviceExtension, Entry, &EvictList);
+    }
+
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    FspFsvolCloseCacheEvictList(FsvolDeviceObject, &EvictList);
+}
+
+VOID FspFsvolCloseCacheEvictExpired(PDEVICE_OBJECT FsvolDeviceObject, UINT64 InterruptTime)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_CLOSE_CACHE_ENTRY *Entry;
+    LIST_ENTRY EvictList;
+    BOOLEAN LowMemory;
+
+    if (!FsvolDeviceExtension->VolumeParams.DelayCloseRequests)
+        return;
+
+    /* when memory is low give up all held opens */
+    LowMemory = FspLowMemoryCondition();
+
+    InitializeListHead(&EvictList);
+
+    /* we are called from a system worker thread; disable APC's while holding the resource */
+    FsRtlEnterFileSystem();
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+
+    while (!IsListEmpty(&FsvolDeviceExtension->CloseCacheList))
+    {
+        Entry = CONTAINING_RECORD(FsvolDeviceExtension->CloseCacheList.Flink,
+            FSP_CLOSE_CACHE_ENTRY, ListEntry);
+        if (!LowMemory && FspExpirationTimeValidEx(Entry->ExpirationTime, InterruptTime))
+            break;
+
+        FspFsvolCloseCacheRemove(FsvolDeviceExtension, Entry, &EvictList);
+    }
+
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    FspFsvolCloseCacheEvictList(FsvolDeviceObject, &EvictList);
+
+    FsRtlExitFileSystem();
+}
+
+VOID FspFsvolCloseCacheEvictAll(PDEVICE_OBJECT FsvolDeviceObject)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    LIST_ENTRY EvictList;
+
+    if (!FsvolDeviceExtension->VolumeParams.DelayCloseRequests)
+        return;
+
+    InitializeListHead(&EvictList);
+
+    FsRtlEnterFileSystem();
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+    while (!IsListEmpty(&FsvolDeviceExtension->CloseCacheList))
+        FspFsvolCloseCacheRemove(FsvolDeviceExtension,
+            CONTAINING_RECORD(FsvolDeviceExtension->CloseCacheList.Flink,
+                FSP_CLOSE_CACHE_ENTRY, ListEntry),
+            &EvictList);
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    FspFsvolCloseCacheEvictList(FsvolDeviceObject, &EvictList);
+
+    FsRtlExitFileSystem();
+}
+
 NTSTATUS FspFsvolCloseComplete(
     PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Response)
 {
@@ -26,12 +26,17 @@ static NTSTATUS FspFsvolCreate(
 static NTSTATUS FspFsvolCreateNoLock(
     PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp,
     BOOLEAN MainFileOpen);
+static NTSTATUS FspFsvolCreateFromCloseCache(
+    PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp,
+    FSP_FILE_DESC *FileDesc);
 FSP_IOPREP_DISPATCH FspFsvolCreatePrepare;
 FSP_IOCMPL_DISPATCH FspFsvolCreateComplete;
 static NTSTATUS FspFsvolCreateTryOpen(PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Response,
     FSP_FILE_NODE *FileNode, FSP_FILE_DESC *FileDesc, PFILE_OBJECT FileObject,
     BOOLEAN FlushImage);
 static VOID FspFsvolCreatePostClose(FSP_FILE_DESC *FileDesc);
+static VOID FspFsvolCreateInvalidateNegativeName(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FILE_DESC *FileDesc);
 static FSP_IOP_REQUEST_FINI FspFsvolCreateRequestFini;
 static FSP_IOP_REQUEST_FINI FspFsvolCreateTryOpenRequestFini;
 static FSP_IOP_REQUEST_FINI FspFsvolCreateOverwriteRequestFini;
@@ -51,10 +56,12 @@ FSP_DRIVER_DISPATCH FspCreate;
 #pragma alloc_text(PAGE, FspFsvrtCreate)
 #pragma alloc_text(PAGE, FspFsvolCreate)
 #pragma alloc_text(PAGE, FspFsvolCreateNoLock)
+#pragma alloc_text(PAGE, FspFsvolCreateFromCloseCache)
 #pragma alloc_text(PAGE, FspFsvolCreatePrepare)
 #pragma alloc_text(PAGE, FspFsvolCreateComplete)
 #pragma alloc_text(PAGE, FspFsvolCreateTryOpen)
 #pragma alloc_text(PAGE, FspFsvolCreatePostClose)
+#pragma alloc_text(PAGE, FspFsvolCreateInvalidateNegativeName)
 #pragma alloc_text(PAGE, FspFsvolCreateRequestFini)
 #pragma alloc_text(PAGE, FspFsvolCreateTryOpenRequestFini)
 #pragma alloc_text(PAGE, FspFsvolCreateOverwriteRequestFini)
@@ -134,7 +141,8 @@ static NTSTATUS FspFsvolCreate(
         }
         finally
         {
-            if (FSP_STATUS_IOQ_POST != Result)
+            /* the Request owns the FileRenameResource if it was posted or completed from the cache */
+            if (FSP_STATUS_IOQ_POST != Result && !(FSP_STATUS_IGNORE_BIT & Result))
                 FspFsvolDeviceFileRenameRelease(FsvolDeviceObject);
         }
     }
@@ -199,6 +207,9 @@ static NTSTATUS FspFsvolCreateNoLock(
     UNICODE_STRING MainFileName = { 0 }, StreamPart = { 0 };
     ULONG StreamType = FspFileNameStreamTypeNone;
     FSP_FSCTL_TRANSACT_REQ *Request;
+    BOOLEAN NegativeNameLookup;
+    ULONG NegativeNameGeneration = 0;
+    PTOKEN_STATISTICS TokenInfo;
 
     /* cannot open files by fileid */
     if (FlagOn(CreateOptions, FILE_OPEN_BY_FILE_ID))
@@ -385,12 +396,58 @@ static NTSTATUS FspFsvolCreateNoLock(
         return STATUS_CANNOT_DELETE;
     }
 
+    /*
+     * Check the negative name cache for plain opens of a main file. Only do so when the
+     * caller has traverse privilege; in this case the user mode file system would report
+     * STATUS_OBJECT_NAME_NOT_FOUND for a nonexistent file regardless of the caller.
+     */
+    NegativeNameLookup =
+        (FILE_OPEN == CreateDisposition || FILE_OVERWRITE == CreateDisposition) &&
+        !FlagOn(Flags, SL_OPEN_TARGET_DIRECTORY) &&
+        0 == StreamPart.Length &&
+        HasTraversePrivilege;
+    if (NegativeNameLookup &&
+        FspFsvolDeviceLookupNegativeName(FsvolDeviceObject, &FileNode->FileName,
+            &NegativeNameGeneration))
+    {
+        FspFileNodeDereference(FileNode);
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
     Result = FspFileDescCreate(&FileDesc);
     if (!NT_SUCCESS(Result))
     {
         FspFileNodeDereference(FileNode);
         return Result;
     }
+    FileDesc->NegativeNameLookup = NegativeNameLookup;
+    FileDesc->NegativeNameGeneration = NegativeNameGeneration;
+    FileDesc->NegativeNameInvalidate =
+        FILE_OPEN != CreateDisposition && FILE_OVERWRITE != CreateDisposition &&
+        !FlagOn(Flags, SL_OPEN_TARGET_DIRECTORY);
+
+    /*
+     * Remember the opener's token for plain opens of a main file, so that the delayed-close
+     * cache can later give this open (once closed) to a reopen by the same token. Like the
+     * negative name cache this requires traverse privilege, because a held open bypasses
+     * the user mode file system's access checks on the file's path.
+     */
+    if (FsvolDeviceExtension->VolumeParams.DelayCloseRequests &&
+        0 != FsvolDeviceExtension->VolumeParams.FileInfoTimeout &&
+        !FlagOn(Flags, SL_OPEN_TARGET_DIRECTORY) &&
+        0 == StreamPart.Length &&
+        !MainFileOpen &&
+        HasTraversePrivilege &&
+        UserMode == RequestorMode &&
+        NT_SUCCESS(SeQueryInformationToken(
+            SeQuerySubjectContextToken(&AccessState->SubjectSecurityContext),
+            TokenStatistics, (PVOID *)&TokenInfo)))
+    {
+        FileDesc->TokenId = TokenInfo->TokenId;
+        FileDesc->TokenModifiedId = TokenInfo->ModifiedId;
+        FileDesc->CloseCacheable = 1;
+        FspFreeExternal(TokenInfo);
+    }
 
     /* fix FileAttributes */
     ClearFlag(FileAttributes,
@@ -529,9 +586,114 @@ static NTSTATUS FspFsvolCreateNoLock(
     Irp->IoStatus.Status = 0;
     Irp->IoStatus.Information = 0;
 
+    if (FileDesc->CloseCacheable)
+        return FspFsvolCreateFromCloseCache(FsvolDeviceObject, Irp, IrpSp, FileDesc);
+
     return FSP_STATUS_IOQ_POST;
 }
 
+static NTSTATUS FspFsvolCreateFromCloseCache(
+    PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp,
+    FSP_FILE_DESC *FileDesc)
+{
+    /*
+     * Try to satisfy a plain open from an open held by the delayed-close cache. On a hit
+     * we complete the Create as if the user mode file system had responded with the held
+     * open; FspFsvolCreateComplete then does all the usual sharing and oplock processing.
+     * On a miss we return FSP_STATUS_IOQ_POST to post the Create as usual.
+     */
+
+    PAGED_CODE();
+
+    FSP_FSCTL_TRANSACT_REQ *Request = FspIrpRequest(Irp);
+    PACCESS_STATE AccessState = IrpSp->Parameters.Create.SecurityContext->AccessState;
+    ULONG CreateDisposition = (IrpSp->Parameters.Create.Options >> 24) & 0xff;
+    ULONG CreateOptions = IrpSp->Parameters.Create.Options;
+    ACCESS_MASK DesiredAccess;
+    FSP_FILE_NODE *FileNode;
+    UINT64 UserContext2;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    BOOLEAN Success, IsDirectory;
+
+    if (FILE_OPEN != CreateDisposition ||
+        FlagOn(CreateOptions, FILE_DELETE_ON_CLOSE) ||
+        FlagOn(AccessState->RemainingDesiredAccess, MAXIMUM_ALLOWED) ||
+        Request->Req.Create.OpenTargetDirectory ||
+        Request->Req.Create.HasTrailingBackslash)
+        return FSP_STATUS_IOQ_POST;
+
+    DesiredAccess = AccessState->RemainingDesiredAccess | AccessState->PreviouslyGrantedAccess;
+
+    /*
+     * DELETE may have been granted by FILE_DELETE_CHILD on the parent directory, whose
+     * security can change without evicting the held opens below it; let the file system decide.
+     */
+    if (FlagOn(DesiredAccess, DELETE))
+        return FSP_STATUS_IOQ_POST;
+
+    FileNode = FspFsvolCloseCacheTake(FsvolDeviceObject, FileDesc, DesiredAccess, &UserContext2);
+    if (0 == FileNode)
+        return FSP_STATUS_IOQ_POST;
+
+    /* we need current FileInfo to check the open against the file */
+    Success = FspFileNodeTryAcquireShared(FileNode, Main);
+    if (Success)
+    {
+        Success = FspFileNodeTryGetFileInfo(FileNode, &FileInfo);
+        FspFileNodeRelease(FileNode, Main);
+    }
+    if (Success)
+    {
+        IsDirectory = BooleanFlagOn(FileInfo.FileAttributes, FILE_ATTRIBUTE_DIRECTORY);
+        Success =
+            !FlagOn(FileInfo.FileAttributes, FILE_ATTRIBUTE_REPARSE_POINT) &&
+            !(FlagOn(CreateOptions, FILE_DIRECTORY_FILE) && !IsDirectory) &&
+            !(FlagOn(CreateOptions, FILE_NON_DIRECTORY_FILE) && IsDirectory) &&
+            !(FlagOn(FileInfo.FileAttributes, FILE_ATTRIBUTE_READONLY) &&
+                FlagOn(DesiredAccess, FILE_WRITE_DATA | FILE_APPEND_DATA | DELETE));
+    }
+    if (!Success)
+    {
+        /* let the user mode file system decide; this also reports any errors properly */
+        FspFsvolCloseCacheDiscard(FileNode, UserContext2);
+        FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseCache.Misses);
+        return FSP_STATUS_IOQ_POST;
+    }
+
+    Response = FspAllocMustSucceed(sizeof *Response + FileNode->FileName.Length);
+    RtlZeroMemory(Response, sizeof *Response);
+    Response->Size = (UINT16)(sizeof *Response + FileNode->FileName.Length);
+    Response->Kind = FspFsctlTransactCreateKind;
+    Response->Hint = (UINT_PTR)Irp;
+    Response->IoStatus.Status = STATUS_SUCCESS;
+    Response->IoStatus.Information = FILE_OPENED;
+    Response->Rsp.Create.Opened.UserContext = FileNode->UserContext;
+    Response->Rsp.Create.Opened.UserContext2 = UserContext2;
+    Response->Rsp.Create.Opened.GrantedAccess = DesiredAccess;
+    Response->Rsp.Create.Opened.FileInfo = FileInfo;
+    Response->Rsp.Create.Opened.FileName.Offset = 0;
+    Response->Rsp.Create.Opened.FileName.Size = FileNode->FileName.Length;
+    RtlCopyMemory(Response->Buffer, FileNode->FileName.Buffer, FileNode->FileName.Length);
+
+    /*
+     * FspFsvolCreateComplete completes the IRP (or queues it for retry) and drops the device
+     * reference taken in FspCreate. It also takes over UserContext2: it is either given to
+     * the new FileDesc or closed.
+     */
+    IoMarkIrpPending(Irp);
+    FspFsvolCreateComplete(Irp, Response);
+    FspFree(Response);
+
+    /* FspFileNodeOpen opened the cached FileNode again; give up the open held by the cache */
+    FspFileNodeClose(FileNode, 0, FALSE);
+    FspFileNodeDereference(FileNode);
+
+    FspStatisticsInc(FspFsvolDeviceStatistics(FsvolDeviceObject), Winfsp.CloseCache.Hits);
+
+    return STATUS_PENDING | FSP_STATUS_IGNORE_BIT;
+}
+
 NTSTATUS FspFsvolCreatePrepare(
     PIRP Irp, FSP_FSCTL_TRANSACT_REQ *Request)
 {
@@ -662,9 +824,18 @@ NTSTATUS FspFsvolCreateComplete(
 
     if (FspFsctlTransactCreateKind == Request->Kind)
     {
+        /* the file may exist now, even if the user-mode file system reports a failure */
+        FspFsvolCreateInvalidateNegativeName(FsvolDeviceObject, Request, FileDesc);
+
         /* did the user-mode file system sent us a failure code? */
         if (!NT_SUCCESS(Response->IoStatus.Status))
         {
+            /* remember nonexistent names so that we can fail repeated opens quickly */
+            if (STATUS_OBJECT_NAME_NOT_FOUND == Response->IoStatus.Status &&
+                FileDesc->NegativeNameLookup)
+                FspFsvolDeviceInsertNegativeName(FsvolDeviceObject,
+                    &FileNode->FileName, FileDesc->NegativeNameGeneration);
+
             Irp->IoStatus.Information = STATUS_SHARING_VIOLATION == Response->IoStatus.Status ?
                 Response->IoStatus.Information : 0;
             Result = Response->IoStatus.Status;
@@ -821,6 +992,9 @@ NTSTATUS FspFsvolCreateComplete(
             sizeof(WCHAR) == FileNode->FileName.Length && L'\\' == FileNode->FileName.Buffer[0];
         FileDesc->UserContext2 = Response->Rsp.Create.Opened.UserContext2;
         FileDesc->DeleteOnClose = BooleanFlagOn(IrpSp->Parameters.Create.Options, FILE_DELETE_ON_CLOSE);
+        if (Response->Rsp.Create.Opened.DisableCache)
+            /* a held open would not remember that caching was disabled */
+            FileDesc->CloseCacheable = 0;
 
         /* handle normalized names */
         if (!FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch)
@@ -1209,6 +1383,29 @@ static VOID FspFsvolCreatePostClose(FSP_FILE_DESC *FileDesc)
      */
 }
 
+static VOID FspFsvolCreateInvalidateNegativeName(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FILE_DESC *FileDesc)
+{
+    PAGED_CODE();
+
+    UNICODE_STRING MainFileName;
+
+    /*
+     * A create that may bring a file into existence invalidates the negative name cache
+     * entry of its main file once it reaches user mode, whatever its outcome. Do this once
+     * per request: either when the response arrives or when the request is finalized.
+     */
+    if (!FileDesc->NegativeNameInvalidate)
+        return;
+    FileDesc->NegativeNameInvalidate = 0;
+
+    MainFileName = FileDesc->FileNode->FileName;
+    if (0 != Request->Req.Create.NamedStream)
+        MainFileName.Length = MainFileName.MaximumLength = (USHORT)Request->Req.Create.NamedStream;
+
+    FspFsvolDeviceInvalidateNegativeName(FsvolDeviceObject, &MainFileName, FALSE);
+}
+
 static VOID FspFsvolCreateRequestFini(FSP_FSCTL_TRANSACT_REQ *Request, PVOID Context[4])
 {
     PAGED_CODE();
@@ -1228,6 +1425,10 @@ static VOID FspFsvolCreateRequestFini(FSP_FSCTL_TRANSACT_REQ *Request, PVOID Con
 
     if (0 != FileDesc)
     {
+        /* the request reached user mode (see FspFsvolCreatePrepare); no-op after a response */
+        if (0 != AccessToken && FspFsctlTransactCreateKind == Request->Kind)
+            FspFsvolCreateInvalidateNegativeName(FsvolDeviceObject, Request, FileDesc);
+
         FspFileNodeDereference(FileDesc->FileNode);
         FspFileDescDelete(FileDesc);
     }
@@ -1518,7 +1719,7 @@ static BOOLEAN FspFsvolCreateOpenOrOverwriteOplock(PIRP Irp, const FSP_FSCTL_TRA
     }
 
     /* get current handle count */
-    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+    FspFsvolDeviceLockContextTableShared(FsvolDeviceObject);
     OplockCount = FileNode->HandleCount;
     FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
 
@@ -171,6 +171,8 @@ const char *IoctlCodeSym(ULONG ControlCode)
     SYM(FSP_FSCTL_VOLUME_NAME)
     SYM(FSP_FSCTL_TRANSACT)
     SYM(FSP_FSCTL_TRANSACT_BATCH)
+    SYM(FSP_FSCTL_TRANSACT_RING_SETUP)
+    SYM(FSP_FSCTL_TRANSACT_RING)
     SYM(FSP_FSCTL_STOP)
     SYM(FSP_FSCTL_WORK)
     SYM(FSP_FSCTL_WORK_BEST_EFFORT)
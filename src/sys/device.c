@@ -43,6 +43,7 @@ VOID FspFsvolDeviceFileRenameRelease(PDEVICE_OBJECT DeviceObject);
 VOID FspFsvolDeviceFileRenameReleaseOwner(PDEVICE_OBJECT DeviceObject, PVOID Owner);
 BOOLEAN FspFsvolDeviceFileRenameIsAcquiredExclusive(PDEVICE_OBJECT DeviceObject);
 VOID FspFsvolDeviceLockContextTable(PDEVICE_OBJECT DeviceObject);
+VOID FspFsvolDeviceLockContextTableShared(PDEVICE_OBJECT DeviceObject);
 VOID FspFsvolDeviceUnlockContextTable(PDEVICE_OBJECT DeviceObject);
 NTSTATUS FspFsvolDeviceCopyContextList(PDEVICE_OBJECT DeviceObject,
     PVOID **PContexts, PULONG PContextCount);
@@ -51,14 +52,35 @@ NTSTATUS FspFsvolDeviceCopyContextByNameList(PDEVICE_OBJECT DeviceObject,
 VOID FspFsvolDeviceDeleteContextList(PVOID *Contexts, ULONG ContextCount);
 PVOID FspFsvolDeviceEnumerateContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
     BOOLEAN NextFlag, FSP_DEVICE_CONTEXT_BY_NAME_TABLE_RESTART_KEY *RestartKey);
-PVOID FspFsvolDeviceLookupContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
-PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName, PVOID Context,
+ULONG FspFsvolDeviceHashContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
+PVOID FspFsvolDeviceLookupContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG FileNameHash);
+PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG FileNameHash, PVOID Context,
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT *ElementStorage, PBOOLEAN PInserted);
 VOID FspFsvolDeviceDeleteContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
-    PBOOLEAN PDeleted);
+    ULONG FileNameHash, PBOOLEAN PDeleted);
+static FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **FspFsvolDeviceFindContextByNameBucketLink(
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension, PUNICODE_STRING FileName, ULONG FileNameHash);
+static VOID FspFsvolDeviceResizeContextByNameBuckets(
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension, ULONG BucketCount);
 static RTL_AVL_COMPARE_ROUTINE FspFsvolDeviceCompareContextByName;
 static RTL_AVL_ALLOCATE_ROUTINE FspFsvolDeviceAllocateContextByName;
 static RTL_AVL_FREE_ROUTINE FspFsvolDeviceFreeContextByName;
+BOOLEAN FspFsvolDeviceLookupNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    PULONG PGeneration);
+VOID FspFsvolDeviceInsertNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG Generation);
+VOID FspFsvolDeviceInvalidateNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    BOOLEAN Subtree);
+VOID FspFsvolDeviceInvalidateExpiredNegativeNames(PDEVICE_OBJECT DeviceObject, UINT64 ExpirationTime);
+VOID FspFsvolDeviceGetNegativeNameStatistics(PDEVICE_OBJECT DeviceObject,
+    FSP_FSCTL_NEGATIVE_NAME_CACHE_STATISTICS *Statistics);
+static VOID FspFsvolDeviceDeleteNegativeName(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA *Element);
+static RTL_AVL_COMPARE_ROUTINE FspFsvolDeviceCompareNegativeName;
+static RTL_AVL_ALLOCATE_ROUTINE FspFsvolDeviceAllocateNegativeName;
+static RTL_AVL_FREE_ROUTINE FspFsvolDeviceFreeNegativeName;
 VOID FspFsvolDeviceGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 BOOLEAN FspFsvolDeviceTryGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 VOID FspFsvolDeviceSetVolumeInfo(PDEVICE_OBJECT DeviceObject, const FSP_FSCTL_VOLUME_INFO *VolumeInfo);
@@ -83,17 +105,30 @@ VOID FspDeviceDeleteAll(VOID);
 #pragma alloc_text(PAGE, FspFsvolDeviceFileRenameReleaseOwner)
 #pragma alloc_text(PAGE, FspFsvolDeviceFileRenameIsAcquiredExclusive)
 #pragma alloc_text(PAGE, FspFsvolDeviceLockContextTable)
+#pragma alloc_text(PAGE, FspFsvolDeviceLockContextTableShared)
 #pragma alloc_text(PAGE, FspFsvolDeviceUnlockContextTable)
 #pragma alloc_text(PAGE, FspFsvolDeviceCopyContextList)
 #pragma alloc_text(PAGE, FspFsvolDeviceCopyContextByNameList)
 #pragma alloc_text(PAGE, FspFsvolDeviceDeleteContextList)
 #pragma alloc_text(PAGE, FspFsvolDeviceEnumerateContextByName)
+#pragma alloc_text(PAGE, FspFsvolDeviceHashContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceLookupContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceInsertContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceDeleteContextByName)
+#pragma alloc_text(PAGE, FspFsvolDeviceFindContextByNameBucketLink)
+#pragma alloc_text(PAGE, FspFsvolDeviceResizeContextByNameBuckets)
 #pragma alloc_text(PAGE, FspFsvolDeviceCompareContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceAllocateContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceFreeContextByName)
+#pragma alloc_text(PAGE, FspFsvolDeviceLookupNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceInsertNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceInvalidateNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceInvalidateExpiredNegativeNames)
+#pragma alloc_text(PAGE, FspFsvolDeviceGetNegativeNameStatistics)
+#pragma alloc_text(PAGE, FspFsvolDeviceDeleteNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceCompareNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceAllocateNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceFreeNegativeName)
 #pragma alloc_text(PAGE, FspDeviceCopyList)
 #pragma alloc_text(PAGE, FspDeviceDeleteList)
 #pragma alloc_text(PAGE, FspDeviceDeleteAll)
@@ -336,17 +371,25 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     SecurityTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceSecurityCacheCapacity, FspFsvolDeviceSecurityCacheItemSizeMax, &SecurityTimeout,
+        FsvolDeviceExtension->VolumeParams.SecurityCacheCapacity,
+        FspFsvolDeviceSecurityCacheItemSizeMax, &SecurityTimeout, 0,
         &FsvolDeviceExtension->SecurityCache);
     if (!NT_SUCCESS(Result))
         return Result;
     FsvolDeviceExtension->InitDoneSec = 1;
 
-    /* create our directory meta cache */
+    /*
+     * Create our directory meta cache. Its items are FSP_DIR_INFO_CHUNKS indexes that
+     * reference the actual directory listing chunks. A listing is limited to
+     * DirInfoCacheSizeMax bytes when it is built (see dirctl.c); the index itself is
+     * always much smaller than that.
+     */
     DirInfoTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceDirInfoCacheCapacity, FspFsvolDeviceDirInfoCacheItemSizeMax, &DirInfoTimeout,
+        FsvolDeviceExtension->VolumeParams.DirInfoCacheCapacity,
+        FsvolDeviceExtension->VolumeParams.DirInfoCacheSizeMax, &DirInfoTimeout,
+        FspDirInfoChunksFini,
         &FsvolDeviceExtension->DirInfoCache);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -356,7 +399,8 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     StreamInfoTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceStreamInfoCacheCapacity, FspFsvolDeviceStreamInfoCacheItemSizeMax, &StreamInfoTimeout,
+        FsvolDeviceExtension->VolumeParams.StreamInfoCacheCapacity,
+        FspFsvolDeviceStreamInfoCacheItemSizeMax, &StreamInfoTimeout, 0,
         &FsvolDeviceExtension->StreamInfoCache);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -376,6 +420,13 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     FsvolDeviceExtension->InitDoneStat = 1;
 
     /* initialize our context table */
+    FsvolDeviceExtension->ContextByNameBuckets = FspAlloc(
+        FspFsvolDeviceContextByNameBucketCountMin * sizeof FsvolDeviceExtension->ContextByNameBuckets[0]);
+    if (0 == FsvolDeviceExtension->ContextByNameBuckets)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(FsvolDeviceExtension->ContextByNameBuckets,
+        FspFsvolDeviceContextByNameBucketCountMin * sizeof FsvolDeviceExtension->ContextByNameBuckets[0]);
+    FsvolDeviceExtension->ContextByNameBucketCount = FspFsvolDeviceContextByNameBucketCountMin;
     ExInitializeResourceLite(&FsvolDeviceExtension->FileRenameResource);
     ExInitializeResourceLite(&FsvolDeviceExtension->ContextTableResource);
     InitializeListHead(&FsvolDeviceExtension->ContextList);
@@ -386,6 +437,16 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
         0);
     FsvolDeviceExtension->InitDoneCtxTab = 1;
 
+    /* initialize our negative name cache */
+    ExInitializeResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+    InitializeListHead(&FsvolDeviceExtension->NegativeNameList);
+    RtlInitializeGenericTableAvl(&FsvolDeviceExtension->NegativeNameTable,
+        FspFsvolDeviceCompareNegativeName,
+        FspFsvolDeviceAllocateNegativeName,
+        FspFsvolDeviceFreeNegativeName,
+        0);
+    FsvolDeviceExtension->InitDoneNegTab = 1;
+
     /* initialize our timer routine and start our expiration timer */
 #pragma prefast(suppress:28133, "We are a filesystem: we do not have AddDevice")
     Result = IoInitializeTimer(DeviceObject, FspFsvolDeviceTimerRoutine, 0);
@@ -397,6 +458,12 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     IoStartTimer(DeviceObject);
     FsvolDeviceExtension->InitDoneTimer = 1;
 
+    /* initialize close batching */
+    FspFsvolCloseBatchInit(DeviceObject);
+
+    /* initialize the delayed-close cache */
+    FspFsvolCloseCacheInit(DeviceObject);
+
     /* initialize the volume information */
     KeInitializeSpinLock(&FsvolDeviceExtension->InfoSpinLock);
     FsvolDeviceExtension->InitDoneInfo = 1;
@@ -420,6 +487,9 @@ static VOID FspFsvolDeviceFini(PDEVICE_OBJECT DeviceObject)
     if (FsvolDeviceExtension->InitDoneTimer)
         IoStopTimer(DeviceObject);
 
+    /* delete any Close batch that was never posted */
+    FspFsvolCloseBatchFini(DeviceObject);
+
     /* delete the file system statistics */
     if (FsvolDeviceExtension->InitDoneStat)
         FspStatisticsDelete(FsvolDeviceExtension->Statistics);
@@ -448,6 +518,16 @@ static VOID FspFsvolDeviceFini(PDEVICE_OBJECT DeviceObject)
     if (FsvolDeviceExtension->InitDoneIoq)
         FspIoqDelete(FsvolDeviceExtension->Ioq);
 
+    /* delete the negative name cache */
+    if (FsvolDeviceExtension->InitDoneNegTab)
+    {
+        while (!IsListEmpty(&FsvolDeviceExtension->NegativeNameList))
+            FspFsvolDeviceDeleteNegativeName(FsvolDeviceExtension,
+                CONTAINING_RECORD(FsvolDeviceExtension->NegativeNameList.Flink,
+                    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA, ListEntry));
+        ExDeleteResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+    }
+
     if (FsvolDeviceExtension->InitDoneCtxTab)
     {
         /*
@@ -459,6 +539,10 @@ static VOID FspFsvolDeviceFini(PDEVICE_OBJECT DeviceObject)
         ExDeleteResourceLite(&FsvolDeviceExtension->FileRenameResource);
     }
 
+    /* the context table buckets are allocated before InitDoneCtxTab is set */
+    if (0 != FsvolDeviceExtension->ContextByNameBuckets)
+        FspFree(FsvolDeviceExtension->ContextByNameBuckets);
+
     /* is there a virtual disk? */
     if (FsvolDeviceExtension->InitDoneFsvrt)
     {
@@ -515,6 +599,8 @@ static VOID FspFsvolDeviceExpirationRoutine(PVOID Context)
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->SecurityCache, InterruptTime);
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->DirInfoCache, InterruptTime);
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->StreamInfoCache, InterruptTime);
+    FspFsvolDeviceInvalidateExpiredNegativeNames(DeviceObject, InterruptTime);
+    FspFsvolCloseCacheEvictExpired(DeviceObject, InterruptTime);
     FspIoqRemoveExpired(FsvolDeviceExtension->Ioq, InterruptTime);
 
     KeAcquireSpinLock(&FsvolDeviceExtension->ExpirationLock, &Irql);
@@ -593,6 +679,21 @@ VOID FspFsvolDeviceLockContextTable(PDEVICE_OBJECT DeviceObject)
     ExAcquireResourceExclusiveLite(&FsvolDeviceExtension->ContextTableResource, TRUE);
 }
 
+VOID FspFsvolDeviceLockContextTableShared(PDEVICE_OBJECT DeviceObject)
+{
+    /*
+     * A shared lock may only be used for read-only access: name lookups, reading
+     * fields that are locked under the ContextTableResource, walking the ContextList.
+     * Enumerating the ContextByNameTable modifies its RestartKey and requires
+     * an exclusive lock.
+     */
+
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    ExAcquireResourceSharedLite(&FsvolDeviceExtension->ContextTableResource, TRUE);
+}
+
 VOID FspFsvolDeviceUnlockContextTable(PDEVICE_OBJECT DeviceObject)
 {
     PAGED_CODE();
@@ -711,54 +812,185 @@ PVOID FspFsvolDeviceEnumerateContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE
         return 0;
 }
 
-PVOID FspFsvolDeviceLookupContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName)
+/*
+ * The ContextByNameTable is kept in two indexes over the same elements:
+ *
+ * - An ordered (AVL) table. FspFsvolDeviceEnumerateContextByName walks it from a name to
+ * find the streams and descendants of a file (on overwrite, delete and rename, and when
+ * checking for open streams or children with handles). Names below a directory are
+ * contiguous in it, so a walk costs O(log n) plus the number of names it returns. Any
+ * unordered structure would need a scan of every open file instead, and a tree keyed by
+ * path component would need an allocation per component.
+ *
+ * - A hash index (ContextByNameBuckets). Exact lookups use only the hash, which replaces
+ * O(log n) name comparisons with usually one. Lookups happen on every open of a file that
+ * is already open and on every delayed-close cache probe, so they far outnumber inserts
+ * and deletes.
+ *
+ * The cost of keeping both is paid only when a name enters or leaves the table, i.e. on
+ * the first open and the last close of a file: the O(log n) AVL insert or delete plus an
+ * O(1) bucket link. Each element costs one pointer and one ULONG more, and there is at
+ * most one bucket per element.
+ */
+
+ULONG FspFsvolDeviceHashContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    BOOLEAN CaseInsensitive = 0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch;
+
+    return FspFileNameHash(FileName, CaseInsensitive);
+}
+
+PVOID FspFsvolDeviceLookupContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG FileNameHash)
 {
     PAGED_CODE();
 
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA *Result;
 
-    Result = RtlLookupElementGenericTableAvl(&FsvolDeviceExtension->ContextByNameTable, &FileName);
+    Result = *FspFsvolDeviceFindContextByNameBucketLink(FsvolDeviceExtension, FileName, FileNameHash);
 
     return 0 != Result ? Result->Context : 0;
 }
 
-PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName, PVOID Context,
+PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG FileNameHash, PVOID Context,
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT *ElementStorage, PBOOLEAN PInserted)
 {
     PAGED_CODE();
 
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
-    FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA *Result, Element = { 0 };
+    FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **Link, *Result, Element = { 0 };
+    ULONG ElementCount;
+    BOOLEAN Inserted;
 
     ASSERT(0 != ElementStorage);
+    ASSERT(FspFsvolDeviceHashContextByName(DeviceObject, FileName) == FileNameHash);
+
+    /* fast path: the name is already in the table */
+    Link = FspFsvolDeviceFindContextByNameBucketLink(FsvolDeviceExtension, FileName, FileNameHash);
+    if (0 != *Link)
+    {
+        if (0 != PInserted)
+            *PInserted = FALSE;
+        return (*Link)->Context;
+    }
+
     Element.FileName = FileName;
     Element.Context = Context;
+    Element.FileNameHash = FileNameHash;
 
     FsvolDeviceExtension->ContextByNameTableElementStorage = ElementStorage;
     Result = RtlInsertElementGenericTableAvl(&FsvolDeviceExtension->ContextByNameTable,
-        &Element, sizeof Element, PInserted);
+        &Element, sizeof Element, &Inserted);
     FsvolDeviceExtension->ContextByNameTableElementStorage = 0;
 
     ASSERT(0 != Result);
+    ASSERT(Inserted);
+
+    /* Link points to the (empty) tail of the name's bucket chain */
+    Result->HashNext = 0;
+    *Link = Result;
+
+    ElementCount = RtlNumberGenericTableElementsAvl(&FsvolDeviceExtension->ContextByNameTable);
+    if (ElementCount > FsvolDeviceExtension->ContextByNameBucketCount)
+        FspFsvolDeviceResizeContextByNameBuckets(FsvolDeviceExtension,
+            2 * FsvolDeviceExtension->ContextByNameBucketCount);
+
+    if (0 != PInserted)
+        *PInserted = Inserted;
 
     return Result->Context;
 }
 
 VOID FspFsvolDeviceDeleteContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
-    PBOOLEAN PDeleted)
+    ULONG FileNameHash, PBOOLEAN PDeleted)
 {
     PAGED_CODE();
 
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
-    BOOLEAN Deleted;
+    FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **Link;
+    ULONG ElementCount;
+    BOOLEAN Deleted = FALSE;
+
+    ASSERT(FspFsvolDeviceHashContextByName(DeviceObject, FileName) == FileNameHash);
 
-    Deleted = RtlDeleteElementGenericTableAvl(&FsvolDeviceExtension->ContextByNameTable, &FileName);
+    Link = FspFsvolDeviceFindContextByNameBucketLink(FsvolDeviceExtension, FileName, FileNameHash);
+    if (0 != *Link)
+    {
+        *Link = (*Link)->HashNext;
+
+        Deleted = RtlDeleteElementGenericTableAvl(&FsvolDeviceExtension->ContextByNameTable, &FileName);
+        ASSERT(Deleted);
+
+        ElementCount = RtlNumberGenericTableElementsAvl(&FsvolDeviceExtension->ContextByNameTable);
+        if (FspFsvolDeviceContextByNameBucketCountMin < FsvolDeviceExtension->ContextByNameBucketCount &&
+            ElementCount < FsvolDeviceExtension->ContextByNameBucketCount / 8)
+            FspFsvolDeviceResizeContextByNameBuckets(FsvolDeviceExtension,
+                FsvolDeviceExtension->ContextByNameBucketCount / 2);
+    }
 
     if (0 != PDeleted)
         *PDeleted = Deleted;
 }
 
+static FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **FspFsvolDeviceFindContextByNameBucketLink(
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension, PUNICODE_STRING FileName, ULONG FileNameHash)
+{
+    /*
+     * Return the link that points to the element with FileName or the (null) link
+     * at the end of its bucket chain if there is no such element.
+     */
+
+    PAGED_CODE();
+
+    BOOLEAN CaseInsensitive = 0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch;
+    FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **Link, *Data;
+
+    Link = &FsvolDeviceExtension->ContextByNameBuckets[
+        FileNameHash & (FsvolDeviceExtension->ContextByNameBucketCount - 1)];
+    for (; 0 != (Data = *Link); Link = &Data->HashNext)
+        if (FileNameHash == Data->FileNameHash &&
+            FileName->Length == Data->FileName->Length &&
+            0 == FspFileNameCompare(FileName, Data->FileName, CaseInsensitive, 0))
+            break;
+
+    return Link;
+}
+
+static VOID FspFsvolDeviceResizeContextByNameBuckets(
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension, ULONG BucketCount)
+{
+    PAGED_CODE();
+
+    FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **Buckets, *Data, *NextData;
+    ULONG Index, NewIndex;
+
+    ASSERT(0 == (BucketCount & (BucketCount - 1)));
+
+    /* resizing is an optimization; on allocation failure keep the current buckets */
+    Buckets = FspAlloc(BucketCount * sizeof Buckets[0]);
+    if (0 == Buckets)
+        return;
+    RtlZeroMemory(Buckets, BucketCount * sizeof Buckets[0]);
+
+    for (Index = 0; FsvolDeviceExtension->ContextByNameBucketCount > Index; Index++)
+        for (Data = FsvolDeviceExtension->ContextByNameBuckets[Index]; 0 != Data; Data = NextData)
+        {
+            NextData = Data->HashNext;
+            NewIndex = Data->FileNameHash & (BucketCount - 1);
+            Data->HashNext = Buckets[NewIndex];
+            Buckets[NewIndex] = Data;
+        }
+
+    FspFree(FsvolDeviceExtension->ContextByNameBuckets);
+    FsvolDeviceExtension->ContextByNameBuckets = Buckets;
+    FsvolDeviceExtension->ContextByNameBucketCount = BucketCount;
+}
+
 static RTL_GENERIC_COMPARE_RESULTS NTAPI FspFsvolDeviceCompareContextByName(
     PRTL_AVL_TABLE Table, PVOID FirstElement, PVOID SecondElement)
 {
@@ -806,6 +1038,280 @@ static VOID NTAPI FspFsvolDeviceFreeContextByName(
     PAGED_CODE();
 }
 
+/*
+ * The negative name cache remembers file names that the user mode file system
+ * has reported as STATUS_OBJECT_NAME_NOT_FOUND, so that repeated opens of the
+ * same nonexistent name can be completed without a round trip to user mode.
+ * Entries expire after FileInfoTimeout and are invalidated whenever a name
+ * may come into existence (create, rename, set/delete reparse point).
+ *
+ * Inserts are tagged with the NegativeNameGeneration observed at lookup time;
+ * any invalidation bumps the generation so that a miss that raced with a create
+ * cannot (re)insert a stale entry.
+ *
+ * The cache holds up to VolumeParams.NegativeNameCacheCapacity entries; its
+ * counters are reported by FSCTL_FILESYSTEM_GET_STATISTICS.
+ */
+
+BOOLEAN FspFsvolDeviceLookupNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    PULONG PGeneration)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA *Element;
+    BOOLEAN Result;
+
+    *PGeneration = 0;
+
+    if (0 == FsvolDeviceExtension->VolumeParams.FileInfoTimeout)
+        return FALSE;
+
+    ExAcquireResourceSharedLite(&FsvolDeviceExtension->NegativeNameResource, TRUE);
+    Element = RtlLookupElementGenericTableAvl(&FsvolDeviceExtension->NegativeNameTable, &FileName);
+    Result = 0 != Element && FspExpirationTimeValid(Element->ExpirationTime);
+    *PGeneration = FsvolDeviceExtension->NegativeNameGeneration;
+    ExReleaseResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+
+    InterlockedIncrement64(Result ?
+        &FsvolDeviceExtension->NegativeNameHitCount :
+        &FsvolDeviceExtension->NegativeNameMissCount);
+
+    return Result;
+}
+
+VOID FspFsvolDeviceInsertNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG Generation)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT *ElementStorage;
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA *Result, Element = { 0 };
+    BOOLEAN Inserted;
+
+    if (0 == FsvolDeviceExtension->VolumeParams.FileInfoTimeout)
+        return;
+
+    /* the negative name cache is best effort; silently ignore allocation failures */
+    ElementStorage = FspAlloc(sizeof *ElementStorage + FileName->Length);
+    if (0 == ElementStorage)
+        return;
+
+    ElementStorage->FileName.Length = ElementStorage->FileName.MaximumLength = FileName->Length;
+    ElementStorage->FileName.Buffer = ElementStorage->FileNameBuf;
+    RtlCopyMemory(ElementStorage->FileNameBuf, FileName->Buffer, FileName->Length);
+    Element.FileName = &ElementStorage->FileName;
+    Element.ExpirationTime = FspExpirationTimeFromMillis(
+        FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
+
+    ExAcquireResourceExclusiveLite(&FsvolDeviceExtension->NegativeNameResource, TRUE);
+
+    if (Generation != FsvolDeviceExtension->NegativeNameGeneration)
+    {
+        ExReleaseResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+        FspFree(ElementStorage);
+        return;
+    }
+
+    FsvolDeviceExtension->NegativeNameTableElementStorage = ElementStorage;
+    Result = RtlInsertElementGenericTableAvl(&FsvolDeviceExtension->NegativeNameTable,
+        &Element, sizeof Element, &Inserted);
+    FsvolDeviceExtension->NegativeNameTableElementStorage = 0;
+
+    ASSERT(0 != Result);
+
+    if (Inserted)
+    {
+        InsertTailList(&FsvolDeviceExtension->NegativeNameList, &Result->ListEntry);
+        FsvolDeviceExtension->NegativeNameInsertCount++;
+
+        /* all entries share the same timeout, so the list head is the oldest entry */
+        if (FsvolDeviceExtension->VolumeParams.NegativeNameCacheCapacity <
+            RtlNumberGenericTableElementsAvl(&FsvolDeviceExtension->NegativeNameTable))
+        {
+            FspFsvolDeviceDeleteNegativeName(FsvolDeviceExtension,
+                CONTAINING_RECORD(FsvolDeviceExtension->NegativeNameList.Flink,
+                    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA, ListEntry));
+            FsvolDeviceExtension->NegativeNameEvictionCount++;
+        }
+    }
+    else
+    {
+        FspFree(ElementStorage);
+
+        Result->ExpirationTime = Element.ExpirationTime;
+        RemoveEntryList(&Result->ListEntry);
+        InsertTailList(&FsvolDeviceExtension->NegativeNameList, &Result->ListEntry);
+    }
+
+    ExReleaseResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+}
+
+VOID FspFsvolDeviceInvalidateNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    BOOLEAN Subtree)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    BOOLEAN CaseInsensitive = 0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch;
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA *Element;
+    PLIST_ENTRY ListEntry, NextEntry;
+    WCHAR Separator;
+
+    if (0 == FsvolDeviceExtension->VolumeParams.FileInfoTimeout)
+        return;
+
+    ExAcquireResourceExclusiveLite(&FsvolDeviceExtension->NegativeNameResource, TRUE);
+
+    FsvolDeviceExtension->NegativeNameGeneration++;
+
+    if (!Subtree)
+    {
+        Element = RtlLookupElementGenericTableAvl(&FsvolDeviceExtension->NegativeNameTable, &FileName);
+        if (0 != Element)
+        {
+            FspFsvolDeviceDeleteNegativeName(FsvolDeviceExtension, Element);
+            FsvolDeviceExtension->NegativeNameInvalidateCount++;
+        }
+    }
+    else
+    {
+        /*
+         * Subtree invalidations are rare (rename, reparse points) and the cache is bounded,
+         * so simply scan all entries for FileName itself and names below it.
+         */
+        for (ListEntry = FsvolDeviceExtension->NegativeNameList.Flink;
+            &FsvolDeviceExtension->NegativeNameList != ListEntry;
+            ListEntry = NextEntry)
+        {
+            NextEntry = ListEntry->Flink;
+            Element = CONTAINING_RECORD(ListEntry, FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA, ListEntry);
+
+            if (!FspFileNameIsPrefix(FileName, Element->FileName, CaseInsensitive, 0))
+                continue;
+
+            if (sizeof(WCHAR) < FileName->Length &&
+                FileName->Length < Element->FileName->Length)
+            {
+                Separator = Element->FileName->Buffer[FileName->Length / sizeof(WCHAR)];
+                if (L'\\' != Separator && L':' != Separator)
+                    continue;
+            }
+
+            FspFsvolDeviceDeleteNegativeName(FsvolDeviceExtension, Element);
+            FsvolDeviceExtension->NegativeNameInvalidateCount++;
+        }
+    }
+
+    ExReleaseResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+}
+
+VOID FspFsvolDeviceInvalidateExpiredNegativeNames(PDEVICE_OBJECT DeviceObject, UINT64 ExpirationTime)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA *Element;
+
+    if (0 == FsvolDeviceExtension->VolumeParams.FileInfoTimeout)
+        return;
+
+    /* we are called from a system worker thread; disable APC's while holding the resource */
+    FsRtlEnterFileSystem();
+    ExAcquireResourceExclusiveLite(&FsvolDeviceExtension->NegativeNameResource, TRUE);
+
+    /* all entries share the same timeout, so the list is ordered by expiration time */
+    while (!IsListEmpty(&FsvolDeviceExtension->NegativeNameList))
+    {
+        Element = CONTAINING_RECORD(FsvolDeviceExtension->NegativeNameList.Flink,
+            FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA, ListEntry);
+        if (FspExpirationTimeValidEx(Element->ExpirationTime, ExpirationTime))
+            break;
+
+        FspFsvolDeviceDeleteNegativeName(FsvolDeviceExtension, Element);
+    }
+
+    ExReleaseResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+    FsRtlExitFileSystem();
+}
+
+VOID FspFsvolDeviceGetNegativeNameStatistics(PDEVICE_OBJECT DeviceObject,
+    FSP_FSCTL_NEGATIVE_NAME_CACHE_STATISTICS *Statistics)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+
+    ExAcquireResourceSharedLite(&FsvolDeviceExtension->NegativeNameResource, TRUE);
+    Statistics->ItemCount = RtlNumberGenericTableElementsAvl(&FsvolDeviceExtension->NegativeNameTable);
+    Statistics->Inserts = FsvolDeviceExtension->NegativeNameInsertCount;
+    Statistics->Evictions = FsvolDeviceExtension->NegativeNameEvictionCount;
+    Statistics->Invalidations = FsvolDeviceExtension->NegativeNameInvalidateCount;
+    ExReleaseResourceLite(&FsvolDeviceExtension->NegativeNameResource);
+
+    Statistics->Hits = FsvolDeviceExtension->NegativeNameHitCount;
+    Statistics->Misses = FsvolDeviceExtension->NegativeNameMissCount;
+}
+
+static VOID FspFsvolDeviceDeleteNegativeName(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA *Element)
+{
+    PAGED_CODE();
+
+    BOOLEAN Deleted;
+
+    RemoveEntryList(&Element->ListEntry);
+
+    /* the first field of Element is the PUNICODE_STRING key expected by the compare routine */
+    Deleted = RtlDeleteElementGenericTableAvl(&FsvolDeviceExtension->NegativeNameTable, Element);
+    ASSERT(Deleted);
+}
+
+static RTL_GENERIC_COMPARE_RESULTS NTAPI FspFsvolDeviceCompareNegativeName(
+    PRTL_AVL_TABLE Table, PVOID FirstElement, PVOID SecondElement)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension =
+        CONTAINING_RECORD(Table, FSP_FSVOL_DEVICE_EXTENSION, NegativeNameTable);
+    BOOLEAN CaseInsensitive = 0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch;
+    PUNICODE_STRING FirstFileName = *(PUNICODE_STRING *)FirstElement;
+    PUNICODE_STRING SecondFileName = *(PUNICODE_STRING *)SecondElement;
+    LONG ComparisonResult;
+
+    ComparisonResult = FspFileNameCompare(FirstFileName, SecondFileName, CaseInsensitive, 0);
+
+    if (0 > ComparisonResult)
+        return GenericLessThan;
+    else
+    if (0 < ComparisonResult)
+        return GenericGreaterThan;
+    else
+        return GenericEqual;
+}
+
+static PVOID NTAPI FspFsvolDeviceAllocateNegativeName(
+    PRTL_AVL_TABLE Table, CLONG ByteSize)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension =
+        CONTAINING_RECORD(Table, FSP_FSVOL_DEVICE_EXTENSION, NegativeNameTable);
+
+    ASSERT(FIELD_OFFSET(FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT, FileName) == ByteSize);
+
+    return FsvolDeviceExtension->NegativeNameTableElementStorage;
+}
+
+static VOID NTAPI FspFsvolDeviceFreeNegativeName(
+    PRTL_AVL_TABLE Table, PVOID Buffer)
+{
+    PAGED_CODE();
+
+    FspFree(Buffer);
+}
+
 VOID FspFsvolDeviceGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo)
 {
     // !PAGED_CODE();
@@ -26,22 +26,38 @@
  * Irp->AssociatedIrp.SystemBuffer) we should also revisit FspIopCompleteIrpEx.
  */
 
+static NTSTATUS FspDirInfoChunkCreate(PCVOID Buffer, ULONG Size,
+    FSP_DIR_INFO_CHUNK **PChunk, PBOOLEAN PComplete);
+static NTSTATUS FspDirInfoChunksCreate(FSP_DIR_INFO_CHUNKS *PrevDirInfoChunks,
+    PCVOID Buffer, ULONG Size, ULONG SizeMax, UINT32 Timeout,
+    FSP_DIR_INFO_CHUNKS **PDirInfoChunks, PULONG PDirInfoChunksSize);
+FSP_META_CACHE_ITEM_FINI FspDirInfoChunksFini;
 static NTSTATUS FspFsvolQueryDirectoryCopy(
-    PUNICODE_STRING DirectoryPattern, BOOLEAN CaseInsensitive,
+    FSP_FILE_NAME_PATTERN *DirectoryPattern, BOOLEAN CaseInsensitive,
     PUNICODE_STRING DirectoryMarker, PUNICODE_STRING DirectoryMarkerOut,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
-    FSP_FSCTL_DIR_INFO **PDirInfo, ULONG DirInfoSize,
+    FSP_DIR_INFO_CHUNK **Chunks, ULONG ChunkCount, PULONG PChunkIndex,
+    FSP_FSCTL_DIR_INFO **PDirInfo,
     PVOID DestBuf, PULONG PDestLen);
+static BOOLEAN FspFsvolQueryDirectorySeek(
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks,
+    PUNICODE_STRING DirectoryMarker, BOOLEAN CaseInsensitive,
+    PULONG PChunkIndex, PULONG PChunkOffset);
 static NTSTATUS FspFsvolQueryDirectoryCopyCache(
     FSP_FILE_DESC *FileDesc, BOOLEAN ResetCache,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
-    FSP_FSCTL_DIR_INFO *DirInfo, ULONG DirInfoSize,
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks,
     PVOID DestBuf, PULONG PDestLen);
 static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
     FSP_FILE_DESC *FileDesc,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
     FSP_FSCTL_DIR_INFO *DirInfo, ULONG DirInfoSize,
     PVOID DestBuf, PULONG PDestLen);
+static BOOLEAN FspFsvolQueryDirectoryReferenceDirInfo(FSP_FILE_NODE *FileNode,
+    FSP_DIR_INFO_CHUNKS **PDirInfoChunks);
+static BOOLEAN FspFsvolQueryDirectoryTrySetDirInfo(FSP_FILE_DESC *FileDesc,
+    PUNICODE_STRING DirectoryMarker, PVOID Buffer, ULONG Size,
+    ULONG DirInfoChangeNumber);
 static NTSTATUS FspFsvolQueryDirectoryRetry(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp,
     BOOLEAN CanWait);
@@ -59,9 +75,15 @@ static FSP_IOP_REQUEST_FINI FspFsvolQueryDirectoryRequestFini;
 FSP_DRIVER_DISPATCH FspDirectoryControl;
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FspDirInfoChunkCreate)
+#pragma alloc_text(PAGE, FspDirInfoChunksCreate)
+// !#pragma alloc_text(PAGE, FspDirInfoChunksFini)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryCopy)
+#pragma alloc_text(PAGE, FspFsvolQueryDirectorySeek)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryCopyCache)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryCopyInPlace)
+#pragma alloc_text(PAGE, FspFsvolQueryDirectoryReferenceDirInfo)
+#pragma alloc_text(PAGE, FspFsvolQueryDirectoryTrySetDirInfo)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryRetry)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectory)
 #pragma alloc_text(PAGE, FspFsvolNotifyChangeDirectory)
@@ -91,11 +113,183 @@ enum
 };
 FSP_FSCTL_STATIC_ASSERT(RequestCookie == RequestMdl, "");
 
+/*
+ * Directory listings are kept in the DirInfo meta cache as a chain of chunks. Each chunk
+ * holds the FSP_FSCTL_DIR_INFO entries of a single QueryDirectory response (up to
+ * FspFsvolDeviceDirInfoCacheChunkSize bytes) and the cache item is an FSP_DIR_INFO_CHUNKS
+ * index of chunk references. The first name of every chunk is recorded in the chunk, so
+ * that a marker can be located by a binary search over the chunks followed by a scan of
+ * a single chunk.
+ *
+ * The first response for a directory starts a new listing. When a handle reads past the
+ * end of a cached listing that is not complete, the response (that continues at the last
+ * name of the listing) is appended to it: a new index that references the existing chunks
+ * and the new chunk replaces the old one. A listing stops growing once it reaches the
+ * DirInfoCacheSizeMax volume parameter; the part of the directory past that point is then
+ * read from user mode on every query as before.
+ */
+
+static NTSTATUS FspDirInfoChunkCreate(PCVOID Buffer, ULONG Size,
+    FSP_DIR_INFO_CHUNK **PChunk, PBOOLEAN PComplete)
+{
+    PAGED_CODE();
+
+    FSP_DIR_INFO_CHUNK *Chunk;
+    FSP_FSCTL_DIR_INFO *DirInfo, *FirstDirInfo = 0, *LastDirInfo = 0;
+    PUINT8 DirInfoEnd;
+    ULONG DirInfoSize;
+    BOOLEAN Complete = FALSE;
+
+    *PChunk = 0;
+    *PComplete = FALSE;
+
+    Chunk = FspAlloc(sizeof *Chunk + Size);
+    if (0 == Chunk)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(Chunk, sizeof *Chunk);
+    Chunk->Buffer = Chunk->BufferStorage;
+    RtlCopyMemory(Chunk->Buffer, Buffer, Size);
+
+    /* keep only whole entries; the end-of-listing entry is recorded in the index instead */
+    DirInfoEnd = Chunk->Buffer + Size;
+    for (DirInfo = (PVOID)Chunk->Buffer;
+        (PUINT8)DirInfo + sizeof(DirInfo->Size) <= DirInfoEnd;
+        DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfoSize)))
+    {
+        DirInfoSize = DirInfo->Size;
+
+        if (sizeof(FSP_FSCTL_DIR_INFO) > DirInfoSize)
+        {
+            Complete = TRUE;
+            break;
+        }
+        if ((PUINT8)DirInfo + DirInfoSize > DirInfoEnd)
+            break;
+
+        if (0 == FirstDirInfo)
+            FirstDirInfo = DirInfo;
+        LastDirInfo = DirInfo;
+    }
+
+    *PComplete = Complete;
+
+    if (0 == LastDirInfo)
+    {
+        FspFree(Chunk);
+        return STATUS_SUCCESS;
+    }
+
+    Chunk->RefCount = 1;
+    Chunk->Size = (ULONG)((PUINT8)LastDirInfo + LastDirInfo->Size - Chunk->Buffer);
+    Chunk->FirstName.Length = Chunk->FirstName.MaximumLength =
+        (USHORT)(FirstDirInfo->Size - sizeof(FSP_FSCTL_DIR_INFO));
+    Chunk->FirstName.Buffer = FirstDirInfo->FileNameBuf;
+    Chunk->LastName.Length = Chunk->LastName.MaximumLength =
+        (USHORT)(LastDirInfo->Size - sizeof(FSP_FSCTL_DIR_INFO));
+    Chunk->LastName.Buffer = LastDirInfo->FileNameBuf;
+
+    *PChunk = Chunk;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS FspDirInfoChunksCreate(FSP_DIR_INFO_CHUNKS *PrevDirInfoChunks,
+    PCVOID Buffer, ULONG Size, ULONG SizeMax, UINT32 Timeout,
+    FSP_DIR_INFO_CHUNKS **PDirInfoChunks, PULONG PDirInfoChunksSize)
+{
+    PAGED_CODE();
+
+    NTSTATUS Result;
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks;
+    FSP_DIR_INFO_CHUNK *Chunk;
+    ULONG PrevChunkCount = 0 != PrevDirInfoChunks ? PrevDirInfoChunks->ChunkCount : 0;
+    ULONG PrevSize = 0 != PrevDirInfoChunks ? PrevDirInfoChunks->Size : 0;
+    ULONG DirInfoChunksSize;
+    BOOLEAN Complete;
+
+    *PDirInfoChunks = 0;
+    *PDirInfoChunksSize = 0;
+
+    Result = FspDirInfoChunkCreate(Buffer, Size, &Chunk, &Complete);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    if (0 == Chunk && (!Complete || 0 == PrevChunkCount))
+        /* nothing to cache; listings always have at least one chunk */
+        return STATUS_NO_MORE_FILES;
+
+    if (0 != Chunk && PrevSize + Chunk->Size > SizeMax)
+    {
+        FspFree(Chunk);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DirInfoChunksSize = FIELD_OFFSET(FSP_DIR_INFO_CHUNKS, Chunks) +
+        (PrevChunkCount + (0 != Chunk)) * sizeof(FSP_DIR_INFO_CHUNK *);
+    DirInfoChunks = FspAlloc(DirInfoChunksSize);
+    if (0 == DirInfoChunks)
+    {
+        if (0 != Chunk)
+            FspFree(Chunk);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DirInfoChunks->ExpirationTime = 0 != PrevDirInfoChunks ?
+        PrevDirInfoChunks->ExpirationTime : FspExpirationTimeFromMillis(Timeout);
+    DirInfoChunks->Size = PrevSize;
+    DirInfoChunks->Complete = Complete;
+    DirInfoChunks->ChunkCount = 0;
+    for (ULONG Index = 0; PrevChunkCount > Index; Index++)
+    {
+        InterlockedIncrement(&PrevDirInfoChunks->Chunks[Index]->RefCount);
+        DirInfoChunks->Chunks[DirInfoChunks->ChunkCount++] = PrevDirInfoChunks->Chunks[Index];
+    }
+    if (0 != Chunk)
+    {
+        DirInfoChunks->Size += Chunk->Size;
+        DirInfoChunks->Chunks[DirInfoChunks->ChunkCount++] = Chunk;
+    }
+
+    *PDirInfoChunks = DirInfoChunks;
+    *PDirInfoChunksSize = DirInfoChunksSize;
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspDirInfoChunksFini(PVOID Buffer, ULONG Size)
+{
+    // !PAGED_CODE();
+
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks = Buffer;
+
+    for (ULONG Index = 0; DirInfoChunks->ChunkCount > Index; Index++)
+        if (0 == InterlockedDecrement(&DirInfoChunks->Chunks[Index]->RefCount))
+            FspFree(DirInfoChunks->Chunks[Index]);
+}
+
+static inline BOOLEAN FspFsvolQueryDirectoryNextChunk(
+    FSP_DIR_INFO_CHUNK **Chunks, ULONG ChunkCount, PULONG PChunkIndex,
+    FSP_FSCTL_DIR_INFO **PDirInfo, PUINT8 *PDirInfoEnd)
+{
+    /* move to the next chunk once the current one has been exhausted */
+    while ((PUINT8)*PDirInfo + sizeof(UINT16) > *PDirInfoEnd)
+    {
+        if (ChunkCount <= *PChunkIndex + 1)
+            return FALSE;
+        ++*PChunkIndex;
+        *PDirInfo = (PVOID)Chunks[*PChunkIndex]->Buffer;
+        *PDirInfoEnd = Chunks[*PChunkIndex]->Buffer + Chunks[*PChunkIndex]->Size;
+    }
+    return TRUE;
+}
+
 static NTSTATUS FspFsvolQueryDirectoryCopy(
-    PUNICODE_STRING DirectoryPattern, BOOLEAN CaseInsensitive,
+    FSP_FILE_NAME_PATTERN *DirectoryPattern, BOOLEAN CaseInsensitive,
     PUNICODE_STRING DirectoryMarker, PUNICODE_STRING DirectoryMarkerOut,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
-    FSP_FSCTL_DIR_INFO **PDirInfo, ULONG DirInfoSize,
+    FSP_DIR_INFO_CHUNK **Chunks, ULONG ChunkCount, PULONG PChunkIndex,
+    FSP_FSCTL_DIR_INFO **PDirInfo,
     PVOID DestBuf, PULONG PDestLen)
 {
 #define FILL_INFO_BASE(TYPE, ...)\
@@ -126,10 +320,12 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
     PAGED_CODE();
 
     NTSTATUS Result = STATUS_SUCCESS;
-    BOOLEAN MatchAll = FspFileDescDirectoryPatternMatchAll == DirectoryPattern->Buffer, Match;
+    BOOLEAN MatchAll = FspFileNamePatternMatchAll == DirectoryPattern->Kind, Match;
     BOOLEAN Loop = TRUE, DirectoryMarkerFound = FALSE;
+    ULONG ChunkIndex = *PChunkIndex;
     FSP_FSCTL_DIR_INFO *DirInfo = *PDirInfo;
-    PUINT8 DirInfoEnd = (PUINT8)DirInfo + DirInfoSize;
+    PUINT8 DirInfoEnd = Chunks[ChunkIndex]->Buffer + Chunks[ChunkIndex]->Size;
+    ULONG DirInfoSize;
     PUINT8 DestBufBgn = (PUINT8)DestBuf;
     PUINT8 DestBufEnd = (PUINT8)DestBuf + *PDestLen;
     PVOID PrevDestBuf = 0;
@@ -165,7 +361,8 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
     try
     {
         for (;
-            Loop && (PUINT8)DirInfo + sizeof(DirInfo->Size) <= DirInfoEnd;
+            Loop && FspFsvolQueryDirectoryNextChunk(Chunks, ChunkCount, &ChunkIndex,
+                &DirInfo, &DirInfoEnd);
             DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfoSize)))
         {
             DirInfoSize = DirInfo->Size;
@@ -195,7 +392,7 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
             Match = MatchAll;
             if (!Match)
             {
-                Result = FspFileNameInExpression(DirectoryPattern, &FileName, CaseInsensitive, 0, &Match);
+                Result = FspFileNamePatternMatch(DirectoryPattern, &FileName, CaseInsensitive, &Match);
                 if (!NT_SUCCESS(Result))
                     return Result;
             }
@@ -290,6 +487,7 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
     /* our code flow should allow only these two status codes here */
     ASSERT(STATUS_SUCCESS == Result || STATUS_BUFFER_OVERFLOW == Result);
 
+    *PChunkIndex = ChunkIndex;
     *PDirInfo = DirInfo;
 
     return Result;
@@ -298,10 +496,82 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
 #undef FILL_INFO_BASE
 }
 
+static inline BOOLEAN FspFsvolQueryDirectorySeekChunk(FSP_DIR_INFO_CHUNK *Chunk,
+    PUNICODE_STRING DirectoryMarker, BOOLEAN CaseInsensitive,
+    PULONG PChunkOffset)
+{
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    PUINT8 DirInfoEnd = Chunk->Buffer + Chunk->Size;
+    UNICODE_STRING FileName;
+
+    for (DirInfo = (PVOID)Chunk->Buffer;
+        (PUINT8)DirInfo + sizeof(DirInfo->Size) <= DirInfoEnd;
+        DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)))
+    {
+        FileName.Length = FileName.MaximumLength =
+            (USHORT)(DirInfo->Size - sizeof(FSP_FSCTL_DIR_INFO));
+        FileName.Buffer = DirInfo->FileNameBuf;
+
+        if (0 == FspFileNameCompare(&FileName, DirectoryMarker, CaseInsensitive, 0))
+        {
+            *PChunkOffset = (ULONG)((PUINT8)DirInfo +
+                FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size) - Chunk->Buffer);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOLEAN FspFsvolQueryDirectorySeek(
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks,
+    PUNICODE_STRING DirectoryMarker, BOOLEAN CaseInsensitive,
+    PULONG PChunkIndex, PULONG PChunkOffset)
+{
+    PAGED_CODE();
+
+    ULONG Lo, Hi, Mid;
+
+    /* find the last chunk whose first name is not greater than the marker */
+    Lo = 0;
+    Hi = DirInfoChunks->ChunkCount;
+    while (Lo + 1 < Hi)
+    {
+        Mid = Lo + (Hi - Lo) / 2;
+        if (0 >= FspFileNameCompare(&DirInfoChunks->Chunks[Mid]->FirstName, DirectoryMarker,
+            CaseInsensitive, 0))
+            Lo = Mid;
+        else
+            Hi = Mid;
+    }
+
+    if (FspFsvolQueryDirectorySeekChunk(DirInfoChunks->Chunks[Lo],
+        DirectoryMarker, CaseInsensitive, PChunkOffset))
+    {
+        *PChunkIndex = Lo;
+        return TRUE;
+    }
+
+    /*
+     * File systems are not required to return directory entries in any particular order
+     * (let alone in the order of our comparison). If the marker is not in the chunk that
+     * we found, look for it in all other chunks.
+     */
+    for (ULONG Index = 0; DirInfoChunks->ChunkCount > Index; Index++)
+        if (Lo != Index && FspFsvolQueryDirectorySeekChunk(DirInfoChunks->Chunks[Index],
+            DirectoryMarker, CaseInsensitive, PChunkOffset))
+        {
+            *PChunkIndex = Index;
+            return TRUE;
+        }
+
+    return FALSE;
+}
+
 static NTSTATUS FspFsvolQueryDirectoryCopyCache(
     FSP_FILE_DESC *FileDesc, BOOLEAN ResetCache,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
-    FSP_FSCTL_DIR_INFO *DirInfo, ULONG DirInfoSize,
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks,
     PVOID DestBuf, PULONG PDestLen)
 {
     /* FileNode/FileDesc assumed acquired exclusive (Main or Full) */
@@ -310,25 +580,39 @@ static NTSTATUS FspFsvolQueryDirectoryCopyCache(
 
     FSP_FILE_NODE *FileNode = FileDesc->FileNode;
 
-    if (ResetCache || FileDesc->DirInfo != FileNode->NonPaged->DirInfo)
-        FileDesc->DirInfoCacheHint = 0; /* reset the DirInfo hint if anything looks fishy! */
+    if (ResetCache || FileDesc->DirInfo != FileNode->NonPaged->DirInfo ||
+        FileDesc->DirInfoCacheChunk >= DirInfoChunks->ChunkCount)
+    {
+        /* reset the DirInfo hint if anything looks fishy! */
+        FileDesc->DirInfoCacheChunk = 0;
+        FileDesc->DirInfoCacheHint = 0;
+    }
 
     FileDesc->DirInfo = FileNode->NonPaged->DirInfo;
 
     NTSTATUS Result;
     BOOLEAN CaseInsensitive = !FileDesc->CaseSensitive;
-    PUNICODE_STRING DirectoryPattern = &FileDesc->DirectoryPattern;
+    FSP_FILE_NAME_PATTERN *DirectoryPattern = &FileDesc->DirectoryPatternCompiled;
     UNICODE_STRING DirectoryMarker = FileDesc->DirectoryMarker;
-    PUINT8 DirInfoBgn = (PUINT8)DirInfo;
-    PUINT8 DirInfoEnd = (PUINT8)DirInfo + DirInfoSize;
+    ULONG ChunkIndex = FileDesc->DirInfoCacheChunk;
+    ULONG ChunkOffset = FileDesc->DirInfoCacheHint;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+
+    if (0 == ChunkIndex && 0 == ChunkOffset && 0 != FileDesc->DirectoryMarker.Buffer &&
+        !FspFsvolQueryDirectorySeek(DirInfoChunks, &FileDesc->DirectoryMarker, CaseInsensitive,
+            &ChunkIndex, &ChunkOffset))
+    {
+        /* marker not in the cached listing; let user mode continue from it */
+        *PDestLen = 0;
+        return STATUS_SUCCESS;
+    }
 
-    DirInfo = (PVOID)(DirInfoBgn + FileDesc->DirInfoCacheHint);
-    DirInfoSize = (ULONG)(DirInfoEnd - (PUINT8)DirInfo);
+    DirInfo = (PVOID)(DirInfoChunks->Chunks[ChunkIndex]->Buffer + ChunkOffset);
 
     Result = FspFsvolQueryDirectoryCopy(DirectoryPattern, CaseInsensitive,
-        0 != FileDesc->DirInfoCacheHint ? 0 : &FileDesc->DirectoryMarker, &DirectoryMarker,
+        0, &DirectoryMarker,
         FileInformationClass, ReturnSingleEntry,
-        &DirInfo, DirInfoSize,
+        DirInfoChunks->Chunks, DirInfoChunks->ChunkCount, &ChunkIndex, &DirInfo,
         DestBuf, PDestLen);
 
     if (NT_SUCCESS(Result))
@@ -338,10 +622,17 @@ static NTSTATUS FspFsvolQueryDirectoryCopyCache(
         {
             if (0 != *PDestLen)
                 FileDesc->DirectoryHasSuchFile = TRUE;
-            FileDesc->DirInfoCacheHint = (ULONG)((PUINT8)DirInfo - DirInfoBgn);
+            FileDesc->DirInfoCacheChunk = ChunkIndex;
+            FileDesc->DirInfoCacheHint =
+                (ULONG)((PUINT8)DirInfo - DirInfoChunks->Chunks[ChunkIndex]->Buffer);
+
+            /* a complete listing has no more entries past its end */
+            if (0 == *PDestLen && DirInfoChunks->Complete)
+                Result = STATUS_NO_MORE_FILES;
         }
     }
-    else if (STATUS_NO_MORE_FILES == Result && !FileDesc->DirectoryHasSuchFile)
+
+    if (STATUS_NO_MORE_FILES == Result && !FileDesc->DirectoryHasSuchFile)
         Result = STATUS_NO_SUCH_FILE;
 
     return Result;
@@ -359,8 +650,10 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
 
     NTSTATUS Result;
     BOOLEAN CaseInsensitive = !FileDesc->CaseSensitive;
-    PUNICODE_STRING DirectoryPattern = &FileDesc->DirectoryPattern;
+    FSP_FILE_NAME_PATTERN *DirectoryPattern = &FileDesc->DirectoryPatternCompiled;
     UNICODE_STRING DirectoryMarker = FileDesc->DirectoryMarker;
+    FSP_DIR_INFO_CHUNK Chunk = { 0 }, *Chunks = &Chunk;
+    ULONG ChunkIndex = 0;
 
     ASSERT(DirInfo == DestBuf);
     FSP_FSCTL_STATIC_ASSERT(
@@ -368,10 +661,13 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
         FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION, FileName),
         "FSP_FSCTL_DIR_INFO must be bigger than FILE_ID_BOTH_DIR_INFORMATION");
 
+    Chunk.Buffer = (PUINT8)DirInfo;
+    Chunk.Size = DirInfoSize;
+
     Result = FspFsvolQueryDirectoryCopy(DirectoryPattern, CaseInsensitive,
         0, &DirectoryMarker,
         FileInformationClass, ReturnSingleEntry,
-        &DirInfo, DirInfoSize,
+        &Chunks, 1, &ChunkIndex, &DirInfo,
         DestBuf, PDestLen);
 
     if (NT_SUCCESS(Result))
@@ -389,6 +685,91 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
     return Result;
 }
 
+static BOOLEAN FspFsvolQueryDirectoryReferenceDirInfo(FSP_FILE_NODE *FileNode,
+    FSP_DIR_INFO_CHUNKS **PDirInfoChunks)
+{
+    /* FileNode assumed acquired */
+
+    PAGED_CODE();
+
+    PCVOID DirInfoBuffer;
+
+    *PDirInfoChunks = 0;
+
+    if (!FspFileNodeReferenceDirInfo(FileNode, &DirInfoBuffer, 0))
+        return FALSE;
+
+    /* a listing that has been extended over time is only as fresh as its oldest chunk */
+    if (!FspExpirationTimeValid(((FSP_DIR_INFO_CHUNKS *)DirInfoBuffer)->ExpirationTime))
+    {
+        FspFileNodeDereferenceDirInfo(DirInfoBuffer);
+        return FALSE;
+    }
+
+    *PDirInfoChunks = (PVOID)DirInfoBuffer;
+
+    return TRUE;
+}
+
+static BOOLEAN FspFsvolQueryDirectoryTrySetDirInfo(FSP_FILE_DESC *FileDesc,
+    PUNICODE_STRING DirectoryMarker, PVOID Buffer, ULONG Size,
+    ULONG DirInfoChangeNumber)
+{
+    /* FileNode/FileDesc assumed acquired exclusive (Main or Full) */
+
+    PAGED_CODE();
+
+    NTSTATUS Result;
+    FSP_FILE_NODE *FileNode = FileDesc->FileNode;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension =
+        FspFsvolDeviceExtension(FileNode->FsvolDeviceObject);
+    FSP_DIR_INFO_CHUNKS *PrevDirInfoChunks = 0, *DirInfoChunks;
+    ULONG DirInfoChunksSize;
+    BOOLEAN KeepHint;
+
+    if (0 == FsvolDeviceExtension->DirInfoCache ||
+        FspFileNodeDirInfoChangeNumber(FileNode) != DirInfoChangeNumber)
+        return FALSE;
+
+    if (0 != DirectoryMarker)
+    {
+        /* only extend a cached listing with a response that continues where the listing ends */
+        if (!FspFsvolQueryDirectoryReferenceDirInfo(FileNode, &PrevDirInfoChunks))
+            return FALSE;
+        if (PrevDirInfoChunks->Complete ||
+            0 != FspFileNameCompare(
+                &PrevDirInfoChunks->Chunks[PrevDirInfoChunks->ChunkCount - 1]->LastName,
+                DirectoryMarker, FALSE, 0))
+        {
+            FspFileNodeDereferenceDirInfo(PrevDirInfoChunks);
+            return FALSE;
+        }
+    }
+
+    Result = FspDirInfoChunksCreate(PrevDirInfoChunks, Buffer, Size,
+        FsvolDeviceExtension->VolumeParams.DirInfoCacheSizeMax,
+        FsvolDeviceExtension->VolumeParams.FileInfoTimeout,
+        &DirInfoChunks, &DirInfoChunksSize);
+
+    /* chunks keep their positions in the extended listing; so does the DirInfo hint */
+    KeepHint = 0 != PrevDirInfoChunks && FileDesc->DirInfo == FileNode->NonPaged->DirInfo;
+
+    if (0 != PrevDirInfoChunks)
+        FspFileNodeDereferenceDirInfo(PrevDirInfoChunks);
+
+    if (!NT_SUCCESS(Result))
+        return FALSE;
+
+    /* the DirInfo cache takes over the chunk references of the index */
+    FspFileNodeSetDirInfo(FileNode, DirInfoChunks, DirInfoChunksSize);
+    FspFree(DirInfoChunks);
+
+    if (KeepHint)
+        FileDesc->DirInfo = FileNode->NonPaged->DirInfo;
+
+    return TRUE;
+}
+
 static inline NTSTATUS FspFsvolQueryDirectoryBufferUserBuffer(
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension, PIRP Irp, PULONG PLength)
 {
@@ -398,8 +779,8 @@ static inline NTSTATUS FspFsvolQueryDirectoryBufferUserBuffer(
     NTSTATUS Result;
     ULONG Length = *PLength;
 
-    if (Length > FspFsvolDeviceDirInfoCacheItemSizeMax)
-        Length = FspFsvolDeviceDirInfoCacheItemSizeMax;
+    if (Length > FspFsvolDeviceDirInfoCacheChunkSize)
+        Length = FspFsvolDeviceDirInfoCacheChunkSize;
     else if (Length < sizeof(FSP_FSCTL_DIR_INFO) +
         FsvolDeviceExtension->VolumeParams.MaxComponentLength * sizeof(WCHAR))
         Length = sizeof(FSP_FSCTL_DIR_INFO) +
@@ -435,14 +816,17 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
      *   - If the FileInfoTimeout is non-zero, then the directory maintains a
      *     DirInfo meta cache that can be used to fulfill IRP requests without
      *     reaching out to user mode. In this case we want the SystemBufferLength
-     *     to be FspFsvolDeviceDirInfoCacheItemSizeMax so that we read up to the
-     *     cache size maximum.
+     *     to be FspFsvolDeviceDirInfoCacheChunkSize so that we read a full chunk.
+     *     This applies both when we start reading the directory and when we
+     *     have run past the end of a cached listing that can still be extended
+     *     (i.e. it is not complete and a full chunk still fits within
+     *     DirInfoCacheSizeMax; a listing never grows past DirInfoCacheSizeMax).
      *
      *   - If the requested DirectoryPattern (stored in FileDesc) is not the "*"
      *     (MatchAll) pattern, then we want to read as many entries as possible
      *     from the user mode file system to avoid multiple roundtrips to user
      *     mode when doing file name matching. In this case we set again the
-     *     SystemBufferLength to be FspFsvolDeviceDirInfoCacheItemSizeMax. This
+     *     SystemBufferLength to be FspFsvolDeviceDirInfoCacheChunkSize. This
      *     is an important optimization and without it QueryDirectory is *very*
      *     slow without the DirInfo meta cache (i.e. when FileInfoTimeout is 0).
      *
@@ -453,12 +837,15 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
 #define GetSystemBufferLengthMaybeCached()\
     (0 != FsvolDeviceExtension->VolumeParams.FileInfoTimeout && 0 == FileDesc->DirectoryMarker.Buffer) ||\
     FspFileDescDirectoryPatternMatchAll != FileDesc->DirectoryPattern.Buffer ?\
-        FspFsvolDeviceDirInfoCacheItemSizeMax : Length
+        FspFsvolDeviceDirInfoCacheChunkSize : Length
 #define GetSystemBufferLengthNonCached()\
+    (!DirInfoChunks->Complete &&\
+        FsvolDeviceExtension->VolumeParams.DirInfoCacheSizeMax - DirInfoChunks->Size >=\
+            FspFsvolDeviceDirInfoCacheChunkSize) ||\
     FspFileDescDirectoryPatternMatchAll != FileDesc->DirectoryPattern.Buffer ?\
-        FspFsvolDeviceDirInfoCacheItemSizeMax : Length
+        FspFsvolDeviceDirInfoCacheChunkSize : Length
 #define GetSystemBufferLengthBestGuess()\
-    FspFsvolDeviceDirInfoCacheItemSizeMax
+    FspFsvolDeviceDirInfoCacheChunkSize
 
     PAGED_CODE();
 
@@ -477,8 +864,7 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
         Irp->AssociatedIrp.SystemBuffer : Irp->UserBuffer;
     ULONG Length = IrpSp->Parameters.QueryDirectory.Length;
     ULONG SystemBufferLength;
-    PVOID DirInfoBuffer;
-    ULONG DirInfoSize;
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks;
     FSP_FSCTL_TRANSACT_REQ *Request = FspIrpRequest(Irp);
     BOOLEAN Success;
 
@@ -529,7 +915,7 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
     }
 
     /* see if the required information is still in the cache and valid! */
-    if (FspFileNodeReferenceDirInfo(FileNode, &DirInfoBuffer, &DirInfoSize))
+    if (FspFsvolQueryDirectoryReferenceDirInfo(FileNode, &DirInfoChunks))
     {
         if (0 == SystemBufferLength)
             SystemBufferLength = GetSystemBufferLengthNonCached();
@@ -537,9 +923,9 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
         Result = FspFsvolQueryDirectoryCopyCache(FileDesc,
             IndexSpecified || RestartScan,
             FileInformationClass, ReturnSingleEntry,
-            DirInfoBuffer, DirInfoSize, Buffer, &Length);
+            DirInfoChunks, Buffer, &Length);
 
-        FspFileNodeDereferenceDirInfo(DirInfoBuffer);
+        FspFileNodeDereferenceDirInfo(DirInfoChunks);
 
         if (!NT_SUCCESS(Result) || 0 != Length)
         {
@@ -923,8 +1309,10 @@ NTSTATUS FspFsvolDirectoryControlComplete(
     PVOID Buffer = Irp->AssociatedIrp.SystemBuffer;
     ULONG Length = IrpSp->Parameters.QueryDirectory.Length;
     ULONG DirInfoChangeNumber;
+    FSP_DIR_INFO_CHUNKS *DirInfoChunks;
     PVOID DirInfoBuffer;
     ULONG DirInfoSize;
+    UNICODE_STRING DirectoryMarker;
     BOOLEAN Success;
 
     ASSERT(FileNode == FileDesc->FileNode);
@@ -972,20 +1360,29 @@ NTSTATUS FspFsvolDirectoryControlComplete(
         FSP_RETURN();
     }
 
+    /*
+     * A response to a request without a marker starts a new cached listing. A response
+     * to a request with a marker may extend the cached listing (if the marker is the last
+     * name in the listing).
+     */
+    DirectoryMarker.Length = DirectoryMarker.MaximumLength =
+        0 != Request->Req.QueryDirectory.Marker.Size ?
+            (USHORT)(Request->Req.QueryDirectory.Marker.Size - sizeof(WCHAR)) : 0;
+    DirectoryMarker.Buffer = (PVOID)(Request->Buffer + Request->Req.QueryDirectory.Marker.Offset);
     if (0 == Request->Req.QueryDirectory.Pattern.Size &&
-        0 == Request->Req.QueryDirectory.Marker.Size &&
-        FspFileNodeTrySetDirInfo(FileNode,
+        FspFsvolQueryDirectoryTrySetDirInfo(FileDesc,
+            0 != Request->Req.QueryDirectory.Marker.Size ? &DirectoryMarker : 0,
             Irp->AssociatedIrp.SystemBuffer,
             (ULONG)Response->IoStatus.Information,
             DirInfoChangeNumber) &&
-        FspFileNodeReferenceDirInfo(FileNode, &DirInfoBuffer, &DirInfoSize))
+        FspFsvolQueryDirectoryReferenceDirInfo(FileNode, &DirInfoChunks))
     {
         Result = FspFsvolQueryDirectoryCopyCache(FileDesc,
-            TRUE,
+            0 == Request->Req.QueryDirectory.Marker.Size,
             FileInformationClass, ReturnSingleEntry,
-            DirInfoBuffer, DirInfoSize, Buffer, &Length);
+            DirInfoChunks, Buffer, &Length);
 
-        FspFileNodeDereferenceDirInfo(DirInfoBuffer);
+        FspFileNodeDereferenceDirInfo(DirInfoChunks);
     }
     else
     {
@@ -46,9 +46,16 @@ NTSTATUS DriverEntry(
 
     FspDriverMultiVersionInitialize();
 
+    Result = FspPoolCacheInitialize();
+    if (!NT_SUCCESS(Result))
+        FSP_RETURN();
+
     Result = FspProcessBufferInitialize();
     if (!NT_SUCCESS(Result))
+    {
+        FspPoolCacheFinalize();
         FSP_RETURN();
+    }
 
     FspDriverObject = DriverObject;
     ExInitializeResourceLite(&FspDeviceGlobalResource);
@@ -65,6 +72,7 @@ NTSTATUS DriverEntry(
     if (!NT_SUCCESS(Result))
     {
         FspProcessBufferFinalize();
+        FspPoolCacheFinalize();
         FSP_RETURN();
     }
     RtlInitUnicodeString(&DeviceName, L"\\Device\\" FSP_FSCTL_NET_DEVICE_NAME);
@@ -76,6 +84,7 @@ NTSTATUS DriverEntry(
     {
         FspDeviceDelete(FspFsctlDiskDeviceObject);
         FspProcessBufferFinalize();
+        FspPoolCacheFinalize();
         FSP_RETURN();
     }
     Result = FspDeviceInitialize(FspFsctlDiskDeviceObject);
@@ -83,6 +92,12 @@ NTSTATUS DriverEntry(
     Result = FspDeviceInitialize(FspFsctlNetDeviceObject);
     ASSERT(STATUS_SUCCESS == Result);
 
+    /* caches shed entries when memory is low; they do without if the event is unavailable */
+    UNICODE_STRING LowMemoryConditionName;
+    RtlInitUnicodeString(&LowMemoryConditionName, L"\\KernelObjects\\LowMemoryCondition");
+    FspLowMemoryConditionEvent = IoCreateNotificationEvent(&LowMemoryConditionName,
+        &FspLowMemoryConditionEventHandle);
+
     /* setup the driver object */
 #if defined(FSP_UNLOAD)
     DriverObject->DriverUnload = FspUnload;
@@ -136,10 +151,10 @@ NTSTATUS DriverEntry(
     /* setup fast I/O and resource acquisition */
     FspFastIoDispatch.SizeOfFastIoDispatch = sizeof FspFastIoDispatch;
     FspFastIoDispatch.FastIoCheckIfPossible = FspFastIoCheckIfPossible;
-    //FspFastIoDispatch.FastIoRead = 0;
-    //FspFastIoDispatch.FastIoWrite = 0;
-    //FspFastIoDispatch.FastIoQueryBasicInfo = 0;
-    //FspFastIoDispatch.FastIoQueryStandardInfo = 0;
+    FspFastIoDispatch.FastIoRead = FspFastIoRead;
+    FspFastIoDispatch.FastIoWrite = FspFastIoWrite;
+    FspFastIoDispatch.FastIoQueryBasicInfo = FspFastIoQueryBasicInfo;
+    FspFastIoDispatch.FastIoQueryStandardInfo = FspFastIoQueryStandardInfo;
     //FspFastIoDispatch.FastIoLock = 0;
     //FspFastIoDispatch.FastIoUnlockSingle = 0;
     //FspFastIoDispatch.FastIoUnlockAll = 0;
@@ -148,7 +163,7 @@ NTSTATUS DriverEntry(
     FspFastIoDispatch.AcquireFileForNtCreateSection = FspAcquireFileForNtCreateSection;
     FspFastIoDispatch.ReleaseFileForNtCreateSection = FspReleaseFileForNtCreateSection;
     //FspFastIoDispatch.FastIoDetachDevice = 0;
-    //FspFastIoDispatch.FastIoQueryNetworkOpenInfo = 0;
+    FspFastIoDispatch.FastIoQueryNetworkOpenInfo = FspFastIoQueryNetworkOpenInfo;
     FspFastIoDispatch.AcquireForModWrite = FspAcquireForModWrite;
     //FspFastIoDispatch.MdlRead = 0;
     //FspFastIoDispatch.MdlReadComplete = 0;
@@ -215,10 +230,17 @@ VOID FspUnload(
     FspFsctlNetDeviceObject = 0;
     //FspDeviceDeleteAll();
 
+    if (0 != FspLowMemoryConditionEvent)
+    {
+        ZwClose(FspLowMemoryConditionEventHandle);
+        FspLowMemoryConditionEvent = 0;
+    }
+
     ExDeleteResourceLite(&FspDeviceGlobalResource);
     FspDriverObject = 0;
 
     FspProcessBufferFinalize();
+    FspPoolCacheFinalize();
 
 #pragma prefast(suppress:28175, "We are in DriverUnload: ok to access DriverName")
     FSP_LEAVE_VOID("DriverName=\"%wZ\"",
@@ -233,5 +255,7 @@ FAST_IO_DISPATCH FspFastIoDispatch;
 CACHE_MANAGER_CALLBACKS FspCacheManagerCallbacks;
 
 ULONG FspProcessorCount;
+PKEVENT FspLowMemoryConditionEvent;
+HANDLE FspLowMemoryConditionEventHandle;
 FSP_MV_CcCoherencyFlushAndPurgeCache *FspMvCcCoherencyFlushAndPurgeCache;
 ULONG FspMvMdlMappingNoWrite = 0;
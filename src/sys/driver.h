@@ -332,8 +332,18 @@ FSP_IOCMPL_DISPATCH FspFsvolShutdownComplete;
 FSP_IOPREP_DISPATCH FspFsvolWritePrepare;
 FSP_IOCMPL_DISPATCH FspFsvolWriteComplete;
 
+/* close batching */
+VOID FspFsvolCloseBatchFlush(PDEVICE_OBJECT FsvolDeviceObject);
+VOID FspFsvolCloseBatchInit(PDEVICE_OBJECT FsvolDeviceObject);
+VOID FspFsvolCloseBatchFini(PDEVICE_OBJECT FsvolDeviceObject);
+
 /* fast I/O and resource acquisition callbacks */
 FAST_IO_CHECK_IF_POSSIBLE FspFastIoCheckIfPossible;
+FAST_IO_READ FspFastIoRead;
+FAST_IO_WRITE FspFastIoWrite;
+FAST_IO_QUERY_BASIC_INFO FspFastIoQueryBasicInfo;
+FAST_IO_QUERY_STANDARD_INFO FspFastIoQueryStandardInfo;
+FAST_IO_QUERY_NETWORK_OPEN_INFO FspFastIoQueryNetworkOpenInfo;
 FAST_IO_ACQUIRE_FILE FspAcquireFileForNtCreateSection;
 FAST_IO_RELEASE_FILE FspReleaseFileForNtCreateSection;
 FAST_IO_ACQUIRE_FOR_MOD_WRITE FspAcquireForModWrite;
@@ -361,6 +371,31 @@ VOID FspPropagateTopFlags(PIRP Irp, PIRP TopLevelIrp);
 #define FspAllocNonPagedExternal(Size)  ExAllocatePoolWithTag(NonPagedPool, Size, FSP_ALLOC_EXTERNAL_TAG)
 #define FspFreeExternal(Pointer)        ExFreePool(Pointer)
 
+/* pool caches */
+enum
+{
+    FspPoolCacheRequest                 = 0,
+    FspPoolCacheWorkItem,
+    FspPoolCacheResponse,
+    FspPoolCacheCount,
+};
+typedef FSP_FSCTL_POOL_CACHE_STATISTICS FSP_POOL_CACHE_STATISTICS;
+FSP_FSCTL_STATIC_ASSERT(FspPoolCacheCount == ARRAYSIZE(((FSP_FSCTL_STATISTICS *)0)->PoolCache),
+    "FSP_FSCTL_STATISTICS::PoolCache must have an entry per pool cache class.");
+NTSTATUS FspPoolCacheInitialize(VOID);
+VOID FspPoolCacheFinalize(VOID);
+PVOID FspPoolCacheAlloc(ULONG Class, POOL_TYPE PoolType, SIZE_T Size, BOOLEAN MustSucceed);
+VOID FspPoolCacheFree(PVOID Pointer);
+VOID FspPoolCacheGetStatistics(ULONG Processor,
+    FSP_POOL_CACHE_STATISTICS Statistics[FspPoolCacheCount]);
+
+/* memory pressure */
+static inline
+BOOLEAN FspLowMemoryCondition(VOID)
+{
+    return 0 != FspLowMemoryConditionEvent && 0 != KeReadStateEvent(FspLowMemoryConditionEvent);
+}
+
 /* hash mix */
 /* Based on the MurmurHash3 fmix32/fmix64 function:
  * See: https://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp?r=152#68
@@ -444,6 +479,7 @@ BOOLEAN FspFileNameIsValid(PUNICODE_STRING Path, ULONG MaxComponentLength,
     PUNICODE_STRING StreamPart, PULONG StreamType);
 BOOLEAN FspFileNameIsValidPattern(PUNICODE_STRING Pattern, ULONG MaxComponentLength);
 VOID FspFileNameSuffix(PUNICODE_STRING Path, PUNICODE_STRING Remain, PUNICODE_STRING Suffix);
+ULONG FspFileNameHash(PUNICODE_STRING Path, BOOLEAN IgnoreCase);
 #if 0
 NTSTATUS FspFileNameUpcase(
     PUNICODE_STRING DestinationName,
@@ -471,6 +507,26 @@ NTSTATUS FspFileNameInExpression(
     PWCH UpcaseTable,
     PBOOLEAN PResult);
 
+/* compiled file name patterns */
+enum
+{
+    FspFileNamePatternGeneric           = 0,
+    FspFileNamePatternMatchAll,         /* "*" */
+    FspFileNamePatternExact,            /* "name" */
+    FspFileNamePatternPrefix,           /* "prefix*" */
+    FspFileNamePatternSuffix,           /* "*suffix" */
+};
+typedef struct
+{
+    UNICODE_STRING Expression;
+    USHORT Kind;
+    USHORT LiteralLength;               /* in WCHAR's */
+    PWSTR Literal;                      /* points into Expression */
+} FSP_FILE_NAME_PATTERN;
+VOID FspFileNamePatternCompile(FSP_FILE_NAME_PATTERN *Pattern, PUNICODE_STRING Expression);
+NTSTATUS FspFileNamePatternMatch(FSP_FILE_NAME_PATTERN *Pattern,
+    PUNICODE_STRING Name, BOOLEAN IgnoreCase, PBOOLEAN PResult);
+
 /* utility */
 PVOID FspAllocatePoolMustSucceed(POOL_TYPE PoolType, SIZE_T Size, ULONG Tag);
 PVOID FspAllocateIrpMustSucceed(CCHAR StackSize);
@@ -801,21 +857,32 @@ retry:
 #define FspIoqCancelled                 ((PIRP)2)
 #define FspIoqPostIrp(Q, I, R)          FspIoqPostIrpEx(Q, I, FALSE, R)
 #define FspIoqPostIrpBestEffort(Q, I, R)FspIoqPostIrpEx(Q, I, TRUE, R)
-typedef struct
+#define FSP_IOQ_SHARD_COUNT_MAX         16
+typedef struct __declspec(align(64))   /* one cache line (or more) per queue */
 {
     KSPIN_LOCK SpinLock;
+    LIST_ENTRY IrpList;
+    IO_CSQ IoCsq;
+    PVOID Ioq;
+    ULONG IrpCount;
+} FSP_IOQ_QUEUE;
+typedef struct
+{
     BOOLEAN Stopped;
 #if defined(FSP_IOQ_USE_QEVENT)
     FSP_QEVENT PendingIrpEvent;
 #else
     KEVENT PendingIrpEvent;
 #endif
-    LIST_ENTRY PendingIrpList, ProcessIrpList, RetriedIrpList;
-    IO_CSQ PendingIoCsq, ProcessIoCsq, RetriedIoCsq;
     ULONG IrpTimeout;
-    ULONG PendingIrpCapacity, PendingIrpCount, ProcessIrpCount, RetriedIrpCount;
+    ULONG PendingIrpCapacity;
     VOID (*CompleteCanceledIrp)(PIRP Irp);
-    ULONG ProcessIrpBucketCount;
+    ULONG ShardCount;
+    ULONG ProcessIrpBucketCount, ProcessIrpShardBucketCount;
+    __declspec(align(64)) LONG PendingIrpCount;
+    FSP_IOQ_QUEUE PendingQueues[FSP_IOQ_SHARD_COUNT_MAX];
+    FSP_IOQ_QUEUE ProcessQueues[FSP_IOQ_SHARD_COUNT_MAX];
+    FSP_IOQ_QUEUE RetriedQueue;
     PVOID ProcessIrpBuckets[];
 } FSP_IOQ;
 NTSTATUS FspIoqCreate(
@@ -837,19 +904,36 @@ PIRP FspIoqNextCompleteIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp);
 ULONG FspIoqRetriedIrpCount(FSP_IOQ *Ioq);
 
 /* meta cache */
-typedef struct
+#define FSP_META_CACHE_STRIPE_COUNT_MAX 16
+#define FSP_META_CACHE_BUCKET_COUNT_MIN 16
+typedef struct __declspec(align(64))   /* one cache line (or more) per stripe */
 {
     KSPIN_LOCK SpinLock;
-    UINT64 MetaTimeout;
-    ULONG MetaCapacity, ItemCount;
-    ULONG ItemSizeMax;
-    UINT64 ItemIndex;
     LIST_ENTRY ItemList;
+    ULONG ItemCapacity, ItemCount;
     ULONG ItemBucketCount;
-    PVOID ItemBuckets[];
+    PVOID *ItemBuckets, *ContentBuckets;
+    UINT64 HitCount, MissCount, EvictionCount, ShareCount;
+} FSP_META_CACHE_STRIPE;
+typedef VOID FSP_META_CACHE_ITEM_FINI(PVOID Buffer, ULONG Size);
+typedef struct
+{
+    UINT64 MetaTimeout;
+    ULONG MetaCapacity;
+    ULONG ItemSizeMax;
+    LONG64 ItemIndex;
+    FSP_META_CACHE_ITEM_FINI *ItemFini;
+    ULONG StripeCount;
+    FSP_META_CACHE_STRIPE Stripes[];
 } FSP_META_CACHE;
+typedef struct
+{
+    ULONG ItemCount, ItemBucketCount;
+    UINT64 HitCount, MissCount, EvictionCount, ShareCount;
+} FSP_META_CACHE_STATISTICS;
 NTSTATUS FspMetaCacheCreate(
     ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    FSP_META_CACHE_ITEM_FINI *ItemFini,
     FSP_META_CACHE **PMetaCache);
 VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache);
 VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationTime);
@@ -857,7 +941,29 @@ BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIn
     PCVOID *PBuffer, PULONG PSize);
 VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer);
 UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+UINT64 FspMetaCacheAddSharedItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
 VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex);
+VOID FspMetaCacheGetStatistics(FSP_META_CACHE *MetaCache, FSP_META_CACHE_STATISTICS *Statistics);
+
+/* directory info chunks */
+typedef struct
+{
+    LONG RefCount;
+    ULONG Size;
+    PUINT8 Buffer;                      /* FSP_FSCTL_DIR_INFO entries; points to BufferStorage */
+    UNICODE_STRING FirstName;           /* name of the first entry; used to seek to a marker */
+    UNICODE_STRING LastName;            /* name of the last entry */
+    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 BufferStorage[];
+} FSP_DIR_INFO_CHUNK;
+typedef struct
+{
+    UINT64 ExpirationTime;              /* expiration time of the oldest chunk */
+    ULONG Size;                         /* total size of all chunks */
+    BOOLEAN Complete;                   /* the listing ends with the last chunk */
+    ULONG ChunkCount;
+    FSP_DIR_INFO_CHUNK *Chunks[];       /* in listing order; chunks are shared by reference */
+} FSP_DIR_INFO_CHUNKS;
+FSP_META_CACHE_ITEM_FINI FspDirInfoChunksFini;
 
 /* I/O processing */
 #define FSP_FSCTL_WORK                  \
@@ -914,7 +1020,7 @@ NTSTATUS FspIopCreateRequestWorkItem(FSP_FSCTL_TRANSACT_REQ *Request);
 VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request);
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini);
 NTSTATUS FspIopPostWorkRequestFunnel(PDEVICE_OBJECT DeviceObject,
-    FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN BestEffort);
+    FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN BestEffort, BOOLEAN Wait);
 VOID FspIopCompleteIrpEx(PIRP Irp, NTSTATUS Result, BOOLEAN DeviceDereference);
 VOID FspIopCompleteCanceledIrp(PIRP Irp);
 BOOLEAN FspIopRetryPrepareIrp(PIRP Irp, NTSTATUS *PResult);
@@ -945,9 +1051,11 @@ VOID FspIrpDeleteRequest(PIRP Irp)
     FspIopCreateRequestFunnel(I, 0, E, RF, FspIopCreateRequestWorkItemFlag, P)
 #define FspIopRequestContext(Request, I)\
     (*FspIopRequestContextAddress(Request, I))
-#define FspIopPostWorkRequest(D, R)     FspIopPostWorkRequestFunnel(D, R, FALSE)
+#define FspIopPostWorkRequest(D, R)     FspIopPostWorkRequestFunnel(D, R, FALSE, FALSE)
 #define FspIopPostWorkRequestBestEffort(D, R)\
-    FspIopPostWorkRequestFunnel(D, R, TRUE)
+    FspIopPostWorkRequestFunnel(D, R, TRUE, FALSE)
+#define FspIopPostWorkRequestBestEffortAndWait(D, R)\
+    FspIopPostWorkRequestFunnel(D, R, TRUE, TRUE)
 #define FspIopCompleteIrp(I, R)         FspIopCompleteIrpEx(I, R, TRUE)
 
 /* work queue processing */
@@ -965,6 +1073,7 @@ typedef struct
 {
     FILESYSTEM_STATISTICS Base;
     FAT_STATISTICS Specific;            /* pretend that we are FAT when it comes to stats */
+    FSP_FSCTL_STATISTICS Winfsp;        /* follows the FAT statistics, see Base.SizeOfCompleteStructure */
     /* align to 64 bytes */
     __declspec(align(64)) UINT8 EndOfStruct[];
 } FSP_STATISTICS;
@@ -978,17 +1087,21 @@ NTSTATUS FspStatisticsCopy(FSP_STATISTICS *Statistics, PVOID Buffer, PULONG PLen
 /* device management */
 enum
 {
-    FspFsvolDeviceSecurityCacheCapacity = 100,
     FspFsvolDeviceSecurityCacheItemSizeMax = 4096,
-    FspFsvolDeviceDirInfoCacheCapacity = 100,
-    FspFsvolDeviceDirInfoCacheItemSizeMax = FSP_FSCTL_ALIGN_UP(16384, PAGE_SIZE),
-    FspFsvolDeviceStreamInfoCacheCapacity = 100,
+    FspFsvolDeviceDirInfoCacheChunkSize = FSP_FSCTL_ALIGN_UP(16384, PAGE_SIZE),
     FspFsvolDeviceStreamInfoCacheItemSizeMax = FSP_FSCTL_ALIGN_UP(16384, PAGE_SIZE),
+    FspFsvolDeviceContextByNameBucketCountMin = 64,
+    FspFsvolDeviceCloseBatchCountMax = 128,
+    FspFsvolDeviceCloseBatchDelay = 10,             /* millis */
+    FspFsvolDeviceCloseCacheCountMax = 512,
+    FspFsvolDeviceCloseCacheTimeout = 3000,         /* millis */
 };
-typedef struct
+typedef struct FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA
 {
     PUNICODE_STRING FileName;
     PVOID Context;
+    ULONG FileNameHash;
+    struct FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA *HashNext;
 } FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA;
 typedef struct
 {
@@ -996,6 +1109,19 @@ typedef struct
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA Data;
 } FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT;
 typedef struct
+{
+    PUNICODE_STRING FileName;
+    LIST_ENTRY ListEntry;
+    UINT64 ExpirationTime;
+} FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA;
+typedef struct
+{
+    RTL_BALANCED_LINKS Header;
+    FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT_DATA Data;
+    UNICODE_STRING FileName;
+    WCHAR FileNameBuf[];
+} FSP_DEVICE_NEGATIVE_NAME_TABLE_ELEMENT;
+typedef struct
 {
     PVOID RestartKey;
     ULONG DeleteCount;
@@ -1016,7 +1142,8 @@ typedef struct
 {
     FSP_DEVICE_EXTENSION Base;
     UINT32 InitDoneFsvrt:1, InitDoneIoq:1, InitDoneSec:1, InitDoneDir:1, InitDoneStrm:1,
-        InitDoneCtxTab:1, InitDoneTimer:1, InitDoneInfo:1, InitDoneNotify:1, InitDoneStat:1;
+        InitDoneCtxTab:1, InitDoneTimer:1, InitDoneInfo:1, InitDoneNotify:1, InitDoneStat:1,
+        InitDoneNegTab:1;
     PDEVICE_OBJECT FsctlDeviceObject;
     PDEVICE_OBJECT FsvrtDeviceObject;
     HANDLE MupHandle;
@@ -1025,17 +1152,35 @@ typedef struct
     FSP_FSCTL_VOLUME_PARAMS VolumeParams;
     UNICODE_STRING VolumePrefix;
     FSP_IOQ *Ioq;
+    FSP_FSCTL_TRANSACT_RING *TransactRing;
+    UINT32 TransactRingSlotCount;
+    HANDLE TransactRingProcessId;
     FSP_META_CACHE *SecurityCache;
     FSP_META_CACHE *DirInfoCache;
     FSP_META_CACHE *StreamInfoCache;
     KSPIN_LOCK ExpirationLock;
     WORK_QUEUE_ITEM ExpirationWorkItem;
     BOOLEAN ExpirationInProgress;
+    FAST_MUTEX CloseBatchMutex;
+    FSP_FSCTL_TRANSACT_REQ *CloseBatchRequest;
+    FSP_DELAYED_WORK_ITEM CloseBatchDelayedWorkItem;
+    BOOLEAN CloseBatchFlushPending;
+    LIST_ENTRY CloseCacheList;          /* locked under ContextTableResource */
+    ULONG CloseCacheCount;
     ERESOURCE FileRenameResource;
     ERESOURCE ContextTableResource;
     LIST_ENTRY ContextList;
     RTL_AVL_TABLE ContextByNameTable;
     PVOID ContextByNameTableElementStorage;
+    FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT_DATA **ContextByNameBuckets;
+    ULONG ContextByNameBucketCount;
+    ERESOURCE NegativeNameResource;
+    LIST_ENTRY NegativeNameList;
+    RTL_AVL_TABLE NegativeNameTable;
+    PVOID NegativeNameTableElementStorage;
+    ULONG NegativeNameGeneration;
+    LONG64 NegativeNameHitCount, NegativeNameMissCount;
+    LONG64 NegativeNameInsertCount, NegativeNameEvictionCount, NegativeNameInvalidateCount;
     UNICODE_STRING VolumeName;
     WCHAR VolumeNameBuf[FSP_FSCTL_VOLUME_NAME_SIZE / sizeof(WCHAR)];
     KSPIN_LOCK InfoSpinLock;
@@ -1074,6 +1219,7 @@ VOID FspFsvolDeviceFileRenameRelease(PDEVICE_OBJECT DeviceObject);
 VOID FspFsvolDeviceFileRenameReleaseOwner(PDEVICE_OBJECT DeviceObject, PVOID Owner);
 BOOLEAN FspFsvolDeviceFileRenameIsAcquiredExclusive(PDEVICE_OBJECT DeviceObject);
 VOID FspFsvolDeviceLockContextTable(PDEVICE_OBJECT DeviceObject);
+VOID FspFsvolDeviceLockContextTableShared(PDEVICE_OBJECT DeviceObject);
 VOID FspFsvolDeviceUnlockContextTable(PDEVICE_OBJECT DeviceObject);
 NTSTATUS FspFsvolDeviceCopyContextList(PDEVICE_OBJECT DeviceObject,
     PVOID **PContexts, PULONG PContextCount);
@@ -1082,11 +1228,23 @@ NTSTATUS FspFsvolDeviceCopyContextByNameList(PDEVICE_OBJECT DeviceObject,
 VOID FspFsvolDeviceDeleteContextList(PVOID *Contexts, ULONG ContextCount);
 PVOID FspFsvolDeviceEnumerateContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
     BOOLEAN NextFlag, FSP_DEVICE_CONTEXT_BY_NAME_TABLE_RESTART_KEY *RestartKey);
-PVOID FspFsvolDeviceLookupContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
-PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName, PVOID Context,
+ULONG FspFsvolDeviceHashContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
+PVOID FspFsvolDeviceLookupContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG FileNameHash);
+PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG FileNameHash, PVOID Context,
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT *ElementStorage, PBOOLEAN PInserted);
 VOID FspFsvolDeviceDeleteContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
-    PBOOLEAN PDeleted);
+    ULONG FileNameHash, PBOOLEAN PDeleted);
+BOOLEAN FspFsvolDeviceLookupNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    PULONG PGeneration);
+VOID FspFsvolDeviceInsertNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG Generation);
+VOID FspFsvolDeviceInvalidateNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    BOOLEAN Subtree);
+VOID FspFsvolDeviceInvalidateExpiredNegativeNames(PDEVICE_OBJECT DeviceObject, UINT64 ExpirationTime);
+VOID FspFsvolDeviceGetNegativeNameStatistics(PDEVICE_OBJECT DeviceObject,
+    FSP_FSCTL_NEGATIVE_NAME_CACHE_STATISTICS *Statistics);
 VOID FspFsvolDeviceGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 BOOLEAN FspFsvolDeviceTryGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 VOID FspFsvolDeviceSetVolumeInfo(PDEVICE_OBJECT DeviceObject, const FSP_FSCTL_VOLUME_INFO *VolumeInfo);
@@ -1166,6 +1324,10 @@ NTSTATUS FspVolumeGetNameList(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeTransact(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeTransactRingSetup(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeTransactRing(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeStop(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeWork(
@@ -1218,6 +1380,8 @@ typedef struct FSP_FILE_NODE
     ULONG StreamDenyDeleteCount;        /* number of times open streams are denying delete */
     LIST_ENTRY ActiveEntry;
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT ContextByNameElementStorage;
+    ULONG FileNameHash;                 /* hash of FileName; updated on rename */
+    PVOID CloseCacheEntry;              /* delayed-close cache entry holding this FileNode */
     /* locked under FSP_FSVOL_DEVICE_EXTENSION::FileRenameResource or Header.Resource */
     UNICODE_STRING FileName;
     PWSTR ExternalFileName;
@@ -1267,11 +1431,16 @@ typedef struct
         DidSetMetadata:1,
         DidSetFileAttributes:1, DidSetReparsePoint:1, DidSetSecurity:1,
         DidSetCreationTime:1, DidSetLastAccessTime:1, DidSetLastWriteTime:1, DidSetChangeTime:1,
-        DirectoryHasSuchFile:1;
+        DirectoryHasSuchFile:1,
+        NegativeNameLookup:1, NegativeNameInvalidate:1,
+        CloseCacheable:1;
+    ULONG NegativeNameGeneration;
+    LUID TokenId, TokenModifiedId;      /* opener token; identifies delayed-close cache hits */
     UNICODE_STRING DirectoryPattern;
+    FSP_FILE_NAME_PATTERN DirectoryPatternCompiled;
     UNICODE_STRING DirectoryMarker;
     UINT64 DirInfo;
-    ULONG DirInfoCacheHint;
+    ULONG DirInfoCacheChunk, DirInfoCacheHint;
     /* stream support */
     HANDLE MainFileHandle;
     PFILE_OBJECT MainFileObject;
@@ -1418,6 +1587,14 @@ NTSTATUS FspMainFileOpen(
 NTSTATUS FspMainFileClose(
     HANDLE MainFileHandle,
     PFILE_OBJECT MainFileObject);
+VOID FspFsvolCloseCacheInit(PDEVICE_OBJECT FsvolDeviceObject);
+FSP_FILE_NODE *FspFsvolCloseCacheTake(PDEVICE_OBJECT FsvolDeviceObject,
+    FSP_FILE_DESC *FileDesc, ACCESS_MASK DesiredAccess, PUINT64 PUserContext2);
+VOID FspFsvolCloseCacheDiscard(FSP_FILE_NODE *FileNode, UINT64 UserContext2);
+VOID FspFsvolCloseCacheEvictFileNode(FSP_FILE_NODE *FileNode);
+VOID FspFsvolCloseCacheEvictSubtree(PDEVICE_OBJECT FsvolDeviceObject, PUNICODE_STRING FileName);
+VOID FspFsvolCloseCacheEvictExpired(PDEVICE_OBJECT FsvolDeviceObject, UINT64 InterruptTime);
+VOID FspFsvolCloseCacheEvictAll(PDEVICE_OBJECT FsvolDeviceObject);
 static __forceinline
 BOOLEAN FspMainFileOpenCheck(PIRP Irp)
 {
@@ -1481,6 +1658,11 @@ BOOLEAN FspFileNodeOplockIsHandle(FSP_FILE_NODE *FileNode)
     return FsRtlCurrentOplockH(FspFileNodeAddrOfOplock(FileNode));
 }
 static inline
+BOOLEAN FspFileNodeOplockIsFastIoPossible(FSP_FILE_NODE *FileNode)
+{
+    return FsRtlOplockIsFastIoPossible(FspFileNodeAddrOfOplock(FileNode));
+}
+static inline
 NTSTATUS FspFileNodeOplockCheck(FSP_FILE_NODE *FileNode, PIRP Irp)
 {
     return FspCheckOplock(FspFileNodeAddrOfOplock(FileNode), Irp, 0, 0, 0);
@@ -1561,6 +1743,8 @@ extern ERESOURCE FspDeviceGlobalResource;
 extern WCHAR FspFileDescDirectoryPatternMatchAll[];
 extern const GUID FspMainFileOpenEcpGuid;
 extern ULONG FspProcessorCount;
+extern PKEVENT FspLowMemoryConditionEvent;
+extern HANDLE FspLowMemoryConditionEventHandle;
 extern FSP_MV_CcCoherencyFlushAndPurgeCache *FspMvCcCoherencyFlushAndPurgeCache;
 extern ULONG FspMvMdlMappingNoWrite;
 
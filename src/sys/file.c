@@ -244,7 +244,7 @@ NTSTATUS FspFileNodeCopyActiveList(PDEVICE_OBJECT DeviceObject,
     NTSTATUS Result;
     ULONG Index;
 
-    FspFsvolDeviceLockContextTable(DeviceObject);
+    FspFsvolDeviceLockContextTableShared(DeviceObject);
     Result = FspFsvolDeviceCopyContextList(DeviceObject, PFileNodes, PFileNodeCount);
     if (NT_SUCCESS(Result))
     {
@@ -316,6 +316,7 @@ NTSTATUS FspFileNodeCreate(PDEVICE_OBJECT DeviceObject,
     FileNode->Header.NodeTypeCode = FspFileNodeFileKind;
     FileNode->Header.NodeByteSize = sizeof *FileNode;
     FileNode->Header.IsFastIoPossible = FastIoIsNotPossible;
+        /* keep FsRtlCopyRead/FsRtlCopyWrite out; FspFastIoRead/FspFastIoWrite do their own checks */
     FileNode->Header.Resource = &NonPaged->Resource;
     FileNode->Header.PagingIoResource = &NonPaged->PagingIoResource;
     FileNode->Header.ValidDataLength.QuadPart = MAXLONGLONG;
@@ -581,6 +582,9 @@ NTSTATUS FspFileNodeOpen(FSP_FILE_NODE *FileNode, PFILE_OBJECT FileObject,
 
     *PSharingViolationReason = FspFileNodeSharingViolationGeneral;
 
+    /* hash the file name outside the lock; the FileNode is not yet visible to anyone else */
+    FileNode->FileNameHash = FspFsvolDeviceHashContextByName(FsvolDeviceObject, &FileNode->FileName);
+
     FspFsvolDeviceLockContextTable(FsvolDeviceObject);
 
     /*
@@ -617,7 +621,8 @@ NTSTATUS FspFileNodeOpen(FSP_FILE_NODE *FileNode, PFILE_OBJECT FileObject,
     }
 
     OpenedFileNode = FspFsvolDeviceInsertContextByName(FsvolDeviceObject,
-        &FileNode->FileName, FileNode, &FileNode->ContextByNameElementStorage, &Inserted);
+        &FileNode->FileName, FileNode->FileNameHash, FileNode,
+        &FileNode->ContextByNameElementStorage, &Inserted);
     ASSERT(0 != OpenedFileNode);
 
     if (Inserted)
@@ -821,7 +826,8 @@ VOID FspFileNodeCleanupComplete(FSP_FILE_NODE *FileNode, PFILE_OBJECT FileObject
 
         if (DeletePending)
         {
-            FspFsvolDeviceDeleteContextByName(FsvolDeviceObject, &FileNode->FileName,
+            FspFsvolDeviceDeleteContextByName(FsvolDeviceObject,
+                &FileNode->FileName, FileNode->FileNameHash,
                 &DeletedFromContextTable);
             ASSERT(DeletedFromContextTable);
 
@@ -854,7 +860,8 @@ VOID FspFileNodeCleanupComplete(FSP_FILE_NODE *FileNode, PFILE_OBJECT FileObject
                 {
                     DescendantFileNode = DescendantFileNodes[DescendantFileNodeIndex];
 
-                    FspFsvolDeviceDeleteContextByName(FsvolDeviceObject, &DescendantFileNode->FileName,
+                    FspFsvolDeviceDeleteContextByName(FsvolDeviceObject,
+                        &DescendantFileNode->FileName, DescendantFileNode->FileNameHash,
                         &StreamDeletedFromContextTable);
                     if (StreamDeletedFromContextTable)
                     {
@@ -941,7 +948,8 @@ VOID FspFileNodeClose(FSP_FILE_NODE *FileNode,
 
     if (0 < FileNode->OpenCount && 0 == --FileNode->OpenCount)
     {
-        FspFsvolDeviceDeleteContextByName(FsvolDeviceObject, &FileNode->FileName,
+        FspFsvolDeviceDeleteContextByName(FsvolDeviceObject,
+            &FileNode->FileName, FileNode->FileNameHash,
             &DeletedFromContextTable);
         ASSERT(DeletedFromContextTable);
     }
@@ -1451,7 +1459,8 @@ VOID FspFileNodeRename(FSP_FILE_NODE *FileNode, PUNICODE_STRING NewFileName)
         if (AcquireForeign)
             FspFileNodeAcquireExclusiveForeign(DescendantFileNode);
 
-        FspFsvolDeviceDeleteContextByName(FsvolDeviceObject, &DescendantFileNode->FileName, &Deleted);
+        FspFsvolDeviceDeleteContextByName(FsvolDeviceObject,
+            &DescendantFileNode->FileName, DescendantFileNode->FileNameHash, &Deleted);
         ASSERT(Deleted);
 
         ExternalFileName = DescendantFileNode->ExternalFileName;
@@ -1474,9 +1483,12 @@ VOID FspFileNodeRename(FSP_FILE_NODE *FileNode, PUNICODE_STRING NewFileName)
         if (0 != ExternalFileName)
             FspFree(ExternalFileName);
 
+        DescendantFileNode->FileNameHash = FspFsvolDeviceHashContextByName(FsvolDeviceObject,
+            &DescendantFileNode->FileName);
+
         InsertedFileNode = FspFsvolDeviceInsertContextByName(
-            FsvolDeviceObject, &DescendantFileNode->FileName, DescendantFileNode,
-            &DescendantFileNode->ContextByNameElementStorage, &Inserted);
+            FsvolDeviceObject, &DescendantFileNode->FileName, DescendantFileNode->FileNameHash,
+            DescendantFileNode, &DescendantFileNode->ContextByNameElementStorage, &Inserted);
         if (!Inserted)
         {
             /*
@@ -1491,14 +1503,15 @@ VOID FspFileNodeRename(FSP_FILE_NODE *FileNode, PUNICODE_STRING NewFileName)
             ASSERT(0 != InsertedFileNode->OpenCount);
 
             InsertedFileNode->OpenCount = 0;
-            FspFsvolDeviceDeleteContextByName(FsvolDeviceObject, &InsertedFileNode->FileName, &Deleted);
+            FspFsvolDeviceDeleteContextByName(FsvolDeviceObject,
+                &InsertedFileNode->FileName, InsertedFileNode->FileNameHash, &Deleted);
             ASSERT(Deleted);
 
             FspFileNodeDereference(InsertedFileNode);
 
             FspFsvolDeviceInsertContextByName(
-                FsvolDeviceObject, &DescendantFileNode->FileName, DescendantFileNode,
-                &DescendantFileNode->ContextByNameElementStorage, &Inserted);
+                FsvolDeviceObject, &DescendantFileNode->FileName, DescendantFileNode->FileNameHash,
+                DescendantFileNode, &DescendantFileNode->ContextByNameElementStorage, &Inserted);
             ASSERT(Inserted);
         }
 
@@ -1670,8 +1683,9 @@ BOOLEAN FspFileNodeTrySetFileInfoOnOpen(FSP_FILE_NODE *FileNode, PFILE_OBJECT Cc
 
     BOOLEAN EarlyExit;
 
-    FspFsvolDeviceLockContextTable(FileNode->FsvolDeviceObject);
-    EarlyExit = 1 < FileNode->OpenCount;
+    /* an open held by the delayed-close cache has no FileObject; do not count it */
+    FspFsvolDeviceLockContextTableShared(FileNode->FsvolDeviceObject);
+    EarlyExit = 1 < FileNode->OpenCount - (0 != FileNode->CloseCacheEntry);
     FspFsvolDeviceUnlockContextTable(FileNode->FsvolDeviceObject);
 
     if (EarlyExit)
@@ -1746,9 +1760,16 @@ VOID FspFileNodeSetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size)
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension =
         FspFsvolDeviceExtension(FileNode->FsvolDeviceObject);
 
-    FspMetaCacheInvalidateItem(FsvolDeviceExtension->SecurityCache, FileNode->Security);
+    /*
+     * Security descriptors are interned by content in the SecurityCache: file nodes
+     * with identical descriptors share the same item. Add the new descriptor before
+     * releasing the old one, so that setting an unchanged descriptor simply yields
+     * the same item.
+     */
+    UINT64 Security = FileNode->Security;
     FileNode->Security = 0 != Buffer ?
-        FspMetaCacheAddItem(FsvolDeviceExtension->SecurityCache, Buffer, Size) : 0;
+        FspMetaCacheAddSharedItem(FsvolDeviceExtension->SecurityCache, Buffer, Size) : 0;
+    FspMetaCacheInvalidateItem(FsvolDeviceExtension->SecurityCache, Security);
     FileNode->SecurityChangeNumber++;
 }
 
@@ -1784,6 +1805,11 @@ VOID FspFileNodeSetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size)
 {
     // !PAGED_CODE();
 
+    /*
+     * Buffer is an FSP_DIR_INFO_CHUNKS index. The DirInfo cache takes over the chunk
+     * references held by the index, even if the item cannot be added.
+     */
+
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension =
         FspFsvolDeviceExtension(FileNode->FsvolDeviceObject);
     FSP_FILE_NODE_NONPAGED *NonPaged = FileNode->NonPaged;
@@ -1796,7 +1822,7 @@ VOID FspFileNodeSetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size)
     FspMetaCacheInvalidateItem(FsvolDeviceExtension->DirInfoCache, DirInfo);
     DirInfo = 0 != Buffer ?
         FspMetaCacheAddItem(FsvolDeviceExtension->DirInfoCache, Buffer, Size) : 0;
-    FileNode->DirInfoChangeNumber++;
+    InterlockedIncrement((PLONG)&FileNode->DirInfoChangeNumber);
 
     /* acquire the NpInfoSpinLock to protect against concurrent FspFileNodeInvalidateDirInfo */
     KeAcquireSpinLock(&NonPaged->NpInfoSpinLock, &Irql);
@@ -1832,6 +1858,9 @@ static VOID FspFileNodeInvalidateDirInfo(FSP_FILE_NODE *FileNode)
     KeReleaseSpinLock(&NonPaged->NpInfoSpinLock, Irql);
 
     FspMetaCacheInvalidateItem(FsvolDeviceExtension->DirInfoCache, DirInfo);
+
+    /* fail concurrent FspFileNodeTrySetDirInfo; they may hold a listing from before this point */
+    InterlockedIncrement((PLONG)&FileNode->DirInfoChangeNumber);
 }
 
 static VOID FspFileNodeInvalidateDirInfoByName(PDEVICE_OBJECT FsvolDeviceObject,
@@ -1840,9 +1869,12 @@ static VOID FspFileNodeInvalidateDirInfoByName(PDEVICE_OBJECT FsvolDeviceObject,
     PAGED_CODE();
 
     FSP_FILE_NODE *FileNode;
+    ULONG FileNameHash;
 
-    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
-    FileNode = FspFsvolDeviceLookupContextByName(FsvolDeviceObject, FileName);
+    FileNameHash = FspFsvolDeviceHashContextByName(FsvolDeviceObject, FileName);
+
+    FspFsvolDeviceLockContextTableShared(FsvolDeviceObject);
+    FileNode = FspFsvolDeviceLookupContextByName(FsvolDeviceObject, FileName, FileNameHash);
     if (0 != FileNode)
         FspFileNodeReference(FileNode);
     FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
@@ -2120,6 +2152,7 @@ NTSTATUS FspFileDescResetDirectory(FSP_FILE_DESC *FileDesc,
         }
 
         FileDesc->DirectoryPattern = DirectoryPattern;
+        FspFileNamePatternCompile(&FileDesc->DirectoryPatternCompiled, &DirectoryPattern);
         FileDesc->DirectoryHasSuchFile = FALSE;
 
         if (0 != FileDesc->DirectoryMarker.Buffer)
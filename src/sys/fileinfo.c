@@ -77,6 +77,12 @@ FSP_IOCMPL_DISPATCH FspFsvolSetInformationComplete;
 static FSP_IOP_REQUEST_FINI FspFsvolSetInformationRequestFini;
 FSP_DRIVER_DISPATCH FspQueryInformation;
 FSP_DRIVER_DISPATCH FspSetInformation;
+static BOOLEAN FspFastIoQueryInformation(PFILE_OBJECT FileObject, BOOLEAN Wait,
+    FILE_INFORMATION_CLASS FileInformationClass, PVOID Buffer, ULONG Length,
+    PIO_STATUS_BLOCK IoStatus);
+FAST_IO_QUERY_BASIC_INFO FspFastIoQueryBasicInfo;
+FAST_IO_QUERY_STANDARD_INFO FspFastIoQueryStandardInfo;
+FAST_IO_QUERY_NETWORK_OPEN_INFO FspFastIoQueryNetworkOpenInfo;
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FspFsvolQueryAllInformation)
@@ -108,6 +114,10 @@ FSP_DRIVER_DISPATCH FspSetInformation;
 #pragma alloc_text(PAGE, FspFsvolSetInformationRequestFini)
 #pragma alloc_text(PAGE, FspQueryInformation)
 #pragma alloc_text(PAGE, FspSetInformation)
+#pragma alloc_text(PAGE, FspFastIoQueryInformation)
+#pragma alloc_text(PAGE, FspFastIoQueryBasicInfo)
+#pragma alloc_text(PAGE, FspFastIoQueryStandardInfo)
+#pragma alloc_text(PAGE, FspFastIoQueryNetworkOpenInfo)
 #endif
 
 enum
@@ -1240,6 +1250,9 @@ static NTSTATUS FspFsvolSetRenameInformation(
     }
 
     FspFsvolDeviceFileRenameAcquireExclusive(FsvolDeviceObject);
+
+    /* closes that are still batched must reach the file system before the rename */
+    FspFsvolCloseBatchFlush(FsvolDeviceObject);
 retry:
     FspFileNodeAcquireExclusive(FileNode, Full);
 
@@ -1298,6 +1311,10 @@ retry:
         Request->Req.SetInformation.FileInformationClass = FileRenameInformation;
         Request->Req.SetInformation.Info.Rename.NewFileName.Offset = Request->FileName.Size;
         Request->Req.SetInformation.Info.Rename.NewFileName.Size = NewFileName.Length + sizeof(WCHAR);
+
+        /* opens held by the delayed-close cache must also reach the file system before the rename */
+        FspFsvolCloseCacheEvictSubtree(FsvolDeviceObject, &FileNode->FileName);
+        FspFsvolCloseCacheEvictSubtree(FsvolDeviceObject, &NewFileName);
     }
 
     /*
@@ -1406,6 +1423,9 @@ static NTSTATUS FspFsvolSetRenameInformationSuccess(
         (Request->Buffer + Request->Req.SetInformation.Info.Rename.NewFileName.Offset);
     FspFileNodeRename(FileNode, &NewFileName);
 
+    /* the new name (and any names below it) now exist; drop any negative name cache entries */
+    FspFsvolDeviceInvalidateNegativeName(FsvolDeviceObject, &FileNode->FileName, TRUE);
+
     /* fastfat has some really arcane rules on rename notifications; simplify! */
     FspFileNodeNotifyChange(FileNode,
         FileNode->IsDirectory ? FILE_NOTIFY_CHANGE_DIR_NAME : FILE_NOTIFY_CHANGE_FILE_NAME,
@@ -1518,7 +1538,9 @@ retry:
         }
     }
 
-    Result = FspIopCreateRequestEx(Irp, 0, 0, FspFsvolSetInformationRequestFini, &Request);
+    /* the file name lets the user mode directory cache invalidate only the containing listing */
+    Result = FspIopCreateRequestEx(Irp, &FileNode->FileName, 0,
+        FspFsvolSetInformationRequestFini, &Request);
     if (!NT_SUCCESS(Result))
     {
         FspFileNodeRelease(FileNode, Full);
@@ -1754,3 +1776,100 @@ NTSTATUS FspSetInformation(
         FileInformationClassSym(IrpSp->Parameters.SetFile.FileInformationClass),
         IrpSp->FileObject);
 }
+
+static BOOLEAN FspFastIoQueryInformation(PFILE_OBJECT FileObject, BOOLEAN Wait,
+    FILE_INFORMATION_CLASS FileInformationClass, PVOID Buffer, ULONG Length,
+    PIO_STATUS_BLOCK IoStatus)
+{
+    /*
+     * Answer the query from the FileNode's FileInfo if it has not expired; otherwise return
+     * FALSE and let the IRP path go to user mode.
+     */
+
+    PAGED_CODE();
+
+    NTSTATUS Result;
+    FSP_FILE_NODE *FileNode = FileObject->FsContext;
+    PVOID BufferBgn = Buffer;
+    PVOID BufferEnd = (PUINT8)Buffer + Length;
+    FSP_FSCTL_FILE_INFO FileInfoBuf;
+    BOOLEAN Success;
+
+    if (!FspFileNodeIsValid(FileNode))
+        return FALSE;
+
+    Success = DEBUGTEST(90) &&
+        FspFileNodeTryAcquireSharedF(FileNode, FspFileNodeAcquireMain, Wait);
+    if (!Success)
+        return FALSE;
+    Success = FspFileNodeTryGetFileInfo(FileNode, &FileInfoBuf);
+    FspFileNodeRelease(FileNode, Main);
+    if (!Success)
+        return FALSE;
+
+    switch (FileInformationClass)
+    {
+    case FileBasicInformation:
+        Result = FspFsvolQueryBasicInformation(FileObject, &Buffer, BufferEnd, &FileInfoBuf);
+        break;
+    case FileNetworkOpenInformation:
+        Result = FspFsvolQueryNetworkOpenInformation(FileObject, &Buffer, BufferEnd, &FileInfoBuf);
+        break;
+    case FileStandardInformation:
+        Result = FspFsvolQueryStandardInformation(FileObject, &Buffer, BufferEnd, &FileInfoBuf);
+        break;
+    default:
+        ASSERT(0);
+        return FALSE;
+    }
+
+    IoStatus->Status = Result;
+    IoStatus->Information = (UINT_PTR)((PUINT8)Buffer - (PUINT8)BufferBgn);
+
+    return TRUE;
+}
+
+BOOLEAN FspFastIoQueryBasicInfo(
+    PFILE_OBJECT FileObject,
+    BOOLEAN Wait,
+    PFILE_BASIC_INFORMATION Buffer,
+    PIO_STATUS_BLOCK IoStatus,
+    PDEVICE_OBJECT DeviceObject)
+{
+    FSP_ENTER_BOOL(PAGED_CODE());
+
+    Result = FspFastIoQueryInformation(FileObject, Wait,
+        FileBasicInformation, Buffer, sizeof *Buffer, IoStatus);
+
+    FSP_LEAVE_BOOL("FileObject=%p", FileObject);
+}
+
+BOOLEAN FspFastIoQueryStandardInfo(
+    PFILE_OBJECT FileObject,
+    BOOLEAN Wait,
+    PFILE_STANDARD_INFORMATION Buffer,
+    PIO_STATUS_BLOCK IoStatus,
+    PDEVICE_OBJECT DeviceObject)
+{
+    FSP_ENTER_BOOL(PAGED_CODE());
+
+    Result = FspFastIoQueryInformation(FileObject, Wait,
+        FileStandardInformation, Buffer, sizeof *Buffer, IoStatus);
+
+    FSP_LEAVE_BOOL("FileObject=%p", FileObject);
+}
+
+BOOLEAN FspFastIoQueryNetworkOpenInfo(
+    PFILE_OBJECT FileObject,
+    BOOLEAN Wait,
+    PFILE_NETWORK_OPEN_INFORMATION Buffer,
+    PIO_STATUS_BLOCK IoStatus,
+    PDEVICE_OBJECT DeviceObject)
+{
+    FSP_ENTER_BOOL(PAGED_CODE());
+
+    Result = FspFastIoQueryInformation(FileObject, Wait,
+        FileNetworkOpenInformation, Buffer, sizeof *Buffer, IoStatus);
+
+    FSP_LEAVE_BOOL("FileObject=%p", FileObject);
+}
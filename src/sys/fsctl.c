@@ -85,6 +85,14 @@ static NTSTATUS FspFsctlFileSystemControl(
             if (0 != IrpSp->FileObject->FsContext2)
                 Result = FspVolumeTransact(FsctlDeviceObject, Irp, IrpSp);
             break;
+        case FSP_FSCTL_TRANSACT_RING_SETUP:
+            if (0 != IrpSp->FileObject->FsContext2)
+                Result = FspVolumeTransactRingSetup(FsctlDeviceObject, Irp, IrpSp);
+            break;
+        case FSP_FSCTL_TRANSACT_RING:
+            if (0 != IrpSp->FileObject->FsContext2)
+                Result = FspVolumeTransactRing(FsctlDeviceObject, Irp, IrpSp);
+            break;
         case FSP_FSCTL_STOP:
             if (0 != IrpSp->FileObject->FsContext2)
                 Result = FspVolumeStop(FsctlDeviceObject, Irp, IrpSp);
@@ -334,6 +342,9 @@ static NTSTATUS FspFsvolFileSystemControlReparsePointComplete(
 
         FspFileNodeInvalidateFileInfo(FileNode);
 
+        /* names below a (former) reparse point may now resolve differently */
+        FspFsvolDeviceInvalidateNegativeName(IrpSp->DeviceObject, &FileNode->FileName, TRUE);
+
         FileDesc->DidSetReparsePoint = TRUE;
         FileDesc->DidSetMetadata = TRUE;
 
@@ -425,7 +436,7 @@ static NTSTATUS FspFsvolFileSystemControlOplock(
         FspFileNodeAcquireExclusive(FileNode, Main);
         if (!FsRtlOplockIsSharedRequest(Irp))
         {
-            FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+            FspFsvolDeviceLockContextTableShared(FsvolDeviceObject);
             OplockCount = FileNode->HandleCount;
             FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
         }
@@ -571,8 +582,33 @@ static NTSTATUS FspFsvolFileSystemControlGetStatistics(
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
     PVOID Buffer = Irp->AssociatedIrp.SystemBuffer;
     ULONG Length = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+    FSP_STATISTICS *Statistics = FsvolDeviceExtension->Statistics;
+    struct
+    {
+        FSP_META_CACHE *MetaCache;
+        FSP_FSCTL_META_CACHE_STATISTICS *Statistics;
+    } MetaCaches[] =
+    {
+        { FsvolDeviceExtension->SecurityCache, &Statistics[0].Winfsp.SecurityCache },
+        { FsvolDeviceExtension->DirInfoCache, &Statistics[0].Winfsp.DirInfoCache },
+        { FsvolDeviceExtension->StreamInfoCache, &Statistics[0].Winfsp.StreamInfoCache },
+    };
+    FSP_META_CACHE_STATISTICS MetaCacheStatistics;
+
+    /* the meta caches and negative name cache are per volume; report them in the first record */
+    for (ULONG Index = 0; ARRAYSIZE(MetaCaches) > Index; Index++)
+    {
+        FspMetaCacheGetStatistics(MetaCaches[Index].MetaCache, &MetaCacheStatistics);
+        MetaCaches[Index].Statistics->ItemCount = MetaCacheStatistics.ItemCount;
+        MetaCaches[Index].Statistics->Hits = MetaCacheStatistics.HitCount;
+        MetaCaches[Index].Statistics->Misses = MetaCacheStatistics.MissCount;
+        MetaCaches[Index].Statistics->Evictions = MetaCacheStatistics.EvictionCount;
+        MetaCaches[Index].Statistics->Shares = MetaCacheStatistics.ShareCount;
+    }
+    FspFsvolDeviceGetNegativeNameStatistics(FsvolDeviceObject,
+        &Statistics[0].Winfsp.NegativeNameCache);
 
-    Result = FspStatisticsCopy(FsvolDeviceExtension->Statistics, Buffer, &Length);
+    Result = FspStatisticsCopy(Statistics, Buffer, &Length);
 
     Irp->IoStatus.Information = Length;
 
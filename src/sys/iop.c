@@ -24,7 +24,7 @@ NTSTATUS FspIopCreateRequestWorkItem(FSP_FSCTL_TRANSACT_REQ *Request);
 VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request);
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini);
 NTSTATUS FspIopPostWorkRequestFunnel(PDEVICE_OBJECT DeviceObject,
-    FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN AllocateIrpMustSucceed);
+    FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN BestEffort, BOOLEAN Wait);
 static IO_COMPLETION_ROUTINE FspIopPostWorkRequestCompletion;
 VOID FspIopCompleteIrpEx(PIRP Irp, NTSTATUS Result, BOOLEAN DeviceDereference);
 VOID FspIopCompleteCanceledIrp(PIRP Irp);
@@ -78,41 +78,25 @@ NTSTATUS FspIopCreateRequestFunnel(
     if (FSP_FSCTL_TRANSACT_REQ_SIZEMAX < sizeof *Request + ExtraSize)
         return STATUS_INVALID_PARAMETER;
 
-    if (FlagOn(Flags, FspIopCreateRequestMustSucceedFlag))
-    {
-        RequestHeader = FspAllocatePoolMustSucceed(
-            FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
-            sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGN_OVERHEAD,
-            FSP_ALLOC_INTERNAL_TAG);
-
-        if (FlagOn(Flags, FspIopCreateRequestWorkItemFlag))
-        {
-            RequestWorkItem = FspAllocatePoolMustSucceed(
-                NonPagedPool, sizeof *RequestWorkItem, FSP_ALLOC_INTERNAL_TAG);
+    RequestHeader = FspPoolCacheAlloc(FspPoolCacheRequest,
+        FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
+        sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGN_OVERHEAD,
+        BooleanFlagOn(Flags, FspIopCreateRequestMustSucceedFlag));
+    if (0 == RequestHeader)
+        return STATUS_INSUFFICIENT_RESOURCES;
 
-            RtlZeroMemory(RequestWorkItem, sizeof *RequestWorkItem);
-        }
-    }
-    else
+    if (FlagOn(Flags, FspIopCreateRequestWorkItemFlag))
     {
-        RequestHeader = ExAllocatePoolWithTag(
-            FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
-            sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGN_OVERHEAD,
-            FSP_ALLOC_INTERNAL_TAG);
-        if (0 == RequestHeader)
-            return STATUS_INSUFFICIENT_RESOURCES;
-
-        if (FlagOn(Flags, FspIopCreateRequestWorkItemFlag))
+        RequestWorkItem = FspPoolCacheAlloc(FspPoolCacheWorkItem,
+            NonPagedPool, sizeof *RequestWorkItem,
+            BooleanFlagOn(Flags, FspIopCreateRequestMustSucceedFlag));
+        if (0 == RequestWorkItem)
         {
-            RequestWorkItem = FspAllocNonPaged(sizeof *RequestWorkItem);
-            if (0 == RequestWorkItem)
-            {
-                FspFree(RequestHeader);
-                return STATUS_INSUFFICIENT_RESOURCES;
-            }
-
-            RtlZeroMemory(RequestWorkItem, sizeof *RequestWorkItem);
+            FspPoolCacheFree(RequestHeader);
+            return STATUS_INSUFFICIENT_RESOURCES;
         }
+
+        RtlZeroMemory(RequestWorkItem, sizeof *RequestWorkItem);
     }
 
 #if 0 != REQ_HEADER_ALIGN_MASK
@@ -159,7 +143,8 @@ NTSTATUS FspIopCreateRequestWorkItem(FSP_FSCTL_TRANSACT_REQ *Request)
 
     if (0 == RequestHeader->WorkItem)
     {
-        RequestWorkItem = FspAllocNonPaged(sizeof *RequestWorkItem);
+        RequestWorkItem = FspPoolCacheAlloc(FspPoolCacheWorkItem,
+            NonPagedPool, sizeof *RequestWorkItem, FALSE);
         if (0 == RequestWorkItem)
             return STATUS_INSUFFICIENT_RESOURCES;
 
@@ -180,16 +165,16 @@ VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request)
         RequestHeader->RequestFini(Request, RequestHeader->Context);
 
     if (0 != RequestHeader->Response)
-        FspFree(RequestHeader->Response);
+        FspPoolCacheFree(RequestHeader->Response);
 
     if (0 != RequestHeader->WorkItem)
-        FspFree(RequestHeader->WorkItem);
+        FspPoolCacheFree(RequestHeader->WorkItem);
 
 #if 0 != REQ_HEADER_ALIGN_MASK
     RequestHeader = ((PVOID *)RequestHeader)[-1];
 #endif
 
-    FspFree(RequestHeader);
+    FspPoolCacheFree(RequestHeader);
 }
 
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini)
@@ -206,14 +191,20 @@ VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *R
 }
 
 NTSTATUS FspIopPostWorkRequestFunnel(PDEVICE_OBJECT DeviceObject,
-    FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN BestEffort)
+    FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN BestEffort, BOOLEAN Wait)
 {
+    /*
+     * If Wait is TRUE, do not return until the user-mode file system has responded to
+     * the Request (or the Request has been canceled because the volume is going away).
+     */
+
     PAGED_CODE();
 
     ASSERT(0 == Request->Hint);
 
     NTSTATUS Result;
     PIRP Irp;
+    KEVENT Event;
 
     if (BestEffort)
         Irp = FspAllocateIrpMustSucceed(DeviceObject->StackSize);
@@ -238,11 +229,18 @@ NTSTATUS FspIopPostWorkRequestFunnel(PDEVICE_OBJECT DeviceObject,
 
     ASSERT(METHOD_NEITHER == (IrpSp->Parameters.DeviceIoControl.IoControlCode & 3));
 
-    IoSetCompletionRoutine(Irp, FspIopPostWorkRequestCompletion, 0, TRUE, TRUE, TRUE);
+    if (Wait)
+        KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    IoSetCompletionRoutine(Irp, FspIopPostWorkRequestCompletion, Wait ? &Event : 0,
+        TRUE, TRUE, TRUE);
 
     Result = IoCallDriver(DeviceObject, Irp);
     if (STATUS_PENDING == Result)
+    {
+        if (Wait)
+            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, 0);
         return STATUS_SUCCESS;
+    }
 
     /*
      * If we did not receive STATUS_PENDING, we still own the Request and must delete it!
@@ -259,8 +257,13 @@ static NTSTATUS FspIopPostWorkRequestCompletion(
 {
     // !PAGED_CODE();
 
+    PKEVENT Event = Context;
+
     IoFreeIrp(Irp);
 
+    if (0 != Event)
+        KeSetEvent(Event, 1, FALSE);
+
     return STATUS_MORE_PROCESSING_REQUIRED;
 }
 
@@ -418,8 +421,9 @@ VOID FspIopSetIrpResponse(PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Response)
     if (0 != Response && RequestHeader->Response != Response)
     {
         if (0 != RequestHeader->Response)
-            FspFree(RequestHeader->Response);
-        RequestHeader->Response = FspAllocMustSucceed(Response->Size);
+            FspPoolCacheFree(RequestHeader->Response);
+        RequestHeader->Response = FspPoolCacheAlloc(FspPoolCacheResponse,
+            PagedPool, Response->Size, TRUE);
         RtlCopyMemory(RequestHeader->Response, Response, Response->Size);
         Response = RequestHeader->Response;
     }
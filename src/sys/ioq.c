@@ -24,8 +24,11 @@
  * difference is that an FSP_IOQ now has a third queue which is used to
  * retry IRP completions. Another difference is that the FSP_IOQ can now
  * use Queued Events (which are implemented on top of KQUEUE) instead of
- * SynchronizationEvent's. However the main ideas below are still valid, so
- * I am leaving the rest of the comment intact.]
+ * SynchronizationEvent's. Finally the FSP_IOQ is now sharded: there is one
+ * Pending queue per processor (up to FSP_IOQ_SHARD_COUNT_MAX) and the Processing
+ * queue is split into as many independently locked parts, each owning a range
+ * of the Processing hash buckets. However the main ideas below are still valid,
+ * so I am leaving the rest of the comment intact.]
  *
  * An FSP_IOQ encapsulates the main FSP mechanism for handling IRP's.
  * It has two queues: a "Pending" queue for managing newly arrived IRP's
@@ -135,11 +138,14 @@
  * FSP_IOQ_USE_QEVENT
  *
  * Define this macro to use Queued Events instead of simple SynchronizationEvent's.
+ *
+ * The Pending queues are sharded and have no common lock, so we must use FspQeventSet
+ * (which serializes on the Queued Event's own lock) rather than FspQeventSetNoLock.
  */
 #if defined(FSP_IOQ_USE_QEVENT)
 #define FspIoqEventInitialize(E)        FspQeventInitialize(E, 0)
 #define FspIoqEventFinalize(E)          FspQeventFinalize(E)
-#define FspIoqEventSet(E)               FspQeventSetNoLock(E)
+#define FspIoqEventSet(E)               FspQeventSet(E)
 #define FspIoqEventCancellableWait(E,T,I)   FspQeventCancellableWait(E,T,I)
 #define FspIoqEventClear(E)             ((VOID)0)
 #else
@@ -212,32 +218,81 @@ typedef struct
 {
     PVOID IrpHint;
     ULONG ExpirationTime;
+    BOOLEAN BoundaryHit;
 } FSP_IOQ_PEEK_CONTEXT;
 
+static inline FSP_IOQ_QUEUE *FspIoqQueueFromCsq(PIO_CSQ IoCsq)
+{
+    return CONTAINING_RECORD(IoCsq, FSP_IOQ_QUEUE, IoCsq);
+}
+
+static inline ULONG FspIoqProcessBucketIndex(FSP_IOQ *Ioq, PVOID Irp)
+{
+    return FspHashMixPointer(Irp) % Ioq->ProcessIrpBucketCount;
+}
+
+static inline FSP_IOQ_QUEUE *FspIoqProcessQueue(FSP_IOQ *Ioq, PVOID Irp)
+{
+    /* each Process queue owns a contiguous range of buckets */
+    return &Ioq->ProcessQueues[FspIoqProcessBucketIndex(Ioq, Irp) / Ioq->ProcessIrpShardBucketCount];
+}
+
+static inline PIRP FspIoqPeekExpiredIrp(PLIST_ENTRY Head, PLIST_ENTRY Entry, ULONG ExpirationTime)
+{
+    for (; Head != Entry; Entry = Entry->Flink)
+    {
+        PIRP Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
+        if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
+            return FspIrpTimestamp(Irp) <= ExpirationTime ? Irp : 0;
+    }
+    return 0;
+}
+
 static inline VOID FspIoqPendingResetSynch(FSP_IOQ *Ioq)
 {
     /*
      * Examine the actual condition of the pending queue and
      * set the PendingIrpEvent accordingly.
+     *
+     * The PendingIrpCount is maintained with interlocked operations
+     * across all Pending queues, so this function does not require any
+     * lock to be held.
      */
     if (0 != Ioq->PendingIrpCount || Ioq->Stopped)
         /* list is not empty or is stopped; wake up a waiter */
         FspIoqEventSet(&Ioq->PendingIrpEvent);
     else
+    {
         /* list is empty and not stopped; future threads should go to sleep */
         /* NOTE: this is not stricly necessary! */
         FspIoqEventClear(&Ioq->PendingIrpEvent);
+#if !defined(FSP_IOQ_USE_QEVENT)
+        /*
+         * A concurrent insertion into another Pending queue may have set the
+         * event right before we cleared it. Re-examine the condition so that
+         * we do not lose its wakeup.
+         */
+        KeMemoryBarrier();
+        if (0 != Ioq->PendingIrpCount || Ioq->Stopped)
+            FspIoqEventSet(&Ioq->PendingIrpEvent);
+#endif
+    }
 }
 
 static NTSTATUS FspIoqPendingInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     if (Ioq->Stopped)
         return STATUS_CANCELLED;
-    if (!InsertContext && Ioq->PendingIrpCapacity <= Ioq->PendingIrpCount)
+    if ((ULONG)InterlockedIncrement(&Ioq->PendingIrpCount) > Ioq->PendingIrpCapacity &&
+        !InsertContext)
+    {
+        InterlockedDecrement(&Ioq->PendingIrpCount);
         return STATUS_INSUFFICIENT_RESOURCES;
-    Ioq->PendingIrpCount++;
-    InsertTailList(&Ioq->PendingIrpList, &Irp->Tail.Overlay.ListEntry);
+    }
+    Queue->IrpCount++;
+    InsertTailList(&Queue->IrpList, &Irp->Tail.Overlay.ListEntry);
     FspIoqEventSet(&Ioq->PendingIrpEvent);
         /* equivalent to FspIoqPendingResetSynch(Ioq) */
     return STATUS_SUCCESS;
@@ -245,18 +300,21 @@ static NTSTATUS FspIoqPendingInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertCo
 
 static VOID FspIoqPendingRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    Ioq->PendingIrpCount--;
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
+    Queue->IrpCount--;
+    InterlockedDecrement(&Ioq->PendingIrpCount);
     RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
     FspIoqPendingResetSynch(Ioq);
 }
 
 static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     if (PeekContext && Ioq->Stopped)
         return 0;
-    PLIST_ENTRY Head = &Ioq->PendingIrpList;
+    PLIST_ENTRY Head = &Queue->IrpList;
     PLIST_ENTRY Entry = 0 == Irp ? Head->Flink : Irp->Tail.Overlay.ListEntry.Flink;
     if (Head == Entry)
         return 0;
@@ -265,54 +323,28 @@ static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
         return Irp;
     PVOID IrpHint = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->IrpHint;
     if (0 == IrpHint)
-    {
-        ULONG ExpirationTime = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime;
-        for (;;)
-        {
-            if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
-                return FspIrpTimestamp(Irp) <= ExpirationTime ? Irp : 0;
-            Entry = Entry->Flink;
-            if (Head == Entry)
-                return 0;
-            Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
-        }
-    }
+        return FspIoqPeekExpiredIrp(Head, Entry, ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime);
     else
     {
         if (Irp == IrpHint)
+        {
+            ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->BoundaryHit = TRUE;
             return 0;
+        }
         return Irp;
     }
 }
 
-_IRQL_raises_(DISPATCH_LEVEL)
-static VOID FspIoqPendingAcquireLock(PIO_CSQ IoCsq, _At_(*PIrql, _IRQL_saves_) PKIRQL PIrql)
-{
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    KeAcquireSpinLock(&Ioq->SpinLock, PIrql);
-}
-
-_IRQL_requires_(DISPATCH_LEVEL)
-static VOID FspIoqPendingReleaseLock(PIO_CSQ IoCsq, _IRQL_restores_ KIRQL Irql)
-{
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-}
-
-static VOID FspIoqPendingCompleteCanceledIrp(PIO_CSQ IoCsq, PIRP Irp)
-{
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    Ioq->CompleteCanceledIrp(Irp);
-}
-
 static NTSTATUS FspIoqProcessInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     if (Ioq->Stopped)
         return STATUS_CANCELLED;
-    Ioq->ProcessIrpCount++;
-    InsertTailList(&Ioq->ProcessIrpList, &Irp->Tail.Overlay.ListEntry);
-    ULONG Index = FspHashMixPointer(Irp) % Ioq->ProcessIrpBucketCount;
+    Queue->IrpCount++;
+    InsertTailList(&Queue->IrpList, &Irp->Tail.Overlay.ListEntry);
+    ULONG Index = FspIoqProcessBucketIndex(Ioq, Irp);
+    ASSERT(FspIoqProcessQueue(Ioq, Irp) == Queue);
 #if DBG
     for (PIRP IrpX = Ioq->ProcessIrpBuckets[Index]; IrpX; IrpX = FspIrpDictNext(IrpX))
         ASSERT(IrpX != Irp);
@@ -325,8 +357,9 @@ static NTSTATUS FspIoqProcessInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertCo
 
 static VOID FspIoqProcessRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
-    ULONG Index = FspHashMixPointer(Irp) % Ioq->ProcessIrpBucketCount;
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
+    ULONG Index = FspIoqProcessBucketIndex(Ioq, Irp);
     for (PIRP *PIrp = (PIRP *)&Ioq->ProcessIrpBuckets[Index];; PIrp = &FspIrpDictNext(*PIrp))
     {
         ASSERT(0 != *PIrp);
@@ -337,16 +370,17 @@ static VOID FspIoqProcessRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
             break;
         }
     }
-    Ioq->ProcessIrpCount--;
+    Queue->IrpCount--;
     RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
 }
 
 static PIRP FspIoqProcessPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     if (PeekContext && Ioq->Stopped)
         return 0;
-    PLIST_ENTRY Head = &Ioq->ProcessIrpList;
+    PLIST_ENTRY Head = &Queue->IrpList;
     PLIST_ENTRY Entry = 0 == Irp ? Head->Flink : Irp->Tail.Overlay.ListEntry.Flink;
     if (Head == Entry)
         return 0;
@@ -355,21 +389,10 @@ static PIRP FspIoqProcessPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
         return Irp;
     PVOID IrpHint = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->IrpHint;
     if (0 == IrpHint)
-    {
-        ULONG ExpirationTime = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime;
-        for (;;)
-        {
-            if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
-                return FspIrpTimestamp(Irp) <= ExpirationTime ? Irp : 0;
-            Entry = Entry->Flink;
-            if (Head == Entry)
-                return 0;
-            Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
-        }
-    }
+        return FspIoqPeekExpiredIrp(Head, Entry, ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime);
     else
     {
-        ULONG Index = FspHashMixPointer(IrpHint) % Ioq->ProcessIrpBucketCount;
+        ULONG Index = FspIoqProcessBucketIndex(Ioq, IrpHint);
         for (Irp = Ioq->ProcessIrpBuckets[Index]; Irp; Irp = FspIrpDictNext(Irp))
             if (Irp == IrpHint)
                 return Irp;
@@ -377,49 +400,31 @@ static PIRP FspIoqProcessPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
     }
 }
 
-_IRQL_raises_(DISPATCH_LEVEL)
-static VOID FspIoqProcessAcquireLock(PIO_CSQ IoCsq, _At_(*PIrql, _IRQL_saves_) PKIRQL PIrql)
-{
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
-    KeAcquireSpinLock(&Ioq->SpinLock, PIrql);
-}
-
-_IRQL_requires_(DISPATCH_LEVEL)
-static VOID FspIoqProcessReleaseLock(PIO_CSQ IoCsq, _IRQL_restores_ KIRQL Irql)
-{
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-}
-
-static VOID FspIoqProcessCompleteCanceledIrp(PIO_CSQ IoCsq, PIRP Irp)
-{
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
-    Ioq->CompleteCanceledIrp(Irp);
-}
-
 static NTSTATUS FspIoqRetriedInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, RetriedIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     if (Ioq->Stopped)
         return STATUS_CANCELLED;
-    Ioq->RetriedIrpCount++;
-    InsertTailList(&Ioq->RetriedIrpList, &Irp->Tail.Overlay.ListEntry);
+    Queue->IrpCount++;
+    InsertTailList(&Queue->IrpList, &Irp->Tail.Overlay.ListEntry);
     return STATUS_SUCCESS;
 }
 
 static VOID FspIoqRetriedRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, RetriedIoCsq);
-    Ioq->RetriedIrpCount--;
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    Queue->IrpCount--;
     RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
 }
 
 static PIRP FspIoqRetriedPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, RetriedIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     if (PeekContext && Ioq->Stopped)
         return 0;
-    PLIST_ENTRY Head = &Ioq->RetriedIrpList;
+    PLIST_ENTRY Head = &Queue->IrpList;
     PLIST_ENTRY Entry = 0 == Irp ? Head->Flink : Irp->Tail.Overlay.ListEntry.Flink;
     if (Head == Entry)
         return 0;
@@ -428,18 +433,7 @@ static PIRP FspIoqRetriedPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
         return Irp;
     PVOID IrpHint = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->IrpHint;
     if (0 == IrpHint)
-    {
-        ULONG ExpirationTime = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime;
-        for (;;)
-        {
-            if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
-                return FspIrpTimestamp(Irp) <= ExpirationTime ? Irp : 0;
-            Entry = Entry->Flink;
-            if (Head == Entry)
-                return 0;
-            Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
-        }
-    }
+        return FspIoqPeekExpiredIrp(Head, Entry, ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime);
     else
     {
         if (Irp == IrpHint)
@@ -449,25 +443,53 @@ static PIRP FspIoqRetriedPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 }
 
 _IRQL_raises_(DISPATCH_LEVEL)
-static VOID FspIoqRetriedAcquireLock(PIO_CSQ IoCsq, _At_(*PIrql, _IRQL_saves_) PKIRQL PIrql)
+static VOID FspIoqAcquireLock(PIO_CSQ IoCsq, _At_(*PIrql, _IRQL_saves_) PKIRQL PIrql)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, RetriedIoCsq);
-    KeAcquireSpinLock(&Ioq->SpinLock, PIrql);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    KeAcquireSpinLock(&Queue->SpinLock, PIrql);
 }
 
 _IRQL_requires_(DISPATCH_LEVEL)
-static VOID FspIoqRetriedReleaseLock(PIO_CSQ IoCsq, _IRQL_restores_ KIRQL Irql)
+static VOID FspIoqReleaseLock(PIO_CSQ IoCsq, _IRQL_restores_ KIRQL Irql)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, RetriedIoCsq);
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    KeReleaseSpinLock(&Queue->SpinLock, Irql);
 }
 
-static VOID FspIoqRetriedCompleteCanceledIrp(PIO_CSQ IoCsq, PIRP Irp)
+static VOID FspIoqCompleteCanceledIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, RetriedIoCsq);
+    FSP_IOQ_QUEUE *Queue = FspIoqQueueFromCsq(IoCsq);
+    FSP_IOQ *Ioq = Queue->Ioq;
     Ioq->CompleteCanceledIrp(Irp);
 }
 
+static VOID FspIoqQueueInitialize(FSP_IOQ *Ioq, FSP_IOQ_QUEUE *Queue,
+    PIO_CSQ_INSERT_IRP_EX CsqInsertIrp,
+    PIO_CSQ_REMOVE_IRP CsqRemoveIrp,
+    PIO_CSQ_PEEK_NEXT_IRP CsqPeekNextIrp)
+{
+    KeInitializeSpinLock(&Queue->SpinLock);
+    InitializeListHead(&Queue->IrpList);
+    IoCsqInitializeEx(&Queue->IoCsq,
+        CsqInsertIrp,
+        CsqRemoveIrp,
+        CsqPeekNextIrp,
+        FspIoqAcquireLock,
+        FspIoqReleaseLock,
+        FspIoqCompleteCanceledIrp);
+    Queue->Ioq = Ioq;
+}
+
+static ULONG FspIoqQueueIrpCount(FSP_IOQ_QUEUE *Queue)
+{
+    ULONG Result;
+    KIRQL Irql;
+    KeAcquireSpinLock(&Queue->SpinLock, &Irql);
+    Result = Queue->IrpCount;
+    KeReleaseSpinLock(&Queue->SpinLock, Irql);
+    return Result;
+}
+
 NTSTATUS FspIoqCreate(
     ULONG IrpCapacity, PLARGE_INTEGER IrpTimeout, VOID (*CompleteCanceledIrp)(PIRP Irp),
     FSP_IOQ **PIoq)
@@ -477,43 +499,38 @@ NTSTATUS FspIoqCreate(
     *PIoq = 0;
 
     FSP_IOQ *Ioq;
-    ULONG BucketCount = (PAGE_SIZE - sizeof *Ioq) / sizeof Ioq->ProcessIrpBuckets[0];
-    Ioq = FspAllocNonPaged(PAGE_SIZE);
+    ULONG Size = (ULONG)ROUND_TO_PAGES(sizeof *Ioq) + PAGE_SIZE;
+    ULONG ShardCount = FSP_IOQ_SHARD_COUNT_MAX >= FspProcessorCount ?
+        FspProcessorCount : FSP_IOQ_SHARD_COUNT_MAX;
+    ULONG ShardBucketCount = (Size - sizeof *Ioq) / sizeof Ioq->ProcessIrpBuckets[0] / ShardCount;
+    Ioq = FspAllocNonPaged(Size);
     if (0 == Ioq)
         return STATUS_INSUFFICIENT_RESOURCES;
-    RtlZeroMemory(Ioq, PAGE_SIZE);
+    RtlZeroMemory(Ioq, Size);
 
-    KeInitializeSpinLock(&Ioq->SpinLock);
     FspIoqEventInitialize(&Ioq->PendingIrpEvent);
-    InitializeListHead(&Ioq->PendingIrpList);
-    InitializeListHead(&Ioq->ProcessIrpList);
-    InitializeListHead(&Ioq->RetriedIrpList);
-    IoCsqInitializeEx(&Ioq->PendingIoCsq,
-        FspIoqPendingInsertIrpEx,
-        FspIoqPendingRemoveIrp,
-        FspIoqPendingPeekNextIrp,
-        FspIoqPendingAcquireLock,
-        FspIoqPendingReleaseLock,
-        FspIoqPendingCompleteCanceledIrp);
-    IoCsqInitializeEx(&Ioq->ProcessIoCsq,
-        FspIoqProcessInsertIrpEx,
-        FspIoqProcessRemoveIrp,
-        FspIoqProcessPeekNextIrp,
-        FspIoqProcessAcquireLock,
-        FspIoqProcessReleaseLock,
-        FspIoqProcessCompleteCanceledIrp);
-    IoCsqInitializeEx(&Ioq->RetriedIoCsq,
+    for (ULONG Index = 0; ShardCount > Index; Index++)
+    {
+        FspIoqQueueInitialize(Ioq, &Ioq->PendingQueues[Index],
+            FspIoqPendingInsertIrpEx,
+            FspIoqPendingRemoveIrp,
+            FspIoqPendingPeekNextIrp);
+        FspIoqQueueInitialize(Ioq, &Ioq->ProcessQueues[Index],
+            FspIoqProcessInsertIrpEx,
+            FspIoqProcessRemoveIrp,
+            FspIoqProcessPeekNextIrp);
+    }
+    FspIoqQueueInitialize(Ioq, &Ioq->RetriedQueue,
         FspIoqRetriedInsertIrpEx,
         FspIoqRetriedRemoveIrp,
-        FspIoqRetriedPeekNextIrp,
-        FspIoqRetriedAcquireLock,
-        FspIoqRetriedReleaseLock,
-        FspIoqRetriedCompleteCanceledIrp);
+        FspIoqRetriedPeekNextIrp);
     Ioq->IrpTimeout = ConvertInterruptTimeToSec(IrpTimeout->QuadPart + InterruptTimeToSecFactor - 1);
         /* convert to seconds (and round up) */
     Ioq->PendingIrpCapacity = IrpCapacity;
     Ioq->CompleteCanceledIrp = CompleteCanceledIrp;
-    Ioq->ProcessIrpBucketCount = BucketCount;
+    Ioq->ShardCount = ShardCount;
+    Ioq->ProcessIrpBucketCount = ShardBucketCount * ShardCount;
+    Ioq->ProcessIrpShardBucketCount = ShardBucketCount;
 
     *PIoq = Ioq;
 
@@ -529,30 +546,32 @@ VOID FspIoqDelete(FSP_IOQ *Ioq)
 
 VOID FspIoqStop(FSP_IOQ *Ioq)
 {
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
+    /*
+     * There is no single queue lock anymore. Insertions check the Stopped flag
+     * under their own queue lock; the memory barrier ensures that any insertion
+     * that acquires a queue lock after this point sees the flag, while any
+     * insertion that has already acquired the lock is drained below.
+     */
     Ioq->Stopped = TRUE;
+    KeMemoryBarrier();
     /* we are being stopped, permanently wake up waiters */
     FspIoqEventSet(&Ioq->PendingIrpEvent);
         /* equivalent to FspIoqPendingResetSynch(Ioq) */
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
     PIRP Irp;
-    while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, 0)))
-        Ioq->CompleteCanceledIrp(Irp);
-    while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, 0)))
-        Ioq->CompleteCanceledIrp(Irp);
-    while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->RetriedIoCsq, 0)))
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingQueues[Index].IoCsq, 0)))
+            Ioq->CompleteCanceledIrp(Irp);
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessQueues[Index].IoCsq, 0)))
+            Ioq->CompleteCanceledIrp(Irp);
+    while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->RetriedQueue.IoCsq, 0)))
         Ioq->CompleteCanceledIrp(Irp);
 }
 
 BOOLEAN FspIoqStopped(FSP_IOQ *Ioq)
 {
-    BOOLEAN Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Ioq->Stopped;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-    return Result;
+    KeMemoryBarrier();
+    return Ioq->Stopped;
 }
 
 VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime)
@@ -560,13 +579,16 @@ VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime)
     FSP_IOQ_PEEK_CONTEXT PeekContext;
     PeekContext.IrpHint = 0;
     PeekContext.ExpirationTime = ConvertInterruptTimeToSec(InterruptTime);
+    PeekContext.BoundaryHit = FALSE;
     PIRP Irp;
-    while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext)))
-        Ioq->CompleteCanceledIrp(Irp);
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingQueues[Index].IoCsq, &PeekContext)))
+            Ioq->CompleteCanceledIrp(Irp);
 #if !defined(FSP_IOQ_PROCESS_NO_CANCEL)
-    while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, &PeekContext)))
-        Ioq->CompleteCanceledIrp(Irp);
-    while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->RetryIoCsq, &PeekContext)))
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessQueues[Index].IoCsq, &PeekContext)))
+            Ioq->CompleteCanceledIrp(Irp);
+    while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->RetriedQueue.IoCsq, &PeekContext)))
         Ioq->CompleteCanceledIrp(Irp);
 #endif
 }
@@ -576,7 +598,9 @@ BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PR
     NTSTATUS Result;
     FspIrpTimestamp(Irp) = BestEffort ? FspIrpTimestampInfinity :
         QueryInterruptTimeInSec() + Ioq->IrpTimeout;
-    Result = IoCsqInsertIrpEx(&Ioq->PendingIoCsq, Irp, 0, (PVOID)BestEffort);
+    Result = IoCsqInsertIrpEx(
+        &Ioq->PendingQueues[KeGetCurrentProcessorNumber() % Ioq->ShardCount].IoCsq,
+        Irp, 0, (PVOID)BestEffort);
     if (NT_SUCCESS(Result))
     {
         if (0 != PResult)
@@ -591,6 +615,34 @@ BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PR
     }
 }
 
+static PIRP FspIoqPendingRemoveNextIrp(FSP_IOQ *Ioq, FSP_IOQ_PEEK_CONTEXT *PeekContext)
+{
+    /*
+     * Start with the Pending queue of the current processor and then steal
+     * work from the Pending queues of the other processors. Each queue is
+     * FIFO, but there is no ordering guarantee across queues.
+     *
+     * If we hit the boundary IRP in any queue we stop looking; this preserves
+     * the guarantee that a transact does not loop over IRP's it has reposted.
+     */
+    ULONG ShardCount = Ioq->ShardCount;
+    ULONG Index = KeGetCurrentProcessorNumber() % ShardCount;
+    PIRP Irp;
+    for (ULONG Count = 0; ShardCount > Count; Count++)
+    {
+        FSP_IOQ_QUEUE *Queue = &Ioq->PendingQueues[Index];
+        /* unsynchronized check; a missed IRP is picked up after FspIoqPendingResetSynch */
+        if (0 != Queue->IrpCount)
+        {
+            Irp = IoCsqRemoveNextIrp(&Queue->IoCsq, PeekContext);
+            if (0 != Irp || PeekContext->BoundaryHit)
+                return Irp;
+        }
+        Index = ShardCount > Index + 1 ? Index + 1 : 0;
+    }
+    return 0;
+}
+
 PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout,
     PIRP CancellableIrp)
 {
@@ -599,6 +651,7 @@ PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout
     PIRP PendingIrp;
     PeekContext.IrpHint = 0 != BoundaryIrp ? BoundaryIrp : (PVOID)1;
     PeekContext.ExpirationTime = 0;
+    PeekContext.BoundaryHit = FALSE;
     if (0 != Timeout)
     {
         NTSTATUS Result;
@@ -609,7 +662,7 @@ PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout
         if (STATUS_CANCELLED == Result || STATUS_THREAD_IS_TERMINATING == Result)
             return FspIoqCancelled;
         ASSERT(STATUS_SUCCESS == Result);
-        PendingIrp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext);
+        PendingIrp = FspIoqPendingRemoveNextIrp(Ioq, &PeekContext);
         if (0 == PendingIrp)
         {
             /*
@@ -618,25 +671,17 @@ PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout
              * our synchronization based on the actual condition of the pending
              * queue.
              */
-            KIRQL Irql;
-            KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
             FspIoqPendingResetSynch(Ioq);
-            KeReleaseSpinLock(&Ioq->SpinLock, Irql);
         }
     }
     else
-        PendingIrp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext);
+        PendingIrp = FspIoqPendingRemoveNextIrp(Ioq, &PeekContext);
     return PendingIrp;
 }
 
 ULONG FspIoqPendingIrpCount(FSP_IOQ *Ioq)
 {
-    ULONG Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Ioq->PendingIrpCount;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-    return Result;
+    return (ULONG)InterlockedCompareExchange(&Ioq->PendingIrpCount, 0, 0);
 }
 
 BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp)
@@ -648,7 +693,7 @@ BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp)
     if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
         FspIrpTimestamp(Irp) = QueryInterruptTimeInSec() + Ioq->IrpTimeout;
 #endif
-    Result = FspCsqInsertIrpEx(&Ioq->ProcessIoCsq, Irp, 0, 0);
+    Result = FspCsqInsertIrpEx(&FspIoqProcessQueue(Ioq, Irp)->IoCsq, Irp, 0, 0);
     return NT_SUCCESS(Result);
 }
 
@@ -659,16 +704,15 @@ PIRP FspIoqEndProcessingIrp(FSP_IOQ *Ioq, UINT_PTR IrpHint)
     FSP_IOQ_PEEK_CONTEXT PeekContext;
     PeekContext.IrpHint = (PVOID)IrpHint;
     PeekContext.ExpirationTime = 0;
-    return FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, &PeekContext);
+    PeekContext.BoundaryHit = FALSE;
+    return FspCsqRemoveNextIrp(&FspIoqProcessQueue(Ioq, (PVOID)IrpHint)->IoCsq, &PeekContext);
 }
 
 ULONG FspIoqProcessIrpCount(FSP_IOQ *Ioq)
 {
-    ULONG Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Ioq->ProcessIrpCount;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+    ULONG Result = 0;
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        Result += FspIoqQueueIrpCount(&Ioq->ProcessQueues[Index]);
     return Result;
 }
 
@@ -681,7 +725,7 @@ BOOLEAN FspIoqRetryCompleteIrp(FSP_IOQ *Ioq, PIRP Irp, NTSTATUS *PResult)
     if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
         FspIrpTimestamp(Irp) = QueryInterruptTimeInSec() + Ioq->IrpTimeout;
 #endif
-    Result = FspCsqInsertIrpEx(&Ioq->RetriedIoCsq, Irp, 0, 0);
+    Result = FspCsqInsertIrpEx(&Ioq->RetriedQueue.IoCsq, Irp, 0, 0);
     if (NT_SUCCESS(Result))
     {
         if (0 != PResult)
@@ -701,15 +745,11 @@ PIRP FspIoqNextCompleteIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp)
     FSP_IOQ_PEEK_CONTEXT PeekContext;
     PeekContext.IrpHint = 0 != BoundaryIrp ? BoundaryIrp : (PVOID)1;
     PeekContext.ExpirationTime = 0;
-    return FspCsqRemoveNextIrp(&Ioq->RetriedIoCsq, &PeekContext);
+    PeekContext.BoundaryHit = FALSE;
+    return FspCsqRemoveNextIrp(&Ioq->RetriedQueue.IoCsq, &PeekContext);
 }
 
 ULONG FspIoqRetriedIrpCount(FSP_IOQ *Ioq)
 {
-    ULONG Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Ioq->RetriedIrpCount;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-    return Result;
+    return FspIoqQueueIrpCount(&Ioq->RetriedQueue);
 }
@@ -17,14 +17,40 @@
 
 #include <sys/driver.h>
 
+/*
+ * The meta cache is striped: items are distributed round-robin (by ItemIndex)
+ * over up to FSP_META_CACHE_STRIPE_COUNT_MAX stripes, each with its own lock,
+ * expiration list and hash table. A stripe's hash table starts small and is
+ * doubled as items are added, so that the cache capacity is not bound by the
+ * number of buckets that fit in a page.
+ *
+ * Items added with FspMetaCacheAddSharedItem are also entered in a per-stripe
+ * content table keyed by a hash of their buffer. Adding a buffer that is
+ * identical to an existing shared item returns the existing ItemIndex and
+ * increments the item's ShareCount rather than creating a new item. To make
+ * this possible the stripe of a shared item is selected by its content hash
+ * rather than round-robin; the stripe is encoded in the low part of the
+ * ItemIndex (ItemIndex = Serial * StripeCount + StripeIndex).
+ *
+ * A cache may be created with an ItemFini callback. Such a cache takes over whatever
+ * the item buffers reference: ItemFini is called with the item buffer when the last
+ * reference to the item goes away, or with the caller's buffer if FspMetaCacheAddItem
+ * fails. Caches with an ItemFini cannot be used with FspMetaCacheAddSharedItem.
+ */
+
 typedef struct _FSP_META_CACHE_ITEM
 {
     LIST_ENTRY ListEntry;
     struct _FSP_META_CACHE_ITEM *DictNext;
+    struct _FSP_META_CACHE_ITEM *ContentNext;
     PVOID ItemBuffer;
+    FSP_META_CACHE_ITEM_FINI *ItemFini;
     UINT64 ItemIndex;
     UINT64 ExpirationTime;
     LONG RefCount;
+    ULONG ShareCount;
+    ULONG ContentHash;
+    BOOLEAN Shared;
 } FSP_META_CACHE_ITEM;
 
 typedef struct
@@ -39,18 +65,83 @@ static inline VOID FspMetaCacheDereferenceItem(FSP_META_CACHE_ITEM *Item)
     LONG RefCount = InterlockedDecrement(&Item->RefCount);
     if (0 == RefCount)
     {
-        /* if we ever need to add a finalizer for meta items it should go here */
+        if (0 != Item->ItemFini)
+        {
+            FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = Item->ItemBuffer;
+            Item->ItemFini(ItemBuffer->Buffer, ItemBuffer->Size);
+        }
         FspFree(Item->ItemBuffer);
         FspFree(Item);
     }
 }
 
-static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+static inline ULONG FspMetaCacheHashBuffer(PCVOID Buffer, ULONG Size)
+{
+    /* FNV-1a */
+    ULONG Hash = 2166136261;
+    for (PUINT8 P = (PVOID)Buffer, EndP = P + Size; EndP > P; P++)
+    {
+        Hash ^= *P;
+        Hash *= 16777619;
+    }
+    return Hash;
+}
+
+static inline FSP_META_CACHE_STRIPE *FspMetaCacheStripe(FSP_META_CACHE *MetaCache,
+    UINT64 ItemIndex)
+{
+    return &MetaCache->Stripes[ItemIndex % MetaCache->StripeCount];
+}
+
+static inline ULONG FspMetaCacheHashIndex(FSP_META_CACHE *MetaCache, FSP_META_CACHE_STRIPE *Stripe,
     UINT64 ItemIndex)
+{
+    /* ItemBucketCount is a power of 2 */
+    return (ULONG)FspHashMix64(ItemIndex / MetaCache->StripeCount) & (Stripe->ItemBucketCount - 1);
+}
+
+static inline ULONG FspMetaCacheContentHashIndex(FSP_META_CACHE *MetaCache, FSP_META_CACHE_STRIPE *Stripe,
+    ULONG ContentHash)
+{
+    /* ItemBucketCount is a power of 2 */
+    return (ContentHash / MetaCache->StripeCount) & (Stripe->ItemBucketCount - 1);
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupContentItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, ULONG ContentHash, PCVOID Buffer, ULONG Size)
+{
+    ULONG HashIndex = FspMetaCacheContentHashIndex(MetaCache, Stripe, ContentHash);
+    for (FSP_META_CACHE_ITEM *ItemX = Stripe->ContentBuckets[HashIndex]; ItemX; ItemX = ItemX->ContentNext)
+    {
+        FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = ItemX->ItemBuffer;
+        if (ItemX->ContentHash == ContentHash &&
+            ItemBuffer->Size == Size &&
+            RtlEqualMemory(ItemBuffer->Buffer, Buffer, Size))
+            return ItemX;
+    }
+    return 0;
+}
+
+static inline VOID FspMetaCacheRemoveContentItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, FSP_META_CACHE_ITEM *Item)
+{
+    if (!Item->Shared)
+        return;
+    ULONG HashIndex = FspMetaCacheContentHashIndex(MetaCache, Stripe, Item->ContentHash);
+    for (FSP_META_CACHE_ITEM **P = (PVOID)&Stripe->ContentBuckets[HashIndex]; *P; P = &(*P)->ContentNext)
+        if (*P == Item)
+        {
+            *P = (*P)->ContentNext;
+            break;
+        }
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ItemIndex)
 {
     FSP_META_CACHE_ITEM *Item = 0;
-    ULONG HashIndex = ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM *ItemX = MetaCache->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, ItemIndex);
+    for (FSP_META_CACHE_ITEM *ItemX = Stripe->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
         if (ItemX->ItemIndex == ItemIndex)
         {
             Item = ItemX;
@@ -59,77 +150,149 @@ static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_M
     return Item;
 }
 
-static inline VOID FspMetaCacheAddItemAtDpcLevel(FSP_META_CACHE *MetaCache, FSP_META_CACHE_ITEM *Item)
+static inline VOID FspMetaCacheGrowAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe)
 {
-    ULONG HashIndex = Item->ItemIndex % MetaCache->ItemBucketCount;
+    /*
+     * Double the bucket array once the load factor exceeds 1. If we cannot
+     * allocate a new bucket array we simply continue with longer chains.
+     */
+    ULONG BucketCount = Stripe->ItemBucketCount * 2;
+    PVOID *Buckets = FspAllocNonPaged(2 * BucketCount * sizeof Buckets[0]);
+    if (0 == Buckets)
+        return;
+    RtlZeroMemory(Buckets, 2 * BucketCount * sizeof Buckets[0]);
+    PVOID *OldBuckets = Stripe->ItemBuckets;
+    ULONG OldBucketCount = Stripe->ItemBucketCount;
+    Stripe->ItemBuckets = Buckets;
+    Stripe->ContentBuckets = Buckets + BucketCount;
+    Stripe->ItemBucketCount = BucketCount;
+    for (ULONG Index = 0; OldBucketCount > Index; Index++)
+    {
+        for (FSP_META_CACHE_ITEM *Item = OldBuckets[Index], *ItemNext; Item; Item = ItemNext)
+        {
+            ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, Item->ItemIndex);
+            ItemNext = Item->DictNext;
+            Item->DictNext = Stripe->ItemBuckets[HashIndex];
+            Stripe->ItemBuckets[HashIndex] = Item;
+            if (Item->Shared)
+            {
+                HashIndex = FspMetaCacheContentHashIndex(MetaCache, Stripe, Item->ContentHash);
+                Item->ContentNext = Stripe->ContentBuckets[HashIndex];
+                Stripe->ContentBuckets[HashIndex] = Item;
+            }
+        }
+    }
+    FspFree(OldBuckets);
+}
+
+static inline VOID FspMetaCacheAddItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, FSP_META_CACHE_ITEM *Item)
+{
+    if (Stripe->ItemCount >= Stripe->ItemBucketCount)
+        FspMetaCacheGrowAtDpcLevel(MetaCache, Stripe);
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, Item->ItemIndex);
 #if DBG
-    for (FSP_META_CACHE_ITEM *ItemX = MetaCache->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    for (FSP_META_CACHE_ITEM *ItemX = Stripe->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
         ASSERT(ItemX->ItemIndex != Item->ItemIndex);
 #endif
-    Item->DictNext = MetaCache->ItemBuckets[HashIndex];
-    MetaCache->ItemBuckets[HashIndex] = Item;
-    InsertTailList(&MetaCache->ItemList, &Item->ListEntry);
-    MetaCache->ItemCount++;
+    Item->DictNext = Stripe->ItemBuckets[HashIndex];
+    Stripe->ItemBuckets[HashIndex] = Item;
+    if (Item->Shared)
+    {
+        HashIndex = FspMetaCacheContentHashIndex(MetaCache, Stripe, Item->ContentHash);
+        Item->ContentNext = Stripe->ContentBuckets[HashIndex];
+        Stripe->ContentBuckets[HashIndex] = Item;
+    }
+    InsertTailList(&Stripe->ItemList, &Item->ListEntry);
+    Stripe->ItemCount++;
 }
 
 static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ItemIndex)
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ItemIndex)
 {
     FSP_META_CACHE_ITEM *Item = 0;
-    ULONG HashIndex = ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM **P = (PVOID)&MetaCache->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, ItemIndex);
+    for (FSP_META_CACHE_ITEM **P = (PVOID)&Stripe->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
         if ((*P)->ItemIndex == ItemIndex)
         {
             Item = *P;
+            if (0 != --Item->ShareCount)
+                /* item is still shared by other owners */
+                return 0;
             *P = (*P)->DictNext;
+            FspMetaCacheRemoveContentItemAtDpcLevel(MetaCache, Stripe, Item);
             RemoveEntryList(&Item->ListEntry);
-            MetaCache->ItemCount--;
+            Stripe->ItemCount--;
             break;
         }
     return Item;
 }
 
 static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveExpiredItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ExpirationTime)
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ExpirationTime)
 {
-    PLIST_ENTRY Head = &MetaCache->ItemList;
+    PLIST_ENTRY Head = &Stripe->ItemList;
     PLIST_ENTRY Entry = Head->Flink;
     if (Head == Entry)
         return 0;
     FSP_META_CACHE_ITEM *Item = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM, ListEntry);
-    if (!FspExpirationTimeValid2(Item->ExpirationTime, ExpirationTime))
+    if (FspExpirationTimeValid2(Item->ExpirationTime, ExpirationTime))
         return 0;
-    ULONG HashIndex = Item->ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM **P = (PVOID)&MetaCache->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, Item->ItemIndex);
+    for (FSP_META_CACHE_ITEM **P = (PVOID)&Stripe->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
         if (*P == Item)
         {
             *P = (*P)->DictNext;
             break;
         }
+    FspMetaCacheRemoveContentItemAtDpcLevel(MetaCache, Stripe, Item);
     RemoveEntryList(&Item->ListEntry);
-    MetaCache->ItemCount--;
+    Stripe->ItemCount--;
     return Item;
 }
 
 NTSTATUS FspMetaCacheCreate(
     ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    FSP_META_CACHE_ITEM_FINI *ItemFini,
     FSP_META_CACHE **PMetaCache)
 {
     *PMetaCache = 0;
     if (0 == MetaCapacity || 0 == ItemSizeMax || 0 == MetaTimeout->QuadPart)
         return STATUS_SUCCESS;
     FSP_META_CACHE *MetaCache;
-    ULONG BucketCount = (PAGE_SIZE - sizeof *MetaCache) / sizeof MetaCache->ItemBuckets[0];
-    MetaCache = FspAllocNonPaged(PAGE_SIZE);
+    ULONG StripeCount = FSP_META_CACHE_STRIPE_COUNT_MAX >= FspProcessorCount ?
+        FspProcessorCount : FSP_META_CACHE_STRIPE_COUNT_MAX;
+    if (StripeCount > MetaCapacity)
+        StripeCount = MetaCapacity;
+    ULONG Size = sizeof *MetaCache + StripeCount * sizeof MetaCache->Stripes[0];
+    MetaCache = FspAllocNonPaged(Size);
     if (0 == MetaCache)
         return STATUS_INSUFFICIENT_RESOURCES;
-    RtlZeroMemory(MetaCache, PAGE_SIZE);
-    KeInitializeSpinLock(&MetaCache->SpinLock);
-    InitializeListHead(&MetaCache->ItemList);
+    RtlZeroMemory(MetaCache, Size);
     MetaCache->MetaCapacity = MetaCapacity;
     MetaCache->ItemSizeMax = ItemSizeMax;
     MetaCache->MetaTimeout = MetaTimeout->QuadPart;
-    MetaCache->ItemBucketCount = BucketCount;
+    MetaCache->ItemFini = ItemFini;
+    MetaCache->StripeCount = StripeCount;
+    for (ULONG Index = 0; StripeCount > Index; Index++)
+    {
+        FSP_META_CACHE_STRIPE *Stripe = &MetaCache->Stripes[Index];
+        KeInitializeSpinLock(&Stripe->SpinLock);
+        InitializeListHead(&Stripe->ItemList);
+        Stripe->ItemCapacity = (MetaCapacity + StripeCount - 1) / StripeCount;
+        Stripe->ItemBucketCount = FSP_META_CACHE_BUCKET_COUNT_MIN;
+        Stripe->ItemBuckets = FspAllocNonPaged(2 * FSP_META_CACHE_BUCKET_COUNT_MIN * sizeof Stripe->ItemBuckets[0]);
+        if (0 == Stripe->ItemBuckets)
+        {
+            for (ULONG IndexX = 0; Index > IndexX; IndexX++)
+                FspFree(MetaCache->Stripes[IndexX].ItemBuckets);
+            FspFree(MetaCache);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RtlZeroMemory(Stripe->ItemBuckets, 2 * FSP_META_CACHE_BUCKET_COUNT_MIN * sizeof Stripe->ItemBuckets[0]);
+        Stripe->ContentBuckets = Stripe->ItemBuckets + FSP_META_CACHE_BUCKET_COUNT_MIN;
+    }
     *PMetaCache = MetaCache;
     return STATUS_SUCCESS;
 }
@@ -138,7 +301,16 @@ VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache)
 {
     if (0 == MetaCache)
         return;
+#if DBG
+    FSP_META_CACHE_STATISTICS Statistics;
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    DEBUGLOG("Capacity=%lu, Buckets=%lu, Hits=%I64u, Misses=%I64u, Evictions=%I64u, Shares=%I64u",
+        MetaCache->MetaCapacity, Statistics.ItemBucketCount,
+        Statistics.HitCount, Statistics.MissCount, Statistics.EvictionCount, Statistics.ShareCount);
+#endif
     FspMetaCacheInvalidateExpired(MetaCache, (UINT64)-1LL);
+    for (ULONG Index = 0; MetaCache->StripeCount > Index; Index++)
+        FspFree(MetaCache->Stripes[Index].ItemBuckets);
     FspFree(MetaCache);
 }
 
@@ -148,14 +320,18 @@ VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationT
         return;
     FSP_META_CACHE_ITEM *Item;
     KIRQL Irql;
-    for (;;)
+    for (ULONG Index = 0; MetaCache->StripeCount > Index; Index++)
     {
-        KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-        Item = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, ExpirationTime);
-        KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
-        if (0 == Item)
-            break;
-        FspMetaCacheDereferenceItem(Item);
+        FSP_META_CACHE_STRIPE *Stripe = &MetaCache->Stripes[Index];
+        for (;;)
+        {
+            KeAcquireSpinLock(&Stripe->SpinLock, &Irql);
+            Item = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, Stripe, ExpirationTime);
+            KeReleaseSpinLock(&Stripe->SpinLock, Irql);
+            if (0 == Item)
+                break;
+            FspMetaCacheDereferenceItem(Item);
+        }
     }
 }
 
@@ -167,18 +343,21 @@ BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIn
         *PSize = 0;
     if (0 == MetaCache || 0 == ItemIndex)
         return FALSE;
+    FSP_META_CACHE_STRIPE *Stripe = FspMetaCacheStripe(MetaCache, ItemIndex);
     FSP_META_CACHE_ITEM *Item = 0;
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
     KIRQL Irql;
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, ItemIndex);
+    KeAcquireSpinLock(&Stripe->SpinLock, &Irql);
+    Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, Stripe, ItemIndex);
     if (0 == Item)
     {
-        KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+        Stripe->MissCount++;
+        KeReleaseSpinLock(&Stripe->SpinLock, Irql);
         return FALSE;
     }
+    Stripe->HitCount++;
     InterlockedIncrement(&Item->RefCount);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    KeReleaseSpinLock(&Stripe->SpinLock, Irql);
     ItemBuffer = Item->ItemBuffer;
     *PBuffer = ItemBuffer->Buffer;
     if (0 != PSize)
@@ -192,16 +371,50 @@ VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer)
     FspMetaCacheDereferenceItem(ItemBuffer->Item);
 }
 
-UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+static inline BOOLEAN FspMetaCacheShareItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, ULONG ContentHash, PCVOID Buffer, ULONG Size,
+    PUINT64 PItemIndex)
+{
+    FSP_META_CACHE_ITEM *Item = FspMetaCacheLookupContentItemAtDpcLevel(MetaCache, Stripe,
+        ContentHash, Buffer, Size);
+    if (0 == Item)
+        return FALSE;
+    /* refresh the item; move it to the tail of the list to keep the list ordered by expiration */
+    Item->ShareCount++;
+    Item->ExpirationTime = FspExpirationTimeFromTimeout(MetaCache->MetaTimeout);
+    RemoveEntryList(&Item->ListEntry);
+    InsertTailList(&Stripe->ItemList, &Item->ListEntry);
+    Stripe->ShareCount++;
+    *PItemIndex = Item->ItemIndex;
+    return TRUE;
+}
+
+static UINT64 FspMetaCacheAddItemEx(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size,
+    BOOLEAN Shared)
 {
     if (0 == MetaCache)
         return 0;
-    FSP_META_CACHE_ITEM *Item;
+    FSP_META_CACHE_STRIPE *Stripe;
+    FSP_META_CACHE_ITEM *Item, *EvictedItem = 0;
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
-    UINT64 ItemIndex = 0;
+    ULONG StripeIndex, ContentHash = 0;
+    UINT64 Serial, ItemIndex = 0;
+    BOOLEAN Success;
     KIRQL Irql;
     if (sizeof *ItemBuffer + Size > MetaCache->ItemSizeMax)
         return 0;
+    if (Shared)
+    {
+        ASSERT(0 == MetaCache->ItemFini);
+        ContentHash = FspMetaCacheHashBuffer(Buffer, Size);
+        Stripe = &MetaCache->Stripes[ContentHash % MetaCache->StripeCount];
+        KeAcquireSpinLock(&Stripe->SpinLock, &Irql);
+        Success = FspMetaCacheShareItemAtDpcLevel(MetaCache, Stripe, ContentHash, Buffer, Size,
+            &ItemIndex);
+        KeReleaseSpinLock(&Stripe->SpinLock, Irql);
+        if (Success)
+            return ItemIndex;
+    }
     Item = FspAllocNonPaged(sizeof *Item);
     if (0 == Item)
         return 0;
@@ -214,31 +427,88 @@ UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
     RtlZeroMemory(Item, sizeof *Item);
     RtlZeroMemory(ItemBuffer, sizeof *ItemBuffer);
     Item->ItemBuffer = ItemBuffer;
+    Item->ItemFini = MetaCache->ItemFini;
     Item->ExpirationTime = FspExpirationTimeFromTimeout(MetaCache->MetaTimeout);
     Item->RefCount = 1;
+    Item->ShareCount = 1;
+    Item->ContentHash = ContentHash;
+    Item->Shared = Shared;
     ItemBuffer->Item = Item;
     ItemBuffer->Size = Size;
     RtlCopyMemory(ItemBuffer->Buffer, Buffer, Size);
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    if (MetaCache->ItemCount >= MetaCache->MetaCapacity)
-        FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, (UINT64)-1LL);
-    ItemIndex = MetaCache->ItemIndex;
-    ItemIndex = (UINT64)-1LL == ItemIndex ? 1 : ItemIndex + 1;
-    MetaCache->ItemIndex = Item->ItemIndex = ItemIndex;
-    FspMetaCacheAddItemAtDpcLevel(MetaCache, Item);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    do
+        Serial = (UINT64)InterlockedIncrement64(&MetaCache->ItemIndex);
+    while (0 == Serial);
+    StripeIndex = (ULONG)((Shared ? ContentHash : Serial) % MetaCache->StripeCount);
+    Item->ItemIndex = ItemIndex = Serial * MetaCache->StripeCount + StripeIndex;
+    Stripe = &MetaCache->Stripes[StripeIndex];
+    ASSERT(FspMetaCacheStripe(MetaCache, ItemIndex) == Stripe);
+    KeAcquireSpinLock(&Stripe->SpinLock, &Irql);
+    if (Shared &&
+        FspMetaCacheShareItemAtDpcLevel(MetaCache, Stripe, ContentHash, Buffer, Size, &ItemIndex))
+    {
+        /* lost a race with another thread adding the same content */
+        KeReleaseSpinLock(&Stripe->SpinLock, Irql);
+        FspMetaCacheDereferenceItem(Item);
+        return ItemIndex;
+    }
+    if (Stripe->ItemCount >= Stripe->ItemCapacity)
+    {
+        EvictedItem = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, Stripe, (UINT64)-1LL);
+        if (0 != EvictedItem)
+            Stripe->EvictionCount++;
+    }
+    FspMetaCacheAddItemAtDpcLevel(MetaCache, Stripe, Item);
+    KeReleaseSpinLock(&Stripe->SpinLock, Irql);
+    if (0 != EvictedItem)
+        FspMetaCacheDereferenceItem(EvictedItem);
+    return ItemIndex;
+}
+
+UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+{
+    UINT64 ItemIndex = FspMetaCacheAddItemEx(MetaCache, Buffer, Size, FALSE);
+    if (0 == ItemIndex && 0 != MetaCache && 0 != MetaCache->ItemFini)
+        /* the cache did not take over the buffer; release what it references */
+        MetaCache->ItemFini((PVOID)Buffer, Size);
     return ItemIndex;
 }
 
+UINT64 FspMetaCacheAddSharedItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+{
+    return FspMetaCacheAddItemEx(MetaCache, Buffer, Size, TRUE);
+}
+
 VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex)
 {
     if (0 == MetaCache || 0 == ItemIndex)
         return;
+    FSP_META_CACHE_STRIPE *Stripe = FspMetaCacheStripe(MetaCache, ItemIndex);
     FSP_META_CACHE_ITEM *Item;
     KIRQL Irql;
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    Item = FspMetaCacheRemoveIndexedItemAtDpcLevel(MetaCache, ItemIndex);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    KeAcquireSpinLock(&Stripe->SpinLock, &Irql);
+    Item = FspMetaCacheRemoveIndexedItemAtDpcLevel(MetaCache, Stripe, ItemIndex);
+    KeReleaseSpinLock(&Stripe->SpinLock, Irql);
     if (0 != Item)
         FspMetaCacheDereferenceItem(Item);
 }
+
+VOID FspMetaCacheGetStatistics(FSP_META_CACHE *MetaCache, FSP_META_CACHE_STATISTICS *Statistics)
+{
+    RtlZeroMemory(Statistics, sizeof *Statistics);
+    if (0 == MetaCache)
+        return;
+    KIRQL Irql;
+    for (ULONG Index = 0; MetaCache->StripeCount > Index; Index++)
+    {
+        FSP_META_CACHE_STRIPE *Stripe = &MetaCache->Stripes[Index];
+        KeAcquireSpinLock(&Stripe->SpinLock, &Irql);
+        Statistics->ItemCount += Stripe->ItemCount;
+        Statistics->ItemBucketCount += Stripe->ItemBucketCount;
+        Statistics->HitCount += Stripe->HitCount;
+        Statistics->MissCount += Stripe->MissCount;
+        Statistics->EvictionCount += Stripe->EvictionCount;
+        Statistics->ShareCount += Stripe->ShareCount;
+        KeReleaseSpinLock(&Stripe->SpinLock, Irql);
+    }
+}
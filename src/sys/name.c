@@ -21,6 +21,7 @@ BOOLEAN FspFileNameIsValid(PUNICODE_STRING Path, ULONG MaxComponentLength,
     PUNICODE_STRING StreamPart, PULONG StreamType);
 BOOLEAN FspFileNameIsValidPattern(PUNICODE_STRING Pattern, ULONG MaxComponentLength);
 VOID FspFileNameSuffix(PUNICODE_STRING Path, PUNICODE_STRING Remain, PUNICODE_STRING Suffix);
+ULONG FspFileNameHash(PUNICODE_STRING Path, BOOLEAN IgnoreCase);
 NTSTATUS FspFileNameInExpression(
     PUNICODE_STRING Expression,
     PUNICODE_STRING Name,
@@ -32,6 +33,7 @@ NTSTATUS FspFileNameInExpression(
 #pragma alloc_text(PAGE, FspFileNameIsValid)
 #pragma alloc_text(PAGE, FspFileNameIsValidPattern)
 #pragma alloc_text(PAGE, FspFileNameSuffix)
+#pragma alloc_text(PAGE, FspFileNameHash)
 #pragma alloc_text(PAGE, FspFileNameInExpression)
 #endif
 
@@ -219,6 +221,40 @@ VOID FspFileNameSuffix(PUNICODE_STRING Path, PUNICODE_STRING Remain, PUNICODE_ST
     Suffix->Buffer = SuffixBgn;
 }
 
+ULONG FspFileNameHash(PUNICODE_STRING Path, BOOLEAN IgnoreCase)
+{
+    PAGED_CODE();
+
+    /*
+     * FNV-1a over the (optionally upcased) UTF-16 code units. Names that compare
+     * equal under FspFileNameCompare (RtlCompareUnicodeString) hash equal, because
+     * both use RtlUpcaseUnicodeChar for case folding.
+     */
+
+    PWSTR PathPtr, PathEnd;
+    UINT32 Hash = 2166136261;
+    WCHAR Char;
+
+    PathPtr = Path->Buffer;
+    PathEnd = (PWSTR)((PUINT8)PathPtr + Path->Length);
+
+    if (IgnoreCase)
+        for (; PathEnd > PathPtr; PathPtr++)
+        {
+            Char = *PathPtr;
+            if (L'a' <= Char && Char <= L'z')
+                Char -= L'a' - L'A';
+            else if (0x80 <= Char)
+                Char = RtlUpcaseUnicodeChar(Char);
+            Hash = (Hash ^ Char) * 16777619;
+        }
+    else
+        for (; PathEnd > PathPtr; PathPtr++)
+            Hash = (Hash ^ *PathPtr) * 16777619;
+
+    return FspHashMix32(Hash);
+}
+
 NTSTATUS FspFileNameInExpression(
     PUNICODE_STRING Expression,
     PUNICODE_STRING Name,
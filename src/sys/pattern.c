@@ -0,0 +1,202 @@
+/**
+ * @file sys/pattern.c
+ *
+ * Compiled file name patterns for QueryDirectory.
+ *
+ * A directory pattern is classified once when it is set on the FileDesc. The shapes that
+ * account for nearly all real world patterns ("*", "*.ext", "prefix*" and patterns without
+ * wildcards) are matched with a single literal compare against the head or tail of the
+ * name; everything else goes through FsRtlIsNameInExpression as before. Win32 FindFirstFile
+ * rewrites "*.ext" as "<.ext" (DOS_STAR), which is also compiled as a suffix when ext has
+ * no dots.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <sys/driver.h>
+
+/*
+ * Integer SSE2 is always available on x64 and the kernel allows its use without saving
+ * the floating point state. Other architectures use the scalar compare.
+ */
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define FSP_FILE_NAME_PATTERN_SSE2
+#endif
+
+VOID FspFileNamePatternCompile(FSP_FILE_NAME_PATTERN *Pattern, PUNICODE_STRING Expression);
+NTSTATUS FspFileNamePatternMatch(FSP_FILE_NAME_PATTERN *Pattern,
+    PUNICODE_STRING Name, BOOLEAN IgnoreCase, PBOOLEAN PResult);
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FspFileNamePatternCompile)
+#pragma alloc_text(PAGE, FspFileNamePatternMatch)
+#endif
+
+static inline BOOLEAN FspFileNamePatternIsWild(WCHAR C)
+{
+    /* see FsRtlDoesNameContainWildCards; includes the DOS_STAR, DOS_QM and DOS_DOT wildcards */
+    return L'*' == C || L'?' == C || L'<' == C || L'>' == C || L'"' == C;
+}
+
+static inline ULONG FspFileNamePatternDotCount(PWSTR Buffer, ULONG Length)
+{
+    ULONG Count = 0;
+    for (ULONG I = 0; Length > I; I++)
+        Count += L'.' == Buffer[I];
+    return Count;
+}
+
+static inline WCHAR FspFileNamePatternUpcase(WCHAR C)
+{
+    if (0x80 > C)
+        return L'a' <= C && C <= L'z' ? C - (L'a' - L'A') : C;
+    return RtlUpcaseUnicodeChar(C);
+}
+
+static inline BOOLEAN FspFileNamePatternCompareScalar(PWSTR Name, PWSTR Literal, ULONG Length,
+    BOOLEAN IgnoreCase)
+{
+    if (IgnoreCase)
+    {
+        for (ULONG I = 0; Length > I; I++)
+            if (FspFileNamePatternUpcase(Name[I]) != Literal[I])
+                return FALSE;
+    }
+    else
+    {
+        for (ULONG I = 0; Length > I; I++)
+            if (Name[I] != Literal[I])
+                return FALSE;
+    }
+
+    return TRUE;
+}
+
+static inline BOOLEAN FspFileNamePatternCompare(PWSTR Name, PWSTR Literal, ULONG Length,
+    BOOLEAN IgnoreCase)
+{
+    /* Literal is upper case when IgnoreCase is TRUE */
+
+#if defined(FSP_FILE_NAME_PATTERN_SSE2)
+    __m128i N, L, Lower;
+    const __m128i BelowA = _mm_set1_epi16(L'a' - 1), AboveZ = _mm_set1_epi16(L'z' + 1);
+    const __m128i CaseBit = _mm_set1_epi16(L'a' - L'A');
+
+    for (; 8 <= Length; Name += 8, Literal += 8, Length -= 8)
+    {
+        N = _mm_loadu_si128((__m128i *)Name);
+        L = _mm_loadu_si128((__m128i *)Literal);
+        if (IgnoreCase)
+        {
+            /* upcase ASCII letters; signed compares leave characters >= 0x8000 alone */
+            Lower = _mm_and_si128(_mm_cmpgt_epi16(N, BelowA), _mm_cmplt_epi16(N, AboveZ));
+            N = _mm_sub_epi16(N, _mm_and_si128(Lower, CaseBit));
+        }
+        if (0xffff != _mm_movemask_epi8(_mm_cmpeq_epi16(N, L)))
+        {
+            /* a mismatch may still be a non-ASCII case difference */
+            if (!IgnoreCase || !FspFileNamePatternCompareScalar(Name, Literal, 8, TRUE))
+                return FALSE;
+        }
+    }
+#endif
+
+    return FspFileNamePatternCompareScalar(Name, Literal, Length, IgnoreCase);
+}
+
+VOID FspFileNamePatternCompile(FSP_FILE_NAME_PATTERN *Pattern, PUNICODE_STRING Expression)
+{
+    PAGED_CODE();
+
+    PWSTR Buffer = Expression->Buffer;
+    ULONG Length = Expression->Length / sizeof(WCHAR);
+    ULONG WildCount = 0, WildIndex = 0;
+
+    RtlZeroMemory(Pattern, sizeof *Pattern);
+    Pattern->Expression = *Expression;
+
+    for (ULONG I = 0; Length > I; I++)
+        if (FspFileNamePatternIsWild(Buffer[I]))
+        {
+            WildCount++;
+            WildIndex = I;
+        }
+
+    if (0 == WildCount)
+    {
+        Pattern->Kind = FspFileNamePatternExact;
+        Pattern->Literal = Buffer;
+        Pattern->LiteralLength = (USHORT)Length;
+    }
+    else if (1 == WildCount && L'*' == Buffer[WildIndex] && 1 == Length)
+        Pattern->Kind = FspFileNamePatternMatchAll;
+    else if (1 == WildCount && L'*' == Buffer[WildIndex] && 0 == WildIndex)
+    {
+        Pattern->Kind = FspFileNamePatternSuffix;
+        Pattern->Literal = Buffer + 1;
+        Pattern->LiteralLength = (USHORT)(Length - 1);
+    }
+    else if (1 == WildCount && L'*' == Buffer[WildIndex] && Length - 1 == WildIndex)
+    {
+        Pattern->Kind = FspFileNamePatternPrefix;
+        Pattern->Literal = Buffer;
+        Pattern->LiteralLength = (USHORT)(Length - 1);
+    }
+    else if (1 == WildCount && L'<' == Buffer[WildIndex] && 0 == WildIndex &&
+        3 <= Length && L'.' == Buffer[1] && 0 == FspFileNamePatternDotCount(Buffer + 2, Length - 2))
+    {
+        /*
+         * DOS_STAR matches up to the last dot in the name. When ext has no dots the last
+         * dot of any name that ends in ".ext" is the one before ext, so "<.ext" is "*.ext".
+         */
+        Pattern->Kind = FspFileNamePatternSuffix;
+        Pattern->Literal = Buffer + 1;
+        Pattern->LiteralLength = (USHORT)(Length - 1);
+    }
+    else
+        Pattern->Kind = FspFileNamePatternGeneric;
+}
+
+NTSTATUS FspFileNamePatternMatch(FSP_FILE_NAME_PATTERN *Pattern,
+    PUNICODE_STRING Name, BOOLEAN IgnoreCase, PBOOLEAN PResult)
+{
+    PAGED_CODE();
+
+    PWSTR Buffer = Name->Buffer;
+    ULONG Length = Name->Length / sizeof(WCHAR);
+
+    switch (Pattern->Kind)
+    {
+    case FspFileNamePatternMatchAll:
+        *PResult = TRUE;
+        return STATUS_SUCCESS;
+    case FspFileNamePatternExact:
+        *PResult = Pattern->LiteralLength == Length &&
+            FspFileNamePatternCompare(Buffer, Pattern->Literal, Length, IgnoreCase);
+        return STATUS_SUCCESS;
+    case FspFileNamePatternPrefix:
+        *PResult = Pattern->LiteralLength <= Length &&
+            FspFileNamePatternCompare(Buffer, Pattern->Literal, Pattern->LiteralLength,
+                IgnoreCase);
+        return STATUS_SUCCESS;
+    case FspFileNamePatternSuffix:
+        *PResult = Pattern->LiteralLength <= Length &&
+            FspFileNamePatternCompare(Buffer + Length - Pattern->LiteralLength,
+                Pattern->Literal, Pattern->LiteralLength, IgnoreCase);
+        return STATUS_SUCCESS;
+    default:
+        return FspFileNameInExpression(&Pattern->Expression, Name, IgnoreCase, 0, PResult);
+    }
+}
@@ -0,0 +1,205 @@
+/**
+ * @file sys/poolcache.c
+ *
+ * Size-classed lookaside caches for the transact request path.
+ *
+ * Every request header, work item and retried response used to be a fresh pool
+ * allocation. These now come from per-processor lookaside lists; the processor index
+ * is only a locality hint, because the lists are interlocked and a block may be freed
+ * on a different processor than the one that allocated it. Each block carries a small
+ * prefix that records the list it came from, so that it can be returned to the right
+ * list (or to pool when it was too large for any list or the list was exhausted).
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <sys/driver.h>
+
+NTSTATUS FspPoolCacheInitialize(VOID);
+VOID FspPoolCacheFinalize(VOID);
+PVOID FspPoolCacheAlloc(ULONG Class, POOL_TYPE PoolType, SIZE_T Size, BOOLEAN MustSucceed);
+VOID FspPoolCacheFree(PVOID Pointer);
+VOID FspPoolCacheGetStatistics(ULONG Processor,
+    FSP_POOL_CACHE_STATISTICS Statistics[FspPoolCacheCount]);
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, FspPoolCacheInitialize)
+#pragma alloc_text(PAGE, FspPoolCacheFinalize)
+#endif
+
+/* the prefix keeps the returned pointer at MEMORY_ALLOCATION_ALIGNMENT like pool does */
+#define FSP_POOL_CACHE_PREFIX_SIZE      MEMORY_ALLOCATION_ALIGNMENT
+
+typedef struct
+{
+    ULONG Class;
+    POOL_TYPE PoolType;
+    ULONG Size;                         /* includes the prefix */
+} FSP_POOL_CACHE_LIST_INFO;
+
+/*
+ * Request lists are ordered from smallest to largest: a bare request, a request with
+ * a typical path and a request with a path and a security descriptor (Create).
+ */
+static const FSP_POOL_CACHE_LIST_INFO FspPoolCacheListInfo[] =
+{
+    { FspPoolCacheRequest, PagedPool, 512 },
+    { FspPoolCacheRequest, PagedPool, 1024 },
+    { FspPoolCacheRequest, PagedPool, PAGE_SIZE },
+    { FspPoolCacheWorkItem, NonPagedPool,
+        FSP_POOL_CACHE_PREFIX_SIZE + sizeof(FSP_FSCTL_TRANSACT_REQ_WORK_ITEM) },
+    { FspPoolCacheResponse, PagedPool, 1024 },
+};
+#define FSP_POOL_CACHE_LIST_COUNT       (sizeof FspPoolCacheListInfo / sizeof FspPoolCacheListInfo[0])
+#define FSP_POOL_CACHE_LIST_NONE        ((ULONG)-1)
+
+typedef struct
+{
+    LOOKASIDE_LIST_EX Lists[FSP_POOL_CACHE_LIST_COUNT];
+    ULONG OversizeCount[FspPoolCacheCount];
+    /* align to 64 bytes */
+    __declspec(align(64)) UINT8 EndOfStruct[];
+} FSP_POOL_CACHE_PROCESSOR;
+
+static FSP_POOL_CACHE_PROCESSOR *FspPoolCacheProcessors;
+
+static inline FSP_POOL_CACHE_PROCESSOR *FspPoolCacheCurrentProcessor(VOID)
+{
+    return &FspPoolCacheProcessors[KeGetCurrentProcessorNumber() % FspProcessorCount];
+}
+
+NTSTATUS FspPoolCacheInitialize(VOID)
+{
+    NTSTATUS Result;
+    ULONG Count = FspProcessorCount * FSP_POOL_CACHE_LIST_COUNT, Index;
+
+    FspPoolCacheProcessors = FspAllocNonPaged(sizeof(FSP_POOL_CACHE_PROCESSOR) * FspProcessorCount);
+    if (0 == FspPoolCacheProcessors)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(FspPoolCacheProcessors, sizeof(FSP_POOL_CACHE_PROCESSOR) * FspProcessorCount);
+    for (Index = 0; Count > Index; Index++)
+    {
+        Result = ExInitializeLookasideListEx(
+            &FspPoolCacheProcessors[Index / FSP_POOL_CACHE_LIST_COUNT].Lists[Index % FSP_POOL_CACHE_LIST_COUNT],
+            0, 0,
+            FspPoolCacheListInfo[Index % FSP_POOL_CACHE_LIST_COUNT].PoolType, 0,
+            FspPoolCacheListInfo[Index % FSP_POOL_CACHE_LIST_COUNT].Size, FSP_ALLOC_INTERNAL_TAG, 0);
+        if (!NT_SUCCESS(Result))
+        {
+            while (0 < Index)
+            {
+                Index--;
+                ExDeleteLookasideListEx(
+                    &FspPoolCacheProcessors[Index / FSP_POOL_CACHE_LIST_COUNT].Lists[Index % FSP_POOL_CACHE_LIST_COUNT]);
+            }
+            FspFree(FspPoolCacheProcessors);
+            FspPoolCacheProcessors = 0;
+            return Result;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspPoolCacheFinalize(VOID)
+{
+    PAGED_CODE();
+
+    for (ULONG Index = 0; FspProcessorCount > Index; Index++)
+        for (ULONG ListIndex = 0; FSP_POOL_CACHE_LIST_COUNT > ListIndex; ListIndex++)
+            ExDeleteLookasideListEx(&FspPoolCacheProcessors[Index].Lists[ListIndex]);
+
+    FspFree(FspPoolCacheProcessors);
+    FspPoolCacheProcessors = 0;
+}
+
+PVOID FspPoolCacheAlloc(ULONG Class, POOL_TYPE PoolType, SIZE_T Size, BOOLEAN MustSucceed)
+{
+    // !PAGED_CODE();
+
+    ASSERT(FspPoolCacheCount > Class);
+
+    FSP_POOL_CACHE_PROCESSOR *Processor = FspPoolCacheCurrentProcessor();
+    ULONG ListIndex = FSP_POOL_CACHE_LIST_NONE;
+    PUINT8 Prefix = 0;
+
+    Size += FSP_POOL_CACHE_PREFIX_SIZE;
+
+    for (ULONG I = 0; FSP_POOL_CACHE_LIST_COUNT > I; I++)
+        if (FspPoolCacheListInfo[I].Class == Class &&
+            FspPoolCacheListInfo[I].PoolType == PoolType &&
+            FspPoolCacheListInfo[I].Size >= Size)
+        {
+            ListIndex = I;
+            break;
+        }
+
+    if (FSP_POOL_CACHE_LIST_NONE != ListIndex)
+        Prefix = ExAllocateFromLookasideListEx(&Processor->Lists[ListIndex]);
+    else
+        Processor->OversizeCount[Class]++;
+
+    if (0 == Prefix)
+    {
+        /* a failed lookaside allocation is a failed pool allocation; retry if we must */
+        ListIndex = FSP_POOL_CACHE_LIST_NONE;
+        Prefix = MustSucceed ?
+            FspAllocatePoolMustSucceed(PoolType, Size, FSP_ALLOC_INTERNAL_TAG) :
+            ExAllocatePoolWithTag(PoolType, Size, FSP_ALLOC_INTERNAL_TAG);
+        if (0 == Prefix)
+            return 0;
+    }
+
+    *(PULONG)Prefix = ListIndex;
+    return Prefix + FSP_POOL_CACHE_PREFIX_SIZE;
+}
+
+VOID FspPoolCacheFree(PVOID Pointer)
+{
+    // !PAGED_CODE();
+
+    PUINT8 Prefix = (PUINT8)Pointer - FSP_POOL_CACHE_PREFIX_SIZE;
+    ULONG ListIndex = *(PULONG)Prefix;
+
+    if (FSP_POOL_CACHE_LIST_NONE != ListIndex)
+    {
+        ASSERT(FSP_POOL_CACHE_LIST_COUNT > ListIndex);
+        ExFreeToLookasideListEx(&FspPoolCacheCurrentProcessor()->Lists[ListIndex], Prefix);
+    }
+    else
+        FspFree(Prefix);
+}
+
+VOID FspPoolCacheGetStatistics(ULONG Processor,
+    FSP_POOL_CACHE_STATISTICS Statistics[FspPoolCacheCount])
+{
+    // !PAGED_CODE();
+
+    ASSERT(FspProcessorCount > Processor);
+
+    FSP_POOL_CACHE_PROCESSOR *P = &FspPoolCacheProcessors[Processor];
+
+    for (ULONG Class = 0; FspPoolCacheCount > Class; Class++)
+    {
+        Statistics[Class].Allocates = P->OversizeCount[Class];
+        Statistics[Class].Misses = P->OversizeCount[Class];
+    }
+    for (ULONG ListIndex = 0; FSP_POOL_CACHE_LIST_COUNT > ListIndex; ListIndex++)
+    {
+        ULONG Class = FspPoolCacheListInfo[ListIndex].Class;
+        Statistics[Class].Allocates += P->Lists[ListIndex].L.TotalAllocates;
+        Statistics[Class].Misses += P->Lists[ListIndex].L.AllocateMisses;
+    }
+}
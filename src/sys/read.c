@@ -29,6 +29,7 @@ FSP_IOPREP_DISPATCH FspFsvolReadPrepare;
 FSP_IOCMPL_DISPATCH FspFsvolReadComplete;
 static FSP_IOP_REQUEST_FINI FspFsvolReadNonCachedRequestFini;
 FSP_DRIVER_DISPATCH FspRead;
+FAST_IO_READ FspFastIoRead;
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FspFsvolRead)
@@ -38,6 +39,7 @@ FSP_DRIVER_DISPATCH FspRead;
 #pragma alloc_text(PAGE, FspFsvolReadComplete)
 #pragma alloc_text(PAGE, FspFsvolReadNonCachedRequestFini)
 #pragma alloc_text(PAGE, FspRead)
+#pragma alloc_text(PAGE, FspFastIoRead)
 #endif
 
 enum
@@ -575,3 +577,96 @@ NTSTATUS FspRead(
         IrpSp->Parameters.Read.ByteOffset.HighPart, IrpSp->Parameters.Read.ByteOffset.LowPart,
         IrpSp->Parameters.Read.Length);
 }
+
+BOOLEAN FspFastIoRead(
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER FileOffset,
+    ULONG Length,
+    BOOLEAN Wait,
+    ULONG LockKey,
+    PVOID Buffer,
+    PIO_STATUS_BLOCK IoStatus,
+    PDEVICE_OBJECT DeviceObject)
+{
+    /*
+     * Cached read without an IRP. We only handle the simple case: the cache is already
+     * initialized, no oplock break or byte range lock is in the way and we are not being
+     * called recursively. Returning FALSE sends the read down the FspFsvolReadCached path.
+     */
+
+    FSP_ENTER_BOOL(PAGED_CODE());
+
+    FSP_FILE_NODE *FileNode = FileObject->FsContext;
+    LARGE_INTEGER ReadOffset = *FileOffset;
+    LARGE_INTEGER ReadLength;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    NTSTATUS CopyResult;
+
+    Result = FALSE;
+
+    if (!FspFileNodeIsValid(FileNode) || FileNode->IsDirectory ||
+        !FlagOn(FileObject->Flags, FO_CACHE_SUPPORTED) || 0 == FileObject->PrivateCacheMap ||
+        0 != IoGetTopLevelIrp())
+        FSP_RETURN();
+
+    if (0 == Length)
+    {
+        IoStatus->Status = STATUS_SUCCESS;
+        IoStatus->Information = 0;
+        FSP_RETURN(Result = TRUE);
+    }
+
+    /*
+     * Acquire Main shared as FspFsvolReadCached does. The cache manager may issue paging
+     * reads while we are top-level with FSRTL_FAST_IO_TOP_LEVEL_IRP; FspPropagateTopFlags
+     * takes that to mean that Main is held, so those reads acquire Pgio themselves.
+     */
+    if (!DEBUGTEST(90) ||
+        !FspFileNodeTryAcquireSharedF(FileNode, FspFileNodeAcquireMain, Wait))
+        FSP_RETURN();
+
+    if (!FspFileNodeOplockIsFastIoPossible(FileNode))
+        goto release;
+
+    /* trim Length; the cache manager does not tolerate reads beyond file size */
+    FspFileNodeGetFileInfo(FileNode, &FileInfo);
+    if ((UINT64)ReadOffset.QuadPart >= FileInfo.FileSize)
+    {
+        IoStatus->Status = STATUS_END_OF_FILE;
+        IoStatus->Information = 0;
+        Result = TRUE;
+        goto release;
+    }
+    if (Length > (ULONG)(FileInfo.FileSize - ReadOffset.QuadPart))
+        Length = (ULONG)(FileInfo.FileSize - ReadOffset.QuadPart);
+
+    ReadLength.QuadPart = Length;
+    if (!FsRtlFastCheckLockForRead(&FileNode->FileLock, &ReadOffset, &ReadLength, LockKey,
+        FileObject, PsGetCurrentProcess()))
+        goto release;
+
+    IoSetTopLevelIrp((PIRP)FSRTL_FAST_IO_TOP_LEVEL_IRP);
+    CopyResult = FspCcCopyRead(FileObject, &ReadOffset, Length, Wait, Buffer, IoStatus);
+    IoSetTopLevelIrp(0);
+
+    /* on STATUS_PENDING (would block) or failure let the IRP path retry and report */
+    if (STATUS_SUCCESS != CopyResult)
+        goto release;
+
+    /* update the current file offset if synchronous I/O */
+    if (FlagOn(FileObject->Flags, FO_SYNCHRONOUS_IO))
+        FileObject->CurrentByteOffset.QuadPart = ReadOffset.QuadPart + IoStatus->Information;
+
+    Result = TRUE;
+
+release:
+    FspFileNodeRelease(FileNode, Main);
+
+    FSP_LEAVE_BOOL(
+        "FileObject=%p, Buffer=%p, "
+        "Key=%#lx, ByteOffset=%#lx:%#lx, Length=%ld",
+        FileObject, Buffer,
+        LockKey,
+        FileOffset->HighPart, FileOffset->LowPart,
+        Length);
+}
@@ -279,6 +279,9 @@ NTSTATUS FspFsvolSetSecurityComplete(
     FileDesc->DidSetSecurity = TRUE;
     FileDesc->DidSetMetadata = TRUE;
 
+    /* a held open was granted its access under the old security descriptor */
+    FspFsvolCloseCacheEvictFileNode(FileNode);
+
     FspFileNodeNotifyChange(FileNode, FILE_NOTIFY_CHANGE_SECURITY, FILE_ACTION_MODIFIED, FALSE);
 
     FspIopRequestContext(Request, RequestFileNode) = 0;
@@ -84,6 +84,10 @@ NTSTATUS FspStatisticsCopy(FSP_STATISTICS *Statistics, PVOID Buffer, PULONG PLen
     else
         Result = STATUS_BUFFER_OVERFLOW;
 
+    /* the pool caches are global; every volume reports the same per processor counts */
+    for (ULONG Index = 0; FspProcessorCount > Index; Index++)
+        FspPoolCacheGetStatistics(Index, Statistics[Index].Winfsp.PoolCache);
+
     RtlCopyMemory(Buffer, Statistics, *PLength);
 
     return Result;
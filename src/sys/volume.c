@@ -39,8 +39,28 @@ NTSTATUS FspVolumeGetNameList(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 static NTSTATUS FspVolumeGetNameListNoLock(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+static VOID FspVolumeTransactCompleteResponse(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    FSP_FSCTL_TRANSACT_RSP *Response, PIRP *PRepostedIrp);
+static VOID FspVolumeTransactCompleteRetried(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    PIRP *PRepostedIrp);
 NTSTATUS FspVolumeTransact(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeTransactRingSetup(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+static NTSTATUS FspVolumeTransactRingQuery(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    PBOOLEAN PCanProduce, PBOOLEAN PCanConsume);
+static NTSTATUS FspVolumeTransactRingConsumeResponse(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    FSP_FSCTL_TRANSACT_RSP *Response, PULONG PSize);
+static NTSTATUS FspVolumeTransactRingProduceBegin(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    PVOID *PSlotBuffer, PLONG PPosition);
+static NTSTATUS FspVolumeTransactRingCopyRequest(PVOID SlotBuffer,
+    FSP_FSCTL_TRANSACT_REQ *Request);
+static NTSTATUS FspVolumeTransactRingProduceEnd(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    LONG Position);
+static VOID FspVolumeTransactRingProduceEmpty(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    PVOID SlotBuffer, LONG Position);
+NTSTATUS FspVolumeTransactRing(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeStop(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeWork(
@@ -59,7 +79,17 @@ NTSTATUS FspVolumeWork(
 #pragma alloc_text(PAGE, FspVolumeGetName)
 #pragma alloc_text(PAGE, FspVolumeGetNameList)
 #pragma alloc_text(PAGE, FspVolumeGetNameListNoLock)
+#pragma alloc_text(PAGE, FspVolumeTransactCompleteResponse)
+#pragma alloc_text(PAGE, FspVolumeTransactCompleteRetried)
 #pragma alloc_text(PAGE, FspVolumeTransact)
+#pragma alloc_text(PAGE, FspVolumeTransactRingSetup)
+#pragma alloc_text(PAGE, FspVolumeTransactRingQuery)
+#pragma alloc_text(PAGE, FspVolumeTransactRingConsumeResponse)
+#pragma alloc_text(PAGE, FspVolumeTransactRingProduceBegin)
+#pragma alloc_text(PAGE, FspVolumeTransactRingCopyRequest)
+#pragma alloc_text(PAGE, FspVolumeTransactRingProduceEnd)
+#pragma alloc_text(PAGE, FspVolumeTransactRingProduceEmpty)
+#pragma alloc_text(PAGE, FspVolumeTransactRing)
 #pragma alloc_text(PAGE, FspVolumeStop)
 #pragma alloc_text(PAGE, FspVolumeWork)
 #endif
@@ -113,17 +143,32 @@ static NTSTATUS FspVolumeCreateNoLock(
     FSP_CREATE_VOLUME_REGISTER_MUP_WORK_ITEM RegisterMupWorkItem;
 
     /* check parameters */
-    if (PREFIXW_SIZE + sizeof(FSP_FSCTL_VOLUME_PARAMS) * sizeof(WCHAR) > FileObject->FileName.Length)
+    if (PREFIXW_SIZE + FSP_FSCTL_VOLUME_PARAMS_V0_SIZE * sizeof(WCHAR) > FileObject->FileName.Length)
         return STATUS_INVALID_PARAMETER;
 
-    /* copy the VolumeParams */
-    for (USHORT Index = 0, Length = sizeof(FSP_FSCTL_VOLUME_PARAMS); Length > Index; Index++)
+    /* copy the VolumeParams; a Version 0 structure ends at FileSystemName */
+    for (USHORT Index = 0, Length = FSP_FSCTL_VOLUME_PARAMS_V0_SIZE; Length > Index; Index++)
     {
         WCHAR Value = FileObject->FileName.Buffer[PREFIXW_SIZE / sizeof(WCHAR) + Index];
         if (0xF000 != (Value & 0xFF00))
             return STATUS_INVALID_PARAMETER;
         ((PUINT8)&VolumeParams)[Index] = Value & 0xFF;
     }
+    if (0 != VolumeParams.Version)
+    {
+        if (sizeof(FSP_FSCTL_VOLUME_PARAMS) != VolumeParams.Version ||
+            PREFIXW_SIZE + sizeof(FSP_FSCTL_VOLUME_PARAMS) * sizeof(WCHAR) > FileObject->FileName.Length)
+            return STATUS_INVALID_PARAMETER;
+
+        for (USHORT Index = FSP_FSCTL_VOLUME_PARAMS_V0_SIZE, Length = sizeof(FSP_FSCTL_VOLUME_PARAMS);
+            Length > Index; Index++)
+        {
+            WCHAR Value = FileObject->FileName.Buffer[PREFIXW_SIZE / sizeof(WCHAR) + Index];
+            if (0xF000 != (Value & 0xFF00))
+                return STATUS_INVALID_PARAMETER;
+            ((PUINT8)&VolumeParams)[Index] = Value & 0xFF;
+        }
+    }
 
     /* check the VolumeParams */
     if (0 == VolumeParams.SectorSize)
@@ -145,6 +190,22 @@ static NTSTATUS FspVolumeCreateNoLock(
     if (FspFsctlIrpCapacityMinimum > VolumeParams.IrpCapacity ||
         VolumeParams.IrpCapacity > FspFsctlIrpCapacityMaximum)
         VolumeParams.IrpCapacity = FspFsctlIrpCapacityDefault;
+    if (FspFsctlMetaCacheCapacityMinimum > VolumeParams.SecurityCacheCapacity ||
+        VolumeParams.SecurityCacheCapacity > FspFsctlMetaCacheCapacityMaximum)
+        VolumeParams.SecurityCacheCapacity = FspFsctlMetaCacheCapacityDefault;
+    if (FspFsctlMetaCacheCapacityMinimum > VolumeParams.DirInfoCacheCapacity ||
+        VolumeParams.DirInfoCacheCapacity > FspFsctlMetaCacheCapacityMaximum)
+        VolumeParams.DirInfoCacheCapacity = FspFsctlMetaCacheCapacityDefault;
+    if (FspFsctlMetaCacheCapacityMinimum > VolumeParams.StreamInfoCacheCapacity ||
+        VolumeParams.StreamInfoCacheCapacity > FspFsctlMetaCacheCapacityMaximum)
+        VolumeParams.StreamInfoCacheCapacity = FspFsctlMetaCacheCapacityDefault;
+    /* file systems that do not ask for more keep the single chunk listings of old */
+    if (FspFsctlDirInfoCacheSizeMaxMinimum > VolumeParams.DirInfoCacheSizeMax ||
+        VolumeParams.DirInfoCacheSizeMax > FspFsctlDirInfoCacheSizeMaxMaximum)
+        VolumeParams.DirInfoCacheSizeMax = FspFsctlDirInfoCacheSizeMaxDefault;
+    if (FspFsctlNegativeNameCacheCapacityMinimum > VolumeParams.NegativeNameCacheCapacity ||
+        VolumeParams.NegativeNameCacheCapacity > FspFsctlNegativeNameCacheCapacityMaximum)
+        VolumeParams.NegativeNameCacheCapacity = FspFsctlNegativeNameCacheCapacityDefault;
     if (FILE_DEVICE_NETWORK_FILE_SYSTEM == FsctlDeviceObject->DeviceType)
     {
         VolumeParams.Prefix[sizeof VolumeParams.Prefix / sizeof(WCHAR) - 1] = L'\0';
@@ -303,6 +364,9 @@ VOID FspVolumeDelete(
     FspVolumeDeleteNoLock(FsctlDeviceObject, Irp, IrpSp);
     FspDeviceGlobalUnlock();
 
+    /* the Ioq is now stopped; give up any held opens so that their FileNode's can go away */
+    FspFsvolCloseCacheEvictAll(FsvolDeviceObject);
+
     /*
      * Call MmForceSectionClosed on active files to ensure that Mm removes them from Standby List.
      */
@@ -672,6 +736,71 @@ static NTSTATUS FspVolumeGetNameListNoLock(
     return Result;
 }
 
+static VOID FspVolumeTransactCompleteResponse(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    FSP_FSCTL_TRANSACT_RSP *Response, PIRP *PRepostedIrp)
+{
+    PAGED_CODE();
+
+    NTSTATUS Result;
+    PIRP ProcessIrp;
+
+    ProcessIrp = FspIoqEndProcessingIrp(FsvolDeviceExtension->Ioq, (UINT_PTR)Response->Hint);
+    if (0 == ProcessIrp)
+    {
+        /* either IRP was canceled or a bogus Hint was provided */
+        DEBUGLOG("BOGUS(Kind=%d, Hint=%p)", Response->Kind, (PVOID)(UINT_PTR)Response->Hint);
+        return;
+    }
+
+    ASSERT((UINT_PTR)ProcessIrp == (UINT_PTR)Response->Hint);
+    ASSERT(FspIrpRequest(ProcessIrp)->Hint == Response->Hint);
+
+    IoSetTopLevelIrp(ProcessIrp);
+    Result = FspIopDispatchComplete(ProcessIrp, Response);
+    if (STATUS_PENDING == Result)
+    {
+        /*
+         * The IRP has been reposted to our Ioq. Remember the first such IRP,
+         * so that we know to break the loop if we see it again.
+         */
+        if (0 == *PRepostedIrp)
+            *PRepostedIrp = ProcessIrp;
+    }
+}
+
+static VOID FspVolumeTransactCompleteRetried(FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension,
+    PIRP *PRepostedIrp)
+{
+    PAGED_CODE();
+
+    NTSTATUS Result;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    PIRP RetriedIrp;
+    ULONG LoopCount;
+
+    LoopCount = FspIoqRetriedIrpCount(FsvolDeviceExtension->Ioq);
+    while (0 < LoopCount--) /* upper bound on loop guarantees forward progress! */
+    {
+        /* get the next retried IRP, but do not go beyond the first reposted IRP! */
+        RetriedIrp = FspIoqNextCompleteIrp(FsvolDeviceExtension->Ioq, *PRepostedIrp);
+        if (0 == RetriedIrp)
+            break;
+
+        IoSetTopLevelIrp(RetriedIrp);
+        Response = FspIopIrpResponse(RetriedIrp);
+        Result = FspIopDispatchComplete(RetriedIrp, Response);
+        if (STATUS_PENDING == Result)
+        {
+            /*
+             * The IRP has been reposted to our Ioq. Remember the first such IRP,
+             * so that we know to break the loop if we see it again.
+             */
+            if (0 == *PRepostedIrp)
+                *PRepostedIrp = RetriedIrp;
+        }
+    }
+}
+
 NTSTATUS FspVolumeTransact(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
 {
@@ -712,7 +841,7 @@ NTSTATUS FspVolumeTransact(
     PUINT8 BufferEnd;
     FSP_FSCTL_TRANSACT_RSP *Response, *NextResponse;
     FSP_FSCTL_TRANSACT_REQ *Request, *PendingIrpRequest;
-    PIRP ProcessIrp, PendingIrp, RetriedIrp, RepostedIrp;
+    PIRP PendingIrp, RepostedIrp;
     ULONG LoopCount;
     LARGE_INTEGER Timeout;
     PIRP TopLevelIrp = IoGetTopLevelIrp();
@@ -727,55 +856,13 @@ NTSTATUS FspVolumeTransact(
         if (0 == NextResponse)
             break;
 
-        ProcessIrp = FspIoqEndProcessingIrp(FsvolDeviceExtension->Ioq, (UINT_PTR)Response->Hint);
-        if (0 == ProcessIrp)
-        {
-            /* either IRP was canceled or a bogus Hint was provided */
-            DEBUGLOG("BOGUS(Kind=%d, Hint=%p)", Response->Kind, (PVOID)(UINT_PTR)Response->Hint);
-            Response = NextResponse;
-            continue;
-        }
-
-        ASSERT((UINT_PTR)ProcessIrp == (UINT_PTR)Response->Hint);
-        ASSERT(FspIrpRequest(ProcessIrp)->Hint == Response->Hint);
-
-        IoSetTopLevelIrp(ProcessIrp);
-        Result = FspIopDispatchComplete(ProcessIrp, Response);
-        if (STATUS_PENDING == Result)
-        {
-            /*
-             * The IRP has been reposted to our Ioq. Remember the first such IRP,
-             * so that we know to break the loop if we see it again.
-             */
-            if (0 == RepostedIrp)
-                RepostedIrp = ProcessIrp;
-        }
+        FspVolumeTransactCompleteResponse(FsvolDeviceExtension, Response, &RepostedIrp);
 
         Response = NextResponse;
     }
 
     /* process any retried IRP's */
-    LoopCount = FspIoqRetriedIrpCount(FsvolDeviceExtension->Ioq);
-    while (0 < LoopCount--) /* upper bound on loop guarantees forward progress! */
-    {
-        /* get the next retried IRP, but do not go beyond the first reposted IRP! */
-        RetriedIrp = FspIoqNextCompleteIrp(FsvolDeviceExtension->Ioq, RepostedIrp);
-        if (0 == RetriedIrp)
-            break;
-
-        IoSetTopLevelIrp(RetriedIrp);
-        Response = FspIopIrpResponse(RetriedIrp);
-        Result = FspIopDispatchComplete(RetriedIrp, Response);
-        if (STATUS_PENDING == Result)
-        {
-            /*
-             * The IRP has been reposted to our Ioq. Remember the first such IRP,
-             * so that we know to break the loop if we see it again.
-             */
-            if (0 == RepostedIrp)
-                RepostedIrp = RetriedIrp;
-        }
-    }
+    FspVolumeTransactCompleteRetried(FsvolDeviceExtension, &RepostedIrp);
 
     /* were we sent an output buffer? */
     switch (ControlCode & 3)
@@ -889,6 +976,430 @@ exit:
     return Result;
 }
 
+NTSTATUS FspVolumeTransactRingSetup(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
+{
+    PAGED_CODE();
+
+    ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == IrpSp->MajorFunction);
+    ASSERT(IRP_MN_USER_FS_REQUEST == IrpSp->MinorFunction);
+    ASSERT(FSP_FSCTL_TRANSACT_RING_SETUP == IrpSp->Parameters.FileSystemControl.FsControlCode);
+    ASSERT(METHOD_BUFFERED == (IrpSp->Parameters.FileSystemControl.FsControlCode & 3));
+    ASSERT(0 != IrpSp->FileObject->FsContext2);
+
+    /* check parameters */
+    PDEVICE_OBJECT FsvolDeviceObject = IrpSp->FileObject->FsContext2;
+    ULONG InputBufferLength = IrpSp->Parameters.FileSystemControl.InputBufferLength;
+    FSP_FSCTL_TRANSACT_RING_PARAMS *Params = Irp->AssociatedIrp.SystemBuffer;
+    FSP_FSCTL_TRANSACT_RING *Ring;
+    UINT32 SlotCount;
+    if (UserMode != Irp->RequestorMode)
+        return STATUS_INVALID_DEVICE_REQUEST;
+    if (sizeof *Params > InputBufferLength)
+        return STATUS_INVALID_PARAMETER;
+    Ring = (PVOID)(UINT_PTR)Params->RingAddress;
+    SlotCount = Params->SlotCount;
+    if (0 == Ring ||
+        (UINT_PTR)Ring != Params->RingAddress ||
+        !FspFsctlTransactRingValidSlotCount(SlotCount))
+        return STATUS_INVALID_PARAMETER;
+
+    /*
+     * The ring lives in the address space of the file system process. We only ever
+     * access it from FSP_FSCTL_TRANSACT_RING, which runs in the context of the same
+     * process, and always under try/except.
+     */
+    try
+    {
+        ProbeForWrite(Ring, (ULONG)FspFsctlTransactRingSize(SlotCount), FSP_FSCTL_DEFAULT_ALIGNMENT);
+    }
+    except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+
+    if (!FspDeviceReference(FsvolDeviceObject))
+        return STATUS_CANCELLED;
+
+    NTSTATUS Result;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+
+    FspDeviceGlobalLock();
+    if (0 == FsvolDeviceExtension->TransactRing)
+    {
+        FsvolDeviceExtension->TransactRingSlotCount = SlotCount;
+        FsvolDeviceExtension->TransactRingProcessId = PsGetCurrentProcessId();
+        InterlockedExchangePointer((PVOID *)&FsvolDeviceExtension->TransactRing, Ring);
+        Result = STATUS_SUCCESS;
+    }
+    else
+        Result = STATUS_INVALID_DEVICE_STATE;
+    FspDeviceGlobalUnlock();
+
+    FspDeviceDereference(FsvolDeviceObject);
+
+    Irp->IoStatus.Information = 0;
+    return Result;
+}
+
+static NTSTATUS FspVolumeTransactRingQuery(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    PBOOLEAN PCanProduce, PBOOLEAN PCanConsume)
+{
+    PAGED_CODE();
+
+    try
+    {
+        if (0 != PCanProduce)
+            *PCanProduce = FspFsctlTransactRingCanProduce(Ring, SlotCount,
+                FspFsctlTransactRingRequestQueue);
+        if (0 != PCanConsume)
+            *PCanConsume = FspFsctlTransactRingCanConsume(Ring, SlotCount,
+                FspFsctlTransactRingRequestQueue);
+    }
+    except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        NTSTATUS Result = GetExceptionCode();
+        return FsRtlIsNtstatusExpected(Result) ? STATUS_INVALID_USER_BUFFER : Result;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS FspVolumeTransactRingConsumeResponse(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    FSP_FSCTL_TRANSACT_RSP *Response, PULONG PSize)
+{
+    PAGED_CODE();
+
+    PVOID SlotBuffer;
+    LONG Position;
+    ULONG Size = 0;
+
+    /* copy the response out of the ring; it must not be used in place */
+    try
+    {
+        SlotBuffer = FspFsctlTransactRingConsumeBegin(Ring, SlotCount,
+            FspFsctlTransactRingResponseQueue, &Position);
+        if (0 != SlotBuffer)
+        {
+            Size = ((FSP_FSCTL_TRANSACT_RSP *)SlotBuffer)->Size;
+            if (FSP_FSCTL_TRANSACT_RSP_SIZEMAX < Size)
+                Size = sizeof(Response->Size); /* will fail FspFsctlTransactConsumeResponse */
+            RtlCopyMemory(Response, SlotBuffer, Size);
+            FspFsctlTransactRingConsumeEnd(Ring, SlotCount,
+                FspFsctlTransactRingResponseQueue, Position);
+        }
+    }
+    except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        NTSTATUS Result = GetExceptionCode();
+        return FsRtlIsNtstatusExpected(Result) ? STATUS_INVALID_USER_BUFFER : Result;
+    }
+
+    *PSize = Size;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS FspVolumeTransactRingProduceBegin(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    PVOID *PSlotBuffer, PLONG PPosition)
+{
+    PAGED_CODE();
+
+    try
+    {
+        *PSlotBuffer = FspFsctlTransactRingProduceBegin(Ring, SlotCount,
+            FspFsctlTransactRingRequestQueue, PPosition);
+    }
+    except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        *PSlotBuffer = 0;
+
+        NTSTATUS Result = GetExceptionCode();
+        return FsRtlIsNtstatusExpected(Result) ? STATUS_INVALID_USER_BUFFER : Result;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS FspVolumeTransactRingCopyRequest(PVOID SlotBuffer,
+    FSP_FSCTL_TRANSACT_REQ *Request)
+{
+    PAGED_CODE();
+
+    try
+    {
+        if (0 != Request)
+            RtlCopyMemory(SlotBuffer, Request, Request->Size);
+        else
+        {
+            /* a request of FspFsctlTransactReservedKind is ignored by the file system */
+            RtlZeroMemory(SlotBuffer, sizeof(FSP_FSCTL_TRANSACT_REQ));
+            ((FSP_FSCTL_TRANSACT_REQ *)SlotBuffer)->Version = sizeof(FSP_FSCTL_TRANSACT_REQ);
+            ((FSP_FSCTL_TRANSACT_REQ *)SlotBuffer)->Size = sizeof(FSP_FSCTL_TRANSACT_REQ);
+        }
+    }
+    except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        NTSTATUS Result = GetExceptionCode();
+        return FsRtlIsNtstatusExpected(Result) ? STATUS_INVALID_USER_BUFFER : Result;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS FspVolumeTransactRingProduceEnd(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    LONG Position)
+{
+    PAGED_CODE();
+
+    try
+    {
+        FspFsctlTransactRingProduceEnd(Ring, SlotCount,
+            FspFsctlTransactRingRequestQueue, Position);
+    }
+    except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        NTSTATUS Result = GetExceptionCode();
+        return FsRtlIsNtstatusExpected(Result) ? STATUS_INVALID_USER_BUFFER : Result;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID FspVolumeTransactRingProduceEmpty(FSP_FSCTL_TRANSACT_RING *Ring, UINT32 SlotCount,
+    PVOID SlotBuffer, LONG Position)
+{
+    PAGED_CODE();
+
+    /*
+     * A slot once claimed must always be published, even when we fail; otherwise the
+     * consumer waits on its Sequence forever. Errors are ignored: if the ring memory
+     * is no longer accessible there is nothing more that we can do.
+     */
+    FspVolumeTransactRingCopyRequest(SlotBuffer, 0);
+    FspVolumeTransactRingProduceEnd(Ring, SlotCount, Position);
+}
+
+NTSTATUS FspVolumeTransactRing(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
+{
+    PAGED_CODE();
+
+    ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == IrpSp->MajorFunction);
+    ASSERT(IRP_MN_USER_FS_REQUEST == IrpSp->MinorFunction);
+    ASSERT(FSP_FSCTL_TRANSACT_RING == IrpSp->Parameters.FileSystemControl.FsControlCode);
+    ASSERT(METHOD_BUFFERED == (IrpSp->Parameters.FileSystemControl.FsControlCode & 3));
+    ASSERT(0 != IrpSp->FileObject->FsContext2);
+
+    /* check parameters */
+    PDEVICE_OBJECT FsvolDeviceObject = IrpSp->FileObject->FsContext2;
+    ULONG InputBufferLength = IrpSp->Parameters.FileSystemControl.InputBufferLength;
+    FSP_FSCTL_TRANSACT_RING_PARAMS *Params = Irp->AssociatedIrp.SystemBuffer;
+    BOOLEAN Wait;
+    if (sizeof *Params > InputBufferLength)
+        return STATUS_INVALID_PARAMETER;
+    Wait = !!Params->Wait;
+
+    if (!FspDeviceReference(FsvolDeviceObject))
+        return STATUS_CANCELLED;
+
+    NTSTATUS Result;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FSCTL_TRANSACT_RING *Ring;
+    UINT32 SlotCount;
+    FSP_FSCTL_TRANSACT_RSP *Response = 0;
+    FSP_FSCTL_TRANSACT_REQ *PendingIrpRequest;
+    PIRP PendingIrp, RepostedIrp;
+    PVOID SlotBuffer;
+    LONG Position;
+    ULONG Size, LoopCount;
+    BOOLEAN CanProduce, CanConsume;
+    LARGE_INTEGER Timeout;
+    PIRP TopLevelIrp = IoGetTopLevelIrp();
+
+    Ring = FsvolDeviceExtension->TransactRing;
+    SlotCount = FsvolDeviceExtension->TransactRingSlotCount;
+    if (0 == Ring)
+    {
+        Result = STATUS_INVALID_DEVICE_STATE;
+        goto exit;
+    }
+    if (PsGetCurrentProcessId() != FsvolDeviceExtension->TransactRingProcessId)
+    {
+        Result = STATUS_ACCESS_DENIED;
+        goto exit;
+    }
+
+    Response = FspAlloc(FSP_FSCTL_TRANSACT_RSP_SIZEMAX);
+    if (0 == Response)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    /* process any user-mode file system responses */
+    RepostedIrp = 0;
+    LoopCount = SlotCount;
+    while (0 < LoopCount--) /* upper bound on loop guarantees forward progress! */
+    {
+        Result = FspVolumeTransactRingConsumeResponse(Ring, SlotCount, Response, &Size);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+        if (0 == Size)
+            break;
+
+        if (0 == FspFsctlTransactConsumeResponse(Response, (PUINT8)Response + Size))
+        {
+            DEBUGLOG("BOGUS(Size=%lu)", Size);
+            continue;
+        }
+
+        FspVolumeTransactCompleteResponse(FsvolDeviceExtension, Response, &RepostedIrp);
+    }
+
+    /* process any retried IRP's */
+    FspVolumeTransactCompleteRetried(FsvolDeviceExtension, &RepostedIrp);
+
+    /* if the file system has no requests to work on, wait for an IRP to arrive */
+    PendingIrp = 0;
+    Result = FspVolumeTransactRingQuery(Ring, SlotCount, 0, &CanConsume);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+    if (Wait && !CanConsume)
+    {
+        KeQuerySystemTime(&Timeout);
+        Timeout.QuadPart += 0 == RepostedIrp ?
+            FsvolDeviceExtension->VolumeParams.TransactTimeout * 10000ULL :
+            FspVolumeTransactEarlyTimeout;
+            /* convert millis to nanos and add to absolute time */
+        while (0 == (PendingIrp = FspIoqNextPendingIrp(FsvolDeviceExtension->Ioq, 0, &Timeout, Irp)))
+        {
+            if (FspIoqStopped(FsvolDeviceExtension->Ioq))
+            {
+                Result = STATUS_CANCELLED;
+                goto exit;
+            }
+        }
+        if (FspIoqTimeout == PendingIrp || FspIoqCancelled == PendingIrp)
+        {
+            Result = FspIoqTimeout == PendingIrp ? STATUS_SUCCESS : STATUS_CANCELLED;
+            goto exit;
+        }
+    }
+
+    /* send any pending IRP's to the user-mode file system */
+    RepostedIrp = 0;
+    LoopCount = SlotCount;
+    while (0 < LoopCount--) /* upper bound on loop guarantees forward progress! */
+    {
+        if (0 == PendingIrp)
+        {
+            /* check that we have a free slot before pulling the next pending IRP off the queue */
+            Result = FspVolumeTransactRingQuery(Ring, SlotCount, &CanProduce, 0);
+            if (!NT_SUCCESS(Result))
+                goto exit;
+            if (!CanProduce)
+                break;
+
+            /* get the next pending IRP, but do not go beyond the first reposted IRP! */
+            PendingIrp = FspIoqNextPendingIrp(FsvolDeviceExtension->Ioq, RepostedIrp, 0, Irp);
+            if (0 == PendingIrp)
+                break;
+        }
+
+        /*
+         * Claim a ring slot before preparing the IRP. If the ring is full (e.g. because
+         * another thread filled it in the meantime) the IRP has not been prepared yet
+         * and can be safely reposted to our Ioq.
+         */
+        Result = FspVolumeTransactRingProduceBegin(Ring, SlotCount, &SlotBuffer, &Position);
+        if (!NT_SUCCESS(Result) || 0 == SlotBuffer)
+        {
+            if (!FspIopRetryPrepareIrp(PendingIrp, &Result))
+                FspIopCompleteIrp(PendingIrp, Result);
+            Result = STATUS_SUCCESS;
+            break;
+        }
+
+        PendingIrpRequest = FspIrpRequest(PendingIrp);
+
+        IoSetTopLevelIrp(PendingIrp);
+        Result = FspIopDispatchPrepare(PendingIrp, PendingIrpRequest);
+        if (STATUS_PENDING == Result)
+        {
+            /*
+             * The IRP has been reposted to our Ioq. Remember the first such IRP,
+             * so that we know to break the loop if we see it again.
+             */
+            if (0 == RepostedIrp)
+                RepostedIrp = PendingIrp;
+            PendingIrpRequest = 0;
+        }
+        else if (!NT_SUCCESS(Result))
+        {
+            FspIopCompleteIrp(PendingIrp, Result);
+            PendingIrpRequest = 0;
+        }
+        else
+        {
+            /*
+             * Copy the request into the (not yet published) slot and mark the IRP as
+             * processing before publishing the slot. Otherwise the file system could
+             * respond before FspIoqEndProcessingIrp can find the IRP.
+             */
+            Result = FspVolumeTransactRingCopyRequest(SlotBuffer, PendingIrpRequest);
+            if (!NT_SUCCESS(Result))
+            {
+                FspIopCompleteIrp(PendingIrp, Result);
+                FspVolumeTransactRingProduceEmpty(Ring, SlotCount, SlotBuffer, Position);
+                goto exit;
+            }
+
+            if (!FspIoqStartProcessingIrp(FsvolDeviceExtension->Ioq, PendingIrp))
+            {
+                /*
+                 * This can only happen if the Ioq was stopped. Abandon everything
+                 * and return STATUS_CANCELLED. Any IRP's in the Pending and Process
+                 * queues of the Ioq will be cancelled during FspIoqStop(). We must
+                 * also cancel the PendingIrp we have in our hands.
+                 */
+                ASSERT(FspIoqStopped(FsvolDeviceExtension->Ioq));
+                FspIopCompleteCanceledIrp(PendingIrp);
+                FspVolumeTransactRingProduceEmpty(Ring, SlotCount, SlotBuffer, Position);
+                Result = STATUS_CANCELLED;
+                goto exit;
+            }
+        }
+
+        /* a slot once claimed must always be published; publish an empty request if necessary */
+        if (0 == PendingIrpRequest)
+        {
+            Result = FspVolumeTransactRingCopyRequest(SlotBuffer, 0);
+            if (!NT_SUCCESS(Result))
+            {
+                FspVolumeTransactRingProduceEnd(Ring, SlotCount, Position);
+                goto exit;
+            }
+        }
+        Result = FspVolumeTransactRingProduceEnd(Ring, SlotCount, Position);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+
+        PendingIrp = 0;
+    }
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (0 != Response)
+        FspFree(Response);
+
+    IoSetTopLevelIrp(TopLevelIrp);
+    FspDeviceDereference(FsvolDeviceObject);
+
+    Irp->IoStatus.Information = 0;
+    return Result;
+}
+
 NTSTATUS FspVolumeStop(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
 {
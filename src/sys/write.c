@@ -30,6 +30,7 @@ FSP_IOPREP_DISPATCH FspFsvolWritePrepare;
 FSP_IOCMPL_DISPATCH FspFsvolWriteComplete;
 static FSP_IOP_REQUEST_FINI FspFsvolWriteNonCachedRequestFini;
 FSP_DRIVER_DISPATCH FspWrite;
+FAST_IO_WRITE FspFastIoWrite;
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FspFsvolWrite)
@@ -39,6 +40,7 @@ FSP_DRIVER_DISPATCH FspWrite;
 #pragma alloc_text(PAGE, FspFsvolWriteComplete)
 #pragma alloc_text(PAGE, FspFsvolWriteNonCachedRequestFini)
 #pragma alloc_text(PAGE, FspWrite)
+#pragma alloc_text(PAGE, FspFastIoWrite)
 #endif
 
 enum
@@ -652,3 +654,94 @@ NTSTATUS FspWrite(
         IrpSp->Parameters.Write.ByteOffset.HighPart, IrpSp->Parameters.Write.ByteOffset.LowPart,
         IrpSp->Parameters.Write.Length);
 }
+
+BOOLEAN FspFastIoWrite(
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER FileOffset,
+    ULONG Length,
+    BOOLEAN Wait,
+    ULONG LockKey,
+    PVOID Buffer,
+    PIO_STATUS_BLOCK IoStatus,
+    PDEVICE_OBJECT DeviceObject)
+{
+    /*
+     * Cached write without an IRP. Writes that extend the file (including writes to the end
+     * of file) need FspSendSetInformationIrp and are left to FspFsvolWriteCached, as are
+     * writes that the cache manager wants deferred.
+     */
+
+    FSP_ENTER_BOOL(PAGED_CODE());
+
+    FSP_FILE_NODE *FileNode = FileObject->FsContext;
+    LARGE_INTEGER WriteOffset = *FileOffset;
+    LARGE_INTEGER WriteLength;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    NTSTATUS CopyResult;
+
+    Result = FALSE;
+
+    if (!FspFileNodeIsValid(FileNode) || FileNode->IsDirectory ||
+        !FlagOn(FileObject->Flags, FO_CACHE_SUPPORTED) || 0 == FileObject->PrivateCacheMap ||
+        0 != IoGetTopLevelIrp() ||
+        0 > WriteOffset.QuadPart/* FILE_WRITE_TO_END_OF_FILE, FILE_USE_FILE_POINTER_POSITION */)
+        FSP_RETURN();
+
+    if (0 == Length)
+    {
+        IoStatus->Status = STATUS_SUCCESS;
+        IoStatus->Information = 0;
+        FSP_RETURN(Result = TRUE);
+    }
+
+    if (!CcCanIWrite(FileObject, Length, Wait, FALSE))
+        FSP_RETURN();
+
+    /* acquire Main exclusive as FspFsvolWriteCached does; see FspFastIoRead */
+    if (!DEBUGTEST(90) ||
+        !FspFileNodeTryAcquireExclusiveF(FileNode, FspFileNodeAcquireMain, Wait))
+        FSP_RETURN();
+
+    if (!FspFileNodeOplockIsFastIoPossible(FileNode))
+        goto release;
+
+    FspFileNodeGetFileInfo(FileNode, &FileInfo);
+    if (FileInfo.FileSize < (UINT64)WriteOffset.QuadPart + Length)
+        goto release;
+
+    WriteLength.QuadPart = Length;
+    if (!FsRtlFastCheckLockForWrite(&FileNode->FileLock, &WriteOffset, &WriteLength, LockKey,
+        FileObject, PsGetCurrentProcess()))
+        goto release;
+
+    IoSetTopLevelIrp((PIRP)FSRTL_FAST_IO_TOP_LEVEL_IRP);
+    CopyResult = FspCcCopyWrite(FileObject, &WriteOffset, Length, Wait, Buffer);
+    IoSetTopLevelIrp(0);
+
+    /* on STATUS_PENDING (would block) or failure let the IRP path retry and report */
+    if (STATUS_SUCCESS != CopyResult)
+        goto release;
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = Length;
+
+    /* update the current file offset if synchronous I/O */
+    if (FlagOn(FileObject->Flags, FO_SYNCHRONOUS_IO))
+        FileObject->CurrentByteOffset.QuadPart = WriteOffset.QuadPart + Length;
+
+    /* mark the file object as modified */
+    SetFlag(FileObject->Flags, FO_FILE_MODIFIED);
+
+    Result = TRUE;
+
+release:
+    FspFileNodeRelease(FileNode, Main);
+
+    FSP_LEAVE_BOOL(
+        "FileObject=%p, Buffer=%p, "
+        "Key=%#lx, ByteOffset=%#lx:%#lx, Length=%ld",
+        FileObject, Buffer,
+        LockKey,
+        FileOffset->HighPart, FileOffset->LowPart,
+        Length);
+}
@@ -0,0 +1,374 @@
+/**
+ * @file arena-bench.c
+ *
+ * Portable test and benchmark for the FUSE per-thread path arena.
+ *
+ * Builds dll/fuse/fuse_arena.c against the shim in posix/dll/fuse/library.h. With -t a set
+ * of single threaded checks asserts on the arena high water and overflow counters that
+ * fsp_fuse_arena_reset publishes in struct fuse (requests that fit, rewound traverse style
+ * lookups, requests that spill to the heap) and a multithreaded run checks that the
+ * counters are exact when many dispatcher threads reset concurrently. Otherwise the cost
+ * of translating a path into the arena is compared with a heap allocated translation.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/dll/fuse/fuse_arena.c"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PATH_MAX_LENGTH                 (2 * FSP_FUSE_ARENA_SIZE)
+
+static unsigned OptRepeat = 3;
+static unsigned OptThreads = 4;
+
+#define FAIL(...)                       do { fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } while (0)
+#define CHECK(e)                        do { if (!(e)) FAIL("%s:%d: CHECK(%s)", __FILE__, __LINE__, #e); } while (0)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct fsp_fuse_context_header *context_create(void)
+{
+    struct fsp_fuse_context_header *contexthdr;
+
+    /* laid out like fsp_fuse_get_context: header, context, arena */
+    contexthdr = aligned_alloc(MEMORY_ALLOCATION_ALIGNMENT,
+        sizeof *contexthdr + 64 + FSP_FUSE_ARENA_SIZE);
+    CHECK(0 != contexthdr);
+    memset(contexthdr, 0, sizeof *contexthdr);
+    contexthdr->Arena = contexthdr->ContextBuf + 64;
+    contexthdr->ArenaSize = FSP_FUSE_ARENA_SIZE;
+
+    return contexthdr;
+}
+
+/* "\d0000\d0001\...", Length characters long */
+static void path_init(PWSTR Path, ULONG Length)
+{
+    for (ULONG I = 0; Length > I; I++)
+        Path[I] = 0 == I % 6 ? L'\\' : L'0' + (I % 6);
+    Path[Length] = L'\0';
+}
+
+static void path_check(PWSTR WindowsPath, const char *PosixPath)
+{
+    ULONG I;
+    for (I = 0; WindowsPath[I]; I++)
+        CHECK((L'\\' == WindowsPath[I] ? '/' : (char)WindowsPath[I]) == PosixPath[I]);
+    CHECK('\0' == PosixPath[I]);
+}
+
+/* not wcscmp: the C library wchar_t is not 16-bit */
+static BOOLEAN path_equal(PWSTR Path1, PWSTR Path2)
+{
+    for (; *Path1 && *Path1 == *Path2; Path1++, Path2++)
+        ;
+    return *Path1 == *Path2;
+}
+
+static LONG arena_size(ULONG Length)
+{
+    return FSP_FSCTL_DEFAULT_ALIGN_UP(Length + 1);
+}
+
+static void fit_test(void)
+{
+    struct fuse f = { 0 };
+    struct fsp_fuse_context_header *contexthdr = context_create();
+    static WCHAR Path[PATH_MAX_LENGTH + 1];
+    char *PosixPath;
+    PWSTR WindowsPath;
+
+    /* a request that fits: counted in the high water, no overflow, no heap */
+    path_init(Path, 37);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+    path_check(Path, PosixPath);
+    CHECK(contexthdr->Arena <= (PUINT8)PosixPath &&
+        contexthdr->Arena + contexthdr->ArenaSize > (PUINT8)PosixPath);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_windows_path(contexthdr, PosixPath, &WindowsPath));
+    CHECK(path_equal(Path, WindowsPath));
+    CHECK(0 == (uintptr_t)WindowsPath % sizeof(WCHAR));
+    CHECK(0 == ShimHeapBlockCount);
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(arena_size(37) + (LONG)FSP_FSCTL_DEFAULT_ALIGN_UP(38 * sizeof(WCHAR)) == f.ArenaHighWater);
+    CHECK(0 == f.ArenaOverflowCount);
+    CHECK(0 == contexthdr->ArenaUsed);
+
+    /* the high water only grows */
+    path_init(Path, 5);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(arena_size(37) + (LONG)FSP_FSCTL_DEFAULT_ALIGN_UP(38 * sizeof(WCHAR)) == f.ArenaHighWater);
+
+    /* exactly the arena size still fits */
+    path_init(Path, FSP_FUSE_ARENA_SIZE - 1);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+    path_check(Path, PosixPath);
+    CHECK(0 == ShimHeapBlockCount);
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(FSP_FUSE_ARENA_SIZE == f.ArenaHighWater);
+    CHECK(0 == f.ArenaOverflowCount);
+
+    free(contexthdr);
+}
+
+static void rewind_test(void)
+{
+    struct fuse f = { 0 };
+    struct fsp_fuse_context_header *contexthdr = context_create();
+    static WCHAR Path[PATH_MAX_LENGTH + 1];
+    char *PosixPath, *OpenPath;
+    ULONG Mark;
+
+    /*
+     * A Create keeps the opened path for the whole request and does a lookup per
+     * traverse/reparse point check; the lookups are rewound and must not accumulate.
+     */
+    path_init(Path, 100);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &OpenPath));
+    path_init(Path, 1000);
+    for (ULONG I = 0; 1000 > I; I++)
+    {
+        Mark = contexthdr->ArenaUsed;
+        CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+        path_check(Path, PosixPath);
+        fsp_fuse_arena_rewind(contexthdr, Mark);
+        CHECK(arena_size(100) == (LONG)contexthdr->ArenaUsed);
+    }
+    CHECK(0 == ShimHeapBlockCount);
+    path_init(Path, 100);
+    path_check(Path, OpenPath);
+    fsp_fuse_arena_reset(&f, contexthdr);
+    /* the rewound lookups still count toward the high water */
+    CHECK(arena_size(100) + arena_size(1000) == f.ArenaHighWater);
+    CHECK(0 == f.ArenaOverflowCount);
+
+    /* the same lookups without rewinding spill over */
+    path_init(Path, 1000);
+    for (ULONG I = 0; 100 > I; I++)
+    {
+        CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+        path_check(Path, PosixPath);
+    }
+    CHECK(0 != ShimHeapBlockCount);
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(100 * arena_size(1000) <= f.ArenaHighWater);
+    CHECK(1 == f.ArenaOverflowCount);
+    CHECK(0 == ShimHeapBlockCount);
+
+    free(contexthdr);
+}
+
+static void overflow_test(void)
+{
+    struct fuse f = { 0 };
+    struct fsp_fuse_context_header *contexthdr = context_create();
+    static WCHAR Path[PATH_MAX_LENGTH + 1];
+    char *PosixPath, *PosixPath2;
+    PWSTR WindowsPath;
+    ULONG Mark;
+
+    /* a path that is larger than the arena goes to the heap and is freed at reset */
+    path_init(Path, PATH_MAX_LENGTH);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+    path_check(Path, PosixPath);
+    CHECK(1 == ShimHeapBlockCount);
+    CHECK(0 == contexthdr->ArenaUsed);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_windows_path(contexthdr, PosixPath, &WindowsPath));
+    CHECK(path_equal(Path, WindowsPath));
+    CHECK(2 == ShimHeapBlockCount);
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(arena_size(PATH_MAX_LENGTH) + (LONG)FSP_FSCTL_DEFAULT_ALIGN_UP(
+        (PATH_MAX_LENGTH + 1) * sizeof(WCHAR)) == f.ArenaHighWater);
+    CHECK(1 == f.ArenaOverflowCount);
+    CHECK(0 == ShimHeapBlockCount);
+
+    /* overflow blocks survive a rewind; the small path after it comes from the arena again */
+    Mark = contexthdr->ArenaUsed;
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+    fsp_fuse_arena_rewind(contexthdr, Mark);
+    CHECK(1 == ShimHeapBlockCount);
+    path_check(Path, PosixPath);
+    path_init(Path, 10);
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath2));
+    CHECK(contexthdr->Arena == (PUINT8)PosixPath2);
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(2 == f.ArenaOverflowCount);
+    CHECK(0 == ShimHeapBlockCount);
+
+    /* a request without overflow does not count */
+    CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+    fsp_fuse_arena_reset(&f, contexthdr);
+    CHECK(2 == f.ArenaOverflowCount);
+
+    free(contexthdr);
+}
+
+static struct fuse StressFuse;
+static volatile LONG StressOverflowCount;
+
+static void *stress_thread(void *Data)
+{
+    struct fsp_fuse_context_header *contexthdr = context_create();
+    static __thread WCHAR Path[PATH_MAX_LENGTH + 1];
+    unsigned Seed = (unsigned)(uintptr_t)Data;
+    char *PosixPath;
+    ULONG Length;
+
+    for (ULONG I = 0; 10000 > I; I++)
+    {
+        Seed = Seed * 1664525 + 1013904223;
+        /* mostly small paths; about one in 64 is larger than the arena */
+        Length = 0 == (Seed >> 8) % 64 ?
+            FSP_FUSE_ARENA_SIZE + (Seed >> 16) % 1000 : 1 + (Seed >> 16) % 1000;
+        path_init(Path, Length);
+        CHECK(STATUS_SUCCESS == fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath));
+        path_check(Path, PosixPath);
+        if (FSP_FUSE_ARENA_SIZE <= Length)
+            __atomic_add_fetch(&StressOverflowCount, 1, __ATOMIC_RELAXED);
+        fsp_fuse_arena_reset(&StressFuse, contexthdr);
+    }
+
+    free(contexthdr);
+
+    return 0;
+}
+
+static void stress_test(void)
+{
+    pthread_t Threads[64];
+    unsigned ThreadCount = 64 < OptThreads ? 64 : OptThreads;
+
+    for (unsigned I = 0; ThreadCount > I; I++)
+        CHECK(0 == pthread_create(&Threads[I], 0, stress_thread, (void *)(uintptr_t)(I + 1)));
+    for (unsigned I = 0; ThreadCount > I; I++)
+        pthread_join(Threads[I], 0);
+
+    /* every overflowing request is counted once and the high water is the largest request */
+    CHECK(StressOverflowCount == StressFuse.ArenaOverflowCount);
+    CHECK(0 < StressFuse.ArenaOverflowCount);
+    CHECK(FSP_FUSE_ARENA_SIZE < StressFuse.ArenaHighWater);
+    CHECK(arena_size(FSP_FUSE_ARENA_SIZE + 999) >= StressFuse.ArenaHighWater);
+    CHECK(0 == ShimHeapBlockCount);
+}
+
+static int test(void)
+{
+    fit_test();
+    rewind_test();
+    overflow_test();
+    stress_test();
+
+    printf("arena: all tests passed (%u threads, %ld overflows, high water %ld bytes)\n",
+        OptThreads, (long)StressFuse.ArenaOverflowCount, (long)StressFuse.ArenaHighWater);
+
+    return 0;
+}
+
+static void bench(ULONG Length, unsigned Count)
+{
+    struct fuse f = { 0 };
+    struct fsp_fuse_context_header *contexthdr = context_create();
+    static WCHAR Path[PATH_MAX_LENGTH + 1];
+    char *PosixPath;
+    ULONG Size;
+    double ArenaTime = 1e9, HeapTime = 1e9, T;
+
+    path_init(Path, Length);
+
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        T = now();
+        for (unsigned I = 0; Count > I; I++)
+        {
+            fsp_fuse_arena_posix_path(contexthdr, Path, &PosixPath);
+            fsp_fuse_arena_reset(&f, contexthdr);
+        }
+        T = now() - T;
+        if (ArenaTime > T)
+            ArenaTime = T;
+
+        /* what FspPosixMapWindowsToPosixPath does: size, allocate, translate, free */
+        T = now();
+        for (unsigned I = 0; Count > I; I++)
+        {
+            Size = 0;
+            FspPosixMapWindowsToPosixPathBuffer(Path, 0, &Size, TRUE);
+            PosixPath = MemAlloc(Size);
+            FspPosixMapWindowsToPosixPathBuffer(Path, PosixPath, &Size, TRUE);
+            MemFree(PosixPath);
+        }
+        T = now() - T;
+        if (HeapTime > T)
+            HeapTime = T;
+    }
+
+    printf("%8u %10u %12.3f %12.3f %9.2fx\n",
+        Length, Count, ArenaTime * 1e3, HeapTime * 1e3, HeapTime / ArenaTime);
+
+    free(contexthdr);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: arena-bench [-t] [-r REPEAT] [-n THREADS] [COUNT]\n"
+        "\n"
+        "    -t          test the arena and its counters\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -n THREADS  threads for the multithreaded test [4]\n"
+        "    COUNT       translations per measurement [1000000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned Count = 1000000;
+    BOOLEAN OptTest = FALSE;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-t", argv[I]))
+            OptTest = TRUE;
+        else if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-n", argv[I]) && argc > I + 1)
+            OptThreads = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0])
+            usage();
+        else
+            Count = strtoul(argv[I], 0, 0);
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+    if (0 == OptThreads)
+        OptThreads = 1;
+
+    if (OptTest)
+        return test();
+
+    printf("%8s %10s %12s %12s %10s\n", "LENGTH", "COUNT", "ARENA(ms)", "HEAP(ms)", "SPEEDUP");
+    bench(16, Count);
+    bench(64, Count);
+    bench(260, Count);
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file arena-bench/posix/dll/fuse/library.h
+ *
+ * Just enough of the FUSE layer environment to compile dll/fuse/fuse_arena.c on a POSIX
+ * system. Compile with -fshort-wchar so that L"" literals are UTF-16 like on Windows.
+ *
+ * The path transcoders are stand-ins that only swap the separators of ASCII paths (the
+ * real ones are tested by posix-bench). MemAlloc/MemFree count the live heap blocks, so
+ * that the harness can check that overflow blocks are freed at reset.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_DLL_FUSE_LIBRARY_H_INCLUDED
+#define WINFSP_DLL_FUSE_LIBRARY_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#if WCHAR_MAX > 0xffff
+#error compile with -fshort-wchar
+#endif
+
+typedef void VOID, *PVOID;
+typedef wchar_t WCHAR, *PWSTR;
+typedef uint8_t UINT8, *PUINT8, BOOLEAN;
+typedef uint32_t ULONG, *PULONG;
+typedef int32_t LONG, NTSTATUS;
+
+#define TRUE                            1
+#define FALSE                           0
+#define __declspec(x)                   __declspec_##x
+#define __declspec_align(n)             __attribute__((aligned(n)))
+#define MEMORY_ALLOCATION_ALIGNMENT     16
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+
+#define FSP_FSCTL_ALIGN_UP(x, s)        (((x) + ((s) - 1L)) & ~((s) - 1L))
+#define FSP_FSCTL_DEFAULT_ALIGNMENT     8
+#define FSP_FSCTL_DEFAULT_ALIGN_UP(x)   FSP_FSCTL_ALIGN_UP(x, FSP_FSCTL_DEFAULT_ALIGNMENT)
+
+#define FSP_FUSE_ARENA_SIZE             (16 * 1024)
+
+static volatile LONG ShimHeapBlockCount;
+static inline void *MemAlloc(size_t Size)
+{
+    void *Pointer = malloc(Size);
+    if (0 != Pointer)
+        __atomic_add_fetch(&ShimHeapBlockCount, 1, __ATOMIC_RELAXED);
+    return Pointer;
+}
+static inline void MemFree(void *Pointer)
+{
+    if (0 != Pointer)
+        __atomic_sub_fetch(&ShimHeapBlockCount, 1, __ATOMIC_RELAXED);
+    free(Pointer);
+}
+
+static inline LONG InterlockedCompareExchange(volatile LONG *Target, LONG Value, LONG Comparand)
+{
+    __atomic_compare_exchange_n(Target, &Comparand, Value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+static inline LONG InterlockedIncrement(volatile LONG *Target)
+{
+    return __atomic_add_fetch(Target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline NTSTATUS FspPosixMapWindowsToPosixPathBuffer(PWSTR WindowsPath,
+    char *PosixPath, PULONG PSize, BOOLEAN Translate)
+{
+    ULONG Length = 0;
+    while (WindowsPath[Length])
+        Length++;
+    if (*PSize < Length + 1)
+    {
+        *PSize = Length + 1;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    for (ULONG I = 0; Length > I; I++)
+        PosixPath[I] = L'\\' == WindowsPath[I] ? '/' : (char)WindowsPath[I];
+    PosixPath[Length] = '\0';
+    *PSize = Length + 1;
+    return STATUS_SUCCESS;
+}
+static inline NTSTATUS FspPosixMapPosixToWindowsPathBuffer(const char *PosixPath,
+    PWSTR WindowsPath, PULONG PSize, BOOLEAN Translate)
+{
+    ULONG Length = (ULONG)strlen(PosixPath);
+    if (*PSize < (Length + 1) * sizeof(WCHAR))
+    {
+        *PSize = (Length + 1) * sizeof(WCHAR);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    for (ULONG I = 0; Length > I; I++)
+        WindowsPath[I] = '/' == PosixPath[I] ? L'\\' : (WCHAR)(unsigned char)PosixPath[I];
+    WindowsPath[Length] = L'\0';
+    *PSize = (Length + 1) * sizeof(WCHAR);
+    return STATUS_SUCCESS;
+}
+
+/* the parts of struct fuse and the context header that the arena uses */
+struct fuse
+{
+    volatile LONG ArenaHighWater, ArenaOverflowCount;
+};
+
+struct fsp_fuse_arena_block
+{
+    struct fsp_fuse_arena_block *Next;
+    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 Buffer[];
+};
+
+struct fsp_fuse_context_header
+{
+    char *PosixPath;
+    PUINT8 Arena;
+    ULONG ArenaSize, ArenaUsed, ArenaPeak, ArenaOverflowSize;
+    struct fsp_fuse_arena_block *ArenaOverflow;
+    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 ContextBuf[];
+};
+
+void *fsp_fuse_arena_alloc(struct fsp_fuse_context_header *contexthdr, ULONG Size);
+VOID fsp_fuse_arena_rewind(struct fsp_fuse_context_header *contexthdr, ULONG Mark);
+VOID fsp_fuse_arena_reset(struct fuse *f, struct fsp_fuse_context_header *contexthdr);
+NTSTATUS fsp_fuse_arena_posix_path(struct fsp_fuse_context_header *contexthdr,
+    PWSTR FileName, char **PPosixPath);
+NTSTATUS fsp_fuse_arena_windows_path(struct fsp_fuse_context_header *contexthdr,
+    const char *PosixPath, PWSTR *PWindowsPath);
+
+#endif
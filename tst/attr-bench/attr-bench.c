@@ -0,0 +1,435 @@
+/**
+ * @file attr-bench.c
+ *
+ * Portable test and benchmark for the FUSE attribute nodes.
+ *
+ * Builds dll/fuse/fuse_attr.c against the shim in posix/dll/fuse/library.h. With -t a set
+ * of single threaded checks (sharing, invalidation, file and directory rename, replaced
+ * rename targets, orphans, leaks) is followed by a multithreaded run that opens, closes
+ * and invalidates paths while other files are renamed back and forth and onto them,
+ * and checks that node keys stay unique. Otherwise the cost
+ * of open/close and of invalidation is measured with many paths open.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/dll/fuse/fuse_attr.c"
+#include <stdio.h>
+#include <time.h>
+
+static unsigned OptRepeat = 3;
+static unsigned OptThreads = 4;
+
+#define FAIL(...)                       do { fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } while (0)
+#define CHECK(e)                        do { if (!(e)) FAIL("%s:%d: CHECK(%s)", __FILE__, __LINE__, #e); } while (0)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fuse_init(struct fuse *f)
+{
+    memset(f, 0, sizeof *f);
+    pthread_rwlock_init(&f->AttrNodeLock, 0);
+}
+
+static void fuse_check_empty(struct fuse *f)
+{
+    for (ULONG Index = 0; FSP_FUSE_ATTR_NODE_BUCKET_COUNT > Index; Index++)
+        CHECK(0 == f->AttrNodeBuckets[Index]);
+    CHECK(0 == ShimHeapBlockCount);
+}
+
+static void share_test(void)
+{
+    struct fuse f;
+    struct fsp_fuse_attr_node *A1, *A2, *B;
+    LONG GenerationA, GenerationB;
+
+    fuse_init(&f);
+
+    A1 = fsp_fuse_attr_reference(&f, "/a");
+    A2 = fsp_fuse_attr_reference(&f, "/a");
+    B = fsp_fuse_attr_reference(&f, "/b");
+    CHECK(0 != A1 && A1 == A2 && 2 == A1->RefCount);
+    CHECK(0 != B && A1 != B && 1 == B->RefCount);
+
+    /* invalidation reaches every open of the path and no other path */
+    GenerationA = A1->Generation;
+    GenerationB = B->Generation;
+    fsp_fuse_attr_invalidate(&f, "/a");
+    CHECK(GenerationA + 1 == A1->Generation);
+    CHECK(GenerationB == B->Generation);
+    fsp_fuse_attr_invalidate(&f, "/c");
+    CHECK(GenerationA + 1 == A1->Generation);
+    CHECK(GenerationB == B->Generation);
+
+    fsp_fuse_attr_dereference(&f, A1);
+    CHECK(A2 == fsp_fuse_attr_reference(&f, "/a"));
+    fsp_fuse_attr_dereference(&f, A2);
+    fsp_fuse_attr_dereference(&f, A2);
+    fsp_fuse_attr_dereference(&f, B);
+    fuse_check_empty(&f);
+}
+
+static void rename_file_test(void)
+{
+    struct fuse f;
+    struct fsp_fuse_attr_node *F, *G, *Other;
+    LONG Generation;
+
+    fuse_init(&f);
+
+    F = fsp_fuse_attr_reference(&f, "/d/f");
+    Other = fsp_fuse_attr_reference(&f, "/d/ff");
+    Generation = F->Generation;
+
+    /* the renamed node takes the new key and its opens must refetch (ctime changed) */
+    fsp_fuse_attr_rename(&f, F, "/d/g-with-a-longer-name");
+    CHECK(Generation + 1 == F->Generation);
+    CHECK(0 == strcmp("/d/g-with-a-longer-name", F->PosixPath));
+    CHECK(0 == strcmp("/d/ff", Other->PosixPath));
+
+    /* opens after the rename share the node; invalidation by the new path reaches it */
+    G = fsp_fuse_attr_reference(&f, "/d/g-with-a-longer-name");
+    CHECK(F == G && 2 == F->RefCount);
+    fsp_fuse_attr_invalidate(&f, "/d/g-with-a-longer-name");
+    CHECK(Generation + 2 == F->Generation);
+
+    /* the old path is free */
+    G = fsp_fuse_attr_reference(&f, "/d/f");
+    CHECK(F != G && 1 == G->RefCount);
+    fsp_fuse_attr_dereference(&f, G);
+
+    /* and back to a shorter name */
+    fsp_fuse_attr_rename(&f, F, "/f");
+    CHECK(0 == strcmp("/f", F->PosixPath));
+    CHECK(F == fsp_fuse_attr_reference(&f, "/f"));
+
+    fsp_fuse_attr_dereference(&f, F);
+    fsp_fuse_attr_dereference(&f, F);
+    fsp_fuse_attr_dereference(&f, F);
+    fsp_fuse_attr_dereference(&f, Other);
+    fuse_check_empty(&f);
+}
+
+static void rename_dir_test(void)
+{
+    static const char *Paths[] =
+    {
+        "/d", "/d/x", "/d/y", "/d/y/z", "/dd", "/dd/x", "/e0", "/",
+    };
+    static const char *NewPaths[] =
+    {
+        "/e", "/e/x", "/e/y", "/e/y/z", "/dd", "/dd/x", "/e0", "/",
+    };
+    struct fuse f;
+    struct fsp_fuse_attr_node *Nodes[sizeof Paths / sizeof Paths[0]];
+    ULONG Count = sizeof Paths / sizeof Paths[0];
+
+    fuse_init(&f);
+
+    for (ULONG I = 0; Count > I; I++)
+    {
+        Nodes[I] = fsp_fuse_attr_reference(&f, Paths[I]);
+        CHECK(0 != Nodes[I]);
+    }
+
+    /* everything below the directory is rekeyed, siblings with a common prefix are not */
+    fsp_fuse_attr_rename(&f, Nodes[0], "/e");
+    for (ULONG I = 0; Count > I; I++)
+    {
+        CHECK(0 == strcmp(NewPaths[I], Nodes[I]->PosixPath));
+        CHECK(Nodes[I] == fsp_fuse_attr_reference(&f, NewPaths[I]));
+        fsp_fuse_attr_dereference(&f, Nodes[I]);
+        CHECK((0 < Nodes[I]->Generation) == (0 != strcmp(Paths[I], NewPaths[I])));
+    }
+    for (ULONG I = 0; 4 > I; I++)
+    {
+        struct fsp_fuse_attr_node *Node = fsp_fuse_attr_reference(&f, Paths[I]);
+        CHECK(Nodes[I] != Node);
+        fsp_fuse_attr_dereference(&f, Node);
+    }
+
+    /* a nested directory */
+    fsp_fuse_attr_rename(&f, Nodes[2], "/dd/y");
+    CHECK(0 == strcmp("/dd/y", Nodes[2]->PosixPath));
+    CHECK(0 == strcmp("/dd/y/z", Nodes[3]->PosixPath));
+    CHECK(0 == strcmp("/e/x", Nodes[1]->PosixPath));
+
+    for (ULONG I = 0; Count > I; I++)
+        fsp_fuse_attr_dereference(&f, Nodes[I]);
+    fuse_check_empty(&f);
+}
+
+static void rename_replace_test(void)
+{
+    struct fuse f;
+    struct fsp_fuse_attr_node *S, *T, *Node;
+    LONG Generation;
+
+    fuse_init(&f);
+
+    S = fsp_fuse_attr_reference(&f, "/s");
+    T = fsp_fuse_attr_reference(&f, "/t");
+    Generation = T->Generation;
+
+    /* the open target is orphaned: it must refetch and it must not keep the key */
+    fsp_fuse_attr_rename(&f, S, "/t");
+    CHECK(0 == T->PosixPath);
+    CHECK(Generation + 1 == T->Generation);
+    CHECK(0 == strcmp("/t", S->PosixPath));
+    Node = fsp_fuse_attr_reference(&f, "/t");
+    CHECK(S == Node);
+    fsp_fuse_attr_dereference(&f, Node);
+
+    /* invalidation by path does not reach the orphan */
+    fsp_fuse_attr_invalidate(&f, "/t");
+    CHECK(Generation + 1 == T->Generation);
+
+    /* renaming an orphan (e.g. a stale handle) only invalidates it */
+    fsp_fuse_attr_rename(&f, T, "/s");
+    CHECK(0 == T->PosixPath);
+    CHECK(Generation + 2 == T->Generation);
+    Node = fsp_fuse_attr_reference(&f, "/s");
+    CHECK(T != Node && S != Node);
+    fsp_fuse_attr_dereference(&f, Node);
+
+    /* renaming onto itself keeps the node */
+    fsp_fuse_attr_rename(&f, S, "/t");
+    CHECK(0 == strcmp("/t", S->PosixPath));
+
+    fsp_fuse_attr_dereference(&f, T);
+    fsp_fuse_attr_dereference(&f, S);
+    fuse_check_empty(&f);
+}
+
+static struct fuse StressFuse;
+static volatile int StressStop;
+
+static void *stress_thread(void *Data)
+{
+    unsigned Seed = (unsigned)(uintptr_t)Data;
+    struct fsp_fuse_attr_node *Nodes[8] = { 0 };
+    char Path[64];
+    ULONG Slot;
+
+    while (!StressStop)
+    {
+        Seed = Seed * 1664525 + 1013904223;
+        Slot = (Seed >> 8) % 8;
+        if (0 != Nodes[Slot])
+        {
+            fsp_fuse_attr_dereference(&StressFuse, Nodes[Slot]);
+            Nodes[Slot] = 0;
+        }
+        snprintf(Path, sizeof Path, "/f%u", (Seed >> 16) % 16);
+        if ((Seed >> 20) & 1)
+            fsp_fuse_attr_invalidate(&StressFuse, Path);
+        else
+        {
+            Nodes[Slot] = fsp_fuse_attr_reference(&StressFuse, Path);
+            CHECK(0 != Nodes[Slot] && 0 < Nodes[Slot]->RefCount);
+        }
+    }
+
+    for (Slot = 0; 8 > Slot; Slot++)
+        if (0 != Nodes[Slot])
+            fsp_fuse_attr_dereference(&StressFuse, Nodes[Slot]);
+
+    return 0;
+}
+
+static void stress_check_keys(struct fuse *f)
+{
+    /* no two linked nodes have the same key */
+    for (ULONG Index = 0; FSP_FUSE_ATTR_NODE_BUCKET_COUNT > Index; Index++)
+        for (struct fsp_fuse_attr_node *Node = f->AttrNodeBuckets[Index]; 0 != Node; Node = Node->Next)
+        {
+            CHECK(0 != Node->PosixPath && 0 < Node->RefCount);
+            CHECK(Index == Node->Hash % FSP_FUSE_ATTR_NODE_BUCKET_COUNT);
+            for (struct fsp_fuse_attr_node *Other = Node->Next; 0 != Other; Other = Other->Next)
+                CHECK(0 != strcmp(Node->PosixPath, Other->PosixPath));
+        }
+}
+
+static void stress_test(void)
+{
+    pthread_t Threads[64];
+    unsigned ThreadCount = 64 < OptThreads ? 64 : OptThreads;
+    struct fsp_fuse_attr_node *Files[4];
+    char Path[64];
+    unsigned Seed = 42;
+
+    fuse_init(&StressFuse);
+
+    for (unsigned I = 0; 4 > I; I++)
+    {
+        snprintf(Path, sizeof Path, "/s%u", I);
+        Files[I] = fsp_fuse_attr_reference(&StressFuse, Path);
+    }
+
+    for (unsigned I = 0; ThreadCount > I; I++)
+        CHECK(0 == pthread_create(&Threads[I], 0, stress_thread, (void *)(uintptr_t)(I + 1)));
+
+    /*
+     * Rename our files back and forth under the workers; every so often rename one onto
+     * a path that the workers open, which orphans their node (if any) for that path.
+     */
+    for (unsigned J = 0; 20000 > J; J++)
+    {
+        unsigned I = J % 4;
+        Seed = Seed * 1664525 + 1013904223;
+        if (0 == (Seed >> 8) % 16)
+            snprintf(Path, sizeof Path, "/f%u", (Seed >> 16) % 16);
+        else
+            snprintf(Path, sizeof Path, "/%c%u", 's' == Files[I]->PosixPath[1] ? 't' : 's', I);
+        fsp_fuse_attr_rename(&StressFuse, Files[I], Path);
+        CHECK(0 == strcmp(Path, Files[I]->PosixPath));
+
+        /* only we rename, so only we orphan; replace a file of ours that we replaced */
+        for (unsigned K = 0; 4 > K; K++)
+            if (0 == Files[K]->PosixPath)
+            {
+                fsp_fuse_attr_dereference(&StressFuse, Files[K]);
+                snprintf(Path, sizeof Path, "/s%u", K);
+                Files[K] = fsp_fuse_attr_reference(&StressFuse, Path);
+                CHECK(0 != Files[K]);
+            }
+
+        if (0 == J % 1000)
+        {
+            AcquireSRWLockExclusive(&StressFuse.AttrNodeLock);
+            stress_check_keys(&StressFuse);
+            ReleaseSRWLockExclusive(&StressFuse.AttrNodeLock);
+        }
+    }
+
+    StressStop = 1;
+    for (unsigned I = 0; ThreadCount > I; I++)
+        pthread_join(Threads[I], 0);
+
+    stress_check_keys(&StressFuse);
+    for (unsigned I = 0; 4 > I; I++)
+        fsp_fuse_attr_dereference(&StressFuse, Files[I]);
+    fuse_check_empty(&StressFuse);
+}
+
+static int test(void)
+{
+    share_test();
+    rename_file_test();
+    rename_dir_test();
+    rename_replace_test();
+    stress_test();
+
+    printf("attr: all tests passed (%u threads)\n", OptThreads);
+
+    return 0;
+}
+
+static void bench(unsigned OpenCount, unsigned Count)
+{
+    struct fuse f;
+    struct fsp_fuse_attr_node **Nodes, *Node;
+    char Path[64];
+    double OpenTime = 1e9, InvalidateTime = 1e9, T;
+
+    fuse_init(&f);
+
+    Nodes = malloc(OpenCount * sizeof *Nodes);
+    CHECK(0 != Nodes);
+    for (unsigned I = 0; OpenCount > I; I++)
+    {
+        snprintf(Path, sizeof Path, "/dir%u/file%u", I % 100, I);
+        Nodes[I] = fsp_fuse_attr_reference(&f, Path);
+    }
+
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        T = now();
+        for (unsigned I = 0; Count > I; I++)
+        {
+            Node = fsp_fuse_attr_reference(&f, "/dir0/newfile");
+            fsp_fuse_attr_dereference(&f, Node);
+        }
+        T = now() - T;
+        if (OpenTime > T)
+            OpenTime = T;
+
+        T = now();
+        for (unsigned I = 0; Count > I; I++)
+            fsp_fuse_attr_invalidate(&f, "/dir0/file0");
+        T = now() - T;
+        if (InvalidateTime > T)
+            InvalidateTime = T;
+    }
+
+    printf("%8u %10u %12.1f %14.1f\n",
+        OpenCount, Count, OpenTime * 1e9 / Count, InvalidateTime * 1e9 / Count);
+
+    for (unsigned I = 0; OpenCount > I; I++)
+        fsp_fuse_attr_dereference(&f, Nodes[I]);
+    free(Nodes);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: attr-bench [-t] [-r REPEAT] [-n THREADS] [COUNT]\n"
+        "\n"
+        "    -t          test the attribute nodes\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -n THREADS  threads for the multithreaded test [4]\n"
+        "    COUNT       operations per measurement [1000000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned Count = 1000000;
+    BOOLEAN OptTest = FALSE;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-t", argv[I]))
+            OptTest = TRUE;
+        else if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-n", argv[I]) && argc > I + 1)
+            OptThreads = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0])
+            usage();
+        else
+            Count = strtoul(argv[I], 0, 0);
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+    if (0 == OptThreads)
+        OptThreads = 1;
+
+    if (OptTest)
+        return test();
+
+    printf("%8s %10s %12s %14s\n", "OPEN", "COUNT", "OPEN(ns)", "INVALIDATE(ns)");
+    bench(10, Count);
+    bench(1000, Count);
+    bench(100000, Count);
+
+    return 0;
+}
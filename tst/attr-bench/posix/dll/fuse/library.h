@@ -0,0 +1,104 @@
+/**
+ * @file attr-bench/posix/dll/fuse/library.h
+ *
+ * Just enough of the FUSE layer environment to compile dll/fuse/fuse_attr.c on a POSIX
+ * system. SRW locks map to pthread rwlocks. MemAlloc/MemFree count the live heap blocks,
+ * so that the harness can check that nodes and rekeyed paths are freed.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_DLL_FUSE_LIBRARY_H_INCLUDED
+#define WINFSP_DLL_FUSE_LIBRARY_H_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+typedef void VOID, *PVOID;
+typedef wchar_t WCHAR, *PWSTR;
+typedef uint8_t UINT8, BOOLEAN;
+typedef uint32_t UINT32, ULONG;
+typedef int32_t LONG;
+
+#define TRUE                            1
+#define FALSE                           0
+
+#define FSP_FUSE_ATTR_NODE_BUCKET_COUNT 64
+
+static volatile LONG ShimHeapBlockCount;
+static inline void *MemAlloc(size_t Size)
+{
+    void *Pointer = malloc(Size);
+    if (0 != Pointer)
+        __atomic_add_fetch(&ShimHeapBlockCount, 1, __ATOMIC_RELAXED);
+    return Pointer;
+}
+static inline void MemFree(void *Pointer)
+{
+    if (0 != Pointer)
+        __atomic_sub_fetch(&ShimHeapBlockCount, 1, __ATOMIC_RELAXED);
+    free(Pointer);
+}
+
+static inline LONG InterlockedIncrement(volatile LONG *Target)
+{
+    return __atomic_add_fetch(Target, 1, __ATOMIC_SEQ_CST);
+}
+
+#define lstrlenA(s)                     ((int)strlen(s))
+#define lstrcmpA(s, t)                  strcmp(s, t)
+#define lstrcpyA(s, t)                  strcpy(s, t)
+#define invariant_strncmp(s, t, n)      strncmp(s, t, n)
+
+/* dll/cache.h is shared with the name keyed caches of the DLL; only its hash is used here */
+#define invariant_wcsncmp(s, t, n)      wcsncmp(s, t, n)
+#define CSTR_EQUAL                      2
+int CompareStringOrdinal(const WCHAR *s, int slen, const WCHAR *t, int tlen, BOOLEAN IgnoreCase);
+#include "../../../../../src/dll/cache.h"
+
+typedef pthread_rwlock_t SRWLOCK;
+#define SRWLOCK_INIT                    PTHREAD_RWLOCK_INITIALIZER
+#define AcquireSRWLockExclusive(l)      pthread_rwlock_wrlock(l)
+#define ReleaseSRWLockExclusive(l)      pthread_rwlock_unlock(l)
+#define AcquireSRWLockShared(l)         pthread_rwlock_rdlock(l)
+#define ReleaseSRWLockShared(l)         pthread_rwlock_unlock(l)
+
+/* the parts of struct fuse that the attribute nodes use */
+struct fuse
+{
+    SRWLOCK AttrNodeLock;
+    struct fsp_fuse_attr_node *AttrNodeBuckets[FSP_FUSE_ATTR_NODE_BUCKET_COUNT];
+};
+
+struct fsp_fuse_attr_node
+{
+    struct fsp_fuse_attr_node *Next;
+    ULONG Hash;
+    LONG RefCount;
+    volatile LONG Generation;
+    char *PosixPath;
+    char PosixPathBuf[];
+};
+
+struct fsp_fuse_attr_node *fsp_fuse_attr_reference(struct fuse *f, const char *PosixPath);
+VOID fsp_fuse_attr_dereference(struct fuse *f, struct fsp_fuse_attr_node *AttrNode);
+VOID fsp_fuse_attr_invalidate(struct fuse *f, const char *PosixPath);
+VOID fsp_fuse_attr_rename(struct fuse *f, struct fsp_fuse_attr_node *RenameNode,
+    const char *NewPosixPath);
+
+#endif
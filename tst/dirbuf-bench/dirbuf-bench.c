@@ -0,0 +1,270 @@
+/**
+ * @file dirbuf-bench.c
+ *
+ * Portable benchmark for the directory buffer sort and marker lookup.
+ *
+ * Builds dll/dirbuf.c against the shim in posix/dll/library.h, so that the directory
+ * buffer can be profiled on any POSIX system. Synthetic directories are filled in random
+ * order, then sorted with both the comparison quicksort and the multikey radix sort; the
+ * two resulting orders are checked to be identical. Finally the sorted buffer is read
+ * page-by-page the way QueryDirectory does, resuming from the marker of the previous page.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/dll/dirbuf.c"
+#include <stdio.h>
+#include <time.h>
+
+#define NAME_MAX_LENGTH                 64
+#define PAGE_SIZE                       (64 * 1024)
+
+static unsigned OptRepeat = 3;
+static unsigned OptSeed = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned rnd(unsigned *state)
+{
+    /* LCG from Numerical Recipes */
+    return (*state = *state * 1664525 + 1013904223) >> 8;
+}
+
+/* short random names; most comparisons are decided by the first character */
+static void name_random(char *Name, unsigned I, unsigned *Seed)
+{
+    static const char Chars[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-";
+    unsigned Length = 6 + rnd(Seed) % 19;
+    for (unsigned J = 0; Length > J; J++)
+        Name[J] = Chars[rnd(Seed) % (sizeof Chars - 1)];
+    snprintf(Name + Length, NAME_MAX_LENGTH - Length, "%u", I);
+}
+
+/* camera-style names; all names share a common prefix */
+static void name_numbered(char *Name, unsigned I, unsigned *Seed)
+{
+    (void)Seed;
+    snprintf(Name, NAME_MAX_LENGTH, "IMG_%08u.JPG", I);
+}
+
+/* source tree names; long common prefixes of varying length */
+static void name_tree(char *Name, unsigned I, unsigned *Seed)
+{
+    static const char *Words[] =
+    {
+        "component", "controller", "converter", "context", "connection",
+    };
+    static const char *Exts[] =
+    {
+        ".c", ".h", ".cpp", ".hpp", ".inl",
+    };
+    snprintf(Name, NAME_MAX_LENGTH, "%s_%s%u_%u%s",
+        Words[rnd(Seed) % 5], Words[rnd(Seed) % 5], rnd(Seed) % 100, I, Exts[I % 5]);
+}
+
+static void fill(PVOID *PDirBuffer, unsigned Count,
+    void (*Generate)(char *, unsigned, unsigned *), unsigned Seed)
+{
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + NAME_MAX_LENGTH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D;
+    char Name[NAME_MAX_LENGTH];
+    unsigned *Order, J, T, Length;
+    NTSTATUS Result;
+
+    /* fill in random order; directory enumerations are rarely sorted */
+    Order = malloc(Count * sizeof *Order);
+    for (unsigned I = 0; Count > I; I++)
+        Order[I] = I;
+    for (unsigned I = Count - 1; 0 < I; I--)
+    {
+        J = rnd(&Seed) % (I + 1);
+        T = Order[I]; Order[I] = Order[J]; Order[J] = T;
+    }
+
+    if (!FspFileSystemAcquireDirectoryBuffer(PDirBuffer, TRUE, &Result))
+        abort();
+
+    for (unsigned I = 0; Count > I; I++)
+    {
+        Generate(Name, Order[I], &Seed);
+        memset(DirInfo, 0, sizeof *DirInfo);
+        for (Length = 0; Name[Length]; Length++)
+            DirInfo->FileNameBuf[Length] = Name[Length];
+        DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + Length * sizeof(WCHAR));
+        if (!FspFileSystemFillDirectoryBuffer(PDirBuffer, DirInfo, &Result))
+            abort();
+    }
+
+    free(Order);
+}
+
+static void bench(const char *Shape, unsigned Count,
+    void (*Generate)(char *, unsigned, unsigned *))
+{
+    PVOID DirBuffer = 0;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *B;
+    PULONG Index, Unsorted, QSorted;
+    ULONG IndexCount, BytesTransferred, Pages = 0, Entries;
+    FSP_FSCTL_DIR_INFO *DirInfo, *DirInfoEnd;
+    WCHAR Marker[NAME_MAX_LENGTH + 1];
+    PUINT8 Page;
+    double QSortTime = 0, RadixTime = 0, ReadTime = 0, T;
+    BOOLEAN HaveMarker, Done;
+
+    fill(&DirBuffer, Count, Generate, OptSeed + Count);
+    B = DirBuffer;
+    Index = (PULONG)(B->Buffer + B->HiMark);
+    IndexCount = (B->Capacity - B->HiMark) / sizeof(ULONG);
+
+    Unsorted = malloc(IndexCount * sizeof(ULONG));
+    QSorted = malloc(IndexCount * sizeof(ULONG));
+    memcpy(Unsorted, Index, IndexCount * sizeof(ULONG));
+
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        memcpy(Index, Unsorted, IndexCount * sizeof(ULONG));
+        T = now();
+        FspFileSystemQSortDirectoryBuffer(B->Buffer, Index, 0, IndexCount - 1);
+        T = now() - T;
+        if (0 == R || QSortTime > T)
+            QSortTime = T;
+        memcpy(QSorted, Index, IndexCount * sizeof(ULONG));
+
+        memcpy(Index, Unsorted, IndexCount * sizeof(ULONG));
+        T = now();
+        FspFileSystemSortDirectoryBuffer(B);
+        T = now() - T;
+        if (0 == R || RadixTime > T)
+            RadixTime = T;
+
+        if (0 != memcmp(QSorted, Index, IndexCount * sizeof(ULONG)))
+        {
+            fprintf(stderr, "%s/%u: radix sort order differs from quicksort order\n",
+                Shape, Count);
+            exit(1);
+        }
+    }
+
+    ReleaseSRWLockExclusive(&B->Lock);
+
+    Page = malloc(PAGE_SIZE);
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        HaveMarker = FALSE;
+        Done = FALSE;
+        Pages = 0;
+        Entries = 0;
+        T = now();
+        while (!Done)
+        {
+            BytesTransferred = 0;
+            FspFileSystemReadDirectoryBuffer(&DirBuffer, HaveMarker ? Marker : 0,
+                Page, PAGE_SIZE, &BytesTransferred);
+            Pages++;
+            for (
+                DirInfo = (PVOID)Page, DirInfoEnd = (PVOID)(Page + BytesTransferred);
+                DirInfoEnd > DirInfo;
+                DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)))
+            {
+                if (0 == DirInfo->Size)
+                {
+                    Done = TRUE;
+                    break;
+                }
+                memcpy(Marker, DirInfo->FileNameBuf, DirInfo->Size - sizeof *DirInfo);
+                Marker[(DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR)] = L'\0';
+                HaveMarker = TRUE;
+                Entries++;
+            }
+        }
+        T = now() - T;
+        if (Count != Entries)
+        {
+            fprintf(stderr, "%s/%u: read %lu entries\n",
+                Shape, Count, (unsigned long)Entries);
+            exit(1);
+        }
+        if (0 == R || ReadTime > T)
+            ReadTime = T;
+    }
+
+    printf("%-10s %8u %12.3f %12.3f %8.2fx %12.3f %8lu\n",
+        Shape, Count, QSortTime * 1e3, RadixTime * 1e3, QSortTime / RadixTime,
+        ReadTime * 1e3, (unsigned long)Pages);
+
+    free(Page);
+    free(QSorted);
+    free(Unsorted);
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: dirbuf-bench [-r REPEAT] [-s SEED] [COUNT...]\n"
+        "\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -s SEED     seed for name generation and fill order [0]\n"
+        "    COUNT       directory sizes [10000 100000 1000000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned DefaultCounts[] = { 10000, 100000, 1000000 };
+    unsigned Counts[32], CountCount = 0;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-s", argv[I]) && argc > I + 1)
+            OptSeed = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0] || sizeof Counts / sizeof Counts[0] == CountCount)
+            usage();
+        else
+            Counts[CountCount++] = strtoul(argv[I], 0, 0);
+    }
+    if (0 == CountCount)
+    {
+        memcpy(Counts, DefaultCounts, sizeof DefaultCounts);
+        CountCount = sizeof DefaultCounts / sizeof DefaultCounts[0];
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+
+    printf("%-10s %8s %12s %12s %9s %12s %8s\n",
+        "SHAPE", "COUNT", "QSORT(ms)", "RADIX(ms)", "SPEEDUP", "READ(ms)", "PAGES");
+    for (unsigned J = 0; CountCount > J; J++)
+    {
+        if (2 > Counts[J])
+            continue;
+        bench("random", Counts[J], name_random);
+        bench("numbered", Counts[J], name_numbered);
+        bench("tree", Counts[J], name_tree);
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file dirbuf-bench/posix/dll/library.h
+ *
+ * Just enough of the DLL environment to compile dll/dirbuf.c on a POSIX system.
+ * Compile with -fshort-wchar so that L"" literals are UTF-16 like on Windows.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_DLL_LIBRARY_H_INCLUDED
+#define WINFSP_DLL_LIBRARY_H_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#if WCHAR_MAX > 0xffff
+#error compile with -fshort-wchar
+#endif
+
+typedef void VOID, *PVOID;
+typedef wchar_t WCHAR, *PWSTR;
+typedef uint8_t UINT8, *PUINT8, BOOLEAN;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32, ULONG, *PULONG;
+typedef int32_t LONG, NTSTATUS, *PNTSTATUS;
+typedef uint64_t UINT64;
+typedef int64_t LONG64;
+
+#define TRUE                            1
+#define FALSE                           0
+#define INFINITE                        0xffffffff
+#define FSP_API
+#define __forceinline                   inline __attribute__((always_inline))
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_INVALID_DEVICE_STATE     ((NTSTATUS)0xC0000184L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+
+#define MemoryBarrier()                 __sync_synchronize()
+#define InterlockedIncrement(P)         __sync_add_and_fetch(P, 1)
+#define InterlockedDecrement(P)         __sync_sub_and_fetch(P, 1)
+#define InterlockedIncrement64(P)       __sync_add_and_fetch(P, 1)
+
+/* the benchmark does not measure contention; a mutex is a good enough SRWLOCK */
+typedef pthread_mutex_t SRWLOCK;
+typedef pthread_cond_t CONDITION_VARIABLE;
+#define SRWLOCK_INIT                    PTHREAD_MUTEX_INITIALIZER
+#define InitializeSRWLock(L)            pthread_mutex_init(L, 0)
+#define AcquireSRWLockExclusive(L)      pthread_mutex_lock(L)
+#define ReleaseSRWLockExclusive(L)      pthread_mutex_unlock(L)
+#define AcquireSRWLockShared(L)         pthread_mutex_lock(L)
+#define ReleaseSRWLockShared(L)         pthread_mutex_unlock(L)
+#define InitializeConditionVariable(C)  pthread_cond_init(C, 0)
+#define WakeAllConditionVariable(C)     pthread_cond_broadcast(C)
+#define SleepConditionVariableSRW(C, L, T, F) pthread_cond_wait(C, L)
+
+static inline UINT64 GetTickCount64(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#define MemAlloc                        malloc
+#define MemRealloc                      realloc
+#define MemFree                         free
+
+#define FSP_FSCTL_DEFAULT_ALIGNMENT     8
+#define FSP_FSCTL_DEFAULT_ALIGN_UP(x)   \
+    (((x) + FSP_FSCTL_DEFAULT_ALIGNMENT - 1) & ~(FSP_FSCTL_DEFAULT_ALIGNMENT - 1))
+
+/* same layout as in winfsp/fsctl.h */
+typedef struct
+{
+    UINT32 FileAttributes;
+    UINT32 ReparseTag;
+    UINT64 AllocationSize;
+    UINT64 FileSize;
+    UINT64 CreationTime;
+    UINT64 LastAccessTime;
+    UINT64 LastWriteTime;
+    UINT64 ChangeTime;
+    UINT64 IndexNumber;
+    UINT32 HardLinks;
+} FSP_FSCTL_FILE_INFO;
+typedef struct
+{
+    UINT16 Size;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    UINT8 Padding[24];
+    WCHAR FileNameBuf[];
+} FSP_FSCTL_DIR_INFO;
+
+/* only the parts of FSP_FILE_SYSTEM used by dll/dirbuf.c */
+typedef struct
+{
+    PVOID DispatcherThread;
+    PVOID DirectoryCache;
+} FSP_FILE_SYSTEM;
+typedef struct
+{
+    ULONG Capacity;
+    ULONG Count;
+    UINT64 HitCount, MissCount;
+    UINT64 InsertCount;
+    UINT64 InvalidateCount;
+} FSP_FILE_SYSTEM_DIRECTORY_CACHE_STATISTICS;
+FSP_API VOID FspFileSystemDeleteDirectoryBuffer(PVOID *PDirBuffer);
+FSP_API VOID FspFileSystemReleaseDirectoryBuffer(PVOID *PDirBuffer);
+VOID FspFileSystemDeleteDirectoryCache(FSP_FILE_SYSTEM *FileSystem);
+
+static inline int lstrlenW(const WCHAR *s)
+{
+    const WCHAR *p = s;
+    while (*p)
+        p++;
+    return (int)(p - s);
+}
+static inline int invariant_wcsncmp(const WCHAR *s, const WCHAR *t, size_t n)
+{
+    int v = 0;
+    const void *e = t + n;
+    while (e > (const void *)t && 0 == (v = (unsigned)*s - (unsigned)*t) && *t)
+        ++s, ++t;
+    return v;
+}
+
+#define CSTR_EQUAL                      2
+static inline int CompareStringOrdinal(const WCHAR *s, int slen, const WCHAR *t, int tlen,
+    BOOLEAN IgnoreCase)
+{
+    /* ASCII case folding only */
+    unsigned c, d;
+    for (int i = 0; slen > i && tlen > i; i++)
+    {
+        c = s[i]; d = t[i];
+        if (IgnoreCase)
+        {
+            c = ('a' <= c && c <= 'z') ? c & ~0x20 : c;
+            d = ('a' <= d && d <= 'z') ? d & ~0x20 : d;
+        }
+        if (c != d)
+            return c < d ? 1 : 3;
+    }
+    return slen == tlen ? CSTR_EQUAL : (slen < tlen ? 1 : 3);
+}
+
+#include "../../../../src/dll/cache.h"
+
+/* same as in dll/fsop.c */
+static inline BOOLEAN FspFileSystemAddDirInfo(FSP_FSCTL_DIR_INFO *DirInfo,
+    PVOID Buffer, ULONG Length, PULONG PBytesTransferred)
+{
+    static UINT8 Zero[sizeof(UINT16)] = { 0 };
+    PVOID BufferEnd = (PUINT8)Buffer + Length;
+    PVOID SrcBuffer;
+    ULONG SrcLength, DstLength;
+
+    if (0 != DirInfo)
+    {
+        SrcBuffer = DirInfo;
+        SrcLength = DirInfo->Size;
+        DstLength = FSP_FSCTL_DEFAULT_ALIGN_UP(SrcLength);
+    }
+    else
+    {
+        SrcBuffer = &Zero;
+        SrcLength = sizeof Zero;
+        DstLength = SrcLength;
+    }
+
+    Buffer = (PVOID)((PUINT8)Buffer + *PBytesTransferred);
+    if ((PUINT8)Buffer + DstLength > (PUINT8)BufferEnd)
+        return FALSE;
+
+    memcpy(Buffer, SrcBuffer, SrcLength);
+    *PBytesTransferred += DstLength;
+
+    return TRUE;
+}
+
+#endif
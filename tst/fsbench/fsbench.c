@@ -21,6 +21,11 @@
 
 static ULONG OptFileCount = 1000;
 static ULONG OptListCount = 100;
+static ULONG OptThreadCount = 8;
+static ULONG OptMissCount = 10;
+static ULONG OptDepth = 8;
+static ULONG OptLargeDirFileCount = 10000;
+static ULONG OptLargeDirListCount = 10;
 static ULONG OptRdwrFileSize = 4096 * 1024;
 static ULONG OptRdwrCcCount = 100;
 static ULONG OptRdwrNcCount = 100;
@@ -58,6 +63,127 @@ static void file_overwrite_test(void)
 {
     file_create_dotest(CREATE_ALWAYS);
 }
+static DWORD WINAPI file_attr_mt_dotest_thread(PVOID Context)
+{
+    ULONG Thread = (ULONG)(UINT_PTR)Context;
+    DWORD FileAttributes;
+    WCHAR FileName[MAX_PATH];
+
+    for (ULONG Index = 0; OptFileCount > Index; Index++)
+    {
+        StringCbPrintfW(FileName, sizeof FileName, L"fsbench-file%lu",
+            (Index + Thread * 97) % OptFileCount);
+        FileAttributes = GetFileAttributesW(FileName);
+        ASSERT(INVALID_FILE_ATTRIBUTES != FileAttributes);
+    }
+
+    return 0;
+}
+static void file_attr_mt_test(void)
+{
+    /* many concurrent requests; exercises the volume I/O queues under contention */
+    HANDLE Threads[MAXIMUM_WAIT_OBJECTS];
+    ULONG ThreadCount = MAXIMUM_WAIT_OBJECTS > OptThreadCount ? OptThreadCount : MAXIMUM_WAIT_OBJECTS;
+    DWORD WaitResult;
+
+    for (ULONG Index = 0; ThreadCount > Index; Index++)
+    {
+        Threads[Index] = CreateThread(0, 0, file_attr_mt_dotest_thread, (PVOID)(UINT_PTR)Index, 0, 0);
+        ASSERT(0 != Threads[Index]);
+    }
+    WaitResult = WaitForMultipleObjects(ThreadCount, Threads, TRUE, INFINITE);
+    ASSERT(WAIT_OBJECT_0 <= WaitResult && WaitResult < WAIT_OBJECT_0 + ThreadCount);
+    for (ULONG Index = 0; ThreadCount > Index; Index++)
+        CloseHandle(Threads[Index]);
+}
+static void file_open_miss_test(void)
+{
+    /* repeated opens of nonexistent files; exercises the negative name cache */
+    HANDLE Handle;
+    WCHAR FileName[MAX_PATH];
+
+    for (ULONG Pass = 0; OptMissCount > Pass; Pass++)
+        for (ULONG Index = 0; OptFileCount > Index; Index++)
+        {
+            StringCbPrintfW(FileName, sizeof FileName, L"fsbench-miss%lu", Index);
+            Handle = CreateFileW(FileName,
+                GENERIC_READ, 0, 0,
+                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+            ASSERT(INVALID_HANDLE_VALUE == Handle);
+            ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+        }
+}
+static BOOL file_open_deep_traverse_privilege(BOOL Enable)
+{
+    LUID Luid;
+    TOKEN_PRIVILEGES Privileges;
+    HANDLE Token;
+    BOOL Success;
+
+    if (!LookupPrivilegeValueW(0, SE_CHANGE_NOTIFY_NAME, &Luid) ||
+        !OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &Token))
+        return FALSE;
+    Privileges.PrivilegeCount = 1;
+    Privileges.Privileges[0].Attributes = Enable ? SE_PRIVILEGE_ENABLED : 0;
+    Privileges.Privileges[0].Luid = Luid;
+    Success = AdjustTokenPrivileges(Token, FALSE, &Privileges, 0, 0, 0) &&
+        ERROR_SUCCESS == GetLastError();
+    CloseHandle(Token);
+    return Success;
+}
+static void file_open_deep_test(void)
+{
+    /*
+     * repeated opens of a file OptDepth directories deep without the traverse privilege;
+     * exercises the traverse check (and the access check cache when enabled)
+     */
+    HANDLE Handle;
+    BOOL Success;
+    WCHAR FileName[MAX_PATH];
+    ULONG Length;
+
+    if (0 == OptDepth)
+        return;
+
+    Length = 0;
+    for (ULONG Depth = 0; OptDepth > Depth; Depth++)
+    {
+        StringCbPrintfW(FileName + Length, sizeof FileName - Length * sizeof(WCHAR),
+            0 == Depth ? L"fsbench-deep%lu" : L"\\fsbench-deep%lu", Depth);
+        Length = lstrlenW(FileName);
+        Success = CreateDirectoryW(FileName, 0);
+        ASSERT(Success);
+    }
+    StringCbPrintfW(FileName + Length, sizeof FileName - Length * sizeof(WCHAR),
+        L"\\fsbench-file");
+    Handle = CreateFileW(FileName,
+        GENERIC_READ | GENERIC_WRITE, 0, 0,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    CloseHandle(Handle);
+
+    Success = file_open_deep_traverse_privilege(FALSE);
+    ASSERT(Success);
+    for (ULONG Index = 0; OptFileCount > Index; Index++)
+    {
+        Handle = CreateFileW(FileName,
+            GENERIC_READ, 0, 0,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        CloseHandle(Handle);
+    }
+    Success = file_open_deep_traverse_privilege(TRUE);
+    ASSERT(Success);
+
+    Success = DeleteFileW(FileName);
+    ASSERT(Success);
+    for (ULONG Depth = OptDepth; 0 < Depth; Depth--)
+    {
+        *wcsrchr(FileName, L'\\') = L'\0';
+        Success = RemoveDirectoryW(FileName);
+        ASSERT(Success);
+    }
+}
 static void file_list_test(void)
 {
     HANDLE Handle;
@@ -75,6 +201,63 @@ static void file_list_test(void)
         ASSERT(Success);
     }
 }
+static void file_largedir_create_test(void)
+{
+    HANDLE Handle;
+    BOOL Success;
+    WCHAR FileName[MAX_PATH];
+
+    Success = CreateDirectoryW(L"fsbench-largedir", 0);
+    ASSERT(Success);
+    for (ULONG Index = 0; OptLargeDirFileCount > Index; Index++)
+    {
+        StringCbPrintfW(FileName, sizeof FileName, L"fsbench-largedir\\fsbench-file%lu", Index);
+        Handle = CreateFileW(FileName,
+            GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            0,
+            CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+            0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        Success = CloseHandle(Handle);
+        ASSERT(Success);
+    }
+}
+static void file_largedir_list_test(void)
+{
+    /* full listings of a large directory; exercises per-entry attribute retrieval */
+    HANDLE Handle;
+    BOOL Success;
+    WIN32_FIND_DATAW FindData;
+    ULONG Count;
+
+    for (ULONG Index = 0; OptLargeDirListCount > Index; Index++)
+    {
+        Count = 0;
+        Handle = FindFirstFileW(L"fsbench-largedir\\*", &FindData);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        do
+        {
+            Count++;
+        } while (FindNextFileW(Handle, &FindData));
+        Success = FindClose(Handle);
+        ASSERT(Success);
+        ASSERT(OptLargeDirFileCount + 2 == Count);
+    }
+}
+static void file_largedir_delete_test(void)
+{
+    BOOL Success;
+    WCHAR FileName[MAX_PATH];
+
+    for (ULONG Index = 0; OptLargeDirFileCount > Index; Index++)
+    {
+        StringCbPrintfW(FileName, sizeof FileName, L"fsbench-largedir\\fsbench-file%lu", Index);
+        Success = DeleteFileW(FileName);
+        ASSERT(Success);
+    }
+    Success = RemoveDirectoryW(L"fsbench-largedir");
+    ASSERT(Success);
+}
 static void file_delete_test(void)
 {
     BOOL Success;
@@ -116,7 +299,13 @@ static void file_tests(void)
     TEST(file_create_test);
     TEST(file_open_test);
     TEST(file_overwrite_test);
+    TEST(file_attr_mt_test);
+    TEST(file_open_miss_test);
+    TEST(file_open_deep_test);
     TEST(file_list_test);
+    TEST(file_largedir_create_test);
+    TEST(file_largedir_list_test);
+    TEST(file_largedir_delete_test);
     TEST(file_delete_test);
     TEST(file_mkdir_test);
     TEST(file_rmdir_test);
@@ -369,6 +558,31 @@ int main(int argc, char *argv[])
                 OptListCount = strtoul(a + sizeof "--list=" - 1, 0, 10);
                 rmarg(argv, argc, argi);
             }
+            else if (0 == strncmp("--threads=", a, sizeof "--threads=" - 1))
+            {
+                OptThreadCount = strtoul(a + sizeof "--threads=" - 1, 0, 10);
+                rmarg(argv, argc, argi);
+            }
+            else if (0 == strncmp("--misses=", a, sizeof "--misses=" - 1))
+            {
+                OptMissCount = strtoul(a + sizeof "--misses=" - 1, 0, 10);
+                rmarg(argv, argc, argi);
+            }
+            else if (0 == strncmp("--depth=", a, sizeof "--depth=" - 1))
+            {
+                OptDepth = strtoul(a + sizeof "--depth=" - 1, 0, 10);
+                rmarg(argv, argc, argi);
+            }
+            else if (0 == strncmp("--largedir=", a, sizeof "--largedir=" - 1))
+            {
+                OptLargeDirFileCount = strtoul(a + sizeof "--largedir=" - 1, 0, 10);
+                rmarg(argv, argc, argi);
+            }
+            else if (0 == strncmp("--largedir-list=", a, sizeof "--largedir-list=" - 1))
+            {
+                OptLargeDirListCount = strtoul(a + sizeof "--largedir-list=" - 1, 0, 10);
+                rmarg(argv, argc, argi);
+            }
             else if (0 == strncmp("--rdwr-cc=", a, sizeof "--rdwr-cc=" - 1))
             {
                 OptRdwrCcCount = strtoul(a + sizeof "--rdwr-cc=" - 1, 0, 10);
@@ -0,0 +1,437 @@
+/**
+ * @file ioq-bench.c
+ *
+ * Portable stress test and benchmark for the sharded I/O queue.
+ *
+ * Builds sys/ioq.c against the shim in posix/sys/driver.h. With -t a set of single
+ * threaded checks (capacity, boundary, expiration, stop) is followed by a multithreaded
+ * stress run that verifies that every posted IRP is dequeued, processed and completed
+ * exactly once. Otherwise producer/consumer throughput is measured with one shard and
+ * with one shard per thread.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/sys/ioq.c"
+#include <stdio.h>
+
+static unsigned OptRepeat = 3;
+static unsigned OptThreads = 4;
+
+static IRP *Irps;
+static LONG *IrpStates;
+static LONG CanceledCount;
+static LONG ProducersDone;
+
+enum
+{
+    IrpStateIdle = 0,
+    IrpStatePending,
+    IrpStateProcessing,
+    IrpStateCompleted,
+};
+
+#define FAIL(...)                       do { fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } while (0)
+#define CHECK(e)                        do { if (!(e)) FAIL("%s:%d: CHECK(%s)", __FILE__, __LINE__, #e); } while (0)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void irps_init(unsigned Count)
+{
+    free(Irps);
+    free(IrpStates);
+    Irps = calloc(Count, sizeof *Irps);
+    IrpStates = calloc(Count, sizeof *IrpStates);
+    CHECK(0 != Irps && 0 != IrpStates);
+    CanceledCount = 0;
+    ProducersDone = 0;
+}
+
+static void irp_transition(PIRP Irp, LONG From, LONG To)
+{
+    LONG Expected = From;
+    if (!__atomic_compare_exchange_n(&IrpStates[Irp - Irps], &Expected, To,
+        0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        FAIL("irp %ld: state %d, expected %d", (long)(Irp - Irps), (int)Expected, (int)From);
+}
+
+static VOID complete_canceled_irp(PIRP Irp)
+{
+    LONG State = __atomic_exchange_n(&IrpStates[Irp - Irps], IrpStateCompleted, __ATOMIC_SEQ_CST);
+    CHECK(IrpStatePending == State || IrpStateProcessing == State);
+    InterlockedIncrement(&CanceledCount);
+}
+
+static FSP_IOQ *ioq_create(ULONG ShardCount, ULONG IrpCapacity, INT64 IrpTimeout)
+{
+    LARGE_INTEGER Timeout;
+    FSP_IOQ *Ioq;
+    FspProcessorCount = ShardCount;
+    Timeout.QuadPart = IrpTimeout;
+    CHECK(NT_SUCCESS(FspIoqCreate(IrpCapacity, &Timeout, complete_canceled_irp, &Ioq)));
+    CHECK(ShardCount == Ioq->ShardCount || FSP_IOQ_SHARD_COUNT_MAX == Ioq->ShardCount);
+    CHECK(0 == (UINT_PTR)&Ioq->PendingQueues[1] % 64);
+    return Ioq;
+}
+
+static void post(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS Expected)
+{
+    NTSTATUS Result;
+    irp_transition(Irp, IrpStateIdle, IrpStatePending);
+    FspIoqPostIrpEx(Ioq, Irp, BestEffort, &Result);
+    if (STATUS_PENDING != Result)
+        irp_transition(Irp, IrpStatePending, IrpStateIdle);
+    if (Expected != Result)
+        FAIL("irp %ld: post result %x, expected %x",
+            (long)(Irp - Irps), (unsigned)Result, (unsigned)Expected);
+}
+
+static void test_capacity(void)
+{
+    enum { Capacity = 10 };
+    FSP_IOQ *Ioq = ioq_create(4, Capacity, 10000000LL * 60);
+
+    irps_init(Capacity + 2);
+    for (unsigned I = 0; Capacity > I; I++)
+    {
+        FspPosixProcessorNumber = I;
+        post(Ioq, &Irps[I], FALSE, STATUS_PENDING);
+    }
+    post(Ioq, &Irps[Capacity], FALSE, STATUS_INSUFFICIENT_RESOURCES);
+    post(Ioq, &Irps[Capacity + 1], TRUE, STATUS_PENDING);
+    CHECK(Capacity + 1 == FspIoqPendingIrpCount(Ioq));
+
+    /* a single consumer steals from every shard */
+    FspPosixProcessorNumber = 0;
+    for (unsigned I = 0; Capacity + 1 > I; I++)
+    {
+        PIRP Irp = FspIoqNextPendingIrp(Ioq, 0, 0, 0);
+        CHECK(0 != Irp && Irp != &Irps[Capacity]);
+        irp_transition(Irp, IrpStatePending, IrpStateCompleted);
+    }
+    CHECK(0 == FspIoqNextPendingIrp(Ioq, 0, 0, 0));
+    CHECK(0 == FspIoqPendingIrpCount(Ioq));
+
+    FspIoqDelete(Ioq);
+    CHECK(0 == CanceledCount);
+    printf("capacity: ok\n");
+}
+
+static void test_boundary(void)
+{
+    enum { Count = 64 };
+    FSP_IOQ *Ioq = ioq_create(4, 1000, 10000000LL * 60);
+    unsigned Seen = 0;
+
+    irps_init(Count);
+    for (unsigned I = 0; Count > I; I++)
+    {
+        FspPosixProcessorNumber = I;
+        post(Ioq, &Irps[I], FALSE, STATUS_PENDING);
+    }
+
+    /* repost the first IRP and use it as the boundary; it must never be returned */
+    FspPosixProcessorNumber = 0;
+    PIRP Boundary = FspIoqNextPendingIrp(Ioq, 0, 0, 0);
+    CHECK(0 != Boundary);
+    irp_transition(Boundary, IrpStatePending, IrpStateIdle);
+    post(Ioq, Boundary, FALSE, STATUS_PENDING);
+    for (PIRP Irp; 0 != (Irp = FspIoqNextPendingIrp(Ioq, Boundary, 0, 0)); Seen++)
+    {
+        CHECK(Boundary != Irp);
+        irp_transition(Irp, IrpStatePending, IrpStateCompleted);
+    }
+    CHECK(0 < Seen && Count > Seen);
+    CHECK(Count - Seen == FspIoqPendingIrpCount(Ioq));
+
+    FspIoqDelete(Ioq);
+    CHECK(Count - Seen == CanceledCount);
+    printf("boundary: ok (%u of %u IRP's before the boundary)\n", Seen, Count - 1);
+}
+
+static void test_expired(void)
+{
+    enum { Count = 32 };
+    FSP_IOQ *Ioq = ioq_create(4, 1000, 10000000LL);
+
+    irps_init(Count);
+    for (unsigned I = 0; Count > I; I++)
+    {
+        FspPosixProcessorNumber = I;
+        post(Ioq, &Irps[I], 0 == I % 2, STATUS_PENDING);
+    }
+
+    /* nothing expires now; everything but the best effort IRP's expires in an hour */
+    FspIoqRemoveExpired(Ioq, KeQueryInterruptTime());
+    CHECK(0 == CanceledCount);
+    FspIoqRemoveExpired(Ioq, KeQueryInterruptTime() + 10000000ULL * 3600);
+    CHECK(Count / 2 == CanceledCount);
+    CHECK(Count / 2 == FspIoqPendingIrpCount(Ioq));
+    for (unsigned I = 0; Count > I; I++)
+        CHECK((0 == I % 2 ? IrpStatePending : IrpStateCompleted) == IrpStates[I]);
+
+    FspIoqDelete(Ioq);
+    CHECK(Count == CanceledCount);
+    printf("expired: ok\n");
+}
+
+static void test_stop(void)
+{
+    enum { Count = 48 };
+    FSP_IOQ *Ioq = ioq_create(4, 1000, 10000000LL * 60);
+    LARGE_INTEGER Timeout;
+
+    irps_init(Count + 1);
+    for (unsigned I = 0; Count > I; I++)
+    {
+        FspPosixProcessorNumber = I;
+        post(Ioq, &Irps[I], FALSE, STATUS_PENDING);
+    }
+
+    /* a third stays Pending, a third is Processing and a third is Retried */
+    for (unsigned I = 0; Count / 3 * 2 > I; I++)
+    {
+        PIRP Irp = FspIoqNextPendingIrp(Ioq, 0, 0, 0);
+        CHECK(0 != Irp);
+        irp_transition(Irp, IrpStatePending, IrpStateProcessing);
+        if (Count / 3 > I)
+            CHECK(FspIoqStartProcessingIrp(Ioq, Irp));
+        else
+            CHECK(FspIoqRetryCompleteIrp(Ioq, Irp, 0));
+    }
+    CHECK(Count / 3 == FspIoqPendingIrpCount(Ioq));
+    CHECK(Count / 3 == FspIoqProcessIrpCount(Ioq));
+    CHECK(Count / 3 == FspIoqRetriedIrpCount(Ioq));
+
+    FspIoqStop(Ioq);
+    CHECK(FspIoqStopped(Ioq));
+    CHECK(Count == CanceledCount);
+    CHECK(0 == FspIoqPendingIrpCount(Ioq));
+    CHECK(0 == FspIoqProcessIrpCount(Ioq));
+    CHECK(0 == FspIoqRetriedIrpCount(Ioq));
+    post(Ioq, &Irps[Count], FALSE, STATUS_CANCELLED);
+
+    /* waiters are woken up permanently */
+    for (unsigned I = 0; 3 > I; I++)
+    {
+        Timeout.QuadPart = -10000000LL * 60;
+        CHECK(0 == FspIoqNextPendingIrp(Ioq, 0, &Timeout, 0));
+    }
+
+    FspIoqDelete(Ioq);
+    printf("stop: ok\n");
+}
+
+typedef struct
+{
+    FSP_IOQ *Ioq;
+    ULONG Index;
+    unsigned First, Count;
+    unsigned long Retries;
+} THREAD_ARGS;
+
+static void *producer(void *Data)
+{
+    THREAD_ARGS *Args = Data;
+    FspPosixProcessorNumber = Args->Index;
+    for (unsigned I = Args->First; Args->First + Args->Count > I; I++)
+    {
+        NTSTATUS Result;
+        irp_transition(&Irps[I], IrpStateIdle, IrpStatePending);
+        while (!FspIoqPostIrp(Args->Ioq, &Irps[I], &Result))
+        {
+            /* over capacity; back off and retry */
+            CHECK(STATUS_INSUFFICIENT_RESOURCES == Result);
+            Args->Retries++;
+            sched_yield();
+        }
+    }
+    InterlockedIncrement(&ProducersDone);
+    return 0;
+}
+
+static void *consumer(void *Data)
+{
+    THREAD_ARGS *Args = Data;
+    FSP_IOQ *Ioq = Args->Ioq;
+    LARGE_INTEGER Timeout;
+    PIRP Batch[16], Irp;
+    unsigned Count = 0;
+
+    FspPosixProcessorNumber = Args->Index;
+    for (;;)
+    {
+        Timeout.QuadPart = -10000LL * 10;
+        Irp = FspIoqNextPendingIrp(Ioq, 0, &Timeout, 0);
+        if (FspIoqTimeout == Irp || 0 == Irp)
+        {
+            if (OptThreads == ProducersDone && 0 == FspIoqPendingIrpCount(Ioq))
+                break;
+            continue;
+        }
+        irp_transition(Irp, IrpStatePending, IrpStateProcessing);
+        if (0 == (Irp - Irps) % 7)
+        {
+            /* model a failed completion that is retried later */
+            CHECK(FspIoqRetryCompleteIrp(Ioq, Irp, 0));
+            Irp = FspIoqNextCompleteIrp(Ioq, 0);
+            if (0 != Irp)
+                irp_transition(Irp, IrpStateProcessing, IrpStateCompleted);
+            continue;
+        }
+        CHECK(FspIoqStartProcessingIrp(Ioq, Irp));
+        Batch[Count++] = Irp;
+        if (sizeof Batch / sizeof Batch[0] == Count)
+        {
+            /* complete out of order and check that a bogus hint finds nothing */
+            CHECK(0 == FspIoqEndProcessingIrp(Ioq, (UINT_PTR)&Irps[-1]));
+            for (unsigned I = Count; 0 < I; I--)
+            {
+                CHECK(Batch[I - 1] == FspIoqEndProcessingIrp(Ioq, (UINT_PTR)Batch[I - 1]));
+                irp_transition(Batch[I - 1], IrpStateProcessing, IrpStateCompleted);
+            }
+            Count = 0;
+        }
+    }
+    for (unsigned I = 0; Count > I; I++)
+    {
+        CHECK(Batch[I] == FspIoqEndProcessingIrp(Ioq, (UINT_PTR)Batch[I]));
+        irp_transition(Batch[I], IrpStateProcessing, IrpStateCompleted);
+    }
+    while (0 != (Irp = FspIoqNextCompleteIrp(Ioq, 0)))
+        irp_transition(Irp, IrpStateProcessing, IrpStateCompleted);
+    return 0;
+}
+
+static double run(ULONG ShardCount, ULONG IrpCapacity, unsigned Count, unsigned long *PRetries)
+{
+    pthread_t Producers[64], Consumers[64];
+    THREAD_ARGS ProducerArgs[64], ConsumerArgs[64];
+    FSP_IOQ *Ioq = ioq_create(ShardCount, IrpCapacity, 10000000LL * 60);
+    double T;
+
+    irps_init(Count * OptThreads);
+    T = now();
+    for (unsigned I = 0; OptThreads > I; I++)
+    {
+        ProducerArgs[I] = (THREAD_ARGS){ Ioq, I, I * Count, Count, 0 };
+        ConsumerArgs[I] = (THREAD_ARGS){ Ioq, I, 0, 0, 0 };
+        pthread_create(&Producers[I], 0, producer, &ProducerArgs[I]);
+        pthread_create(&Consumers[I], 0, consumer, &ConsumerArgs[I]);
+    }
+    *PRetries = 0;
+    for (unsigned I = 0; OptThreads > I; I++)
+    {
+        pthread_join(Producers[I], 0);
+        pthread_join(Consumers[I], 0);
+        *PRetries += ProducerArgs[I].Retries;
+    }
+    T = now() - T;
+
+    for (unsigned I = 0; Count * OptThreads > I; I++)
+        if (IrpStateCompleted != IrpStates[I])
+            FAIL("irp %u: state %d after stress run", I, (int)IrpStates[I]);
+    CHECK(0 == FspIoqPendingIrpCount(Ioq));
+    CHECK(0 == FspIoqProcessIrpCount(Ioq));
+    CHECK(0 == FspIoqRetriedIrpCount(Ioq));
+    FspIoqDelete(Ioq);
+    CHECK(0 == CanceledCount);
+
+    return T;
+}
+
+static int test(unsigned Count)
+{
+    unsigned long Retries;
+
+    test_capacity();
+    test_boundary();
+    test_expired();
+    test_stop();
+
+    /* a small capacity also exercises the STATUS_INSUFFICIENT_RESOURCES path */
+    run(OptThreads, 64, Count, &Retries);
+    printf("stress: ok (%u threads, %u IRP's, %lu retries over capacity)\n",
+        OptThreads, Count * OptThreads, Retries);
+
+    return 0;
+}
+
+static void bench(ULONG ShardCount, unsigned Count)
+{
+    unsigned long Retries;
+    double Time = 0, T;
+
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        T = run(ShardCount, (ULONG)-1, Count, &Retries);
+        if (0 == R || Time > T)
+            Time = T;
+    }
+
+    printf("%8u %8u %10u %12.3f %12.0f\n",
+        ShardCount, OptThreads, Count * OptThreads, Time * 1e3, Count * OptThreads / Time);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: ioq-bench [-t] [-r REPEAT] [-p THREADS] [COUNT]\n"
+        "\n"
+        "    -t          run the queue checks and a stress run\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -p THREADS  producer/consumer pairs (at most 64) [4]\n"
+        "    COUNT       IRP's posted per producer [100000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned Count = 100000;
+    BOOLEAN OptTest = FALSE;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-t", argv[I]))
+            OptTest = TRUE;
+        else if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-p", argv[I]) && argc > I + 1)
+            OptThreads = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0])
+            usage();
+        else
+            Count = strtoul(argv[I], 0, 0);
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+    if (0 == OptThreads || 64 < OptThreads)
+        usage();
+
+    if (OptTest)
+        return test(Count);
+
+    printf("%8s %8s %10s %12s %12s\n",
+        "SHARDS", "THREADS", "IRPS", "TIME(ms)", "IRPS/SEC");
+    bench(1, Count);
+    bench(OptThreads, Count);
+
+    return 0;
+}
@@ -0,0 +1,323 @@
+/**
+ * @file ioq-bench/posix/sys/driver.h
+ *
+ * Just enough of the FSD environment to compile sys/ioq.c on a POSIX system.
+ *
+ * Spin locks are modelled with pthread mutexes, so that the harness behaves when there
+ * are more threads than processors. KeGetCurrentProcessorNumber returns a per-thread
+ * number that the harness assigns, which lets it choose how threads map to IOQ shards.
+ * IRP cancelation is not modelled; IoCsqInsertIrpEx does not set a cancel routine.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_SYS_DRIVER_H_INCLUDED
+#define WINFSP_SYS_DRIVER_H_INCLUDED
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef void VOID;
+typedef void *PVOID;
+typedef uint8_t UCHAR, UINT8, BOOLEAN;
+typedef uint32_t ULONG, UINT32;
+typedef int32_t LONG, NTSTATUS;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef uintptr_t UINT_PTR, ULONG_PTR;
+typedef UCHAR KIRQL, *PKIRQL;
+typedef union
+{
+    INT64 QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+#define TRUE                            1
+#define FALSE                           0
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_THREAD_IS_TERMINATING    ((NTSTATUS)0xC000004BL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+#define ASSERT(e)                       assert(e)
+#define PAGE_SIZE                       4096
+#define ROUND_TO_PAGES(Size)            (((ULONG_PTR)(Size) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define RtlZeroMemory(P, S)             memset(P, 0, S)
+#define CONTAINING_RECORD(a, T, f)      ((T *)((PUINT8)(a) - offsetof(T, f)))
+typedef UINT8 *PUINT8;
+#define __declspec(x)                   __declspec_##x
+#define __declspec_align(n)             __attribute__((aligned(n)))
+
+/* SAL */
+#define _IRQL_raises_(x)
+#define _IRQL_requires_(x)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _At_(x, y)
+
+/* interlocked */
+#define InterlockedIncrement(P)         __atomic_add_fetch(P, 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(P)         __atomic_sub_fetch(P, 1, __ATOMIC_SEQ_CST)
+static inline LONG InterlockedCompareExchange(LONG volatile *P, LONG Exchange, LONG Comparand)
+{
+    __atomic_compare_exchange_n(P, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+#define KeMemoryBarrier()               __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* processors */
+static ULONG FspProcessorCount = 1;
+static __thread ULONG FspPosixProcessorNumber;
+#define KeGetCurrentProcessorNumber()   (FspPosixProcessorNumber)
+
+/* time */
+static inline UINT64 KeQueryInterruptTime(VOID)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 10000000ULL + (UINT64)ts.tv_nsec / 100;
+}
+
+/* memory */
+#define FspAllocNonPaged(Size)          aligned_alloc(PAGE_SIZE, ROUND_TO_PAGES(Size))
+#define FspFree(Pointer)                free(Pointer)
+
+/* lists */
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY *Flink, *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+static inline VOID InitializeListHead(PLIST_ENTRY Head)
+{
+    Head->Flink = Head->Blink = Head;
+}
+static inline VOID InsertTailList(PLIST_ENTRY Head, PLIST_ENTRY Entry)
+{
+    Entry->Flink = Head;
+    Entry->Blink = Head->Blink;
+    Head->Blink->Flink = Entry;
+    Head->Blink = Entry;
+}
+static inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY Flink = Entry->Flink, Blink = Entry->Blink;
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return Flink == Blink;
+}
+
+/* spin locks */
+typedef pthread_mutex_t KSPIN_LOCK;
+#define KeInitializeSpinLock(L)         pthread_mutex_init(L, 0)
+#define KeAcquireSpinLock(L, PIrql)     (*(PIrql) = 0, pthread_mutex_lock(L))
+#define KeReleaseSpinLock(L, Irql)      ((VOID)(Irql), pthread_mutex_unlock(L))
+
+/* IRP's and cancel-safe queues */
+typedef struct _IRP
+{
+    BOOLEAN Cancel;
+    struct
+    {
+        struct
+        {
+            PVOID DriverContext[4];
+            LIST_ENTRY ListEntry;
+        } Overlay;
+    } Tail;
+} IRP, *PIRP;
+typedef struct _IO_CSQ IO_CSQ, *PIO_CSQ;
+typedef PVOID PIO_CSQ_IRP_CONTEXT;
+typedef VOID (*PIO_CSQ_INSERT_IRP)(PIO_CSQ, PIRP);
+typedef NTSTATUS (*PIO_CSQ_INSERT_IRP_EX)(PIO_CSQ, PIRP, PVOID);
+typedef VOID (*PIO_CSQ_REMOVE_IRP)(PIO_CSQ, PIRP);
+typedef PIRP (*PIO_CSQ_PEEK_NEXT_IRP)(PIO_CSQ, PIRP, PVOID);
+typedef VOID (*PIO_CSQ_ACQUIRE_LOCK)(PIO_CSQ, PKIRQL);
+typedef VOID (*PIO_CSQ_RELEASE_LOCK)(PIO_CSQ, KIRQL);
+typedef VOID (*PIO_CSQ_COMPLETE_CANCELED_IRP)(PIO_CSQ, PIRP);
+struct _IO_CSQ
+{
+    PIO_CSQ_INSERT_IRP CsqInsertIrp;
+    PIO_CSQ_REMOVE_IRP CsqRemoveIrp;
+    PIO_CSQ_PEEK_NEXT_IRP CsqPeekNextIrp;
+    PIO_CSQ_ACQUIRE_LOCK CsqAcquireLock;
+    PIO_CSQ_RELEASE_LOCK CsqReleaseLock;
+    PIO_CSQ_COMPLETE_CANCELED_IRP CsqCompleteCanceledIrp;
+};
+static inline NTSTATUS IoCsqInitializeEx(PIO_CSQ Csq,
+    PIO_CSQ_INSERT_IRP_EX CsqInsertIrp,
+    PIO_CSQ_REMOVE_IRP CsqRemoveIrp,
+    PIO_CSQ_PEEK_NEXT_IRP CsqPeekNextIrp,
+    PIO_CSQ_ACQUIRE_LOCK CsqAcquireLock,
+    PIO_CSQ_RELEASE_LOCK CsqReleaseLock,
+    PIO_CSQ_COMPLETE_CANCELED_IRP CsqCompleteCanceledIrp)
+{
+    Csq->CsqInsertIrp = (PIO_CSQ_INSERT_IRP)CsqInsertIrp;
+    Csq->CsqRemoveIrp = CsqRemoveIrp;
+    Csq->CsqPeekNextIrp = CsqPeekNextIrp;
+    Csq->CsqAcquireLock = CsqAcquireLock;
+    Csq->CsqReleaseLock = CsqReleaseLock;
+    Csq->CsqCompleteCanceledIrp = CsqCompleteCanceledIrp;
+    return STATUS_SUCCESS;
+}
+static inline NTSTATUS IoCsqInsertIrpEx(PIO_CSQ Csq, PIRP Irp, PIO_CSQ_IRP_CONTEXT Context,
+    PVOID InsertContext)
+{
+    NTSTATUS Result;
+    KIRQL Irql;
+    Csq->CsqAcquireLock(Csq, &Irql);
+    Result = ((PIO_CSQ_INSERT_IRP_EX)Csq->CsqInsertIrp)(Csq, Irp, InsertContext);
+    Csq->CsqReleaseLock(Csq, Irql);
+    return Result;
+}
+static inline PIRP IoCsqRemoveNextIrp(PIO_CSQ Csq, PVOID PeekContext)
+{
+    KIRQL Irql;
+    PIRP Irp;
+    Csq->CsqAcquireLock(Csq, &Irql);
+    Irp = Csq->CsqPeekNextIrp(Csq, 0, PeekContext);
+    if (0 != Irp)
+        Csq->CsqRemoveIrp(Csq, Irp);
+    Csq->CsqReleaseLock(Csq, Irql);
+    return Irp;
+}
+
+/* hash; must match sys/driver.h */
+static inline UINT64 FspHashMix64(UINT64 k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+static inline ULONG FspHashMixPointer(PVOID Pointer)
+{
+    return (ULONG)FspHashMix64((UINT64)(UINT_PTR)Pointer);
+}
+
+/* IRP context; must match sys/driver.h */
+#define FspIrpTimestampInfinity         ((ULONG)-1L)
+#define FspIrpTimestamp(Irp)            \
+    (*(ULONG *)&(Irp)->Tail.Overlay.DriverContext[0])
+#define FspIrpDictNext(Irp)             \
+    (*(PIRP *)&(Irp)->Tail.Overlay.DriverContext[1])
+
+/* queued events: an auto-reset event */
+typedef struct
+{
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+    BOOLEAN Signaled;
+} FSP_QEVENT;
+static inline VOID FspQeventInitialize(FSP_QEVENT *Qevent, ULONG ThreadCount)
+{
+    pthread_mutex_init(&Qevent->Mutex, 0);
+    pthread_cond_init(&Qevent->Cond, 0);
+    Qevent->Signaled = FALSE;
+}
+static inline VOID FspQeventFinalize(FSP_QEVENT *Qevent)
+{
+    pthread_cond_destroy(&Qevent->Cond);
+    pthread_mutex_destroy(&Qevent->Mutex);
+}
+static inline VOID FspQeventSet(FSP_QEVENT *Qevent)
+{
+    pthread_mutex_lock(&Qevent->Mutex);
+    if (!Qevent->Signaled)
+    {
+        Qevent->Signaled = TRUE;
+        pthread_cond_signal(&Qevent->Cond);
+    }
+    pthread_mutex_unlock(&Qevent->Mutex);
+}
+static inline NTSTATUS FspQeventCancellableWait(FSP_QEVENT *Qevent,
+    PLARGE_INTEGER PTimeout, PIRP Irp)
+{
+    /* relative timeouts only (negative, in 100ns units) */
+    struct timespec ts;
+    NTSTATUS Result = STATUS_SUCCESS;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    UINT64 Nsec = (UINT64)ts.tv_nsec + (UINT64)-PTimeout->QuadPart * 100;
+    ts.tv_sec += Nsec / 1000000000;
+    ts.tv_nsec = Nsec % 1000000000;
+    pthread_mutex_lock(&Qevent->Mutex);
+    while (!Qevent->Signaled)
+        if (0 != pthread_cond_timedwait(&Qevent->Cond, &Qevent->Mutex, &ts))
+        {
+            Result = STATUS_TIMEOUT;
+            break;
+        }
+    if (STATUS_SUCCESS == Result)
+        Qevent->Signaled = FALSE;
+    pthread_mutex_unlock(&Qevent->Mutex);
+    return Result;
+}
+
+/* I/O queue; must match sys/driver.h */
+#define FSP_IOQ_USE_QEVENT
+#define FSP_IOQ_PROCESS_NO_CANCEL
+#define FspIoqTimeout                   ((PIRP)1)
+#define FspIoqCancelled                 ((PIRP)2)
+#define FspIoqPostIrp(Q, I, R)          FspIoqPostIrpEx(Q, I, FALSE, R)
+#define FspIoqPostIrpBestEffort(Q, I, R)FspIoqPostIrpEx(Q, I, TRUE, R)
+#define FSP_IOQ_SHARD_COUNT_MAX         16
+typedef struct __declspec(align(64))   /* one cache line (or more) per queue */
+{
+    KSPIN_LOCK SpinLock;
+    LIST_ENTRY IrpList;
+    IO_CSQ IoCsq;
+    PVOID Ioq;
+    ULONG IrpCount;
+} FSP_IOQ_QUEUE;
+typedef struct
+{
+    BOOLEAN Stopped;
+    FSP_QEVENT PendingIrpEvent;
+    ULONG IrpTimeout;
+    ULONG PendingIrpCapacity;
+    VOID (*CompleteCanceledIrp)(PIRP Irp);
+    ULONG ShardCount;
+    ULONG ProcessIrpBucketCount, ProcessIrpShardBucketCount;
+    __declspec(align(64)) LONG PendingIrpCount;
+    FSP_IOQ_QUEUE PendingQueues[FSP_IOQ_SHARD_COUNT_MAX];
+    FSP_IOQ_QUEUE ProcessQueues[FSP_IOQ_SHARD_COUNT_MAX];
+    FSP_IOQ_QUEUE RetriedQueue;
+    PVOID ProcessIrpBuckets[];
+} FSP_IOQ;
+NTSTATUS FspIoqCreate(
+    ULONG IrpCapacity, PLARGE_INTEGER IrpTimeout, VOID (*CompleteCanceledIrp)(PIRP Irp),
+    FSP_IOQ **PIoq);
+VOID FspIoqDelete(FSP_IOQ *Ioq);
+VOID FspIoqStop(FSP_IOQ *Ioq);
+BOOLEAN FspIoqStopped(FSP_IOQ *Ioq);
+VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime);
+BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PResult);
+PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout,
+    PIRP CancellableIrp);
+ULONG FspIoqPendingIrpCount(FSP_IOQ *Ioq);
+BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp);
+PIRP FspIoqEndProcessingIrp(FSP_IOQ *Ioq, UINT_PTR IrpHint);
+ULONG FspIoqProcessIrpCount(FSP_IOQ *Ioq);
+BOOLEAN FspIoqRetryCompleteIrp(FSP_IOQ *Ioq, PIRP Irp, NTSTATUS *PResult);
+PIRP FspIoqNextCompleteIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp);
+ULONG FspIoqRetriedIrpCount(FSP_IOQ *Ioq);
+
+#endif
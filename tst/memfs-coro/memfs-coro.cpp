@@ -0,0 +1,1032 @@
+/**
+ * @file memfs-coro.cpp
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+/*
+ * An in-memory file system whose Read, Write and ReadDirectory operations are coroutines.
+ *
+ * Every read, write and directory listing first awaits a simulated backend round trip
+ * (-l Latency). While an operation is suspended its dispatcher thread goes back to the FSD
+ * and picks up the next request, so the number of operations in flight is bounded by the
+ * FSD rather than by the number of dispatcher threads. Compare for example:
+ *
+ *     fsbench --rdwr-mmap-tests ... against memfs-coro -l 10
+ */
+
+#include <winfsp/coro.hpp>
+#include <sddl.h>
+#include <strsafe.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define PROGNAME                        "memfs-coro"
+
+#define ALLOCATION_UNIT                 4096
+#define TOTAL_SIZE                      (1024ULL * 1024 * 1024)
+
+#define info(format, ...)               Service::Log(EVENTLOG_INFORMATION_TYPE, format, __VA_ARGS__)
+#define warn(format, ...)               Service::Log(EVENTLOG_WARNING_TYPE, format, __VA_ARGS__)
+#define fail(format, ...)               Service::Log(EVENTLOG_ERROR_TYPE, format, __VA_ARGS__)
+
+using namespace Fsp;
+
+struct MemfsCoroFileNode
+{
+    MemfsCoroFileNode(const std::wstring &FileName) :
+        FileName(FileName), FileInfo(), RefCount(1)
+    {
+        InitializeSRWLock(&Lock);
+    }
+    VOID Reference()
+    {
+        InterlockedIncrement(&RefCount);
+    }
+    VOID Dereference()
+    {
+        if (0 == InterlockedDecrement(&RefCount))
+            delete this;
+    }
+    BOOLEAN IsDirectory()
+    {
+        return 0 != (FileInfo.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+    std::wstring FileName;
+    FileSystemBase::FileInfo FileInfo;
+    std::vector<UINT8> FileSecurity;
+    std::vector<UINT8> FileData;
+    SRWLOCK Lock;                       /* protects FileInfo, FileSecurity and FileData */
+    LONG RefCount;
+};
+
+struct MemfsCoroFileNameLess
+{
+    bool operator()(const std::wstring &A, const std::wstring &B) const
+    {
+        return 0 > _wcsicmp(A.c_str(), B.c_str());
+    }
+};
+
+class MemfsCoro : public CoroutineFileSystemBase
+{
+public:
+    MemfsCoro();
+    ~MemfsCoro();
+    NTSTATUS SetParams(ULONG Latency, ULONG ExecutorThreadCount);
+
+protected:
+    NTSTATUS Init(PVOID Host);
+    NTSTATUS GetVolumeInfo(
+        VolumeInfo *VolumeInfo);
+    NTSTATUS GetSecurityByName(
+        PWSTR FileName,
+        PUINT32 PFileAttributes/* or ReparsePointIndex */,
+        PSECURITY_DESCRIPTOR SecurityDescriptor,
+        SIZE_T *PSecurityDescriptorSize);
+    NTSTATUS Create(
+        PWSTR FileName,
+        UINT32 CreateOptions,
+        UINT32 GrantedAccess,
+        UINT32 FileAttributes,
+        PSECURITY_DESCRIPTOR SecurityDescriptor,
+        UINT64 AllocationSize,
+        PVOID *PFileNode,
+        PVOID *PFileDesc,
+        OpenFileInfo *OpenFileInfo);
+    NTSTATUS Open(
+        PWSTR FileName,
+        UINT32 CreateOptions,
+        UINT32 GrantedAccess,
+        PVOID *PFileNode,
+        PVOID *PFileDesc,
+        OpenFileInfo *OpenFileInfo);
+    NTSTATUS Overwrite(
+        PVOID FileNode,
+        PVOID FileDesc,
+        UINT32 FileAttributes,
+        BOOLEAN ReplaceFileAttributes,
+        UINT64 AllocationSize,
+        FileInfo *FileInfo);
+    VOID Cleanup(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PWSTR FileName,
+        ULONG Flags);
+    VOID Close(
+        PVOID FileNode,
+        PVOID FileDesc);
+    Task<NTSTATUS> ReadAsync(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PVOID Buffer,
+        UINT64 Offset,
+        ULONG Length,
+        PULONG PBytesTransferred);
+    Task<NTSTATUS> WriteAsync(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PVOID Buffer,
+        UINT64 Offset,
+        ULONG Length,
+        BOOLEAN WriteToEndOfFile,
+        BOOLEAN ConstrainedIo,
+        PULONG PBytesTransferred,
+        FileInfo *FileInfo);
+    NTSTATUS Flush(
+        PVOID FileNode,
+        PVOID FileDesc,
+        FileInfo *FileInfo);
+    NTSTATUS GetFileInfo(
+        PVOID FileNode,
+        PVOID FileDesc,
+        FileInfo *FileInfo);
+    NTSTATUS SetBasicInfo(
+        PVOID FileNode,
+        PVOID FileDesc,
+        UINT32 FileAttributes,
+        UINT64 CreationTime,
+        UINT64 LastAccessTime,
+        UINT64 LastWriteTime,
+        UINT64 ChangeTime,
+        FileInfo *FileInfo);
+    NTSTATUS SetFileSize(
+        PVOID FileNode,
+        PVOID FileDesc,
+        UINT64 NewSize,
+        BOOLEAN SetAllocationSize,
+        FileInfo *FileInfo);
+    NTSTATUS CanDelete(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PWSTR FileName);
+    NTSTATUS Rename(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PWSTR FileName,
+        PWSTR NewFileName,
+        BOOLEAN ReplaceIfExists);
+    NTSTATUS GetSecurity(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PSECURITY_DESCRIPTOR SecurityDescriptor,
+        SIZE_T *PSecurityDescriptorSize);
+    NTSTATUS SetSecurity(
+        PVOID FileNode,
+        PVOID FileDesc,
+        SECURITY_INFORMATION SecurityInformation,
+        PSECURITY_DESCRIPTOR ModificationDescriptor);
+    Task<NTSTATUS> ReadDirectoryAsync(
+        PVOID FileNode,
+        PVOID FileDesc,
+        PWSTR Pattern,
+        PWSTR Marker,
+        PVOID Buffer,
+        ULONG Length,
+        PULONG PBytesTransferred);
+
+private:
+    typedef std::map<std::wstring, MemfsCoroFileNode *, MemfsCoroFileNameLess> FileNodeMap;
+    static UINT64 GetSystemTime();
+    static std::wstring GetParentName(const std::wstring &FileName);
+    static std::wstring GetChildPrefix(const std::wstring &FileName);
+    static BOOLEAN HasPrefix(const std::wstring &FileName, const std::wstring &Prefix);
+    static BOOLEAN IsChild(const std::wstring &FileName, const std::wstring &Prefix);
+    static BOOLEAN AddDirInfo(MemfsCoroFileNode *FileNode, PCWSTR FileName,
+        PVOID Buffer, ULONG Length, PULONG PBytesTransferred);
+    MemfsCoroFileNode *Lookup(const std::wstring &FileName);
+    FileNodeMap::iterator FirstChild(const std::wstring &FileName);
+    Fsp::Executor *_Executor;
+    ULONG _Latency;
+    SRWLOCK _Lock;                      /* protects _FileNodes */
+    FileNodeMap _FileNodes;
+};
+
+MemfsCoro::MemfsCoro() : CoroutineFileSystemBase(), _Executor(), _Latency(0)
+{
+    InitializeSRWLock(&_Lock);
+}
+
+MemfsCoro::~MemfsCoro()
+{
+    for (FileNodeMap::iterator I = _FileNodes.begin(); _FileNodes.end() != I; ++I)
+        I->second->Dereference();
+    delete _Executor;
+}
+
+NTSTATUS MemfsCoro::SetParams(ULONG Latency, ULONG ExecutorThreadCount)
+{
+    PSECURITY_DESCRIPTOR RootSecurity;
+    ULONG RootSecuritySize;
+    MemfsCoroFileNode *RootNode;
+
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+        L"O:BAG:BAD:P(A;;FA;;;SY)(A;;FA;;;BA)(A;;FA;;;WD)", SDDL_REVISION_1,
+        &RootSecurity, &RootSecuritySize))
+        return NtStatusFromWin32(GetLastError());
+
+    RootNode = new MemfsCoroFileNode(L"\\");
+    RootNode->FileInfo.FileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+    RootNode->FileInfo.CreationTime =
+    RootNode->FileInfo.LastAccessTime =
+    RootNode->FileInfo.LastWriteTime =
+    RootNode->FileInfo.ChangeTime = GetSystemTime();
+    RootNode->FileSecurity.assign((PUINT8)RootSecurity, (PUINT8)RootSecurity + RootSecuritySize);
+    LocalFree(RootSecurity);
+    _FileNodes[RootNode->FileName] = RootNode;
+
+    _Executor = new Fsp::Executor(0, ExecutorThreadCount);
+    _Latency = Latency;
+
+    return STATUS_SUCCESS;
+}
+
+UINT64 MemfsCoro::GetSystemTime()
+{
+    FILETIME FileTime;
+    GetSystemTimeAsFileTime(&FileTime);
+    return ((PLARGE_INTEGER)&FileTime)->QuadPart;
+}
+
+std::wstring MemfsCoro::GetParentName(const std::wstring &FileName)
+{
+    std::wstring::size_type Index = FileName.rfind(L'\\');
+    return 0 == Index || std::wstring::npos == Index ? L"\\" : FileName.substr(0, Index);
+}
+
+std::wstring MemfsCoro::GetChildPrefix(const std::wstring &FileName)
+{
+    return L"\\" == FileName ? FileName : FileName + L"\\";
+}
+
+BOOLEAN MemfsCoro::HasPrefix(const std::wstring &FileName, const std::wstring &Prefix)
+{
+    return FileName.size() >= Prefix.size() &&
+        0 == _wcsnicmp(FileName.c_str(), Prefix.c_str(), Prefix.size());
+}
+
+BOOLEAN MemfsCoro::IsChild(const std::wstring &FileName, const std::wstring &Prefix)
+{
+    /* FileName has Prefix; the root has the root prefix but is not its own child */
+    return FileName.size() > Prefix.size() &&
+        std::wstring::npos == FileName.find(L'\\', Prefix.size());
+}
+
+BOOLEAN MemfsCoro::AddDirInfo(MemfsCoroFileNode *FileNode, PCWSTR FileName,
+    PVOID Buffer, ULONG Length, PULONG PBytesTransferred)
+{
+    union
+    {
+        UINT8 B[FIELD_OFFSET(FileSystemBase::DirInfo, FileNameBuf) + MAX_PATH * sizeof(WCHAR)];
+        FileSystemBase::DirInfo D;
+    } DirInfoBuf;
+    FileSystemBase::DirInfo *DirInfo = &DirInfoBuf.D;
+    size_t FileNameLength = wcslen(FileName);
+
+    if (MAX_PATH < FileNameLength)
+        return TRUE;
+
+    memset(DirInfo->Padding, 0, sizeof DirInfo->Padding);
+    DirInfo->Size = (UINT16)(FIELD_OFFSET(FileSystemBase::DirInfo, FileNameBuf) +
+        FileNameLength * sizeof(WCHAR));
+    AcquireSRWLockShared(&FileNode->Lock);
+    DirInfo->FileInfo = FileNode->FileInfo;
+    ReleaseSRWLockShared(&FileNode->Lock);
+    memcpy(DirInfo->FileNameBuf, FileName, FileNameLength * sizeof(WCHAR));
+
+    return FspFileSystemAddDirInfo(DirInfo, Buffer, Length, PBytesTransferred);
+}
+
+MemfsCoroFileNode *MemfsCoro::Lookup(const std::wstring &FileName)
+{
+    FileNodeMap::iterator I = _FileNodes.find(FileName);
+    return _FileNodes.end() != I ? I->second : 0;
+}
+
+MemfsCoro::FileNodeMap::iterator MemfsCoro::FirstChild(const std::wstring &FileName)
+{
+    std::wstring Prefix = GetChildPrefix(FileName);
+    FileNodeMap::iterator I = _FileNodes.lower_bound(Prefix);
+    for (; _FileNodes.end() != I && HasPrefix(I->first, Prefix); ++I)
+        if (IsChild(I->first, Prefix))
+            return I;
+    return _FileNodes.end();
+}
+
+NTSTATUS MemfsCoro::Init(PVOID Host0)
+{
+    FileSystemHost *Host = (FileSystemHost *)Host0;
+    Host->SetSectorSize(ALLOCATION_UNIT);
+    Host->SetSectorsPerAllocationUnit(1);
+    Host->SetFileInfoTimeout(1000);
+    Host->SetCaseSensitiveSearch(FALSE);
+    Host->SetCasePreservedNames(TRUE);
+    Host->SetUnicodeOnDisk(TRUE);
+    Host->SetPersistentAcls(TRUE);
+    Host->SetPostCleanupWhenModifiedOnly(TRUE);
+    Host->SetVolumeCreationTime(GetSystemTime());
+    Host->SetVolumeSerialNumber(0);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::GetVolumeInfo(
+    VolumeInfo *VolumeInfo)
+{
+    VolumeInfo->TotalSize = TOTAL_SIZE;
+    VolumeInfo->FreeSize = TOTAL_SIZE;
+    VolumeInfo->VolumeLabelLength = (UINT16)(sizeof L"MEMFS-CORO" - sizeof(WCHAR));
+    memcpy(VolumeInfo->VolumeLabel, L"MEMFS-CORO", VolumeInfo->VolumeLabelLength);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::GetSecurityByName(
+    PWSTR FileName,
+    PUINT32 PFileAttributes/* or ReparsePointIndex */,
+    PSECURITY_DESCRIPTOR SecurityDescriptor,
+    SIZE_T *PSecurityDescriptorSize)
+{
+    MemfsCoroFileNode *FileNode, *ParentNode;
+    NTSTATUS Result = STATUS_SUCCESS;
+
+    AcquireSRWLockShared(&_Lock);
+
+    FileNode = Lookup(FileName);
+    if (0 == FileNode)
+    {
+        ParentNode = Lookup(GetParentName(FileName));
+        Result = 0 != ParentNode && ParentNode->IsDirectory() ?
+            STATUS_OBJECT_NAME_NOT_FOUND : STATUS_OBJECT_PATH_NOT_FOUND;
+        goto exit;
+    }
+
+    AcquireSRWLockShared(&FileNode->Lock);
+    if (0 != PFileAttributes)
+        *PFileAttributes = FileNode->FileInfo.FileAttributes;
+    if (0 != PSecurityDescriptorSize)
+    {
+        if (FileNode->FileSecurity.size() > *PSecurityDescriptorSize)
+            Result = STATUS_BUFFER_OVERFLOW;
+        else if (0 != SecurityDescriptor)
+            memcpy(SecurityDescriptor, FileNode->FileSecurity.data(), FileNode->FileSecurity.size());
+        *PSecurityDescriptorSize = FileNode->FileSecurity.size();
+    }
+    ReleaseSRWLockShared(&FileNode->Lock);
+
+exit:
+    ReleaseSRWLockShared(&_Lock);
+
+    return Result;
+}
+
+NTSTATUS MemfsCoro::Create(
+    PWSTR FileName,
+    UINT32 CreateOptions,
+    UINT32 GrantedAccess,
+    UINT32 FileAttributes,
+    PSECURITY_DESCRIPTOR SecurityDescriptor,
+    UINT64 AllocationSize,
+    PVOID *PFileNode,
+    PVOID *PFileDesc,
+    OpenFileInfo *OpenFileInfo)
+{
+    MemfsCoroFileNode *FileNode, *ParentNode;
+    NTSTATUS Result = STATUS_SUCCESS;
+
+    AcquireSRWLockExclusive(&_Lock);
+
+    if (0 != Lookup(FileName))
+    {
+        Result = STATUS_OBJECT_NAME_COLLISION;
+        goto exit;
+    }
+
+    ParentNode = Lookup(GetParentName(FileName));
+    if (0 == ParentNode || !ParentNode->IsDirectory())
+    {
+        Result = STATUS_OBJECT_PATH_NOT_FOUND;
+        goto exit;
+    }
+
+    if (CreateOptions & FILE_DIRECTORY_FILE)
+        FileAttributes |= FILE_ATTRIBUTE_DIRECTORY;
+    else
+        FileAttributes &= ~FILE_ATTRIBUTE_DIRECTORY;
+    if (0 == FileAttributes)
+        FileAttributes = FILE_ATTRIBUTE_NORMAL;
+
+    FileNode = new MemfsCoroFileNode(FileName);
+    FileNode->FileInfo.FileAttributes = FileAttributes;
+    FileNode->FileInfo.CreationTime =
+    FileNode->FileInfo.LastAccessTime =
+    FileNode->FileInfo.LastWriteTime =
+    FileNode->FileInfo.ChangeTime = GetSystemTime();
+    if (0 != SecurityDescriptor)
+        FileNode->FileSecurity.assign((PUINT8)SecurityDescriptor,
+            (PUINT8)SecurityDescriptor + GetSecurityDescriptorLength(SecurityDescriptor));
+    _FileNodes[FileNode->FileName] = FileNode;
+
+    FileNode->Reference();
+    *PFileNode = FileNode;
+    *PFileDesc = 0;
+    OpenFileInfo->FileInfo = FileNode->FileInfo;
+
+exit:
+    ReleaseSRWLockExclusive(&_Lock);
+
+    return Result;
+}
+
+NTSTATUS MemfsCoro::Open(
+    PWSTR FileName,
+    UINT32 CreateOptions,
+    UINT32 GrantedAccess,
+    PVOID *PFileNode,
+    PVOID *PFileDesc,
+    OpenFileInfo *OpenFileInfo)
+{
+    MemfsCoroFileNode *FileNode;
+
+    AcquireSRWLockShared(&_Lock);
+    FileNode = Lookup(FileName);
+    if (0 != FileNode)
+        FileNode->Reference();
+    ReleaseSRWLockShared(&_Lock);
+
+    if (0 == FileNode)
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+
+    *PFileNode = FileNode;
+    *PFileDesc = 0;
+    return GetFileInfo(FileNode, 0, &OpenFileInfo->FileInfo);
+}
+
+NTSTATUS MemfsCoro::Overwrite(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    UINT32 FileAttributes,
+    BOOLEAN ReplaceFileAttributes,
+    UINT64 AllocationSize,
+    FileInfo *FileInfo)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+
+    AcquireSRWLockExclusive(&FileNode->Lock);
+    FileNode->FileData.clear();
+    if (ReplaceFileAttributes)
+        FileNode->FileInfo.FileAttributes = FileAttributes | FILE_ATTRIBUTE_ARCHIVE;
+    else
+        FileNode->FileInfo.FileAttributes |= FileAttributes | FILE_ATTRIBUTE_ARCHIVE;
+    FileNode->FileInfo.FileSize = 0;
+    FileNode->FileInfo.AllocationSize = 0;
+    FileNode->FileInfo.LastAccessTime =
+    FileNode->FileInfo.LastWriteTime =
+    FileNode->FileInfo.ChangeTime = GetSystemTime();
+    *FileInfo = FileNode->FileInfo;
+    ReleaseSRWLockExclusive(&FileNode->Lock);
+
+    return STATUS_SUCCESS;
+}
+
+VOID MemfsCoro::Cleanup(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PWSTR FileName,
+    ULONG Flags)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+    UINT64 SystemTime = GetSystemTime();
+
+    AcquireSRWLockExclusive(&FileNode->Lock);
+    if (Flags & CleanupSetArchiveBit)
+    {
+        if (!FileNode->IsDirectory())
+            FileNode->FileInfo.FileAttributes |= FILE_ATTRIBUTE_ARCHIVE;
+    }
+    if (Flags & CleanupSetLastAccessTime)
+        FileNode->FileInfo.LastAccessTime = SystemTime;
+    if (Flags & CleanupSetLastWriteTime)
+        FileNode->FileInfo.LastWriteTime = SystemTime;
+    if (Flags & CleanupSetChangeTime)
+        FileNode->FileInfo.ChangeTime = SystemTime;
+    ReleaseSRWLockExclusive(&FileNode->Lock);
+
+    if ((Flags & CleanupDelete) && 0 != FileName)
+    {
+        AcquireSRWLockExclusive(&_Lock);
+        if (_FileNodes.end() == FirstChild(FileNode->FileName) &&
+            FileNode == Lookup(FileNode->FileName))
+        {
+            _FileNodes.erase(FileNode->FileName);
+            FileNode->Dereference();
+        }
+        ReleaseSRWLockExclusive(&_Lock);
+    }
+}
+
+VOID MemfsCoro::Close(
+    PVOID FileNode0,
+    PVOID FileDesc)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+
+    FileNode->Dereference();
+}
+
+Task<NTSTATUS> MemfsCoro::ReadAsync(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PVOID Buffer,
+    UINT64 Offset,
+    ULONG Length,
+    PULONG PBytesTransferred)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+    NTSTATUS Result = STATUS_SUCCESS;
+    UINT64 EndOffset;
+
+    /* simulated backend round trip; the dispatcher thread is released here */
+    co_await _Executor->Delay(_Latency);
+
+    AcquireSRWLockShared(&FileNode->Lock);
+    if (Offset >= FileNode->FileInfo.FileSize)
+        Result = STATUS_END_OF_FILE;
+    else
+    {
+        EndOffset = Offset + Length;
+        if (EndOffset > FileNode->FileInfo.FileSize)
+            EndOffset = FileNode->FileInfo.FileSize;
+        memcpy(Buffer, FileNode->FileData.data() + Offset, (size_t)(EndOffset - Offset));
+        *PBytesTransferred = (ULONG)(EndOffset - Offset);
+    }
+    ReleaseSRWLockShared(&FileNode->Lock);
+
+    co_return Result;
+}
+
+Task<NTSTATUS> MemfsCoro::WriteAsync(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PVOID Buffer,
+    UINT64 Offset,
+    ULONG Length,
+    BOOLEAN WriteToEndOfFile,
+    BOOLEAN ConstrainedIo,
+    PULONG PBytesTransferred,
+    FileInfo *FileInfo)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+    UINT64 EndOffset;
+
+    co_await _Executor->Delay(_Latency);
+
+    AcquireSRWLockExclusive(&FileNode->Lock);
+    if (ConstrainedIo)
+    {
+        if (Offset >= FileNode->FileInfo.FileSize)
+        {
+            *FileInfo = FileNode->FileInfo;
+            ReleaseSRWLockExclusive(&FileNode->Lock);
+            co_return STATUS_SUCCESS;
+        }
+        EndOffset = Offset + Length;
+        if (EndOffset > FileNode->FileInfo.FileSize)
+            EndOffset = FileNode->FileInfo.FileSize;
+    }
+    else
+    {
+        if (WriteToEndOfFile)
+            Offset = FileNode->FileInfo.FileSize;
+        EndOffset = Offset + Length;
+        if (EndOffset > TOTAL_SIZE)
+        {
+            ReleaseSRWLockExclusive(&FileNode->Lock);
+            co_return STATUS_DISK_FULL;
+        }
+        if (EndOffset > FileNode->FileInfo.FileSize)
+        {
+            FileNode->FileData.resize((size_t)EndOffset);
+            FileNode->FileInfo.FileSize = EndOffset;
+            FileNode->FileInfo.AllocationSize = (EndOffset + ALLOCATION_UNIT - 1)
+                / ALLOCATION_UNIT * ALLOCATION_UNIT;
+        }
+    }
+    memcpy(FileNode->FileData.data() + Offset, Buffer, (size_t)(EndOffset - Offset));
+    *PBytesTransferred = (ULONG)(EndOffset - Offset);
+    *FileInfo = FileNode->FileInfo;
+    ReleaseSRWLockExclusive(&FileNode->Lock);
+
+    co_return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::Flush(
+    PVOID FileNode,
+    PVOID FileDesc,
+    FileInfo *FileInfo)
+{
+    /* nothing to flush, since we do not cache anything */
+    if (0 != FileNode)
+        return GetFileInfo(FileNode, FileDesc, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::GetFileInfo(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    FileInfo *FileInfo)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+
+    AcquireSRWLockShared(&FileNode->Lock);
+    *FileInfo = FileNode->FileInfo;
+    ReleaseSRWLockShared(&FileNode->Lock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::SetBasicInfo(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    UINT32 FileAttributes,
+    UINT64 CreationTime,
+    UINT64 LastAccessTime,
+    UINT64 LastWriteTime,
+    UINT64 ChangeTime,
+    FileInfo *FileInfo)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+
+    AcquireSRWLockExclusive(&FileNode->Lock);
+    if (INVALID_FILE_ATTRIBUTES != FileAttributes)
+        FileNode->FileInfo.FileAttributes = FileAttributes |
+            (FileNode->FileInfo.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    if (0 != CreationTime)
+        FileNode->FileInfo.CreationTime = CreationTime;
+    if (0 != LastAccessTime)
+        FileNode->FileInfo.LastAccessTime = LastAccessTime;
+    if (0 != LastWriteTime)
+        FileNode->FileInfo.LastWriteTime = LastWriteTime;
+    if (0 != ChangeTime)
+        FileNode->FileInfo.ChangeTime = ChangeTime;
+    *FileInfo = FileNode->FileInfo;
+    ReleaseSRWLockExclusive(&FileNode->Lock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::SetFileSize(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    UINT64 NewSize,
+    BOOLEAN SetAllocationSize,
+    FileInfo *FileInfo)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+
+    if (NewSize > TOTAL_SIZE)
+        return STATUS_DISK_FULL;
+
+    AcquireSRWLockExclusive(&FileNode->Lock);
+    if (!SetAllocationSize || FileNode->FileInfo.FileSize > NewSize)
+    {
+        /* allocation size is derived from the file size; truncation is the only visible effect */
+        FileNode->FileData.resize((size_t)NewSize);
+        FileNode->FileInfo.FileSize = NewSize;
+        FileNode->FileInfo.AllocationSize = (NewSize + ALLOCATION_UNIT - 1)
+            / ALLOCATION_UNIT * ALLOCATION_UNIT;
+    }
+    *FileInfo = FileNode->FileInfo;
+    ReleaseSRWLockExclusive(&FileNode->Lock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS MemfsCoro::CanDelete(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PWSTR FileName)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+    NTSTATUS Result;
+
+    AcquireSRWLockShared(&_Lock);
+    Result = _FileNodes.end() != FirstChild(FileNode->FileName) ?
+        STATUS_DIRECTORY_NOT_EMPTY : STATUS_SUCCESS;
+    ReleaseSRWLockShared(&_Lock);
+
+    return Result;
+}
+
+NTSTATUS MemfsCoro::Rename(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PWSTR FileName,
+    PWSTR NewFileName,
+    BOOLEAN ReplaceIfExists)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0, *NewFileNode;
+    std::wstring OldPrefix, NewPrefix;
+    std::vector<MemfsCoroFileNode *> Descendants;
+    NTSTATUS Result = STATUS_SUCCESS;
+
+    AcquireSRWLockExclusive(&_Lock);
+
+    NewFileNode = Lookup(NewFileName);
+    if (0 != NewFileNode && FileNode != NewFileNode)
+    {
+        if (!ReplaceIfExists)
+        {
+            Result = STATUS_OBJECT_NAME_COLLISION;
+            goto exit;
+        }
+        if (NewFileNode->IsDirectory())
+        {
+            Result = STATUS_ACCESS_DENIED;
+            goto exit;
+        }
+        _FileNodes.erase(NewFileNode->FileName);
+        NewFileNode->Dereference();
+    }
+
+    /* a directory takes all of its descendants with it */
+    OldPrefix = GetChildPrefix(FileNode->FileName);
+    NewPrefix = GetChildPrefix(NewFileName);
+    for (FileNodeMap::iterator I = _FileNodes.lower_bound(OldPrefix);
+        _FileNodes.end() != I && HasPrefix(I->first, OldPrefix);)
+    {
+        Descendants.push_back(I->second);
+        I = _FileNodes.erase(I);
+    }
+    _FileNodes.erase(FileNode->FileName);
+
+    FileNode->FileName = NewFileName;
+    _FileNodes[FileNode->FileName] = FileNode;
+    for (size_t I = 0; Descendants.size() > I; I++)
+    {
+        Descendants[I]->FileName = NewPrefix + Descendants[I]->FileName.substr(OldPrefix.size());
+        _FileNodes[Descendants[I]->FileName] = Descendants[I];
+    }
+
+exit:
+    ReleaseSRWLockExclusive(&_Lock);
+
+    return Result;
+}
+
+NTSTATUS MemfsCoro::GetSecurity(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PSECURITY_DESCRIPTOR SecurityDescriptor,
+    SIZE_T *PSecurityDescriptorSize)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+    NTSTATUS Result = STATUS_SUCCESS;
+
+    AcquireSRWLockShared(&FileNode->Lock);
+    if (FileNode->FileSecurity.size() > *PSecurityDescriptorSize)
+        Result = STATUS_BUFFER_OVERFLOW;
+    else if (0 != SecurityDescriptor)
+        memcpy(SecurityDescriptor, FileNode->FileSecurity.data(), FileNode->FileSecurity.size());
+    *PSecurityDescriptorSize = FileNode->FileSecurity.size();
+    ReleaseSRWLockShared(&FileNode->Lock);
+
+    return Result;
+}
+
+NTSTATUS MemfsCoro::SetSecurity(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    SECURITY_INFORMATION SecurityInformation,
+    PSECURITY_DESCRIPTOR ModificationDescriptor)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0;
+    PSECURITY_DESCRIPTOR NewSecurityDescriptor;
+    NTSTATUS Result;
+
+    AcquireSRWLockExclusive(&FileNode->Lock);
+    Result = FspSetSecurityDescriptor(
+        FileNode->FileSecurity.data(),
+        SecurityInformation,
+        ModificationDescriptor,
+        &NewSecurityDescriptor);
+    if (NT_SUCCESS(Result))
+    {
+        FileNode->FileSecurity.assign((PUINT8)NewSecurityDescriptor,
+            (PUINT8)NewSecurityDescriptor + GetSecurityDescriptorLength(NewSecurityDescriptor));
+        FspDeleteSecurityDescriptor(NewSecurityDescriptor, (NTSTATUS (*)())FspSetSecurityDescriptor);
+    }
+    ReleaseSRWLockExclusive(&FileNode->Lock);
+
+    return Result;
+}
+
+Task<NTSTATUS> MemfsCoro::ReadDirectoryAsync(
+    PVOID FileNode0,
+    PVOID FileDesc,
+    PWSTR Pattern,
+    PWSTR Marker,
+    PVOID Buffer,
+    ULONG Length,
+    PULONG PBytesTransferred)
+{
+    MemfsCoroFileNode *FileNode = (MemfsCoroFileNode *)FileNode0, *ParentNode;
+    std::wstring Prefix;
+    FileNodeMap::iterator I;
+
+    co_await _Executor->Delay(_Latency);
+
+    AcquireSRWLockShared(&_Lock);
+
+    Prefix = GetChildPrefix(FileNode->FileName);
+    if (L"\\" != FileNode->FileName)
+    {
+        /* add the "." and ".." entries for all directories except the root */
+        if (0 == Marker)
+        {
+            if (!AddDirInfo(FileNode, L".", Buffer, Length, PBytesTransferred))
+                goto exit;
+        }
+        if (0 == Marker || (L'.' == Marker[0] && L'\0' == Marker[1]))
+        {
+            ParentNode = Lookup(GetParentName(FileNode->FileName));
+            if (0 != ParentNode &&
+                !AddDirInfo(ParentNode, L"..", Buffer, Length, PBytesTransferred))
+                goto exit;
+            Marker = 0;
+        }
+        else if (L'.' == Marker[0] && L'.' == Marker[1] && L'\0' == Marker[2])
+            Marker = 0;
+    }
+
+    I = 0 != Marker ?
+        _FileNodes.upper_bound(Prefix + Marker) : _FileNodes.lower_bound(Prefix);
+    for (; _FileNodes.end() != I && HasPrefix(I->first, Prefix); ++I)
+    {
+        if (!IsChild(I->first, Prefix))
+            continue;
+        if (!AddDirInfo(I->second, &I->second->FileName[Prefix.size()],
+            Buffer, Length, PBytesTransferred))
+            goto exit;
+    }
+    FspFileSystemAddDirInfo(0, Buffer, Length, PBytesTransferred);
+
+exit:
+    ReleaseSRWLockShared(&_Lock);
+
+    co_return STATUS_SUCCESS;
+}
+
+class MemfsCoroService : public Service
+{
+public:
+    MemfsCoroService();
+
+protected:
+    NTSTATUS OnStart(ULONG Argc, PWSTR *Argv);
+    NTSTATUS OnStop();
+
+private:
+    MemfsCoro _Memfs;
+    FileSystemHost _Host;
+};
+
+static ULONG wcstol_deflt(wchar_t *w, ULONG deflt)
+{
+    wchar_t *endp;
+    ULONG ul = wcstol(w, &endp, 0);
+    return L'\0' != w[0] && L'\0' == *endp ? ul : deflt;
+}
+
+MemfsCoroService::MemfsCoroService() : Service(L"" PROGNAME), _Memfs(), _Host(_Memfs)
+{
+}
+
+NTSTATUS MemfsCoroService::OnStart(ULONG argc, PWSTR *argv)
+{
+#define argtos(v)                       if (arge > ++argp) v = *argp; else goto usage
+#define argtol(v)                       if (arge > ++argp) v = wcstol_deflt(*argp, v); else goto usage
+
+    wchar_t **argp, **arge;
+    PWSTR DebugLogFile = 0;
+    ULONG DebugFlags = 0;
+    ULONG Latency = 10;
+    ULONG ExecutorThreadCount = 0;
+    PWSTR VolumePrefix = 0;
+    PWSTR MountPoint = 0;
+    NTSTATUS Result;
+
+    for (argp = argv + 1, arge = argv + argc; arge > argp; argp++)
+    {
+        if (L'-' != argp[0][0])
+            break;
+        switch (argp[0][1])
+        {
+        case L'?':
+            goto usage;
+        case L'd':
+            argtol(DebugFlags);
+            break;
+        case L'D':
+            argtos(DebugLogFile);
+            break;
+        case L'l':
+            argtol(Latency);
+            break;
+        case L'm':
+            argtos(MountPoint);
+            break;
+        case L't':
+            argtol(ExecutorThreadCount);
+            break;
+        case L'u':
+            argtos(VolumePrefix);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (arge > argp)
+        goto usage;
+
+    if (0 == MountPoint)
+        goto usage;
+
+    if (0 != DebugLogFile)
+    {
+        Result = FileSystemHost::SetDebugLogFile(DebugLogFile);
+        if (!NT_SUCCESS(Result))
+        {
+            fail(L"cannot open debug log file");
+            goto usage;
+        }
+    }
+
+    Result = _Memfs.SetParams(Latency, ExecutorThreadCount);
+    if (!NT_SUCCESS(Result))
+    {
+        fail(L"cannot create file system");
+        return Result;
+    }
+
+    _Host.SetPrefix(VolumePrefix);
+    Result = _Host.Mount(MountPoint, 0, FALSE, DebugFlags);
+    if (!NT_SUCCESS(Result))
+    {
+        fail(L"cannot mount file system");
+        return Result;
+    }
+
+    MountPoint = _Host.MountPoint();
+    info(L"%s%s%s -l %lu -m %s",
+        L"" PROGNAME,
+        0 != VolumePrefix && L'\0' != VolumePrefix[0] ? L" -u " : L"",
+            0 != VolumePrefix && L'\0' != VolumePrefix[0] ? VolumePrefix : L"",
+        Latency,
+        MountPoint);
+
+    return STATUS_SUCCESS;
+
+usage:
+    static wchar_t usage[] = L""
+        "usage: %s OPTIONS\n"
+        "\n"
+        "options:\n"
+        "    -d DebugFlags       [-1: enable all debug logs]\n"
+        "    -D DebugLogFile     [file path; use - for stderr]\n"
+        "    -l Latency          [simulated backend latency in millis; default: 10]\n"
+        "    -t ThreadCount      [executor threads; default: process thread pool]\n"
+        "    -u \\Server\\Share    [UNC prefix (single backslash)]\n"
+        "    -m MountPoint       [X:|*|directory]\n";
+
+    fail(usage, L"" PROGNAME);
+
+    return STATUS_UNSUCCESSFUL;
+
+#undef argtos
+#undef argtol
+}
+
+NTSTATUS MemfsCoroService::OnStop()
+{
+    _Host.Unmount();
+    return STATUS_SUCCESS;
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    return MemfsCoroService().Run();
+}
@@ -39,16 +39,19 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
     wchar_t **argp, **arge;
     ULONG DebugFlags = 0;
     PWSTR DebugLogFile = 0;
+    PWSTR DebugTraceFile = 0;
     ULONG CaseInsensitiveFlags = 0;
     ULONG Flags = MemfsDisk;
     ULONG FileInfoTimeout = INFINITE;
     ULONG MaxFileNodes = 1024;
     ULONG MaxFileSize = 16 * 1024 * 1024;
+    ULONG AccessCheckCacheCapacity = 0;
     PWSTR FileSystemName = 0;
     PWSTR MountPoint = 0;
     PWSTR VolumePrefix = 0;
     PWSTR RootSddl = 0;
     HANDLE DebugLogHandle = INVALID_HANDLE_VALUE;
+    HANDLE DebugTraceHandle = INVALID_HANDLE_VALUE;
     MEMFS *Memfs = 0;
     NTSTATUS Result;
 
@@ -60,6 +63,9 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         {
         case L'?':
             goto usage;
+        case L'a':
+            argtol(AccessCheckCacheCapacity);
+            break;
         case L'd':
             argtol(DebugFlags);
             break;
@@ -84,6 +90,9 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         case L's':
             argtol(MaxFileSize);
             break;
+        case L'T':
+            argtos(DebugTraceFile);
+            break;
         case L't':
             argtol(FileInfoTimeout);
             break;
@@ -125,6 +134,30 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         FspDebugLogSetHandle(DebugLogHandle);
     }
 
+    if (0 != DebugTraceFile)
+    {
+        DebugTraceHandle = CreateFileW(
+            DebugTraceFile,
+            GENERIC_WRITE,
+            FILE_SHARE_READ,
+            0,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            0);
+        if (INVALID_HANDLE_VALUE == DebugTraceHandle)
+        {
+            fail(L"cannot open debug trace file");
+            goto usage;
+        }
+
+        Result = FspDebugTraceStart(DebugTraceHandle);
+        if (!NT_SUCCESS(Result))
+        {
+            fail(L"cannot start debug trace");
+            goto exit;
+        }
+    }
+
     Result = MemfsCreateFunnel(
         CaseInsensitiveFlags | Flags,
         FileInfoTimeout,
@@ -142,6 +175,17 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
 
     FspFileSystemSetDebugLog(MemfsFileSystem(Memfs), DebugFlags);
 
+    if (0 != AccessCheckCacheCapacity)
+    {
+        Result = FspFileSystemSetAccessCheckCache(MemfsFileSystem(Memfs),
+            AccessCheckCacheCapacity, 0);
+        if (!NT_SUCCESS(Result))
+        {
+            fail(L"cannot enable access check cache");
+            goto exit;
+        }
+    }
+
     if (0 != MountPoint && L'\0' != MountPoint[0])
     {
         Result = FspFileSystemSetMountPoint(MemfsFileSystem(Memfs),
@@ -176,6 +220,9 @@ exit:
     if (!NT_SUCCESS(Result) && 0 != Memfs)
         MemfsDelete(Memfs);
 
+    if (!NT_SUCCESS(Result))
+        FspDebugTraceStop();
+
     return Result;
 
 usage:
@@ -185,9 +232,11 @@ usage:
         "options:\n"
         "    -d DebugFlags       [-1: enable all debug logs]\n"
         "    -D DebugLogFile     [file path; use - for stderr]\n"
+        "    -T DebugTraceFile   [binary trace of -d requests; print with fsptool trace]\n"
         "    -i                  [case insensitive file system]\n"
         "    -t FileInfoTimeout  [millis]\n"
         "    -n MaxFileNodes\n"
+        "    -a AccessCacheCap   [traverse check cache entries]\n"
         "    -s MaxFileSize      [bytes]\n"
         "    -F FileSystemName\n"
         "    -S RootSddl         [file rights: FA, etc; NO generic rights: GA, etc.]\n"
@@ -206,6 +255,8 @@ NTSTATUS SvcStop(FSP_SERVICE *Service)
     MemfsStop(Memfs);
     MemfsDelete(Memfs);
 
+    FspDebugTraceStop();
+
     return STATUS_SUCCESS;
 }
 
@@ -1704,6 +1704,10 @@ NTSTATUS MemfsCreateFunnel(
     VolumeParams.NamedStreams = 1;
 #endif
     VolumeParams.PostCleanupWhenModifiedOnly = 1;
+    VolumeParams.BatchCloseRequests = !!(Flags & MemfsBatchCloseRequests);
+    VolumeParams.DelayCloseRequests = !!(Flags & MemfsDelayCloseRequests);
+    if (Flags & MemfsLargeDirInfoCache)
+        VolumeParams.DirInfoCacheSizeMax = 1024 * 1024;
     if (0 != VolumePrefix)
         wcscpy_s(VolumeParams.Prefix, sizeof VolumeParams.Prefix / sizeof(WCHAR), VolumePrefix);
     wcscpy_s(VolumeParams.FileSystemName, sizeof VolumeParams.FileSystemName / sizeof(WCHAR),
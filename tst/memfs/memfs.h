@@ -30,6 +30,9 @@ enum
 {
     MemfsDisk                           = 0x00,
     MemfsNet                            = 0x01,
+    MemfsLargeDirInfoCache              = 0x10,
+    MemfsDelayCloseRequests             = 0x20,
+    MemfsBatchCloseRequests             = 0x40,
     MemfsCaseInsensitive                = 0x80,
 };
 
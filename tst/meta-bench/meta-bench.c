@@ -0,0 +1,472 @@
+/**
+ * @file meta-bench.c
+ *
+ * Portable stress test and benchmark for the striped meta cache.
+ *
+ * Builds sys/meta.c against the shim in posix/sys/driver.h. With -t a set of single
+ * threaded checks (lookup, capacity, expiration, shared items, bucket growth, ItemFini)
+ * is followed by a multithreaded stress run that verifies that referenced buffers are
+ * never torn or freed early and that ItemFini is called exactly once per added buffer.
+ * Otherwise lookup throughput is measured with one stripe and with one stripe per thread.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/sys/meta.c"
+#include <stdio.h>
+#include <unistd.h>
+
+static unsigned OptRepeat = 3;
+static unsigned OptThreads = 4;
+
+static LONG FiniCount;
+
+typedef struct
+{
+    UINT64 Key;
+    UINT8 Data[48];
+} ITEM;
+
+#define FAIL(...)                       do { fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } while (0)
+#define CHECK(e)                        do { if (!(e)) FAIL("%s:%d: CHECK(%s)", __FILE__, __LINE__, #e); } while (0)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void item_init(ITEM *Item, UINT64 Key)
+{
+    Item->Key = Key;
+    for (ULONG I = 0; sizeof Item->Data > I; I++)
+        Item->Data[I] = (UINT8)(Key + I);
+}
+
+static void item_check(PCVOID Buffer, ULONG Size, UINT64 Key)
+{
+    const ITEM *Item = Buffer;
+    CHECK(sizeof *Item == Size);
+    CHECK(Key == Item->Key);
+    for (ULONG I = 0; sizeof Item->Data > I; I++)
+        CHECK((UINT8)(Key + I) == Item->Data[I]);
+}
+
+static VOID item_fini(PVOID Buffer, ULONG Size)
+{
+    /* poison the buffer, so that a lookup that races with the last dereference fails */
+    memset(Buffer, 0xcc, Size);
+    InterlockedIncrement(&FiniCount);
+}
+
+static FSP_META_CACHE *cache_create(ULONG StripeCount, ULONG Capacity, INT64 Timeout,
+    FSP_META_CACHE_ITEM_FINI *ItemFini)
+{
+    LARGE_INTEGER MetaTimeout;
+    FSP_META_CACHE *MetaCache;
+    MetaTimeout.QuadPart = Timeout;
+    FspProcessorCount = StripeCount;
+    CHECK(STATUS_SUCCESS == FspMetaCacheCreate(Capacity, 1024, &MetaTimeout, ItemFini, &MetaCache));
+    CHECK(0 != MetaCache);
+    CHECK(0 == (UINT_PTR)MetaCache->Stripes % 64);
+    return MetaCache;
+}
+
+static UINT64 add(FSP_META_CACHE *MetaCache, UINT64 Key)
+{
+    ITEM Item;
+    UINT64 ItemIndex;
+    item_init(&Item, Key);
+    ItemIndex = FspMetaCacheAddItem(MetaCache, &Item, sizeof Item);
+    CHECK(0 != ItemIndex);
+    return ItemIndex;
+}
+
+static BOOLEAN lookup(FSP_META_CACHE *MetaCache, UINT64 ItemIndex, UINT64 Key)
+{
+    PCVOID Buffer;
+    ULONG Size;
+    if (!FspMetaCacheReferenceItemBuffer(MetaCache, ItemIndex, &Buffer, &Size))
+    {
+        CHECK(0 == Buffer && 0 == Size);
+        return FALSE;
+    }
+    item_check(Buffer, Size, Key);
+    FspMetaCacheDereferenceItemBuffer(Buffer);
+    return TRUE;
+}
+
+static void test_lookup(void)
+{
+    enum { Count = 100 };
+    FSP_META_CACHE *MetaCache = cache_create(4, 1000, 10000000LL * 60, 0);
+    FSP_META_CACHE_STATISTICS Statistics;
+    UINT64 ItemIndex[Count];
+    PCVOID Buffer;
+
+    for (ULONG I = 0; Count > I; I++)
+        ItemIndex[I] = add(MetaCache, I);
+    for (ULONG I = 0; Count > I; I++)
+        CHECK(lookup(MetaCache, ItemIndex[I], I));
+    CHECK(!lookup(MetaCache, 0, 0));
+    CHECK(!lookup(MetaCache, ItemIndex[Count - 1] + 4, 0));
+
+    /* a referenced buffer outlives the invalidation of its item */
+    CHECK(FspMetaCacheReferenceItemBuffer(MetaCache, ItemIndex[0], &Buffer, 0));
+    for (ULONG I = 0; Count > I; I += 2)
+        FspMetaCacheInvalidateItem(MetaCache, ItemIndex[I]);
+    item_check(Buffer, sizeof(ITEM), 0);
+    FspMetaCacheDereferenceItemBuffer(Buffer);
+    for (ULONG I = 0; Count > I; I++)
+        CHECK(lookup(MetaCache, ItemIndex[I], I) == (I & 1));
+
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    CHECK(Count / 2 == Statistics.ItemCount);
+    CHECK(Count + 1 + Count / 2 == Statistics.HitCount);
+    CHECK(1 + Count / 2 == Statistics.MissCount);  /* ItemIndex 0 is not counted */
+    CHECK(0 == Statistics.EvictionCount);
+    CHECK(4 * 2 * FSP_META_CACHE_BUCKET_COUNT_MIN == Statistics.ItemBucketCount);  /* 25 items per stripe */
+
+    FspMetaCacheDelete(MetaCache);
+    printf("lookup: ok\n");
+}
+
+static void test_capacity(void)
+{
+    enum { Capacity = 64, Count = 256 };
+    FSP_META_CACHE *MetaCache = cache_create(4, Capacity, 10000000LL * 60, 0);
+    FSP_META_CACHE_STATISTICS Statistics;
+    UINT64 ItemIndex[Count];
+
+    for (ULONG I = 0; Count > I; I++)
+        ItemIndex[I] = add(MetaCache, I);
+
+    /* items are spread evenly over the stripes and each stripe evicts its oldest items */
+    for (ULONG I = 0; Count > I; I++)
+        CHECK(lookup(MetaCache, ItemIndex[I], I) == (Count - Capacity <= I));
+
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    CHECK(Capacity == Statistics.ItemCount);
+    CHECK(Count - Capacity == Statistics.EvictionCount);
+
+    FspMetaCacheDelete(MetaCache);
+    printf("capacity: ok\n");
+}
+
+static void test_expired(void)
+{
+    enum { Count = 32 };
+    FSP_META_CACHE *MetaCache = cache_create(4, 1000, 10000000LL / 10, 0);
+    FSP_META_CACHE_STATISTICS Statistics;
+    UINT64 ItemIndex[Count];
+
+    for (ULONG I = 0; Count > I; I++)
+        ItemIndex[I] = add(MetaCache, I);
+    FspMetaCacheInvalidateExpired(MetaCache, KeQueryInterruptTime());
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    CHECK(Count == Statistics.ItemCount);
+
+    usleep(200000);
+    FspMetaCacheInvalidateExpired(MetaCache, KeQueryInterruptTime());
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    CHECK(0 == Statistics.ItemCount);
+    for (ULONG I = 0; Count > I; I++)
+        CHECK(!lookup(MetaCache, ItemIndex[I], I));
+
+    FspMetaCacheDelete(MetaCache);
+    printf("expired: ok\n");
+}
+
+static void test_shared(void)
+{
+    FSP_META_CACHE *MetaCache = cache_create(4, 1000, 10000000LL * 60, 0);
+    FSP_META_CACHE_STATISTICS Statistics;
+    UINT64 ItemIndex[3];
+    ITEM Item;
+
+    item_init(&Item, 1);
+    ItemIndex[0] = FspMetaCacheAddSharedItem(MetaCache, &Item, sizeof Item);
+    ItemIndex[1] = FspMetaCacheAddSharedItem(MetaCache, &Item, sizeof Item);
+    item_init(&Item, 2);
+    ItemIndex[2] = FspMetaCacheAddSharedItem(MetaCache, &Item, sizeof Item);
+    CHECK(0 != ItemIndex[0]);
+    CHECK(ItemIndex[0] == ItemIndex[1]);
+    CHECK(ItemIndex[0] != ItemIndex[2]);
+
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    CHECK(2 == Statistics.ItemCount);
+    CHECK(1 == Statistics.ShareCount);
+
+    /* each owner invalidates once; the item goes away with the last owner */
+    FspMetaCacheInvalidateItem(MetaCache, ItemIndex[0]);
+    CHECK(lookup(MetaCache, ItemIndex[1], 1));
+    FspMetaCacheInvalidateItem(MetaCache, ItemIndex[1]);
+    CHECK(!lookup(MetaCache, ItemIndex[1], 1));
+    CHECK(lookup(MetaCache, ItemIndex[2], 2));
+
+    /* content that is no longer cached is added as a new item */
+    item_init(&Item, 1);
+    ItemIndex[0] = FspMetaCacheAddSharedItem(MetaCache, &Item, sizeof Item);
+    CHECK(0 != ItemIndex[0] && ItemIndex[1] != ItemIndex[0]);
+    CHECK(lookup(MetaCache, ItemIndex[0], 1));
+
+    FspMetaCacheDelete(MetaCache);
+    printf("shared: ok\n");
+}
+
+static void test_growth(void)
+{
+    enum { Count = 5000 };
+    FSP_META_CACHE *MetaCache = cache_create(1, Count, 10000000LL * 60, 0);
+    FSP_META_CACHE_STATISTICS Statistics;
+    static UINT64 ItemIndex[Count];
+
+    for (ULONG I = 0; Count > I; I++)
+        ItemIndex[I] = add(MetaCache, I);
+    for (ULONG I = 0; Count > I; I++)
+        CHECK(lookup(MetaCache, ItemIndex[I], I));
+
+    FspMetaCacheGetStatistics(MetaCache, &Statistics);
+    CHECK(Count == Statistics.ItemCount);
+    CHECK(0 == Statistics.EvictionCount);
+    CHECK(Count <= Statistics.ItemBucketCount);
+    CHECK(0 == (Statistics.ItemBucketCount & (Statistics.ItemBucketCount - 1)));
+
+    FspMetaCacheDelete(MetaCache);
+    printf("growth: ok (%lu buckets)\n", (unsigned long)Statistics.ItemBucketCount);
+}
+
+static void test_fini(void)
+{
+    enum { Capacity = 16, Count = 40 };
+    FSP_META_CACHE *MetaCache = cache_create(2, Capacity, 10000000LL * 60, item_fini);
+    UINT64 ItemIndex[Count];
+    PCVOID Buffer;
+    UINT8 Large[2048];
+
+    FiniCount = 0;
+    for (ULONG I = 0; Count > I; I++)
+        ItemIndex[I] = add(MetaCache, I);
+    CHECK(Count - Capacity == FiniCount);
+
+    /* a buffer that the cache does not take is finalized by FspMetaCacheAddItem */
+    FiniCount = 0;
+    memset(Large, 0, sizeof Large);
+    CHECK(0 == FspMetaCacheAddItem(MetaCache, Large, sizeof Large));
+    CHECK(1 == FiniCount);
+    FiniCount = 0;
+    FspMetaCacheInvalidateItem(MetaCache, ItemIndex[Count - 1]);
+    CHECK(1 == FiniCount);
+
+    /* a held reference delays ItemFini until it is released */
+    FiniCount = 0;
+    CHECK(FspMetaCacheReferenceItemBuffer(MetaCache, ItemIndex[Count - 2], &Buffer, 0));
+    FspMetaCacheInvalidateItem(MetaCache, ItemIndex[Count - 2]);
+    CHECK(0 == FiniCount);
+    item_check(Buffer, sizeof(ITEM), Count - 2);
+    FspMetaCacheDereferenceItemBuffer(Buffer);
+    CHECK(1 == FiniCount);
+
+    FiniCount = 0;
+    FspMetaCacheDelete(MetaCache);
+    CHECK(Capacity - 2 == FiniCount);
+
+    printf("fini: ok\n");
+}
+
+typedef struct
+{
+    FSP_META_CACHE *MetaCache;
+    unsigned Index;
+    unsigned Count;
+    BOOLEAN Test;
+    LONG Adds;
+    LONG Hits;
+} THREAD_ARGS;
+
+static void *worker(void *Data)
+{
+    enum { Window = 64 };
+    THREAD_ARGS *Args = Data;
+    FSP_META_CACHE *MetaCache = Args->MetaCache;
+    UINT64 ItemIndex[Window], Key[Window];
+    unsigned Seed = Args->Index + 1;
+
+    memset(ItemIndex, 0, sizeof ItemIndex);
+    for (unsigned I = 0; Args->Count > I; I++)
+    {
+        unsigned Slot = rand_r(&Seed) % Window;
+        unsigned Op = rand_r(&Seed) % 8;
+        if (0 == Op || 0 == ItemIndex[Slot])
+        {
+            /* keys are unique across threads, so a lookup can only match its own buffer */
+            Key[Slot] = ((UINT64)Args->Index << 32) | I;
+            ItemIndex[Slot] = add(MetaCache, Key[Slot]);
+            Args->Adds++;
+        }
+        else if (1 == Op)
+        {
+            FspMetaCacheInvalidateItem(MetaCache, ItemIndex[Slot]);
+            ItemIndex[Slot] = 0;
+        }
+        else if (lookup(MetaCache, ItemIndex[Slot], Key[Slot]))
+            Args->Hits++;
+    }
+
+    return 0;
+}
+
+static void *reader(void *Data)
+{
+    THREAD_ARGS *Args = Data;
+    FSP_META_CACHE *MetaCache = Args->MetaCache;
+    unsigned Seed = Args->Index + 1;
+    PCVOID Buffer;
+
+    for (unsigned I = 0; Args->Count > I; I++)
+    {
+        /* ItemIndex = Serial * StripeCount + StripeIndex; serials start at 1 */
+        UINT64 Serial = 1 + rand_r(&Seed) % MetaCache->MetaCapacity;
+        UINT64 ItemIndex = Serial * MetaCache->StripeCount + Serial % MetaCache->StripeCount;
+        if (FspMetaCacheReferenceItemBuffer(MetaCache, ItemIndex, &Buffer, 0))
+        {
+            FspMetaCacheDereferenceItemBuffer(Buffer);
+            Args->Hits++;
+        }
+    }
+
+    return 0;
+}
+
+static double run(FSP_META_CACHE *MetaCache, void *(*Routine)(void *), unsigned Count,
+    LONG *PAdds, LONG *PHits)
+{
+    pthread_t Threads[64];
+    THREAD_ARGS Args[64];
+    double T;
+
+    memset(Args, 0, sizeof Args);
+    T = now();
+    for (unsigned I = 0; OptThreads > I; I++)
+    {
+        Args[I].MetaCache = MetaCache;
+        Args[I].Index = I;
+        Args[I].Count = Count;
+        CHECK(0 == pthread_create(&Threads[I], 0, Routine, &Args[I]));
+    }
+    *PAdds = *PHits = 0;
+    for (unsigned I = 0; OptThreads > I; I++)
+    {
+        CHECK(0 == pthread_join(Threads[I], 0));
+        *PAdds += Args[I].Adds;
+        *PHits += Args[I].Hits;
+    }
+    T = now() - T;
+
+    return T;
+}
+
+static int test(unsigned Count)
+{
+    FSP_META_CACHE *MetaCache;
+    LONG Adds, Hits;
+
+    test_lookup();
+    test_capacity();
+    test_expired();
+    test_shared();
+    test_growth();
+    test_fini();
+
+    /* a capacity below the threads' combined working set also exercises eviction */
+    MetaCache = cache_create(OptThreads, 32 * OptThreads, 10000000LL * 60, item_fini);
+    FiniCount = 0;
+    run(MetaCache, worker, Count, &Adds, &Hits);
+    FspMetaCacheDelete(MetaCache);
+    CHECK(Adds == FiniCount);
+    printf("stress: ok (%u threads, %ld adds, %ld hits)\n", OptThreads, (long)Adds, (long)Hits);
+
+    return 0;
+}
+
+static void bench(ULONG StripeCount, unsigned Count)
+{
+    enum { Capacity = 4096 };
+    FSP_META_CACHE *MetaCache;
+    double Time = 0, T;
+    LONG Adds, Hits;
+
+    MetaCache = cache_create(StripeCount, Capacity, 10000000LL * 60, 0);
+    for (ULONG I = 0; Capacity > I; I++)
+        add(MetaCache, I);
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        T = run(MetaCache, reader, Count, &Adds, &Hits);
+        CHECK((LONG)(Count * OptThreads) == Hits);
+        if (0 == R || Time > T)
+            Time = T;
+    }
+    FspMetaCacheDelete(MetaCache);
+
+    printf("%8u %8u %10u %12.3f %12.0f\n",
+        StripeCount, OptThreads, Count * OptThreads, Time * 1e3, Count * OptThreads / Time);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: meta-bench [-t] [-r REPEAT] [-p THREADS] [COUNT]\n"
+        "\n"
+        "    -t          run the cache checks and a stress run\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -p THREADS  threads (at most 16) [4]\n"
+        "    COUNT       operations per thread [100000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned Count = 100000;
+    BOOLEAN OptTest = FALSE;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-t", argv[I]))
+            OptTest = TRUE;
+        else if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-p", argv[I]) && argc > I + 1)
+            OptThreads = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0])
+            usage();
+        else
+            Count = strtoul(argv[I], 0, 0);
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+    if (0 == OptThreads || FSP_META_CACHE_STRIPE_COUNT_MAX < OptThreads)
+        usage();
+
+    if (OptTest)
+        return test(Count);
+
+    printf("%8s %8s %10s %12s %12s\n",
+        "STRIPES", "THREADS", "LOOKUPS", "TIME(ms)", "LOOKUPS/SEC");
+    bench(1, Count);
+    bench(OptThreads, Count);
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file meta-bench/posix/sys/driver.h
+ *
+ * Just enough of the FSD environment to compile sys/meta.c on a POSIX system.
+ *
+ * Spin locks are modelled with pthread mutexes, so that the harness behaves when there
+ * are more threads than processors. FspProcessorCount is set by the harness and
+ * determines the number of stripes that FspMetaCacheCreate uses.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_SYS_DRIVER_H_INCLUDED
+#define WINFSP_SYS_DRIVER_H_INCLUDED
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef void VOID;
+typedef void *PVOID;
+typedef const void *PCVOID;
+typedef uint8_t UCHAR, UINT8, BOOLEAN, *PUINT8;
+typedef uint32_t ULONG, UINT32, *PULONG;
+typedef int32_t LONG, NTSTATUS;
+typedef uint64_t UINT64, *PUINT64;
+typedef int64_t INT64, LONG64;
+typedef uintptr_t UINT_PTR, ULONG_PTR;
+typedef UCHAR KIRQL, *PKIRQL;
+typedef union
+{
+    INT64 QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+#define TRUE                            1
+#define FALSE                           0
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+#define ASSERT(e)                       assert(e)
+#define DBG                             1
+#define DEBUGLOG(fmt, ...)              ((VOID)0)
+#define MEMORY_ALLOCATION_ALIGNMENT     16
+#define RtlZeroMemory(P, S)             memset(P, 0, S)
+#define RtlCopyMemory(D, S, L)          memcpy(D, S, L)
+#define RtlEqualMemory(D, S, L)         (0 == memcmp(D, S, L))
+#define CONTAINING_RECORD(a, T, f)      ((T *)((PUINT8)(a) - offsetof(T, f)))
+#define __declspec(x)                   __declspec_##x
+#define __declspec_align(n)             __attribute__((aligned(n)))
+
+/* interlocked */
+#define InterlockedIncrement(P)         __atomic_add_fetch(P, 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(P)         __atomic_sub_fetch(P, 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(P)       __atomic_add_fetch(P, 1, __ATOMIC_SEQ_CST)
+
+/* processors */
+static ULONG FspProcessorCount = 1;
+
+/* memory; FSP_META_CACHE_STRIPE is cache line aligned, so align all allocations */
+static inline PVOID FspPosixAlloc(size_t Size)
+{
+    return aligned_alloc(64, (Size + 63) & ~(size_t)63);
+}
+#define FspAlloc(Size)                  FspPosixAlloc(Size)
+#define FspAllocNonPaged(Size)          FspPosixAlloc(Size)
+#define FspFree(Pointer)                free(Pointer)
+
+/* hashing; must match sys/driver.h */
+static inline
+UINT64 FspHashMix64(UINT64 k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* timeouts; must match sys/driver.h */
+static inline UINT64 KeQueryInterruptTime(VOID)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 10000000ULL + (UINT64)ts.tv_nsec / 100;
+}
+static inline
+UINT64 FspExpirationTimeFromTimeout(UINT64 Timeout)
+{
+    /* if Timeout is 0 or -1 then Timeout else KeQueryInterruptTime() + Timeout */
+    return 1 >= Timeout + 1 ? Timeout : KeQueryInterruptTime() + Timeout;
+}
+static inline
+BOOLEAN FspExpirationTimeValid2(UINT64 ExpirationTime, UINT64 CurrentTime)
+{
+    return CurrentTime < ExpirationTime;
+}
+
+/* lists */
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY *Flink, *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+static inline VOID InitializeListHead(PLIST_ENTRY Head)
+{
+    Head->Flink = Head->Blink = Head;
+}
+static inline VOID InsertTailList(PLIST_ENTRY Head, PLIST_ENTRY Entry)
+{
+    Entry->Flink = Head;
+    Entry->Blink = Head->Blink;
+    Head->Blink->Flink = Entry;
+    Head->Blink = Entry;
+}
+static inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY Flink = Entry->Flink, Blink = Entry->Blink;
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return Flink == Blink;
+}
+
+/* spin locks */
+typedef pthread_mutex_t KSPIN_LOCK;
+#define KeInitializeSpinLock(L)         pthread_mutex_init(L, 0)
+#define KeAcquireSpinLock(L, PIrql)     (*(PIrql) = 0, pthread_mutex_lock(L))
+#define KeReleaseSpinLock(L, Irql)      ((VOID)(Irql), pthread_mutex_unlock(L))
+
+/* meta cache; must match sys/driver.h */
+#define FSP_META_CACHE_STRIPE_COUNT_MAX 16
+#define FSP_META_CACHE_BUCKET_COUNT_MIN 16
+typedef struct __declspec(align(64))   /* one cache line (or more) per stripe */
+{
+    KSPIN_LOCK SpinLock;
+    LIST_ENTRY ItemList;
+    ULONG ItemCapacity, ItemCount;
+    ULONG ItemBucketCount;
+    PVOID *ItemBuckets, *ContentBuckets;
+    UINT64 HitCount, MissCount, EvictionCount, ShareCount;
+} FSP_META_CACHE_STRIPE;
+typedef VOID FSP_META_CACHE_ITEM_FINI(PVOID Buffer, ULONG Size);
+typedef struct
+{
+    UINT64 MetaTimeout;
+    ULONG MetaCapacity;
+    ULONG ItemSizeMax;
+    LONG64 ItemIndex;
+    FSP_META_CACHE_ITEM_FINI *ItemFini;
+    ULONG StripeCount;
+    FSP_META_CACHE_STRIPE Stripes[];
+} FSP_META_CACHE;
+typedef struct
+{
+    ULONG ItemCount, ItemBucketCount;
+    UINT64 HitCount, MissCount, EvictionCount, ShareCount;
+} FSP_META_CACHE_STATISTICS;
+NTSTATUS FspMetaCacheCreate(
+    ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    FSP_META_CACHE_ITEM_FINI *ItemFini,
+    FSP_META_CACHE **PMetaCache);
+VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache);
+VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationTime);
+BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIndex,
+    PCVOID *PBuffer, PULONG PSize);
+VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer);
+UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+UINT64 FspMetaCacheAddSharedItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex);
+VOID FspMetaCacheGetStatistics(FSP_META_CACHE *MetaCache, FSP_META_CACHE_STATISTICS *Statistics);
+
+#endif
@@ -38,10 +38,13 @@ public:
     Ptfs();
     ~Ptfs();
     NTSTATUS SetPath(PWSTR Path);
+    VOID SetAsyncRead(BOOLEAN AsyncRead);
 
 protected:
     static NTSTATUS GetFileInfoInternal(HANDLE Handle, FileInfo *FileInfo);
+    static DWORD WINAPI AsyncReadWork(PVOID Context);
     NTSTATUS Init(PVOID Host);
+    VOID Unmounted(PVOID Host);
     NTSTATUS GetVolumeInfo(
         VolumeInfo *VolumeInfo);
     NTSTATUS GetSecurityByName(
@@ -160,6 +163,19 @@ protected:
 private:
     PWSTR _Path;
     UINT64 _CreationTime;
+    BOOLEAN _AsyncRead;
+    volatile LONG _AsyncReadCount;      /* pending reads plus one until Unmounted */
+    HANDLE _AsyncReadIdleEvent;
+};
+
+struct PtfsAsyncRead
+{
+    Ptfs *Self;
+    AsyncResponse Response;
+    HANDLE Handle;
+    PVOID Buffer;
+    UINT64 Offset;
+    ULONG Length;
 };
 
 struct PtfsFileDesc
@@ -176,15 +192,22 @@ struct PtfsFileDesc
     PVOID DirBuffer;
 };
 
-Ptfs::Ptfs() : FileSystemBase(), _Path()
+Ptfs::Ptfs() : FileSystemBase(), _Path(), _AsyncRead(), _AsyncReadCount(1), _AsyncReadIdleEvent()
 {
 }
 
 Ptfs::~Ptfs()
 {
+    if (0 != _AsyncReadIdleEvent)
+        CloseHandle(_AsyncReadIdleEvent);
     delete[] _Path;
 }
 
+VOID Ptfs::SetAsyncRead(BOOLEAN AsyncRead)
+{
+    _AsyncRead = AsyncRead;
+}
+
 NTSTATUS Ptfs::SetPath(PWSTR Path)
 {
     WCHAR FullPath[MAX_PATH];
@@ -264,9 +287,22 @@ NTSTATUS Ptfs::Init(PVOID Host0)
     Host->SetPassQueryDirectoryPattern(TRUE);
     Host->SetVolumeCreationTime(_CreationTime);
     Host->SetVolumeSerialNumber(0);
+    if (_AsyncRead && 0 == _AsyncReadIdleEvent)
+    {
+        _AsyncReadIdleEvent = CreateEventW(0, TRUE, FALSE, 0);
+        if (0 == _AsyncReadIdleEvent)
+            return NtStatusFromWin32(GetLastError());
+    }
     return STATUS_SUCCESS;
 }
 
+VOID Ptfs::Unmounted(PVOID Host)
+{
+    /* the dispatcher has stopped; complete the pending reads before the file system goes away */
+    if (0 != _AsyncReadIdleEvent && 0 != InterlockedDecrement(&_AsyncReadCount))
+        WaitForSingleObject(_AsyncReadIdleEvent, INFINITE);
+}
+
 NTSTATUS Ptfs::GetVolumeInfo(
     VolumeInfo *VolumeInfo)
 {
@@ -521,6 +557,30 @@ NTSTATUS Ptfs::Read(
     HANDLE Handle = HandleFromFileDesc(FileDesc);
     OVERLAPPED Overlapped = { 0 };
 
+    if (_AsyncRead)
+    {
+        /*
+         * Read on a thread pool thread and complete the request from there. The handle stays
+         * open until then, because Close is not sent while a read of the file is pending.
+         */
+        PtfsAsyncRead *Read = new PtfsAsyncRead();
+        Read->Response = PendResponse();
+        if (Read->Response.IsValid())
+        {
+            Read->Self = this;
+            Read->Handle = Handle;
+            Read->Buffer = Buffer;
+            Read->Offset = Offset;
+            Read->Length = Length;
+            InterlockedIncrement(&_AsyncReadCount);
+            if (QueueUserWorkItem(AsyncReadWork, Read, WT_EXECUTEDEFAULT))
+                return STATUS_PENDING;
+            InterlockedDecrement(&_AsyncReadCount);
+        }
+        /* not pended: drop the token and read synchronously */
+        delete Read;
+    }
+
     Overlapped.Offset = (DWORD)Offset;
     Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
 
@@ -530,6 +590,29 @@ NTSTATUS Ptfs::Read(
     return STATUS_SUCCESS;
 }
 
+DWORD WINAPI Ptfs::AsyncReadWork(PVOID Context)
+{
+    PtfsAsyncRead *Read = (PtfsAsyncRead *)Context;
+    Ptfs *Self = Read->Self;
+    OVERLAPPED Overlapped = { 0 };
+    ULONG BytesTransferred = 0;
+    NTSTATUS Result = STATUS_SUCCESS;
+
+    Overlapped.Offset = (DWORD)Read->Offset;
+    Overlapped.OffsetHigh = (DWORD)(Read->Offset >> 32);
+
+    if (!ReadFile(Read->Handle, Read->Buffer, Read->Length, &BytesTransferred, &Overlapped))
+        Result = NtStatusFromWin32(GetLastError());
+
+    Read->Response.CompleteRead(Result, BytesTransferred);
+    delete Read;
+
+    if (0 == InterlockedDecrement(&Self->_AsyncReadCount))
+        SetEvent(Self->_AsyncReadIdleEvent);
+
+    return 0;
+}
+
 NTSTATUS Ptfs::Write(
     PVOID FileNode,
     PVOID FileDesc,
@@ -889,6 +972,7 @@ NTSTATUS PtfsService::OnStart(ULONG argc, PWSTR *argv)
     PWSTR VolumePrefix = 0;
     PWSTR PassThrough = 0;
     PWSTR MountPoint = 0;
+    BOOLEAN AsyncRead = FALSE;
     HANDLE DebugLogHandle = INVALID_HANDLE_VALUE;
     WCHAR PassThroughBuf[MAX_PATH];
     NTSTATUS Result;
@@ -901,6 +985,9 @@ NTSTATUS PtfsService::OnStart(ULONG argc, PWSTR *argv)
         {
         case L'?':
             goto usage;
+        case L'a':
+            AsyncRead = TRUE;
+            break;
         case L'd':
             argtol(DebugFlags);
             break;
@@ -967,6 +1054,8 @@ NTSTATUS PtfsService::OnStart(ULONG argc, PWSTR *argv)
         return Result;
     }
 
+    _Ptfs.SetAsyncRead(AsyncRead);
+
     _Host.SetPrefix(VolumePrefix);
     Result = _Host.Mount(MountPoint, 0, FALSE, DebugFlags);
     if (!NT_SUCCESS(Result))
@@ -994,7 +1083,8 @@ usage:
         "    -D DebugLogFile     [file path; use - for stderr]\n"
         "    -u \\Server\\Share    [UNC prefix (single backslash)]\n"
         "    -p Directory        [directory to expose as pass through file system]\n"
-        "    -m MountPoint       [X:|*|directory]\n";
+        "    -m MountPoint       [X:|*|directory]\n"
+        "    -a                  [complete reads asynchronously]\n";
 
     fail(usage, L"" PROGNAME);
 
@@ -0,0 +1,330 @@
+/**
+ * @file pattern-bench.c
+ *
+ * Portable test and benchmark for the QueryDirectory pattern matcher.
+ *
+ * Builds sys/pattern.c against the shim in posix/sys/driver.h, which supplies a reference
+ * implementation of the FsRtlIsNameInExpression rules for the generic path. With -t the
+ * compiled matcher is checked against the reference matcher on random names and patterns;
+ * otherwise the two are timed over synthetic directories.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/sys/pattern.c"
+#include <stdio.h>
+#include <time.h>
+
+#define NAME_MAX_LENGTH                 64
+
+static unsigned OptRepeat = 3;
+static unsigned OptSeed = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned rnd(unsigned *state)
+{
+    /* LCG from Numerical Recipes */
+    return (*state = *state * 1664525 + 1013904223) >> 8;
+}
+
+static void string_init(PUNICODE_STRING String, PWSTR Buffer, const char *Str)
+{
+    ULONG Length;
+    for (Length = 0; Str[Length]; Length++)
+        Buffer[Length] = (unsigned char)Str[Length];
+    String->Length = String->MaximumLength = (USHORT)(Length * sizeof(WCHAR));
+    String->Buffer = Buffer;
+}
+
+static void string_upcase(PUNICODE_STRING String)
+{
+    for (ULONG I = 0; String->Length / sizeof(WCHAR) > I; I++)
+        String->Buffer[I] = RtlUpcaseUnicodeChar(String->Buffer[I]);
+}
+
+static void string_print(const char *Label, PUNICODE_STRING String)
+{
+    fprintf(stderr, "%s=\"", Label);
+    for (ULONG I = 0; String->Length / sizeof(WCHAR) > I; I++)
+        fprintf(stderr, 0x80 > String->Buffer[I] ? "%c" : "\\x%x", String->Buffer[I]);
+    fprintf(stderr, "\"");
+}
+
+static void name_random(PWSTR Buffer, ULONG *PLength, unsigned *Seed)
+{
+    /* few distinct characters, so that random patterns actually match */
+    static const WCHAR Chars[] =
+    {
+        L'a', L'b', L'A', L'B', L'.', L'.', L'x', L'_', 0xe9, 0xc9, 0xff, 0x178, 0x8000,
+    };
+    ULONG Length = rnd(Seed) % 24;
+    for (ULONG J = 0; Length > J; J++)
+        Buffer[J] = Chars[rnd(Seed) % (sizeof Chars / sizeof Chars[0])];
+    *PLength = Length;
+}
+
+static void pattern_random(PWSTR Buffer, ULONG *PLength, unsigned *Seed)
+{
+    static const WCHAR Wilds[] =
+    {
+        L'*', L'?', L'<', L'>', L'"',
+    };
+    ULONG Length;
+
+    name_random(Buffer + 1, &Length, Seed);
+    switch (rnd(Seed) % 7)
+    {
+    case 0:
+        /* exact */
+        memmove(Buffer, Buffer + 1, Length * sizeof(WCHAR));
+        break;
+    case 1:
+        /* suffix */
+        Buffer[0] = L'*';
+        Length++;
+        break;
+    case 2:
+        /* prefix */
+        memmove(Buffer, Buffer + 1, Length * sizeof(WCHAR));
+        Buffer[Length++] = L'*';
+        break;
+    case 4:
+        /* DOS_STAR suffix, as produced by FindFirstFile for "*.ext" */
+        memmove(Buffer + 2, Buffer + 1, Length * sizeof(WCHAR));
+        Buffer[0] = L'<';
+        Buffer[1] = L'.';
+        Length += 2;
+        break;
+    case 3:
+        /* match all */
+        Buffer[0] = L'*';
+        Length = 1;
+        break;
+    default:
+        /* generic */
+        memmove(Buffer, Buffer + 1, Length * sizeof(WCHAR));
+        for (ULONG K = 1 + rnd(Seed) % 3; 0 < K; K--)
+            if (0 < Length)
+                Buffer[rnd(Seed) % Length] = Wilds[rnd(Seed) % (sizeof Wilds / sizeof Wilds[0])];
+        break;
+    }
+    *PLength = Length;
+}
+
+static int test(unsigned Count)
+{
+    WCHAR PatternBuf[NAME_MAX_LENGTH], NameBuf[NAME_MAX_LENGTH];
+    UNICODE_STRING Expression, Name;
+    FSP_FILE_NAME_PATTERN Pattern;
+    ULONG Length, Kinds[5] = { 0 }, Matches = 0;
+    BOOLEAN IgnoreCase, Result, Expected;
+    unsigned Seed = OptSeed;
+
+    /* FindFirstFile sends "*.ext" as "<.ext"; it takes the suffix path only when ext has no dots */
+    string_init(&Expression, PatternBuf, "<.obj");
+    FspFileNamePatternCompile(&Pattern, &Expression);
+    if (FspFileNamePatternSuffix != Pattern.Kind)
+    {
+        fprintf(stderr, "<.obj: kind=%u (expected suffix)\n", Pattern.Kind);
+        return 1;
+    }
+    string_init(&Expression, PatternBuf, "<.tar.gz");
+    FspFileNamePatternCompile(&Pattern, &Expression);
+    if (FspFileNamePatternGeneric != Pattern.Kind)
+    {
+        fprintf(stderr, "<.tar.gz: kind=%u (expected generic)\n", Pattern.Kind);
+        return 1;
+    }
+
+    for (unsigned I = 0; Count > I; I++)
+    {
+        IgnoreCase = I & 1;
+
+        pattern_random(PatternBuf, &Length, &Seed);
+        Expression.Length = Expression.MaximumLength = (USHORT)(Length * sizeof(WCHAR));
+        Expression.Buffer = PatternBuf;
+        if (IgnoreCase)
+            string_upcase(&Expression);
+        FspFileNamePatternCompile(&Pattern, &Expression);
+        Kinds[Pattern.Kind]++;
+
+        for (unsigned J = 0; 16 > J; J++)
+        {
+            if (0 == J % 4 && FspFileNamePatternGeneric != Pattern.Kind)
+            {
+                /* derive a name from the pattern; random names rarely match long literals */
+                for (Length = 0; Expression.Length / sizeof(WCHAR) > Length; Length++)
+                    NameBuf[Length] = L'*' == PatternBuf[Length] || L'<' == PatternBuf[Length] ?
+                        L'x' : PatternBuf[Length];
+                if (IgnoreCase && 0 < Length)
+                    NameBuf[rnd(&Seed) % Length] |= 0 == J % 8 ? 0x20 : 0;
+            }
+            else
+                name_random(NameBuf, &Length, &Seed);
+            Name.Length = Name.MaximumLength = (USHORT)(Length * sizeof(WCHAR));
+            Name.Buffer = NameBuf;
+
+            FspFileNamePatternMatch(&Pattern, &Name, IgnoreCase, &Result);
+            FspFileNameInExpression(&Expression, &Name, IgnoreCase, 0, &Expected);
+            if (Result != Expected)
+            {
+                fprintf(stderr, "mismatch: ");
+                string_print("pattern", &Expression);
+                fprintf(stderr, " ");
+                string_print("name", &Name);
+                fprintf(stderr, " ignorecase=%d kind=%u result=%d expected=%d\n",
+                    IgnoreCase, Pattern.Kind, Result, Expected);
+                return 1;
+            }
+            Matches += Result;
+        }
+    }
+
+    printf("%u patterns: generic=%lu matchall=%lu exact=%lu prefix=%lu suffix=%lu; "
+        "%lu of %u names matched\n",
+        Count,
+        (unsigned long)Kinds[FspFileNamePatternGeneric],
+        (unsigned long)Kinds[FspFileNamePatternMatchAll],
+        (unsigned long)Kinds[FspFileNamePatternExact],
+        (unsigned long)Kinds[FspFileNamePatternPrefix],
+        (unsigned long)Kinds[FspFileNamePatternSuffix],
+        (unsigned long)Matches, Count * 16);
+
+    return 0;
+}
+
+static void bench(const char *Shape, const char *PatternStr, unsigned Count,
+    const char *Format)
+{
+    WCHAR PatternBuf[NAME_MAX_LENGTH];
+    UNICODE_STRING Expression, *Names;
+    FSP_FILE_NAME_PATTERN Pattern;
+    PWSTR NameBufs;
+    char Name[NAME_MAX_LENGTH];
+    ULONG CompiledMatches = 0, GenericMatches = 0;
+    BOOLEAN Result;
+    double CompiledTime = 0, GenericTime = 0, T;
+    static const char *Kinds[] =
+    {
+        "generic", "matchall", "exact", "prefix", "suffix",
+    };
+
+    Names = malloc(Count * sizeof *Names);
+    NameBufs = malloc(Count * NAME_MAX_LENGTH * sizeof(WCHAR));
+    for (unsigned I = 0; Count > I; I++)
+    {
+        snprintf(Name, sizeof Name, Format, I, I % 7);
+        string_init(&Names[I], NameBufs + I * NAME_MAX_LENGTH, Name);
+    }
+
+    string_init(&Expression, PatternBuf, PatternStr);
+    string_upcase(&Expression);
+    FspFileNamePatternCompile(&Pattern, &Expression);
+
+    for (unsigned R = 0; OptRepeat > R; R++)
+    {
+        CompiledMatches = 0;
+        T = now();
+        for (unsigned I = 0; Count > I; I++)
+        {
+            FspFileNamePatternMatch(&Pattern, &Names[I], TRUE, &Result);
+            CompiledMatches += Result;
+        }
+        T = now() - T;
+        if (0 == R || CompiledTime > T)
+            CompiledTime = T;
+
+        GenericMatches = 0;
+        T = now();
+        for (unsigned I = 0; Count > I; I++)
+        {
+            FspFileNameInExpression(&Expression, &Names[I], TRUE, 0, &Result);
+            GenericMatches += Result;
+        }
+        T = now() - T;
+        if (0 == R || GenericTime > T)
+            GenericTime = T;
+    }
+
+    if (CompiledMatches != GenericMatches)
+    {
+        fprintf(stderr, "%s/%s: compiled matcher found %lu names, generic matcher %lu\n",
+            Shape, PatternStr, (unsigned long)CompiledMatches, (unsigned long)GenericMatches);
+        exit(1);
+    }
+
+    printf("%-10s %-22s %-8s %8u %8lu %12.3f %12.3f %8.2fx\n",
+        Shape, PatternStr, Kinds[Pattern.Kind], Count, (unsigned long)CompiledMatches,
+        CompiledTime * 1e3, GenericTime * 1e3, GenericTime / CompiledTime);
+
+    free(NameBufs);
+    free(Names);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: pattern-bench [-t] [-r REPEAT] [-s SEED] [COUNT]\n"
+        "\n"
+        "    -t          test the compiled matcher against the reference matcher\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -s SEED     seed for random names and patterns [0]\n"
+        "    COUNT       directory size (or pattern count with -t) [1000000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned Count = 1000000;
+    BOOLEAN OptTest = FALSE;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-t", argv[I]))
+            OptTest = TRUE;
+        else if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-s", argv[I]) && argc > I + 1)
+            OptSeed = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0])
+            usage();
+        else
+            Count = strtoul(argv[I], 0, 0);
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+
+    if (OptTest)
+        return test(Count);
+
+    printf("%-10s %-22s %-8s %8s %8s %12s %12s %9s\n",
+        "SHAPE", "PATTERN", "KIND", "COUNT", "MATCHES", "COMPILED(ms)", "GENERIC(ms)", "SPEEDUP");
+    bench("numbered", "*", Count, "IMG_%08u.JPG");
+    bench("numbered", "*.jpg", Count, "IMG_%08u.JPG");
+    bench("numbered", "img_0000*", Count, "IMG_%08u.JPG");
+    bench("numbered", "IMG_00001234.JPG", Count, "IMG_%08u.JPG");
+    bench("tree", "*.obj", Count, "component_controller_%u.%u.obj");
+    bench("tree", "<.obj", Count, "component_controller_%u.%u.obj");
+    bench("tree", "*_controller_1?.?.obj", Count, "component_controller_%u.%u.obj");
+    bench("tree", "component_controller_*", Count, "component_controller_%u.%u.obj");
+
+    return 0;
+}
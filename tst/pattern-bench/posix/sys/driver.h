@@ -0,0 +1,148 @@
+/**
+ * @file pattern-bench/posix/sys/driver.h
+ *
+ * Just enough of the FSD environment to compile sys/pattern.c on a POSIX system.
+ * Compile with -fshort-wchar so that L"" literals are UTF-16 like on Windows.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_SYS_DRIVER_H_INCLUDED
+#define WINFSP_SYS_DRIVER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#if WCHAR_MAX > 0xffff
+#error compile with -fshort-wchar
+#endif
+
+typedef void VOID;
+typedef wchar_t WCHAR, *PWSTR, *PWCH;
+typedef uint8_t BOOLEAN, *PBOOLEAN;
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef int32_t NTSTATUS;
+
+#define TRUE                            1
+#define FALSE                           0
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+#define PAGED_CODE()                    ((void)0)
+#define RtlZeroMemory(P, S)             memset(P, 0, S)
+
+typedef struct
+{
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+/* ASCII and Latin-1 only; enough to exercise the non-ASCII path of the matcher */
+static inline WCHAR RtlUpcaseUnicodeChar(WCHAR C)
+{
+    if ((L'a' <= C && C <= L'z') || (0xe0 <= C && C <= 0xfe && 0xf7 != C))
+        return C - 0x20;
+    if (0xff == C)
+        return 0x178;
+    return C;
+}
+
+/*
+ * Reference matcher for the generic path; follows the FsRtlIsNameInExpression rules
+ * for *, ?, DOS_STAR (<), DOS_QM (>) and DOS_DOT (").
+ */
+static BOOLEAN FspFileNameInExpressionRef(PWSTR E, PWSTR EEnd, PWSTR N, PWSTR NEnd,
+    BOOLEAN IgnoreCase)
+{
+    PWSTR P, LastDot;
+
+    for (; EEnd > E; E++)
+    {
+        switch (*E)
+        {
+        case L'*':
+            for (P = N; NEnd >= P; P++)
+                if (FspFileNameInExpressionRef(E + 1, EEnd, P, NEnd, IgnoreCase))
+                    return TRUE;
+            return FALSE;
+        case L'<':
+            for (LastDot = 0, P = N; NEnd > P; P++)
+                if (L'.' == *P)
+                    LastDot = P;
+            for (P = N; (0 != LastDot ? LastDot : NEnd) >= P; P++)
+                if (FspFileNameInExpressionRef(E + 1, EEnd, P, NEnd, IgnoreCase))
+                    return TRUE;
+            return FALSE;
+        case L'?':
+            if (NEnd == N)
+                return FALSE;
+            N++;
+            break;
+        case L'>':
+            if (NEnd != N && L'.' != *N)
+                N++;
+            break;
+        case L'"':
+            if (NEnd != N && L'.' == *N)
+                N++;
+            else if (NEnd != N)
+                return FALSE;
+            break;
+        default:
+            if (NEnd == N || *E != (IgnoreCase ? RtlUpcaseUnicodeChar(*N) : *N))
+                return FALSE;
+            N++;
+            break;
+        }
+    }
+
+    return NEnd == N;
+}
+
+static inline NTSTATUS FspFileNameInExpression(
+    PUNICODE_STRING Expression,
+    PUNICODE_STRING Name,
+    BOOLEAN IgnoreCase,
+    PWCH UpcaseTable,
+    PBOOLEAN PResult)
+{
+    *PResult = FspFileNameInExpressionRef(
+        Expression->Buffer, Expression->Buffer + Expression->Length / sizeof(WCHAR),
+        Name->Buffer, Name->Buffer + Name->Length / sizeof(WCHAR),
+        IgnoreCase);
+    return STATUS_SUCCESS;
+}
+
+/* compiled file name patterns; must match sys/driver.h */
+enum
+{
+    FspFileNamePatternGeneric           = 0,
+    FspFileNamePatternMatchAll,         /* "*" */
+    FspFileNamePatternExact,            /* "name" */
+    FspFileNamePatternPrefix,           /* "prefix*" */
+    FspFileNamePatternSuffix,           /* "*suffix" */
+};
+typedef struct
+{
+    UNICODE_STRING Expression;
+    USHORT Kind;
+    USHORT LiteralLength;               /* in WCHAR's */
+    PWSTR Literal;                      /* points into Expression */
+} FSP_FILE_NAME_PATTERN;
+
+#endif
@@ -0,0 +1,341 @@
+/**
+ * @file posix-bench.c
+ *
+ * Portable test and benchmark for the POSIX path mappings.
+ *
+ * Builds dll/posixpath.c against the shim in posix/dll/library.h. With -t the path
+ * mappings are checked against a reference transcoder on random paths; otherwise they
+ * are timed.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include "../../src/dll/posixpath.c"
+#include <stdio.h>
+#include <time.h>
+
+#define FAIL(...)                       do { fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } while (0)
+#define CHECK(e)                        do { if (!(e)) FAIL("%s:%d: CHECK(%s)", __FILE__, __LINE__, #e); } while (0)
+
+#define PATH_MAX_LENGTH                 96
+
+static unsigned OptRepeat = 3;
+static unsigned OptSeed = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned rnd(unsigned *state)
+{
+    /* LCG from Numerical Recipes */
+    return (*state = *state * 1664525 + 1013904223) >> 8;
+}
+
+static int wstrcmp(const WCHAR *s, const WCHAR *t)
+{
+    /* not wcscmp: WCHAR is 16-bit here, but the C library's wchar_t may not be */
+    for (; *s && *s == *t; s++, t++)
+        ;
+    return (int)*s - (int)*t;
+}
+
+/*
+ * paths
+ */
+
+static ULONG path_reference_w2p(const WCHAR *WindowsPath, char *PosixPath, BOOLEAN Translate)
+{
+    /* straightforward UTF-16 -> UTF-8 with the dll/posixpath.c translation rules */
+    unsigned char *q = (unsigned char *)PosixPath;
+    UINT32 c;
+
+    for (const WCHAR *p = WindowsPath; *p; p++)
+    {
+        c = *p;
+        if (0xd800 <= c && c <= 0xdbff && 0xdc00 <= p[1] && p[1] <= 0xdfff)
+            c = 0x10000 + (((c - 0xd800) << 10) | (p[1] - 0xdc00)), p++;
+        else if (0xd800 <= c && c <= 0xdfff)
+            c = 0xfffd;
+        else if (Translate && L'\\' == c)
+            c = '/';
+        else if (Translate && 0xf000 <= c && c <= 0xf07f && FspPosixIsInvalidPathChar(c & 0x7f))
+            c &= 0x7f;
+
+        if (0x80 > c)
+            *q++ = (unsigned char)c;
+        else if (0x800 > c)
+            *q++ = (unsigned char)(0xc0 | (c >> 6)),
+            *q++ = (unsigned char)(0x80 | (c & 0x3f));
+        else if (0x10000 > c)
+            *q++ = (unsigned char)(0xe0 | (c >> 12)),
+            *q++ = (unsigned char)(0x80 | ((c >> 6) & 0x3f)),
+            *q++ = (unsigned char)(0x80 | (c & 0x3f));
+        else
+            *q++ = (unsigned char)(0xf0 | (c >> 18)),
+            *q++ = (unsigned char)(0x80 | ((c >> 12) & 0x3f)),
+            *q++ = (unsigned char)(0x80 | ((c >> 6) & 0x3f)),
+            *q++ = (unsigned char)(0x80 | (c & 0x3f));
+    }
+    *q = '\0';
+
+    return (ULONG)((char *)q - PosixPath);
+}
+
+static BOOLEAN path_roundtrips(const WCHAR *WindowsPath, BOOLEAN Translate)
+{
+    /* whether POSIX -> Windows must give back WindowsPath */
+    for (const WCHAR *p = WindowsPath; *p; p++)
+    {
+        if (0xd800 <= *p && *p <= 0xdbff && 0xdc00 <= p[1] && p[1] <= 0xdfff)
+            p++;
+        else if (0xd800 <= *p && *p <= 0xdfff)
+            return FALSE;
+        else if (Translate && (L'/' == *p || FspPosixIsInvalidPathChar(*p)))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static void path_random(PWSTR Buffer, unsigned *Seed)
+{
+    /* long ASCII runs (to exercise the 16 character blocks) mixed with everything else */
+    static const WCHAR Chars[] =
+    {
+        L'\\', L'/', L':', L'*', L'?', L'|', 0x01,
+        0xe9, 0x7ff, 0x800, 0x20ac, 0xfffd, 0xffff,
+        0xf03a, 0xf02a, 0xf05c, 0xf041, 0xf0ff,
+        0xd83d, 0xde00, 0xdbff, 0xdfff,
+    };
+    ULONG Length = rnd(Seed) % PATH_MAX_LENGTH;
+    for (ULONG J = 0; Length > J; J++)
+        Buffer[J] = 0 != rnd(Seed) % 4 ?
+            (WCHAR)(L'a' + rnd(Seed) % 26) :
+            Chars[rnd(Seed) % (sizeof Chars / sizeof Chars[0])];
+    Buffer[Length] = L'\0';
+}
+
+static void path_check(const WCHAR *WindowsPath, BOOLEAN Translate)
+{
+    char Expected[PATH_MAX_LENGTH * 3 + 1], PosixBuffer[PATH_MAX_LENGTH * 3 + 1], *PosixPath;
+    WCHAR WindowsBuffer[PATH_MAX_LENGTH + 1], *WindowsPath2;
+    ULONG ExpectedSize, Size;
+
+    ExpectedSize = path_reference_w2p(WindowsPath, Expected, Translate) + 1;
+
+    /* Windows -> POSIX */
+    CHECK(NT_SUCCESS(FspPosixMapWindowsToPosixPathEx((PWSTR)WindowsPath, &PosixPath, Translate)));
+    if (0 != strcmp(Expected, PosixPath))
+        FAIL("Windows -> POSIX (Translate=%d): \"%s\" (expected \"%s\")",
+            Translate, PosixPath, Expected);
+    FspPosixDeletePath(PosixPath);
+
+    Size = ExpectedSize - 1;
+    CHECK(STATUS_BUFFER_TOO_SMALL ==
+        FspPosixMapWindowsToPosixPathBuffer((PWSTR)WindowsPath, PosixBuffer, &Size, Translate));
+    CHECK(ExpectedSize == Size);
+    CHECK(NT_SUCCESS(
+        FspPosixMapWindowsToPosixPathBuffer((PWSTR)WindowsPath, PosixBuffer, &Size, Translate)));
+    CHECK(ExpectedSize == Size && 0 == strcmp(Expected, PosixBuffer));
+    Size = sizeof PosixBuffer;
+    CHECK(NT_SUCCESS(
+        FspPosixMapWindowsToPosixPathBuffer((PWSTR)WindowsPath, PosixBuffer, &Size, Translate)));
+    CHECK(ExpectedSize == Size && 0 == strcmp(Expected, PosixBuffer));
+
+    if (!path_roundtrips(WindowsPath, Translate))
+        return;
+
+    /* POSIX -> Windows */
+    CHECK(NT_SUCCESS(FspPosixMapPosixToWindowsPathEx(Expected, &WindowsPath2, Translate)));
+    CHECK(0 == wstrcmp(WindowsPath, WindowsPath2));
+    FspPosixDeletePath(WindowsPath2);
+
+    ExpectedSize = (lstrlenW(WindowsPath) + 1) * sizeof(WCHAR);
+    Size = ExpectedSize - 1;
+    CHECK(STATUS_BUFFER_TOO_SMALL ==
+        FspPosixMapPosixToWindowsPathBuffer(Expected, WindowsBuffer, &Size, Translate));
+    CHECK(ExpectedSize == Size);
+    CHECK(NT_SUCCESS(
+        FspPosixMapPosixToWindowsPathBuffer(Expected, WindowsBuffer, &Size, Translate)));
+    CHECK(ExpectedSize == Size && 0 == wstrcmp(WindowsPath, WindowsBuffer));
+    Size = sizeof WindowsBuffer;
+    CHECK(NT_SUCCESS(
+        FspPosixMapPosixToWindowsPathBuffer(Expected, WindowsBuffer, &Size, Translate)));
+    CHECK(ExpectedSize == Size && 0 == wstrcmp(WindowsPath, WindowsBuffer));
+}
+
+static void path_check_utf8(const char *PosixPath, const WCHAR *ExpectedPath)
+{
+    WCHAR *WindowsPath;
+
+    CHECK(NT_SUCCESS(FspPosixMapPosixToWindowsPathEx(PosixPath, &WindowsPath, TRUE)));
+    if (0 != wstrcmp(ExpectedPath, WindowsPath))
+    {
+        fprintf(stderr, "POSIX -> Windows: \"%s\":", PosixPath);
+        for (const WCHAR *p = WindowsPath; *p; p++)
+            fprintf(stderr, " %04x", *p);
+        FAIL("%s", "");
+    }
+    FspPosixDeletePath(WindowsPath);
+}
+
+static void path_test(unsigned Count)
+{
+    WCHAR WindowsPath[PATH_MAX_LENGTH + 1];
+    unsigned Seed = OptSeed;
+
+    path_check(L"", TRUE);
+    path_check(L"\\", TRUE);
+    path_check(L"\\a\\very\\long\\ascii\\path\\that\\spans\\several\\blocks.txt", TRUE);
+    path_check(L"\\a\\very\\long\\ascii\\path\\that\\spans\\several\\blocks.txt", FALSE);
+    path_check(L"\\0123456789abcde\xf03a", TRUE);
+
+    for (unsigned I = 0; Count > I; I++)
+    {
+        path_random(WindowsPath, &Seed);
+        path_check(WindowsPath, TRUE);
+        path_check(WindowsPath, FALSE);
+    }
+
+    /* invalid UTF-8 decodes to U+FFFD per maximal subpart */
+    path_check_utf8("/a\xff", L"\\a\xfffd");
+    path_check_utf8("/\xc0\xaf", L"\\\xfffd\xfffd");
+    path_check_utf8("/\xe0\x80\x80", L"\\\xfffd\xfffd\xfffd");
+    path_check_utf8("/\xed\xa0\x80", L"\\\xfffd\xfffd\xfffd");
+    path_check_utf8("/\xf0\x9f\x98", L"\\\xfffd");
+    path_check_utf8("/\xf4\x90\x80\x80", L"\\\xfffd\xfffd\xfffd\xfffd");
+    path_check_utf8("/0123456789abcdef\xe2\x82\xac:", L"\\0123456789abcdef\x20ac\xf03a");
+}
+
+static int test(unsigned Count)
+{
+    path_test(Count);
+
+    printf("OK (%s)\n", FspPosixPathSse2 ? "sse2" : "scalar");
+
+    return 0;
+}
+
+/*
+ * benchmark
+ */
+
+static void bench_report(const char *Name, unsigned Count, double Best)
+{
+    printf("%-24s %10u %12.3f %10.1f\n", Name, Count, Best * 1000, Best * 1e9 / Count);
+}
+
+static void bench(unsigned Count)
+{
+    PWSTR WindowsPath = L"\\Users\\billz\\Documents\\Projects\\winfsp\\src\\dll\\posix.c";
+    const char *PosixPath = "/Users/billz/Documents/Projects/winfsp/src/dll/posix.c";
+    char PosixBuffer[256];
+    WCHAR WindowsBuffer[256];
+    PVOID Path;
+    ULONG Size;
+    double Start, Best;
+    volatile UINT32 Sink = 0;
+
+#define BENCH(Name, Body)               \
+    do                                  \
+    {                                   \
+        Best = 1e9;                     \
+        for (unsigned R = 0; OptRepeat > R; R++)\
+        {                               \
+            Start = now();              \
+            for (unsigned I = 0; Count > I; I++)\
+                Body;                   \
+            Start = now() - Start;      \
+            if (Best > Start)           \
+                Best = Start;           \
+        }                               \
+        bench_report(Name, Count, Best);\
+    } while (0)
+
+    printf("%-24s %10s %12s %10s\n", "MAPPING", "COUNT", "TIME(ms)", "NS/OP");
+
+    BENCH("windows->posix (Ex)", do
+    {
+        FspPosixMapWindowsToPosixPathEx(WindowsPath, (char **)&Path, TRUE);
+        FspPosixDeletePath(Path);
+    } while (0));
+
+    BENCH("windows->posix (Buffer)", do
+    {
+        Size = sizeof PosixBuffer;
+        FspPosixMapWindowsToPosixPathBuffer(WindowsPath, PosixBuffer, &Size, TRUE);
+        Sink += Size;
+    } while (0));
+
+    BENCH("posix->windows (Ex)", do
+    {
+        FspPosixMapPosixToWindowsPathEx(PosixPath, (PWSTR *)&Path, TRUE);
+        FspPosixDeletePath(Path);
+    } while (0));
+
+    BENCH("posix->windows (Buffer)", do
+    {
+        Size = sizeof WindowsBuffer;
+        FspPosixMapPosixToWindowsPathBuffer(PosixPath, WindowsBuffer, &Size, TRUE);
+        Sink += Size;
+    } while (0));
+
+#undef BENCH
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: posix-bench [-t] [-r REPEAT] [-s SEED] [COUNT]\n"
+        "\n"
+        "    -t          test the path mappings\n"
+        "    -r REPEAT   runs per measurement; the best run is reported [3]\n"
+        "    -s SEED     seed for random paths [0]\n"
+        "    COUNT       operations per measurement (or random path count with -t) [1000000]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned Count = 1000000;
+    BOOLEAN OptTest = FALSE;
+    int I;
+
+    for (I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-t", argv[I]))
+            OptTest = TRUE;
+        else if (0 == strcmp("-r", argv[I]) && argc > I + 1)
+            OptRepeat = strtoul(argv[++I], 0, 0);
+        else if (0 == strcmp("-s", argv[I]) && argc > I + 1)
+            OptSeed = strtoul(argv[++I], 0, 0);
+        else if ('-' == argv[I][0])
+            usage();
+        else
+            Count = strtoul(argv[I], 0, 0);
+    }
+    if (0 == OptRepeat)
+        OptRepeat = 1;
+
+    if (OptTest)
+        return test(Count);
+
+    printf("%s\n", FspPosixPathSse2 ? "sse2" : "scalar");
+    bench(Count);
+
+    return 0;
+}
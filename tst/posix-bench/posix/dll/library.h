@@ -0,0 +1,64 @@
+/**
+ * @file posix-bench/posix/dll/library.h
+ *
+ * Just enough of the DLL environment to compile dll/posixpath.c on a POSIX system.
+ * Compile with -fshort-wchar so that L"" literals are UTF-16 like on Windows.
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef WINFSP_DLL_LIBRARY_H_INCLUDED
+#define WINFSP_DLL_LIBRARY_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#if WCHAR_MAX > 0xffff
+#error compile with -fshort-wchar
+#endif
+
+typedef void VOID, *PVOID;
+typedef wchar_t WCHAR, *PWSTR;
+typedef uint8_t UINT8, *PUINT8, BOOLEAN;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32, *PUINT32, ULONG, *PULONG;
+typedef int32_t LONG, NTSTATUS;
+typedef uint64_t UINT64;
+
+#define TRUE                            1
+#define FALSE                           0
+#define MAXULONG                        0xffffffff
+#define FSP_API
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+
+#define MemAlloc                        malloc
+#define MemFree                         free
+
+static inline int lstrlenW(const WCHAR *s)
+{
+    const WCHAR *p = s;
+    while (*p)
+        p++;
+    return (int)(p - s);
+}
+#define lstrlenA(s)                     ((int)strlen(s))
+
+#endif
@@ -647,6 +647,143 @@ void create_notraverse_test(void)
         create_notraverse_dotest(MemfsNet, L"\\\\memfs\\share");
 }
 
+void create_notraverse_cache_dotest(ULONG Flags, PWSTR Prefix)
+{
+    MEMFS *Memfs;
+    NTSTATUS Result;
+    FSP_FILE_SYSTEM_ACCESS_CHECK_CACHE_STATISTICS Statistics;
+
+    static PWSTR Sddl = L"D:P(A;;GA;;;WD)";
+    static PWSTR Sddl2 = L"D:P(A;;GRGWSD;;;WD)";
+    PSECURITY_DESCRIPTOR SecurityDescriptor, SecurityDescriptor2;
+    SECURITY_ATTRIBUTES SecurityAttributes = { 0 };
+    LUID Luid;
+    TOKEN_PRIVILEGES Privileges;
+    HANDLE Handle, Token;
+    BOOLEAN Success;
+    WCHAR FilePath[MAX_PATH];
+
+    Result = MemfsCreate(
+        (OptCaseInsensitive ? MemfsCaseInsensitive : 0) | Flags,
+        1000,
+        1024,
+        1024 * 1024,
+        MemfsNet == Flags ? L"\\memfs\\share" : 0,
+        0,
+        &Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    Result = FspFileSystemGetAccessCheckCacheStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(STATUS_INVALID_DEVICE_STATE == Result);
+
+    Result = FspFileSystemSetAccessCheckCache(MemfsFileSystem(Memfs), 64, 60000);
+    ASSERT(NT_SUCCESS(Result));
+
+    Result = MemfsStart(Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    Success = ConvertStringSecurityDescriptorToSecurityDescriptorW(Sddl, SDDL_REVISION_1, &SecurityDescriptor, 0);
+    ASSERT(Success);
+    Success = ConvertStringSecurityDescriptorToSecurityDescriptorW(Sddl2, SDDL_REVISION_1, &SecurityDescriptor2, 0);
+    ASSERT(Success);
+
+    SecurityAttributes.nLength = sizeof SecurityAttributes;
+    SecurityAttributes.lpSecurityDescriptor = SecurityDescriptor;
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Success = CreateDirectoryW(FilePath, &SecurityAttributes);
+    ASSERT(Success);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\dir2",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Success = CreateDirectoryW(FilePath, &SecurityAttributes);
+    ASSERT(Success);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\dir2\\file0",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, 0, &SecurityAttributes, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    CloseHandle(Handle);
+
+    Success = LookupPrivilegeValueW(0, SE_CHANGE_NOTIFY_NAME, &Luid);
+    ASSERT(Success);
+    Success = OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &Token);
+    ASSERT(Success);
+    Privileges.PrivilegeCount = 1;
+    Privileges.Privileges[0].Attributes = 0;
+    Privileges.Privileges[0].Luid = Luid;
+    Success = AdjustTokenPrivileges(Token, FALSE, &Privileges, 0, 0, 0);
+    ASSERT(Success);
+
+    /* the first open fills the cache, the second one is satisfied from it */
+    for (ULONG I = 0; 2 > I; I++)
+    {
+        Handle = CreateFileW(FilePath,
+            FILE_READ_ATTRIBUTES, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        CloseHandle(Handle);
+    }
+
+    Result = FspFileSystemGetAccessCheckCacheStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(64 == Statistics.Capacity);
+    ASSERT(3 <= Statistics.InsertCount);
+    ASSERT(1 <= Statistics.HitCount);
+
+    /* remove traverse access from dir1; the cached entries must not be used */
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Success = SetFileSecurityW(FilePath, DACL_SECURITY_INFORMATION, SecurityDescriptor2);
+    ASSERT(Success);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\dir2\\file0",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Handle = CreateFileW(FilePath,
+        FILE_READ_ATTRIBUTES, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE == Handle);
+    ASSERT(ERROR_ACCESS_DENIED == GetLastError());
+
+    Result = FspFileSystemGetAccessCheckCacheStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(1 <= Statistics.InvalidateCount);
+
+    Privileges.PrivilegeCount = 1;
+    Privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    Privileges.Privileges[0].Luid = Luid;
+    Success = AdjustTokenPrivileges(Token, FALSE, &Privileges, 0, 0, 0);
+    ASSERT(Success);
+    CloseHandle(Token);
+
+    Success = DeleteFileW(FilePath);
+    ASSERT(Success);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\dir2",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Success = RemoveDirectoryW(FilePath);
+    ASSERT(Success);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    Success = RemoveDirectoryW(FilePath);
+    ASSERT(Success);
+
+    LocalFree(SecurityDescriptor2);
+    LocalFree(SecurityDescriptor);
+
+    MemfsStop(Memfs);
+    MemfsDelete(Memfs);
+}
+
+void create_notraverse_cache_test(void)
+{
+    if (WinFspDiskTests)
+        create_notraverse_cache_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        create_notraverse_cache_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
 void create_backup_dotest(ULONG Flags, PWSTR Prefix)
 {
     void *memfs = memfs_start(Flags);
@@ -1141,6 +1278,8 @@ void create_tests(void)
     TEST(create_sd_test);
     if (!OptNoTraverseToken && !OptShareName)
         TEST(create_notraverse_test);
+    if (!OptNoTraverseToken && !OptShareName && !OptExternal && !OptMountPoint)
+        TEST(create_notraverse_cache_test);
     TEST(create_backup_test);
     TEST(create_restore_test);
     TEST(create_share_test);
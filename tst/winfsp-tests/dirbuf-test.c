@@ -17,6 +17,7 @@
 
 #include <winfsp/winfsp.h>
 #include <tlib/testsuite.h>
+#include <strsafe.h>
 #include <time.h>
 
 #include "winfsp-tests.h"
@@ -314,6 +315,392 @@ static void dirbuf_fill_test(void)
         dirbuf_fill_dotest(seed + I, 10000);
 }
 
+static ULONG dirbuf_stream_count;
+
+static DWORD WINAPI dirbuf_stream_producer(PVOID DirStream)
+{
+    NTSTATUS Result;
+    BOOLEAN Success;
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + MAX_PATH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D;
+    ULONG N;
+
+    for (ULONG I = 0; dirbuf_stream_count + 2 > I; I++)
+    {
+        memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+
+        if (0 == I)
+            StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L".");
+        else if (1 == I)
+            StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L"..");
+        else
+            StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L"file%08lu%s", I - 2,
+                0 == I % 7 ? L"-with-a-longer-name" : L"");
+        N = (ULONG)wcslen(DirInfo->FileNameBuf);
+        DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + N * sizeof(WCHAR));
+
+        Success = FspFileSystemFillDirectoryStream(DirStream, DirInfo, &Result);
+        ASSERT(Success);
+        ASSERT(STATUS_SUCCESS == Result);
+    }
+
+    FspFileSystemReleaseDirectoryStream(DirStream, STATUS_SUCCESS);
+
+    return 0;
+}
+
+static void dirbuf_stream_dotest(ULONG Count, ULONG WindowSize, ULONG Length)
+{
+    PVOID DirStream = 0;
+    NTSTATUS Result;
+    BOOLEAN Success;
+    HANDLE Thread;
+    FSP_FSCTL_DIR_INFO *DirInfo, *DirInfoEnd;
+    PUINT8 Buffer;
+    ULONG BytesTransferred;
+    WCHAR FileName[MAX_PATH], Marker[MAX_PATH];
+    ULONG N, FileNameLength;
+    BOOLEAN Done;
+
+    dirbuf_stream_count = Count;
+
+    Buffer = malloc(Length);
+    ASSERT(0 != Buffer);
+
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireDirectoryStream(&DirStream, TRUE, WindowSize, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    Thread = CreateThread(0, 0, dirbuf_stream_producer, &DirStream, 0, 0);
+    ASSERT(0 != Thread);
+
+    N = 0;
+    Done = FALSE;
+    Marker[0] = L'\0';
+    while (!Done)
+    {
+        BytesTransferred = 0;
+        Result = FspFileSystemReadDirectoryStream(&DirStream, 0 == N ? 0 : Marker,
+            Buffer, Length, &BytesTransferred);
+        ASSERT(STATUS_SUCCESS == Result);
+        ASSERT(0 != BytesTransferred);
+
+        for (
+            DirInfo = (PVOID)Buffer, DirInfoEnd = (PVOID)(Buffer + BytesTransferred);
+            DirInfoEnd > DirInfo;
+            DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)), N++)
+        {
+            if (0 == DirInfo->Size)
+            {
+                Done = TRUE;
+                break;
+            }
+
+            if (0 == N)
+                StringCbPrintfW(FileName, sizeof FileName, L".");
+            else if (1 == N)
+                StringCbPrintfW(FileName, sizeof FileName, L"..");
+            else
+                StringCbPrintfW(FileName, sizeof FileName, L"file%08lu%s", N - 2,
+                    0 == N % 7 ? L"-with-a-longer-name" : L"");
+            FileNameLength = (ULONG)wcslen(FileName);
+
+            ASSERT(FileNameLength == (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR));
+            ASSERT(0 == memcmp(FileName, DirInfo->FileNameBuf, FileNameLength * sizeof(WCHAR)));
+
+            memcpy(Marker, FileName, (FileNameLength + 1) * sizeof(WCHAR));
+        }
+    }
+    ASSERT(Count + 2 == N);
+
+    WaitForSingleObject(Thread, INFINITE);
+    CloseHandle(Thread);
+
+    FspFileSystemDeleteDirectoryStream(&DirStream);
+
+    free(Buffer);
+}
+
+static void dirbuf_stream_test(void)
+{
+    dirbuf_stream_dotest(0, 0, 4096);
+    dirbuf_stream_dotest(10, 0, 4096);
+    dirbuf_stream_dotest(10000, 0, 4096);
+    dirbuf_stream_dotest(10000, 4096, 4096);
+    dirbuf_stream_dotest(10000, 1024, 65536);
+    dirbuf_stream_dotest(1000, 256, 512);
+}
+
+static void dirbuf_stream_partial_test(void)
+{
+    PVOID DirStream = 0;
+    NTSTATUS Result;
+    BOOLEAN Success;
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + MAX_PATH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D, *DirInfoEnd;
+    PUINT8 Buffer;
+    ULONG Length = 4096, BytesTransferred, N;
+
+    Buffer = malloc(Length);
+    ASSERT(0 != Buffer);
+
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireDirectoryStream(&DirStream, TRUE, 0, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    for (ULONG I = 1; 2 >= I; I++)
+    {
+        memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+        DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + I * sizeof(WCHAR));
+        DirInfo->FileNameBuf[0] = L'.';
+        DirInfo->FileNameBuf[1] = 2 == I ? L'.' : L'\0';
+        Success = FspFileSystemFillDirectoryStream(&DirStream, DirInfo, &Result);
+        ASSERT(Success);
+        ASSERT(STATUS_SUCCESS == Result);
+    }
+
+    /* the producer is behind: a read returns the entries available without blocking */
+    BytesTransferred = 0;
+    Result = FspFileSystemReadDirectoryStream(&DirStream, 0, Buffer, Length, &BytesTransferred);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(0 != BytesTransferred);
+    for (
+        DirInfo = (PVOID)Buffer, DirInfoEnd = (PVOID)(Buffer + BytesTransferred), N = 0;
+        DirInfoEnd > DirInfo;
+        DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)), N++)
+        ASSERT(0 != DirInfo->Size);
+    ASSERT(2 == N);
+
+    DirInfo = &DirInfoBuf.D;
+    memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+    DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + sizeof(WCHAR));
+    DirInfo->FileNameBuf[0] = L'a';
+    Success = FspFileSystemFillDirectoryStream(&DirStream, DirInfo, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    FspFileSystemReleaseDirectoryStream(&DirStream, STATUS_SUCCESS);
+
+    BytesTransferred = 0;
+    Result = FspFileSystemReadDirectoryStream(&DirStream, L"..", Buffer, Length, &BytesTransferred);
+    ASSERT(STATUS_SUCCESS == Result);
+    DirInfo = (PVOID)Buffer;
+    ASSERT(sizeof(FSP_FSCTL_DIR_INFO) + sizeof(WCHAR) == DirInfo->Size);
+    ASSERT(L'a' == DirInfo->FileNameBuf[0]);
+    DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size));
+    ASSERT(0 == DirInfo->Size);
+
+    FspFileSystemDeleteDirectoryStream(&DirStream);
+
+    free(Buffer);
+}
+
+static void dirbuf_stream_order_test(void)
+{
+    PVOID DirStream = 0;
+    NTSTATUS Result;
+    BOOLEAN Success;
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + MAX_PATH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D;
+
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireDirectoryStream(&DirStream, FALSE, 0, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+    DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + sizeof(WCHAR));
+    DirInfo->FileNameBuf[0] = L'b';
+    Success = FspFileSystemFillDirectoryStream(&DirStream, DirInfo, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    DirInfo->FileNameBuf[0] = L'a';
+    Success = FspFileSystemFillDirectoryStream(&DirStream, DirInfo, &Result);
+    ASSERT(!Success);
+    ASSERT(STATUS_INVALID_PARAMETER == Result);
+
+    DirInfo->FileNameBuf[0] = L'b';
+    Success = FspFileSystemFillDirectoryStream(&DirStream, DirInfo, &Result);
+    ASSERT(!Success);
+    ASSERT(STATUS_INVALID_PARAMETER == Result);
+
+    FspFileSystemReleaseDirectoryStream(&DirStream, STATUS_SUCCESS);
+
+    FspFileSystemDeleteDirectoryStream(&DirStream);
+}
+
+static ULONG dirbuf_cache_fill_count;
+
+static NTSTATUS dirbuf_cache_read(FSP_FILE_SYSTEM *FileSystem, PWSTR DirName, PVOID *PDirBuffer,
+    PWSTR Marker, PVOID Buffer, ULONG Length, PULONG PBytesTransferred, NTSTATUS FillResult)
+{
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + MAX_PATH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D;
+    NTSTATUS Result;
+
+    if (FspFileSystemAcquireCachedDirectoryBuffer(FileSystem, DirName, PDirBuffer, 0 == Marker, &Result))
+    {
+        dirbuf_cache_fill_count++;
+
+        for (ULONG I = 0; 100 > I; I++)
+        {
+            memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+            StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L"file%03lu", 99 - I);
+            DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + 7 * sizeof(WCHAR));
+            if (!FspFileSystemFillDirectoryBuffer(PDirBuffer, DirInfo, &Result))
+                break;
+        }
+        if (NT_SUCCESS(Result))
+            Result = FillResult;
+
+        FspFileSystemReleaseCachedDirectoryBuffer(FileSystem, PDirBuffer, Result);
+    }
+
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    *PBytesTransferred = 0;
+    FspFileSystemReadDirectoryBuffer(PDirBuffer, Marker, Buffer, Length, PBytesTransferred);
+
+    return STATUS_SUCCESS;
+}
+
+static ULONG dirbuf_cache_enumerate(FSP_FILE_SYSTEM *FileSystem, PWSTR DirName,
+    NTSTATUS FillResult)
+{
+    PVOID DirBuffer = 0;
+    NTSTATUS Result;
+    UINT8 Buffer[1024];
+    ULONG BytesTransferred;
+    FSP_FSCTL_DIR_INFO *DirInfo, *DirInfoEnd;
+    WCHAR FileName[MAX_PATH], Marker[MAX_PATH];
+    ULONG N = 0;
+    BOOLEAN Done = FALSE;
+
+    while (!Done)
+    {
+        Result = dirbuf_cache_read(FileSystem, DirName, &DirBuffer, 0 == N ? 0 : Marker,
+            Buffer, sizeof Buffer, &BytesTransferred, FillResult);
+        if (!NT_SUCCESS(Result))
+        {
+            ASSERT(FillResult == Result);
+            FspFileSystemDeleteDirectoryBuffer(&DirBuffer);
+            return (ULONG)-1;
+        }
+
+        for (
+            DirInfo = (PVOID)Buffer, DirInfoEnd = (PVOID)(Buffer + BytesTransferred);
+            DirInfoEnd > DirInfo;
+            DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)), N++)
+        {
+            if (0 == DirInfo->Size)
+            {
+                Done = TRUE;
+                break;
+            }
+
+            StringCbPrintfW(FileName, sizeof FileName, L"file%03lu", N);
+            ASSERT(7 == (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR));
+            ASSERT(0 == memcmp(FileName, DirInfo->FileNameBuf, 7 * sizeof(WCHAR)));
+
+            memcpy(Marker, FileName, 8 * sizeof(WCHAR));
+        }
+    }
+
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer);
+
+    return N;
+}
+
+static void dirbuf_cache_test(void)
+{
+    /* the directory cache only needs a file system object that has not been started */
+    FSP_FILE_SYSTEM FileSystem;
+    FSP_FILE_SYSTEM_DIRECTORY_CACHE_STATISTICS Statistics;
+    PVOID DirBuffer;
+    NTSTATUS Result;
+    BOOLEAN Success;
+    UINT8 Buffer[1024];
+    ULONG BytesTransferred;
+
+    memset(&FileSystem, 0, sizeof FileSystem);
+    Result = FspFileSystemSetDirectoryCache(&FileSystem, 16, 60000, FALSE);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    dirbuf_cache_fill_count = 0;
+
+    /* second handle shares the listing; names compare case-insensitively */
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir", STATUS_SUCCESS));
+    ASSERT(1 == dirbuf_cache_fill_count);
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\DIR", STATUS_SUCCESS));
+    ASSERT(1 == dirbuf_cache_fill_count);
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir\\sub", STATUS_SUCCESS));
+    ASSERT(2 == dirbuf_cache_fill_count);
+
+    /* a change to a file in the directory invalidates the directory only */
+    FspFileSystemInvalidateDirectoryCache(&FileSystem, L"\\dir\\file");
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir", STATUS_SUCCESS));
+    ASSERT(3 == dirbuf_cache_fill_count);
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir\\sub", STATUS_SUCCESS));
+    ASSERT(3 == dirbuf_cache_fill_count);
+
+    /* a change to a directory invalidates the directories under it */
+    FspFileSystemInvalidateDirectoryCache(&FileSystem, L"\\dir");
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir\\sub", STATUS_SUCCESS));
+    ASSERT(4 == dirbuf_cache_fill_count);
+
+    /* a failed listing is not cached */
+    FspFileSystemInvalidateDirectoryCache(&FileSystem, 0);
+    ASSERT((ULONG)-1 == dirbuf_cache_enumerate(&FileSystem, L"\\dir", STATUS_ACCESS_DENIED));
+    ASSERT(5 == dirbuf_cache_fill_count);
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir", STATUS_SUCCESS));
+    ASSERT(6 == dirbuf_cache_fill_count);
+
+    /* refilling a shared listing through the regular API detaches from it */
+    DirBuffer = 0;
+    Result = dirbuf_cache_read(&FileSystem, L"\\dir", &DirBuffer, 0,
+        Buffer, sizeof Buffer, &BytesTransferred, STATUS_SUCCESS);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(6 == dirbuf_cache_fill_count);
+    Success = FspFileSystemAcquireDirectoryBuffer(&DirBuffer, TRUE, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+    FspFileSystemReleaseDirectoryBuffer(&DirBuffer);
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer);
+    ASSERT(100 == dirbuf_cache_enumerate(&FileSystem, L"\\dir", STATUS_SUCCESS));
+    ASSERT(6 == dirbuf_cache_fill_count);
+
+    Result = FspFileSystemGetDirectoryCacheStatistics(&FileSystem, &Statistics);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(16 == Statistics.Capacity);
+    ASSERT(6 == Statistics.MissCount);
+    ASSERT(5 == Statistics.InsertCount);
+
+    Result = FspFileSystemSetDirectoryCache(&FileSystem, 0, 0, FALSE);
+    ASSERT(STATUS_SUCCESS == Result);
+    Result = FspFileSystemGetDirectoryCacheStatistics(&FileSystem, &Statistics);
+    ASSERT(STATUS_INVALID_DEVICE_STATE == Result);
+}
+
 void dirbuf_tests(void)
 {
     if (OptExternal)
@@ -322,4 +709,8 @@ void dirbuf_tests(void)
     TEST(dirbuf_empty_test);
     TEST(dirbuf_dots_test);
     TEST(dirbuf_fill_test);
+    TEST(dirbuf_stream_test);
+    TEST(dirbuf_stream_partial_test);
+    TEST(dirbuf_stream_order_test);
+    TEST(dirbuf_cache_test);
 }
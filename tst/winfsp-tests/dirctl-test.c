@@ -410,6 +410,232 @@ void querydir_buffer_overflow_test(void)
     }
 }
 
+/*
+ * Listings larger than a single DirInfo cache chunk. The file names are long so that the
+ * directory spans several chunks; names are numbered so that a listing can be checked to
+ * return every file exactly once and in order.
+ */
+#define QUERYDIR_CHUNKS_FILE_COUNT      600
+
+static void querydir_chunks_create(PWSTR DirPath, BOOLEAN Delete)
+{
+    WCHAR FilePath[MAX_PATH];
+    HANDLE Handle;
+    BOOL Success;
+
+    if (!Delete)
+    {
+        Success = CreateDirectoryW(DirPath, 0);
+        ASSERT(Success);
+    }
+
+    for (ULONG I = 1; QUERYDIR_CHUNKS_FILE_COUNT >= I; I++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file%04uABCDEFGHIJKLMNOPQRSTUVXWYZ",
+            DirPath, I);
+        if (!Delete)
+        {
+            Handle = CreateFileW(FilePath, GENERIC_ALL, 0, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+            ASSERT(INVALID_HANDLE_VALUE != Handle);
+            CloseHandle(Handle);
+        }
+        else
+        {
+            Success = DeleteFileW(FilePath);
+            ASSERT(Success);
+        }
+    }
+
+    if (Delete)
+    {
+        Success = RemoveDirectoryW(DirPath);
+        ASSERT(Success);
+    }
+}
+
+static void querydir_chunks_list(HANDLE Handle, ULONG Length, BOOLEAN ReturnSingleEntry)
+{
+    NTSTATUS Status;
+    IO_STATUS_BLOCK IoStatus;
+    PUINT8 Buffer;
+    PFILE_DIRECTORY_INFORMATION DirInfo;
+    BOOLEAN RestartScan = TRUE;
+    ULONG FileCount = 0, FileNumber, LastFileNumber = 0;
+
+    Buffer = malloc(Length);
+    ASSERT(0 != Buffer);
+
+    for (;;)
+    {
+        Status = NtQueryDirectoryFile(
+            Handle,
+            0, 0, 0,
+            &IoStatus,
+            Buffer,
+            Length,
+            FileDirectoryInformation,
+            ReturnSingleEntry,
+            0,
+            RestartScan);
+        if (STATUS_NO_MORE_FILES == Status)
+            break;
+        ASSERT(STATUS_SUCCESS == Status);
+        RestartScan = FALSE;
+
+        for (DirInfo = (PVOID)Buffer;;
+            DirInfo = (PVOID)((PUINT8)DirInfo + DirInfo->NextEntryOffset))
+        {
+            if (8 <= DirInfo->FileNameLength / sizeof(WCHAR) &&
+                0 == mywcscmp(DirInfo->FileName, 4, L"file", 4))
+            {
+                FileNumber = 0;
+                for (ULONG I = 4; 8 > I; I++)
+                    FileNumber = FileNumber * 10 + (DirInfo->FileName[I] - L'0');
+
+                /* in order and without duplicates, including across chunk boundaries */
+                ASSERT(LastFileNumber < FileNumber);
+                LastFileNumber = FileNumber;
+                FileCount++;
+            }
+
+            if (0 == DirInfo->NextEntryOffset)
+                break;
+        }
+    }
+
+    ASSERT(QUERYDIR_CHUNKS_FILE_COUNT == FileCount);
+    ASSERT(QUERYDIR_CHUNKS_FILE_COUNT == LastFileNumber);
+
+    free(Buffer);
+}
+
+static void querydir_chunks_dotest(ULONG Flags, PWSTR Prefix)
+{
+    void *memfs = memfs_start_ex(Flags | MemfsLargeDirInfoCache, -1);
+
+    HANDLE Handle0, Handle1;
+    WCHAR DirPath[MAX_PATH];
+    FSP_FSCTL_STATISTICS Statistics0, Statistics1;
+
+    StringCbPrintfW(DirPath, sizeof DirPath, L"%s%s\\dir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    querydir_chunks_create(DirPath, FALSE);
+
+    Handle0 = CreateFileW(DirPath,
+        FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle0);
+
+    /* the first listing is built one continuation chunk at a time */
+    querydir_chunks_list(Handle0, 4096, FALSE);
+
+    memfs_get_statistics(Handle0, &Statistics0);
+
+    /* the cached listing is complete; marker seeks cross every chunk boundary */
+    Handle1 = CreateFileW(DirPath,
+        FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle1);
+    querydir_chunks_list(Handle1, 4096, FALSE);
+    querydir_chunks_list(Handle1, 4096, TRUE);
+    querydir_chunks_list(Handle1, 64 * 1024, FALSE);
+    querydir_chunks_list(Handle0, 1024, FALSE);
+
+    memfs_get_statistics(Handle0, &Statistics1);
+    ASSERT(Statistics1.DirInfoCache.Hits > Statistics0.DirInfoCache.Hits);
+    ASSERT(Statistics1.DirInfoCache.Misses == Statistics0.DirInfoCache.Misses);
+
+    CloseHandle(Handle1);
+    CloseHandle(Handle0);
+
+    querydir_chunks_create(DirPath, TRUE);
+
+    memfs_stop(memfs);
+}
+
+void querydir_chunks_test(void)
+{
+    if (OptShareName)
+        return;
+
+    if (WinFspDiskTests)
+        querydir_chunks_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        querydir_chunks_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
+static volatile LONG querydir_chunks_invalidate_done;
+
+static unsigned __stdcall querydir_chunks_invalidate_thread(void *DirPath)
+{
+    WCHAR FilePath[MAX_PATH];
+    HANDLE Handle;
+
+    /* every create and delete invalidates the cached listing of the directory */
+    for (ULONG I = 0; !querydir_chunks_invalidate_done; I++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\tmp%u", (PWSTR)DirPath, I % 16);
+        Handle = CreateFileW(FilePath,
+            GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_NEW,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+        if (INVALID_HANDLE_VALUE == Handle)
+            return GetLastError();
+        CloseHandle(Handle);
+    }
+
+    return 0;
+}
+
+static void querydir_chunks_invalidate_dotest(ULONG Flags, PWSTR Prefix)
+{
+    void *memfs = memfs_start_ex(Flags | MemfsLargeDirInfoCache, -1);
+
+    HANDLE Handle, Thread;
+    DWORD ExitCode;
+    WCHAR DirPath[MAX_PATH];
+
+    StringCbPrintfW(DirPath, sizeof DirPath, L"%s%s\\dir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    querydir_chunks_create(DirPath, FALSE);
+
+    querydir_chunks_invalidate_done = 0;
+    Thread = (HANDLE)_beginthreadex(0, 0, querydir_chunks_invalidate_thread, DirPath, 0, 0);
+    ASSERT(0 != Thread);
+
+    /*
+     * Listings are invalidated while they are being extended, so continuation requests
+     * are in flight when their listing goes away. The files that are not touched must
+     * still be listed exactly once.
+     */
+    for (ULONG I = 0; 20 > I; I++)
+    {
+        Handle = CreateFileW(DirPath,
+            FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+            OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        querydir_chunks_list(Handle, 0 == I % 2 ? 4096 : 1024, 0 == I % 5);
+        CloseHandle(Handle);
+    }
+
+    InterlockedExchange(&querydir_chunks_invalidate_done, 1);
+    WaitForSingleObject(Thread, INFINITE);
+    GetExitCodeThread(Thread, &ExitCode);
+    CloseHandle(Thread);
+    ASSERT(0 == ExitCode);
+
+    querydir_chunks_create(DirPath, TRUE);
+
+    memfs_stop(memfs);
+}
+
+void querydir_chunks_invalidate_test(void)
+{
+    if (WinFspDiskTests)
+        querydir_chunks_invalidate_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        querydir_chunks_invalidate_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
 static unsigned __stdcall dirnotify_dotest_thread(void *FilePath)
 {
     FspDebugLog(__FUNCTION__ ": \"%S\"\n", FilePath);
@@ -546,5 +772,7 @@ void dirctl_tests(void)
     TEST(querydir_expire_cache_test);
     if (!OptShareName)
         TEST(querydir_buffer_overflow_test);
+    TEST(querydir_chunks_test);
+    TEST(querydir_chunks_invalidate_test);
     TEST(dirnotify_test);
 }
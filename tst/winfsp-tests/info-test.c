@@ -160,6 +160,102 @@ void getfileinfo_test(void)
     }
 }
 
+static void getfileinfo_fastio_dotest(ULONG Flags, PWSTR Prefix, ULONG FileInfoTimeout)
+{
+    void *memfs = memfs_start_ex(Flags, FileInfoTimeout);
+
+    HANDLE Handle, Handle2;
+    BOOL Success;
+    WCHAR FilePath[MAX_PATH];
+    FILE_BASIC_INFO BasicInfo;
+    FILE_STANDARD_INFO StandardInfo;
+    WIN32_FILE_ATTRIBUTE_DATA AttributeData;
+    UINT8 Buffer[16] = { 0 };
+    DWORD BytesTransferred;
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\file0",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+
+    /* repeated queries can be answered by the fast I/O routines */
+    for (ULONG I = 0; 3 > I; I++)
+    {
+        Success = GetFileInformationByHandleEx(Handle, FileStandardInfo, &StandardInfo, sizeof StandardInfo);
+        ASSERT(Success);
+        ASSERT(0 == StandardInfo.EndOfFile.QuadPart);
+        ASSERT(!StandardInfo.Directory);
+    }
+
+    /* changes made through another handle are seen */
+    Handle2 = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle2);
+    Success = WriteFile(Handle2, Buffer, sizeof Buffer, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(sizeof Buffer == BytesTransferred);
+    Success = SetFileAttributesW(FilePath, FILE_ATTRIBUTE_HIDDEN);
+    ASSERT(Success);
+
+    Success = GetFileInformationByHandleEx(Handle, FileStandardInfo, &StandardInfo, sizeof StandardInfo);
+    ASSERT(Success);
+    ASSERT(sizeof Buffer == StandardInfo.EndOfFile.QuadPart);
+    Success = GetFileInformationByHandleEx(Handle, FileBasicInfo, &BasicInfo, sizeof BasicInfo);
+    ASSERT(Success);
+    ASSERT(0 != (FILE_ATTRIBUTE_HIDDEN & BasicInfo.FileAttributes));
+    Success = GetFileAttributesExW(FilePath, GetFileExInfoStandard, &AttributeData);
+    ASSERT(Success);
+    ASSERT(0 != (FILE_ATTRIBUTE_HIDDEN & AttributeData.dwFileAttributes));
+    ASSERT(sizeof Buffer == AttributeData.nFileSizeLow && 0 == AttributeData.nFileSizeHigh);
+
+    /* an expired FileInfo is not used by the fast I/O routines */
+    if (0 != FileInfoTimeout && INFINITE != FileInfoTimeout)
+    {
+        Sleep(FileInfoTimeout + 500);
+
+        Success = GetFileInformationByHandleEx(Handle, FileStandardInfo, &StandardInfo, sizeof StandardInfo);
+        ASSERT(Success);
+        ASSERT(sizeof Buffer == StandardInfo.EndOfFile.QuadPart);
+        Success = GetFileInformationByHandleEx(Handle, FileBasicInfo, &BasicInfo, sizeof BasicInfo);
+        ASSERT(Success);
+        ASSERT(0 != (FILE_ATTRIBUTE_HIDDEN & BasicInfo.FileAttributes));
+        Success = GetFileAttributesExW(FilePath, GetFileExInfoStandard, &AttributeData);
+        ASSERT(Success);
+        ASSERT(sizeof Buffer == AttributeData.nFileSizeLow && 0 == AttributeData.nFileSizeHigh);
+    }
+
+    CloseHandle(Handle2);
+    CloseHandle(Handle);
+
+    memfs_stop(memfs);
+}
+
+void getfileinfo_fastio_test(void)
+{
+    if (NtfsTests)
+    {
+        WCHAR DirBuf[MAX_PATH];
+        GetTestDirectory(DirBuf);
+        getfileinfo_fastio_dotest(-1, DirBuf, 0);
+    }
+    if (WinFspDiskTests)
+    {
+        getfileinfo_fastio_dotest(MemfsDisk, 0, 0);
+        getfileinfo_fastio_dotest(MemfsDisk, 0, 1000);
+        getfileinfo_fastio_dotest(MemfsDisk, 0, INFINITE);
+    }
+    if (WinFspNetTests)
+    {
+        getfileinfo_fastio_dotest(MemfsNet, L"\\\\memfs\\share", 0);
+        getfileinfo_fastio_dotest(MemfsNet, L"\\\\memfs\\share", 1000);
+        getfileinfo_fastio_dotest(MemfsNet, L"\\\\memfs\\share", INFINITE);
+    }
+}
+
 void getfileinfo_name_dotest(ULONG Flags, PWSTR Prefix, ULONG FileInfoTimeout)
 {
     void *memfs = memfs_start_ex(Flags, FileInfoTimeout);
@@ -1792,6 +1888,7 @@ void setvolinfo_test(void)
 void info_tests(void)
 {
     TEST(getfileinfo_test);
+    TEST(getfileinfo_fastio_test);
     TEST(getfileinfo_name_test);
     TEST(setfileinfo_test);
     TEST(delete_test);
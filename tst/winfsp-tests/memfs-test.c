@@ -18,20 +18,15 @@
 #include <winfsp/winfsp.h>
 #include <tlib/testsuite.h>
 #include <process.h>
+#include <strsafe.h>
 #include "memfs.h"
 
 #include "winfsp-tests.h"
 
 int memfs_running;
 
-void *memfs_start_ex(ULONG Flags, ULONG FileInfoTimeout)
+static MEMFS *memfs_create_ex(ULONG Flags, ULONG FileInfoTimeout)
 {
-    if (-1 == Flags)
-    {
-        memfs_running = 1;
-        return 0;
-    }
-
     MEMFS *Memfs;
     NTSTATUS Result;
 
@@ -40,7 +35,7 @@ void *memfs_start_ex(ULONG Flags, ULONG FileInfoTimeout)
         FileInfoTimeout,
         1024,
         1024 * 1024,
-        MemfsNet == Flags ? L"\\memfs\\share" : 0,
+        (Flags & MemfsNet) ? L"\\memfs\\share" : 0,
         0,
         &Memfs);
     ASSERT(NT_SUCCESS(Result));
@@ -52,6 +47,22 @@ void *memfs_start_ex(ULONG Flags, ULONG FileInfoTimeout)
         ASSERT(NT_SUCCESS(Result));
     }
 
+    return Memfs;
+}
+
+void *memfs_start_ex(ULONG Flags, ULONG FileInfoTimeout)
+{
+    if (-1 == Flags)
+    {
+        memfs_running = 1;
+        return 0;
+    }
+
+    MEMFS *Memfs;
+    NTSTATUS Result;
+
+    Memfs = memfs_create_ex(Flags, FileInfoTimeout);
+
     Result = MemfsStart(Memfs);
     ASSERT(NT_SUCCESS(Result));
 
@@ -85,6 +96,38 @@ PWSTR memfs_volumename(void *data)
     return MemfsFileSystem(Memfs)->VolumeName;
 }
 
+void memfs_get_statistics(HANDLE Handle, FSP_FSCTL_STATISTICS *Statistics)
+{
+    typedef struct
+    {
+        FILESYSTEM_STATISTICS Base;
+        FAT_STATISTICS Specific;
+        FSP_FSCTL_STATISTICS Winfsp;
+    } STATISTICS;
+    PUINT8 Buffer, P, EndP;
+    DWORD BytesTransferred;
+    BOOL Success;
+
+    Buffer = malloc(64 * 1024);
+    ASSERT(0 != Buffer);
+
+    Success = DeviceIoControl(Handle, FSCTL_FILESYSTEM_GET_STATISTICS,
+        0, 0, Buffer, 64 * 1024, &BytesTransferred, 0);
+    ASSERT(Success);
+
+    /* sum the per processor records; all FSP_FSCTL_STATISTICS fields are UINT64 */
+    memset(Statistics, 0, sizeof *Statistics);
+    for (P = Buffer, EndP = P + BytesTransferred; EndP > P;
+        P += ((STATISTICS *)P)->Base.SizeOfCompleteStructure)
+    {
+        ASSERT(sizeof(STATISTICS) <= ((STATISTICS *)P)->Base.SizeOfCompleteStructure);
+        for (ULONG I = 0; sizeof *Statistics / sizeof(UINT64) > I; I++)
+            ((PUINT64)Statistics)[I] += ((PUINT64)&((STATISTICS *)P)->Winfsp)[I];
+    }
+
+    free(Buffer);
+}
+
 void memfs_dotest(ULONG Flags)
 {
     void *memfs = memfs_start(Flags);
@@ -100,10 +143,668 @@ void memfs_test(void)
         memfs_dotest(MemfsNet);
 }
 
+static unsigned __stdcall memfs_batch_dotest_thread(void *FilePath0)
+{
+    PWSTR FilePath = FilePath0;
+    HANDLE Handle;
+    UINT8 Buffer[256];
+    DWORD BytesTransferred;
+    unsigned Errors = 0;
+
+    for (ULONG I = 0; 100 > I; I++)
+    {
+        Handle = CreateFileW(FilePath,
+            GENERIC_READ | GENERIC_WRITE, 0, 0,
+            CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+        if (INVALID_HANDLE_VALUE == Handle)
+        {
+            Errors++;
+            continue;
+        }
+
+        memset(Buffer, (UINT8)I, sizeof Buffer);
+        if (!WriteFile(Handle, Buffer, sizeof Buffer, &BytesTransferred, 0) ||
+            sizeof Buffer != BytesTransferred)
+            Errors++;
+
+        CloseHandle(Handle);
+    }
+
+    return Errors;
+}
+
+static void memfs_dotest_workers(PWSTR DirPath)
+{
+    /* 8 client threads that each create, write and delete 100 files in DirPath */
+    WCHAR FilePaths[8][MAX_PATH];
+    HANDLE Threads[8];
+    DWORD ExitCode;
+
+    for (ULONG I = 0; 8 > I; I++)
+    {
+        StringCbPrintfW(FilePaths[I], sizeof FilePaths[I], L"%s\\file%u", DirPath, I);
+        Threads[I] = (HANDLE)_beginthreadex(0, 0, memfs_batch_dotest_thread, FilePaths[I], 0, 0);
+        ASSERT(0 != Threads[I]);
+    }
+
+    WaitForMultipleObjects(8, Threads, TRUE, INFINITE);
+    for (ULONG I = 0; 8 > I; I++)
+    {
+        GetExitCodeThread(Threads[I], &ExitCode);
+        CloseHandle(Threads[I]);
+        ASSERT(0 == ExitCode);
+    }
+}
+
+static void memfs_batch_dotest(ULONG Flags, PWSTR Prefix, ULONG WorkerCount)
+{
+    MEMFS *Memfs;
+    NTSTATUS Result;
+    WCHAR RootPath[MAX_PATH];
+    FSP_FILE_SYSTEM_DISPATCHER_STATISTICS Statistics;
+
+    Memfs = memfs_create_ex(Flags, 1000);
+
+    /* fewer dispatcher threads than client threads, so that requests queue up in the FSD */
+    FspFileSystemSetDispatcherThreadCount(MemfsFileSystem(Memfs), 2, 2, 0);
+    FspFileSystemSetTransactBatch(MemfsFileSystem(Memfs), TRUE, WorkerCount);
+
+    Result = MemfsStart(Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    StringCbPrintfW(RootPath, sizeof RootPath, L"%s%s",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    memfs_dotest_workers(RootPath);
+
+    /* requests were actually delivered in batches */
+    Result = FspFileSystemGetDispatcherStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(8 * 100 * 3 <= Statistics.RequestCount);
+    ASSERT(Statistics.RequestCount > Statistics.BatchCount);
+
+    MemfsStop(Memfs);
+    MemfsDelete(Memfs);
+}
+
+static void memfs_batch_test(void)
+{
+    if (WinFspDiskTests)
+    {
+        memfs_batch_dotest(MemfsDisk, 0, 0);
+        memfs_batch_dotest(MemfsDisk, 0, 4);
+    }
+    if (WinFspNetTests)
+    {
+        memfs_batch_dotest(MemfsNet, L"\\\\memfs\\share", 0);
+        memfs_batch_dotest(MemfsNet, L"\\\\memfs\\share", 4);
+    }
+}
+
+static void memfs_batch_close_dotest(ULONG Flags, PWSTR Prefix)
+{
+    void *memfs = memfs_start(MemfsBatchCloseRequests | Flags);
+
+    WCHAR RootPath[MAX_PATH], DirPath[MAX_PATH], NewDirPath[MAX_PATH], FilePath[MAX_PATH];
+    HANDLE Handle, RootHandle;
+    FSP_FSCTL_STATISTICS Statistics0, Statistics1, Statistics2;
+    BOOL Success;
+
+    StringCbPrintfW(DirPath, sizeof DirPath, L"%s%s\\dir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    StringCbPrintfW(NewDirPath, sizeof NewDirPath, L"%s%s\\newdir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = CreateDirectoryW(DirPath, 0);
+    ASSERT(Success);
+
+    /* keep the root directory open to query the statistics; it is outside the renamed tree */
+    StringCbPrintfW(RootPath, sizeof RootPath, L"%s%s\\",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    RootHandle = CreateFileW(RootPath,
+        FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+    ASSERT(INVALID_HANDLE_VALUE != RootHandle);
+
+    memfs_get_statistics(RootHandle, &Statistics0);
+
+    memfs_dotest_workers(DirPath);
+
+    memfs_get_statistics(RootHandle, &Statistics1);
+
+    /* every Close went through a batch and batches carried more than one Close on average */
+    ASSERT(Statistics1.CloseBatch.Closes - Statistics0.CloseBatch.Closes >= 8 * 100);
+    ASSERT(Statistics1.CloseBatch.Requests - Statistics0.CloseBatch.Requests >= 1);
+    ASSERT(Statistics1.CloseBatch.Requests - Statistics0.CloseBatch.Requests <
+        Statistics1.CloseBatch.Closes - Statistics0.CloseBatch.Closes);
+
+    /* leave a batched Close pending for a file in the directory and rename the directory */
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file", DirPath);
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, 0, 0,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    CloseHandle(Handle);
+
+    Success = MoveFileExW(DirPath, NewDirPath, 0);
+    ASSERT(Success);
+
+    /* the batch holding the Close was posted by the rename (or by the delayed flush) */
+    memfs_get_statistics(RootHandle, &Statistics2);
+    ASSERT(Statistics2.CloseBatch.Closes - Statistics1.CloseBatch.Closes >= 1);
+    ASSERT(Statistics2.CloseBatch.Requests - Statistics1.CloseBatch.Requests >= 1);
+
+    CloseHandle(RootHandle);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file", NewDirPath);
+    Success = DeleteFileW(FilePath);
+    ASSERT(Success);
+    Success = RemoveDirectoryW(NewDirPath);
+    ASSERT(Success);
+
+    memfs_stop(memfs);
+}
+
+static void memfs_batch_close_test(void)
+{
+    if (WinFspDiskTests)
+        memfs_batch_close_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        memfs_batch_close_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
+static void memfs_delay_close_dotest(ULONG Flags, PWSTR Prefix)
+{
+    void *memfs = memfs_start(MemfsDelayCloseRequests | Flags);
+
+    WCHAR DirPath[MAX_PATH], NewDirPath[MAX_PATH], FilePath[MAX_PATH];
+    HANDLE Handle;
+    BOOL Success;
+    UINT8 Buffer[16];
+    DWORD BytesTransferred;
+    FSP_FSCTL_STATISTICS Statistics0, Statistics1;
+
+    StringCbPrintfW(DirPath, sizeof DirPath, L"%s%s\\dir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    StringCbPrintfW(NewDirPath, sizeof NewDirPath, L"%s%s\\newdir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = CreateDirectoryW(DirPath, 0);
+    ASSERT(Success);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file", DirPath);
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, 0, 0,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    Success = WriteFile(Handle, "0123456789abcdef", 16, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(16 == BytesTransferred);
+    memfs_get_statistics(Handle, &Statistics0);
+    CloseHandle(Handle);
+
+    /* reopens with the same or less access may be satisfied by the held open */
+    for (ULONG I = 0; 100 > I; I++)
+    {
+        Handle = CreateFileW(FilePath,
+            0 == I % 2 ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE, 0, 0,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        Success = ReadFile(Handle, Buffer, sizeof Buffer, &BytesTransferred, 0);
+        ASSERT(Success);
+        ASSERT(16 == BytesTransferred);
+        ASSERT(0 == memcmp("0123456789abcdef", Buffer, 16));
+        if (99 == I)
+            memfs_get_statistics(Handle, &Statistics1);
+        CloseHandle(Handle);
+    }
+
+    /*
+     * After the first reopen the held open is read-only: read-only reopens hit and
+     * read-write reopens miss. Allow for a held open that expires on a slow machine.
+     */
+    ASSERT(Statistics1.CloseCache.Inserts - Statistics0.CloseCache.Inserts >= 1);
+    ASSERT(Statistics1.CloseCache.Hits - Statistics0.CloseCache.Hits >= 25);
+    ASSERT(Statistics1.CloseCache.Hits + Statistics1.CloseCache.Misses -
+        Statistics0.CloseCache.Hits - Statistics0.CloseCache.Misses >= 100);
+
+    /* reopens that ask for DELETE always go to the file system */
+    for (ULONG I = 0; 2 > I; I++)
+    {
+        Handle = CreateFileW(FilePath,
+            GENERIC_READ | DELETE, 0, 0,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        memfs_get_statistics(Handle, &Statistics0);
+        CloseHandle(Handle);
+    }
+    ASSERT(Statistics0.CloseCache.Hits == Statistics1.CloseCache.Hits);
+
+    /* a held open must not survive a rename of its directory */
+    Success = MoveFileExW(DirPath, NewDirPath, 0);
+    ASSERT(Success);
+
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ, 0, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE == Handle);
+    ASSERT(ERROR_PATH_NOT_FOUND == GetLastError());
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file", NewDirPath);
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ, 0, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    memfs_get_statistics(Handle, &Statistics0);
+    ASSERT(Statistics0.CloseCache.Hits == Statistics1.CloseCache.Hits);
+    ASSERT(Statistics0.CloseCache.Evictions - Statistics1.CloseCache.Evictions >= 1);
+    CloseHandle(Handle);
+
+    /* nor a delete of its file */
+    Success = DeleteFileW(FilePath);
+    ASSERT(Success);
+
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ, 0, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE == Handle);
+    ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+
+    Success = RemoveDirectoryW(NewDirPath);
+    ASSERT(Success);
+
+    memfs_stop(memfs);
+}
+
+static void memfs_delay_close_test(void)
+{
+    if (WinFspDiskTests)
+        memfs_delay_close_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        memfs_delay_close_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
+static void memfs_meta_cache_dotest(ULONG Flags, PWSTR Prefix)
+{
+    void *memfs = memfs_start(Flags);
+
+    WCHAR DirPath[MAX_PATH], FilePath[MAX_PATH];
+    HANDLE Handle, FileHandle, FindHandle;
+    WIN32_FIND_DATAW FindData;
+    FSP_FSCTL_STATISTICS Statistics0, Statistics1;
+    UINT8 SecurityDescriptorBuf[1024];
+    DWORD Length;
+    BOOL Success;
+
+    StringCbPrintfW(DirPath, sizeof DirPath, L"%s%s\\dir",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = CreateDirectoryW(DirPath, 0);
+    ASSERT(Success);
+
+    for (ULONG I = 0; 10 > I; I++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file%u", DirPath, I);
+        Handle = CreateFileW(FilePath,
+            GENERIC_READ | GENERIC_WRITE, 0, 0,
+            CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        CloseHandle(Handle);
+    }
+
+    /* keep the directory open, so that its FileNode (and cached meta data) stays around */
+    Handle = CreateFileW(DirPath,
+        FILE_READ_ATTRIBUTES | READ_CONTROL, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+
+    memfs_get_statistics(Handle, &Statistics0);
+
+    for (ULONG I = 0; 10 > I; I++)
+    {
+        Success = GetKernelObjectSecurity(Handle,
+            OWNER_SECURITY_INFORMATION | GROUP_SECURITY_INFORMATION | DACL_SECURITY_INFORMATION,
+            (PSECURITY_DESCRIPTOR)SecurityDescriptorBuf, sizeof SecurityDescriptorBuf, &Length);
+        ASSERT(Success);
+    }
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\*", DirPath);
+    for (ULONG I = 0; 10 > I; I++)
+    {
+        FindHandle = FindFirstFileW(FilePath, &FindData);
+        ASSERT(INVALID_HANDLE_VALUE != FindHandle);
+        while (FindNextFileW(FindHandle, &FindData))
+            ;
+        ASSERT(ERROR_NO_MORE_FILES == GetLastError());
+        FindClose(FindHandle);
+    }
+
+    memfs_get_statistics(Handle, &Statistics1);
+
+    /* the first query of each kind may miss; the rest must be satisfied from the caches */
+    ASSERT(Statistics1.SecurityCache.Hits - Statistics0.SecurityCache.Hits >= 9);
+    ASSERT(Statistics1.DirInfoCache.Hits - Statistics0.DirInfoCache.Hits >= 9);
+    ASSERT(0 < Statistics1.SecurityCache.ItemCount);
+    ASSERT(0 < Statistics1.DirInfoCache.ItemCount);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\missing", DirPath);
+    for (ULONG I = 0; 10 > I; I++)
+    {
+        FileHandle = CreateFileW(FilePath,
+            FILE_READ_ATTRIBUTES, 0, 0,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE == FileHandle);
+        ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+    }
+
+    memfs_get_statistics(Handle, &Statistics0);
+
+    /* the first open misses and inserts the name; the rest must be satisfied from the cache */
+    ASSERT(Statistics0.NegativeNameCache.Hits - Statistics1.NegativeNameCache.Hits >= 9);
+    ASSERT(Statistics0.NegativeNameCache.Inserts - Statistics1.NegativeNameCache.Inserts >= 1);
+    ASSERT(0 < Statistics0.NegativeNameCache.ItemCount);
+
+    FileHandle = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, 0, 0,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != FileHandle);
+    CloseHandle(FileHandle);
+
+    memfs_get_statistics(Handle, &Statistics1);
+    ASSERT(Statistics1.NegativeNameCache.Invalidations - Statistics0.NegativeNameCache.Invalidations >= 1);
+
+    FileHandle = CreateFileW(FilePath,
+        FILE_READ_ATTRIBUTES, 0, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != FileHandle);
+    CloseHandle(FileHandle);
+
+    Success = DeleteFileW(FilePath);
+    ASSERT(Success);
+
+    CloseHandle(Handle);
+
+    for (ULONG I = 0; 10 > I; I++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s\\file%u", DirPath, I);
+        Success = DeleteFileW(FilePath);
+        ASSERT(Success);
+    }
+    Success = RemoveDirectoryW(DirPath);
+    ASSERT(Success);
+
+    memfs_stop(memfs);
+}
+
+static void memfs_meta_cache_test(void)
+{
+    if (WinFspDiskTests)
+        memfs_meta_cache_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        memfs_meta_cache_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
+static FSP_FILE_SYSTEM_OPERATION_GUARD *memfs_threadpool_enter_operation;
+
+static NTSTATUS memfs_threadpool_slow_enter_operation(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    /* keep the dispatcher threads busy, so that the pool must grow */
+    if (FspFsctlTransactCreateKind == Request->Kind)
+        Sleep(10);
+
+    return memfs_threadpool_enter_operation(FileSystem, Request, Response);
+}
+
+static void memfs_threadpool_dotest(ULONG Flags, PWSTR Prefix)
+{
+    MEMFS *Memfs;
+    NTSTATUS Result;
+    WCHAR RootPath[MAX_PATH];
+    FSP_FILE_SYSTEM_DISPATCHER_STATISTICS Statistics;
+    UINT64 ThreadExitCount;
+
+    Memfs = memfs_create_ex(Flags, 1000);
+
+    FspFileSystemSetDispatcherThreadCount(MemfsFileSystem(Memfs), 2, 6, 100);
+
+    memfs_threadpool_enter_operation = MemfsFileSystem(Memfs)->EnterOperation;
+    FspFileSystemSetOperationGuard(MemfsFileSystem(Memfs),
+        memfs_threadpool_slow_enter_operation, MemfsFileSystem(Memfs)->LeaveOperation);
+
+    Result = FspFileSystemGetDispatcherStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(STATUS_INVALID_DEVICE_STATE == Result);
+
+    Result = MemfsStart(Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    StringCbPrintfW(RootPath, sizeof RootPath, L"%s%s",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName);
+    memfs_dotest_workers(RootPath);
+
+    Result = FspFileSystemGetDispatcherStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(2 == Statistics.ThreadCountMin);
+    ASSERT(6 == Statistics.ThreadCountMax);
+    ASSERT(2 <= Statistics.ThreadCount && 6 >= Statistics.ThreadCount);
+    ASSERT(Statistics.ThreadCountMin < Statistics.ThreadCountPeak && 6 >= Statistics.ThreadCountPeak);
+    ASSERT(Statistics.ThreadCreateCount >= Statistics.ThreadCountPeak);
+    ASSERT(8 * 100 <= Statistics.RequestCount);
+
+    /*
+     * Threads above ThreadCountMin retire once idle for longer than the IdleTimeout. A
+     * thread only notices that it is idle when its transact times out, so wait for a few
+     * transact timeouts.
+     */
+    ThreadExitCount = Statistics.ThreadExitCount;
+    for (ULONG I = 0; 100 > I && ThreadExitCount == Statistics.ThreadExitCount; I++)
+    {
+        Sleep(100);
+        Result = FspFileSystemGetDispatcherStatistics(MemfsFileSystem(Memfs), &Statistics);
+        ASSERT(NT_SUCCESS(Result));
+    }
+    ASSERT(ThreadExitCount < Statistics.ThreadExitCount);
+    ASSERT(Statistics.ThreadCountMin <= Statistics.ThreadCount);
+
+    MemfsStop(Memfs);
+    MemfsDelete(Memfs);
+}
+
+static void memfs_threadpool_test(void)
+{
+    if (WinFspDiskTests)
+        memfs_threadpool_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        memfs_threadpool_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
+static void memfs_trace_decode(PWSTR TraceFileName,
+    ULONG CreateRequestCount, ULONG CreateResponseCount)
+{
+    WCHAR FsptoolPath[MAX_PATH], OutputFileName[MAX_PATH], CommandLine[2 * MAX_PATH + 64];
+    SECURITY_ATTRIBUTES OutputAttributes;
+    STARTUPINFOW StartupInfo;
+    PROCESS_INFORMATION ProcessInfo;
+    HANDLE OutputHandle;
+    DWORD OutputSize, BytesTransferred, ExitCode;
+    PWSTR FsptoolName;
+    PSTR Output, P;
+    ULONG RequestCount = 0, ResponseCount = 0;
+    BOOL Success;
+
+    /* fsptool is built (and installed) next to winfsp-tests; skip the check if it is not there */
+    Success = 0 != GetModuleFileNameW(0, FsptoolPath, MAX_PATH);
+    ASSERT(Success);
+    FsptoolName = wcsrchr(FsptoolPath, L'\\');
+    ASSERT(0 != FsptoolName);
+    *FsptoolName = L'\0';
+    StringCbCatW(FsptoolPath, sizeof FsptoolPath,
+#if defined(_WIN64)
+        L"\\fsptool-x64.exe"
+#elif defined(_WIN32)
+        L"\\fsptool-x86.exe"
+#else
+#error
+#endif
+        );
+    if (INVALID_FILE_ATTRIBUTES == GetFileAttributesW(FsptoolPath))
+        return;
+
+    StringCbPrintfW(OutputFileName, sizeof OutputFileName, L"%s.txt", TraceFileName);
+    memset(&OutputAttributes, 0, sizeof OutputAttributes);
+    OutputAttributes.nLength = sizeof OutputAttributes;
+    OutputAttributes.bInheritHandle = TRUE;
+    OutputHandle = CreateFileW(OutputFileName,
+        GENERIC_READ | GENERIC_WRITE, 0, &OutputAttributes,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+    ASSERT(INVALID_HANDLE_VALUE != OutputHandle);
+
+    StringCbPrintfW(CommandLine, sizeof CommandLine, L"\"%s\" trace \"%s\"",
+        FsptoolPath, TraceFileName);
+
+    memset(&StartupInfo, 0, sizeof StartupInfo);
+    StartupInfo.cb = sizeof StartupInfo;
+    StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    StartupInfo.hStdOutput = OutputHandle;
+    StartupInfo.hStdError = OutputHandle;
+
+    Success = CreateProcessW(FsptoolPath, CommandLine, 0, 0, TRUE, 0, 0, 0,
+        &StartupInfo, &ProcessInfo);
+    ASSERT(Success);
+    CloseHandle(ProcessInfo.hThread);
+    ASSERT(WAIT_OBJECT_0 == WaitForSingleObject(ProcessInfo.hProcess, 60000));
+    Success = GetExitCodeProcess(ProcessInfo.hProcess, &ExitCode);
+    ASSERT(Success);
+    ASSERT(0 == ExitCode);
+    CloseHandle(ProcessInfo.hProcess);
+
+    OutputSize = GetFileSize(OutputHandle, 0);
+    ASSERT(INVALID_FILE_SIZE != OutputSize);
+    Output = malloc(OutputSize + 1);
+    ASSERT(0 != Output);
+    SetFilePointer(OutputHandle, 0, 0, FILE_BEGIN);
+    Success = ReadFile(OutputHandle, Output, OutputSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(OutputSize == BytesTransferred);
+    Output[OutputSize] = '\0';
+
+    /* the decoded trace has one line per record that agrees with the raw records */
+    ASSERT(Output == strstr(Output, "trace of process "));
+    for (P = Output; 0 != (P = strstr(P, ">>Create ")); P++)
+        RequestCount++;
+    for (P = Output; 0 != (P = strstr(P, "<<Create ")); P++)
+        ResponseCount++;
+    ASSERT(CreateRequestCount == RequestCount);
+    ASSERT(CreateResponseCount == ResponseCount);
+
+    free(Output);
+    CloseHandle(OutputHandle);
+}
+
+static void memfs_trace_dotest(ULONG Flags, PWSTR Prefix)
+{
+    void *memfs = memfs_start(Flags);
+
+    NTSTATUS Result;
+    WCHAR RootPath[MAX_PATH], TempPath[MAX_PATH], TraceFileName[MAX_PATH];
+    HANDLE TraceHandle;
+    DWORD BytesTransferred;
+    FSP_DEBUG_TRACE_HEADER Header;
+    FSP_DEBUG_TRACE_RECORD Record;
+    ULONG CreateRequestCount = 0, CreateResponseCount = 0, DroppedCount = 0;
+    BOOL Success;
+
+    Success = GetTempPathW(MAX_PATH, TempPath) && GetTempFileNameW(TempPath, L"trc", 0, TraceFileName);
+    ASSERT(Success);
+    TraceHandle = CreateFileW(TraceFileName,
+        GENERIC_READ | GENERIC_WRITE, 0, 0,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != TraceHandle);
+
+    FspFileSystemSetDebugLog(MemfsFileSystem(memfs), -1);
+
+    Result = FspDebugTraceStart(TraceHandle);
+    ASSERT(NT_SUCCESS(Result));
+    Result = FspDebugTraceStart(TraceHandle);
+    ASSERT(STATUS_INVALID_DEVICE_STATE == Result);
+
+    StringCbPrintfW(RootPath, sizeof RootPath, L"%s%s",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    memfs_dotest_workers(RootPath);
+
+    memfs_stop(memfs);
+
+    FspDebugTraceStop();
+
+    SetFilePointer(TraceHandle, 0, 0, FILE_BEGIN);
+    Success = ReadFile(TraceHandle, &Header, sizeof Header, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(sizeof Header == BytesTransferred);
+    ASSERT(0 == memcmp(FSP_DEBUG_TRACE_MAGIC, Header.Magic, sizeof Header.Magic));
+    ASSERT(FSP_DEBUG_TRACE_VERSION == Header.Version);
+    ASSERT(sizeof(FSP_DEBUG_TRACE_RECORD) == Header.RecordSize);
+    ASSERT(0 != Header.Frequency);
+    ASSERT(GetCurrentProcessId() == Header.ProcessId);
+
+    for (;;)
+    {
+        Success = ReadFile(TraceHandle, &Record, sizeof Record, &BytesTransferred, 0);
+        ASSERT(Success);
+        if (0 == BytesTransferred)
+            break;
+        ASSERT(sizeof Record == BytesTransferred);
+        ASSERT(Header.StartCounter <= Record.Counter);
+
+        switch (Record.Type)
+        {
+        case FspDebugTraceRequest:
+            if (FspFsctlTransactCreateKind == Record.Kind)
+                CreateRequestCount++;
+            break;
+        case FspDebugTraceResponse:
+            if (FspFsctlTransactCreateKind == Record.Kind)
+                CreateResponseCount++;
+            break;
+        case FspDebugTraceDropped:
+            ASSERT(0 != Record.Arg0);
+            DroppedCount += (ULONG)Record.Arg0;
+            break;
+        default:
+            ASSERT(0);
+            break;
+        }
+    }
+
+    /* every CreateFileW above is one Create request and response, unless it was dropped */
+    ASSERT(2 * 8 * 100 <= CreateRequestCount + CreateResponseCount + DroppedCount);
+    if (0 == DroppedCount)
+        ASSERT(CreateRequestCount == CreateResponseCount);
+
+    CloseHandle(TraceHandle);
+
+    memfs_trace_decode(TraceFileName, CreateRequestCount, CreateResponseCount);
+
+    Success = DeleteFileW(TraceFileName);
+    ASSERT(Success);
+}
+
+static void memfs_trace_test(void)
+{
+    if (WinFspDiskTests)
+        memfs_trace_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        memfs_trace_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
 void memfs_tests(void)
 {
     if (OptExternal)
         return;
 
     TEST(memfs_test);
+    if (!OptMountPoint)
+    {
+        TEST(memfs_batch_test);
+        TEST(memfs_batch_close_test);
+        TEST(memfs_delay_close_test);
+        TEST(memfs_meta_cache_test);
+        TEST(memfs_threadpool_test);
+        TEST(memfs_trace_test);
+    }
 }
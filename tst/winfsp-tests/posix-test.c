@@ -263,6 +263,129 @@ void posix_map_path_test(void)
     }
 }
 
+static void posix_map_path_roundtrip_dotest(PWSTR WindowsPath, ULONG Length)
+{
+    NTSTATUS Result;
+    char PosixPath[64 * 3 + 1], PosixPath2[64 * 3 + 1];
+    WCHAR WindowsPath2[64 + 1];
+    ULONG Size, Size2;
+
+    ASSERT(64 >= Length);
+    WindowsPath[Length] = L'\0';
+
+    /* untranslated: must agree with the system converter */
+    Size = sizeof PosixPath;
+    Result = FspPosixMapWindowsToPosixPathBuffer(WindowsPath, PosixPath, &Size, FALSE);
+    ASSERT(NT_SUCCESS(Result));
+    Size2 = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, PosixPath2, sizeof PosixPath2, 0, 0);
+    ASSERT(Size2 == Size);
+    ASSERT(0 == memcmp(PosixPath, PosixPath2, Size));
+
+    /* translated: must round trip */
+    Size = sizeof PosixPath;
+    Result = FspPosixMapWindowsToPosixPathBuffer(WindowsPath, PosixPath, &Size, TRUE);
+    ASSERT(NT_SUCCESS(Result));
+    Size2 = sizeof WindowsPath2;
+    Result = FspPosixMapPosixToWindowsPathBuffer(PosixPath, WindowsPath2, &Size2, TRUE);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT((Length + 1) * sizeof(WCHAR) == Size2);
+    ASSERT(0 == memcmp(WindowsPath, WindowsPath2, Size2));
+}
+
+void posix_map_path_roundtrip_test(void)
+{
+    /*
+     * Every UTF-16 character that may appear in a Windows file name (and every surrogate pair)
+     * at positions that exercise both the vectorized and the scalar conversion paths.
+     */
+    static ULONG Positions[] = { 0, 7, 15, 16, 31, 39 };
+    WCHAR WindowsPath[64 + 1];
+    ULONG Length = 40;
+
+    for (ULONG C = 1; 0x10000 > C; C++)
+    {
+        if ((0xd800 <= C && C <= 0xdfff) || L'/' == C ||
+            (L'\\' != C && (32 > C || 0 != wcschr(L"\"*:<>?|", (WCHAR)C))))
+            continue;
+
+        for (ULONG P = 0; sizeof Positions / sizeof Positions[0] > P; P++)
+        {
+            for (ULONG I = 0; Length > I; I++)
+                WindowsPath[I] = L'a' + I % 26;
+            WindowsPath[Positions[P]] = (WCHAR)C;
+            posix_map_path_roundtrip_dotest(WindowsPath, Length);
+        }
+    }
+
+    for (ULONG C = 0x10000; 0x110000 > C; C++)
+    {
+        for (ULONG I = 0; Length > I; I++)
+            WindowsPath[I] = L'A' + I % 26;
+        WindowsPath[15] = (WCHAR)(0xd800 | ((C - 0x10000) >> 10));
+        WindowsPath[16] = (WCHAR)(0xdc00 | ((C - 0x10000) & 0x3ff));
+        posix_map_path_roundtrip_dotest(WindowsPath, Length);
+    }
+}
+
+void posix_map_path_buffer_test(void)
+{
+    NTSTATUS Result;
+    char PosixPath[32];
+    WCHAR WindowsPath[32];
+    ULONG Size;
+
+    Size = 9;
+    Result = FspPosixMapWindowsToPosixPathBuffer(L"\\foo\\b\xe4r", PosixPath, &Size, TRUE);
+    ASSERT(STATUS_BUFFER_TOO_SMALL == Result);
+    ASSERT(10 == Size);
+    Result = FspPosixMapWindowsToPosixPathBuffer(L"\\foo\\b\xe4r", PosixPath, &Size, TRUE);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(10 == Size);
+    ASSERT(0 == strcmp("/foo/b\xc3\xa4r", PosixPath));
+
+    Size = 8 * sizeof(WCHAR);
+    Result = FspPosixMapPosixToWindowsPathBuffer("/foo/b\xc3\xa4r", WindowsPath, &Size, TRUE);
+    ASSERT(STATUS_BUFFER_TOO_SMALL == Result);
+    ASSERT(9 * sizeof(WCHAR) == Size);
+    Result = FspPosixMapPosixToWindowsPathBuffer("/foo/b\xc3\xa4r", WindowsPath, &Size, TRUE);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(9 * sizeof(WCHAR) == Size);
+    ASSERT(0 == wcscmp(L"\\foo\\b\xe4r", WindowsPath));
+
+    /* invalid UTF-16 and UTF-8 are replaced with U+FFFD */
+    Size = sizeof PosixPath;
+    Result = FspPosixMapWindowsToPosixPathBuffer(L"\\a\xd800" L"b", PosixPath, &Size, TRUE);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(0 == strcmp("/a\xef\xbf\xbd" "b", PosixPath));
+    Size = sizeof WindowsPath;
+    Result = FspPosixMapPosixToWindowsPathBuffer("/a\xc0\xaf" "b", WindowsPath, &Size, TRUE);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(0 == wcscmp(L"\\a\xfffd\xfffd" L"b", WindowsPath));
+}
+
+void posix_map_path_perf_test(void)
+{
+    /* throughput of the path transcoder on a long mostly ASCII path */
+    NTSTATUS Result;
+    WCHAR WindowsPath[261];
+    char PosixPath[261 * 3];
+    ULONG Size;
+
+    for (ULONG I = 0; 260 > I; I++)
+        WindowsPath[I] = 0 == I % 16 ? L'\\' : (15 == I % 16 ? 0xe4 : L'a' + I % 26);
+    WindowsPath[260] = L'\0';
+
+    for (ULONG Count = 0; 100000 > Count; Count++)
+    {
+        Size = sizeof PosixPath;
+        Result = FspPosixMapWindowsToPosixPathBuffer(WindowsPath, PosixPath, &Size, TRUE);
+        ASSERT(NT_SUCCESS(Result));
+        Size = sizeof WindowsPath;
+        Result = FspPosixMapPosixToWindowsPathBuffer(PosixPath, WindowsPath, &Size, TRUE);
+        ASSERT(NT_SUCCESS(Result));
+    }
+}
+
 void posix_tests(void)
 {
     if (OptExternal)
@@ -271,4 +394,7 @@ void posix_tests(void)
     TEST(posix_map_sid_test);
     TEST(posix_map_sd_test);
     TEST(posix_map_path_test);
+    TEST(posix_map_path_roundtrip_test);
+    TEST(posix_map_path_buffer_test);
+    TEST(posix_map_path_perf_test);
 }
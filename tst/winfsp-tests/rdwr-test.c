@@ -1107,6 +1107,146 @@ void rdwr_mixed_test(void)
     }
 }
 
+static void rdwr_fastio_dotest(ULONG Flags, PWSTR Prefix, ULONG FileInfoTimeout)
+{
+    void *memfs = memfs_start_ex(Flags, FileInfoTimeout);
+
+    HANDLE Handle, Handle2;
+    BOOL Success;
+    WCHAR FilePath[MAX_PATH];
+    SYSTEM_INFO SystemInfo;
+    PUINT8 Buffer[2];
+    ULONG PageSize, BufferSize;
+    DWORD BytesTransferred;
+    DWORD FilePointer;
+
+    GetSystemInfo(&SystemInfo);
+    PageSize = SystemInfo.dwPageSize;
+    BufferSize = 4 * PageSize;
+
+    Buffer[0] = malloc(BufferSize);
+    Buffer[1] = malloc(BufferSize);
+    ASSERT(0 != Buffer[0] && 0 != Buffer[1]);
+
+    srand((unsigned)time(0));
+    for (PUINT8 Bgn = Buffer[0], End = Bgn + BufferSize; End > Bgn; Bgn++)
+        *Bgn = rand();
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\file0",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+
+    Handle = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+
+    /* extending writes are left to the IRP path */
+    Success = WriteFile(Handle, Buffer[0], BufferSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(BufferSize == BytesTransferred);
+
+    /* writes and reads within the file size can be done by the fast I/O routines */
+    for (ULONG I = 0; 4 > I; I++)
+    {
+        for (PUINT8 Bgn = Buffer[0] + I * PageSize, End = Bgn + PageSize; End > Bgn; Bgn++)
+            *Bgn = rand();
+
+        FilePointer = SetFilePointer(Handle, I * PageSize, 0, FILE_BEGIN);
+        ASSERT(I * PageSize == FilePointer);
+        Success = WriteFile(Handle, Buffer[0] + I * PageSize, PageSize, &BytesTransferred, 0);
+        ASSERT(Success);
+        ASSERT(PageSize == BytesTransferred);
+        ASSERT(FilePointer + BytesTransferred == SetFilePointer(Handle, 0, 0, FILE_CURRENT));
+    }
+
+    FilePointer = SetFilePointer(Handle, 0, 0, FILE_BEGIN);
+    ASSERT(0 == FilePointer);
+    memset(Buffer[1], 0, BufferSize);
+    Success = ReadFile(Handle, Buffer[1], BufferSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(BufferSize == BytesTransferred);
+    ASSERT(FilePointer + BytesTransferred == SetFilePointer(Handle, 0, 0, FILE_CURRENT));
+    ASSERT(0 == memcmp(Buffer[0], Buffer[1], BytesTransferred));
+
+    Success = ReadFile(Handle, Buffer[1], PageSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(0 == BytesTransferred);
+
+    /* byte range locks held through another handle are honored */
+    Handle2 = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle2);
+
+    Success = LockFile(Handle2, 0, 0, PageSize, 0);
+    ASSERT(Success);
+
+    FilePointer = SetFilePointer(Handle, 0, 0, FILE_BEGIN);
+    ASSERT(0 == FilePointer);
+    Success = ReadFile(Handle, Buffer[1], PageSize, &BytesTransferred, 0);
+    ASSERT(!Success);
+    ASSERT(ERROR_LOCK_VIOLATION == GetLastError());
+    Success = WriteFile(Handle, Buffer[0], PageSize, &BytesTransferred, 0);
+    ASSERT(!Success);
+    ASSERT(ERROR_LOCK_VIOLATION == GetLastError());
+
+    FilePointer = SetFilePointer(Handle, PageSize, 0, FILE_BEGIN);
+    ASSERT(PageSize == FilePointer);
+    memset(Buffer[1], 0, BufferSize);
+    Success = ReadFile(Handle, Buffer[1], PageSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(PageSize == BytesTransferred);
+    ASSERT(0 == memcmp(Buffer[0] + PageSize, Buffer[1], BytesTransferred));
+
+    Success = UnlockFile(Handle2, 0, 0, PageSize, 0);
+    ASSERT(Success);
+
+    FilePointer = SetFilePointer(Handle, 0, 0, FILE_BEGIN);
+    ASSERT(0 == FilePointer);
+    Success = WriteFile(Handle, Buffer[0], PageSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(PageSize == BytesTransferred);
+
+    FilePointer = SetFilePointer(Handle2, 0, 0, FILE_BEGIN);
+    ASSERT(0 == FilePointer);
+    memset(Buffer[1], 0, BufferSize);
+    Success = ReadFile(Handle2, Buffer[1], BufferSize, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(BufferSize == BytesTransferred);
+    ASSERT(0 == memcmp(Buffer[0], Buffer[1], BytesTransferred));
+
+    Success = CloseHandle(Handle2);
+    ASSERT(Success);
+
+    Success = CloseHandle(Handle);
+    ASSERT(Success);
+
+    free(Buffer[0]);
+    free(Buffer[1]);
+
+    memfs_stop(memfs);
+}
+
+void rdwr_fastio_test(void)
+{
+    if (NtfsTests)
+    {
+        WCHAR DirBuf[MAX_PATH];
+        GetTestDirectory(DirBuf);
+        rdwr_fastio_dotest(-1, DirBuf, 0);
+    }
+    if (WinFspDiskTests)
+    {
+        rdwr_fastio_dotest(MemfsDisk, 0, 1000);
+        rdwr_fastio_dotest(MemfsDisk, 0, INFINITE);
+    }
+    if (WinFspNetTests)
+    {
+        rdwr_fastio_dotest(MemfsNet, L"\\\\memfs\\share", 1000);
+        rdwr_fastio_dotest(MemfsNet, L"\\\\memfs\\share", INFINITE);
+    }
+}
+
 void rdwr_tests(void)
 {
     TEST(rdwr_noncached_test);
@@ -1126,4 +1266,5 @@ void rdwr_tests(void)
     TEST(rdwr_writethru_overlapped_test);
     TEST(rdwr_mmap_test);
     TEST(rdwr_mixed_test);
+    TEST(rdwr_fastio_test);
 }
@@ -0,0 +1,314 @@
+/**
+ * @file transact-ring-test.c
+ *
+ * @copyright 2015-2017 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <winfsp/winfsp.h>
+#include <tlib/testsuite.h>
+#include <process.h>
+#include <strsafe.h>
+#include "memfs.h"
+
+#include "winfsp-tests.h"
+
+static FSP_FSCTL_TRANSACT_RING *transact_ring_alloc(UINT32 SlotCount)
+{
+    FSP_FSCTL_TRANSACT_RING *Ring;
+
+    Ring = VirtualAlloc(0, FspFsctlTransactRingSize(SlotCount), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    ASSERT(0 != Ring);
+    FspFsctlTransactRingInitialize(Ring, SlotCount);
+
+    return Ring;
+}
+
+static void transact_ring_free(FSP_FSCTL_TRANSACT_RING *Ring)
+{
+    VirtualFree(Ring, 0, MEM_RELEASE);
+}
+
+static void transact_ring_slotcount_test(void)
+{
+    ASSERT(!FspFsctlTransactRingValidSlotCount(0));
+    ASSERT(!FspFsctlTransactRingValidSlotCount(8));
+    ASSERT(FspFsctlTransactRingValidSlotCount(16));
+    ASSERT(!FspFsctlTransactRingValidSlotCount(24));
+    ASSERT(FspFsctlTransactRingValidSlotCount(32));
+    ASSERT(FspFsctlTransactRingValidSlotCount(256));
+    ASSERT(!FspFsctlTransactRingValidSlotCount(512));
+
+    ASSERT(FSP_FSCTL_TRANSACT_REQ_SIZEMAX <=
+        FSP_FSCTL_TRANSACT_RING_SLOT_SIZE - sizeof(FSP_FSCTL_TRANSACT_RING_SLOT));
+    ASSERT(FSP_FSCTL_TRANSACT_RSP_SIZEMAX <=
+        FSP_FSCTL_TRANSACT_RING_SLOT_SIZE - sizeof(FSP_FSCTL_TRANSACT_RING_SLOT));
+}
+
+static void transact_ring_fifo_dotest(UINT32 SlotCount)
+{
+    FSP_FSCTL_TRANSACT_RING *Ring = transact_ring_alloc(SlotCount);
+    FSP_FSCTL_TRANSACT_REQ *Request;
+    LONG Position;
+
+    for (ULONG Round = 0; 3 > Round; Round++)
+    {
+        ASSERT(FspFsctlTransactRingCanProduce(Ring, SlotCount, FspFsctlTransactRingRequestQueue));
+        ASSERT(!FspFsctlTransactRingCanConsume(Ring, SlotCount, FspFsctlTransactRingRequestQueue));
+        ASSERT(0 == FspFsctlTransactRingConsumeBegin(Ring, SlotCount,
+            FspFsctlTransactRingRequestQueue, &Position));
+
+        for (ULONG I = 0; SlotCount > I; I++)
+        {
+            Request = FspFsctlTransactRingProduceBegin(Ring, SlotCount,
+                FspFsctlTransactRingRequestQueue, &Position);
+            ASSERT(0 != Request);
+            ASSERT(0 == ((UINT_PTR)Request & (FSP_FSCTL_DEFAULT_ALIGNMENT - 1)));
+            memset(Request, 0, sizeof *Request);
+            Request->Version = sizeof *Request;
+            Request->Size = sizeof *Request;
+            Request->Kind = FspFsctlTransactReadKind;
+            Request->Hint = Round * SlotCount + I + 1;
+            FspFsctlTransactRingProduceEnd(Ring, SlotCount,
+                FspFsctlTransactRingRequestQueue, Position);
+        }
+
+        ASSERT(!FspFsctlTransactRingCanProduce(Ring, SlotCount, FspFsctlTransactRingRequestQueue));
+        ASSERT(0 == FspFsctlTransactRingProduceBegin(Ring, SlotCount,
+            FspFsctlTransactRingRequestQueue, &Position));
+
+        /* the response queue is independent of the request queue */
+        ASSERT(FspFsctlTransactRingCanProduce(Ring, SlotCount, FspFsctlTransactRingResponseQueue));
+        ASSERT(!FspFsctlTransactRingCanConsume(Ring, SlotCount, FspFsctlTransactRingResponseQueue));
+
+        for (ULONG I = 0; SlotCount > I; I++)
+        {
+            Request = FspFsctlTransactRingConsumeBegin(Ring, SlotCount,
+                FspFsctlTransactRingRequestQueue, &Position);
+            ASSERT(0 != Request);
+            ASSERT(sizeof *Request == Request->Size);
+            ASSERT(FspFsctlTransactReadKind == Request->Kind);
+            ASSERT(Round * SlotCount + I + 1 == Request->Hint);
+            FspFsctlTransactRingConsumeEnd(Ring, SlotCount,
+                FspFsctlTransactRingRequestQueue, Position);
+        }
+    }
+
+    transact_ring_free(Ring);
+}
+
+static void transact_ring_fifo_test(void)
+{
+    transact_ring_fifo_dotest(FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MIN);
+    transact_ring_fifo_dotest(64);
+    transact_ring_fifo_dotest(FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MAX);
+}
+
+#define RING_STRESS_PRODUCERS           4
+#define RING_STRESS_CONSUMERS           4
+#define RING_STRESS_COUNT               100000
+
+typedef struct
+{
+    FSP_FSCTL_TRANSACT_RING *Ring;
+    UINT32 SlotCount;
+    ULONG Index;
+    volatile LONG *Seen;
+    volatile LONG *Consumed;
+} RING_STRESS_DATA;
+
+static unsigned __stdcall transact_ring_stress_producer(void *Data0)
+{
+    RING_STRESS_DATA *Data = Data0;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    LONG Position;
+
+    for (ULONG I = 0; RING_STRESS_COUNT > I; I++)
+    {
+        while (0 == (Response = FspFsctlTransactRingProduceBegin(Data->Ring, Data->SlotCount,
+            FspFsctlTransactRingResponseQueue, &Position)))
+            SwitchToThread();
+
+        /* vary the response size to catch torn copies */
+        Response->Size = (UINT16)(sizeof *Response + I % 256);
+        Response->Kind = FspFsctlTransactWriteKind;
+        Response->Hint = (UINT64)Data->Index * RING_STRESS_COUNT + I;
+        memset(Response->Buffer, (UINT8)Response->Hint, I % 256);
+        FspFsctlTransactRingProduceEnd(Data->Ring, Data->SlotCount,
+            FspFsctlTransactRingResponseQueue, Position);
+    }
+
+    return 0;
+}
+
+static unsigned __stdcall transact_ring_stress_consumer(void *Data0)
+{
+    RING_STRESS_DATA *Data = Data0;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    LONG Position;
+    UINT64 Hint;
+    ULONG Extra;
+
+    while (RING_STRESS_PRODUCERS * RING_STRESS_COUNT > *Data->Consumed)
+    {
+        Response = FspFsctlTransactRingConsumeBegin(Data->Ring, Data->SlotCount,
+            FspFsctlTransactRingResponseQueue, &Position);
+        if (0 == Response)
+        {
+            SwitchToThread();
+            continue;
+        }
+
+        Hint = Response->Hint;
+        Extra = Response->Size - sizeof *Response;
+        if (FspFsctlTransactWriteKind != Response->Kind ||
+            RING_STRESS_PRODUCERS * RING_STRESS_COUNT <= Hint ||
+            Hint % RING_STRESS_COUNT % 256 != Extra)
+            InterlockedIncrement(&Data->Seen[RING_STRESS_PRODUCERS * RING_STRESS_COUNT]);
+        else
+        {
+            for (ULONG J = 0; Extra > J; J++)
+                if ((UINT8)Hint != Response->Buffer[J])
+                {
+                    InterlockedIncrement(&Data->Seen[RING_STRESS_PRODUCERS * RING_STRESS_COUNT]);
+                    break;
+                }
+            InterlockedIncrement(&Data->Seen[Hint]);
+        }
+
+        FspFsctlTransactRingConsumeEnd(Data->Ring, Data->SlotCount,
+            FspFsctlTransactRingResponseQueue, Position);
+        InterlockedIncrement(Data->Consumed);
+    }
+
+    return 0;
+}
+
+static void transact_ring_stress_dotest(UINT32 SlotCount)
+{
+    FSP_FSCTL_TRANSACT_RING *Ring = transact_ring_alloc(SlotCount);
+    RING_STRESS_DATA Data[RING_STRESS_PRODUCERS + RING_STRESS_CONSUMERS];
+    HANDLE Threads[RING_STRESS_PRODUCERS + RING_STRESS_CONSUMERS];
+    volatile LONG *Seen;
+    volatile LONG Consumed = 0;
+
+    /* one extra counter at the end records corrupted responses */
+    Seen = calloc(RING_STRESS_PRODUCERS * RING_STRESS_COUNT + 1, sizeof(LONG));
+    ASSERT(0 != Seen);
+
+    for (ULONG I = 0; RING_STRESS_PRODUCERS + RING_STRESS_CONSUMERS > I; I++)
+    {
+        Data[I].Ring = Ring;
+        Data[I].SlotCount = SlotCount;
+        Data[I].Index = I;
+        Data[I].Seen = Seen;
+        Data[I].Consumed = &Consumed;
+        Threads[I] = (HANDLE)_beginthreadex(0, 0,
+            RING_STRESS_PRODUCERS > I ? transact_ring_stress_producer : transact_ring_stress_consumer,
+            &Data[I], 0, 0);
+        ASSERT(0 != Threads[I]);
+    }
+
+    WaitForMultipleObjects(RING_STRESS_PRODUCERS + RING_STRESS_CONSUMERS, Threads, TRUE, INFINITE);
+    for (ULONG I = 0; RING_STRESS_PRODUCERS + RING_STRESS_CONSUMERS > I; I++)
+        CloseHandle(Threads[I]);
+
+    ASSERT(RING_STRESS_PRODUCERS * RING_STRESS_COUNT == Consumed);
+    for (ULONG I = 0; RING_STRESS_PRODUCERS * RING_STRESS_COUNT > I; I++)
+        ASSERT(1 == Seen[I]);
+    ASSERT(0 == Seen[RING_STRESS_PRODUCERS * RING_STRESS_COUNT]);
+
+    ASSERT(FspFsctlTransactRingCanProduce(Ring, SlotCount, FspFsctlTransactRingResponseQueue));
+    ASSERT(!FspFsctlTransactRingCanConsume(Ring, SlotCount, FspFsctlTransactRingResponseQueue));
+
+    free((PVOID)Seen);
+    transact_ring_free(Ring);
+}
+
+static void transact_ring_stress_test(void)
+{
+    transact_ring_stress_dotest(FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MIN);
+    transact_ring_stress_dotest(FSP_FSCTL_TRANSACT_RING_SLOTCOUNT_MAX);
+}
+
+static void transact_ring_memfs_dotest(ULONG Flags, PWSTR Prefix)
+{
+    MEMFS *Memfs;
+    NTSTATUS Result;
+    WCHAR FilePath[MAX_PATH];
+    HANDLE Handle;
+    BOOL Success;
+    UINT8 Buffer[512];
+    DWORD BytesTransferred;
+
+    Result = MemfsCreate(
+        (OptCaseInsensitive ? MemfsCaseInsensitive : 0) | Flags,
+        1000,
+        1024,
+        1024 * 1024,
+        MemfsNet == Flags ? L"\\memfs\\share" : 0,
+        0,
+        &Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    FspFileSystemSetTransactRing(MemfsFileSystem(Memfs), 32);
+
+    Result = MemfsStart(Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    for (ULONG I = 0; 100 > I; I++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\file%u",
+            Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : MemfsFileSystem(Memfs)->VolumeName,
+            I);
+
+        Handle = CreateFileW(FilePath,
+            GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+            CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+
+        memset(Buffer, (UINT8)I, sizeof Buffer);
+        Success = WriteFile(Handle, Buffer, sizeof Buffer, &BytesTransferred, 0);
+        ASSERT(Success);
+        ASSERT(sizeof Buffer == BytesTransferred);
+
+        SetFilePointer(Handle, 0, 0, FILE_BEGIN);
+        memset(Buffer, 0, sizeof Buffer);
+        Success = ReadFile(Handle, Buffer, sizeof Buffer, &BytesTransferred, 0);
+        ASSERT(Success);
+        ASSERT(sizeof Buffer == BytesTransferred);
+        ASSERT((UINT8)I == Buffer[0] && (UINT8)I == Buffer[sizeof Buffer - 1]);
+
+        CloseHandle(Handle);
+    }
+
+    MemfsStop(Memfs);
+    MemfsDelete(Memfs);
+}
+
+static void transact_ring_memfs_test(void)
+{
+    if (WinFspDiskTests)
+        transact_ring_memfs_dotest(MemfsDisk, 0);
+    if (WinFspNetTests)
+        transact_ring_memfs_dotest(MemfsNet, L"\\\\memfs\\share");
+}
+
+void transact_ring_tests(void)
+{
+    TEST(transact_ring_slotcount_test);
+    TEST(transact_ring_fifo_test);
+    TEST(transact_ring_stress_test);
+    if (!OptExternal && !OptMountPoint)
+        TEST(transact_ring_memfs_test);
+}
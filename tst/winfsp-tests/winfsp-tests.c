@@ -185,6 +185,7 @@ int main(int argc, char *argv[])
     TESTSUITE(eventlog_tests);
     TESTSUITE(path_tests);
     TESTSUITE(dirbuf_tests);
+    TESTSUITE(transact_ring_tests);
     TESTSUITE(version_tests);
     TESTSUITE(mount_tests);
     TESTSUITE(timeout_tests);
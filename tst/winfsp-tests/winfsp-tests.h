@@ -137,6 +137,7 @@ void *memfs_start_ex(ULONG Flags, ULONG FileInfoTimeout);
 void *memfs_start(ULONG Flags);
 void memfs_stop(void *data);
 PWSTR memfs_volumename(void *data);
+void memfs_get_statistics(HANDLE Handle, FSP_FSCTL_STATISTICS *Statistics);
 
 int mywcscmp(PWSTR a, int alen, PWSTR b, int blen);
 int myrand(void);